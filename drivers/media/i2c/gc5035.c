@@ -21,12 +21,19 @@
 #include <media/v4l2-fwnode.h>
 #include <media/v4l2-subdev.h>
 
+#include "sensor_reg_burst.h"
+#include "sensor_i2c_stats.h"
+#include "sensor_mode_fw.h"
+
 /* External clock frequency supported by the driver */
 #define GC5035_MCLK_RATE				24000000UL
 /* Number of lanes supported by this driver */
 #define GC5035_DATA_LANES				2
 /* Bits per sample of sensor output */
 #define GC5035_BITS_PER_SAMPLE				10
+/* CSI-2 data types of the image and of the embedded data lines */
+#define GC5035_CSI2_DT_RAW10				0x2b
+#define GC5035_CSI2_DT_EMBEDDED				0x12
 
 #define MIPI_FREQ		438000000LL
 
@@ -237,6 +244,12 @@ struct gc5035 {
 	struct gc5035_power_ctrl power;
 	bool streaming;
 	const struct gc5035_mode *cur_mode;
+
+	/* I2C timing of the register helpers */
+	struct sensor_i2c_stats i2c_stats;
+
+	/* Mode register lists from firmware, if any */
+	struct sensor_mode_fw mode_fw;
 };
 
 static inline struct gc5035 *to_gc5035(struct v4l2_subdev *sd)
@@ -1069,7 +1082,7 @@ static void gc5035_set_power(struct gc5035 *gc5035, int on)
 	/* First, set reset pin as low */
 	if (power->reset_gpio) {
 		gpiod_set_value_cansleep(power->reset_gpio, 0);
-		msleep(5);
+		usleep_range(5000, 5500);
 	}
 
 	/* Use _DSM of INT3472 to enable clock */
@@ -1096,37 +1109,53 @@ static void gc5035_set_power(struct gc5035 *gc5035, int on)
 	/* If we need to power on, set reset pin to high at last */
 	if (on && power->reset_gpio) {
 		gpiod_set_value_cansleep(power->reset_gpio, 1);
-		msleep(5);
+		usleep_range(5000, 5500);
 	}
 	power->status = on;
 }
 
 static int gc5035_write_reg(struct gc5035 *gc5035, u8 reg, u8 val)
 {
-	return i2c_smbus_write_byte_data(gc5035->client, reg, val);
+	u64 start = ktime_get_ns();
+	int ret;
+
+	ret = i2c_smbus_write_byte_data(gc5035->client, reg, val);
+	sensor_i2c_stats_add(&gc5035->i2c_stats, SENSOR_I2C_WRITE, 2, start);
+
+	return ret;
 }
 
 static int gc5035_write_array(struct gc5035 *gc5035,
 			      const struct gc5035_regval *regs,
 			      size_t num_regs)
 {
+	struct sensor_reg_burst burst;
 	unsigned int i;
 	int ret;
+	u64 start;
 
+	start = ktime_get_ns();
+	sensor_reg_burst_init(&burst, gc5035->client, 1, 1);
 	for (i = 0; i < num_regs; i++) {
-		ret = gc5035_write_reg(gc5035, regs[i].addr, regs[i].val);
+		ret = sensor_reg_burst_add(&burst, regs[i].addr, regs[i].val);
 		if (ret)
 			return ret;
 	}
 
-	return 0;
+	ret = sensor_reg_burst_flush(&burst);
+	sensor_i2c_stats_add(&gc5035->i2c_stats, SENSOR_I2C_LIST, burst.sent,
+			     start);
+
+	return ret;
 }
 
 static int gc5035_read_reg(struct gc5035 *gc5035, u8 reg, u8 *val)
 {
+	u64 start = ktime_get_ns();
 	int ret;
 
 	ret = i2c_smbus_read_byte_data(gc5035->client, reg);
+	sensor_i2c_stats_add(&gc5035->i2c_stats, SENSOR_I2C_READ, 2, start);
 	if (ret < 0)
 		return ret;
 
@@ -1567,12 +1596,51 @@ static int gc5035_enum_frame_sizes(struct v4l2_subdev *sd,
 	return 0;
 }
 
+/*
+ * The image, and the embedded data lines when the mode firmware turns
+ * them on, both on virtual channel 0.
+ */
+static int gc5035_get_frame_desc(struct v4l2_subdev *sd, unsigned int pad,
+				 struct v4l2_mbus_frame_desc *fd)
+{
+	struct gc5035 *gc5035 = to_gc5035(sd);
+	const struct sensor_mode_fw_regs *fw_regs;
+	const struct gc5035_mode *mode;
+
+	memset(fd, 0, sizeof(*fd));
+	fd->type = V4L2_MBUS_FRAME_DESC_TYPE_CSI2;
+
+	mutex_lock(&gc5035->mutex);
+	mode = gc5035->cur_mode;
+	fd->entry[0].pixelcode = MEDIA_BUS_FMT_SGRBG10_1X10;
+	fd->entry[0].length = mode->width * mode->height *
+			      GC5035_BITS_PER_SAMPLE / 8;
+	fd->entry[0].bus.csi2.dt = GC5035_CSI2_DT_RAW10;
+	fd->num_entries = 1;
+
+	fw_regs = sensor_mode_fw_find(&gc5035->mode_fw, mode->width,
+				      mode->height);
+	if (fw_regs && fw_regs->embedded_lines) {
+		fd->entry[1].pixelcode = MEDIA_BUS_FMT_FIXED;
+		fd->entry[1].length = fw_regs->embedded_lines *
+				      fw_regs->embedded_bpl;
+		fd->entry[1].bus.csi2.dt = GC5035_CSI2_DT_EMBEDDED;
+		fd->num_entries = 2;
+	}
+	mutex_unlock(&gc5035->mutex);
+
+	return 0;
+}
+
 static int __gc5035_start_stream(struct gc5035 *gc5035)
 {
+	const struct sensor_mode_fw_regs *fw_regs;
+	u64 start;
 	int ret;
 
 	gc5035_set_power(gc5035, 1);
 
+	start = ktime_get_ns();
 	ret = gc5035_write_array(gc5035, gc5035_global_regs,
 				 ARRAY_SIZE(gc5035_global_regs));
 	if (ret)
@@ -1582,10 +1650,22 @@ static int __gc5035_start_stream(struct gc5035 *gc5035)
 	if (ret)
 		return ret;
 
-	ret = gc5035_write_array(gc5035, gc5035->cur_mode->reg_list,
-				 gc5035->cur_mode->num_regs);
+	fw_regs = sensor_mode_fw_find(&gc5035->mode_fw, gc5035->cur_mode->width,
+				      gc5035->cur_mode->height);
+	if (fw_regs) {
+		u64 list_start = ktime_get_ns();
+
+		ret = sensor_mode_fw_write(&gc5035->mode_fw, fw_regs);
+		sensor_i2c_stats_add(&gc5035->i2c_stats, SENSOR_I2C_LIST,
+				     gc5035->mode_fw.sent, list_start);
+	} else {
+		ret = gc5035_write_array(gc5035, gc5035->cur_mode->reg_list,
+					 gc5035->cur_mode->num_regs);
+	}
 	if (ret)
 		return ret;
+	sensor_i2c_stats_mode(&gc5035->i2c_stats, gc5035->cur_mode->width,
+			      gc5035->cur_mode->height, start);
 
 	/* In case these controls are set before streaming */
 	ret = __v4l2_ctrl_handler_setup(&gc5035->ctrl_handler);
@@ -1719,6 +1799,7 @@ static const struct v4l2_subdev_pad_ops gc5035_pad_ops = {
 	.enum_frame_size = gc5035_enum_frame_sizes,
 	.get_fmt = gc5035_get_fmt,
 	.set_fmt = gc5035_set_fmt,
+	.get_frame_desc = gc5035_get_frame_desc,
 };
 
 static const struct v4l2_subdev_ops gc5035_subdev_ops = {
@@ -2063,6 +2144,10 @@ static int gc5035_probe(struct i2c_client *client)
 		return -ENOMEM;
 
 	gc5035->client = client;
+	ret = sensor_i2c_stats_init(&gc5035->i2c_stats, dev);
+	if (ret)
+		return ret;
+
 	gc5035_init_power_ctrl(gc5035);
 	gc5035_set_power(gc5035, 1);
 	
@@ -2088,6 +2173,8 @@ static int gc5035_probe(struct i2c_client *client)
 	if (ret)
 		return dev_err_probe(dev, ret, "Failed to get regulators\n");
     
+	sensor_mode_fw_load(&gc5035->mode_fw, client, "gc5035-modes.bin", 1);
+
 	mutex_init(&gc5035->mutex);
 	sd = &gc5035->subdev;
 	v4l2_i2c_subdev_init(sd, client, &gc5035_subdev_ops);
@@ -2123,6 +2210,7 @@ static int gc5035_probe(struct i2c_client *client)
 	}
 
 	pm_runtime_set_active(dev);
+	device_enable_async_suspend(dev);
 	pm_runtime_enable(dev);
 	pm_runtime_idle(dev);
 	gc5035_set_power(gc5035, 0);
@@ -2183,6 +2271,7 @@ MODULE_DEVICE_TABLE(of, gc5035_of_match);
 static struct i2c_driver gc5035_i2c_driver = {
 	.driver = {
 		.name = "gc5035",
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 		.pm = &gc5035_pm_ops,
 		.acpi_match_table = ACPI_PTR(gc5035_acpi_ids),
 		.of_match_table = gc5035_of_match,
@@ -12,6 +12,11 @@
 #include <media/v4l2-ctrls.h>
 #include <media/v4l2-device.h>
 #include <media/v4l2-fwnode.h>
+
+#include "sensor_reg_burst.h"
+#include "sensor_reg_shadow.h"
+#include "sensor_i2c_stats.h"
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 6, 0) && \
     IS_ENABLED(CONFIG_INTEL_VSC)
 #include <linux/vsc.h>
@@ -41,6 +46,9 @@ static const struct acpi_device_id cvfd_ids[] = {
 #define HI556_MODE_STANDBY		0x0000
 #define HI556_MODE_STREAMING		0x0100
 
+/* Keep the sensor powered and its mode retained after stream off */
+#define HI556_AUTOSUSPEND_DELAY_MS	1000
+
 /* vertical-timings from sensor */
 #define HI556_REG_FLL			0x0006
 #define HI556_FLL_30FPS			0x0814
@@ -525,12 +533,21 @@ struct hi556 {
 	/* Streaming on/off */
 	bool streaming;
 
+	/* Registers written since power up */
+	struct sensor_reg_shadow shadow;
+
+	/* Mode still programmed in standby, NULL once powered off */
+	const struct hi556_mode *retained;
+
 	/* True if the device has been identified */
 	bool identified;
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 6, 0) && \
     IS_ENABLED(CONFIG_INTEL_VSC)
 	bool use_intel_vsc;
 #endif
+
+	/* I2C timing of the register helpers */
+	struct sensor_i2c_stats i2c_stats;
 };
 
 static u64 to_pixel_rate(u32 f_index)
@@ -549,6 +566,7 @@ static int hi556_read_reg(struct hi556 *hi556, u16 reg, u16 len, u32 *val)
 	u8 addr_buf[2];
 	u8 data_buf[4] = {0};
 	int ret;
+	u64 start;
 
 	if (len > 4)
 		return -EINVAL;
@@ -563,7 +581,10 @@ static int hi556_read_reg(struct hi556 *hi556, u16 reg, u16 len, u32 *val)
 	msgs[1].len = len;
 	msgs[1].buf = &data_buf[4 - len];
 
+	start = ktime_get_ns();
 	ret = i2c_transfer(client->adapter, msgs, ARRAY_SIZE(msgs));
+	sensor_i2c_stats_add(&hi556->i2c_stats, SENSOR_I2C_READ,
+			     msgs[0].len + len, start);
 	if (ret != ARRAY_SIZE(msgs))
 		return -EIO;
 
@@ -576,14 +597,23 @@ static int hi556_write_reg(struct hi556 *hi556, u16 reg, u16 len, u32 val)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(&hi556->sd);
 	u8 buf[6];
+	u64 start;
+	int ret;
 
 	if (len > 4)
 		return -EINVAL;
 
 	put_unaligned_be16(reg, buf);
 	put_unaligned_be32(val << 8 * (4 - len), buf + 2);
-	if (i2c_master_send(client, buf, len + 2) != len + 2)
+	start = ktime_get_ns();
+	ret = i2c_master_send(client, buf, len + 2);
+	sensor_i2c_stats_add(&hi556->i2c_stats, SENSOR_I2C_WRITE, len + 2,
+			     start);
+	if (ret != len + 2) {
+		sensor_reg_shadow_reset(&hi556->shadow);
 		return -EIO;
+	}
+	sensor_reg_shadow_write(&hi556->shadow, reg, len, val);
 
 	return 0;
 }
@@ -592,22 +622,44 @@ static int hi556_write_reg_list(struct hi556 *hi556,
 				const struct hi556_reg_list *r_list)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(&hi556->sd);
+	struct sensor_reg_burst burst;
 	unsigned int i;
 	int ret;
+	u64 start;
 
+	start = ktime_get_ns();
+	sensor_reg_burst_init(&burst, client, 2, 2);
 	for (i = 0; i < r_list->num_of_regs; i++) {
-		ret = hi556_write_reg(hi556, r_list->regs[i].address,
-				      HI556_REG_VALUE_16BIT,
-				      r_list->regs[i].val);
-		if (ret) {
-			dev_err_ratelimited(&client->dev,
-					    "failed to write reg 0x%4.4x. error = %d",
-					    r_list->regs[i].address, ret);
-			return ret;
-		}
+		ret = sensor_reg_burst_add(&burst, r_list->regs[i].address,
+					   r_list->regs[i].val);
+		if (ret)
+			goto err;
+		sensor_reg_shadow_write(&hi556->shadow,
+					r_list->regs[i].address, 2,
+					r_list->regs[i].val);
 	}
 
-	return 0;
+	ret = sensor_reg_burst_flush(&burst);
+	sensor_i2c_stats_add(&hi556->i2c_stats, SENSOR_I2C_LIST, burst.sent,
+			     start);
+	if (!ret)
+		return 0;
+
+err:
+	sensor_reg_shadow_reset(&hi556->shadow);
+	dev_err_ratelimited(&client->dev,
+			    "failed to write reg 0x%4.4x. error = %d",
+			    burst.start, ret);
+	return ret;
+}
+
+/* Only for registers the sensor never changes by itself */
+static int hi556_read_cached(struct hi556 *hi556, u16 reg, u16 len, u32 *val)
+{
+	if (sensor_reg_shadow_read(&hi556->shadow, reg, len, val))
+		return 0;
+
+	return hi556_read_reg(hi556, reg, len, val);
 }
 
 static int hi556_update_digital_gain(struct hi556 *hi556, u32 d_gain)
@@ -639,8 +691,8 @@ static int hi556_test_pattern(struct hi556 *hi556, u32 pattern)
 	u32 val;
 
 	if (pattern) {
-		ret = hi556_read_reg(hi556, HI556_REG_ISP,
-				     HI556_REG_VALUE_08BIT, &val);
+		ret = hi556_read_cached(hi556, HI556_REG_ISP,
+					HI556_REG_VALUE_08BIT, &val);
 		if (ret)
 			return ret;
 
@@ -852,24 +904,34 @@ static int hi556_start_streaming(struct hi556 *hi556)
 	struct i2c_client *client = v4l2_get_subdevdata(&hi556->sd);
 	const struct hi556_reg_list *reg_list;
 	int link_freq_index, ret;
+	u64 start;
 
-	ret = hi556_identify_module(hi556);
-	if (ret)
-		return ret;
+	if (hi556->retained != hi556->cur_mode) {
+		hi556->retained = NULL;
 
-	link_freq_index = hi556->cur_mode->link_freq_index;
-	reg_list = &link_freq_configs[link_freq_index].reg_list;
-	ret = hi556_write_reg_list(hi556, reg_list);
-	if (ret) {
-		dev_err(&client->dev, "failed to set plls");
-		return ret;
-	}
+		ret = hi556_identify_module(hi556);
+		if (ret)
+			return ret;
 
-	reg_list = &hi556->cur_mode->reg_list;
-	ret = hi556_write_reg_list(hi556, reg_list);
-	if (ret) {
-		dev_err(&client->dev, "failed to set mode");
-		return ret;
+		link_freq_index = hi556->cur_mode->link_freq_index;
+		reg_list = &link_freq_configs[link_freq_index].reg_list;
+		start = ktime_get_ns();
+		ret = hi556_write_reg_list(hi556, reg_list);
+		if (ret) {
+			dev_err(&client->dev, "failed to set plls");
+			return ret;
+		}
+
+		reg_list = &hi556->cur_mode->reg_list;
+		ret = hi556_write_reg_list(hi556, reg_list);
+		if (ret) {
+			dev_err(&client->dev, "failed to set mode");
+			return ret;
+		}
+		sensor_i2c_stats_mode(&hi556->i2c_stats,
+				      hi556->cur_mode->width,
+				      hi556->cur_mode->height, start);
+		hi556->retained = hi556->cur_mode;
 	}
 
 	ret = __v4l2_ctrl_handler_setup(hi556->sd.ctrl_handler);
@@ -921,7 +983,8 @@ static int hi556_set_stream(struct v4l2_subdev *sd, int enable)
 		}
 	} else {
 		hi556_stop_streaming(hi556);
-		pm_runtime_put(&client->dev);
+		pm_runtime_mark_last_busy(&client->dev);
+		pm_runtime_put_autosuspend(&client->dev);
 	}
 
 	hi556->streaming = enable;
@@ -936,6 +999,9 @@ static int hi556_power_off(struct device *dev)
 	struct hi556 *hi556 = to_hi556(sd);
 	int ret = 0;
 
+	sensor_reg_shadow_reset(&hi556->shadow);
+	hi556->retained = NULL;
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 6, 0) && \
     IS_ENABLED(CONFIG_INTEL_VSC)
 	if (hi556->use_intel_vsc) {
@@ -1015,6 +1081,8 @@ static int __maybe_unused hi556_suspend(struct device *dev)
 	mutex_lock(&hi556->mutex);
 	if (hi556->streaming)
 		hi556_stop_streaming(hi556);
+	sensor_reg_shadow_reset(&hi556->shadow);
+	hi556->retained = NULL;
 
 	mutex_unlock(&hi556->mutex);
 
@@ -1356,6 +1424,8 @@ static void hi556_remove(struct i2c_client *client)
 	media_entity_cleanup(&sd->entity);
 	v4l2_ctrl_handler_free(sd->ctrl_handler);
 	pm_runtime_disable(&client->dev);
+	sensor_reg_shadow_reset(&hi556->shadow);
+	pm_runtime_dont_use_autosuspend(&client->dev);
 	mutex_destroy(&hi556->mutex);
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 1, 0)
@@ -1382,6 +1452,9 @@ static int hi556_probe(struct i2c_client *client)
 	}
 
 	v4l2_i2c_subdev_init(&hi556->sd, client, &hi556_subdev_ops);
+	ret = sensor_i2c_stats_init(&hi556->i2c_stats, &client->dev);
+	if (ret)
+		return ret;
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 17, 0)
 	full_power = acpi_dev_state_d0(&client->dev);
@@ -1406,6 +1479,7 @@ static int hi556_probe(struct i2c_client *client)
 	}
 
 	mutex_init(&hi556->mutex);
+	sensor_reg_shadow_init(&hi556->shadow);
 	hi556->cur_mode = &supported_modes[0];
 	ret = hi556_init_controls(hi556);
 	if (ret) {
@@ -1434,6 +1508,10 @@ static int hi556_probe(struct i2c_client *client)
 	/* Set the device's state to active if it's in D0 state. */
 	if (full_power)
 		pm_runtime_set_active(&client->dev);
+	pm_runtime_set_autosuspend_delay(&client->dev,
+					 HI556_AUTOSUSPEND_DELAY_MS);
+	pm_runtime_use_autosuspend(&client->dev);
+	device_enable_async_suspend(&client->dev);
 	pm_runtime_enable(&client->dev);
 	pm_runtime_idle(&client->dev);
 
@@ -1468,6 +1546,7 @@ MODULE_DEVICE_TABLE(acpi, hi556_acpi_ids);
 static struct i2c_driver hi556_i2c_driver = {
 	.driver = {
 		.name = "hi556",
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 		.pm = &hi556_pm_ops,
 		.acpi_match_table = ACPI_PTR(hi556_acpi_ids),
 	},
@@ -17,6 +17,9 @@
 #elif IS_ENABLED(CONFIG_POWER_CTRL_LOGIC)
 #include "power_ctrl_logic.h"
 #endif
+#include "sensor_reg_burst.h"
+#include "sensor_group_hold.h"
+#include "sensor_i2c_stats.h"
 
 #define HM11B1_LINK_FREQ_384MHZ		384000000ULL
 #define HM11B1_SCLK			72000000LL
@@ -31,6 +34,9 @@
 #define HM11B1_MODE_STANDBY		0x00
 #define HM11B1_MODE_STREAMING		0x01
 
+/* Keep the sensor powered and its mode retained after stream off */
+#define HM11B1_AUTOSUSPEND_DELAY_MS	1000
+
 /* vertical-timings from sensor */
 #define HM11B1_REG_VTS			0x3402
 #define HM11B1_VTS_DEF			0x037d
@@ -460,6 +466,9 @@ struct hm11b1 {
 	/* To serialize asynchronus callbacks */
 	struct mutex mutex;
 
+	/* Control writes waiting for one group launch, under mutex */
+	struct sensor_group_hold hold;
+
 	/* i2c client */
 	struct i2c_client *client;
 
@@ -474,6 +483,12 @@ struct hm11b1 {
 
 	/* Streaming on/off */
 	bool streaming;
+
+	/* Mode still programmed in standby, NULL once powered off */
+	const struct hm11b1_mode *retained;
+
+	/* I2C timing of the register helpers */
+	struct sensor_i2c_stats i2c_stats;
 };
 
 static inline struct hm11b1 *to_hm11b1(struct v4l2_subdev *subdev)
@@ -506,6 +521,7 @@ static int hm11b1_read_reg(struct hm11b1 *hm11b1, u16 reg, u16 len, u32 *val)
 	u8 addr_buf[2];
 	u8 data_buf[4] = {0};
 	int ret = 0;
+	u64 start;
 
 	if (len > sizeof(data_buf))
 		return -EINVAL;
@@ -520,7 +536,10 @@ static int hm11b1_read_reg(struct hm11b1 *hm11b1, u16 reg, u16 len, u32 *val)
 	msgs[1].len = len;
 	msgs[1].buf = &data_buf[sizeof(data_buf) - len];
 
+	start = ktime_get_ns();
 	ret = i2c_transfer(client->adapter, msgs, ARRAY_SIZE(msgs));
+	sensor_i2c_stats_add(&hm11b1->i2c_stats, SENSOR_I2C_READ,
+			     msgs[0].len + len, start);
 	if (ret != ARRAY_SIZE(msgs))
 		return ret < 0 ? ret : -EIO;
 
@@ -534,6 +553,7 @@ static int hm11b1_write_reg(struct hm11b1 *hm11b1, u16 reg, u16 len, u32 val)
 	struct i2c_client *client = hm11b1->client;
 	u8 buf[6];
 	int ret = 0;
+	u64 start;
 
 	if (len > 4)
 		return -EINVAL;
@@ -541,7 +561,10 @@ static int hm11b1_write_reg(struct hm11b1 *hm11b1, u16 reg, u16 len, u32 val)
 	put_unaligned_be16(reg, buf);
 	put_unaligned_be32(val << 8 * (4 - len), buf + 2);
 
+	start = ktime_get_ns();
 	ret = i2c_master_send(client, buf, len + 2);
+	sensor_i2c_stats_add(&hm11b1->i2c_stats, SENSOR_I2C_WRITE, len + 2,
+			     start);
 	if (ret != len + 2)
 		return ret < 0 ? ret : -EIO;
 
@@ -552,21 +575,31 @@ static int hm11b1_write_reg_list(struct hm11b1 *hm11b1,
 				 const struct hm11b1_reg_list *r_list)
 {
 	struct i2c_client *client = hm11b1->client;
+	struct sensor_reg_burst burst;
 	unsigned int i;
-	int ret = 0;
+	int ret;
+	u64 start;
 
+	start = ktime_get_ns();
+	sensor_reg_burst_init(&burst, client, 2, 1);
 	for (i = 0; i < r_list->num_of_regs; i++) {
-		ret = hm11b1_write_reg(hm11b1, r_list->regs[i].address, 1,
-				       r_list->regs[i].val);
-		if (ret) {
-			dev_err_ratelimited(&client->dev,
-					    "write reg 0x%4.4x return err = %d",
-					    r_list->regs[i].address, ret);
-			return ret;
-		}
+		ret = sensor_reg_burst_add(&burst, r_list->regs[i].address,
+					   r_list->regs[i].val);
+		if (ret)
+			goto err;
 	}
 
-	return 0;
+	ret = sensor_reg_burst_flush(&burst);
+	sensor_i2c_stats_add(&hm11b1->i2c_stats, SENSOR_I2C_LIST, burst.sent,
+			     start);
+	if (!ret)
+		return 0;
+
+err:
+	dev_err_ratelimited(&client->dev,
+			    "write reg 0x%4.4x return err = %d",
+			    burst.start, ret);
+	return ret;
 }
 
 static int hm11b1_update_digital_gain(struct hm11b1 *hm11b1, u32 d_gain)
@@ -598,6 +631,25 @@ static int hm11b1_test_pattern(struct hm11b1 *hm11b1, u32 pattern)
 	return hm11b1_write_reg(hm11b1, HM11B1_REG_TEST_PATTERN, 1, pattern);
 }
 
+static int hm11b1_group_hold(struct sensor_group_hold *g)
+{
+	struct hm11b1 *hm11b1 = container_of(g, struct hm11b1, hold);
+
+	return hm11b1_write_reg(hm11b1, HM11B1_REG_COMMAND_UPDATE, 1, 1);
+}
+
+static int hm11b1_group_launch(struct sensor_group_hold *g)
+{
+	struct hm11b1 *hm11b1 = container_of(g, struct hm11b1, hold);
+
+	return hm11b1_write_reg(hm11b1, HM11B1_REG_COMMAND_UPDATE, 1, 0);
+}
+
+static const struct sensor_group_hold_ops hm11b1_group_hold_ops = {
+	.hold = hm11b1_group_hold,
+	.launch = hm11b1_group_launch,
+};
+
 static int hm11b1_set_ctrl(struct v4l2_ctrl *ctrl)
 {
 	struct hm11b1 *hm11b1 = container_of(ctrl->handler,
@@ -621,7 +673,7 @@ static int hm11b1_set_ctrl(struct v4l2_ctrl *ctrl)
 	if (!pm_runtime_get_if_in_use(&client->dev))
 		return 0;
 
-	ret = hm11b1_write_reg(hm11b1, HM11B1_REG_COMMAND_UPDATE, 1, 1);
+	ret = sensor_group_hold_begin(&hm11b1->hold);
 	if (ret) {
 		dev_err(&client->dev, "failed to enable HM11B1_REG_COMMAND_UPDATE");
 		pm_runtime_put(&client->dev);
@@ -659,7 +711,6 @@ static int hm11b1_set_ctrl(struct v4l2_ctrl *ctrl)
 		break;
 	}
 
-	ret |= hm11b1_write_reg(hm11b1, HM11B1_REG_COMMAND_UPDATE, 1, 0);
 	pm_runtime_put(&client->dev);
 
 	return ret;
@@ -753,26 +804,40 @@ static int hm11b1_start_streaming(struct hm11b1 *hm11b1)
 	const struct hm11b1_reg_list *reg_list;
 	int link_freq_index;
 	int ret = 0;
+	u64 start;
 
-	link_freq_index = hm11b1->cur_mode->link_freq_index;
-	reg_list = &link_freq_configs[link_freq_index].reg_list;
-	ret = hm11b1_write_reg_list(hm11b1, reg_list);
-	if (ret) {
-		dev_err(&client->dev, "failed to set plls");
-		return ret;
-	}
+	if (hm11b1->retained != hm11b1->cur_mode) {
+		hm11b1->retained = NULL;
 
-	reg_list = &hm11b1->cur_mode->reg_list;
-	ret = hm11b1_write_reg_list(hm11b1, reg_list);
-	if (ret) {
-		dev_err(&client->dev, "failed to set mode");
-		return ret;
+		link_freq_index = hm11b1->cur_mode->link_freq_index;
+		reg_list = &link_freq_configs[link_freq_index].reg_list;
+		start = ktime_get_ns();
+		ret = hm11b1_write_reg_list(hm11b1, reg_list);
+		if (ret) {
+			dev_err(&client->dev, "failed to set plls");
+			return ret;
+		}
+
+		reg_list = &hm11b1->cur_mode->reg_list;
+		ret = hm11b1_write_reg_list(hm11b1, reg_list);
+		if (ret) {
+			dev_err(&client->dev, "failed to set mode");
+			return ret;
+		}
+		sensor_i2c_stats_mode(&hm11b1->i2c_stats,
+				      hm11b1->cur_mode->width,
+				      hm11b1->cur_mode->height, start);
+		hm11b1->retained = hm11b1->cur_mode;
 	}
 
 	ret = __v4l2_ctrl_handler_setup(hm11b1->sd.ctrl_handler);
 	if (ret)
 		return ret;
 
+	ret = sensor_group_hold_launch(&hm11b1->hold);
+	if (ret)
+		return ret;
+
 	ret = hm11b1_write_reg(hm11b1, HM11B1_REG_MODE_SELECT, 1,
 			       HM11B1_MODE_STREAMING);
 	if (ret)
@@ -785,6 +850,9 @@ static void hm11b1_stop_streaming(struct hm11b1 *hm11b1)
 {
 	struct i2c_client *client = hm11b1->client;
 
+	/* An open group would capture the stream off write */
+	sensor_group_hold_launch(&hm11b1->hold);
+
 	if (hm11b1_write_reg(hm11b1, HM11B1_REG_MODE_SELECT, 1,
 			     HM11B1_MODE_STANDBY))
 		dev_err(&client->dev, "failed to stop streaming");
@@ -816,7 +884,8 @@ static int hm11b1_set_stream(struct v4l2_subdev *sd, int enable)
 		}
 	} else {
 		hm11b1_stop_streaming(hm11b1);
-		pm_runtime_put(&client->dev);
+		pm_runtime_mark_last_busy(&client->dev);
+		pm_runtime_put_autosuspend(&client->dev);
 	}
 
 	hm11b1->streaming = enable;
@@ -831,6 +900,8 @@ static int hm11b1_power_off(struct device *dev)
 	struct hm11b1 *hm11b1 = to_hm11b1(sd);
 	int ret = 0;
 
+	hm11b1->retained = NULL;
+
 #if IS_ENABLED(CONFIG_INTEL_SKL_INT3472)
 	gpiod_set_value_cansleep(hm11b1->reset_gpio, 1);
 	gpiod_set_value_cansleep(hm11b1->powerdown_gpio, 1);
@@ -870,6 +941,7 @@ static int __maybe_unused hm11b1_suspend(struct device *dev)
 	mutex_lock(&hm11b1->mutex);
 	if (hm11b1->streaming)
 		hm11b1_stop_streaming(hm11b1);
+	hm11b1->retained = NULL;
 
 	mutex_unlock(&hm11b1->mutex);
 
@@ -1152,8 +1224,10 @@ static void hm11b1_remove(struct i2c_client *client)
 
 	v4l2_async_unregister_subdev(sd);
 	media_entity_cleanup(&sd->entity);
+	sensor_group_hold_cancel(&hm11b1->hold);
 	v4l2_ctrl_handler_free(sd->ctrl_handler);
 	pm_runtime_disable(&client->dev);
+	pm_runtime_dont_use_autosuspend(&client->dev);
 	mutex_destroy(&hm11b1->mutex);
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 1, 0)
@@ -1214,6 +1288,9 @@ static int hm11b1_probe(struct i2c_client *client)
 	hm11b1->client = client;
 
 	v4l2_i2c_subdev_init(&hm11b1->sd, client, &hm11b1_subdev_ops);
+	ret = sensor_i2c_stats_init(&hm11b1->i2c_stats, &client->dev);
+	if (ret)
+		return ret;
 
 #if IS_ENABLED(CONFIG_INTEL_SKL_INT3472)
 	ret = hm11b1_parse_power(hm11b1);
@@ -1235,6 +1312,8 @@ static int hm11b1_probe(struct i2c_client *client)
 	}
 
 	mutex_init(&hm11b1->mutex);
+	sensor_group_hold_init(&hm11b1->hold, &client->dev, &hm11b1->mutex,
+			       &hm11b1_group_hold_ops);
 	hm11b1->cur_mode = &supported_modes[0];
 	ret = hm11b1_init_controls(hm11b1);
 	if (ret) {
@@ -1269,6 +1348,10 @@ static int hm11b1_probe(struct i2c_client *client)
 	 * Enable runtime PM and turn off the device.
 	 */
 	pm_runtime_set_active(&client->dev);
+	pm_runtime_set_autosuspend_delay(&client->dev,
+					 HM11B1_AUTOSUSPEND_DELAY_MS);
+	pm_runtime_use_autosuspend(&client->dev);
+	device_enable_async_suspend(&client->dev);
 	pm_runtime_enable(&client->dev);
 	pm_runtime_idle(&client->dev);
 
@@ -1278,6 +1361,7 @@ probe_error_media_entity_cleanup:
 	media_entity_cleanup(&hm11b1->sd.entity);
 
 probe_error_v4l2_ctrl_handler_free:
+	sensor_group_hold_cancel(&hm11b1->hold);
 	v4l2_ctrl_handler_free(hm11b1->sd.ctrl_handler);
 	mutex_destroy(&hm11b1->mutex);
 
@@ -1304,6 +1388,7 @@ MODULE_DEVICE_TABLE(acpi, hm11b1_acpi_ids);
 static struct i2c_driver hm11b1_i2c_driver = {
 	.driver = {
 		.name = "hm11b1",
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 		.pm = &hm11b1_pm_ops,
 		.acpi_match_table = ACPI_PTR(hm11b1_acpi_ids),
 	},
@@ -13,6 +13,11 @@
 #include <media/v4l2-ctrls.h>
 #include <media/v4l2-device.h>
 #include <media/v4l2-fwnode.h>
+#include "sensor_reg_burst.h"
+#include "sensor_reg_shadow.h"
+#include "sensor_group_hold.h"
+#include "sensor_i2c_stats.h"
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 6, 0) && \
     IS_ENABLED(CONFIG_INTEL_VSC)
 #include <linux/vsc.h>
@@ -26,6 +31,9 @@
 
 #define HM2170_REG_DELAY 		0xffff
 
+/* Keep the sensor powered and its registers retained after stream off */
+#define HM2170_AUTOSUSPEND_DELAY_MS	1000
+
 #define HM2170_REG_CHIP_ID		0x0000
 #define HM2170_CHIP_ID			0x2170
 #define HM2170_REG_SILICON_REV		0x0002
@@ -629,8 +637,17 @@ struct hm2170 {
 	/* To serialize asynchronus callbacks */
 	struct mutex mutex;
 
+	/* Control writes waiting for one group launch, under mutex */
+	struct sensor_group_hold hold;
+
 	/* Streaming on/off */
 	bool streaming;
+
+	/* Registers programmed since power up, under mutex */
+	struct sensor_reg_shadow shadow;
+
+	/* I2C timing of the register helpers */
+	struct sensor_i2c_stats i2c_stats;
 };
 
 static inline struct hm2170 *to_hm2170(struct v4l2_subdev *subdev)
@@ -663,6 +680,7 @@ static int hm2170_read_reg(struct hm2170 *hm2170, u16 reg, u16 len, u32 *val)
 	u8 addr_buf[2];
 	u8 data_buf[4] = {0};
 	int ret = 0;
+	u64 start;
 
 	if (len > sizeof(data_buf))
 		return -EINVAL;
@@ -677,7 +695,10 @@ static int hm2170_read_reg(struct hm2170 *hm2170, u16 reg, u16 len, u32 *val)
 	msgs[1].len = len;
 	msgs[1].buf = &data_buf[sizeof(data_buf) - len];
 
+	start = ktime_get_ns();
 	ret = i2c_transfer(client->adapter, msgs, ARRAY_SIZE(msgs));
+	sensor_i2c_stats_add(&hm2170->i2c_stats, SENSOR_I2C_READ,
+			     msgs[0].len + len, start);
 	if (ret != ARRAY_SIZE(msgs))
 		return ret < 0 ? ret : -EIO;
 
@@ -691,6 +712,7 @@ static int hm2170_write_reg(struct hm2170 *hm2170, u16 reg, u16 len, u32 val)
 	struct i2c_client *client = v4l2_get_subdevdata(&hm2170->sd);
 	u8 buf[6];
 	int ret = 0;
+	u64 start;
 
 	if (len > 4)
 		return -EINVAL;
@@ -703,9 +725,15 @@ static int hm2170_write_reg(struct hm2170 *hm2170, u16 reg, u16 len, u32 val)
 	put_unaligned_be16(reg, buf);
 	put_unaligned_be32(val << 8 * (4 - len), buf + 2);
 
+	start = ktime_get_ns();
 	ret = i2c_master_send(client, buf, len + 2);
-	if (ret != len + 2)
+	sensor_i2c_stats_add(&hm2170->i2c_stats, SENSOR_I2C_WRITE, len + 2,
+			     start);
+	if (ret != len + 2) {
+		sensor_reg_shadow_reset(&hm2170->shadow);
 		return ret < 0 ? ret : -EIO;
+	}
+	sensor_reg_shadow_write(&hm2170->shadow, reg, len, val);
 
 	return 0;
 }
@@ -714,21 +742,49 @@ static int hm2170_write_reg_list(struct hm2170 *hm2170,
 				 const struct hm2170_reg_list *r_list)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(&hm2170->sd);
+	struct sensor_reg_shadow *shadow = &hm2170->shadow;
+	struct sensor_reg_burst burst;
+	bool written = false;
 	unsigned int i;
-	int ret = 0;
+	int ret;
+	u64 start;
 
+	/*
+	 * Only registers that differ from the shadow are sent, and a delay
+	 * only when something was written before it.
+	 */
+	start = ktime_get_ns();
+	sensor_reg_burst_init(&burst, client, 2, 1);
 	for (i = 0; i < r_list->num_of_regs; i++) {
-		ret = hm2170_write_reg(hm2170, r_list->regs[i].address, 1,
-				       r_list->regs[i].val);
-		if (ret) {
-			dev_err_ratelimited(&client->dev,
-					    "write reg 0x%4.4x return err = %d",
-					    r_list->regs[i].address, ret);
-			return ret;
+		u16 addr = r_list->regs[i].address;
+		u8 val = r_list->regs[i].val;
+
+		if (addr == HM2170_REG_DELAY) {
+			ret = written ? sensor_reg_burst_delay(&burst, val) : 0;
+			written = false;
+		} else if (sensor_reg_shadow_match(shadow, addr, val)) {
+			continue;
+		} else {
+			ret = sensor_reg_burst_add(&burst, addr, val);
+			sensor_reg_shadow_set(shadow, addr, val);
+			written = true;
 		}
+		if (ret)
+			goto err;
 	}
 
-	return 0;
+	ret = sensor_reg_burst_flush(&burst);
+	sensor_i2c_stats_add(&hm2170->i2c_stats, SENSOR_I2C_LIST, burst.sent,
+			     start);
+	if (!ret)
+		return 0;
+
+err:
+	sensor_reg_shadow_reset(shadow);
+	dev_err_ratelimited(&client->dev,
+			    "write reg 0x%4.4x return err = %d",
+			    burst.start, ret);
+	return ret;
 }
 
 static int hm2170_test_pattern(struct hm2170 *hm2170, u32 pattern)
@@ -740,6 +796,27 @@ static int hm2170_test_pattern(struct hm2170 *hm2170, u32 pattern)
 	return hm2170_write_reg(hm2170, HM2170_REG_TEST_PATTERN, 1, pattern);
 }
 
+static int hm2170_group_hold(struct sensor_group_hold *g)
+{
+	struct hm2170 *hm2170 = container_of(g, struct hm2170, hold);
+
+	return hm2170_write_reg(hm2170, HM2170_REG_COMMAND_UPDATE, 1,
+				HM2170_COMMAND_HOLD);
+}
+
+static int hm2170_group_launch(struct sensor_group_hold *g)
+{
+	struct hm2170 *hm2170 = container_of(g, struct hm2170, hold);
+
+	return hm2170_write_reg(hm2170, HM2170_REG_COMMAND_UPDATE, 1,
+				HM2170_COMMAND_UPDATE);
+}
+
+static const struct sensor_group_hold_ops hm2170_group_hold_ops = {
+	.hold = hm2170_group_hold,
+	.launch = hm2170_group_launch,
+};
+
 static int hm2170_set_ctrl(struct v4l2_ctrl *ctrl)
 {
 	struct hm2170 *hm2170 = container_of(ctrl->handler,
@@ -763,8 +840,7 @@ static int hm2170_set_ctrl(struct v4l2_ctrl *ctrl)
 	if (!pm_runtime_get_if_in_use(&client->dev))
 		return 0;
 
-	ret = hm2170_write_reg(hm2170, HM2170_REG_COMMAND_UPDATE, 1,
-			       HM2170_COMMAND_HOLD);
+	ret = sensor_group_hold_begin(&hm2170->hold);
 	if (ret)
 		dev_dbg(&client->dev, "failed to hold command");
 
@@ -803,8 +879,6 @@ static int hm2170_set_ctrl(struct v4l2_ctrl *ctrl)
 		ret = -EINVAL;
 		break;
 	}
-	ret |= hm2170_write_reg(hm2170, HM2170_REG_COMMAND_UPDATE, 1,
-				HM2170_COMMAND_UPDATE);
 
 	pm_runtime_put(&client->dev);
 
@@ -920,18 +994,27 @@ static int hm2170_start_streaming(struct hm2170 *hm2170)
 	struct i2c_client *client = v4l2_get_subdevdata(&hm2170->sd);
 	const struct hm2170_reg_list *reg_list;
 	int ret = 0;
+	u64 start;
 
 	reg_list = &hm2170->cur_mode->reg_list;
+	start = ktime_get_ns();
 	ret = hm2170_write_reg_list(hm2170, reg_list);
 	if (ret) {
 		dev_err(&client->dev, "failed to set mode");
 		return ret;
 	}
+	sensor_i2c_stats_mode(&hm2170->i2c_stats,
+			      hm2170->cur_mode->width,
+			      hm2170->cur_mode->height, start);
 
 	ret = __v4l2_ctrl_handler_setup(hm2170->sd.ctrl_handler);
 	if (ret)
 		return ret;
 
+	ret = sensor_group_hold_launch(&hm2170->hold);
+	if (ret)
+		return ret;
+
 	ret = hm2170_write_reg(hm2170, HM2170_REG_MODE_SELECT, 1,
 			       HM2170_MODE_STREAMING);
 	if (ret)
@@ -944,6 +1027,9 @@ static void hm2170_stop_streaming(struct hm2170 *hm2170)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(&hm2170->sd);
 
+	/* An open group would capture the stream off write */
+	sensor_group_hold_launch(&hm2170->hold);
+
 	if (hm2170_write_reg(hm2170, HM2170_REG_MODE_SELECT, 1,
 			     HM2170_MODE_STANDBY))
 		dev_err(&client->dev, "failed to stop streaming");
@@ -975,7 +1061,8 @@ static int hm2170_set_stream(struct v4l2_subdev *sd, int enable)
 		}
 	} else {
 		hm2170_stop_streaming(hm2170);
-		pm_runtime_put(&client->dev);
+		pm_runtime_mark_last_busy(&client->dev);
+		pm_runtime_put_autosuspend(&client->dev);
 	}
 
 	hm2170->streaming = enable;
@@ -1021,6 +1108,34 @@ static int hm2170_power_on(struct device *dev)
 }
 #endif
 
+static int hm2170_runtime_suspend(struct device *dev)
+{
+	struct v4l2_subdev *sd = dev_get_drvdata(dev);
+	struct hm2170 *hm2170 = to_hm2170(sd);
+
+	/* Power may go away now, nothing programmed can be relied on */
+	mutex_lock(&hm2170->mutex);
+	sensor_reg_shadow_reset(&hm2170->shadow);
+	mutex_unlock(&hm2170->mutex);
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 6, 0) && \
+    IS_ENABLED(CONFIG_INTEL_VSC)
+	return hm2170_power_off(dev);
+#else
+	return 0;
+#endif
+}
+
+static int hm2170_runtime_resume(struct device *dev)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 6, 0) && \
+    IS_ENABLED(CONFIG_INTEL_VSC)
+	return hm2170_power_on(dev);
+#else
+	return 0;
+#endif
+}
+
 static int __maybe_unused hm2170_suspend(struct device *dev)
 {
 	struct v4l2_subdev *sd = dev_get_drvdata(dev);
@@ -1029,6 +1144,7 @@ static int __maybe_unused hm2170_suspend(struct device *dev)
 	mutex_lock(&hm2170->mutex);
 	if (hm2170->streaming)
 		hm2170_stop_streaming(hm2170);
+	sensor_reg_shadow_reset(&hm2170->shadow);
 
 	mutex_unlock(&hm2170->mutex);
 
@@ -1295,8 +1411,11 @@ static void hm2170_remove(struct i2c_client *client)
 
 	v4l2_async_unregister_subdev(sd);
 	media_entity_cleanup(&sd->entity);
+	sensor_group_hold_cancel(&hm2170->hold);
 	v4l2_ctrl_handler_free(sd->ctrl_handler);
 	pm_runtime_disable(&client->dev);
+	pm_runtime_dont_use_autosuspend(&client->dev);
+	sensor_reg_shadow_reset(&hm2170->shadow);
 	mutex_destroy(&hm2170->mutex);
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 1, 0)
@@ -1323,6 +1442,9 @@ static int hm2170_probe(struct i2c_client *client)
 	}
 
 	v4l2_i2c_subdev_init(&hm2170->sd, client, &hm2170_subdev_ops);
+	ret = sensor_i2c_stats_init(&hm2170->i2c_stats, &client->dev);
+	if (ret)
+		return ret;
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 6, 0) && \
     IS_ENABLED(CONFIG_INTEL_VSC)
 	hm2170->conf.lane_num = HM2170_DATA_LANES;
@@ -1346,6 +1468,9 @@ static int hm2170_probe(struct i2c_client *client)
 	}
 
 	mutex_init(&hm2170->mutex);
+	sensor_group_hold_init(&hm2170->hold, &client->dev, &hm2170->mutex,
+			       &hm2170_group_hold_ops);
+	sensor_reg_shadow_init(&hm2170->shadow);
 	hm2170->cur_mode = &supported_modes[hm2170->rev][0];
 	ret = hm2170_init_controls(hm2170);
 	if (ret) {
@@ -1376,6 +1501,10 @@ static int hm2170_probe(struct i2c_client *client)
 	 * Enable runtime PM and turn off the device.
 	 */
 	pm_runtime_set_active(&client->dev);
+	pm_runtime_set_autosuspend_delay(&client->dev,
+					 HM2170_AUTOSUSPEND_DELAY_MS);
+	pm_runtime_use_autosuspend(&client->dev);
+	device_enable_async_suspend(&client->dev);
 	pm_runtime_enable(&client->dev);
 	pm_runtime_idle(&client->dev);
 
@@ -1385,6 +1514,7 @@ probe_error_media_entity_cleanup:
 	media_entity_cleanup(&hm2170->sd.entity);
 
 probe_error_v4l2_ctrl_handler_free:
+	sensor_group_hold_cancel(&hm2170->hold);
 	v4l2_ctrl_handler_free(hm2170->sd.ctrl_handler);
 	mutex_destroy(&hm2170->mutex);
 
@@ -1399,10 +1529,7 @@ probe_error_ret:
 
 static const struct dev_pm_ops hm2170_pm_ops = {
 	SET_SYSTEM_SLEEP_PM_OPS(hm2170_suspend, hm2170_resume)
-#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 6, 0) && \
-    IS_ENABLED(CONFIG_INTEL_VSC)
-	SET_RUNTIME_PM_OPS(hm2170_power_off, hm2170_power_on, NULL)
-#endif
+	SET_RUNTIME_PM_OPS(hm2170_runtime_suspend, hm2170_runtime_resume, NULL)
 };
 
 static const struct acpi_device_id hm2170_acpi_ids[] = {
@@ -1415,6 +1542,7 @@ MODULE_DEVICE_TABLE(acpi, hm2170_acpi_ids);
 static struct i2c_driver hm2170_i2c_driver = {
 	.driver = {
 		.name = "hm2170",
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 		.pm = &hm2170_pm_ops,
 		.acpi_match_table = hm2170_acpi_ids,
 	},
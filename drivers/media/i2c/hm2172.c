@@ -15,6 +15,11 @@
 #include <media/v4l2-fwnode.h>
 #include <linux/clk.h>
 #include <linux/gpio/consumer.h>
+#include "sensor_reg_burst.h"
+#include "sensor_group_hold.h"
+#include "sensor_i2c_stats.h"
+#include "sensor_mode_fw.h"
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 6, 0) && \
     IS_ENABLED(CONFIG_INTEL_VSC)
 #include <linux/vsc.h>
@@ -940,12 +945,21 @@ struct hm2172 {
 	/* To serialize asynchronus callbacks */
 	struct mutex mutex;
 
+	/* Control writes waiting for one group launch, under mutex */
+	struct sensor_group_hold hold;
+
 	/* Streaming on/off */
 	bool streaming;
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 6, 0) && \
     IS_ENABLED(CONFIG_INTEL_VSC)
 	bool use_intel_vsc;
 #endif
+
+	/* I2C timing of the register helpers */
+	struct sensor_i2c_stats i2c_stats;
+
+	/* Mode register lists from firmware, if any */
+	struct sensor_mode_fw mode_fw;
 };
 
 static inline struct hm2172 *to_hm2172(struct v4l2_subdev *subdev)
@@ -978,6 +992,7 @@ static int hm2172_read_reg(struct hm2172 *hm2172, u16 reg, u16 len, u32 *val)
 	u8 addr_buf[2];
 	u8 data_buf[4] = {0};
 	int ret = 0;
+	u64 start;
 
 	if (len > sizeof(data_buf))
 		return -EINVAL;
@@ -992,7 +1007,10 @@ static int hm2172_read_reg(struct hm2172 *hm2172, u16 reg, u16 len, u32 *val)
 	msgs[1].len = len;
 	msgs[1].buf = &data_buf[sizeof(data_buf) - len];
 
+	start = ktime_get_ns();
 	ret = i2c_transfer(client->adapter, msgs, ARRAY_SIZE(msgs));
+	sensor_i2c_stats_add(&hm2172->i2c_stats, SENSOR_I2C_READ,
+			     msgs[0].len + len, start);
 	if (ret != ARRAY_SIZE(msgs))
 		return ret < 0 ? ret : -EIO;
 
@@ -1006,6 +1024,7 @@ static int hm2172_write_reg(struct hm2172 *hm2172, u16 reg, u16 len, u32 val)
 	struct i2c_client *client = v4l2_get_subdevdata(&hm2172->sd);
 	u8 buf[6];
 	int ret = 0;
+	u64 start;
 
 	if (len > 4)
 		return -EINVAL;
@@ -1018,7 +1037,10 @@ static int hm2172_write_reg(struct hm2172 *hm2172, u16 reg, u16 len, u32 val)
 	put_unaligned_be16(reg, buf);
 	put_unaligned_be32(val << 8 * (4 - len), buf + 2);
 
+	start = ktime_get_ns();
 	ret = i2c_master_send(client, buf, len + 2);
+	sensor_i2c_stats_add(&hm2172->i2c_stats, SENSOR_I2C_WRITE, len + 2,
+			     start);
 	if (ret != len + 2) {
 		dev_err(&client->dev, "failed to write reg %d val %d", reg, val);
 		return ret < 0 ? ret : -EIO;
@@ -1031,21 +1053,36 @@ static int hm2172_write_reg_list(struct hm2172 *hm2172,
 				 const struct hm2172_reg_list *r_list)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(&hm2172->sd);
+	struct sensor_reg_burst burst;
 	unsigned int i;
-	int ret = 0;
+	int ret;
+	u64 start;
 
+	start = ktime_get_ns();
+	sensor_reg_burst_init(&burst, client, 2, 1);
 	for (i = 0; i < r_list->num_of_regs; i++) {
-		ret = hm2172_write_reg(hm2172, r_list->regs[i].address, 1,
-				       r_list->regs[i].val);
-		if (ret) {
-			dev_err_ratelimited(&client->dev,
-					    "write reg 0x%4.4x return err = %d",
-					    r_list->regs[i].address, ret);
-			return ret;
-		}
+		if (r_list->regs[i].address == HM2172_REG_DELAY)
+			ret = sensor_reg_burst_delay(&burst,
+						     r_list->regs[i].val);
+		else
+			ret = sensor_reg_burst_add(&burst,
+						   r_list->regs[i].address,
+						   r_list->regs[i].val);
+		if (ret)
+			goto err;
 	}
 
-	return 0;
+	ret = sensor_reg_burst_flush(&burst);
+	sensor_i2c_stats_add(&hm2172->i2c_stats, SENSOR_I2C_LIST, burst.sent,
+			     start);
+	if (!ret)
+		return 0;
+
+err:
+	dev_err_ratelimited(&client->dev,
+			    "write reg 0x%4.4x return err = %d",
+			    burst.start, ret);
+	return ret;
 }
 
 static int hm2172_test_pattern(struct hm2172 *hm2172, u32 pattern)
@@ -1057,6 +1094,27 @@ static int hm2172_test_pattern(struct hm2172 *hm2172, u32 pattern)
 	return hm2172_write_reg(hm2172, HM2172_REG_TEST_PATTERN, 1, pattern);
 }
 
+static int hm2172_group_hold(struct sensor_group_hold *g)
+{
+	struct hm2172 *hm2172 = container_of(g, struct hm2172, hold);
+
+	return hm2172_write_reg(hm2172, HM2172_REG_COMMAND_UPDATE, 1,
+				HM2172_COMMAND_HOLD);
+}
+
+static int hm2172_group_launch(struct sensor_group_hold *g)
+{
+	struct hm2172 *hm2172 = container_of(g, struct hm2172, hold);
+
+	return hm2172_write_reg(hm2172, HM2172_REG_COMMAND_UPDATE, 1,
+				HM2172_COMMAND_UPDATE);
+}
+
+static const struct sensor_group_hold_ops hm2172_group_hold_ops = {
+	.hold = hm2172_group_hold,
+	.launch = hm2172_group_launch,
+};
+
 static int hm2172_set_ctrl(struct v4l2_ctrl *ctrl)
 {
 	struct hm2172 *hm2172 = container_of(ctrl->handler,
@@ -1080,8 +1138,7 @@ static int hm2172_set_ctrl(struct v4l2_ctrl *ctrl)
 	if (!pm_runtime_get_if_in_use(&client->dev))
 		return 0;
 
-	ret = hm2172_write_reg(hm2172, HM2172_REG_COMMAND_UPDATE, 1,
-			       HM2172_COMMAND_HOLD);
+	ret = sensor_group_hold_begin(&hm2172->hold);
 	if (ret)
 		dev_dbg(&client->dev, "failed to hold command");
 
@@ -1120,8 +1177,6 @@ static int hm2172_set_ctrl(struct v4l2_ctrl *ctrl)
 		ret = -EINVAL;
 		break;
 	}
-	ret |= hm2172_write_reg(hm2172, HM2172_REG_COMMAND_UPDATE, 1,
-				HM2172_COMMAND_UPDATE);
 
 	pm_runtime_put(&client->dev);
 
@@ -1237,20 +1292,39 @@ static void hm2172_vsc_privacy_callback(void *handle,
 static int hm2172_start_streaming(struct hm2172 *hm2172)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(&hm2172->sd);
+	const struct sensor_mode_fw_regs *fw_regs;
 	const struct hm2172_reg_list *reg_list;
 	int ret = 0;
+	u64 start;
 
 	reg_list = &hm2172->cur_mode->reg_list;
-	ret = hm2172_write_reg_list(hm2172, reg_list);
+	fw_regs = sensor_mode_fw_find(&hm2172->mode_fw,
+				      hm2172->cur_mode->width,
+				      hm2172->cur_mode->height);
+	start = ktime_get_ns();
+	if (fw_regs) {
+		ret = sensor_mode_fw_write(&hm2172->mode_fw, fw_regs);
+		sensor_i2c_stats_add(&hm2172->i2c_stats, SENSOR_I2C_LIST,
+				     hm2172->mode_fw.sent, start);
+	} else {
+		ret = hm2172_write_reg_list(hm2172, reg_list);
+	}
 	if (ret) {
 		dev_err(&client->dev, "failed to set mode");
 		return ret;
 	}
+	sensor_i2c_stats_mode(&hm2172->i2c_stats,
+			      hm2172->cur_mode->width,
+			      hm2172->cur_mode->height, start);
 
 	ret = __v4l2_ctrl_handler_setup(hm2172->sd.ctrl_handler);
 	if (ret)
 		return ret;
 
+	ret = sensor_group_hold_launch(&hm2172->hold);
+	if (ret)
+		return ret;
+
 	ret = hm2172_write_reg(hm2172, HM2172_REG_MODE_SELECT, 1,
 			       HM2172_MODE_STREAMING);
 	if (ret)
@@ -1263,6 +1337,9 @@ static void hm2172_stop_streaming(struct hm2172 *hm2172)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(&hm2172->sd);
 
+	/* An open group would capture the stream off write */
+	sensor_group_hold_launch(&hm2172->hold);
+
 	if (hm2172_write_reg(hm2172, HM2172_REG_MODE_SELECT, 1,
 			     HM2172_MODE_STANDBY))
 		dev_err(&client->dev, "failed to stop streaming");
@@ -1723,6 +1800,7 @@ static void hm2172_remove(struct i2c_client *client)
 
 	v4l2_async_unregister_subdev(sd);
 	media_entity_cleanup(&sd->entity);
+	sensor_group_hold_cancel(&hm2172->hold);
 	v4l2_ctrl_handler_free(sd->ctrl_handler);
 	pm_runtime_disable(&client->dev);
 	mutex_destroy(&hm2172->mutex);
@@ -1750,6 +1828,9 @@ static int hm2172_probe(struct i2c_client *client)
 
 	/* Initialize subdev */
 	v4l2_i2c_subdev_init(&hm217->sd, client, &hm2172_subdev_ops);
+	ret = sensor_i2c_stats_init(&hm217->i2c_stats, &client->dev);
+	if (ret)
+		return ret;
 	hm2172_get_pm_resources(&client->dev);
 
 	ret = hm2172_power_on(&client->dev);
@@ -1765,6 +1846,12 @@ static int hm2172_probe(struct i2c_client *client)
 		goto error_power_off;
 	}
 
+	sensor_mode_fw_load(&hm217->mode_fw, client, "hm2172-modes.bin", 2);
+
+	mutex_init(&hm217->mutex);
+	sensor_group_hold_init(&hm217->hold, &client->dev, &hm217->mutex,
+			       &hm2172_group_hold_ops);
+
 	/* Set default mode to max resolution */
 	hm217->cur_mode = &supported_modes[0];
 
@@ -1795,6 +1882,7 @@ static int hm2172_probe(struct i2c_client *client)
 	 * Enable runtime PM and turn off the device.
 	 */
 	pm_runtime_set_active(&client->dev);
+	device_enable_async_suspend(&client->dev);
 	pm_runtime_enable(&client->dev);
 	pm_runtime_idle(&client->dev);
 
@@ -1804,6 +1892,7 @@ error_media_entity:
 	media_entity_cleanup(&hm217->sd.entity);
 
 error_handler_free:
+	sensor_group_hold_cancel(&hm217->hold);
 	v4l2_ctrl_handler_free(hm217->sd.ctrl_handler);
 	mutex_destroy(&hm217->mutex);
 	dev_err(&client->dev, "%s failed:%d\n", __func__, ret);
@@ -1828,6 +1917,7 @@ MODULE_DEVICE_TABLE(acpi, hm2172_acpi_ids);
 static struct i2c_driver hm2172_i2c_driver = {
 	.driver = {
 		.name = "hm2172",
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 		.pm = &hm2172_pm_ops,
 		.acpi_match_table = hm2172_acpi_ids,
 	},
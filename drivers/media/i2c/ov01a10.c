@@ -11,6 +11,9 @@
 #include <media/v4l2-ctrls.h>
 #include <media/v4l2-device.h>
 #include <media/v4l2-fwnode.h>
+#include "sensor_reg_burst.h"
+#include "sensor_i2c_stats.h"
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 6, 0) && \
     IS_ENABLED(CONFIG_INTEL_VSC)
 #include <linux/vsc.h>
@@ -305,6 +308,9 @@ struct ov01a10 {
 
 	/* Streaming on/off */
 	bool streaming;
+
+	/* I2C timing of the register helpers */
+	struct sensor_i2c_stats i2c_stats;
 };
 
 static inline struct ov01a10 *to_ov01a10(struct v4l2_subdev *subdev)
@@ -319,6 +325,7 @@ static int ov01a10_read_reg(struct ov01a10 *ov01a10, u16 reg, u16 len, u32 *val)
 	u8 addr_buf[2];
 	u8 data_buf[4] = {0};
 	int ret = 0;
+	u64 start;
 
 	if (len > sizeof(data_buf))
 		return -EINVAL;
@@ -333,7 +340,10 @@ static int ov01a10_read_reg(struct ov01a10 *ov01a10, u16 reg, u16 len, u32 *val)
 	msgs[1].len = len;
 	msgs[1].buf = &data_buf[sizeof(data_buf) - len];
 
+	start = ktime_get_ns();
 	ret = i2c_transfer(client->adapter, msgs, ARRAY_SIZE(msgs));
+	sensor_i2c_stats_add(&ov01a10->i2c_stats, SENSOR_I2C_READ,
+			     msgs[0].len + len, start);
 
 	if (ret != ARRAY_SIZE(msgs))
 		return ret < 0 ? ret : -EIO;
@@ -348,6 +358,7 @@ static int ov01a10_write_reg(struct ov01a10 *ov01a10, u16 reg, u16 len, u32 val)
 	struct i2c_client *client = v4l2_get_subdevdata(&ov01a10->sd);
 	u8 buf[6];
 	int ret = 0;
+	u64 start;
 
 	if (len > 4)
 		return -EINVAL;
@@ -355,7 +366,10 @@ static int ov01a10_write_reg(struct ov01a10 *ov01a10, u16 reg, u16 len, u32 val)
 	put_unaligned_be16(reg, buf);
 	put_unaligned_be32(val << 8 * (4 - len), buf + 2);
 
+	start = ktime_get_ns();
 	ret = i2c_master_send(client, buf, len + 2);
+	sensor_i2c_stats_add(&ov01a10->i2c_stats, SENSOR_I2C_WRITE, len + 2,
+			     start);
 	if (ret != len + 2)
 		return ret < 0 ? ret : -EIO;
 
@@ -366,21 +380,31 @@ static int ov01a10_write_reg_list(struct ov01a10 *ov01a10,
 				  const struct ov01a10_reg_list *r_list)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(&ov01a10->sd);
+	struct sensor_reg_burst burst;
 	unsigned int i;
-	int ret = 0;
+	int ret;
+	u64 start;
 
+	start = ktime_get_ns();
+	sensor_reg_burst_init(&burst, client, 2, 1);
 	for (i = 0; i < r_list->num_of_regs; i++) {
-		ret = ov01a10_write_reg(ov01a10, r_list->regs[i].address, 1,
-					r_list->regs[i].val);
-		if (ret) {
-			dev_err_ratelimited(&client->dev,
-					    "write reg 0x%4.4x return err = %d",
-					    r_list->regs[i].address, ret);
-			return ret;
-		}
+		ret = sensor_reg_burst_add(&burst, r_list->regs[i].address,
+					   r_list->regs[i].val);
+		if (ret)
+			goto err;
 	}
 
-	return 0;
+	ret = sensor_reg_burst_flush(&burst);
+	sensor_i2c_stats_add(&ov01a10->i2c_stats, SENSOR_I2C_LIST, burst.sent,
+			     start);
+	if (!ret)
+		return 0;
+
+err:
+	dev_err_ratelimited(&client->dev,
+			    "write reg 0x%4.4x return err = %d",
+			    burst.start, ret);
+	return ret;
 }
 
 static int ov01a10_update_digital_gain(struct ov01a10 *ov01a10, u32 d_gain)
@@ -587,9 +611,11 @@ static int ov01a10_start_streaming(struct ov01a10 *ov01a10)
 	const struct ov01a10_reg_list *reg_list;
 	int link_freq_index;
 	int ret = 0;
+	u64 start;
 
 	link_freq_index = ov01a10->cur_mode->link_freq_index;
 	reg_list = &link_freq_configs[link_freq_index].reg_list;
+	start = ktime_get_ns();
 	ret = ov01a10_write_reg_list(ov01a10, reg_list);
 	if (ret) {
 		dev_err(&client->dev, "failed to set plls");
@@ -602,6 +628,9 @@ static int ov01a10_start_streaming(struct ov01a10 *ov01a10)
 		dev_err(&client->dev, "failed to set mode");
 		return ret;
 	}
+	sensor_i2c_stats_mode(&ov01a10->i2c_stats,
+			      ov01a10->cur_mode->width,
+			      ov01a10->cur_mode->height, start);
 
 	ret = __v4l2_ctrl_handler_setup(ov01a10->sd.ctrl_handler);
 	if (ret)
@@ -1016,6 +1045,9 @@ static int ov01a10_probe(struct i2c_client *client)
 		return -ENOMEM;
 
 	v4l2_i2c_subdev_init(&ov01a10->sd, client, &ov01a10_subdev_ops);
+	ret = sensor_i2c_stats_init(&ov01a10->i2c_stats, &client->dev);
+	if (ret)
+		return ret;
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 6, 0) && \
     IS_ENABLED(CONFIG_INTEL_VSC)
 	ov01a10->conf.lane_num = OV01A10_DATA_LANES;
@@ -1069,6 +1101,7 @@ static int ov01a10_probe(struct i2c_client *client)
 	 * Enable runtime PM and turn off the device.
 	 */
 	pm_runtime_set_active(&client->dev);
+	device_enable_async_suspend(&client->dev);
 	pm_runtime_enable(&client->dev);
 	pm_runtime_idle(&client->dev);
 
@@ -1110,6 +1143,7 @@ MODULE_DEVICE_TABLE(acpi, ov01a10_acpi_ids);
 static struct i2c_driver ov01a10_i2c_driver = {
 	.driver = {
 		.name = "ov01a10",
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 		.pm = &ov01a10_pm_ops,
 		.acpi_match_table = ACPI_PTR(ov01a10_acpi_ids),
 	},
@@ -17,6 +17,8 @@
 #elif IS_ENABLED(CONFIG_POWER_CTRL_LOGIC)
 #include "power_ctrl_logic.h"
 #endif
+#include "sensor_reg_burst.h"
+#include "sensor_i2c_stats.h"
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 6, 0) && \
     IS_ENABLED(CONFIG_INTEL_VSC)
 #include <linux/vsc.h>
@@ -35,6 +37,9 @@
 #define OV01A1S_MODE_STANDBY		0x00
 #define OV01A1S_MODE_STREAMING		0x01
 
+/* Keep the sensor powered and its mode retained after stream off */
+#define OV01A1S_AUTOSUSPEND_DELAY_MS	1000
+
 /* vertical-timings from sensor */
 #define OV01A1S_REG_VTS			0x380e
 #define OV01A1S_VTS_DEF			0x0380
@@ -345,6 +350,12 @@ struct ov01a1s {
 
 	/* Streaming on/off */
 	bool streaming;
+
+	/* Mode still programmed in standby, NULL once powered off */
+	const struct ov01a1s_mode *retained;
+
+	/* I2C timing of the register helpers */
+	struct sensor_i2c_stats i2c_stats;
 };
 
 static inline struct ov01a1s *to_ov01a1s(struct v4l2_subdev *subdev)
@@ -359,6 +370,7 @@ static int ov01a1s_read_reg(struct ov01a1s *ov01a1s, u16 reg, u16 len, u32 *val)
 	u8 addr_buf[2];
 	u8 data_buf[4] = {0};
 	int ret = 0;
+	u64 start;
 
 	if (len > sizeof(data_buf))
 		return -EINVAL;
@@ -373,7 +385,10 @@ static int ov01a1s_read_reg(struct ov01a1s *ov01a1s, u16 reg, u16 len, u32 *val)
 	msgs[1].len = len;
 	msgs[1].buf = &data_buf[sizeof(data_buf) - len];
 
+	start = ktime_get_ns();
 	ret = i2c_transfer(client->adapter, msgs, ARRAY_SIZE(msgs));
+	sensor_i2c_stats_add(&ov01a1s->i2c_stats, SENSOR_I2C_READ,
+			     msgs[0].len + len, start);
 	if (ret != ARRAY_SIZE(msgs))
 		return ret < 0 ? ret : -EIO;
 
@@ -387,6 +402,7 @@ static int ov01a1s_write_reg(struct ov01a1s *ov01a1s, u16 reg, u16 len, u32 val)
 	struct i2c_client *client = ov01a1s->client;
 	u8 buf[6];
 	int ret = 0;
+	u64 start;
 
 	if (len > 4)
 		return -EINVAL;
@@ -394,7 +410,10 @@ static int ov01a1s_write_reg(struct ov01a1s *ov01a1s, u16 reg, u16 len, u32 val)
 	put_unaligned_be16(reg, buf);
 	put_unaligned_be32(val << 8 * (4 - len), buf + 2);
 
+	start = ktime_get_ns();
 	ret = i2c_master_send(client, buf, len + 2);
+	sensor_i2c_stats_add(&ov01a1s->i2c_stats, SENSOR_I2C_WRITE, len + 2,
+			     start);
 	if (ret != len + 2)
 		return ret < 0 ? ret : -EIO;
 
@@ -405,21 +424,31 @@ static int ov01a1s_write_reg_list(struct ov01a1s *ov01a1s,
 				  const struct ov01a1s_reg_list *r_list)
 {
 	struct i2c_client *client = ov01a1s->client;
+	struct sensor_reg_burst burst;
 	unsigned int i;
-	int ret = 0;
+	int ret;
+	u64 start;
 
+	start = ktime_get_ns();
+	sensor_reg_burst_init(&burst, client, 2, 1);
 	for (i = 0; i < r_list->num_of_regs; i++) {
-		ret = ov01a1s_write_reg(ov01a1s, r_list->regs[i].address, 1,
-					r_list->regs[i].val);
-		if (ret) {
-			dev_err_ratelimited(&client->dev,
-					    "write reg 0x%4.4x return err = %d",
-					    r_list->regs[i].address, ret);
-			return ret;
-		}
+		ret = sensor_reg_burst_add(&burst, r_list->regs[i].address,
+					   r_list->regs[i].val);
+		if (ret)
+			goto err;
 	}
 
-	return 0;
+	ret = sensor_reg_burst_flush(&burst);
+	sensor_i2c_stats_add(&ov01a1s->i2c_stats, SENSOR_I2C_LIST, burst.sent,
+			     start);
+	if (!ret)
+		return 0;
+
+err:
+	dev_err_ratelimited(&client->dev,
+			    "write reg 0x%4.4x return err = %d",
+			    burst.start, ret);
+	return ret;
 }
 
 static int ov01a1s_update_digital_gain(struct ov01a1s *ov01a1s, u32 d_gain)
@@ -636,20 +665,30 @@ static int ov01a1s_start_streaming(struct ov01a1s *ov01a1s)
 	const struct ov01a1s_reg_list *reg_list;
 	int link_freq_index;
 	int ret = 0;
+	u64 start;
 
-	link_freq_index = ov01a1s->cur_mode->link_freq_index;
-	reg_list = &link_freq_configs[link_freq_index].reg_list;
-	ret = ov01a1s_write_reg_list(ov01a1s, reg_list);
-	if (ret) {
-		dev_err(&client->dev, "failed to set plls");
-		return ret;
-	}
+	if (ov01a1s->retained != ov01a1s->cur_mode) {
+		ov01a1s->retained = NULL;
 
-	reg_list = &ov01a1s->cur_mode->reg_list;
-	ret = ov01a1s_write_reg_list(ov01a1s, reg_list);
-	if (ret) {
-		dev_err(&client->dev, "failed to set mode");
-		return ret;
+		link_freq_index = ov01a1s->cur_mode->link_freq_index;
+		reg_list = &link_freq_configs[link_freq_index].reg_list;
+		start = ktime_get_ns();
+		ret = ov01a1s_write_reg_list(ov01a1s, reg_list);
+		if (ret) {
+			dev_err(&client->dev, "failed to set plls");
+			return ret;
+		}
+
+		reg_list = &ov01a1s->cur_mode->reg_list;
+		ret = ov01a1s_write_reg_list(ov01a1s, reg_list);
+		if (ret) {
+			dev_err(&client->dev, "failed to set mode");
+			return ret;
+		}
+		sensor_i2c_stats_mode(&ov01a1s->i2c_stats,
+				      ov01a1s->cur_mode->width,
+				      ov01a1s->cur_mode->height, start);
+		ov01a1s->retained = ov01a1s->cur_mode;
 	}
 
 	ret = __v4l2_ctrl_handler_setup(ov01a1s->sd.ctrl_handler);
@@ -701,7 +740,8 @@ static int ov01a1s_set_stream(struct v4l2_subdev *sd, int enable)
 		}
 	} else {
 		ov01a1s_stop_streaming(ov01a1s);
-		pm_runtime_put(&client->dev);
+		pm_runtime_mark_last_busy(&client->dev);
+		pm_runtime_put_autosuspend(&client->dev);
 	}
 
 	ov01a1s->streaming = enable;
@@ -716,6 +756,8 @@ static int ov01a1s_power_off(struct device *dev)
 	struct ov01a1s *ov01a1s = to_ov01a1s(sd);
 	int ret = 0;
 
+	ov01a1s->retained = NULL;
+
 #if IS_ENABLED(CONFIG_INTEL_SKL_INT3472)
 	if (ov01a1s->power_type == OV01A1S_USE_INT3472) {
 		gpiod_set_value_cansleep(ov01a1s->reset_gpio, 1);
@@ -791,6 +833,7 @@ static int __maybe_unused ov01a1s_suspend(struct device *dev)
 	mutex_lock(&ov01a1s->mutex);
 	if (ov01a1s->streaming)
 		ov01a1s_stop_streaming(ov01a1s);
+	ov01a1s->retained = NULL;
 
 	mutex_unlock(&ov01a1s->mutex);
 
@@ -1075,6 +1118,7 @@ static void ov01a1s_remove(struct i2c_client *client)
 	media_entity_cleanup(&sd->entity);
 	v4l2_ctrl_handler_free(sd->ctrl_handler);
 	pm_runtime_disable(&client->dev);
+	pm_runtime_dont_use_autosuspend(&client->dev);
 	mutex_destroy(&ov01a1s->mutex);
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 1, 0)
@@ -1177,6 +1221,9 @@ static int ov01a1s_probe(struct i2c_client *client)
 		return ret;
 
 	v4l2_i2c_subdev_init(&ov01a1s->sd, client, &ov01a1s_subdev_ops);
+	ret = sensor_i2c_stats_init(&ov01a1s->i2c_stats, &client->dev);
+	if (ret)
+		return ret;
 #if IS_ENABLED(CONFIG_INTEL_SKL_INT3472)
 	/* In other cases, power is up in ov01a1s_parse_power */
 	if (ov01a1s->power_type == OV01A1S_USE_INT3472)
@@ -1223,6 +1270,10 @@ static int ov01a1s_probe(struct i2c_client *client)
 	 * Enable runtime PM and turn off the device.
 	 */
 	pm_runtime_set_active(&client->dev);
+	pm_runtime_set_autosuspend_delay(&client->dev,
+					 OV01A1S_AUTOSUSPEND_DELAY_MS);
+	pm_runtime_use_autosuspend(&client->dev);
+	device_enable_async_suspend(&client->dev);
 	pm_runtime_enable(&client->dev);
 	pm_runtime_idle(&client->dev);
 
@@ -1258,6 +1309,7 @@ MODULE_DEVICE_TABLE(acpi, ov01a1s_acpi_ids);
 static struct i2c_driver ov01a1s_i2c_driver = {
 	.driver = {
 		.name = "ov01a1s",
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 		.pm = &ov01a1s_pm_ops,
 		.acpi_match_table = ACPI_PTR(ov01a1s_acpi_ids),
 	},
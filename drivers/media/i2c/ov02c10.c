@@ -13,6 +13,10 @@
 #include <media/v4l2-ctrls.h>
 #include <media/v4l2-device.h>
 #include <media/v4l2-fwnode.h>
+#include "sensor_reg_burst.h"
+#include "sensor_reg_shadow.h"
+#include "sensor_i2c_stats.h"
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 6, 0) && \
 IS_ENABLED(CONFIG_INTEL_VSC)
 #include <linux/vsc.h>
@@ -715,6 +719,9 @@ IS_ENABLED(CONFIG_INTEL_VSC)
 	/* Streaming on/off */
 	bool streaming;
 
+	/* Registers written since power up */
+	struct sensor_reg_shadow shadow;
+
 	/* Module name index */
 	u8 module_name_index;
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 6, 0) && \
@@ -722,6 +729,9 @@ IS_ENABLED(CONFIG_INTEL_VSC)
 
 	bool use_intel_vsc;
 #endif
+
+	/* I2C timing of the register helpers */
+	struct sensor_i2c_stats i2c_stats;
 };
 
 static inline struct ov02c10 *to_ov02c10(struct v4l2_subdev *subdev)
@@ -736,6 +746,7 @@ static int ov02c10_read_reg(struct ov02c10 *ov02c10, u16 reg, u16 len, u32 *val)
 	u8 addr_buf[2];
 	u8 data_buf[4] = {0};
 	int ret = 0;
+	u64 start;
 
 	if (len > sizeof(data_buf))
 		return -EINVAL;
@@ -750,7 +761,10 @@ static int ov02c10_read_reg(struct ov02c10 *ov02c10, u16 reg, u16 len, u32 *val)
 	msgs[1].len = len;
 	msgs[1].buf = &data_buf[sizeof(data_buf) - len];
 
+	start = ktime_get_ns();
 	ret = i2c_transfer(client->adapter, msgs, ARRAY_SIZE(msgs));
+	sensor_i2c_stats_add(&ov02c10->i2c_stats, SENSOR_I2C_READ,
+			     msgs[0].len + len, start);
 
 	if (ret != ARRAY_SIZE(msgs))
 		return ret < 0 ? ret : -EIO;
@@ -765,6 +779,7 @@ static int ov02c10_write_reg(struct ov02c10 *ov02c10, u16 reg, u16 len, u32 val)
 	struct i2c_client *client = v4l2_get_subdevdata(&ov02c10->sd);
 	u8 buf[6];
 	int ret = 0;
+	u64 start;
 
 	if (len > 4)
 		return -EINVAL;
@@ -772,9 +787,15 @@ static int ov02c10_write_reg(struct ov02c10 *ov02c10, u16 reg, u16 len, u32 val)
 	put_unaligned_be16(reg, buf);
 	put_unaligned_be32(val << 8 * (4 - len), buf + 2);
 
+	start = ktime_get_ns();
 	ret = i2c_master_send(client, buf, len + 2);
-	if (ret != len + 2)
+	sensor_i2c_stats_add(&ov02c10->i2c_stats, SENSOR_I2C_WRITE, len + 2,
+			     start);
+	if (ret != len + 2) {
+		sensor_reg_shadow_reset(&ov02c10->shadow);
 		return ret < 0 ? ret : -EIO;
+	}
+	sensor_reg_shadow_write(&ov02c10->shadow, reg, len, val);
 
 	return 0;
 }
@@ -783,21 +804,44 @@ static int ov02c10_write_reg_list(struct ov02c10 *ov02c10,
 				  const struct ov02c10_reg_list *r_list)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(&ov02c10->sd);
+	struct sensor_reg_burst burst;
 	unsigned int i;
-	int ret = 0;
+	int ret;
+	u64 start;
 
+	start = ktime_get_ns();
+	sensor_reg_burst_init(&burst, client, 2, 1);
 	for (i = 0; i < r_list->num_of_regs; i++) {
-		ret = ov02c10_write_reg(ov02c10, r_list->regs[i].address, 1,
+		ret = sensor_reg_burst_add(&burst, r_list->regs[i].address,
+					   r_list->regs[i].val);
+		if (ret)
+			goto err;
+		sensor_reg_shadow_write(&ov02c10->shadow,
+					r_list->regs[i].address, 1,
 					r_list->regs[i].val);
-		if (ret) {
-			dev_err_ratelimited(&client->dev,
-					    "write reg 0x%4.4x return err = %d",
-					    r_list->regs[i].address, ret);
-			return ret;
-		}
 	}
 
-	return 0;
+	ret = sensor_reg_burst_flush(&burst);
+	sensor_i2c_stats_add(&ov02c10->i2c_stats, SENSOR_I2C_LIST, burst.sent,
+			     start);
+	if (!ret)
+		return 0;
+
+err:
+	sensor_reg_shadow_reset(&ov02c10->shadow);
+	dev_err_ratelimited(&client->dev,
+			    "write reg 0x%4.4x return err = %d",
+			    burst.start, ret);
+	return ret;
+}
+
+/* Only for registers the sensor never changes by itself */
+static int ov02c10_read_cached(struct ov02c10 *ov02c10, u16 reg, u16 len, u32 *val)
+{
+	if (sensor_reg_shadow_read(&ov02c10->shadow, reg, len, val))
+		return 0;
+
+	return ov02c10_read_reg(ov02c10, reg, len, val);
 }
 
 static int ov02c10_test_pattern(struct ov02c10 *ov02c10, u32 pattern)
@@ -974,10 +1018,12 @@ static int ov02c10_start_streaming(struct ov02c10 *ov02c10)
 	const struct ov02c10_reg_list *reg_list;
 	int link_freq_index;
 	int ret = 0;
+	u64 start;
 	u32 rotate, shift_x, shift_y;
 
 	link_freq_index = ov02c10->cur_mode->link_freq_index;
 	reg_list = &link_freq_configs[link_freq_index].reg_list;
+	start = ktime_get_ns();
 	ret = ov02c10_write_reg_list(ov02c10, reg_list);
 	if (ret) {
 		dev_err(&client->dev, "failed to set plls");
@@ -990,6 +1036,9 @@ static int ov02c10_start_streaming(struct ov02c10 *ov02c10)
 		dev_err(&client->dev, "failed to set mode");
 		return ret;
 	}
+	sensor_i2c_stats_mode(&ov02c10->i2c_stats,
+			      ov02c10->cur_mode->width,
+			      ov02c10->cur_mode->height, start);
 
 	ret = __v4l2_ctrl_handler_setup(ov02c10->sd.ctrl_handler);
 	if (ret)
@@ -999,20 +1048,20 @@ static int ov02c10_start_streaming(struct ov02c10 *ov02c10)
 	case MODULE_CJFME32:
 	case MODULE_2BG203N3:
 	case MODULE_KBFC645:
-		ret = ov02c10_read_reg(ov02c10, OV02C10_ROTATE_CONTROL,
-				       1, &rotate);
+		ret = ov02c10_read_cached(ov02c10, OV02C10_ROTATE_CONTROL,
+					  1, &rotate);
 		if (ret)
 			dev_err(&client->dev,
 				"read ROTATE_CONTROL fail: %d", ret);
 
-		ret = ov02c10_read_reg(ov02c10, OV02C10_ISP_X_WIN_CONTROL,
-				       1, &shift_x);
+		ret = ov02c10_read_cached(ov02c10, OV02C10_ISP_X_WIN_CONTROL,
+					  1, &shift_x);
 		if (ret)
 			dev_err(&client->dev,
 				"read ISP_X_WIN_CONTROL fail: %d", ret);
 
-		ret = ov02c10_read_reg(ov02c10, OV02C10_ISP_Y_WIN_CONTROL,
-				       1, &shift_y);
+		ret = ov02c10_read_cached(ov02c10, OV02C10_ISP_Y_WIN_CONTROL,
+					  1, &shift_y);
 		if (ret)
 			dev_err(&client->dev,
 				"read ISP_Y_WIN_CONTROL fail: %d", ret);
@@ -1179,6 +1228,8 @@ static int ov02c10_power_off(struct device *dev)
 	struct ov02c10 *ov02c10 = to_ov02c10(sd);
 	int ret = 0;
 
+	sensor_reg_shadow_reset(&ov02c10->shadow);
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 6, 0) && \
 IS_ENABLED(CONFIG_INTEL_VSC)
 	if (ov02c10->use_intel_vsc) {
@@ -1262,6 +1313,7 @@ static int __maybe_unused ov02c10_suspend(struct device *dev)
 	mutex_lock(&ov02c10->mutex);
 	if (ov02c10->streaming)
 		ov02c10_stop_streaming(ov02c10);
+	sensor_reg_shadow_reset(&ov02c10->shadow);
 
 	mutex_unlock(&ov02c10->mutex);
 
@@ -1586,6 +1638,7 @@ static void ov02c10_remove(struct i2c_client *client)
 	media_entity_cleanup(&sd->entity);
 	v4l2_ctrl_handler_free(sd->ctrl_handler);
 	pm_runtime_disable(&client->dev);
+	sensor_reg_shadow_reset(&ov02c10->shadow);
 	mutex_destroy(&ov02c10->mutex);
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 1, 0)
@@ -1640,6 +1693,9 @@ static int ov02c10_probe(struct i2c_client *client)
 		return -ENOMEM;
 
 	v4l2_i2c_subdev_init(&ov02c10->sd, client, &ov02c10_subdev_ops);
+	ret = sensor_i2c_stats_init(&ov02c10->i2c_stats, &client->dev);
+	if (ret)
+		return ret;
 	ov02c10_get_pm_resources(&client->dev);
 
 	ret = ov02c10_power_on(&client->dev);
@@ -1657,6 +1713,7 @@ static int ov02c10_probe(struct i2c_client *client)
 	ov02c10_read_module_name(ov02c10);
 	ov02c10_read_mipi_lanes(ov02c10);
 	mutex_init(&ov02c10->mutex);
+	sensor_reg_shadow_init(&ov02c10->shadow);
 	ov02c10->cur_mode = &supported_modes[0];
 	if (ov02c10->mipi_lanes == 2)
 		ov02c10->cur_mode = &supported_modes[1];
@@ -1689,6 +1746,7 @@ static int ov02c10_probe(struct i2c_client *client)
 	 * Enable runtime PM and turn off the device.
 	 */
 	pm_runtime_set_active(&client->dev);
+	device_enable_async_suspend(&client->dev);
 	pm_runtime_enable(&client->dev);
 	pm_runtime_idle(&client->dev);
 
@@ -1724,6 +1782,7 @@ MODULE_DEVICE_TABLE(acpi, ov02c10_acpi_ids);
 static struct i2c_driver ov02c10_i2c_driver = {
 	.driver = {
 		.name = "ov02c10",
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 		.pm = &ov02c10_pm_ops,
 		.acpi_match_table = ACPI_PTR(ov02c10_acpi_ids),
 	},
@@ -13,6 +13,10 @@
 #include <media/v4l2-ctrls.h>
 #include <media/v4l2-device.h>
 #include <media/v4l2-fwnode.h>
+#include "sensor_reg_burst.h"
+#include "sensor_group_hold.h"
+#include "sensor_i2c_stats.h"
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 6, 0) && \
     IS_ENABLED(CONFIG_INTEL_VSC)
 #include <linux/vsc.h>
@@ -302,12 +306,18 @@ struct ov02e10 {
 	/* To serialize asynchronus callbacks */
 	struct mutex mutex;
 
+	/* Control writes waiting for one group launch, under mutex */
+	struct sensor_group_hold hold;
+
 	/* Streaming on/off */
 	bool streaming;
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 6, 0) && \
     IS_ENABLED(CONFIG_INTEL_VSC)
 	bool use_intel_vsc;
 #endif
+
+	/* I2C timing of the register helpers */
+	struct sensor_i2c_stats i2c_stats;
 };
 
 static inline struct ov02e10 *to_ov02e10(struct v4l2_subdev *subdev)
@@ -339,6 +349,7 @@ static int ov02e10_read_reg(struct ov02e10 *ov02e10, u8 reg, u16 len, u32 *val)
 	struct i2c_msg msgs[2];
 	u8 data_buf[4] = { 0 };
 	int ret;
+	u64 start;
 
 	if (len > sizeof(data_buf))
 		return -EINVAL;
@@ -352,7 +363,10 @@ static int ov02e10_read_reg(struct ov02e10 *ov02e10, u8 reg, u16 len, u32 *val)
 	msgs[1].len = len;
 	msgs[1].buf = &data_buf[sizeof(data_buf) - len];
 
+	start = ktime_get_ns();
 	ret = i2c_transfer(client->adapter, msgs, ARRAY_SIZE(msgs));
+	sensor_i2c_stats_add(&ov02e10->i2c_stats, SENSOR_I2C_READ,
+			     msgs[0].len + len, start);
 	if (ret != ARRAY_SIZE(msgs))
 		return ret < 0 ? ret : -EIO;
 
@@ -366,6 +380,7 @@ static int ov02e10_write_reg(struct ov02e10 *ov02e10, u8 reg, u16 len, u32 val)
 	struct i2c_client *client = v4l2_get_subdevdata(&ov02e10->sd);
 	u8 buf[5];
 	int ret;
+	u64 start;
 
 	if (len > 4)
 		return -EINVAL;
@@ -379,7 +394,10 @@ static int ov02e10_write_reg(struct ov02e10 *ov02e10, u8 reg, u16 len, u32 val)
 	buf[0] = reg;
 	put_unaligned_be32(val << 8 * (4 - len), buf + 1);
 
+	start = ktime_get_ns();
 	ret = i2c_master_send(client, buf, len + 1);
+	sensor_i2c_stats_add(&ov02e10->i2c_stats, SENSOR_I2C_WRITE, len + 1,
+			     start);
 	if (ret != len + 1) {
 		dev_err(&client->dev, "failed to write reg %d val %d", reg,
 			val);
@@ -393,21 +411,36 @@ static int ov02e10_write_reg_list(struct ov02e10 *ov02e10,
 				  const struct ov02e10_reg_list *r_list)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(&ov02e10->sd);
+	struct sensor_reg_burst burst;
 	unsigned int i;
 	int ret;
+	u64 start;
 
+	start = ktime_get_ns();
+	sensor_reg_burst_init(&burst, client, 1, 1);
 	for (i = 0; i < r_list->num_of_regs; i++) {
-		ret = ov02e10_write_reg(ov02e10, r_list->regs[i].address, 1,
-					r_list->regs[i].val);
-		if (ret) {
-			dev_err_ratelimited(&client->dev,
-					    "write reg 0x%4.4x return err = %d",
-					    r_list->regs[i].address, ret);
-			return ret;
-		}
+		if (r_list->regs[i].address == OV02E10_REG_DELAY)
+			ret = sensor_reg_burst_delay(&burst,
+						     r_list->regs[i].val);
+		else
+			ret = sensor_reg_burst_add(&burst,
+						   r_list->regs[i].address,
+						   r_list->regs[i].val);
+		if (ret)
+			goto err;
 	}
 
-	return 0;
+	ret = sensor_reg_burst_flush(&burst);
+	sensor_i2c_stats_add(&ov02e10->i2c_stats, SENSOR_I2C_LIST, burst.sent,
+			     start);
+	if (!ret)
+		return 0;
+
+err:
+	dev_err_ratelimited(&client->dev,
+			    "write reg 0x%4.4x return err = %d",
+			    burst.start, ret);
+	return ret;
 }
 
 static int ov02e10_test_pattern(struct ov02e10 *ov02e10, u32 pattern)
@@ -420,6 +453,27 @@ static int ov02e10_test_pattern(struct ov02e10 *ov02e10, u32 pattern)
 				 pattern);
 }
 
+static int ov02e10_group_hold(struct sensor_group_hold *g)
+{
+	struct ov02e10 *ov02e10 = container_of(g, struct ov02e10, hold);
+
+	return ov02e10_write_reg(ov02e10, OV02E10_REG_COMMAND_UPDATE, 1,
+				 OV02E10_COMMAND_HOLD);
+}
+
+static int ov02e10_group_launch(struct sensor_group_hold *g)
+{
+	struct ov02e10 *ov02e10 = container_of(g, struct ov02e10, hold);
+
+	return ov02e10_write_reg(ov02e10, OV02E10_REG_COMMAND_UPDATE, 1,
+				 OV02E10_COMMAND_UPDATE);
+}
+
+static const struct sensor_group_hold_ops ov02e10_group_hold_ops = {
+	.hold = ov02e10_group_hold,
+	.launch = ov02e10_group_launch,
+};
+
 static int ov02e10_set_ctrl(struct v4l2_ctrl *ctrl)
 {
 	struct ov02e10 *ov02e10 = container_of(ctrl->handler,
@@ -442,8 +496,9 @@ static int ov02e10_set_ctrl(struct v4l2_ctrl *ctrl)
 	/* V4L2 controls values will be applied only when power is already up */
 	if (!pm_runtime_get_if_in_use(&client->dev))
 		return 0;
-	ret = ov02e10_write_reg(ov02e10, OV02E10_REG_COMMAND_UPDATE, 1,
-				OV02E10_COMMAND_HOLD);
+	ret = sensor_group_hold_begin(&ov02e10->hold);
+	if (ret)
+		dev_dbg(&client->dev, "failed to hold command");
 
 	switch (ctrl->id) {
 	case V4L2_CID_ANALOGUE_GAIN:
@@ -497,9 +552,6 @@ static int ov02e10_set_ctrl(struct v4l2_ctrl *ctrl)
 		ret = -EINVAL;
 		break;
 	}
-	dev_dbg(&client->dev, "will update cmd\n");
-	ret |= ov02e10_write_reg(ov02e10, OV02E10_REG_COMMAND_UPDATE, 1,
-				 OV02E10_COMMAND_UPDATE);
 
 	pm_runtime_put(&client->dev);
 
@@ -618,14 +670,19 @@ static int ov02e10_start_streaming(struct ov02e10 *ov02e10)
 	struct i2c_client *client = v4l2_get_subdevdata(&ov02e10->sd);
 	const struct ov02e10_reg_list *reg_list;
 	int ret;
+	u64 start;
 
 	dev_dbg(&client->dev, "start to set sensor settings\n");
 	reg_list = &ov02e10->cur_mode->reg_list;
+	start = ktime_get_ns();
 	ret = ov02e10_write_reg_list(ov02e10, reg_list);
 	if (ret) {
 		dev_err(&client->dev, "failed to set mode");
 		return ret;
 	}
+	sensor_i2c_stats_mode(&ov02e10->i2c_stats,
+			      ov02e10->cur_mode->width,
+			      ov02e10->cur_mode->height, start);
 	dev_dbg(&client->dev, "start to set ctrl_handler\n");
 	ret = __v4l2_ctrl_handler_setup(ov02e10->sd.ctrl_handler);
 	if (ret) {
@@ -633,6 +690,10 @@ static int ov02e10_start_streaming(struct ov02e10 *ov02e10)
 		return ret;
 	}
 
+	ret = sensor_group_hold_launch(&ov02e10->hold);
+	if (ret)
+		return ret;
+
 	dev_dbg(&client->dev, "start to streaming\n");
 	ret = ov02e10_write_reg_list(ov02e10, &ov02e10_streaming_list);
 	if (ret) {
@@ -648,6 +709,9 @@ static void ov02e10_stop_streaming(struct ov02e10 *ov02e10)
 	struct i2c_client *client = v4l2_get_subdevdata(&ov02e10->sd);
 	int ret;
 
+	/* An open group would capture the stream off write */
+	sensor_group_hold_launch(&ov02e10->hold);
+
 	ret = ov02e10_write_reg_list(ov02e10, &ov02e10_standby_list);
 	if (ret)
 		dev_err(&client->dev, "failed to stop streaming: %d", ret);
@@ -1110,6 +1174,7 @@ static void ov02e10_remove(struct i2c_client *client)
 
 	v4l2_async_unregister_subdev(sd);
 	media_entity_cleanup(&sd->entity);
+	sensor_group_hold_cancel(&ov02e10->hold);
 	v4l2_ctrl_handler_free(sd->ctrl_handler);
 	pm_runtime_disable(&client->dev);
 	mutex_destroy(&ov02e10->mutex);
@@ -1137,6 +1202,9 @@ static int ov02e10_probe(struct i2c_client *client)
 
 	/* Initialize subdev */
 	v4l2_i2c_subdev_init(&ov02e->sd, client, &ov02e10_subdev_ops);
+	ret = sensor_i2c_stats_init(&ov02e->i2c_stats, &client->dev);
+	if (ret)
+		return ret;
 	ov02e10_get_pm_resources(&client->dev);
 
 	ret = ov02e10_power_on(&client->dev);
@@ -1152,6 +1220,10 @@ static int ov02e10_probe(struct i2c_client *client)
 		goto error_power_off;
 	}
 
+	mutex_init(&ov02e->mutex);
+	sensor_group_hold_init(&ov02e->hold, &client->dev, &ov02e->mutex,
+			       &ov02e10_group_hold_ops);
+
 	/* Set default mode to max resolution */
 	ov02e->cur_mode = &supported_modes[0];
 
@@ -1185,6 +1257,7 @@ static int ov02e10_probe(struct i2c_client *client)
 	 * Enable runtime PM and turn off the device.
 	 */
 	pm_runtime_set_active(&client->dev);
+	device_enable_async_suspend(&client->dev);
 	pm_runtime_enable(&client->dev);
 	pm_runtime_idle(&client->dev);
 
@@ -1194,6 +1267,7 @@ error_media_entity:
 	media_entity_cleanup(&ov02e->sd.entity);
 
 error_handler_free:
+	sensor_group_hold_cancel(&ov02e->hold);
 	v4l2_ctrl_handler_free(ov02e->sd.ctrl_handler);
 	mutex_destroy(&ov02e->mutex);
 	dev_err(&client->dev, "%s failed:%d\n", __func__, ret);
@@ -1219,6 +1293,7 @@ MODULE_DEVICE_TABLE(acpi, ov02e10_acpi_ids);
 static struct i2c_driver ov02e10_i2c_driver = {
 	.driver = {
 		   .name = "ov02e10",
+		   .probe_type = PROBE_PREFER_ASYNCHRONOUS,
 		   .pm = &ov02e10_pm_ops,
 		   .acpi_match_table = ov02e10_acpi_ids,
 		    },
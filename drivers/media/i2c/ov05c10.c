@@ -937,6 +937,7 @@ static int ov05c10_probe(struct i2c_client *client)
 	 * Enable runtime PM and turn off the device.
 	 */
 	pm_runtime_set_active(&client->dev);
+	device_enable_async_suspend(&client->dev);
 	pm_runtime_enable(&client->dev);
 	pm_runtime_set_autosuspend_delay(&client->dev, 1000);
 	pm_runtime_use_autosuspend(&client->dev);
@@ -988,6 +989,7 @@ MODULE_DEVICE_TABLE(acpi, ov05c10_acpi_ids);
 static struct i2c_driver ov05c10_i2c_driver = {
 	.driver = {
 		.name  = "ov05c10",
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 		.pm = pm_ptr(&ov05c10_pm_ops),
 		.acpi_match_table = ACPI_PTR(ov05c10_acpi_ids),
 	},
@@ -10,6 +10,7 @@
 #include <linux/nvmem-provider.h>
 #include <linux/regmap.h>
 #include <linux/version.h>
+#include <linux/workqueue.h>
 #include <media/v4l2-ctrls.h>
 #include <media/v4l2-device.h>
 #include <media/v4l2-fwnode.h>
@@ -17,6 +18,10 @@
 #include <linux/clk.h>
 #include <linux/gpio/consumer.h>
 
+#include "sensor_reg_burst.h"
+#include "sensor_group_hold.h"
+#include "sensor_i2c_stats.h"
+
 #define OV2740_LINK_FREQ_360MHZ		360000000ULL
 #define OV2740_LINK_FREQ_180MHZ		180000000ULL
 #define OV2740_SCLK			72000000LL
@@ -31,6 +36,12 @@
 #define OV2740_MODE_STANDBY		0x00
 #define OV2740_MODE_STREAMING		0x01
 
+/* Keep the sensor powered and its mode retained after stream off */
+#define OV2740_AUTOSUSPEND_DELAY_MS	1000
+
+/* XVCLK cycles from reset release to the first SCCB access */
+#define OV2740_RESET_SETTLE_CYCLES	8192
+
 #define OV2740_REG_DELAY 		0xffff
 
 /* vertical-timings from sensor */
@@ -85,6 +96,8 @@ struct nvm_data {
 	struct nvmem_device *nvmem;
 	struct regmap *regmap;
 	char *nvm_buffer;
+	/* Reads the OTP once after probe */
+	struct work_struct load_work;
 };
 
 enum {
@@ -553,9 +566,15 @@ struct ov2740 {
 	/* To serialize asynchronus callbacks */
 	struct mutex mutex;
 
+	/* Control writes waiting for one group launch, under mutex */
+	struct sensor_group_hold hold;
+
 	/* Streaming on/off */
 	bool streaming;
 
+	/* Mode still programmed in standby, NULL once powered off */
+	const struct ov2740_mode *retained;
+
 	/* NVM data inforamtion */
 	struct nvm_data *nvm;
 
@@ -569,6 +588,9 @@ struct ov2740 {
 
 	/* Module name index */
 	u8 module_name_index;
+
+	/* I2C timing of the register helpers */
+	struct sensor_i2c_stats i2c_stats;
 };
 
 static inline struct ov2740 *to_ov2740(struct v4l2_subdev *subdev)
@@ -601,6 +623,7 @@ static int ov2740_read_reg(struct ov2740 *ov2740, u16 reg, u16 len, u32 *val)
 	u8 addr_buf[2];
 	u8 data_buf[4] = {0};
 	int ret = 0;
+	u64 start;
 
 	if (len > sizeof(data_buf))
 		return -EINVAL;
@@ -615,7 +638,10 @@ static int ov2740_read_reg(struct ov2740 *ov2740, u16 reg, u16 len, u32 *val)
 	msgs[1].len = len;
 	msgs[1].buf = &data_buf[sizeof(data_buf) - len];
 
+	start = ktime_get_ns();
 	ret = i2c_transfer(client->adapter, msgs, ARRAY_SIZE(msgs));
+	sensor_i2c_stats_add(&ov2740->i2c_stats, SENSOR_I2C_READ,
+			     msgs[0].len + len, start);
 	if (ret != ARRAY_SIZE(msgs))
 		return ret < 0 ? ret : -EIO;
 
@@ -629,6 +655,7 @@ static int ov2740_write_reg(struct ov2740 *ov2740, u16 reg, u16 len, u32 val)
 	struct i2c_client *client = ov2740->client;
 	u8 buf[6];
 	int ret = 0;
+	u64 start;
 
 	if (len > 4)
 		return -EINVAL;
@@ -641,7 +668,10 @@ static int ov2740_write_reg(struct ov2740 *ov2740, u16 reg, u16 len, u32 val)
 	put_unaligned_be16(reg, buf);
 	put_unaligned_be32(val << 8 * (4 - len), buf + 2);
 
+	start = ktime_get_ns();
 	ret = i2c_master_send(client, buf, len + 2);
+	sensor_i2c_stats_add(&ov2740->i2c_stats, SENSOR_I2C_WRITE, len + 2,
+			     start);
 	if (ret != len + 2)
 		return ret < 0 ? ret : -EIO;
 
@@ -652,32 +682,42 @@ static int ov2740_write_reg_list(struct ov2740 *ov2740,
 				 const struct ov2740_reg_list *r_list)
 {
 	struct i2c_client *client = ov2740->client;
+	struct sensor_reg_burst burst;
 	unsigned int i;
-	int ret = 0;
+	int ret;
+	u64 start;
 
+	start = ktime_get_ns();
+	sensor_reg_burst_init(&burst, client, 2, 1);
 	for (i = 0; i < r_list->num_of_regs; i++) {
-		ret = ov2740_write_reg(ov2740, r_list->regs[i].address, 1,
-				       r_list->regs[i].val);
-		if (ret) {
-			dev_err_ratelimited(&client->dev,
-					    "write reg 0x%4.4x return err = %d",
-					    r_list->regs[i].address, ret);
-			return ret;
-		}
+		if (r_list->regs[i].address == OV2740_REG_DELAY)
+			ret = sensor_reg_burst_delay(&burst,
+						     r_list->regs[i].val);
+		else
+			ret = sensor_reg_burst_add(&burst,
+						   r_list->regs[i].address,
+						   r_list->regs[i].val);
+		if (ret)
+			goto err;
 	}
 
-	return 0;
+	ret = sensor_reg_burst_flush(&burst);
+	sensor_i2c_stats_add(&ov2740->i2c_stats, SENSOR_I2C_LIST, burst.sent,
+			     start);
+	if (!ret)
+		return 0;
+
+err:
+	dev_err_ratelimited(&client->dev,
+			    "write reg 0x%4.4x return err = %d",
+			    burst.start, ret);
+	return ret;
 }
 
 static int ov2740_update_digital_gain(struct ov2740 *ov2740, u32 d_gain)
 {
 	int ret = 0;
 
-	ret = ov2740_write_reg(ov2740, OV2740_REG_GROUP_ACCESS, 1,
-			       OV2740_GROUP_HOLD_START);
-	if (ret)
-		return ret;
-
 	ret = ov2740_write_reg(ov2740, OV2740_REG_MWB_R_GAIN, 2, d_gain);
 	if (ret)
 		return ret;
@@ -687,16 +727,6 @@ static int ov2740_update_digital_gain(struct ov2740 *ov2740, u32 d_gain)
 		return ret;
 
 	ret = ov2740_write_reg(ov2740, OV2740_REG_MWB_B_GAIN, 2, d_gain);
-	if (ret)
-		return ret;
-
-	ret = ov2740_write_reg(ov2740, OV2740_REG_GROUP_ACCESS, 1,
-			       OV2740_GROUP_HOLD_END);
-	if (ret)
-		return ret;
-
-	ret = ov2740_write_reg(ov2740, OV2740_REG_GROUP_ACCESS, 1,
-			       OV2740_GROUP_HOLD_LAUNCH);
 	return ret;
 }
 
@@ -709,6 +739,33 @@ static int ov2740_test_pattern(struct ov2740 *ov2740, u32 pattern)
 	return ov2740_write_reg(ov2740, OV2740_REG_TEST_PATTERN, 1, pattern);
 }
 
+static int ov2740_group_hold(struct sensor_group_hold *g)
+{
+	struct ov2740 *ov2740 = container_of(g, struct ov2740, hold);
+
+	return ov2740_write_reg(ov2740, OV2740_REG_GROUP_ACCESS, 1,
+				OV2740_GROUP_HOLD_START);
+}
+
+static int ov2740_group_launch(struct sensor_group_hold *g)
+{
+	struct ov2740 *ov2740 = container_of(g, struct ov2740, hold);
+	int ret;
+
+	ret = ov2740_write_reg(ov2740, OV2740_REG_GROUP_ACCESS, 1,
+			       OV2740_GROUP_HOLD_END);
+	if (ret)
+		return ret;
+
+	return ov2740_write_reg(ov2740, OV2740_REG_GROUP_ACCESS, 1,
+				OV2740_GROUP_HOLD_LAUNCH);
+}
+
+static const struct sensor_group_hold_ops ov2740_group_hold_ops = {
+	.hold = ov2740_group_hold,
+	.launch = ov2740_group_launch,
+};
+
 static int ov2740_set_ctrl(struct v4l2_ctrl *ctrl)
 {
 	struct ov2740 *ov2740 = container_of(ctrl->handler,
@@ -732,6 +789,10 @@ static int ov2740_set_ctrl(struct v4l2_ctrl *ctrl)
 	if (!pm_runtime_get_if_in_use(&client->dev))
 		return 0;
 
+	ret = sensor_group_hold_begin(&ov2740->hold);
+	if (ret)
+		dev_dbg(&client->dev, "failed to start group hold");
+
 	switch (ctrl->id) {
 	case V4L2_CID_ANALOGUE_GAIN:
 		ret = ov2740_write_reg(ov2740, OV2740_REG_ANALOG_GAIN, 2,
@@ -866,7 +927,9 @@ static int ov2740_load_otp_data(struct nvm_data *nvm)
 	client = nvm->client;
 	ov2740 = to_ov2740(i2c_get_clientdata(client));
 
-	nvm->nvm_buffer = kzalloc(CUSTOMER_USE_OTP_SIZE, GFP_KERNEL);
+	/* devm, the nvmem device outlives remove() and may still read it */
+	nvm->nvm_buffer = devm_kzalloc(&client->dev, CUSTOMER_USE_OTP_SIZE,
+				       GFP_KERNEL);
 	if (!nvm->nvm_buffer)
 		return -ENOMEM;
 
@@ -939,7 +1002,7 @@ static int ov2740_load_otp_data(struct nvm_data *nvm)
 
 	return 0;
 err:
-	kfree(nvm->nvm_buffer);
+	devm_kfree(&client->dev, nvm->nvm_buffer);
 	nvm->nvm_buffer = NULL;
 
 	return ret;
@@ -952,28 +1015,42 @@ static int ov2740_start_streaming(struct ov2740 *ov2740)
 	const struct ov2740_reg_list *reg_list;
 	int link_freq_index;
 	int ret = 0;
+	u64 start;
 
-	ov2740_load_otp_data(nvm);
+	if (ov2740->retained != ov2740->cur_mode) {
+		ov2740->retained = NULL;
 
-	link_freq_index = ov2740->cur_mode->link_freq_index;
-	reg_list = &link_freq_configs[link_freq_index].reg_list;
-	ret = ov2740_write_reg_list(ov2740, reg_list);
-	if (ret) {
-		dev_err(&client->dev, "failed to set plls");
-		return ret;
-	}
+		ov2740_load_otp_data(nvm);
 
-	reg_list = &ov2740->cur_mode->reg_list;
-	ret = ov2740_write_reg_list(ov2740, reg_list);
-	if (ret) {
-		dev_err(&client->dev, "failed to set mode");
-		return ret;
+		link_freq_index = ov2740->cur_mode->link_freq_index;
+		reg_list = &link_freq_configs[link_freq_index].reg_list;
+		start = ktime_get_ns();
+		ret = ov2740_write_reg_list(ov2740, reg_list);
+		if (ret) {
+			dev_err(&client->dev, "failed to set plls");
+			return ret;
+		}
+
+		reg_list = &ov2740->cur_mode->reg_list;
+		ret = ov2740_write_reg_list(ov2740, reg_list);
+		if (ret) {
+			dev_err(&client->dev, "failed to set mode");
+			return ret;
+		}
+		sensor_i2c_stats_mode(&ov2740->i2c_stats,
+				      ov2740->cur_mode->width,
+				      ov2740->cur_mode->height, start);
+		ov2740->retained = ov2740->cur_mode;
 	}
 
 	ret = __v4l2_ctrl_handler_setup(ov2740->sd.ctrl_handler);
 	if (ret)
 		return ret;
 
+	ret = sensor_group_hold_launch(&ov2740->hold);
+	if (ret)
+		return ret;
+
 	ret = ov2740_write_reg(ov2740, OV2740_REG_MODE_SELECT, 1,
 			       OV2740_MODE_STREAMING);
 	if (ret)
@@ -986,6 +1063,9 @@ static void ov2740_stop_streaming(struct ov2740 *ov2740)
 {
 	struct i2c_client *client = ov2740->client;
 
+	/* An open group would capture the stream off write */
+	sensor_group_hold_launch(&ov2740->hold);
+
 	if (ov2740_write_reg(ov2740, OV2740_REG_MODE_SELECT, 1,
 			     OV2740_MODE_STANDBY))
 		dev_err(&client->dev, "failed to stop streaming");
@@ -1016,7 +1096,8 @@ static int ov2740_set_stream(struct v4l2_subdev *sd, int enable)
 		}
 	} else {
 		ov2740_stop_streaming(ov2740);
-		pm_runtime_put(&client->dev);
+		pm_runtime_mark_last_busy(&client->dev);
+		pm_runtime_put_autosuspend(&client->dev);
 	}
 
 	ov2740->streaming = enable;
@@ -1031,6 +1112,7 @@ static int ov2740_power_off(struct device *dev)
 	struct ov2740 *ov2740 = to_ov2740(sd);
 	int ret = 0;
 
+	ov2740->retained = NULL;
 	gpiod_set_value_cansleep(ov2740->reset_gpio, 1);
 	clk_disable_unprepare(ov2740->clk);
 	msleep(20);
@@ -1042,11 +1124,22 @@ static int ov2740_power_on(struct device *dev)
 {
 	struct v4l2_subdev *sd = dev_get_drvdata(dev);
 	struct ov2740 *ov2740 = to_ov2740(sd);
+	unsigned long rate;
+	unsigned int us;
 	int ret = 0;
 
 	ret = clk_prepare_enable(ov2740->clk);
 	gpiod_set_value_cansleep(ov2740->reset_gpio, 0);
-	msleep(20);
+
+	/* Without a known clock rate keep the old conservative wait */
+	rate = clk_get_rate(ov2740->clk);
+	if (rate) {
+		us = DIV_ROUND_UP_ULL((u64)OV2740_RESET_SETTLE_CYCLES *
+				      USEC_PER_SEC, rate);
+		usleep_range(us, us + 100);
+	} else {
+		msleep(20);
+	}
 
 	return ret;
 }
@@ -1059,6 +1152,7 @@ static int __maybe_unused ov2740_suspend(struct device *dev)
 	mutex_lock(&ov2740->mutex);
 	if (ov2740->streaming)
 		ov2740_stop_streaming(ov2740);
+	ov2740->retained = NULL;
 
 	mutex_unlock(&ov2740->mutex);
 
@@ -1363,11 +1457,18 @@ static void ov2740_remove(struct i2c_client *client)
 	struct v4l2_subdev *sd = i2c_get_clientdata(client);
 	struct ov2740 *ov2740 = to_ov2740(sd);
 
+	if (ov2740->nvm)
+		cancel_work_sync(&ov2740->nvm->load_work);
 	v4l2_async_unregister_subdev(sd);
 	media_entity_cleanup(&sd->entity);
+	sensor_group_hold_cancel(&ov2740->hold);
 	v4l2_ctrl_handler_free(sd->ctrl_handler);
 	pm_runtime_disable(&client->dev);
-	mutex_destroy(&ov2740->mutex);
+	pm_runtime_dont_use_autosuspend(&client->dev);
+	/*
+	 * No mutex_destroy(): the devm nvmem device is unregistered after
+	 * remove() and its reads still take the mutex until then.
+	 */
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 1, 0)
 	return 0;
@@ -1404,6 +1505,33 @@ exit:
 	return ret;
 }
 
+/* Have the OTP cached before the first stream on or nvmem read */
+static void ov2740_otp_load_work(struct work_struct *work)
+{
+	struct nvm_data *nvm = container_of(work, struct nvm_data, load_work);
+	struct ov2740 *ov2740 = to_ov2740(i2c_get_clientdata(nvm->client));
+	struct device *dev = &nvm->client->dev;
+	int ret;
+
+	mutex_lock(&ov2740->mutex);
+	/* Loading toggles streaming, leave a running stream alone */
+	if (nvm->nvm_buffer || ov2740->streaming)
+		goto exit;
+
+	ret = pm_runtime_resume_and_get(dev);
+	if (ret < 0)
+		goto exit;
+
+	ret = ov2740_load_otp_data(nvm);
+	if (ret)
+		dev_dbg(dev, "OTP preload failed, ret %d\n", ret);
+
+	pm_runtime_mark_last_busy(dev);
+	pm_runtime_put_autosuspend(dev);
+exit:
+	mutex_unlock(&ov2740->mutex);
+}
+
 static int ov2740_register_nvmem(struct i2c_client *client,
 				 struct ov2740 *ov2740)
 {
@@ -1427,6 +1555,7 @@ static int ov2740_register_nvmem(struct i2c_client *client,
 
 	nvm->regmap = regmap;
 	nvm->client = client;
+	INIT_WORK(&nvm->load_work, ov2740_otp_load_work);
 
 	nvmem_config.name = dev_name(dev);
 	nvmem_config.dev = dev;
@@ -1524,6 +1653,9 @@ static int ov2740_probe(struct i2c_client *client)
 				     ret);
 
 	v4l2_i2c_subdev_init(&ov2740->sd, client, &ov2740_subdev_ops);
+	ret = sensor_i2c_stats_init(&ov2740->i2c_stats, &client->dev);
+	if (ret)
+		return ret;
 
 	ret = ov2740_parse_power(ov2740);
 	if (ret)
@@ -1538,6 +1670,8 @@ static int ov2740_probe(struct i2c_client *client)
 	}
 
 	mutex_init(&ov2740->mutex);
+	sensor_group_hold_init(&ov2740->hold, &client->dev, &ov2740->mutex,
+			       &ov2740_group_hold_ops);
 	if (ov2740->module_name_index >= ARRAY_SIZE(ov2740_module_names)) {
 		ov2740->module_name_index = 0;
 		dev_err(&client->dev, "unknown module_name_index: %d",
@@ -1585,15 +1719,23 @@ static int ov2740_probe(struct i2c_client *client)
 	 * Enable runtime PM and turn off the device.
 	 */
 	pm_runtime_set_active(&client->dev);
+	pm_runtime_set_autosuspend_delay(&client->dev,
+					 OV2740_AUTOSUSPEND_DELAY_MS);
+	pm_runtime_use_autosuspend(&client->dev);
+	device_enable_async_suspend(&client->dev);
 	pm_runtime_enable(&client->dev);
 	pm_runtime_idle(&client->dev);
 
+	if (ov2740->nvm)
+		schedule_work(&ov2740->nvm->load_work);
+
 	return 0;
 
 probe_error_media_entity_cleanup:
 	media_entity_cleanup(&ov2740->sd.entity);
 
 probe_error_v4l2_ctrl_handler_free:
+	sensor_group_hold_cancel(&ov2740->hold);
 	v4l2_ctrl_handler_free(ov2740->sd.ctrl_handler);
 	mutex_destroy(&ov2740->mutex);
 
@@ -1618,6 +1760,7 @@ MODULE_DEVICE_TABLE(acpi, ov2740_acpi_ids);
 static struct i2c_driver ov2740_i2c_driver = {
 	.driver = {
 		.name = "ov2740",
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 		.pm = &ov2740_pm_ops,
 		.acpi_match_table = ov2740_acpi_ids,
 	},
@@ -12,6 +12,8 @@
 #include <media/v4l2-device.h>
 #include <media/v4l2-fwnode.h>
 
+#include "sensor_reg_burst.h"
+
 #define OV8856_REG_VALUE_08BIT		1
 #define OV8856_REG_VALUE_16BIT		2
 #define OV8856_REG_VALUE_24BIT		3
@@ -721,21 +723,27 @@ static int ov8856_write_reg_list(struct ov8856 *ov8856,
 				 const struct ov8856_reg_list *r_list)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(&ov8856->sd);
+	struct sensor_reg_burst burst;
 	unsigned int i;
 	int ret;
 
+	sensor_reg_burst_init(&burst, client, 2, 1);
 	for (i = 0; i < r_list->num_of_regs; i++) {
-		ret = ov8856_write_reg(ov8856, r_list->regs[i].address, 1,
-				       r_list->regs[i].val);
-		if (ret) {
-			dev_err_ratelimited(&client->dev,
-					    "failed to W reg 0x%4.4x err %d",
-					    r_list->regs[i].address, ret);
-			return ret;
-		}
+		ret = sensor_reg_burst_add(&burst, r_list->regs[i].address,
+					   r_list->regs[i].val);
+		if (ret)
+			goto err;
 	}
 
-	return 0;
+	ret = sensor_reg_burst_flush(&burst);
+	if (!ret)
+		return 0;
+
+err:
+	dev_err_ratelimited(&client->dev,
+			    "failed to W reg 0x%4.4x err %d",
+			    burst.start, ret);
+	return ret;
 }
 
 static int ov8856_update_digital_gain(struct ov8856 *ov8856, u32 d_gain)
@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (c) 2024 Intel Corporation. */
+
+#ifndef _SENSOR_GROUP_HOLD_H_
+#define _SENSOR_GROUP_HOLD_H_
+
+#include <linux/device.h>
+#include <linux/mutex.h>
+#include <linux/pm_runtime.h>
+#include <linux/workqueue.h>
+
+/*
+ * Group hold batching for sensor controls. The first control written
+ * opens a hold, and everything written until the group is launched
+ * takes effect on the same frame.
+ *
+ * The launch is deferred to a work item taking the control handler
+ * lock. The control framework keeps that lock across a whole
+ * VIDIOC_S_EXT_CTRLS call or handler setup, so all controls of one call
+ * end up in one group. Stream on and stream off launch the group right
+ * away. An open group holds a runtime PM reference.
+ */
+struct sensor_group_hold;
+
+struct sensor_group_hold_ops {
+	int (*hold)(struct sensor_group_hold *g);
+	int (*launch)(struct sensor_group_hold *g);
+};
+
+struct sensor_group_hold {
+	struct device *dev;
+	/* The control handler lock */
+	struct mutex *lock;
+	const struct sensor_group_hold_ops *ops;
+	struct work_struct work;
+	bool open;
+};
+
+/* Call with the lock held */
+static inline int sensor_group_hold_launch(struct sensor_group_hold *g)
+{
+	int ret;
+
+	if (!g->open)
+		return 0;
+
+	g->open = false;
+	ret = g->ops->launch(g);
+	pm_runtime_put(g->dev);
+
+	return ret;
+}
+
+static inline void sensor_group_hold_work(struct work_struct *work)
+{
+	struct sensor_group_hold *g =
+		container_of(work, struct sensor_group_hold, work);
+	int ret;
+
+	mutex_lock(g->lock);
+	ret = sensor_group_hold_launch(g);
+	mutex_unlock(g->lock);
+	if (ret)
+		dev_err(g->dev, "failed to launch group hold: %d", ret);
+}
+
+static inline void sensor_group_hold_init(struct sensor_group_hold *g,
+					  struct device *dev,
+					  struct mutex *lock,
+					  const struct sensor_group_hold_ops *ops)
+{
+	g->dev = dev;
+	g->lock = lock;
+	g->ops = ops;
+	g->open = false;
+	INIT_WORK(&g->work, sensor_group_hold_work);
+}
+
+/* Call with the lock held and the sensor powered */
+static inline int sensor_group_hold_begin(struct sensor_group_hold *g)
+{
+	int ret;
+
+	if (g->open)
+		return 0;
+
+	ret = g->ops->hold(g);
+	if (ret)
+		return ret;
+
+	pm_runtime_get_noresume(g->dev);
+	g->open = true;
+	schedule_work(&g->work);
+
+	return 0;
+}
+
+/* Drop a pending launch on remove, without the lock held */
+static inline void sensor_group_hold_cancel(struct sensor_group_hold *g)
+{
+	cancel_work_sync(&g->work);
+	if (g->open) {
+		g->open = false;
+		pm_runtime_put_noidle(g->dev);
+	}
+}
+
+#endif
@@ -0,0 +1,196 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (c) 2024 Intel Corporation. */
+
+#ifndef _SENSOR_I2C_STATS_H_
+#define _SENSOR_I2C_STATS_H_
+
+#include <linux/debugfs.h>
+#include <linux/device.h>
+#include <linux/fs.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/seq_file.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+enum sensor_i2c_op {
+	SENSOR_I2C_READ,
+	SENSOR_I2C_WRITE,
+	/* A whole register list, delays included */
+	SENSOR_I2C_LIST,
+	SENSOR_I2C_NUM_OPS,
+};
+
+struct sensor_i2c_op_stats {
+	u64 count;
+	u64 bytes;
+	u64 total_ns;
+	u64 max_ns;
+};
+
+#define SENSOR_I2C_STATS_MODES	8
+
+struct sensor_i2c_mode_stats {
+	u32 width;
+	u32 height;
+	u64 max_ns;
+};
+
+/*
+ * I2C time spent in the register helpers of one sensor, shown in
+ * debugfs as <module>/<i2c device name>/i2c_stats. Bytes are those sent and
+ * received on the bus, register addresses included. Writing to the file
+ * clears the figures.
+ */
+struct sensor_i2c_stats {
+	spinlock_t lock;	/* Protects the figures below */
+	struct sensor_i2c_op_stats op[SENSOR_I2C_NUM_OPS];
+	/* Longest mode register list, by mode size */
+	struct sensor_i2c_mode_stats mode[SENSOR_I2C_STATS_MODES];
+	struct dentry *dir;
+};
+
+static inline void sensor_i2c_stats_add(struct sensor_i2c_stats *s,
+					enum sensor_i2c_op op,
+					unsigned int bytes, u64 start)
+{
+	struct sensor_i2c_op_stats *o = &s->op[op];
+	u64 ns = ktime_get_ns() - start;
+
+	spin_lock(&s->lock);
+	o->count++;
+	o->bytes += bytes;
+	o->total_ns += ns;
+	o->max_ns = max(o->max_ns, ns);
+	spin_unlock(&s->lock);
+}
+
+/* A mode register list, start is when its first register was sent */
+static inline void sensor_i2c_stats_mode(struct sensor_i2c_stats *s,
+					 u32 width, u32 height, u64 start)
+{
+	struct sensor_i2c_mode_stats *m;
+	u64 ns = ktime_get_ns() - start;
+	unsigned int i;
+
+	spin_lock(&s->lock);
+	for (i = 0; i < SENSOR_I2C_STATS_MODES; i++) {
+		m = &s->mode[i];
+		if (!m->max_ns) {
+			m->width = width;
+			m->height = height;
+		}
+		if (m->width == width && m->height == height) {
+			m->max_ns = max(m->max_ns, ns);
+			break;
+		}
+	}
+	spin_unlock(&s->lock);
+}
+
+static inline int sensor_i2c_stats_show(struct seq_file *m, void *data)
+{
+	static const char * const names[SENSOR_I2C_NUM_OPS] = {
+		[SENSOR_I2C_READ] = "read",
+		[SENSOR_I2C_WRITE] = "write",
+		[SENSOR_I2C_LIST] = "list",
+	};
+	struct sensor_i2c_stats *s = m->private;
+	struct sensor_i2c_mode_stats mode[SENSOR_I2C_STATS_MODES];
+	struct sensor_i2c_op_stats op[SENSOR_I2C_NUM_OPS];
+	unsigned int i;
+
+	spin_lock(&s->lock);
+	memcpy(op, s->op, sizeof(op));
+	memcpy(mode, s->mode, sizeof(mode));
+	spin_unlock(&s->lock);
+
+	seq_puts(m, "op\tcount\tbytes\ttotal_us\tmax_us\n");
+	for (i = 0; i < SENSOR_I2C_NUM_OPS; i++)
+		seq_printf(m, "%s\t%llu\t%llu\t%llu\t%llu\n", names[i],
+			   op[i].count, op[i].bytes,
+			   div_u64(op[i].total_ns, NSEC_PER_USEC),
+			   div_u64(op[i].max_ns, NSEC_PER_USEC));
+
+	for (i = 0; i < SENSOR_I2C_STATS_MODES && mode[i].max_ns; i++)
+		seq_printf(m, "mode %ux%u\tmax_us %llu\n", mode[i].width,
+			   mode[i].height,
+			   div_u64(mode[i].max_ns, NSEC_PER_USEC));
+
+	return 0;
+}
+
+static inline int sensor_i2c_stats_open(struct inode *inode,
+					struct file *file)
+{
+	return single_open(file, sensor_i2c_stats_show, inode->i_private);
+}
+
+static inline ssize_t sensor_i2c_stats_clear(struct file *file,
+					     const char __user *buf,
+					     size_t count, loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+	struct sensor_i2c_stats *s = m->private;
+
+	spin_lock(&s->lock);
+	memset(s->op, 0, sizeof(s->op));
+	memset(s->mode, 0, sizeof(s->mode));
+	spin_unlock(&s->lock);
+
+	return count;
+}
+
+static const struct file_operations sensor_i2c_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = sensor_i2c_stats_open,
+	.read = seq_read,
+	.write = sensor_i2c_stats_clear,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* The <module> directory, shared by the sensors of the including driver */
+static DEFINE_MUTEX(sensor_i2c_stats_lock);
+static struct dentry *sensor_i2c_stats_root;
+static unsigned int sensor_i2c_stats_users;
+
+static inline void sensor_i2c_stats_remove(void *data)
+{
+	struct sensor_i2c_stats *s = data;
+
+	mutex_lock(&sensor_i2c_stats_lock);
+	debugfs_remove_recursive(s->dir);
+	if (!--sensor_i2c_stats_users) {
+		debugfs_remove_recursive(sensor_i2c_stats_root);
+		sensor_i2c_stats_root = NULL;
+	}
+	mutex_unlock(&sensor_i2c_stats_lock);
+}
+
+/*
+ * Call before the first register access. The debugfs entries go away
+ * with the device.
+ */
+static inline int sensor_i2c_stats_init(struct sensor_i2c_stats *s,
+					struct device *dev)
+{
+	spin_lock_init(&s->lock);
+	memset(s->op, 0, sizeof(s->op));
+	memset(s->mode, 0, sizeof(s->mode));
+
+	mutex_lock(&sensor_i2c_stats_lock);
+	if (!sensor_i2c_stats_users++)
+		sensor_i2c_stats_root = debugfs_create_dir(KBUILD_MODNAME,
+							   NULL);
+	s->dir = debugfs_create_dir(dev_name(dev), sensor_i2c_stats_root);
+	mutex_unlock(&sensor_i2c_stats_lock);
+	debugfs_create_file("i2c_stats", 0600, s->dir, s,
+			    &sensor_i2c_stats_fops);
+
+	return devm_add_action_or_reset(dev, sensor_i2c_stats_remove, s);
+}
+
+#endif
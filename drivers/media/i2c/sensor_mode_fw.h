@@ -0,0 +1,212 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (c) 2024 Intel Corporation. */
+
+#ifndef _SENSOR_MODE_FW_H_
+#define _SENSOR_MODE_FW_H_
+
+#include <linux/delay.h>
+#include <linux/device.h>
+#include <linux/firmware.h>
+#include <linux/i2c.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/types.h>
+#include <linux/version.h>
+
+/* "SMOD" */
+#define SENSOR_MODE_FW_MAGIC		0x444f4d53
+#define SENSOR_MODE_FW_VERSION		2
+#define SENSOR_MODE_FW_MAX_MODES	16
+
+/*
+ * Mode register lists loaded as firmware, replacing the built-in list of
+ * the mode of the same size. The file is little endian: a struct
+ * sensor_mode_fw_header, then num_modes times a struct sensor_mode_fw_mode
+ * followed by size bytes of runs. Version 2 files have a struct
+ * sensor_mode_fw_embedded after each struct sensor_mode_fw_mode: the
+ * embedded data lines (CSI-2 data type 0x12) the runs turn on, if any.
+ *
+ * A run is a count byte followed by the register address (addr_len bytes,
+ * big endian) and count values, exactly as they go on the bus, so each
+ * run is one I2C write straight from the file. A count of zero is a delay,
+ * the next byte being the time in ms.
+ */
+struct sensor_mode_fw_header {
+	__le32 magic;
+	__le16 version;
+	u8 addr_len;
+	u8 num_modes;
+} __packed;
+
+struct sensor_mode_fw_mode {
+	__le16 width;
+	__le16 height;
+	__le32 size;
+} __packed;
+
+struct sensor_mode_fw_embedded {
+	__le16 lines;
+	__le16 bytes_per_line;
+} __packed;
+
+struct sensor_mode_fw_regs {
+	u32 width;
+	u32 height;
+	u32 embedded_lines;
+	u32 embedded_bpl;
+	const u8 *runs;
+	size_t size;
+};
+
+struct sensor_mode_fw {
+	struct i2c_client *client;
+	unsigned int addr_len;
+	unsigned int num_modes;
+	struct sensor_mode_fw_regs modes[SENSOR_MODE_FW_MAX_MODES];
+	/* Bytes sent by the last sensor_mode_fw_write() */
+	unsigned int sent;
+};
+
+static inline bool sensor_mode_fw_runs_valid(struct sensor_mode_fw *f,
+					     const u8 *p, size_t size)
+{
+	const struct i2c_adapter_quirks *q = f->client->adapter->quirks;
+	unsigned int max = q && q->max_write_len ? q->max_write_len : ~0U;
+	const u8 *end = p + size;
+
+	while (p < end) {
+		unsigned int count = *p++;
+		size_t len = count ? f->addr_len + count : 1;
+
+		if (len > end - p || (count && len > max))
+			return false;
+		p += len;
+	}
+
+	return true;
+}
+
+static inline bool sensor_mode_fw_parse(struct sensor_mode_fw *f,
+					const u8 *data, size_t size)
+{
+	const struct sensor_mode_fw_header *h = (const void *)data;
+	const struct sensor_mode_fw_embedded *e;
+	const struct sensor_mode_fw_mode *m;
+	size_t off = sizeof(*h);
+	unsigned int i;
+
+	if (size < sizeof(*h) ||
+	    le32_to_cpu(h->magic) != SENSOR_MODE_FW_MAGIC ||
+	    !le16_to_cpu(h->version) ||
+	    le16_to_cpu(h->version) > SENSOR_MODE_FW_VERSION ||
+	    h->addr_len != f->addr_len ||
+	    h->num_modes > SENSOR_MODE_FW_MAX_MODES)
+		return false;
+
+	for (i = 0; i < h->num_modes; i++) {
+		struct sensor_mode_fw_regs *r = &f->modes[i];
+
+		if (size - off < sizeof(*m))
+			return false;
+		m = (const void *)(data + off);
+		off += sizeof(*m);
+
+		r->width = le16_to_cpu(m->width);
+		r->height = le16_to_cpu(m->height);
+		r->size = le32_to_cpu(m->size);
+		r->embedded_lines = 0;
+		r->embedded_bpl = 0;
+		if (le16_to_cpu(h->version) >= 2) {
+			if (size - off < sizeof(*e))
+				return false;
+			e = (const void *)(data + off);
+			off += sizeof(*e);
+			r->embedded_lines = le16_to_cpu(e->lines);
+			r->embedded_bpl = le16_to_cpu(e->bytes_per_line);
+		}
+		r->runs = data + off;
+		if (r->size > size - off ||
+		    !sensor_mode_fw_runs_valid(f, r->runs, r->size))
+			return false;
+		off += r->size;
+	}
+	f->num_modes = h->num_modes;
+
+	return true;
+}
+
+/*
+ * Load the optional mode firmware. Without the file, or with an invalid
+ * one, the driver keeps its built-in register lists.
+ */
+static inline void sensor_mode_fw_load(struct sensor_mode_fw *f,
+				       struct i2c_client *client,
+				       const char *name, unsigned int addr_len)
+{
+	struct device *dev = &client->dev;
+	const struct firmware *fw;
+	u8 *data;
+	int ret;
+
+	f->client = client;
+	f->addr_len = addr_len;
+	f->num_modes = 0;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 0, 0)
+	ret = firmware_request_nowarn(&fw, name, dev);
+#else
+	ret = request_firmware_direct(&fw, name, dev);
+#endif
+	if (ret)
+		return;
+
+	data = devm_kmemdup(dev, fw->data, fw->size, GFP_KERNEL);
+	if (data && !sensor_mode_fw_parse(f, data, fw->size)) {
+		dev_warn(dev, "invalid %s, using built-in modes\n", name);
+		f->num_modes = 0;
+		devm_kfree(dev, data);
+	} else if (data) {
+		dev_info(dev, "%u mode(s) from %s\n", f->num_modes, name);
+	}
+	release_firmware(fw);
+}
+
+static inline const struct sensor_mode_fw_regs *
+sensor_mode_fw_find(struct sensor_mode_fw *f, u32 width, u32 height)
+{
+	unsigned int i;
+
+	for (i = 0; i < f->num_modes; i++)
+		if (f->modes[i].width == width && f->modes[i].height == height)
+			return &f->modes[i];
+
+	return NULL;
+}
+
+static inline int sensor_mode_fw_write(struct sensor_mode_fw *f,
+				       const struct sensor_mode_fw_regs *r)
+{
+	const u8 *p = r->runs, *end = r->runs + r->size;
+	int ret;
+
+	f->sent = 0;
+	while (p < end) {
+		unsigned int count = *p++;
+		int len = f->addr_len + count;
+
+		if (!count) {
+			msleep(*p++);
+			continue;
+		}
+
+		ret = i2c_master_send(f->client, (const char *)p, len);
+		if (ret != len)
+			return ret < 0 ? ret : -EIO;
+		f->sent += len;
+		p += len;
+	}
+
+	return 0;
+}
+
+#endif
@@ -0,0 +1,114 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (c) 2024 Intel Corporation. */
+
+#ifndef _SENSOR_REG_BURST_H_
+#define _SENSOR_REG_BURST_H_
+
+#include <linux/delay.h>
+#include <linux/i2c.h>
+#include <linux/kernel.h>
+#include <linux/types.h>
+
+/* Largest burst payload, register address excluded */
+#define SENSOR_REG_BURST_MAX	32
+
+/*
+ * Register list writer for sensors that auto-increment the register
+ * address on sequential writes. Registers whose address follows the
+ * end of the previous value go out as one I2C write, the start address
+ * followed by the values back to back. Anything else starts a new run.
+ * Call sensor_reg_burst_flush() after the last register.
+ */
+struct sensor_reg_burst {
+	struct i2c_client *client;
+	unsigned int addr_len;
+	unsigned int val_len;
+	unsigned int max;
+	unsigned int len;
+	/* First register of the current run */
+	u16 start;
+	/* Bytes sent so far, register addresses included */
+	unsigned int sent;
+	u8 buf[2 + SENSOR_REG_BURST_MAX];
+};
+
+static inline void sensor_reg_burst_init(struct sensor_reg_burst *b,
+					 struct i2c_client *client,
+					 unsigned int addr_len,
+					 unsigned int val_len)
+{
+	const struct i2c_adapter_quirks *q = client->adapter->quirks;
+
+	b->client = client;
+	b->addr_len = addr_len;
+	b->val_len = val_len;
+	b->max = SENSOR_REG_BURST_MAX;
+	if (q && q->max_write_len && q->max_write_len > addr_len)
+		b->max = min_t(unsigned int, b->max,
+			       q->max_write_len - addr_len);
+	b->max = max(rounddown(b->max, val_len), val_len);
+	b->len = 0;
+	b->sent = 0;
+}
+
+static inline int sensor_reg_burst_flush(struct sensor_reg_burst *b)
+{
+	unsigned int len = b->addr_len + b->len;
+	int ret;
+
+	if (!b->len)
+		return 0;
+
+	b->len = 0;
+	ret = i2c_master_send(b->client, b->buf, len);
+	if (ret != len)
+		return ret < 0 ? ret : -EIO;
+	b->sent += len;
+
+	return 0;
+}
+
+/* Delay entries of a register list, the run so far goes out first */
+static inline int sensor_reg_burst_delay(struct sensor_reg_burst *b,
+					 unsigned int ms)
+{
+	int ret = sensor_reg_burst_flush(b);
+
+	if (!ret)
+		msleep(ms);
+
+	return ret;
+}
+
+static inline int sensor_reg_burst_add(struct sensor_reg_burst *b,
+				       u16 reg, u32 val)
+{
+	unsigned int i;
+	int ret;
+
+	/* Registers are byte addressed, a run covers start .. start + len */
+	if (b->len && (reg != b->start + b->len ||
+		       b->len + b->val_len > b->max)) {
+		ret = sensor_reg_burst_flush(b);
+		if (ret)
+			return ret;
+	}
+
+	if (!b->len) {
+		b->start = reg;
+		if (b->addr_len == 2) {
+			b->buf[0] = reg >> 8;
+			b->buf[1] = reg & 0xff;
+		} else {
+			b->buf[0] = reg & 0xff;
+		}
+	}
+
+	for (i = 0; i < b->val_len; i++)
+		b->buf[b->addr_len + b->len++] =
+			val >> (8 * (b->val_len - 1 - i));
+
+	return 0;
+}
+
+#endif
@@ -0,0 +1,79 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (c) 2024 Intel Corporation. */
+
+#ifndef _SENSOR_REG_SHADOW_H_
+#define _SENSOR_REG_SHADOW_H_
+
+#include <linux/types.h>
+#include <linux/xarray.h>
+
+/*
+ * Values last written to the sensor, by register key. Only valid while
+ * the sensor stays powered: reset it whenever power may have been lost,
+ * and after a failed write. A register list then only needs to send the
+ * entries that differ from the shadow, and registers the sensor never
+ * changes by itself can be read back without I2C.
+ */
+struct sensor_reg_shadow {
+	struct xarray regs;
+};
+
+static inline void sensor_reg_shadow_init(struct sensor_reg_shadow *s)
+{
+	xa_init(&s->regs);
+}
+
+static inline void sensor_reg_shadow_reset(struct sensor_reg_shadow *s)
+{
+	xa_destroy(&s->regs);
+}
+
+static inline bool sensor_reg_shadow_match(struct sensor_reg_shadow *s,
+					   unsigned long key, u8 val)
+{
+	void *entry = xa_load(&s->regs, key);
+
+	return entry && xa_to_value(entry) == val;
+}
+
+static inline void sensor_reg_shadow_set(struct sensor_reg_shadow *s,
+					 unsigned long key, u8 val)
+{
+	/* Without memory the value is unknown, not stale */
+	if (xa_err(xa_store(&s->regs, key, xa_mk_value(val), GFP_KERNEL)))
+		xa_erase(&s->regs, key);
+}
+
+/* A big endian write of len bytes starting at key */
+static inline void sensor_reg_shadow_write(struct sensor_reg_shadow *s,
+					   unsigned long key,
+					   unsigned int len, u32 val)
+{
+	unsigned int i;
+
+	for (i = 0; i < len; i++)
+		sensor_reg_shadow_set(s, key + i,
+				      val >> (8 * (len - 1 - i)));
+}
+
+/* A big endian read of len bytes, false unless all of them are known */
+static inline bool sensor_reg_shadow_read(struct sensor_reg_shadow *s,
+					  unsigned long key,
+					  unsigned int len, u32 *val)
+{
+	unsigned int i;
+	u32 v = 0;
+
+	for (i = 0; i < len; i++) {
+		void *entry = xa_load(&s->regs, key + i);
+
+		if (!entry)
+			return false;
+		v = v << 8 | xa_to_value(entry);
+	}
+	*val = v;
+
+	return true;
+}
+
+#endif
@@ -2,8 +2,10 @@
 /* Author: Dan Scally <djrscally@gmail.com> */
 
 #include <linux/acpi.h>
+#include <linux/async.h>
 #include <linux/device.h>
 #include <linux/i2c.h>
+#include <linux/ktime.h>
 #include <linux/pci.h>
 #include <linux/property.h>
 #include <linux/version.h>
@@ -330,12 +332,15 @@ static int cio2_bridge_connect_sensor(const struct cio2_sensor_config *cfg,
 	struct cio2_sensor *sensor;
 	struct acpi_device *adev;
 	acpi_status status;
+	u64 start;
 	int ret;
 
 	for_each_acpi_dev_match(adev, cfg->hid, NULL, -1) {
 		if (!adev->status.enabled)
 			continue;
 
+		start = ktime_get_ns();
+
 		if (bridge->n_sensors >= CIO2_NUM_PORTS) {
 			acpi_dev_put(adev);
 			dev_err(&cio2->dev, "Exceeded available CIO2 ports\n");
@@ -392,8 +397,9 @@ static int cio2_bridge_connect_sensor(const struct cio2_sensor_config *cfg,
 
 		cio2_bridge_instantiate_vcm_i2c_client(sensor);
 
-		dev_info(&cio2->dev, "Found supported sensor %s\n",
-			 acpi_dev_name(adev));
+		dev_info(&cio2->dev, "Found supported sensor %s in %llu us\n",
+			 acpi_dev_name(adev),
+			 div_u64(ktime_get_ns() - start, NSEC_PER_USEC));
 
 		bridge->n_sensors++;
 	}
@@ -468,7 +474,7 @@ static int cio2_bridge_sensors_are_ready(void)
 }
 #endif
 
-int cio2_bridge_init(struct pci_dev *cio2)
+static int cio2_bridge_discover(struct pci_dev *cio2)
 {
 	struct device *dev = &cio2->dev;
 	struct fwnode_handle *fwnode;
@@ -476,11 +482,6 @@ int cio2_bridge_init(struct pci_dev *cio2)
 	unsigned int i;
 	int ret;
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 17, 0)
-	if (!cio2_bridge_sensors_are_ready())
-		return -EPROBE_DEFER;
-
-#endif
 	bridge = kzalloc(sizeof(*bridge), GFP_KERNEL);
 	if (!bridge)
 		return -ENOMEM;
@@ -532,3 +533,41 @@ err_free_bridge:
 	return ret;
 }
 
+/*
+ * The SSDB and _PLD evaluations and the software node registration run
+ * asynchronously, alongside the firmware load and authentication. Nothing
+ * looks at the fwnode graph before the ISYS driver probes, which waits for
+ * the discovery in cio2_bridge_wait().
+ */
+static async_cookie_t cio2_bridge_cookie;
+static bool cio2_bridge_pending;
+static int cio2_bridge_ret;
+
+static void cio2_bridge_discover_async(void *data, async_cookie_t cookie)
+{
+	cio2_bridge_ret = cio2_bridge_discover(data);
+}
+
+int cio2_bridge_init(struct pci_dev *cio2)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 17, 0)
+	if (!cio2_bridge_sensors_are_ready())
+		return -EPROBE_DEFER;
+
+#endif
+	cio2_bridge_pending = true;
+	cio2_bridge_cookie = async_schedule(cio2_bridge_discover_async, cio2);
+
+	return 0;
+}
+
+int cio2_bridge_wait(struct pci_dev *cio2)
+{
+	if (!cio2_bridge_pending)
+		return 0;
+
+	async_synchronize_cookie(cio2_bridge_cookie + 1);
+	cio2_bridge_pending = false;
+
+	return cio2_bridge_ret;
+}
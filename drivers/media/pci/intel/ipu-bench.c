@@ -0,0 +1,350 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Intel Corporation
+
+#include <linux/debugfs.h>
+#include <linux/device.h>
+#include <linux/dma-mapping.h>
+#include <linux/fs.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/pci.h>
+#include <linux/scatterlist.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+
+#include "ipu.h"
+#include "ipu-bus.h"
+#include "ipu-dma.h"
+#include "ipu-mmu.h"
+#include "ipu-platform.h"
+
+#define IPU_BENCH_MAX_PAGES		4096	/* 16 MiB */
+#define IPU_BENCH_MAX_ITERATIONS	100000
+#define IPU_BENCH_REPORT_SIZE		1024
+
+/*
+ * Timing of the mapping hot paths, run on demand from the "bench" file in
+ * the intel-ipu6-bench debugfs directory. Writing
+ * "<isys|psys> <bytes> <iterations>" maps a scratch buffer of that many
+ * scattered pages through the MMU of the subsystem of the IPU again and
+ * again, and reading gives the percentiles of each step in ns.
+ *
+ * The scratch mappings come from the same IOVA space as the live ones, so
+ * the benchmark can run next to streaming. The TLB is only written while
+ * the subsystem is powered, the report tells which case was measured.
+ */
+enum ipu_bench_case {
+	IPU_BENCH_MMU_MAP,
+	IPU_BENCH_MMU_UNMAP,
+	IPU_BENCH_TLB_INVALIDATE,
+	IPU_BENCH_DMA_MAP_SG,
+	IPU_BENCH_DMA_UNMAP_SG,
+	IPU_BENCH_NUM_CASES,
+};
+
+static const char * const ipu_bench_names[IPU_BENCH_NUM_CASES] = {
+	[IPU_BENCH_MMU_MAP] = "mmu_map",
+	[IPU_BENCH_MMU_UNMAP] = "mmu_unmap",
+	[IPU_BENCH_TLB_INVALIDATE] = "tlb_invalidate",
+	[IPU_BENCH_DMA_MAP_SG] = "dma_map_sg",
+	[IPU_BENCH_DMA_UNMAP_SG] = "dma_unmap_sg",
+};
+
+static struct dentry *ipu_bench_dir;
+/* Serializes the runs and protects the report */
+static DEFINE_MUTEX(ipu_bench_mutex);
+static char ipu_bench_report[IPU_BENCH_REPORT_SIZE];
+static int ipu_bench_report_len;
+
+static int ipu_bench_cmp(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static u64 ipu_bench_pct(u64 *s, unsigned int n, unsigned int pct)
+{
+	return s[min_t(unsigned int, div_u64((u64)n * pct, 100), n - 1)];
+}
+
+static int ipu_bench_print(char *buf, size_t size, enum ipu_bench_case c,
+			   u64 *s, unsigned int n)
+{
+	sort(s, n, sizeof(*s), ipu_bench_cmp, NULL);
+
+	return scnprintf(buf, size, "%-16s %10llu %10llu %10llu %10llu\n",
+			 ipu_bench_names[c], ipu_bench_pct(s, n, 50),
+			 ipu_bench_pct(s, n, 90), ipu_bench_pct(s, n, 99),
+			 s[n - 1]);
+}
+
+/* Map and unmap the PCI mapped scratch table at a fresh IOVA each time */
+static int ipu_bench_mmu(struct ipu_bus_device *adev, struct sg_table *sgt,
+			 unsigned int npages, unsigned int iters, u64 **s)
+{
+	struct ipu_mmu *mmu = adev->mmu;
+	struct ipu_mmu_info *mmu_info = mmu->dmap->mmu_info;
+	struct scatterlist *sg;
+	unsigned long addr;
+	struct iova *iova;
+	unsigned int i, j;
+	int ret = 0;
+	u64 start;
+
+	for (i = 0; i < iters; i++) {
+		iova = ipu_dma_alloc_iova(mmu->dmap, npages,
+					  dma_get_mask(&adev->dev) >> PAGE_SHIFT);
+		if (!iova)
+			return -ENOMEM;
+
+		start = ktime_get_ns();
+		addr = iova->pfn_lo << PAGE_SHIFT;
+		for_each_sg(sgt->sgl, sg, sgt->nents, j) {
+			ret = ipu_mmu_map(mmu_info, addr, sg_dma_address(sg),
+					  PAGE_ALIGN(sg_dma_len(sg)));
+			if (ret)
+				break;
+			addr += PAGE_ALIGN(sg_dma_len(sg));
+		}
+		s[IPU_BENCH_MMU_MAP][i] = ktime_get_ns() - start;
+
+		start = ktime_get_ns();
+		mmu->tlb_invalidate(mmu);
+		s[IPU_BENCH_TLB_INVALIDATE][i] = ktime_get_ns() - start;
+
+		start = ktime_get_ns();
+		ipu_mmu_unmap(mmu_info, iova->pfn_lo << PAGE_SHIFT,
+			      addr - (iova->pfn_lo << PAGE_SHIFT));
+		s[IPU_BENCH_MMU_UNMAP][i] = ktime_get_ns() - start;
+
+		mmu->tlb_invalidate(mmu);
+		ipu_dma_free_iova(mmu->dmap, iova);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* The DMA API path of buffer import, IOVA allocation and TLB included */
+static int ipu_bench_dma(struct device *dev, struct sg_table *sgt,
+			 unsigned int iters, u64 **s)
+{
+	unsigned int i;
+	u64 start;
+	int nents;
+
+	for (i = 0; i < iters; i++) {
+		start = ktime_get_ns();
+		nents = dma_map_sg(dev, sgt->sgl, sgt->orig_nents,
+				   DMA_BIDIRECTIONAL);
+		s[IPU_BENCH_DMA_MAP_SG][i] = ktime_get_ns() - start;
+		if (!nents)
+			return -ENOMEM;
+
+		start = ktime_get_ns();
+		dma_unmap_sg(dev, sgt->sgl, sgt->orig_nents,
+			     DMA_BIDIRECTIONAL);
+		s[IPU_BENCH_DMA_UNMAP_SG][i] = ktime_get_ns() - start;
+	}
+
+	return 0;
+}
+
+static int ipu_bench_run(struct ipu_bus_device *adev, unsigned int npages,
+			 unsigned int iters)
+{
+	struct pci_dev *pdev = adev->isp->pdev;
+	u64 *s[IPU_BENCH_NUM_CASES] = { NULL };
+	struct ipu_mmu *mmu = adev->mmu;
+	struct page **pages;
+	struct sg_table sgt;
+	unsigned int i;
+	int len, ret;
+
+	pages = kvcalloc(npages, sizeof(*pages), GFP_KERNEL);
+	if (!pages)
+		return -ENOMEM;
+
+	/* Single pages, scattered as in a user buffer */
+	for (i = 0; i < npages; i++) {
+		pages[i] = alloc_page(GFP_KERNEL);
+		if (!pages[i]) {
+			ret = -ENOMEM;
+			goto out_free_pages;
+		}
+	}
+
+	ret = sg_alloc_table_from_pages(&sgt, pages, npages, 0,
+					(size_t)npages << PAGE_SHIFT,
+					GFP_KERNEL);
+	if (ret)
+		goto out_free_pages;
+
+	for (i = 0; i < IPU_BENCH_NUM_CASES; i++) {
+		s[i] = kvmalloc_array(iters, sizeof(**s), GFP_KERNEL);
+		if (!s[i]) {
+			ret = -ENOMEM;
+			goto out_free_samples;
+		}
+	}
+
+	ret = ipu_bench_dma(&adev->dev, &sgt, iters, s);
+	if (ret)
+		goto out_free_samples;
+
+	sgt.nents = dma_map_sg(&pdev->dev, sgt.sgl, sgt.orig_nents,
+			       DMA_BIDIRECTIONAL);
+	if (!sgt.nents) {
+		ret = -ENOMEM;
+		goto out_free_samples;
+	}
+	ret = ipu_bench_mmu(adev, &sgt, npages, iters, s);
+	dma_unmap_sg(&pdev->dev, sgt.sgl, sgt.orig_nents, DMA_BIDIRECTIONAL);
+	if (ret)
+		goto out_free_samples;
+
+	len = scnprintf(ipu_bench_report, sizeof(ipu_bench_report),
+			"%s pages %u iterations %u tlb %s\n"
+			"%-16s %10s %10s %10s %10s\n", dev_name(&adev->dev),
+			npages, iters, READ_ONCE(mmu->ready) ? "hw" : "off",
+			"case", "p50_ns", "p90_ns", "p99_ns", "max_ns");
+	for (i = 0; i < IPU_BENCH_NUM_CASES; i++)
+		len += ipu_bench_print(ipu_bench_report + len,
+				       sizeof(ipu_bench_report) - len, i,
+				       s[i], iters);
+	ipu_bench_report_len = len;
+
+out_free_samples:
+	for (i = 0; i < IPU_BENCH_NUM_CASES; i++)
+		kvfree(s[i]);
+	sg_free_table(&sgt);
+	i = npages;
+out_free_pages:
+	while (i--)
+		__free_page(pages[i]);
+	kvfree(pages);
+
+	return ret;
+}
+
+/*
+ * The IPU bound to the core driver, held against unbind by the device lock
+ * the caller takes. There is one IPU in a system.
+ */
+static struct pci_dev *ipu_bench_get_ipu(void)
+{
+	struct pci_dev *pdev = NULL;
+
+	while ((pdev = pci_get_device(PCI_VENDOR_ID_INTEL, PCI_ANY_ID, pdev)))
+		if (pdev->dev.driver &&
+		    !strcmp(pdev->dev.driver->name, IPU_NAME))
+			return pdev;
+
+	return NULL;
+}
+
+static ssize_t ipu_bench_write(struct file *file, const char __user *ubuf,
+			       size_t count, loff_t *ppos)
+{
+	unsigned int bytes, iters, npages;
+	struct ipu_bus_device *adev;
+	struct ipu_device *isp;
+	struct pci_dev *pdev;
+	char buf[32], sys[5];
+	int ret = -ENODEV;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	buf[count] = '\0';
+
+	if (sscanf(buf, "%4s %u %u", sys, &bytes, &iters) != 3 ||
+	    !bytes || bytes > IPU_BENCH_MAX_PAGES * PAGE_SIZE ||
+	    !iters || iters > IPU_BENCH_MAX_ITERATIONS)
+		return -EINVAL;
+
+	if (strcmp(sys, "isys") && strcmp(sys, "psys"))
+		return -EINVAL;
+	npages = DIV_ROUND_UP(bytes, PAGE_SIZE);
+
+	pdev = ipu_bench_get_ipu();
+	if (!pdev)
+		return -ENODEV;
+
+	device_lock(&pdev->dev);
+	/* It may have been unbound meanwhile */
+	isp = pdev->dev.driver ? pci_get_drvdata(pdev) : NULL;
+	if (!isp)
+		goto out_unlock;
+
+	adev = strcmp(sys, "isys") ? isp->psys : isp->isys;
+	if (IS_ERR_OR_NULL(adev) || !adev->mmu)
+		goto out_unlock;
+
+	mutex_lock(&ipu_bench_mutex);
+	ret = ipu_bench_run(adev, npages, iters);
+	mutex_unlock(&ipu_bench_mutex);
+
+out_unlock:
+	device_unlock(&pdev->dev);
+	pci_dev_put(pdev);
+
+	return ret ? ret : count;
+}
+
+static ssize_t ipu_bench_read(struct file *file, char __user *ubuf,
+			      size_t count, loff_t *ppos)
+{
+	ssize_t ret;
+
+	mutex_lock(&ipu_bench_mutex);
+	ret = simple_read_from_buffer(ubuf, count, ppos, ipu_bench_report,
+				      ipu_bench_report_len);
+	mutex_unlock(&ipu_bench_mutex);
+
+	return ret;
+}
+
+static const struct file_operations ipu_bench_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = ipu_bench_read,
+	.write = ipu_bench_write,
+	.llseek = default_llseek,
+};
+
+static int __init ipu_bench_init(void)
+{
+	struct dentry *file;
+
+	ipu_bench_dir = debugfs_create_dir(IPU_NAME "-bench", NULL);
+	if (IS_ERR_OR_NULL(ipu_bench_dir))
+		return -ENOMEM;
+
+	file = debugfs_create_file("bench", 0600, ipu_bench_dir, NULL,
+				   &ipu_bench_fops);
+	if (IS_ERR_OR_NULL(file)) {
+		debugfs_remove_recursive(ipu_bench_dir);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void __exit ipu_bench_exit(void)
+{
+	debugfs_remove_recursive(ipu_bench_dir);
+}
+
+module_init(ipu_bench_init);
+module_exit(ipu_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Intel ipu MMU and DMA mapping microbenchmark");
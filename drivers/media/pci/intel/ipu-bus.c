@@ -4,6 +4,7 @@
 #include <linux/delay.h>
 #include <linux/device.h>
 #include <linux/interrupt.h>
+#include <linux/ktime.h>
 #include <linux/list.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
@@ -14,10 +15,49 @@
 #include "ipu.h"
 #include "ipu-platform.h"
 #include "ipu-dma.h"
+#include "ipu-buttress-trace.h"
 
 #ifdef CONFIG_PM
 static struct bus_type ipu_bus;
 
+/*
+ * A resume shortly after a suspend means the power cycle was wasted:
+ * learn the gap and keep the device up about twice as long next time.
+ */
+static void bus_pm_learn_gap(struct ipu_bus_device *adev)
+{
+	struct ipu_bus_pm *pm = &adev->pm;
+	u64 gap, want;
+
+	pm->resumes++;
+	if (pm->max_ms <= pm->delay_ms || !pm->suspend_ns)
+		return;
+
+	gap = ktime_get_ns() - pm->suspend_ns;
+	if (gap > (u64)pm->max_ms * NSEC_PER_MSEC) {
+		/* Long idle, drift back to the configured delay */
+		pm->cur_ms = (pm->cur_ms + pm->delay_ms) / 2;
+		return;
+	}
+
+	pm->early_resumes++;
+	pm->gap_avg_ns = pm->gap_avg_ns ? (3 * pm->gap_avg_ns + gap) / 4 : gap;
+	want = div_u64(2 * pm->gap_avg_ns, NSEC_PER_MSEC);
+	pm->cur_ms = clamp_t(u64, want, pm->delay_ms, pm->max_ms);
+}
+
+static int bus_pm_runtime_idle(struct device *dev)
+{
+	struct ipu_bus_device *adev = to_ipu_bus_device(dev);
+
+	if (dev->power.use_autosuspend &&
+	    dev->power.autosuspend_delay != adev->pm.cur_ms)
+		pm_runtime_set_autosuspend_delay(dev, adev->pm.cur_ms);
+	pm_runtime_mark_last_busy(dev);
+
+	return 0;
+}
+
 static int bus_pm_runtime_suspend(struct device *dev)
 {
 	struct ipu_bus_device *adev = to_ipu_bus_device(dev);
@@ -29,8 +69,11 @@ static int bus_pm_runtime_suspend(struct device *dev)
 
 	rval = ipu_buttress_power(dev, adev->ctrl, false);
 	dev_dbg(dev, "%s: buttress power down %d\n", __func__, rval);
-	if (!rval)
+	if (!rval) {
+		adev->pm.suspends++;
+		adev->pm.suspend_ns = ktime_get_ns();
 		return 0;
+	}
 
 	dev_err(dev, "power down failed!\n");
 
@@ -52,11 +95,15 @@ static int bus_pm_runtime_resume(struct device *dev)
 	if (rval)
 		return rval;
 
+	ipu_bus_boot_mark(adev, IPU_BOOT_POWER_UP);
+
 	rval = pm_generic_runtime_resume(dev);
 	dev_dbg(dev, "%s: resume %d\n", __func__, rval);
 	if (rval)
 		goto out_err;
 
+	bus_pm_learn_gap(adev);
+
 	return 0;
 
 out_err:
@@ -68,6 +115,7 @@ out_err:
 static const struct dev_pm_ops ipu_bus_pm_ops = {
 	.runtime_suspend = bus_pm_runtime_suspend,
 	.runtime_resume = bus_pm_runtime_resume,
+	.runtime_idle = bus_pm_runtime_idle,
 };
 
 #define IPU_BUS_PM_OPS	(&ipu_bus_pm_ops)
@@ -134,6 +182,7 @@ static void ipu_bus_remove(struct device *dev)
 
 	if (adrv->remove)
 		adrv->remove(adev);
+	pm_runtime_dont_use_autosuspend(dev);
 #if LINUX_VERSION_CODE < KERNEL_VERSION(5, 15, 0)
 
 	return 0;
@@ -232,6 +281,54 @@ void ipu_bus_del_devices(struct pci_dev *pdev)
 	mutex_unlock(&ipu_bus_mutex);
 }
 
+/*
+ * Keep the subsystem powered for delay_ms after its last user is gone,
+ * or adaptively up to max_ms. A zero delay_ms and max_ms keeps the
+ * suspend immediate.
+ */
+void ipu_bus_set_autosuspend(struct ipu_bus_device *adev,
+			     unsigned int delay_ms, unsigned int max_ms)
+{
+	adev->pm.delay_ms = delay_ms;
+	adev->pm.max_ms = max(delay_ms, max_ms);
+	adev->pm.cur_ms = delay_ms;
+	if (!adev->pm.max_ms)
+		return;
+
+	pm_runtime_set_autosuspend_delay(&adev->dev, delay_ms);
+	pm_runtime_use_autosuspend(&adev->dev);
+}
+EXPORT_SYMBOL_GPL(ipu_bus_set_autosuspend);
+
+/*
+ * Record a firmware boot phase on the boot timeline of adev. Power up
+ * starts a new timeline, the first stream open is kept until the next.
+ */
+void ipu_bus_boot_mark(struct ipu_bus_device *adev,
+		       enum ipu_boot_phase phase)
+{
+	u64 *tsc = adev->boot_tsc;
+	u64 now, delta_ns = 0;
+
+	if (phase == IPU_BOOT_STREAM_OPEN && tsc[phase])
+		return;
+
+	if (ipu_buttress_tsc_read(adev->isp, &now))
+		return;
+
+	if (phase == IPU_BOOT_POWER_UP)
+		memset(adev->boot_tsc, 0, sizeof(adev->boot_tsc));
+	else if (tsc[IPU_BOOT_POWER_UP] && now > tsc[IPU_BOOT_POWER_UP])
+		delta_ns = ipu_buttress_tsc_ticks_to_ns(now -
+							tsc[IPU_BOOT_POWER_UP],
+							adev->isp);
+	tsc[phase] = now;
+
+	trace_ipu_buttress_boot_phase(dev_name(&adev->dev), phase, now,
+				      delta_ns);
+}
+EXPORT_SYMBOL_GPL(ipu_bus_boot_mark);
+
 int ipu_bus_register_driver(struct ipu_bus_driver *adrv)
 {
 	adrv->drv.bus = &ipu_bus;
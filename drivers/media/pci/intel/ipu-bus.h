@@ -15,6 +15,32 @@
 struct ipu_buttress_ctrl;
 struct ipu_subsystem_trace_config;
 
+/*
+ * Runtime PM autosuspend policy and counters. With max_ms above delay_ms
+ * the delay adapts to the recent suspend to resume gaps, between the two.
+ */
+struct ipu_bus_pm {
+	unsigned int delay_ms;
+	unsigned int max_ms;
+	unsigned int cur_ms;
+	u64 gap_avg_ns;
+	u64 suspend_ns;
+	u64 suspends;
+	u64 resumes;
+	/* Resumes within max_ms of the last suspend */
+	u64 early_resumes;
+};
+
+/* Firmware boot timeline phases, see ipu_bus_boot_mark() */
+enum ipu_boot_phase {
+	IPU_BOOT_POWER_UP,
+	IPU_BOOT_AUTH,
+	IPU_BOOT_SP_START,
+	IPU_BOOT_SYSCOM_READY,
+	IPU_BOOT_STREAM_OPEN,
+	IPU_BOOT_NUM
+};
+
 struct ipu_bus_device {
 	struct device dev;
 	struct list_head list;
@@ -27,6 +53,9 @@ struct ipu_bus_device {
 	u64 dma_mask;
 	/* Protect runtime_resume calls on the dev */
 	struct mutex resume_lock;
+	struct ipu_bus_pm pm;
+	/* TSC of each phase since the last power up, 0 if not reached */
+	u64 boot_tsc[IPU_BOOT_NUM];
 };
 
 #define to_ipu_bus_device(_dev) container_of(_dev, struct ipu_bus_device, dev)
@@ -49,6 +78,10 @@ struct ipu_bus_device *ipu_bus_initialize_device(struct pci_dev *pdev,
 						 struct ipu_buttress_ctrl *ctrl,
 						 char *name, unsigned int nr);
 int ipu_bus_add_device(struct ipu_bus_device *adev);
+void ipu_bus_set_autosuspend(struct ipu_bus_device *adev,
+			     unsigned int delay_ms, unsigned int max_ms);
+void ipu_bus_boot_mark(struct ipu_bus_device *adev,
+		       enum ipu_boot_phase phase);
 void ipu_bus_del_devices(struct pci_dev *pdev);
 
 int ipu_bus_register_driver(struct ipu_bus_driver *adrv);
@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2024 Intel Corporation */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ipu_buttress
+
+#if !defined(IPU_BUTTRESS_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define IPU_BUTTRESS_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(ipu_buttress_psys_dvfs,
+	TP_PROTO(unsigned int util, unsigned int old_freq,
+		 unsigned int new_freq, bool missed),
+	TP_ARGS(util, old_freq, new_freq, missed),
+	TP_STRUCT__entry(
+		__field(unsigned int, util)
+		__field(unsigned int, old_freq)
+		__field(unsigned int, new_freq)
+		__field(bool, missed)
+	),
+	TP_fast_assign(
+		__entry->util = util;
+		__entry->old_freq = old_freq;
+		__entry->new_freq = new_freq;
+		__entry->missed = missed;
+	),
+	TP_printk("util=%u%% freq=%u->%u missed=%d",
+		  __entry->util, __entry->old_freq, __entry->new_freq,
+		  __entry->missed)
+);
+
+/* Firmware boot phase, delta_ns is the time since power up */
+TRACE_EVENT(ipu_buttress_boot_phase,
+	TP_PROTO(const char *dev, unsigned int phase, u64 tsc, u64 delta_ns),
+	TP_ARGS(dev, phase, tsc, delta_ns),
+	TP_STRUCT__entry(
+		__array(char, dev, 16)
+		__field(unsigned int, phase)
+		__field(u64, tsc)
+		__field(u64, delta_ns)
+	),
+	TP_fast_assign(
+		strscpy(__entry->dev, dev, sizeof(__entry->dev));
+		__entry->phase = phase;
+		__entry->tsc = tsc;
+		__entry->delta_ns = delta_ns;
+	),
+	TP_printk("%s phase=%u tsc=%llu delta_ns=%llu",
+		  __entry->dev, __entry->phase, __entry->tsc,
+		  __entry->delta_ns)
+);
+
+#endif /* IPU_BUTTRESS_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ipu-buttress-trace
+#include <trace/define_trace.h>
@@ -4,6 +4,7 @@
 #include <linux/clk.h>
 #include <linux/clkdev.h>
 #include <linux/clk-provider.h>
+#include <linux/clocksource.h>
 #include <linux/completion.h>
 #include <linux/debugfs.h>
 #include <linux/device.h>
@@ -12,6 +13,7 @@
 #include <linux/errno.h>
 #include <linux/firmware.h>
 #include <linux/iopoll.h>
+#include <linux/math64.h>
 #include <linux/module.h>
 #include <linux/pci.h>
 #include <linux/pm_runtime.h>
@@ -24,6 +26,9 @@
 #include "ipu-platform-buttress-regs.h"
 #include "ipu-cpd.h"
 
+#define CREATE_TRACE_POINTS
+#include "ipu-buttress-trace.h"
+
 #define BOOTLOADER_STATUS_OFFSET       0x15c
 
 #define BOOTLOADER_MAGIC_KEY		0xb00710ad
@@ -40,6 +45,8 @@
 
 #define BUTTRESS_IPC_TX_TIMEOUT			1000
 #define BUTTRESS_IPC_RESET_TIMEOUT		2000
+/* Fallback poll period of the CSR handshakes, in us */
+#define BUTTRESS_IPC_CSR_POLL			500
 #define BUTTRESS_IPC_RX_TIMEOUT			1000
 #define BUTTRESS_IPC_VALIDITY_TIMEOUT		1000000
 #define BUTTRESS_TSC_SYNC_TIMEOUT		5000
@@ -51,14 +58,40 @@
 
 #define BUTTRESS_IPC_CMD_SEND_RETRY	1
 
+/* PSYS busy percentage the DVFS governor sizes the clock for */
+#define IPU_BUTTRESS_PSYS_DVFS_TARGET_UTIL	80
+
 static const u32 ipu_adev_irq_mask[] = {
 	BUTTRESS_ISR_IS_IRQ, BUTTRESS_ISR_PS_IRQ
 };
 
+/*
+ * Sleep until the peer changes csr_in. The CSE raises
+ * BUTTRESS_ISR_CSE_CSR_SET when it sets a CSR bit, which completes
+ * csr_complete. The ISH has no such interrupt enabled, and the ISR
+ * ignores interrupts while the device is not runtime active (e.g. in
+ * the middle of runtime resume), so those cases are polled.
+ */
+static void ipu_buttress_ipc_csr_sleep(struct ipu_device *isp,
+				       struct ipu_buttress_ipc *ipc)
+{
+	if (ipc == &isp->buttress.cse && pm_runtime_active(&isp->pdev->dev))
+		wait_for_completion_timeout(&ipc->csr_complete,
+					    usecs_to_jiffies(BUTTRESS_IPC_CSR_POLL));
+	else
+		usleep_range(BUTTRESS_IPC_CSR_POLL - 100, BUTTRESS_IPC_CSR_POLL);
+
+	/* Bits set from now on complete it again */
+	reinit_completion(&ipc->csr_complete);
+}
+
 int ipu_buttress_ipc_reset(struct ipu_device *isp, struct ipu_buttress_ipc *ipc)
 {
 	struct ipu_buttress *b = &isp->buttress;
-	unsigned int retries = BUTTRESS_IPC_RESET_TIMEOUT;
+	/* As long as BUTTRESS_IPC_RESET_TIMEOUT polls used to take */
+	unsigned long deadline = jiffies +
+		usecs_to_jiffies(BUTTRESS_IPC_RESET_TIMEOUT *
+				 BUTTRESS_IPC_CSR_POLL);
 	u32 val = 0, csr_in_clr;
 
 	if (!isp->secure_mode) {
@@ -71,6 +104,7 @@ int ipu_buttress_ipc_reset(struct ipu_device *isp, struct ipu_buttress_ipc *ipc)
 	/* Clear-by-1 CSR (all bits), corresponding internal states. */
 	val = readl(isp->base + ipc->csr_in);
 	writel(val, isp->base + ipc->csr_in);
+	reinit_completion(&ipc->csr_complete);
 
 	/* Set peer CSR bit IPC_PEER_COMP_ACTIONS_RST_PHASE1 */
 	writel(ENTRY, isp->base + ipc->csr_out);
@@ -86,8 +120,8 @@ int ipu_buttress_ipc_reset(struct ipu_device *isp, struct ipu_buttress_ipc *ipc)
 		BUTTRESS_IU2CSECSR_IPC_PEER_ACKED_REG_VALID |
 		BUTTRESS_IU2CSECSR_IPC_PEER_ASSERTED_REG_VALID_REQ | QUERY;
 
-	while (retries--) {
-		usleep_range(400, 500);
+	while (time_before(jiffies, deadline)) {
+		ipu_buttress_ipc_csr_sleep(isp, ipc);
 		val = readl(isp->base + ipc->csr_in);
 		switch (val) {
 		case (ENTRY | EXIT):
@@ -199,24 +233,28 @@ ipu_buttress_ipc_validity_open(struct ipu_device *isp,
 			       struct ipu_buttress_ipc *ipc)
 {
 	unsigned int mask = BUTTRESS_IU2CSECSR_IPC_PEER_ACKED_REG_VALID;
-	unsigned int tout = BUTTRESS_IPC_VALIDITY_TIMEOUT;
-	void __iomem *addr;
-	int ret;
+	unsigned long deadline = jiffies +
+		usecs_to_jiffies(BUTTRESS_IPC_VALIDITY_TIMEOUT);
+	void __iomem *addr = isp->base + ipc->csr_in;
 	u32 val;
 
+	reinit_completion(&ipc->csr_complete);
+
 	/* Set bit 3 in CSE CSR */
 	writel(BUTTRESS_IU2CSECSR_IPC_PEER_ASSERTED_REG_VALID_REQ,
 	       isp->base + ipc->csr_out);
 
-	addr = isp->base + ipc->csr_in;
-	ret = readl_poll_timeout(addr, val, val & mask, 200, tout);
-	if (ret) {
-		val = readl(addr);
-		dev_err(&isp->pdev->dev, "CSE validity timeout 0x%x\n", val);
-		ipu_buttress_ipc_validity_close(isp, ipc);
+	while (!((val = readl(addr)) & mask)) {
+		if (time_after(jiffies, deadline)) {
+			dev_err(&isp->pdev->dev, "CSE validity timeout 0x%x\n",
+				val);
+			ipu_buttress_ipc_validity_close(isp, ipc);
+			return -ETIMEDOUT;
+		}
+		ipu_buttress_ipc_csr_sleep(isp, ipc);
 	}
 
-	return ret;
+	return 0;
 }
 
 static void ipu_buttress_ipc_recv(struct ipu_device *isp,
@@ -401,6 +439,7 @@ irqreturn_t ipu_buttress_isr(int irq, void *isp_ptr)
 
 		if (irq_status & (BUTTRESS_ISR_IPC_FROM_CSE_IS_WAITING |
 				  BUTTRESS_ISR_IPC_FROM_ISH_IS_WAITING |
+				  BUTTRESS_ISR_CSE_CSR_SET |
 				  BUTTRESS_ISR_IPC_EXEC_DONE_BY_CSE |
 				  BUTTRESS_ISR_IPC_EXEC_DONE_BY_ISH |
 				  BUTTRESS_ISR_SAI_VIOLATION) &&
@@ -421,6 +460,9 @@ irqreturn_t ipu_buttress_isr(int irq, void *isp_ptr)
 			complete(&b->ish.recv_complete);
 		}
 
+		if (irq_status & BUTTRESS_ISR_CSE_CSR_SET)
+			complete(&b->cse.csr_complete);
+
 		if (irq_status & BUTTRESS_ISR_IPC_EXEC_DONE_BY_CSE) {
 			dev_dbg(&isp->pdev->dev,
 				"BUTTRESS_ISR_IPC_EXEC_DONE_BY_CSE\n");
@@ -655,6 +697,12 @@ static void ipu_buttress_set_psys_freq(struct ipu_device *isp,
 	ipu_buttress_set_psys_ratio(isp, psys_ratio, psys_ratio);
 }
 
+/* Constraints are a floor for the governor, never the other way round */
+static unsigned int ipu_buttress_psys_target_freq(struct ipu_buttress *b)
+{
+	return max(b->psys_min_freq, b->psys_dvfs_freq);
+}
+
 void
 ipu_buttress_add_psys_constraint(struct ipu_device *isp,
 				 struct ipu_buttress_constraint *constraint)
@@ -667,7 +715,8 @@ ipu_buttress_add_psys_constraint(struct ipu_device *isp,
 	if (constraint->min_freq > b->psys_min_freq) {
 		isp->buttress.psys_min_freq = min(constraint->min_freq,
 						  b->psys_fused_freqs.max_freq);
-		ipu_buttress_set_psys_freq(isp, b->psys_min_freq);
+		ipu_buttress_set_psys_freq(isp,
+					   ipu_buttress_psys_target_freq(b));
 	}
 	mutex_unlock(&b->cons_mutex);
 }
@@ -692,12 +741,66 @@ ipu_buttress_remove_psys_constraint(struct ipu_device *isp,
 		b->psys_min_freq = clamp(min_freq,
 					 b->psys_fused_freqs.efficient_freq,
 					 b->psys_fused_freqs.max_freq);
-		ipu_buttress_set_psys_freq(isp, b->psys_min_freq);
+		ipu_buttress_set_psys_freq(isp,
+					   ipu_buttress_psys_target_freq(b));
 	}
 	mutex_unlock(&b->cons_mutex);
 }
 EXPORT_SYMBOL_GPL(ipu_buttress_remove_psys_constraint);
 
+static bool psys_dvfs;
+module_param(psys_dvfs, bool, 0664);
+MODULE_PARM_DESC(psys_dvfs, "Scale PSYS frequency by its utilisation");
+
+/*
+ * Utilisation driven PSYS frequency. psys reports how long the firmware
+ * was busy during the last window and whether a deadline was missed; the
+ * next frequency keeps the busy time at the target utilisation, a miss
+ * goes straight to the fused maximum. Constraints stay a floor.
+ */
+void ipu_buttress_psys_dvfs_update(struct ipu_device *isp, u64 busy_ns,
+				   u64 window_ns, bool missed)
+{
+	struct ipu_buttress *b = &isp->buttress;
+	struct ipu_buttress_fused_freqs *fused = &b->psys_fused_freqs;
+	unsigned int util, old_freq, freq;
+
+	if (!window_ns || !fused->max_freq)
+		return;
+
+	mutex_lock(&b->cons_mutex);
+	if (!psys_dvfs) {
+		if (b->psys_dvfs_freq) {
+			b->psys_dvfs_freq = 0;
+			ipu_buttress_set_psys_freq(isp, b->psys_min_freq);
+		}
+		goto out_mutex_unlock;
+	}
+
+	old_freq = b->psys_dvfs_freq ? b->psys_dvfs_freq : fused->max_freq;
+	util = div64_u64(min(busy_ns, window_ns) * 100, window_ns);
+	if (missed) {
+		freq = fused->max_freq;
+	} else {
+		freq = DIV_ROUND_UP(old_freq * util,
+				    IPU_BUTTRESS_PSYS_DVFS_TARGET_UTIL);
+		freq = roundup(freq, BUTTRESS_PS_FREQ_STEP);
+		freq = clamp(freq, fused->min_freq, fused->max_freq);
+	}
+
+	trace_ipu_buttress_psys_dvfs(util, old_freq, freq, missed);
+
+	if (freq != b->psys_dvfs_freq) {
+		b->psys_dvfs_freq = freq;
+		ipu_buttress_set_psys_freq(isp,
+					   ipu_buttress_psys_target_freq(b));
+	}
+
+out_mutex_unlock:
+	mutex_unlock(&b->cons_mutex);
+}
+EXPORT_SYMBOL_GPL(ipu_buttress_psys_dvfs_update);
+
 int ipu_buttress_reset_authentication(struct ipu_device *isp)
 {
 	int ret;
@@ -748,7 +851,14 @@ int ipu_buttress_map_fw_image(struct ipu_bus_device *sys,
 
 	addr = fw->data;
 	for (i = 0; i < n_pages; i++) {
-		struct page *p = vmalloc_to_page(addr);
+		struct page *p;
+
+		if (is_vmalloc_addr(addr))
+			p = vmalloc_to_page(addr);
+		else if (virt_addr_valid(addr))
+			p = virt_to_page(addr);
+		else
+			p = NULL;
 
 		if (!p) {
 			rval = -ENODEV;
@@ -911,6 +1021,7 @@ int ipu_buttress_authenticate(struct ipu_device *isp)
 	}
 
 	dev_info(&isp->pdev->dev, "CSE authenticate_run done\n");
+	ipu_bus_boot_mark(isp->psys, IPU_BOOT_AUTH);
 
 iunit_power_off:
 	mutex_unlock(&b->auth_mutex);
@@ -984,12 +1095,15 @@ struct clk_ipu_sensor {
 
 #define to_clk_ipu_sensor(_hw) container_of(_hw, struct clk_ipu_sensor, hw)
 
+/*
+ * Lockless: a change of the high word between the two reads is resolved
+ * from the low word, which is valid as long as the three reads complete
+ * within 2^31 ticks.
+ */
 int ipu_buttress_tsc_read(struct ipu_device *isp, u64 *val)
 {
 	u32 tsc_hi_1, tsc_hi_2, tsc_lo;
-	unsigned long flags;
 
-	local_irq_save(flags);
 	tsc_hi_1 = readl(isp->base + BUTTRESS_REG_TSC_HI);
 	tsc_lo = readl(isp->base + BUTTRESS_REG_TSC_LO);
 	tsc_hi_2 = readl(isp->base + BUTTRESS_REG_TSC_HI);
@@ -1002,7 +1116,6 @@ int ipu_buttress_tsc_read(struct ipu_device *isp, u64 *val)
 		else
 			*val = (u64)tsc_hi_2 << 32 | tsc_lo;
 	}
-	local_irq_restore(flags);
 
 	return 0;
 }
@@ -1145,7 +1258,8 @@ static int ipu_buttress_psys_freq_set(void *data, u64 val)
 					    isp->buttress.psys_force_ratio,
 					    isp->buttress.psys_force_ratio);
 	else
-		ipu_buttress_set_psys_freq(isp, isp->buttress.psys_min_freq);
+		ipu_buttress_set_psys_freq(isp,
+			ipu_buttress_psys_target_freq(&isp->buttress));
 
 	return 0;
 }
@@ -1232,20 +1346,15 @@ err:
 
 #endif /* CONFIG_DEBUG_FS */
 
+/*
+ * ns = ticks * 10^9 / (ref_clk * 100 kHz), done as a multiply and shift
+ * with the factors set up in ipu_buttress_init(). The 128-bit
+ * intermediate keeps the full TSC range.
+ */
 u64 ipu_buttress_tsc_ticks_to_ns(u64 ticks, const struct ipu_device *isp)
 {
-	u64 ns = ticks * 10000;
-
-	/*
-	 * converting TSC tick count to ns is calculated by:
-	 * Example (TSC clock frequency is 19.2MHz):
-	 * ns = ticks * 1000 000 000 / 19.2Mhz
-	 *    = ticks * 1000 000 000 / 19200000Hz
-	 *    = ticks * 10000 / 192 ns
-	 */
-	do_div(ns, isp->buttress.ref_clk);
-
-	return ns;
+	return mul_u64_u32_shr(ticks, isp->buttress.tsc_mult,
+			       isp->buttress.tsc_shift);
 }
 EXPORT_SYMBOL_GPL(ipu_buttress_tsc_ticks_to_ns);
 
@@ -1310,6 +1419,8 @@ int ipu_buttress_init(struct ipu_device *isp)
 	init_completion(&b->cse.send_complete);
 	init_completion(&b->ish.recv_complete);
 	init_completion(&b->cse.recv_complete);
+	init_completion(&b->ish.csr_complete);
+	init_completion(&b->cse.csr_complete);
 
 	b->cse.nack = BUTTRESS_CSE2IUDATA0_IPC_NACK;
 	b->cse.nack_mask = BUTTRESS_CSE2IUDATA0_IPC_NACK_MASK;
@@ -1364,6 +1475,10 @@ int ipu_buttress_init(struct ipu_device *isp)
 		break;
 	}
 
+	/* maxsec 1 gives the most precise factors that fit in 32 bits */
+	clocks_calc_mult_shift(&b->tsc_mult, &b->tsc_shift,
+			       b->ref_clk * 100000, NSEC_PER_SEC, 1);
+
 	rval = device_create_file(&isp->pdev->dev,
 				  &dev_attr_psys_fused_min_freq);
 	if (rval) {
@@ -45,6 +45,8 @@ struct ipu_buttress_fused_freqs {
 struct ipu_buttress_ipc {
 	struct completion send_complete;
 	struct completion recv_complete;
+	/* Peer set a bit in csr_in, CSE only */
+	struct completion csr_complete;
 	u32 nack;
 	u32 nack_mask;
 	u32 recv_data;
@@ -63,10 +65,15 @@ struct ipu_buttress {
 	struct list_head constraints;
 	struct ipu_buttress_fused_freqs psys_fused_freqs;
 	unsigned int psys_min_freq;
+	/* DVFS governor frequency, 0 while the governor is off */
+	unsigned int psys_dvfs_freq;
 	u32 wdt_cached_value;
 	u8 psys_force_ratio;
 	bool force_suspend;
 	u32 ref_clk;
+	/* TSC ticks to ns, see ipu_buttress_tsc_ticks_to_ns() */
+	u32 tsc_mult;
+	u32 tsc_shift;
 };
 
 struct ipu_buttress_sensor_clk_freq {
@@ -107,6 +114,8 @@ ipu_buttress_add_psys_constraint(struct ipu_device *isp,
 void
 ipu_buttress_remove_psys_constraint(struct ipu_device *isp,
 				    struct ipu_buttress_constraint *constraint);
+void ipu_buttress_psys_dvfs_update(struct ipu_device *isp, u64 busy_ns,
+				   u64 window_ns, bool missed);
 void ipu_buttress_set_secure_mode(struct ipu_device *isp);
 bool ipu_buttress_get_secure_mode(struct ipu_device *isp);
 int ipu_buttress_authenticate(struct ipu_device *isp);
@@ -148,45 +148,47 @@ static int ipu6_cpd_metadata_get_cmpnt_id(struct ipu_device *isp,
 	return cmpnt->id;
 }
 
-static int ipu_cpd_parse_module_data(struct ipu_device *isp,
-				     const void *module_data,
-				     unsigned int module_data_size,
-				     dma_addr_t dma_addr_module_data,
-				     u64 *pkg_dir,
-				     const void *metadata,
-				     unsigned int metadata_size)
+/*
+ * Resolve the id and version of every module data component once, when
+ * the file is validated. Both subsystems and a firmware reload then build
+ * their package directories from the index.
+ */
+static int ipu_cpd_build_index(struct ipu_device *isp, const void *cpd)
 {
+	const struct ipu_cpd_ent *mod_ent = ipu_cpd_get_moduledata(cpd);
+	const struct ipu_cpd_ent *met_ent = ipu_cpd_get_metadata(cpd);
 	const struct ipu_cpd_module_data_hdr *module_data_hdr;
+	struct ipu_cpd_index *index = &isp->cpd_index;
 	const struct ipu_cpd_hdr *dir_hdr;
 	const struct ipu_cpd_ent *dir_ent;
-	int i;
-	u8 len;
+	const void *metadata;
+	unsigned int i;
 
-	if (!module_data)
-		return -EINVAL;
+	index->cpd = NULL;
 
-	module_data_hdr = module_data;
-	dir_hdr = module_data + module_data_hdr->hdr_len;
-	len = dir_hdr->hdr_len;
-	dir_ent = (struct ipu_cpd_ent *)(((u8 *)dir_hdr) + len);
+	module_data_hdr = cpd + mod_ent->offset;
+	dir_hdr = (const void *)module_data_hdr + module_data_hdr->hdr_len;
+	dir_ent = ipu_cpd_get_entries(dir_hdr);
+	metadata = cpd + met_ent->offset;
 
-	pkg_dir[0] = PKG_DIR_HDR_MARK;
-	/* pkg_dir entry count = component count + pkg_dir header */
-	pkg_dir[1] = dir_hdr->ent_cnt + 1;
+	/* The pkg_dir header takes one of its entries */
+	if (dir_hdr->ent_cnt > IPU_CPD_MAX_COMPONENTS) {
+		dev_err(&isp->pdev->dev, "Too many components (%u)\n",
+			dir_hdr->ent_cnt);
+		return -EINVAL;
+	}
 
 	for (i = 0; i < dir_hdr->ent_cnt; i++, dir_ent++) {
-		u64 *p = &pkg_dir[PKG_DIR_ENT_LEN + i * PKG_DIR_ENT_LEN];
+		struct ipu_cpd_index_ent *e = &index->ent[i];
 		int ver, id;
 
-		*p++ = dma_addr_module_data + dir_ent->offset;
-
 		if (ipu_ver == IPU_VER_6 || ipu_ver == IPU_VER_6EP ||
 		    ipu_ver == IPU_VER_6EP_MTL)
 			id = ipu6_cpd_metadata_get_cmpnt_id(isp, metadata,
-							    metadata_size, i);
+							    met_ent->len, i);
 		else
 			id = ipu_cpd_metadata_get_cmpnt_id(isp, metadata,
-							   metadata_size, i);
+							   met_ent->len, i);
 
 		if (id < 0 || id > MAX_COMPONENT_ID) {
 			dev_err(&isp->pdev->dev,
@@ -197,10 +199,10 @@ static int ipu_cpd_parse_module_data(struct ipu_device *isp,
 		if (ipu_ver == IPU_VER_6 || ipu_ver == IPU_VER_6EP ||
 		    ipu_ver == IPU_VER_6EP_MTL)
 			ver = ipu6_cpd_metadata_cmpnt_version(isp, metadata,
-							      metadata_size, i);
+							      met_ent->len, i);
 		else
 			ver = ipu_cpd_metadata_cmpnt_version(isp, metadata,
-							     metadata_size, i);
+							     met_ent->len, i);
 
 		if (ver < 0 || ver > MAX_COMPONENT_VERSION) {
 			dev_err(&isp->pdev->dev,
@@ -208,16 +210,41 @@ static int ipu_cpd_parse_module_data(struct ipu_device *isp,
 			return -EINVAL;
 		}
 
+		e->offset = mod_ent->offset + dir_ent->offset;
+		e->len = dir_ent->len;
+		e->id = id;
+		e->ver = ver;
+	}
+
+	index->num = dir_hdr->ent_cnt;
+	index->cpd = cpd;
+
+	return 0;
+}
+
+static void ipu_cpd_fill_pkg_dir(const struct ipu_cpd_index *index,
+				 dma_addr_t dma_addr_src, u64 *pkg_dir)
+{
+	unsigned int i;
+
+	pkg_dir[0] = PKG_DIR_HDR_MARK;
+	/* pkg_dir entry count = component count + pkg_dir header */
+	pkg_dir[1] = index->num + 1;
+
+	for (i = 0; i < index->num; i++) {
+		const struct ipu_cpd_index_ent *e = &index->ent[i];
+		u64 *p = &pkg_dir[PKG_DIR_ENT_LEN + i * PKG_DIR_ENT_LEN];
+
+		*p++ = dma_addr_src + e->offset;
+
 		/*
 		 * PKG_DIR Entry (type == id)
 		 * 63:56        55      54:48   47:32   31:24   23:0
 		 * Rsvd         Rsvd    Type    Version Rsvd    Size
 		 */
-		*p = dir_ent->len | (u64)id << PKG_DIR_ID_SHIFT |
-		    (u64)ver << PKG_DIR_VERSION_SHIFT;
+		*p = e->len | (u64)e->id << PKG_DIR_ID_SHIFT |
+		    (u64)e->ver << PKG_DIR_VERSION_SHIFT;
 	}
-
-	return 0;
 }
 
 void *ipu_cpd_create_pkg_dir(struct ipu_bus_device *adev,
@@ -226,11 +253,14 @@ void *ipu_cpd_create_pkg_dir(struct ipu_bus_device *adev,
 			     dma_addr_t *dma_addr, unsigned int *pkg_dir_size)
 {
 	struct ipu_device *isp = adev->isp;
-	const struct ipu_cpd_ent *ent, *man_ent, *met_ent;
+	const struct ipu_cpd_ent *man_ent, *met_ent;
 	u64 *pkg_dir;
 	unsigned int man_sz, met_sz;
 	void *pkg_dir_pos;
-	int ret;
+
+	/* The index comes from ipu_cpd_validate_cpd_file() */
+	if (WARN_ON(isp->cpd_index.cpd != src))
+		return NULL;
 
 	man_ent = ipu_cpd_get_manifest(src);
 	man_sz = man_ent->len;
@@ -258,26 +288,7 @@ void *ipu_cpd_create_pkg_dir(struct ipu_bus_device *adev,
 	 * We can ignore other fields that size in N + 1 qword as they
 	 * are 0 anyway. Just setting size for now.
 	 */
-
-	ent = ipu_cpd_get_moduledata(src);
-
-	ret = ipu_cpd_parse_module_data(isp, src + ent->offset,
-					ent->len,
-					dma_addr_src + ent->offset,
-					pkg_dir,
-					src + met_ent->offset, met_ent->len);
-	if (ret) {
-		dev_err(&isp->pdev->dev,
-			"Unable to parse module data section!\n");
-		dma_free_attrs(&adev->dev, *pkg_dir_size, pkg_dir,
-			       *dma_addr,
-#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 8, 0)
-			       NULL);
-#else
-			       0);
-#endif
-		return NULL;
-	}
+	ipu_cpd_fill_pkg_dir(&isp->cpd_index, dma_addr_src, pkg_dir);
 
 	/* Copy manifest after pkg_dir */
 	pkg_dir_pos = pkg_dir + PKG_DIR_ENT_LEN * MAX_PKG_DIR_ENT_CNT;
@@ -450,7 +461,7 @@ int ipu_cpd_validate_cpd_file(struct ipu_device *isp,
 		return rval;
 	}
 
-	return 0;
+	return ipu_cpd_build_index(isp, cpd_file);
 }
 EXPORT_SYMBOL_GPL(ipu_cpd_validate_cpd_file);
 
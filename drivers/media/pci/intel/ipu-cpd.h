@@ -4,10 +4,15 @@
 #ifndef IPU_CPD_H
 #define IPU_CPD_H
 
+#include <linux/types.h>
+
 #define IPU_CPD_SIZE_OF_FW_ARCH_VERSION		7
 #define IPU_CPD_SIZE_OF_SYSTEM_VERSION		11
 #define IPU_CPD_SIZE_OF_COMPONENT_NAME		12
 
+/* Module data components, the package directory has one more entry */
+#define IPU_CPD_MAX_COMPONENTS			15
+
 #define IPU_CPD_METADATA_EXTN_TYPE_IUNIT	0x10
 
 #define IPU_CPD_METADATA_IMAGE_TYPE_RESERVED		0
@@ -92,6 +97,23 @@ struct __packed ipu_cpd_client_pkg_hdr {
 	u32 prog_bin_size;
 };
 
+struct ipu_bus_device;
+struct ipu_device;
+
+/* Module data components of the last validated CPD file */
+struct ipu_cpd_index_ent {
+	u32 offset;	/* From the start of the file */
+	u32 len;
+	u8 id;
+	u16 ver;
+};
+
+struct ipu_cpd_index {
+	const void *cpd;
+	unsigned int num;
+	struct ipu_cpd_index_ent ent[IPU_CPD_MAX_COMPONENTS];
+};
+
 void *ipu_cpd_create_pkg_dir(struct ipu_bus_device *adev,
 			     const void *src,
 			     dma_addr_t dma_addr_src,
@@ -9,10 +9,16 @@
 #include <linux/gfp.h>
 #include <linux/highmem.h>
 #include <linux/iova.h>
+#include <linux/log2.h>
 #include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/rbtree.h>
 #include <linux/scatterlist.h>
+#include <linux/shrinker.h>
+#include <linux/sizes.h>
 #include <linux/version.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
 #include <linux/dma-map-ops.h>
 #endif
@@ -21,25 +27,341 @@
 #include "ipu-bus.h"
 #include "ipu-mmu.h"
 
+/*
+ * Per-CPU magazines of freed IOVAs, one per power of two size below
+ * IPU_IOVA_CACHE_ORDERS pages, in the spirit of the iova rcaches. They
+ * keep the common buffer sizes away from the rbtree and its global lock
+ * when ISYS and PSYS map from several threads.
+ */
+#define IPU_IOVA_CACHE_ORDERS	8
+#define IPU_IOVA_CACHE_DEPTH	8
+
+struct ipu_iova_cpu_cache {
+	spinlock_t lock;	/* Protects the magazines of one CPU */
+	unsigned int count[IPU_IOVA_CACHE_ORDERS];
+	struct iova *iovas[IPU_IOVA_CACHE_ORDERS][IPU_IOVA_CACHE_DEPTH];
+};
+
+int ipu_dma_iova_cache_init(struct ipu_dma_mapping *dmap)
+{
+	unsigned int cpu;
+
+	dmap->iova_cache = alloc_percpu(struct ipu_iova_cpu_cache);
+	if (!dmap->iova_cache)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu_ptr(dmap->iova_cache, cpu)->lock);
+
+	return 0;
+}
+
+static void ipu_dma_iova_cache_drain(struct ipu_dma_mapping *dmap)
+{
+	struct ipu_iova_cpu_cache *cache;
+	unsigned long flags;
+	unsigned int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		cache = per_cpu_ptr(dmap->iova_cache, cpu);
+		spin_lock_irqsave(&cache->lock, flags);
+		for (i = 0; i < IPU_IOVA_CACHE_ORDERS; i++) {
+			while (cache->count[i])
+				__free_iova(&dmap->iovad,
+					    cache->iovas[i][--cache->count[i]]);
+		}
+		spin_unlock_irqrestore(&cache->lock, flags);
+	}
+}
+
+void ipu_dma_iova_cache_destroy(struct ipu_dma_mapping *dmap)
+{
+	if (!dmap->iova_cache)
+		return;
+
+	ipu_dma_iova_cache_drain(dmap);
+	free_percpu(dmap->iova_cache);
+	dmap->iova_cache = NULL;
+}
+
+/*
+ * Sizes served by the magazines are rounded up to a power of two pages,
+ * callers must not size their loops by the returned iova.
+ */
+struct iova *ipu_dma_alloc_iova(struct ipu_dma_mapping *dmap,
+				unsigned long npages, unsigned long limit_pfn)
+{
+	unsigned int order = order_base_2(npages);
+	struct ipu_iova_cpu_cache *cache;
+	struct iova *iova = NULL;
+	unsigned long flags;
+
+	if (order >= IPU_IOVA_CACHE_ORDERS || !dmap->iova_cache)
+		return alloc_iova(&dmap->iovad, npages, limit_pfn, 0);
+
+	cache = raw_cpu_ptr(dmap->iova_cache);
+	spin_lock_irqsave(&cache->lock, flags);
+	if (cache->count[order])
+		iova = cache->iovas[order][--cache->count[order]];
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	if (iova) {
+		if (iova->pfn_hi <= limit_pfn)
+			return iova;
+		__free_iova(&dmap->iovad, iova);
+	}
+
+	iova = alloc_iova(&dmap->iovad, 1UL << order, limit_pfn, 0);
+	if (iova)
+		return iova;
+
+	/* The space may be held by the magazines, give it back and retry */
+	ipu_dma_iova_cache_drain(dmap);
+
+	return alloc_iova(&dmap->iovad, 1UL << order, limit_pfn, 0);
+}
+EXPORT_SYMBOL(ipu_dma_alloc_iova);
+
+void ipu_dma_free_iova(struct ipu_dma_mapping *dmap, struct iova *iova)
+{
+	unsigned long npages = iova_size(iova);
+	struct ipu_iova_cpu_cache *cache;
+	unsigned int order = ilog2(npages);
+	unsigned long flags;
+
+	if (!dmap->iova_cache || !is_power_of_2(npages) ||
+	    order >= IPU_IOVA_CACHE_ORDERS) {
+		__free_iova(&dmap->iovad, iova);
+		return;
+	}
+
+	cache = raw_cpu_ptr(dmap->iova_cache);
+	spin_lock_irqsave(&cache->lock, flags);
+	if (cache->count[order] < IPU_IOVA_CACHE_DEPTH) {
+		cache->iovas[order][cache->count[order]++] = iova;
+		iova = NULL;
+	}
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	if (iova)
+		__free_iova(&dmap->iovad, iova);
+}
+EXPORT_SYMBOL(ipu_dma_free_iova);
+
 struct vm_info {
-	struct list_head list;
+	struct rb_node node;
 	struct page **pages;
 	dma_addr_t ipu_iova;
 	void *vaddr;
 	unsigned long size;
 };
 
+/* vm_info is indexed by its iova range, the ranges never overlap */
 static struct vm_info *get_vm_info(struct ipu_mmu *mmu, dma_addr_t iova)
 {
-	struct vm_info *info, *save;
+	struct vm_info *info = NULL;
+	struct rb_node *node;
+	unsigned long flags;
+
+	spin_lock_irqsave(&mmu->vma_lock, flags);
+	node = mmu->vma_tree.rb_node;
+	while (node) {
+		struct vm_info *cur = rb_entry(node, struct vm_info, node);
+
+		if (iova < cur->ipu_iova) {
+			node = node->rb_left;
+		} else if (iova >= cur->ipu_iova + cur->size) {
+			node = node->rb_right;
+		} else {
+			info = cur;
+			break;
+		}
+	}
+	spin_unlock_irqrestore(&mmu->vma_lock, flags);
 
-	list_for_each_entry_safe(info, save, &mmu->vma_list, list) {
-		if (iova >= info->ipu_iova &&
-		    iova < (info->ipu_iova + info->size))
-			return info;
+	return info;
+}
+
+static void add_vm_info(struct ipu_mmu *mmu, struct vm_info *info)
+{
+	struct rb_node **new, *parent = NULL;
+	unsigned long flags;
+
+	spin_lock_irqsave(&mmu->vma_lock, flags);
+	new = &mmu->vma_tree.rb_node;
+	while (*new) {
+		struct vm_info *cur = rb_entry(*new, struct vm_info, node);
+
+		parent = *new;
+		if (info->ipu_iova < cur->ipu_iova)
+			new = &(*new)->rb_left;
+		else
+			new = &(*new)->rb_right;
 	}
+	rb_link_node(&info->node, parent, new);
+	rb_insert_color(&info->node, &mmu->vma_tree);
+	spin_unlock_irqrestore(&mmu->vma_lock, flags);
+}
 
-	return NULL;
+static void del_vm_info(struct ipu_mmu *mmu, struct vm_info *info)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&mmu->vma_lock, flags);
+	rb_erase(&info->node, &mmu->vma_tree);
+	spin_unlock_irqrestore(&mmu->vma_lock, flags);
+}
+
+/*
+ * Chunks of IPU_DMA_POOL_ORDER pages zeroed and flushed ahead of time by a
+ * worker, so that a large ipu_dma_alloc() at stream start doesn't memset
+ * and clflush its buffer itself. The pool is topped up to dma_pool_bytes
+ * after each draw and handed back to the page allocator by its shrinker.
+ */
+#define IPU_DMA_POOL_ORDER	4
+
+static unsigned int dma_pool_bytes = SZ_32M;
+module_param(dma_pool_bytes, uint, 0644);
+MODULE_PARM_DESC(dma_pool_bytes,
+		 "Pre-zeroed memory kept for DMA allocations (0 = none)");
+
+static struct {
+	spinlock_t lock;	/* Protects list and count */
+	struct list_head list;
+	unsigned long count;
+	struct work_struct refill;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	struct shrinker *shrinker;
+#else
+	struct shrinker shrinker;
+#endif
+} ipu_dma_pool;
+
+static unsigned long ipu_dma_pool_max(void)
+{
+	return READ_ONCE(dma_pool_bytes) >> (PAGE_SHIFT + IPU_DMA_POOL_ORDER);
+}
+
+static struct page *ipu_dma_pool_get(void)
+{
+	struct page *page;
+
+	spin_lock(&ipu_dma_pool.lock);
+	page = list_first_entry_or_null(&ipu_dma_pool.list, struct page, lru);
+	if (page) {
+		list_del(&page->lru);
+		ipu_dma_pool.count--;
+	}
+	spin_unlock(&ipu_dma_pool.lock);
+
+	if (!page || ipu_dma_pool.count < ipu_dma_pool_max())
+		queue_work(system_unbound_wq, &ipu_dma_pool.refill);
+
+	return page;
+}
+
+static void ipu_dma_pool_refill(struct work_struct *work)
+{
+	const gfp_t gfp = GFP_KERNEL | __GFP_NOWARN | __GFP_NORETRY;
+	struct page *page;
+
+	while (READ_ONCE(ipu_dma_pool.count) < ipu_dma_pool_max()) {
+		/* Don't fight reclaim for it, the pool is only an optimisation */
+		page = alloc_pages(gfp, IPU_DMA_POOL_ORDER);
+		if (!page)
+			return;
+
+		memset(page_address(page), 0, PAGE_SIZE << IPU_DMA_POOL_ORDER);
+		clflush_cache_range(page_address(page),
+				    PAGE_SIZE << IPU_DMA_POOL_ORDER);
+
+		spin_lock(&ipu_dma_pool.lock);
+		list_add(&page->lru, &ipu_dma_pool.list);
+		ipu_dma_pool.count++;
+		spin_unlock(&ipu_dma_pool.lock);
+		cond_resched();
+	}
+}
+
+static unsigned long ipu_dma_pool_count(struct shrinker *shrinker,
+					struct shrink_control *sc)
+{
+	return READ_ONCE(ipu_dma_pool.count) << IPU_DMA_POOL_ORDER;
+}
+
+static unsigned long ipu_dma_pool_scan(struct shrinker *shrinker,
+				       struct shrink_control *sc)
+{
+	unsigned long freed = 0;
+	struct page *page;
+
+	while (freed < sc->nr_to_scan) {
+		spin_lock(&ipu_dma_pool.lock);
+		page = list_first_entry_or_null(&ipu_dma_pool.list,
+						struct page, lru);
+		if (page) {
+			list_del(&page->lru);
+			ipu_dma_pool.count--;
+		}
+		spin_unlock(&ipu_dma_pool.lock);
+		if (!page)
+			break;
+
+		__free_pages(page, IPU_DMA_POOL_ORDER);
+		freed += 1 << IPU_DMA_POOL_ORDER;
+	}
+
+	return freed ? freed : SHRINK_STOP;
+}
+
+int ipu_dma_pool_init(void)
+{
+	struct shrinker *shrinker;
+	int rval = 0;
+
+	spin_lock_init(&ipu_dma_pool.lock);
+	INIT_LIST_HEAD(&ipu_dma_pool.list);
+	INIT_WORK(&ipu_dma_pool.refill, ipu_dma_pool_refill);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	shrinker = shrinker_alloc(0, "ipu-dma-pool");
+	if (!shrinker)
+		return -ENOMEM;
+	ipu_dma_pool.shrinker = shrinker;
+#else
+	shrinker = &ipu_dma_pool.shrinker;
+#endif
+	shrinker->count_objects = ipu_dma_pool_count;
+	shrinker->scan_objects = ipu_dma_pool_scan;
+	shrinker->seeks = DEFAULT_SEEKS;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	shrinker_register(shrinker);
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+	rval = register_shrinker(shrinker, "ipu-dma-pool");
+#else
+	rval = register_shrinker(shrinker);
+#endif
+	if (!rval)
+		queue_work(system_unbound_wq, &ipu_dma_pool.refill);
+
+	return rval;
+}
+
+void ipu_dma_pool_exit(void)
+{
+	struct page *page, *tmp;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	shrinker_free(ipu_dma_pool.shrinker);
+#else
+	unregister_shrinker(&ipu_dma_pool.shrinker);
+#endif
+	cancel_work_sync(&ipu_dma_pool.refill);
+
+	list_for_each_entry_safe(page, tmp, &ipu_dma_pool.list, lru)
+		__free_pages(page, IPU_DMA_POOL_ORDER);
+	INIT_LIST_HEAD(&ipu_dma_pool.list);
+	ipu_dma_pool.count = 0;
 }
 
 /* Begin of things adapted from arch/arm/mm/dma-mapping.c */
@@ -87,8 +409,20 @@ static struct page **__dma_alloc_buffer(struct device *dev, size_t size,
 
 	while (count) {
 		int j, order = __fls(count);
-
-		pages[i] = alloc_pages(gfp, order);
+		bool clear = true;
+
+		pages[i] = NULL;
+		/* The pool pages aren't from a restricted zone */
+		if (order >= IPU_DMA_POOL_ORDER &&
+		    !(gfp & (__GFP_DMA | __GFP_DMA32))) {
+			pages[i] = ipu_dma_pool_get();
+			if (pages[i]) {
+				order = IPU_DMA_POOL_ORDER;
+				clear = false;
+			}
+		}
+		if (!pages[i])
+			pages[i] = alloc_pages(gfp, order);
 		while (!pages[i] && order)
 			pages[i] = alloc_pages(gfp, --order);
 		if (!pages[i])
@@ -101,7 +435,8 @@ static struct page **__dma_alloc_buffer(struct device *dev, size_t size,
 				pages[i + j] = pages[i] + j;
 		}
 
-		__dma_clear_buffer(pages[i], PAGE_SIZE << order, attrs);
+		if (clear)
+			__dma_clear_buffer(pages[i], PAGE_SIZE << order, attrs);
 		i += 1 << order;
 		count -= 1 << order;
 	}
@@ -138,10 +473,18 @@ static int __dma_free_buffer(struct device *dev, struct page **pages,
 
 /* End of things adapted from arch/arm/mm/dma-mapping.c */
 
-static void ipu_dma_sync_single_for_cpu(struct device *dev,
-					dma_addr_t dma_handle,
-					size_t size,
-					enum dma_data_direction dir)
+/*
+ * The IPU doesn't snoop the CPU caches. Handing a buffer to the device
+ * always takes a flush, so that no dirty line gets written back over what
+ * the IPU wrote. Taking it back only needs one if the IPU may have
+ * written: a CPU write-only buffer, DMA_TO_DEVICE, costs nothing there.
+ * Only the range asked for is flushed, dma_sync_single_range_for_cpu() or
+ * a partial sg gets away with the part of the buffer it reads.
+ */
+static void ipu_dma_sync_single_for_device(struct device *dev,
+					   dma_addr_t dma_handle,
+					   size_t size,
+					   enum dma_data_direction dir)
 {
 	void *vaddr;
 	u32 offset;
@@ -160,9 +503,18 @@ static void ipu_dma_sync_single_for_cpu(struct device *dev,
 	clflush_cache_range(vaddr, size);
 }
 
-static void ipu_dma_sync_sg_for_cpu(struct device *dev,
-				    struct scatterlist *sglist,
-				    int nents, enum dma_data_direction dir)
+static void ipu_dma_sync_single_for_cpu(struct device *dev,
+					dma_addr_t dma_handle,
+					size_t size,
+					enum dma_data_direction dir)
+{
+	if (dir != DMA_TO_DEVICE)
+		ipu_dma_sync_single_for_device(dev, dma_handle, size, dir);
+}
+
+static void ipu_dma_sync_sg_for_device(struct device *dev,
+				       struct scatterlist *sglist,
+				       int nents, enum dma_data_direction dir)
 {
 	struct scatterlist *sg;
 	int i;
@@ -171,6 +523,40 @@ static void ipu_dma_sync_sg_for_cpu(struct device *dev,
 		clflush_cache_range(page_to_virt(sg_page(sg)), sg->length);
 }
 
+static void ipu_dma_sync_sg_for_cpu(struct device *dev,
+				    struct scatterlist *sglist,
+				    int nents, enum dma_data_direction dir)
+{
+	if (dir != DMA_TO_DEVICE)
+		ipu_dma_sync_sg_for_device(dev, sglist, nents, dir);
+}
+
+/* Undo the PCI mappings of the first count pages of an ipu_dma_alloc() */
+static void ipu_dma_unmap_chunks(struct device *dev, struct iova *iova,
+				 struct page **pages, unsigned long count,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 8, 0)
+				 struct dma_attrs *attrs)
+#else
+				 unsigned long attrs)
+#endif
+{
+	struct ipu_mmu *mmu = to_ipu_bus_device(dev)->mmu;
+	struct pci_dev *pdev = to_ipu_bus_device(dev)->isp->pdev;
+	unsigned long i, run;
+	dma_addr_t pci_dma_addr;
+
+	for (i = 0; i < count; i += run) {
+		run = max_t(unsigned long, page_private(pages[i]), 1);
+		set_page_private(pages[i], 0);
+		pci_dma_addr =
+			ipu_mmu_iova_to_phys(mmu->dmap->mmu_info,
+					     (iova->pfn_lo + i) << PAGE_SHIFT);
+		dma_unmap_page_attrs(&pdev->dev, pci_dma_addr,
+				     run << PAGE_SHIFT, DMA_BIDIRECTIONAL,
+				     attrs);
+	}
+}
+
 static void *ipu_dma_alloc(struct device *dev, size_t size,
 			   dma_addr_t *dma_handle, gfp_t gfp,
 #if LINUX_VERSION_CODE < KERNEL_VERSION(4, 8, 0)
@@ -186,8 +572,8 @@ static void *ipu_dma_alloc(struct device *dev, size_t size,
 	struct vm_info *info;
 	int i;
 	int rval;
-	unsigned long count;
-	dma_addr_t pci_dma_addr, ipu_iova;
+	unsigned long count, run, max_run = 1;
+	dma_addr_t pci_dma_addr;
 
 	info = kzalloc(sizeof(*info), GFP_KERNEL);
 	if (!info)
@@ -196,8 +582,8 @@ static void *ipu_dma_alloc(struct device *dev, size_t size,
 	size = PAGE_ALIGN(size);
 	count = size >> PAGE_SHIFT;
 
-	iova = alloc_iova(&mmu->dmap->iovad, count,
-			  dma_get_mask(dev) >> PAGE_SHIFT, 0);
+	iova = ipu_dma_alloc_iova(mmu->dmap, count,
+				  dma_get_mask(dev) >> PAGE_SHIFT);
 	if (!iova)
 		goto out_kfree;
 
@@ -207,12 +593,27 @@ static void *ipu_dma_alloc(struct device *dev, size_t size,
 
 	dev_dbg(dev, "dma_alloc: iova low pfn %lu, high pfn %lu\n", iova->pfn_lo,
 		iova->pfn_hi);
-	for (i = 0; iova->pfn_lo + i <= iova->pfn_hi; i++) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 1, 0)
+	/* A bounce buffer only takes so much at once */
+	max_run = max_t(unsigned long,
+			dma_max_mapping_size(&pdev->dev) >> PAGE_SHIFT, 1);
+#endif
+	for (i = 0; i < count; i += run) {
+		/*
+		 * Map each physically contiguous chunk at once. Behind an
+		 * IOMMU it then gets one IOVA range, which the IOMMU can
+		 * back with large pages, and one ipu_mmu_map() call.
+		 */
+		for (run = 1; i + run < count && run < max_run &&
+		     page_to_pfn(pages[i + run]) == page_to_pfn(pages[i]) + run;
+		     run++)
+			;
+
 		pci_dma_addr = dma_map_page_attrs(&pdev->dev, pages[i], 0,
-						  PAGE_SIZE, DMA_BIDIRECTIONAL,
-						  attrs);
-		dev_dbg(dev, "dma_alloc: mapped pci_dma_addr %pad\n",
-			&pci_dma_addr);
+						  run << PAGE_SHIFT,
+						  DMA_BIDIRECTIONAL, attrs);
+		dev_dbg(dev, "dma_alloc: mapped pci_dma_addr %pad, %lu pages\n",
+			&pci_dma_addr, run);
 		if (dma_mapping_error(&pdev->dev, pci_dma_addr)) {
 			dev_err(dev, "pci_dma_mapping for page[%d] failed", i);
 			goto out_unmap;
@@ -220,15 +621,18 @@ static void *ipu_dma_alloc(struct device *dev, size_t size,
 
 		rval = ipu_mmu_map(mmu->dmap->mmu_info,
 				   (iova->pfn_lo + i) << PAGE_SHIFT,
-				   pci_dma_addr, PAGE_SIZE);
+				   pci_dma_addr, run << PAGE_SHIFT);
 		if (rval) {
-			dev_err(dev, "ipu_mmu_map for pci_dma[%d] %pad failed",
-				i, &pci_dma_addr);
+			dev_err(dev, "ipu_mmu_map for pci_dma %pad failed",
+				&pci_dma_addr);
 			dma_unmap_page_attrs(&pdev->dev, pci_dma_addr,
-					     PAGE_SIZE, DMA_BIDIRECTIONAL,
-					     attrs);
+					     run << PAGE_SHIFT,
+					     DMA_BIDIRECTIONAL, attrs);
 			goto out_unmap;
 		}
+
+		/* The first page of a chunk keeps its length for the unmap */
+		set_page_private(pages[i], run);
 	}
 
 	info->vaddr = vmap(pages, count, VM_USERMAP, PAGE_KERNEL);
@@ -240,25 +644,19 @@ static void *ipu_dma_alloc(struct device *dev, size_t size,
 	info->pages = pages;
 	info->ipu_iova = *dma_handle;
 	info->size = size;
-	list_add(&info->list, &mmu->vma_list);
+	add_vm_info(mmu, info);
 
 	return info->vaddr;
 
 out_unmap:
-	for (i--; i >= 0; i--) {
-		ipu_iova = (iova->pfn_lo + i) << PAGE_SHIFT;
-		pci_dma_addr = ipu_mmu_iova_to_phys(mmu->dmap->mmu_info,
-						    ipu_iova);
-		dma_unmap_page_attrs(&pdev->dev, pci_dma_addr, PAGE_SIZE,
-				     DMA_BIDIRECTIONAL, attrs);
-
-		ipu_mmu_unmap(mmu->dmap->mmu_info, ipu_iova, PAGE_SIZE);
-	}
+	ipu_dma_unmap_chunks(dev, iova, pages, i, attrs);
+	ipu_mmu_unmap(mmu->dmap->mmu_info, iova->pfn_lo << PAGE_SHIFT,
+		      (unsigned long)i << PAGE_SHIFT);
 
 	__dma_free_buffer(dev, pages, size, attrs);
 
 out_free_iova:
-	__free_iova(&mmu->dmap->iovad, iova);
+	ipu_dma_free_iova(mmu->dmap, iova);
 out_kfree:
 	kfree(info);
 
@@ -274,13 +672,10 @@ static void ipu_dma_free(struct device *dev, size_t size, void *vaddr,
 #endif
 {
 	struct ipu_mmu *mmu = to_ipu_bus_device(dev)->mmu;
-	struct pci_dev *pdev = to_ipu_bus_device(dev)->isp->pdev;
 	struct page **pages;
 	struct vm_info *info;
 	struct iova *iova = find_iova(&mmu->dmap->iovad,
 				      dma_handle >> PAGE_SHIFT);
-	dma_addr_t pci_dma_addr, ipu_iova;
-	int i;
 
 	if (WARN_ON(!iova))
 		return;
@@ -295,7 +690,7 @@ static void ipu_dma_free(struct device *dev, size_t size, void *vaddr,
 	if (WARN_ON(!info->pages))
 		return;
 
-	list_del(&info->list);
+	del_vm_info(mmu, info);
 
 	size = PAGE_ALIGN(size);
 
@@ -303,22 +698,17 @@ static void ipu_dma_free(struct device *dev, size_t size, void *vaddr,
 
 	vunmap(vaddr);
 
-	for (i = 0; i < size >> PAGE_SHIFT; i++) {
-		ipu_iova = (iova->pfn_lo + i) << PAGE_SHIFT;
-		pci_dma_addr = ipu_mmu_iova_to_phys(mmu->dmap->mmu_info,
-						    ipu_iova);
-		dma_unmap_page_attrs(&pdev->dev, pci_dma_addr, PAGE_SIZE,
-				     DMA_BIDIRECTIONAL, attrs);
-	}
-
-	ipu_mmu_unmap(mmu->dmap->mmu_info, iova->pfn_lo << PAGE_SHIFT,
-		      iova_size(iova) << PAGE_SHIFT);
+	ipu_dma_unmap_chunks(dev, iova, pages, size >> PAGE_SHIFT, attrs);
 
-	__dma_free_buffer(dev, pages, size, attrs);
+	/* What was mapped, the iova may be rounded up by the magazines */
+	ipu_mmu_unmap(mmu->dmap->mmu_info, iova->pfn_lo << PAGE_SHIFT, size);
 
-	mmu->tlb_invalidate(mmu);
+	if (!ipu_mmu_defer_unmap(mmu, iova)) {
+		ipu_mmu_tlb_invalidate_unmap(mmu);
+		ipu_dma_free_iova(mmu->dmap, iova);
+	}
 
-	__free_iova(&mmu->dmap->iovad, iova);
+	__dma_free_buffer(dev, pages, size, attrs);
 
 	kfree(info);
 }
@@ -398,6 +788,7 @@ static void ipu_dma_unmap_sg(struct device *dev,
 #endif
 {
 	int i, npages, count;
+	size_t mapped = 0;
 	struct scatterlist *sg;
 	dma_addr_t pci_dma_addr;
 	struct ipu_mmu *mmu = to_ipu_bus_device(dev)->mmu;
@@ -416,7 +807,7 @@ static void ipu_dma_unmap_sg(struct device *dev,
 #else
 	if ((attrs & DMA_ATTR_SKIP_CPU_SYNC) == 0)
 #endif
-		ipu_dma_sync_sg_for_cpu(dev, sglist, nents, DMA_BIDIRECTIONAL);
+		ipu_dma_sync_sg_for_cpu(dev, sglist, nents, dir);
 
 	/* get the nents as orig_nents given by caller */
 	count = 0;
@@ -427,6 +818,7 @@ static void ipu_dma_unmap_sg(struct device *dev,
 			break;
 
 		npages -= PAGE_ALIGN(sg_dma_len(sg)) >> PAGE_SHIFT;
+		mapped += PAGE_ALIGN(sg_dma_len(sg));
 		count++;
 		if (npages <= 0)
 			break;
@@ -448,14 +840,20 @@ static void ipu_dma_unmap_sg(struct device *dev,
 
 	dev_dbg(dev, "ipu_mmu_unmap low pfn %lu high pfn %lu\n",
 		iova->pfn_lo, iova->pfn_hi);
-	ipu_mmu_unmap(mmu->dmap->mmu_info, iova->pfn_lo << PAGE_SHIFT,
-		      iova_size(iova) << PAGE_SHIFT);
+	/* As mapped by ipu_dma_map_sg(), not the rounded up iova size */
+	ipu_mmu_unmap(mmu->dmap->mmu_info, iova->pfn_lo << PAGE_SHIFT, mapped);
 
-	mmu->tlb_invalidate(mmu);
+	/* A deferred unmap keeps the iova quarantined until the TLB flush */
+	if (ipu_mmu_defer_unmap(mmu, iova)) {
+		dma_unmap_sg_attrs(&pdev->dev, sglist, nents, dir, attrs);
+		return;
+	}
+
+	ipu_mmu_tlb_invalidate_unmap(mmu);
 
 	dma_unmap_sg_attrs(&pdev->dev, sglist, nents, dir, attrs);
 
-	__free_iova(&mmu->dmap->iovad, iova);
+	ipu_dma_free_iova(mmu->dmap, iova);
 }
 
 static int ipu_dma_map_sg(struct device *dev, struct scatterlist *sglist,
@@ -486,8 +884,8 @@ static int ipu_dma_map_sg(struct device *dev, struct scatterlist *sglist,
 	for_each_sg(sglist, sg, count, i)
 		npages += PAGE_ALIGN(sg_dma_len(sg)) >> PAGE_SHIFT;
 
-	iova = alloc_iova(&mmu->dmap->iovad, npages,
-			  dma_get_mask(dev) >> PAGE_SHIFT, 0);
+	iova = ipu_dma_alloc_iova(mmu->dmap, npages,
+				  dma_get_mask(dev) >> PAGE_SHIFT);
 	if (!iova)
 		return 0;
 
@@ -521,7 +919,7 @@ static int ipu_dma_map_sg(struct device *dev, struct scatterlist *sglist,
 #else
 	if ((attrs & DMA_ATTR_SKIP_CPU_SYNC) == 0)
 #endif
-		ipu_dma_sync_sg_for_cpu(dev, sglist, nents, DMA_BIDIRECTIONAL);
+		ipu_dma_sync_sg_for_device(dev, sglist, nents, dir);
 
 	mmu->tlb_invalidate(mmu);
 
@@ -576,8 +974,8 @@ const struct dma_map_ops ipu_dma_ops = {
 	.map_sg = ipu_dma_map_sg,
 	.unmap_sg = ipu_dma_unmap_sg,
 	.sync_single_for_cpu = ipu_dma_sync_single_for_cpu,
-	.sync_single_for_device = ipu_dma_sync_single_for_cpu,
+	.sync_single_for_device = ipu_dma_sync_single_for_device,
 	.sync_sg_for_cpu = ipu_dma_sync_sg_for_cpu,
-	.sync_sg_for_device = ipu_dma_sync_sg_for_cpu,
+	.sync_sg_for_device = ipu_dma_sync_sg_for_device,
 	.get_sgtable = ipu_dma_get_sgtable,
 };
@@ -7,13 +7,23 @@
 #include <linux/iova.h>
 
 struct ipu_mmu_info;
+struct ipu_iova_cpu_cache;
 
 struct ipu_dma_mapping {
 	struct ipu_mmu_info *mmu_info;
 	struct iova_domain iovad;
+	struct ipu_iova_cpu_cache __percpu *iova_cache;
 	struct kref ref;
 };
 
 extern const struct dma_map_ops ipu_dma_ops;
 
+int ipu_dma_iova_cache_init(struct ipu_dma_mapping *dmap);
+void ipu_dma_iova_cache_destroy(struct ipu_dma_mapping *dmap);
+struct iova *ipu_dma_alloc_iova(struct ipu_dma_mapping *dmap,
+				unsigned long npages, unsigned long limit_pfn);
+void ipu_dma_free_iova(struct ipu_dma_mapping *dmap, struct iova *iova);
+int ipu_dma_pool_init(void);
+void ipu_dma_pool_exit(void);
+
 #endif /* IPU_DMA_H */
@@ -81,6 +81,20 @@ struct ipu_fw_syscom_config {
 
 /* End of shared structures / data */
 
+/*
+ * Host copies of the queue indexes. The host owned index (write index of
+ * a send queue, read index of a receive queue) is only ever written by
+ * the host, so its copy is always exact and never read back. The index
+ * the firmware owns is re-read from DMEM only when the copy shows the
+ * queue full (send) or empty (receive).
+ */
+struct ipu_fw_com_queue_shadow {
+	unsigned int wr;
+	unsigned int rd;
+	/* Receive queues: read index last written to DMEM */
+	unsigned int committed;
+};
+
 struct ipu_fw_com_context {
 	struct ipu_bus_device *adev;
 	void __iomem *dmem_addr;
@@ -97,6 +111,8 @@ struct ipu_fw_com_context {
 
 	struct ipu_fw_sys_queue *input_queue;	/* array of host to SP queues */
 	struct ipu_fw_sys_queue *output_queue;	/* array of SP to host */
+	struct ipu_fw_com_queue_shadow *input_shadow;
+	struct ipu_fw_com_queue_shadow *output_shadow;
 
 	void *config_host_addr;
 	void *specific_host_addr;
@@ -166,20 +182,10 @@ static unsigned int num_free(unsigned int wr, unsigned int rd,
 	return size - num_messages(wr, rd, size);
 }
 
-static unsigned int curr_index(void __iomem *q_dmem,
-			       enum message_direction dir)
-{
-	return readl(q_dmem +
-			 (dir == DIR_RECV ? FW_COM_RD_REG : FW_COM_WR_REG));
-}
-
-static unsigned int inc_index(void __iomem *q_dmem, struct ipu_fw_sys_queue *q,
-			      enum message_direction dir)
+static unsigned int inc_index(struct ipu_fw_sys_queue *q, unsigned int index,
+			      unsigned int n)
 {
-	unsigned int index;
-
-	index = curr_index(q_dmem, dir) + 1;
-	return index >= q->size ? 0 : index;
+	return (index + n) % q->size;
 }
 
 static unsigned int ipu_sys_queue_buf_size(unsigned int size,
@@ -226,9 +232,13 @@ void *ipu_fw_com_prepare(struct ipu_fw_com_cfg *cfg,
 	if (!cfg || !cfg->cell_start || !cfg->cell_ready)
 		return NULL;
 
-	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	ctx = kzalloc(sizeof(*ctx) +
+		      (cfg->num_input_queues + cfg->num_output_queues) *
+		      sizeof(struct ipu_fw_com_queue_shadow), GFP_KERNEL);
 	if (!ctx)
 		return NULL;
+	ctx->input_shadow = (struct ipu_fw_com_queue_shadow *)(ctx + 1);
+	ctx->output_shadow = ctx->input_shadow + cfg->num_input_queues;
 	ctx->dmem_addr = base + cfg->dmem_addr + REGMEM_OFFSET;
 	ctx->adev = adev;
 	ctx->cell_start = cfg->cell_start;
@@ -369,6 +379,7 @@ int ipu_fw_com_open(struct ipu_fw_com_context *ctx)
 					  ctx->buttress_boot_offset,
 					  SYSCOM_CONFIG_ID));
 	ctx->cell_start(ctx->adev);
+	ipu_bus_boot_mark(ctx->adev, IPU_BOOT_SP_START);
 
 	return 0;
 }
@@ -410,8 +421,20 @@ int ipu_fw_com_release(struct ipu_fw_com_context *ctx, unsigned int force)
 }
 EXPORT_SYMBOL_GPL(ipu_fw_com_release);
 
+static void ipu_fw_com_sync_shadow(struct ipu_fw_com_queue_shadow *sh,
+				   struct ipu_fw_sys_queue *q,
+				   void __iomem *dmem_addr)
+{
+	void __iomem *q_dmem = dmem_addr + q->wr_reg * 4;
+
+	sh->wr = readl(q_dmem + FW_COM_WR_REG);
+	sh->rd = readl(q_dmem + FW_COM_RD_REG);
+	sh->committed = sh->rd;
+}
+
 int ipu_fw_com_ready(struct ipu_fw_com_context *ctx)
 {
+	unsigned int i;
 	int state;
 
 	state = readl(BUTTRESS_FW_BOOT_PARAM_REG(ctx->base_addr,
@@ -420,6 +443,16 @@ int ipu_fw_com_ready(struct ipu_fw_com_context *ctx)
 	if (state != SYSCOM_STATE_READY)
 		return -EBUSY;	/* SPC is not ready to handle messages yet */
 
+	/* The firmware has set up the indexes, start the copies from them */
+	for (i = 0; i < ctx->num_input_queues; i++)
+		ipu_fw_com_sync_shadow(&ctx->input_shadow[i],
+				       &ctx->input_queue[i], ctx->dmem_addr);
+	for (i = 0; i < ctx->num_output_queues; i++)
+		ipu_fw_com_sync_shadow(&ctx->output_shadow[i],
+				       &ctx->output_queue[i], ctx->dmem_addr);
+
+	ipu_bus_boot_mark(ctx->adev, IPU_BOOT_SYSCOM_READY);
+
 	return 0;
 }
 EXPORT_SYMBOL_GPL(ipu_fw_com_ready);
@@ -431,77 +464,166 @@ static bool is_index_valid(struct ipu_fw_sys_queue *q, unsigned int index)
 	return true;
 }
 
-void *ipu_send_get_token(struct ipu_fw_com_context *ctx, int q_nbr)
+/* Refresh the copy of the index the firmware owns */
+static bool sync_fw_index(struct ipu_fw_sys_queue *q, unsigned int reg,
+			  void __iomem *dmem_addr, unsigned int *index)
+{
+	unsigned int val = readl(dmem_addr + q->wr_reg * 4 + reg);
+
+	/* Catch indexes in dmem */
+	if (!is_index_valid(q, val))
+		return false;
+
+	*index = val;
+	return true;
+}
+
+static unsigned int send_free(struct ipu_fw_com_context *ctx, int q_nbr,
+			      unsigned int wr)
 {
 	struct ipu_fw_sys_queue *q = &ctx->input_queue[q_nbr];
-	void __iomem *q_dmem = ctx->dmem_addr + q->wr_reg * 4;
-	unsigned int wr, rd;
-	unsigned int packets;
-	unsigned int index;
+	struct ipu_fw_com_queue_shadow *sh = &ctx->input_shadow[q_nbr];
+	unsigned int packets = num_free(wr + 1, sh->rd, q->size);
 
-	wr = readl(q_dmem + FW_COM_WR_REG);
-	rd = readl(q_dmem + FW_COM_RD_REG);
+	if (packets ||
+	    !sync_fw_index(q, FW_COM_RD_REG, ctx->dmem_addr, &sh->rd))
+		return packets;
 
-	/* Catch indexes in dmem */
-	if (!is_index_valid(q, wr) || !is_index_valid(q, rd))
-		return NULL;
+	return num_free(wr + 1, sh->rd, q->size);
+}
 
-	packets = num_free(wr + 1, rd, q->size);
-	if (!packets)
-		return NULL;
+void *ipu_send_get_token(struct ipu_fw_com_context *ctx, int q_nbr)
+{
+	struct ipu_fw_sys_queue *q = &ctx->input_queue[q_nbr];
+	struct ipu_fw_com_queue_shadow *sh = &ctx->input_shadow[q_nbr];
 
-	index = curr_index(q_dmem, DIR_SEND);
+	if (!send_free(ctx, q_nbr, sh->wr))
+		return NULL;
 
-	return (void *)(unsigned long)q->host_address + (index * q->token_size);
+	return (void *)(unsigned long)q->host_address + (sh->wr * q->token_size);
 }
 EXPORT_SYMBOL_GPL(ipu_send_get_token);
 
 void ipu_send_put_token(struct ipu_fw_com_context *ctx, int q_nbr)
 {
 	struct ipu_fw_sys_queue *q = &ctx->input_queue[q_nbr];
-	void __iomem *q_dmem = ctx->dmem_addr + q->wr_reg * 4;
-	int index = curr_index(q_dmem, DIR_SEND);
-
-	/* Increment index */
-	index = inc_index(q_dmem, q, DIR_SEND);
+	struct ipu_fw_com_queue_shadow *sh = &ctx->input_shadow[q_nbr];
 
-	writel(index, q_dmem + FW_COM_WR_REG);
+	sh->wr = inc_index(q, sh->wr, 1);
+	writel(sh->wr, ctx->dmem_addr + q->wr_reg * 4 + FW_COM_WR_REG);
 }
 EXPORT_SYMBOL_GPL(ipu_send_put_token);
 
-void *ipu_recv_get_token(struct ipu_fw_com_context *ctx, int q_nbr)
+int ipu_send_batch_begin(struct ipu_fw_com_context *ctx, int q_nbr,
+			 struct ipu_fw_com_send_batch *batch)
+{
+	struct ipu_fw_sys_queue *q = &ctx->input_queue[q_nbr];
+	struct ipu_fw_com_queue_shadow *sh = &ctx->input_shadow[q_nbr];
+
+	batch->q_nbr = q_nbr;
+	batch->wr = sh->wr;
+	batch->free = num_free(sh->wr + 1, sh->rd, q->size);
+	batch->count = 0;
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(ipu_send_batch_begin);
+
+void *ipu_send_batch_get_token(struct ipu_fw_com_context *ctx,
+			       struct ipu_fw_com_send_batch *batch)
+{
+	struct ipu_fw_sys_queue *q = &ctx->input_queue[batch->q_nbr];
+	unsigned int index;
+
+	if (batch->count >= batch->free)
+		batch->free = send_free(ctx, batch->q_nbr, batch->wr);
+	if (batch->count >= batch->free)
+		return NULL;
+
+	index = inc_index(q, batch->wr, batch->count++);
+
+	return (void *)(unsigned long)q->host_address + (index * q->token_size);
+}
+EXPORT_SYMBOL_GPL(ipu_send_batch_get_token);
+
+void ipu_send_batch_end(struct ipu_fw_com_context *ctx,
+			struct ipu_fw_com_send_batch *batch)
+{
+	struct ipu_fw_sys_queue *q = &ctx->input_queue[batch->q_nbr];
+	struct ipu_fw_com_queue_shadow *sh = &ctx->input_shadow[batch->q_nbr];
+
+	if (!batch->count)
+		return;
+
+	sh->wr = inc_index(q, batch->wr, batch->count);
+	writel(sh->wr, ctx->dmem_addr + q->wr_reg * 4 + FW_COM_WR_REG);
+	batch->count = 0;
+}
+EXPORT_SYMBOL_GPL(ipu_send_batch_end);
+
+/*
+ * As ipu_recv_get_token(), also returning the number of pending tokens.
+ * The write index is only re-read once the tokens seen so far are
+ * consumed, so the level is the one at that read minus the consumed.
+ */
+void *ipu_recv_get_token_level(struct ipu_fw_com_context *ctx, int q_nbr,
+			       unsigned int *level)
 {
 	struct ipu_fw_sys_queue *q = &ctx->output_queue[q_nbr];
-	void __iomem *q_dmem = ctx->dmem_addr + q->wr_reg * 4;
-	unsigned int wr, rd;
+	struct ipu_fw_com_queue_shadow *sh = &ctx->output_shadow[q_nbr];
 	unsigned int packets;
-	void *addr;
-
-	wr = readl(q_dmem + FW_COM_WR_REG);
-	rd = readl(q_dmem + FW_COM_RD_REG);
 
-	/* Catch indexes in dmem? */
-	if (!is_index_valid(q, wr) || !is_index_valid(q, rd))
+	if (sh->wr == sh->rd &&
+	    !sync_fw_index(q, FW_COM_WR_REG, ctx->dmem_addr, &sh->wr))
 		return NULL;
 
-	packets = num_messages(wr, rd, q->size);
+	packets = num_messages(sh->wr, sh->rd, q->size);
+	if (level)
+		*level = packets;
 	if (!packets)
 		return NULL;
 
-	addr = (void *)(unsigned long)q->host_address + (rd * q->token_size);
+	return (void *)(unsigned long)q->host_address + (sh->rd * q->token_size);
+}
+EXPORT_SYMBOL_GPL(ipu_recv_get_token_level);
 
-	return addr;
+void *ipu_recv_get_token(struct ipu_fw_com_context *ctx, int q_nbr)
+{
+	return ipu_recv_get_token_level(ctx, q_nbr, NULL);
 }
 EXPORT_SYMBOL_GPL(ipu_recv_get_token);
 
-void ipu_recv_put_token(struct ipu_fw_com_context *ctx, int q_nbr)
+/*
+ * Consume the current token without telling the firmware yet, the
+ * next ipu_recv_get_token() returns the one after it. The slots are
+ * handed back by ipu_recv_commit_tokens() in a single index write.
+ */
+void ipu_recv_release_token(struct ipu_fw_com_context *ctx, int q_nbr)
 {
 	struct ipu_fw_sys_queue *q = &ctx->output_queue[q_nbr];
-	void __iomem *q_dmem = ctx->dmem_addr + q->wr_reg * 4;
-	unsigned int rd = inc_index(q_dmem, q, DIR_RECV);
+	struct ipu_fw_com_queue_shadow *sh = &ctx->output_shadow[q_nbr];
 
-	/* Release index */
-	writel(rd, q_dmem + FW_COM_RD_REG);
+	sh->rd = inc_index(q, sh->rd, 1);
+}
+EXPORT_SYMBOL_GPL(ipu_recv_release_token);
+
+void ipu_recv_commit_tokens(struct ipu_fw_com_context *ctx, int q_nbr)
+{
+	struct ipu_fw_sys_queue *q = &ctx->output_queue[q_nbr];
+	struct ipu_fw_com_queue_shadow *sh = &ctx->output_shadow[q_nbr];
+
+	if (sh->committed == sh->rd)
+		return;
+
+	writel(sh->rd, ctx->dmem_addr + q->wr_reg * 4 + FW_COM_RD_REG);
+	sh->committed = sh->rd;
+}
+EXPORT_SYMBOL_GPL(ipu_recv_commit_tokens);
+
+void ipu_recv_put_token(struct ipu_fw_com_context *ctx, int q_nbr)
+{
+	ipu_recv_release_token(ctx, q_nbr);
+	ipu_recv_commit_tokens(ctx, q_nbr);
 }
 EXPORT_SYMBOL_GPL(ipu_recv_put_token);
 
@@ -7,6 +7,18 @@
 struct ipu_fw_com_context;
 struct ipu_bus_device;
 
+/*
+ * Send tokens taken with ipu_send_batch_get_token() go to consecutive
+ * queue entries and are published together by ipu_send_batch_end(),
+ * with a single write index update.
+ */
+struct ipu_fw_com_send_batch {
+	int q_nbr;
+	unsigned int wr;
+	unsigned int free;
+	unsigned int count;
+};
+
 struct ipu_fw_syscom_queue_config {
 	unsigned int queue_size;	/* tokens per queue */
 	unsigned int token_size;	/* bytes per token */
@@ -41,8 +53,18 @@ int ipu_fw_com_close(struct ipu_fw_com_context *ctx);
 int ipu_fw_com_release(struct ipu_fw_com_context *ctx, unsigned int force);
 
 void *ipu_recv_get_token(struct ipu_fw_com_context *ctx, int q_nbr);
+void *ipu_recv_get_token_level(struct ipu_fw_com_context *ctx, int q_nbr,
+			       unsigned int *level);
 void ipu_recv_put_token(struct ipu_fw_com_context *ctx, int q_nbr);
+void ipu_recv_release_token(struct ipu_fw_com_context *ctx, int q_nbr);
+void ipu_recv_commit_tokens(struct ipu_fw_com_context *ctx, int q_nbr);
 void *ipu_send_get_token(struct ipu_fw_com_context *ctx, int q_nbr);
 void ipu_send_put_token(struct ipu_fw_com_context *ctx, int q_nbr);
+int ipu_send_batch_begin(struct ipu_fw_com_context *ctx, int q_nbr,
+			 struct ipu_fw_com_send_batch *batch);
+void *ipu_send_batch_get_token(struct ipu_fw_com_context *ctx,
+			       struct ipu_fw_com_send_batch *batch);
+void ipu_send_batch_end(struct ipu_fw_com_context *ctx,
+			struct ipu_fw_com_send_batch *batch);
 
 #endif
@@ -185,8 +185,10 @@ ipu_fw_isys_complex_cmd(struct ipu_isys *isys,
 
 	token = ipu_send_get_token(ctx,
 				   stream_handle + IPU_BASE_MSG_SEND_QUEUES);
-	if (!token)
+	if (!token) {
+		atomic_inc(&isys->fw_queues.send_full);
 		return -EBUSY;
+	}
 
 	token->payload = dma_mapped_buf;
 	token->buf_handle = (unsigned long)cpu_mapped_buf;
@@ -197,6 +199,52 @@ ipu_fw_isys_complex_cmd(struct ipu_isys *isys,
 	return 0;
 }
 
+int ipu_fw_isys_send_batch_begin(struct ipu_isys *isys,
+				 const unsigned int stream_handle,
+				 struct ipu_fw_com_send_batch *batch)
+{
+	return ipu_send_batch_begin(isys->fwcom,
+				    stream_handle + IPU_BASE_MSG_SEND_QUEUES,
+				    batch);
+}
+
+/* As ipu_fw_isys_complex_cmd(), sent at ipu_fw_isys_send_batch_end() */
+int ipu_fw_isys_complex_cmd_batch(struct ipu_isys *isys,
+				  struct ipu_fw_com_send_batch *batch,
+				  void *cpu_mapped_buf,
+				  dma_addr_t dma_mapped_buf, size_t size,
+				  enum ipu_fw_isys_send_type send_type)
+{
+	struct ipu_fw_send_queue_token *token;
+
+	if (send_type >= N_IPU_FW_ISYS_SEND_TYPE)
+		return -EINVAL;
+
+	dev_dbg(&isys->adev->dev, "batch send_token: %s, queue: %d\n",
+		send_msg_types[send_type], batch->q_nbr);
+
+	token = ipu_send_batch_get_token(isys->fwcom, batch);
+	if (!token) {
+		atomic_inc(&isys->fw_queues.send_full);
+		return -EBUSY;
+	}
+
+	if (cpu_mapped_buf)
+		clflush_cache_range(cpu_mapped_buf, size);
+
+	token->payload = dma_mapped_buf;
+	token->buf_handle = (unsigned long)cpu_mapped_buf;
+	token->send_type = send_type;
+
+	return 0;
+}
+
+void ipu_fw_isys_send_batch_end(struct ipu_isys *isys,
+				struct ipu_fw_com_send_batch *batch)
+{
+	ipu_send_batch_end(isys->fwcom, batch);
+}
+
 int ipu_fw_isys_simple_cmd(struct ipu_isys *isys,
 			   const unsigned int stream_handle,
 			   enum ipu_fw_isys_send_type send_type)
@@ -284,6 +332,39 @@ static int query_sp(struct ipu_bus_device *adev)
 	return val == IPU_ISYS_SPC_STATUS_READY;
 }
 
+/*
+ * Every stream can have its whole buffer queue in flight, and the single
+ * receive queue takes the responses of all of them, so size both from the
+ * most streams and the deepest buffer queue seen in earlier sessions.
+ */
+static void ipu_fw_isys_queue_sizes(struct ipu_isys *isys,
+				    unsigned int *send_size,
+				    unsigned int *recv_size)
+{
+	struct ipu_isys_fw_queue_stats *stats = &isys->fw_queues;
+	unsigned int streams = max(stats->max_streams, 1U);
+	unsigned int depth = stats->max_depth;
+
+	*send_size = clamp_t(unsigned int, depth + IPU_ISYS_SEND_QUEUE_CMDS,
+			     IPU_ISYS_SIZE_SEND_QUEUE,
+			     IPU_ISYS_MAX_SIZE_SEND_QUEUE);
+	*recv_size = clamp_t(unsigned int,
+			     streams * depth * IPU_ISYS_RESP_PER_FRAME,
+			     IPU_ISYS_SIZE_RECV_QUEUE,
+			     IPU_ISYS_MAX_SIZE_RECV_QUEUE);
+
+	stats->send_size = *send_size;
+	stats->recv_size = *recv_size;
+	atomic_set(&stats->send_full, 0);
+	stats->recv_level = 0;
+	stats->recv_high_water = 0;
+	stats->recv_full = 0;
+
+	dev_dbg(&isys->adev->dev,
+		"fw queues: send %u recv %u (streams %u depth %u)\n",
+		*send_size, *recv_size, streams, depth);
+}
+
 static int ipu6_isys_fwcom_cfg_init(struct ipu_isys *isys,
 				    struct ipu_fw_com_cfg *fwcom,
 				    unsigned int num_streams)
@@ -303,6 +384,7 @@ static int ipu6_isys_fwcom_cfg_init(struct ipu_isys *isys,
 	int num_in_message_queues;
 	unsigned int max_streams;
 	unsigned int max_send_queues, max_sram_blocks, max_devq_size;
+	unsigned int send_size, recv_size;
 
 	max_streams = IPU6_ISYS_NUM_STREAMS;
 	max_send_queues = IPU6_N_MAX_SEND_QUEUES;
@@ -317,6 +399,7 @@ static int ipu6_isys_fwcom_cfg_init(struct ipu_isys *isys,
 
 	num_in_message_queues = clamp_t(unsigned int, num_streams, 1,
 					max_streams);
+	ipu_fw_isys_queue_sizes(isys, &send_size, &recv_size);
 	isys_fw_cfg = devm_kzalloc(&isys->adev->dev, sizeof(*isys_fw_cfg),
 				   GFP_KERNEL);
 	if (!isys_fw_cfg)
@@ -385,8 +468,7 @@ static int ipu6_isys_fwcom_cfg_init(struct ipu_isys *isys,
 	for (i = 0; i < isys_fw_cfg->num_send_queues[type_msg]; i++) {
 		input_queue_cfg[base_msg_send + i].token_size =
 			sizeof(struct ipu_fw_send_queue_token);
-		input_queue_cfg[base_msg_send + i].queue_size =
-			IPU_ISYS_SIZE_SEND_QUEUE;
+		input_queue_cfg[base_msg_send + i].queue_size = send_size;
 	}
 
 	for (i = 0; i < isys_fw_cfg->num_recv_queues[type_proxy]; i++) {
@@ -398,8 +480,7 @@ static int ipu6_isys_fwcom_cfg_init(struct ipu_isys *isys,
 	for (i = 0; i < isys_fw_cfg->num_recv_queues[type_msg]; i++) {
 		output_queue_cfg[base_msg_recv + i].token_size =
 			sizeof(struct ipu_fw_resp_queue_token);
-		output_queue_cfg[base_msg_recv + i].queue_size =
-			IPU_ISYS_SIZE_RECV_QUEUE;
+		output_queue_cfg[base_msg_recv + i].queue_size = recv_size;
 	}
 
 	fwcom->dmem_addr = isys->pdata->ipdata->hw_variant.dmem_offset;
@@ -454,16 +535,35 @@ int ipu_fw_isys_init(struct ipu_isys *isys, unsigned int num_streams)
 }
 
 struct ipu_fw_isys_resp_info_abi *
-ipu_fw_isys_get_resp(void *context, unsigned int queue,
+ipu_fw_isys_get_resp(struct ipu_isys *isys, unsigned int queue,
 		     struct ipu_fw_isys_resp_info_abi *response)
 {
-	return (struct ipu_fw_isys_resp_info_abi *)
-	    ipu_recv_get_token(context, queue);
+	struct ipu_isys_fw_queue_stats *stats = &isys->fw_queues;
+	struct ipu_fw_isys_resp_info_abi *resp;
+	unsigned int level = 0;
+
+	resp = (struct ipu_fw_isys_resp_info_abi *)
+	    ipu_recv_get_token_level(isys->fwcom, queue, &level);
+
+	/* One entry always stays empty, so size - 1 pending means full */
+	if (level >= stats->recv_size - 1 && stats->recv_level < level)
+		stats->recv_full++;
+	stats->recv_level = level;
+	if (level > stats->recv_high_water)
+		stats->recv_high_water = level;
+
+	return resp;
 }
 
+/* The slot is handed back to the firmware by ipu_fw_isys_commit_resp() */
 void ipu_fw_isys_put_resp(void *context, unsigned int queue)
 {
-	ipu_recv_put_token(context, queue);
+	ipu_recv_release_token(context, queue);
+}
+
+void ipu_fw_isys_commit_resp(void *context, unsigned int queue)
+{
+	ipu_recv_commit_tokens(context, queue);
 }
 
 void ipu_fw_isys_set_params(struct ipu_fw_isys_stream_cfg_data_abi *stream_cfg)
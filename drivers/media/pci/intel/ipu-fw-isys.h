@@ -804,13 +804,24 @@ int ipu_fw_isys_complex_cmd(struct ipu_isys *isys,
 			    void *cpu_mapped_buf,
 			    dma_addr_t dma_mapped_buf,
 			    size_t size, enum ipu_fw_isys_send_type send_type);
+int ipu_fw_isys_send_batch_begin(struct ipu_isys *isys,
+				 const unsigned int stream_handle,
+				 struct ipu_fw_com_send_batch *batch);
+int ipu_fw_isys_complex_cmd_batch(struct ipu_isys *isys,
+				  struct ipu_fw_com_send_batch *batch,
+				  void *cpu_mapped_buf,
+				  dma_addr_t dma_mapped_buf, size_t size,
+				  enum ipu_fw_isys_send_type send_type);
+void ipu_fw_isys_send_batch_end(struct ipu_isys *isys,
+				struct ipu_fw_com_send_batch *batch);
 int ipu_fw_isys_send_proxy_token(struct ipu_isys *isys,
 				 unsigned int req_id,
 				 unsigned int index,
 				 unsigned int offset, u32 value);
 void ipu_fw_isys_cleanup(struct ipu_isys *isys);
 struct ipu_fw_isys_resp_info_abi *
-ipu_fw_isys_get_resp(void *context, unsigned int queue,
+ipu_fw_isys_get_resp(struct ipu_isys *isys, unsigned int queue,
 		     struct ipu_fw_isys_resp_info_abi *response);
 void ipu_fw_isys_put_resp(void *context, unsigned int queue);
+void ipu_fw_isys_commit_resp(void *context, unsigned int queue);
 #endif
@@ -291,6 +291,8 @@ struct ipu_fw_resource_definitions {
 struct ipu6_psys_hw_res_variant {
 	unsigned int queue_num;
 	unsigned int cell_num;
+	unsigned int cmd_queue_start;
+	const struct ipu_fw_resource_definitions *res_defs;
 	int (*set_proc_dev_chn)(struct ipu_fw_psys_process *ptr, u16 offset,
 				u16 value);
 	int (*set_proc_dfm_bitmap)(struct ipu_fw_psys_process *ptr,
@@ -0,0 +1,358 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Intel Corporation
+
+#include <linux/bitops.h>
+#include <linux/cpumask.h>
+#include <linux/device.h>
+#include <linux/err.h>
+#include <linux/io.h>
+#include <linux/module.h>
+#include <linux/perf_event.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/stringify.h>
+#include <linux/version.h>
+
+#include "ipu-gpc-pmu.h"
+#include "ipu-platform-regs.h"
+
+#define IPU_GPC_PMU_NUM_COUNTERS	16
+#define IPU_GPC_PMU_CONFIG_MASK		GENMASK(7, 0)
+
+/*
+ * The general purpose counters of one subsystem as a perf PMU. The
+ * counters only count, they are 32 bits wide and do not interrupt, so
+ * only counting events are supported and a counter must be read before
+ * it wraps. Events that do not fit in the counters are multiplexed by
+ * perf. The counters lose their state when the subsystem powers off:
+ * counts are saved on suspend and the counters programmed again on
+ * resume. Do not use the debugfs gpc knobs at the same time.
+ */
+struct ipu_gpc_pmu {
+	struct pmu pmu;
+	struct device *dev;
+	void __iomem *base;
+	const struct ipu_gpc_pmu_regs *regs;
+	spinlock_t lock;	/* Protects events, powered and the counters */
+	struct perf_event *events[IPU_GPC_PMU_NUM_COUNTERS];
+	bool powered;
+	int cpu;
+};
+
+#define to_ipu_gpc_pmu(p)	container_of(p, struct ipu_gpc_pmu, pmu)
+
+PMU_FORMAT_ATTR(source, "config:0-4");
+PMU_FORMAT_ATTR(route, "config:5-6");
+PMU_FORMAT_ATTR(sense, "config:7");
+
+static struct attribute *ipu_gpc_pmu_format_attrs[] = {
+	&format_attr_source.attr,
+	&format_attr_route.attr,
+	&format_attr_sense.attr,
+	NULL,
+};
+
+static const struct attribute_group ipu_gpc_pmu_format_group = {
+	.name = "format",
+	.attrs = ipu_gpc_pmu_format_attrs,
+};
+
+#define IPU_GPC_PMU_EVENT(_name, _idx)					\
+	PMU_EVENT_ATTR_STRING(_name, ipu_gpc_pmu_event_##_name,		\
+			      "source=" __stringify(_idx))
+
+IPU_GPC_PMU_EVENT(tlb_miss_lb, IPU_GPC_TRACE_TLB_MISS_MMU_LB_IDX);
+IPU_GPC_PMU_EVENT(full_write_lb, IPU_GPC_TRACE_FULL_WRITE_LB_IDX);
+IPU_GPC_PMU_EVENT(nofull_write_lb, IPU_GPC_TRACE_NOFULL_WRITE_LB_IDX);
+IPU_GPC_PMU_EVENT(full_read_lb, IPU_GPC_TRACE_FULL_READ_LB_IDX);
+IPU_GPC_PMU_EVENT(nofull_read_lb, IPU_GPC_TRACE_NOFULL_READ_LB_IDX);
+IPU_GPC_PMU_EVENT(stall_lb, IPU_GPC_TRACE_STALL_LB_IDX);
+IPU_GPC_PMU_EVENT(zlw_lb, IPU_GPC_TRACE_ZLW_LB_IDX);
+IPU_GPC_PMU_EVENT(tlb_miss_hbtx, IPU_GPC_TRACE_TLB_MISS_MMU_HBTX_IDX);
+IPU_GPC_PMU_EVENT(full_write_hbtx, IPU_GPC_TRACE_FULL_WRITE_HBTX_IDX);
+IPU_GPC_PMU_EVENT(nofull_write_hbtx, IPU_GPC_TRACE_NOFULL_WRITE_HBTX_IDX);
+IPU_GPC_PMU_EVENT(full_read_hbtx, IPU_GPC_TRACE_FULL_READ_HBTX_IDX);
+IPU_GPC_PMU_EVENT(stall_hbtx, IPU_GPC_TRACE_STALL_HBTX_IDX);
+IPU_GPC_PMU_EVENT(zlw_hbtx, IPU_GPC_TRACE_ZLW_HBTX_IDX);
+IPU_GPC_PMU_EVENT(tlb_miss_hbfrx, IPU_GPC_TRACE_TLB_MISS_MMU_HBFRX_IDX);
+IPU_GPC_PMU_EVENT(full_read_hbfrx, IPU_GPC_TRACE_FULL_READ_HBFRX_IDX);
+IPU_GPC_PMU_EVENT(nofull_read_hbfrx, IPU_GPC_TRACE_NOFULL_READ_HBFRX_IDX);
+IPU_GPC_PMU_EVENT(stall_hbfrx, IPU_GPC_TRACE_STALL_HBFRX_IDX);
+IPU_GPC_PMU_EVENT(zlw_hbfrx, IPU_GPC_TRACE_ZLW_HBFRX_IDX);
+IPU_GPC_PMU_EVENT(tlb_miss_icache, IPU_GPC_TRACE_TLB_MISS_ICACHE_IDX);
+IPU_GPC_PMU_EVENT(full_read_icache, IPU_GPC_TRACE_FULL_READ_ICACHE_IDX);
+IPU_GPC_PMU_EVENT(stall_icache, IPU_GPC_TRACE_STALL_ICACHE_IDX);
+
+static struct attribute *ipu_gpc_pmu_event_attrs[] = {
+	&ipu_gpc_pmu_event_tlb_miss_lb.attr.attr,
+	&ipu_gpc_pmu_event_full_write_lb.attr.attr,
+	&ipu_gpc_pmu_event_nofull_write_lb.attr.attr,
+	&ipu_gpc_pmu_event_full_read_lb.attr.attr,
+	&ipu_gpc_pmu_event_nofull_read_lb.attr.attr,
+	&ipu_gpc_pmu_event_stall_lb.attr.attr,
+	&ipu_gpc_pmu_event_zlw_lb.attr.attr,
+	&ipu_gpc_pmu_event_tlb_miss_hbtx.attr.attr,
+	&ipu_gpc_pmu_event_full_write_hbtx.attr.attr,
+	&ipu_gpc_pmu_event_nofull_write_hbtx.attr.attr,
+	&ipu_gpc_pmu_event_full_read_hbtx.attr.attr,
+	&ipu_gpc_pmu_event_stall_hbtx.attr.attr,
+	&ipu_gpc_pmu_event_zlw_hbtx.attr.attr,
+	&ipu_gpc_pmu_event_tlb_miss_hbfrx.attr.attr,
+	&ipu_gpc_pmu_event_full_read_hbfrx.attr.attr,
+	&ipu_gpc_pmu_event_nofull_read_hbfrx.attr.attr,
+	&ipu_gpc_pmu_event_stall_hbfrx.attr.attr,
+	&ipu_gpc_pmu_event_zlw_hbfrx.attr.attr,
+	&ipu_gpc_pmu_event_tlb_miss_icache.attr.attr,
+	&ipu_gpc_pmu_event_full_read_icache.attr.attr,
+	&ipu_gpc_pmu_event_stall_icache.attr.attr,
+	NULL,
+};
+
+static const struct attribute_group ipu_gpc_pmu_event_group = {
+	.name = "events",
+	.attrs = ipu_gpc_pmu_event_attrs,
+};
+
+static ssize_t cpumask_show(struct device *dev,
+			    struct device_attribute *attr, char *buf)
+{
+	struct ipu_gpc_pmu *gpc = to_ipu_gpc_pmu(dev_get_drvdata(dev));
+
+	return cpumap_print_to_pagebuf(true, buf, cpumask_of(gpc->cpu));
+}
+
+static DEVICE_ATTR_RO(cpumask);
+
+static struct attribute *ipu_gpc_pmu_cpumask_attrs[] = {
+	&dev_attr_cpumask.attr,
+	NULL,
+};
+
+static const struct attribute_group ipu_gpc_pmu_cpumask_group = {
+	.attrs = ipu_gpc_pmu_cpumask_attrs,
+};
+
+static const struct attribute_group *ipu_gpc_pmu_attr_groups[] = {
+	&ipu_gpc_pmu_format_group,
+	&ipu_gpc_pmu_event_group,
+	&ipu_gpc_pmu_cpumask_group,
+	NULL,
+};
+
+/* Called with the lock held */
+static void __ipu_gpc_pmu_update(struct ipu_gpc_pmu *gpc,
+				 struct perf_event *event)
+{
+	struct hw_perf_event *hwc = &event->hw;
+	u32 now, prev;
+
+	if (!gpc->powered || hwc->state & PERF_HES_STOPPED)
+		return;
+
+	now = readl(gpc->base + gpc->regs->value0 + 4 * hwc->idx);
+	prev = local64_xchg(&hwc->prev_count, now);
+	local64_add((u32)(now - prev), &event->count);
+}
+
+/* Called with the lock held and the subsystem powered */
+static void __ipu_gpc_pmu_program(struct ipu_gpc_pmu *gpc,
+				  struct perf_event *event)
+{
+	struct hw_perf_event *hwc = &event->hw;
+
+	writel(hwc->config, gpc->base + gpc->regs->cnt_sel0 + 4 * hwc->idx);
+	writel(BIT(hwc->idx), gpc->base + gpc->regs->soft_reset);
+	writel(1, gpc->base + gpc->regs->enable0 + 4 * hwc->idx);
+	writel(1, gpc->base + gpc->regs->overall_enable);
+	local64_set(&hwc->prev_count, 0);
+}
+
+static int ipu_gpc_pmu_event_init(struct perf_event *event)
+{
+	struct ipu_gpc_pmu *gpc = to_ipu_gpc_pmu(event->pmu);
+
+	if (event->attr.type != event->pmu->type)
+		return -ENOENT;
+
+	/* System wide counting only */
+	if (is_sampling_event(event) || event->attach_state & PERF_ATTACH_TASK)
+		return -EOPNOTSUPP;
+
+	if (event->cpu < 0)
+		return -EINVAL;
+
+	if (event->attr.config & ~IPU_GPC_PMU_CONFIG_MASK)
+		return -EINVAL;
+
+	event->cpu = gpc->cpu;
+	event->hw.config = event->attr.config;
+
+	return 0;
+}
+
+static void ipu_gpc_pmu_start(struct perf_event *event, int flags)
+{
+	struct ipu_gpc_pmu *gpc = to_ipu_gpc_pmu(event->pmu);
+	unsigned long irqflags;
+
+	spin_lock_irqsave(&gpc->lock, irqflags);
+	event->hw.state = 0;
+	local64_set(&event->hw.prev_count, 0);
+	if (gpc->powered)
+		__ipu_gpc_pmu_program(gpc, event);
+	spin_unlock_irqrestore(&gpc->lock, irqflags);
+}
+
+static void ipu_gpc_pmu_stop(struct perf_event *event, int flags)
+{
+	struct ipu_gpc_pmu *gpc = to_ipu_gpc_pmu(event->pmu);
+	struct hw_perf_event *hwc = &event->hw;
+	unsigned long irqflags;
+
+	spin_lock_irqsave(&gpc->lock, irqflags);
+	__ipu_gpc_pmu_update(gpc, event);
+	if (gpc->powered && !(hwc->state & PERF_HES_STOPPED))
+		writel(0, gpc->base + gpc->regs->enable0 + 4 * hwc->idx);
+	hwc->state |= PERF_HES_STOPPED | PERF_HES_UPTODATE;
+	spin_unlock_irqrestore(&gpc->lock, irqflags);
+}
+
+static int ipu_gpc_pmu_add(struct perf_event *event, int flags)
+{
+	struct ipu_gpc_pmu *gpc = to_ipu_gpc_pmu(event->pmu);
+	unsigned long irqflags;
+	int i;
+
+	spin_lock_irqsave(&gpc->lock, irqflags);
+	for (i = 0; i < IPU_GPC_PMU_NUM_COUNTERS; i++)
+		if (!gpc->events[i])
+			break;
+	if (i == IPU_GPC_PMU_NUM_COUNTERS) {
+		spin_unlock_irqrestore(&gpc->lock, irqflags);
+		return -EAGAIN;
+	}
+	gpc->events[i] = event;
+	event->hw.idx = i;
+	event->hw.state = PERF_HES_STOPPED | PERF_HES_UPTODATE;
+	spin_unlock_irqrestore(&gpc->lock, irqflags);
+
+	if (flags & PERF_EF_START)
+		ipu_gpc_pmu_start(event, PERF_EF_RELOAD);
+
+	return 0;
+}
+
+static void ipu_gpc_pmu_del(struct perf_event *event, int flags)
+{
+	struct ipu_gpc_pmu *gpc = to_ipu_gpc_pmu(event->pmu);
+	unsigned long irqflags;
+
+	ipu_gpc_pmu_stop(event, PERF_EF_UPDATE);
+
+	spin_lock_irqsave(&gpc->lock, irqflags);
+	gpc->events[event->hw.idx] = NULL;
+	spin_unlock_irqrestore(&gpc->lock, irqflags);
+}
+
+static void ipu_gpc_pmu_read(struct perf_event *event)
+{
+	struct ipu_gpc_pmu *gpc = to_ipu_gpc_pmu(event->pmu);
+	unsigned long irqflags;
+
+	spin_lock_irqsave(&gpc->lock, irqflags);
+	__ipu_gpc_pmu_update(gpc, event);
+	spin_unlock_irqrestore(&gpc->lock, irqflags);
+}
+
+/* Call once the subsystem is powered */
+void ipu_gpc_pmu_resume(struct ipu_gpc_pmu *gpc)
+{
+	unsigned long irqflags;
+	int i;
+
+	if (!gpc)
+		return;
+
+	spin_lock_irqsave(&gpc->lock, irqflags);
+	gpc->powered = true;
+	for (i = 0; i < IPU_GPC_PMU_NUM_COUNTERS; i++)
+		if (gpc->events[i] &&
+		    !(gpc->events[i]->hw.state & PERF_HES_STOPPED))
+			__ipu_gpc_pmu_program(gpc, gpc->events[i]);
+	spin_unlock_irqrestore(&gpc->lock, irqflags);
+}
+EXPORT_SYMBOL_GPL(ipu_gpc_pmu_resume);
+
+/* Call before the subsystem powers off */
+void ipu_gpc_pmu_suspend(struct ipu_gpc_pmu *gpc)
+{
+	unsigned long irqflags;
+	int i;
+
+	if (!gpc)
+		return;
+
+	spin_lock_irqsave(&gpc->lock, irqflags);
+	for (i = 0; i < IPU_GPC_PMU_NUM_COUNTERS; i++)
+		if (gpc->events[i])
+			__ipu_gpc_pmu_update(gpc, gpc->events[i]);
+	gpc->powered = false;
+	spin_unlock_irqrestore(&gpc->lock, irqflags);
+}
+EXPORT_SYMBOL_GPL(ipu_gpc_pmu_suspend);
+
+/*
+ * Register the counters at base as the perf PMU name. The subsystem is
+ * taken as powered off until ipu_gpc_pmu_resume().
+ */
+struct ipu_gpc_pmu *ipu_gpc_pmu_register(struct device *dev,
+					 void __iomem *base,
+					 const struct ipu_gpc_pmu_regs *regs,
+					 const char *name)
+{
+	struct ipu_gpc_pmu *gpc;
+	int ret;
+
+	gpc = kzalloc(sizeof(*gpc), GFP_KERNEL);
+	if (!gpc)
+		return ERR_PTR(-ENOMEM);
+
+	spin_lock_init(&gpc->lock);
+	gpc->dev = dev;
+	gpc->base = base;
+	gpc->regs = regs;
+	gpc->cpu = cpumask_first(cpu_online_mask);
+	gpc->pmu = (struct pmu) {
+		.module = THIS_MODULE,
+		.task_ctx_nr = perf_invalid_context,
+		.attr_groups = ipu_gpc_pmu_attr_groups,
+		.event_init = ipu_gpc_pmu_event_init,
+		.add = ipu_gpc_pmu_add,
+		.del = ipu_gpc_pmu_del,
+		.start = ipu_gpc_pmu_start,
+		.stop = ipu_gpc_pmu_stop,
+		.read = ipu_gpc_pmu_read,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 0, 0)
+		.capabilities = PERF_PMU_CAP_NO_EXCLUDE,
+#endif
+	};
+
+	ret = perf_pmu_register(&gpc->pmu, name, -1);
+	if (ret) {
+		kfree(gpc);
+		return ERR_PTR(ret);
+	}
+
+	return gpc;
+}
+EXPORT_SYMBOL_GPL(ipu_gpc_pmu_register);
+
+void ipu_gpc_pmu_unregister(struct ipu_gpc_pmu *gpc)
+{
+	if (!gpc)
+		return;
+
+	perf_pmu_unregister(&gpc->pmu);
+	kfree(gpc);
+}
+EXPORT_SYMBOL_GPL(ipu_gpc_pmu_unregister);
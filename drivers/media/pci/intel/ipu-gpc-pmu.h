@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2024 Intel Corporation */
+
+#ifndef IPU_GPC_PMU_H
+#define IPU_GPC_PMU_H
+
+#include <linux/kconfig.h>
+#include <linux/types.h>
+
+struct device;
+struct ipu_gpc_pmu;
+
+/* GPC register offsets from the base given to ipu_gpc_pmu_register() */
+struct ipu_gpc_pmu_regs {
+	u32 soft_reset;
+	u32 overall_enable;
+	u32 enable0;
+	u32 value0;
+	u32 cnt_sel0;
+};
+
+#if IS_ENABLED(CONFIG_PERF_EVENTS)
+struct ipu_gpc_pmu *ipu_gpc_pmu_register(struct device *dev,
+					 void __iomem *base,
+					 const struct ipu_gpc_pmu_regs *regs,
+					 const char *name);
+void ipu_gpc_pmu_unregister(struct ipu_gpc_pmu *gpc);
+void ipu_gpc_pmu_resume(struct ipu_gpc_pmu *gpc);
+void ipu_gpc_pmu_suspend(struct ipu_gpc_pmu *gpc);
+#else
+static inline struct ipu_gpc_pmu *
+ipu_gpc_pmu_register(struct device *dev, void __iomem *base,
+		     const struct ipu_gpc_pmu_regs *regs, const char *name)
+{
+	return NULL;
+}
+
+static inline void ipu_gpc_pmu_unregister(struct ipu_gpc_pmu *gpc)
+{
+}
+
+static inline void ipu_gpc_pmu_resume(struct ipu_gpc_pmu *gpc)
+{
+}
+
+static inline void ipu_gpc_pmu_suspend(struct ipu_gpc_pmu *gpc)
+{
+}
+#endif
+#endif
@@ -0,0 +1,217 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2024 Intel Corporation
+
+#include <linux/bitops.h>
+#include <linux/debugfs.h>
+#include <linux/device.h>
+#include <linux/hrtimer.h>
+#include <linux/io.h>
+#include <linux/kfifo.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/pm_runtime.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/uaccess.h>
+#include <linux/version.h>
+
+#include "ipu.h"
+#include "ipu-buttress.h"
+#include "ipu-gpc-sample.h"
+
+#define IPU_GPC_SAMPLE_RING_SIZE	1024	/* records, power of two */
+#define IPU_GPC_SAMPLE_MIN_US		100
+#define IPU_GPC_SAMPLE_READ_MAX		64	/* records per read() */
+
+/*
+ * Periodic snapshots of the general purpose counters of one subsystem,
+ * taken every sample_interval_us and, on ISYS with sample_sof set, at
+ * every start of frame. Records go to a ring read from the "samples"
+ * file. Only snapshots taken while the subsystem is powered are recorded.
+ * When the ring is full new records are dropped and counted in the lost
+ * field of the next one.
+ */
+struct ipu_gpc_sampler {
+	struct device *dev;
+	struct ipu_device *isp;
+	void __iomem *values;	/* first counter value register */
+	spinlock_t lock;	/* Protects ring and lost */
+	DECLARE_KFIFO_PTR(ring, struct ipu_gpc_sample_record);
+	u32 lost;
+	struct hrtimer timer;
+	struct mutex mutex;	/* Serialises interval changes */
+	u32 interval_us;
+	u32 mask;
+	bool sof;
+};
+
+/* Can be called from any context */
+void ipu_gpc_sample(struct ipu_gpc_sampler *s, u32 trigger, u32 sequence)
+{
+	struct ipu_gpc_sample_record r = {
+		.trigger = trigger,
+		.sequence = sequence,
+	};
+	unsigned long flags;
+	unsigned int i;
+
+	if (!s || (trigger != IPU_GPC_SAMPLE_TIMER && !READ_ONCE(s->sof)))
+		return;
+
+	if (pm_runtime_get_if_in_use(s->dev) <= 0)
+		return;
+
+	r.mask = READ_ONCE(s->mask);
+	ipu_buttress_tsc_read(s->isp, &r.tsc);
+	for (i = 0; i < IPU_GPC_SAMPLE_COUNTERS; i++)
+		if (r.mask & BIT(i))
+			r.value[i] = readl(s->values + 4 * i);
+	pm_runtime_put(s->dev);
+
+	spin_lock_irqsave(&s->lock, flags);
+	if (kfifo_is_full(&s->ring)) {
+		s->lost++;
+	} else {
+		r.lost = s->lost;
+		s->lost = 0;
+		kfifo_put(&s->ring, r);
+	}
+	spin_unlock_irqrestore(&s->lock, flags);
+}
+EXPORT_SYMBOL_GPL(ipu_gpc_sample);
+
+static enum hrtimer_restart ipu_gpc_sample_timer(struct hrtimer *timer)
+{
+	struct ipu_gpc_sampler *s =
+		container_of(timer, struct ipu_gpc_sampler, timer);
+	u32 interval_us = READ_ONCE(s->interval_us);
+
+	if (!interval_us)
+		return HRTIMER_NORESTART;
+
+	ipu_gpc_sample(s, IPU_GPC_SAMPLE_TIMER, 0);
+	hrtimer_forward_now(timer, us_to_ktime(interval_us));
+
+	return HRTIMER_RESTART;
+}
+
+static int ipu_gpc_sample_interval_get(void *data, u64 *val)
+{
+	struct ipu_gpc_sampler *s = data;
+
+	*val = READ_ONCE(s->interval_us);
+
+	return 0;
+}
+
+static int ipu_gpc_sample_interval_set(void *data, u64 val)
+{
+	struct ipu_gpc_sampler *s = data;
+
+	if (val && (val < IPU_GPC_SAMPLE_MIN_US || val > U32_MAX))
+		return -EINVAL;
+
+	mutex_lock(&s->mutex);
+	hrtimer_cancel(&s->timer);
+	WRITE_ONCE(s->interval_us, val);
+	if (val)
+		hrtimer_start(&s->timer, us_to_ktime(val), HRTIMER_MODE_REL);
+	mutex_unlock(&s->mutex);
+
+	return 0;
+}
+
+DEFINE_SIMPLE_ATTRIBUTE(ipu_gpc_sample_interval_fops,
+			ipu_gpc_sample_interval_get,
+			ipu_gpc_sample_interval_set, "%llu\n");
+
+/* Whole records queued so far, 0 when there are none */
+static ssize_t ipu_gpc_samples_read(struct file *file, char __user *buf,
+				    size_t len, loff_t *ppos)
+{
+	struct ipu_gpc_sampler *s = file->private_data;
+	struct ipu_gpc_sample_record *r;
+	unsigned int n = min_t(size_t, len / sizeof(*r),
+			       IPU_GPC_SAMPLE_READ_MAX);
+	ssize_t ret;
+
+	if (!n)
+		return -EINVAL;
+
+	r = kmalloc_array(n, sizeof(*r), GFP_KERNEL);
+	if (!r)
+		return -ENOMEM;
+
+	n = kfifo_out_spinlocked(&s->ring, r, n, &s->lock);
+	if (copy_to_user(buf, r, n * sizeof(*r)))
+		ret = -EFAULT;
+	else
+		ret = n * sizeof(*r);
+	kfree(r);
+
+	return ret;
+}
+
+static const struct file_operations ipu_gpc_samples_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = ipu_gpc_samples_read,
+	.llseek = no_llseek,
+};
+
+static void ipu_gpc_sampler_release(void *data)
+{
+	struct ipu_gpc_sampler *s = data;
+
+	hrtimer_cancel(&s->timer);
+	kfifo_free(&s->ring);
+	mutex_destroy(&s->mutex);
+}
+
+/*
+ * Add the sampler files to dir. values is the first of the
+ * IPU_GPC_SAMPLE_COUNTERS counter value registers. Freed with dev.
+ */
+struct ipu_gpc_sampler *ipu_gpc_sampler_create(struct device *dev,
+					       struct ipu_device *isp,
+					       void __iomem *values,
+					       struct dentry *dir)
+{
+	struct ipu_gpc_sampler *s;
+	int ret;
+
+	s = devm_kzalloc(dev, sizeof(*s), GFP_KERNEL);
+	if (!s)
+		return ERR_PTR(-ENOMEM);
+
+	ret = kfifo_alloc(&s->ring, IPU_GPC_SAMPLE_RING_SIZE, GFP_KERNEL);
+	if (ret)
+		return ERR_PTR(ret);
+
+	s->dev = dev;
+	s->isp = isp;
+	s->values = values;
+	s->mask = GENMASK(IPU_GPC_SAMPLE_COUNTERS - 1, 0);
+	spin_lock_init(&s->lock);
+	mutex_init(&s->mutex);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 13, 0)
+	hrtimer_init(&s->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	s->timer.function = ipu_gpc_sample_timer;
+#else
+	hrtimer_setup(&s->timer, ipu_gpc_sample_timer, CLOCK_MONOTONIC,
+		      HRTIMER_MODE_REL);
+#endif
+
+	ret = devm_add_action_or_reset(dev, ipu_gpc_sampler_release, s);
+	if (ret)
+		return ERR_PTR(ret);
+
+	debugfs_create_file("sample_interval_us", 0600, dir, s,
+			    &ipu_gpc_sample_interval_fops);
+	debugfs_create_x32("sample_mask", 0600, dir, &s->mask);
+	debugfs_create_bool("sample_sof", 0600, dir, &s->sof);
+	debugfs_create_file("samples", 0400, dir, s, &ipu_gpc_samples_fops);
+
+	return s;
+}
+EXPORT_SYMBOL_GPL(ipu_gpc_sampler_create);
@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2024 Intel Corporation */
+
+#ifndef IPU_GPC_SAMPLE_H
+#define IPU_GPC_SAMPLE_H
+
+#include <linux/types.h>
+
+struct dentry;
+struct device;
+struct ipu_device;
+struct ipu_gpc_sampler;
+
+#define IPU_GPC_SAMPLE_COUNTERS		16
+
+#define IPU_GPC_SAMPLE_TIMER		0
+/* Start of frame on CSI-2 port n: IPU_GPC_SAMPLE_SOF(n) */
+#define IPU_GPC_SAMPLE_SOF(n)		(0x100 | (n))
+
+/*
+ * One snapshot of the counters, as read from the "samples" file. Counters
+ * outside mask are not read and left zero. Values are the free running
+ * 32 bit counts, consumers take the difference between records.
+ */
+struct ipu_gpc_sample_record {
+	__u64 tsc;	/* buttress TSC at the snapshot */
+	__u32 trigger;	/* IPU_GPC_SAMPLE_TIMER or IPU_GPC_SAMPLE_SOF() */
+	__u32 sequence;	/* frame sequence of a SOF sample */
+	__u32 mask;
+	__u32 lost;	/* records dropped before this one, ring full */
+	__u32 value[IPU_GPC_SAMPLE_COUNTERS];
+};
+
+struct ipu_gpc_sampler *ipu_gpc_sampler_create(struct device *dev,
+					       struct ipu_device *isp,
+					       void __iomem *values,
+					       struct dentry *dir);
+void ipu_gpc_sample(struct ipu_gpc_sampler *s, u32 trigger, u32 sequence);
+#endif
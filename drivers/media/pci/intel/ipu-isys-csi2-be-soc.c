@@ -39,6 +39,7 @@ static const u32 csi2_be_soc_supported_codes_pad[] = {
 	MEDIA_BUS_FMT_SGRBG8_1X8,
 	MEDIA_BUS_FMT_SRGGB8_1X8,
 	MEDIA_BUS_FMT_Y8_1X8,
+	MEDIA_BUS_FMT_FIXED,
 	0,
 };
 
@@ -95,6 +96,39 @@ static const struct v4l2_ctrl_config compression_ctrl_cfg = {
 	.def = 0,
 };
 
+static const struct v4l2_ctrl_config watermark_ctrl_cfg = {
+	.ops = NULL,
+	.id = V4L2_CID_IPU_ISYS_WATERMARK,
+	.name = "ISYS BE-SOC watermark lines",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.min = 0,
+	.max = IPU_ISYS_MAX_HEIGHT,
+	.step = 1,
+	.def = 0,
+};
+
+static const struct v4l2_ctrl_config embedded_ctrl_cfg = {
+	.ops = NULL,
+	.id = V4L2_CID_IPU_ISYS_EMBEDDED_LINES,
+	.name = "ISYS BE-SOC embedded data lines",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.min = 0,
+	.max = IPU_ISYS_MAX_EMBEDDED_LINES,
+	.step = 1,
+	.def = 0,
+};
+
+static const struct v4l2_ctrl_config keep_open_ctrl_cfg = {
+	.ops = NULL,
+	.id = V4L2_CID_IPU_ISYS_KEEP_OPEN,
+	.name = "ISYS BE-SOC keep stream open ms",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.min = -1,
+	.max = IPU_ISYS_KEEP_OPEN_MAX_MS,
+	.step = 1,
+	.def = -1,
+};
+
 static int set_stream(struct v4l2_subdev *sd, int enable)
 {
 	return 0;
@@ -104,6 +138,63 @@ static const struct v4l2_subdev_video_ops csi2_be_soc_sd_video_ops = {
 	.s_stream = set_stream,
 };
 
+/*
+ * Embedded data is another data type on the virtual channel of the image,
+ * its size has nothing to do with the image format. The sensor behind the
+ * CSI-2 receiver must list it in its frame descriptor, in the size of the
+ * sink format: the line length in bytes times the lines.
+ */
+static int
+embedded_link_validate(struct v4l2_subdev *sd, struct media_link *link,
+		       struct v4l2_subdev_format *sink_fmt)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 14, 0)
+	struct ipu_isys_subdev *asd = to_ipu_isys_subdev(sd);
+	struct media_entity *csi2 = link->source->entity;
+	struct v4l2_mbus_frame_desc desc = { 0 };
+	struct media_pad *remote_pad;
+	unsigned int i;
+	int rval;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 0, 0)
+	remote_pad = media_entity_remote_pad(&csi2->pads[CSI2_PAD_SINK]);
+#else
+	remote_pad = media_pad_remote_pad_first(&csi2->pads[CSI2_PAD_SINK]);
+#endif
+	if (!remote_pad || !is_media_entity_v4l2_subdev(remote_pad->entity))
+		return -EPIPE;
+
+	rval = v4l2_subdev_call(media_entity_to_v4l2_subdev(remote_pad->entity),
+				pad, get_frame_desc, remote_pad->index, &desc);
+	if (rval || desc.type != V4L2_MBUS_FRAME_DESC_TYPE_CSI2) {
+		dev_dbg(&asd->isys->adev->dev,
+			"%s: no CSI-2 frame descriptor\n",
+			remote_pad->entity->name);
+		return -EPIPE;
+	}
+
+	for (i = 0; i < desc.num_entries; i++) {
+		if (desc.entry[i].bus.csi2.dt !=
+		    IPU_ISYS_MIPI_CSI2_TYPE_EMBEDDED8)
+			continue;
+		if (desc.entry[i].length ==
+		    sink_fmt->format.width * sink_fmt->format.height)
+			return 0;
+		dev_dbg(&asd->isys->adev->dev,
+			"embedded data of %u bytes, format %ux%u\n",
+			desc.entry[i].length, sink_fmt->format.width,
+			sink_fmt->format.height);
+		return -EPIPE;
+	}
+
+	dev_dbg(&asd->isys->adev->dev, "%s: no embedded data\n",
+		remote_pad->entity->name);
+	return -EPIPE;
+#else
+	return 0;
+#endif
+}
+
 static int
 __subdev_link_validate(struct v4l2_subdev *sd, struct media_link *link,
 		       struct v4l2_subdev_format *source_fmt,
@@ -114,6 +205,10 @@ __subdev_link_validate(struct v4l2_subdev *sd, struct media_link *link,
 						    struct ipu_isys_pipeline,
 						    pipe);
 
+	/* Not the stream crop either */
+	if (sink_fmt->format.code == MEDIA_BUS_FMT_FIXED)
+		return embedded_link_validate(sd, link, sink_fmt);
+
 	ip->csi2_be_soc = to_ipu_isys_csi2_be_soc(sd);
 	return ipu_isys_subdev_link_validate(sd, link, source_fmt, sink_fmt);
 }
@@ -366,6 +461,33 @@ int ipu_isys_csi2_be_soc_init(struct ipu_isys_csi2_be_soc *csi2_be_soc,
 		goto fail;
 	}
 	csi2_be_soc->av.compression = 0;
+
+	csi2_be_soc->av.watermark_ctrl =
+		v4l2_ctrl_new_custom(&csi2_be_soc->av.ctrl_handler,
+				     &watermark_ctrl_cfg, NULL);
+	if (!csi2_be_soc->av.watermark_ctrl) {
+		dev_err(&isys->adev->dev,
+			"failed to create BE-SOC watermark ctrl\n");
+		goto fail;
+	}
+
+	csi2_be_soc->av.embedded_ctrl =
+		v4l2_ctrl_new_custom(&csi2_be_soc->av.ctrl_handler,
+				     &embedded_ctrl_cfg, NULL);
+	if (!csi2_be_soc->av.embedded_ctrl) {
+		dev_err(&isys->adev->dev,
+			"failed to create BE-SOC embedded ctrl\n");
+		goto fail;
+	}
+
+	csi2_be_soc->av.keep_open_ctrl =
+		v4l2_ctrl_new_custom(&csi2_be_soc->av.ctrl_handler,
+				     &keep_open_ctrl_cfg, NULL);
+	if (!csi2_be_soc->av.keep_open_ctrl) {
+		dev_err(&isys->adev->dev,
+			"failed to create BE-SOC keep open ctrl\n");
+		goto fail;
+	}
 	csi2_be_soc->av.vdev.ctrl_handler =
 		&csi2_be_soc->av.ctrl_handler;
 
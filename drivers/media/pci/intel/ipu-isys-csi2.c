@@ -7,12 +7,14 @@
 
 #include <media/ipu-isys.h>
 #include <media/media-entity.h>
+#include <media/v4l2-ctrls.h>
 #include <media/v4l2-device.h>
 #include <media/v4l2-event.h>
 
 #include "ipu.h"
 #include "ipu-bus.h"
 #include "ipu-buttress.h"
+#include "ipu-gpc-sample.h"
 #include "ipu-isys.h"
 #include "ipu-isys-subdev.h"
 #include "ipu-isys-video.h"
@@ -241,6 +243,12 @@ ipu_isys_csi2_calc_timing(struct ipu_isys_csi2 *csi2,
 	if (rval)
 		return rval;
 
+	/* accinv is fixed, the timing only changes with the link frequency */
+	if (link_freq == csi2->timing_link_freq) {
+		*timing = csi2->timing;
+		return 0;
+	}
+
 	timing->ctermen = calc_timing(CSI2_CSI_RX_DLY_CNT_TERMEN_CLANE_A,
 				      CSI2_CSI_RX_DLY_CNT_TERMEN_CLANE_B,
 				      link_freq, accinv);
@@ -259,6 +267,9 @@ ipu_isys_csi2_calc_timing(struct ipu_isys_csi2 *csi2,
 	dev_dbg(&csi2->isys->adev->dev, "dtermen %u\n", timing->dtermen);
 	dev_dbg(&csi2->isys->adev->dev, "dsettle %u\n", timing->dsettle);
 
+	csi2->timing_link_freq = link_freq;
+	csi2->timing = *timing;
+
 	return 0;
 }
 
@@ -286,6 +297,11 @@ static int set_stream(struct v4l2_subdev *sd, int enable)
 	ext_sd = media_entity_to_v4l2_subdev(ip->external->entity);
 	cfg = v4l2_get_subdev_hostdata(ext_sd);
 
+	cancel_work_sync(&csi2->frame_ctrls_work);
+	spin_lock_irq(&csi2->isys->lock);
+	csi2->nr_frame_ctrls = 0;
+	spin_unlock_irq(&csi2->isys->lock);
+
 	if (!enable) {
 		ipu_isys_csi2_set_stream(sd, timing, 0, enable);
 		return 0;
@@ -311,15 +327,12 @@ static void csi2_capture_done(struct ipu_isys_pipeline *ip,
 {
 	if (ip->interlaced && ip->isys->short_packet_source ==
 	    IPU_ISYS_SHORT_PACKET_FROM_RECEIVER) {
-		struct ipu_isys_buffer *ib;
 		unsigned long flags;
 
+		/* The oldest buffer is done, it can be handed out again */
 		spin_lock_irqsave(&ip->short_packet_queue_lock, flags);
-		if (!list_empty(&ip->short_packet_active)) {
-			ib = list_last_entry(&ip->short_packet_active,
-					     struct ipu_isys_buffer, head);
-			list_move(&ib->head, &ip->short_packet_incoming);
-		}
+		if (ip->short_packet_tail != ip->short_packet_head)
+			ip->short_packet_tail++;
 		spin_unlock_irqrestore(&ip->short_packet_queue_lock, flags);
 	}
 }
@@ -477,11 +490,117 @@ static void csi2_set_ffmt(struct v4l2_subdev *sd,
 	WARN_ON(1);
 }
 
+static void frame_ctrls_set(struct ipu_isys_csi2 *csi2,
+			    struct v4l2_subdev *ext_sd,
+			    const struct ipu_isys_frame_ctrls *fc)
+{
+	struct v4l2_ctrl *ctrls[IPU_ISYS_FRAME_CTRLS_MAX];
+	s32 values[IPU_ISYS_FRAME_CTRLS_MAX];
+	unsigned int i, n = 0;
+
+	for (i = 0; i < fc->count; i++) {
+		struct v4l2_ctrl *ctrl =
+			v4l2_ctrl_find(ext_sd->ctrl_handler, fc->ctrls[i].id);
+
+		if (!ctrl || !ctrl->is_int ||
+		    ctrl->flags & V4L2_CTRL_FLAG_READ_ONLY) {
+			dev_dbg(&csi2->isys->adev->dev,
+				"frame %u: can't set control 0x%x on %s\n",
+				fc->sequence, fc->ctrls[i].id, ext_sd->name);
+			continue;
+		}
+		ctrls[n] = ctrl;
+		values[n++] = fc->ctrls[i].value;
+	}
+	if (!n)
+		return;
+
+	/* Under one handler lock the sensor sees them as one batch */
+	v4l2_ctrl_lock(ctrls[0]);
+	for (i = 0; i < n; i++)
+		if (__v4l2_ctrl_s_ctrl(ctrls[i], values[i]))
+			dev_dbg(&csi2->isys->adev->dev,
+				"frame %u: failed to set control 0x%x\n",
+				fc->sequence, ctrls[i]->id);
+	v4l2_ctrl_unlock(ctrls[0]);
+}
+
+/* Take the oldest queued entry whose frame has started */
+static bool frame_ctrls_pop(struct ipu_isys_csi2 *csi2,
+			    struct ipu_isys_frame_ctrls *fc)
+{
+	unsigned int i, due;
+	bool found;
+
+	spin_lock_irq(&csi2->isys->lock);
+	due = csi2->nr_frame_ctrls;
+	for (i = 0; i < csi2->nr_frame_ctrls; i++) {
+		u32 sequence = csi2->frame_ctrls[i].sequence;
+
+		if ((s32)(sequence - csi2->sof_frame) > 0)
+			continue;
+		if (due == csi2->nr_frame_ctrls ||
+		    (s32)(sequence - csi2->frame_ctrls[due].sequence) < 0)
+			due = i;
+	}
+	found = due < csi2->nr_frame_ctrls;
+	if (found) {
+		*fc = csi2->frame_ctrls[due];
+		csi2->frame_ctrls[due] =
+			csi2->frame_ctrls[--csi2->nr_frame_ctrls];
+	}
+	spin_unlock_irq(&csi2->isys->lock);
+
+	return found;
+}
+
+static void frame_ctrls_work(struct work_struct *work)
+{
+	struct ipu_isys_csi2 *csi2 =
+		container_of(work, struct ipu_isys_csi2, frame_ctrls_work);
+	struct media_pipeline *mp = media_entity_pipeline(&csi2->asd.sd.entity);
+	struct ipu_isys_frame_ctrls fc;
+	struct ipu_isys_pipeline *ip;
+	struct v4l2_subdev *ext_sd;
+
+	if (!mp)
+		return;
+	ip = container_of(mp, struct ipu_isys_pipeline, pipe);
+	if (!ip->external || !ip->external->entity)
+		return;
+	ext_sd = media_entity_to_v4l2_subdev(ip->external->entity);
+	if (!ext_sd || !ext_sd->ctrl_handler)
+		return;
+
+	while (frame_ctrls_pop(csi2, &fc))
+		frame_ctrls_set(csi2, ext_sd, &fc);
+}
+
+int ipu_isys_csi2_queue_frame_ctrls(struct ipu_isys_csi2 *csi2,
+				    const struct ipu_isys_frame_ctrls *fc)
+{
+	int rval = 0;
+
+	if (!fc->count || fc->count > IPU_ISYS_FRAME_CTRLS_MAX)
+		return -EINVAL;
+
+	spin_lock_irq(&csi2->isys->lock);
+	if (csi2->nr_frame_ctrls < IPU_ISYS_FRAME_CTRLS_DEPTH)
+		csi2->frame_ctrls[csi2->nr_frame_ctrls++] = *fc;
+	else
+		rval = -EBUSY;
+	spin_unlock_irq(&csi2->isys->lock);
+
+	return rval;
+}
+
 void ipu_isys_csi2_cleanup(struct ipu_isys_csi2 *csi2)
 {
 	if (!csi2->isys)
 		return;
 
+	cancel_work_sync(&csi2->frame_ctrls_work);
+
 	v4l2_device_unregister_subdev(&csi2->asd.sd);
 	ipu_isys_subdev_cleanup(&csi2->asd);
 	csi2->isys = NULL;
@@ -529,6 +648,7 @@ int ipu_isys_csi2_init(struct ipu_isys_csi2 *csi2,
 	csi2->asd.ctrl_init = csi_ctrl_init;
 	csi2->asd.isys = isys;
 	init_completion(&csi2->eof_completion);
+	INIT_WORK(&csi2->frame_ctrls_work, frame_ctrls_work);
 	rval = ipu_isys_subdev_init(&csi2->asd, &csi2_sd_ops, 0,
 				    NR_OF_CSI2_PADS,
 				    NR_OF_CSI2_SOURCE_PADS,
@@ -601,8 +721,16 @@ void ipu_isys_csi2_sof_event(struct ipu_isys_csi2 *csi2)
 	}
 
 	ev.u.frame_sync.frame_sequence = atomic_inc_return(&ip->sequence) - 1;
+	csi2->sof_frame = ev.u.frame_sync.frame_sequence;
+	if (csi2->nr_frame_ctrls)
+		queue_work(system_highpri_wq, &csi2->frame_ctrls_work);
 	spin_unlock_irqrestore(&csi2->isys->lock, flags);
 
+#ifdef IPU_ISYS_GPC
+	ipu_gpc_sample(csi2->isys->gpc_sampler,
+		       IPU_GPC_SAMPLE_SOF(csi2->index),
+		       ev.u.frame_sync.frame_sequence);
+#endif
 	v4l2_event_queue(vdev, &ev);
 	dev_dbg(&csi2->isys->adev->dev,
 		"sof_event::csi2-%i sequence: %i\n",
@@ -670,29 +798,32 @@ struct ipu_isys_buffer *
 ipu_isys_csi2_get_short_packet_buffer(struct ipu_isys_pipeline *ip,
 				      struct ipu_isys_buffer_list *bl)
 {
-	struct ipu_isys_buffer *ib;
 	struct ipu_isys_private_buffer *pb;
 	struct ipu_isys_mipi_packet_header *ph;
 	unsigned long flags;
 
 	spin_lock_irqsave(&ip->short_packet_queue_lock, flags);
-	if (list_empty(&ip->short_packet_incoming)) {
+	if (ip->short_packet_head - ip->short_packet_tail >=
+	    IPU_ISYS_SHORT_PACKET_BUFFER_NUM) {
 		spin_unlock_irqrestore(&ip->short_packet_queue_lock, flags);
 		return NULL;
 	}
-	ib = list_last_entry(&ip->short_packet_incoming,
-			     struct ipu_isys_buffer, head);
-	pb = ipu_isys_buffer_to_private_buffer(ib);
+	pb = &ip->short_packet_bufs[ip->short_packet_head++ %
+				    IPU_ISYS_SHORT_PACKET_BUFFER_NUM];
+	spin_unlock_irqrestore(&ip->short_packet_queue_lock, flags);
+
 	ph = (struct ipu_isys_mipi_packet_header *)pb->buffer;
 
 	/* Fill the packet header with magic number. */
 	ph->word_count = 0xffff;
 	ph->dtype = 0xff;
 
-	dma_sync_single_for_cpu(&ip->isys->adev->dev, pb->dma_addr,
-				sizeof(*ph), DMA_BIDIRECTIONAL);
-	spin_unlock_irqrestore(&ip->short_packet_queue_lock, flags);
-	list_move(&ib->head, &bl->head);
+	/* Coherent from 5.4 on, see short_packet_queue_setup() */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 4, 0)
+	dma_sync_single_for_device(&ip->isys->adev->dev, pb->dma_addr,
+				   sizeof(*ph), DMA_BIDIRECTIONAL);
+#endif
+	list_add(&pb->ib.head, &bl->head);
 
-	return ib;
+	return &pb->ib;
 }
@@ -4,9 +4,13 @@
 #ifndef IPU_ISYS_CSI2_H
 #define IPU_ISYS_CSI2_H
 
+#include <linux/workqueue.h>
+
 #include <media/media-entity.h>
 #include <media/v4l2-device.h>
 
+#include <uapi/linux/ipu-isys.h>
+
 #include "ipu-isys-queue.h"
 #include "ipu-isys-subdev.h"
 #include "ipu-isys-video.h"
@@ -72,6 +76,15 @@ struct ipu_isys;
 #define IPU_EOF_TIMEOUT 300
 #define IPU_EOF_TIMEOUT_JIFFIES msecs_to_jiffies(IPU_EOF_TIMEOUT)
 
+#define IPU_ISYS_FRAME_CTRLS_DEPTH	8
+
+struct ipu_isys_csi2_timing {
+	u32 ctermen;
+	u32 csettle;
+	u32 dtermen;
+	u32 dsettle;
+};
+
 /*
  * struct ipu_isys_csi2
  *
@@ -93,13 +106,16 @@ struct ipu_isys_csi2 {
 	bool wait_for_sync;
 
 	struct v4l2_ctrl *store_csi2_header;
-};
 
-struct ipu_isys_csi2_timing {
-	u32 ctermen;
-	u32 csettle;
-	u32 dtermen;
-	u32 dsettle;
+	/* RX timing of the last link frequency, see ipu_isys_csi2_calc_timing() */
+	s64 timing_link_freq;
+	struct ipu_isys_csi2_timing timing;
+
+	/* Sensor controls waiting for their frame, under isys->lock */
+	struct ipu_isys_frame_ctrls frame_ctrls[IPU_ISYS_FRAME_CTRLS_DEPTH];
+	unsigned int nr_frame_ctrls;
+	u32 sof_frame;
+	struct work_struct frame_ctrls_work;
 };
 
 /*
@@ -151,6 +167,8 @@ ipu_isys_csi2_get_short_packet_buffer(struct ipu_isys_pipeline *ip,
 void ipu_isys_csi2_sof_event(struct ipu_isys_csi2 *csi2);
 void ipu_isys_csi2_eof_event(struct ipu_isys_csi2 *csi2);
 void ipu_isys_csi2_wait_last_eof(struct ipu_isys_csi2 *csi2);
+int ipu_isys_csi2_queue_frame_ctrls(struct ipu_isys_csi2 *csi2,
+				    const struct ipu_isys_frame_ctrls *fc);
 
 /* interface for platform specific */
 int ipu_isys_csi2_set_stream(struct v4l2_subdev *sd,
@@ -159,6 +177,7 @@ int ipu_isys_csi2_set_stream(struct v4l2_subdev *sd,
 unsigned int ipu_isys_csi2_get_current_field(struct ipu_isys_pipeline *ip,
 					     unsigned int *timestamp);
 void ipu_isys_csi2_isr(struct ipu_isys_csi2 *csi2);
-void ipu_isys_csi2_error(struct ipu_isys_csi2 *csi2);
+void ipu_isys_csi2_phy_idle_off(struct ipu_isys *isys);
+bool ipu_isys_csi2_error(struct ipu_isys_csi2 *csi2);
 
 #endif /* IPU_ISYS_CSI2_H */
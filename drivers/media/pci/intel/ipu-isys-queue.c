@@ -3,10 +3,20 @@
 
 #include <linux/completion.h>
 #include <linux/device.h>
+#include <linux/dma-buf.h>
 #include <linux/module.h>
+#include <linux/scatterlist.h>
+#include <linux/sizes.h>
+#include <linux/slab.h>
 #include <linux/string.h>
 
 #include <media/media-entity.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 20, 0)
+#include <media/media-request.h>
+#include <media/v4l2-ctrls.h>
+#include <media/v4l2-event.h>
+#include <media/v4l2-subdev.h>
+#endif
 #include <media/videobuf2-dma-contig.h>
 #include <media/v4l2-ioctl.h>
 
@@ -17,10 +27,32 @@
 #include "ipu-isys-csi2.h"
 #include "ipu-isys-video.h"
 
+#define CREATE_TRACE_POINTS
+#include "ipu-isys-trace.h"
+
 static bool wall_clock_ts_on;
 module_param(wall_clock_ts_on, bool, 0660);
 MODULE_PARM_DESC(wall_clock_ts_on, "Timestamp based on REALTIME clock");
 
+static unsigned int stream_recovery;
+module_param(stream_recovery, uint, 0664);
+MODULE_PARM_DESC(stream_recovery,
+		 "In-place stream error recoveries per stream on, 0 disables");
+
+static unsigned long dmabuf_cache_max_bytes = SZ_128M;
+module_param(dmabuf_cache_max_bytes, ulong, 0664);
+MODULE_PARM_DESC(dmabuf_cache_max_bytes,
+		 "Bytes of unused imported dma-bufs kept mapped, 0 disables");
+
+static unsigned int dmabuf_cache_idle_ms = 5000;
+module_param(dmabuf_cache_idle_ms, uint, 0664);
+MODULE_PARM_DESC(dmabuf_cache_idle_ms,
+		 "Unmap imported dma-bufs unused for this many ms, 0 never");
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0)
+static void ipu_isys_queue_set_mem_ops(struct ipu_isys_queue *aq);
+#endif
+
 static int queue_setup(struct vb2_queue *q,
 #if LINUX_VERSION_CODE < KERNEL_VERSION(4, 5, 0)
 		       const struct v4l2_format *__fmt,
@@ -78,6 +110,11 @@ static int queue_setup(struct vb2_queue *q,
 			av->vdev.name, i, sizes[i]);
 	}
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0)
+	/* vb2 has set the memory of the buffers to come */
+	ipu_isys_queue_set_mem_ops(aq);
+#endif
+
 	return 0;
 }
 
@@ -125,6 +162,14 @@ int ipu_isys_buf_prepare(struct vb2_buffer *vb)
 
 	if (av->mpix.plane_fmt[0].sizeimage > vb2_plane_size(vb, 0))
 		return -EINVAL;
+	if (av->embedded_lines) {
+		if (vb->num_planes < 2 ||
+		    av->mpix.plane_fmt[1].sizeimage > vb2_plane_size(vb, 1))
+			return -EINVAL;
+		vb2_set_plane_payload(vb, 1,
+				      av->mpix.plane_fmt[1].bytesperline *
+				      av->embedded_lines);
+	}
 
 	vb2_set_plane_payload(vb, 0, av->mpix.plane_fmt[0].bytesperline *
 			      av->mpix.height);
@@ -201,13 +246,14 @@ void ipu_isys_buffer_list_queue(struct ipu_isys_buffer_list *bl,
 			    vb2_queue_to_ipu_isys_queue(vb->vb2_queue);
 
 			av = ipu_isys_queue_to_video(aq);
-			spin_lock_irqsave(&aq->lock, flags);
 			list_del(&ib->head);
-			if (op_flags & IPU_ISYS_BUFFER_LIST_FL_ACTIVE)
+			if (op_flags & IPU_ISYS_BUFFER_LIST_FL_ACTIVE) {
+				spin_lock_irqsave(&aq->lock, flags);
 				list_add(&ib->head, &aq->active);
-			else if (op_flags & IPU_ISYS_BUFFER_LIST_FL_INCOMING)
+				spin_unlock_irqrestore(&aq->lock, flags);
+			} else if (op_flags & IPU_ISYS_BUFFER_LIST_FL_INCOMING) {
 				list_add_tail(&ib->head, &aq->incoming);
-			spin_unlock_irqrestore(&aq->lock, flags);
+			}
 
 			if (op_flags & IPU_ISYS_BUFFER_LIST_FL_SET_STATE)
 				vb2_buffer_done(vb, state);
@@ -217,14 +263,21 @@ void ipu_isys_buffer_list_queue(struct ipu_isys_buffer_list *bl,
 			struct ipu_isys_pipeline *ip = pb->ip;
 
 			av = container_of(ip, struct ipu_isys_video, ip);
-			spin_lock_irqsave(&ip->short_packet_queue_lock, flags);
 			list_del(&ib->head);
-			if (op_flags & IPU_ISYS_BUFFER_LIST_FL_ACTIVE)
-				list_add(&ib->head, &ip->short_packet_active);
-			else if (op_flags & IPU_ISYS_BUFFER_LIST_FL_INCOMING)
-				list_add(&ib->head, &ip->short_packet_incoming);
-			spin_unlock_irqrestore(&ip->short_packet_queue_lock,
-					       flags);
+			/*
+			 * The buffer stays in the ring when activated. A
+			 * requeued one is the one taken last, give it back.
+			 */
+			if (op_flags & IPU_ISYS_BUFFER_LIST_FL_INCOMING) {
+				spin_lock_irqsave(&ip->short_packet_queue_lock,
+						  flags);
+				WARN_ON(pb->index !=
+					(ip->short_packet_head - 1) %
+					IPU_ISYS_SHORT_PACKET_BUFFER_NUM);
+				ip->short_packet_head--;
+				spin_unlock_irqrestore
+				    (&ip->short_packet_queue_lock, flags);
+			}
 		} else {
 			WARN_ON(1);
 			return;
@@ -296,18 +349,108 @@ static void flush_firmware_streamon_fail(struct ipu_isys_pipeline *ip)
 	}
 }
 
+/* Move the buffers buf_queue() put in the ring to the incoming list */
+static void ipu_isys_queue_pull_incoming(struct ipu_isys_queue *aq)
+{
+	struct ipu_isys_buffer *ib;
+
+	while (kfifo_get(&aq->incoming_ring, &ib))
+		list_add(&ib->head, &aq->incoming);
+}
+
 /*
  * Attempt obtaining a buffer list from the incoming queues, a list of
  * buffers that contains one entry from each video buffer queue. If
  * all queues have no buffers, the buffers that were already dequeued
  * are returned to their queues.
  */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 20, 0)
+static struct media_request *ipu_isys_buffer_req(struct ipu_isys_buffer *ib)
+{
+	return ipu_isys_buffer_to_vb2_buffer(ib)->req_obj.req;
+}
+
+/*
+ * The controls of a request are applied when its buffer list goes to the
+ * firmware, the frame captured into them is the first to see the values.
+ */
+static void ipu_isys_buffer_list_req_setup(struct ipu_isys_pipeline *ip,
+					   struct ipu_isys_buffer_list *bl)
+{
+	struct media_request *req = NULL;
+	struct v4l2_ctrl_handler *hdl;
+	struct ipu_isys_buffer *ib;
+
+	list_for_each_entry(ib, &bl->head, head) {
+		if (ib->type == IPU_ISYS_VIDEO_BUFFER) {
+			req = ipu_isys_buffer_req(ib);
+			break;
+		}
+	}
+	if (!req || !ip->external ||
+	    !is_media_entity_v4l2_subdev(ip->external->entity))
+		return;
+
+	hdl = media_entity_to_v4l2_subdev(ip->external->entity)->ctrl_handler;
+	if (!hdl)
+		return;
+
+	v4l2_ctrl_request_setup(req, hdl);
+	v4l2_ctrl_request_complete(req, hdl);
+}
+
+/*
+ * A request holds at most one buffer per queue, and when the pipeline is
+ * already known, one for each of its queues. buffer_list_get() then never
+ * mixes buffers of different requests in a frame buffer set.
+ */
+int ipu_isys_req_validate(struct media_request *req)
+{
+	struct ipu_isys_pipeline *ip = NULL;
+	struct media_request_object *obj, *prev;
+	unsigned int nbufs = 0;
+
+	list_for_each_entry(obj, &req->objects, list) {
+		struct ipu_isys_video *av;
+		struct media_pipeline *mp;
+		struct vb2_buffer *vb;
+
+		if (!vb2_request_object_is_buffer(obj))
+			continue;
+
+		vb = container_of(obj, struct vb2_buffer, req_obj);
+		list_for_each_entry(prev, &req->objects, list) {
+			if (prev == obj)
+				break;
+			if (vb2_request_object_is_buffer(prev) &&
+			    container_of(prev, struct vb2_buffer,
+					 req_obj)->vb2_queue == vb->vb2_queue)
+				return -EINVAL;
+		}
+
+		av = ipu_isys_queue_to_video(vb2_queue_to_ipu_isys_queue
+					     (vb->vb2_queue));
+		mp = media_entity_pipeline(&av->vdev.entity);
+		if (mp) {
+			if (ip && ip != to_ipu_isys_pipeline(mp))
+				return -EINVAL;
+			ip = to_ipu_isys_pipeline(mp);
+		}
+		nbufs++;
+	}
+
+	if (ip && nbufs != ip->nr_queues)
+		return -EINVAL;
+
+	return vb2_request_validate(req);
+}
+#endif
+
 static int buffer_list_get(struct ipu_isys_pipeline *ip,
 			   struct ipu_isys_buffer_list *bl)
 {
 	struct ipu_isys_queue *aq;
 	struct ipu_isys_buffer *ib;
-	unsigned long flags;
 	int ret = 0;
 
 	bl->nbufs = 0;
@@ -316,9 +459,8 @@ static int buffer_list_get(struct ipu_isys_pipeline *ip,
 	list_for_each_entry(aq, &ip->queues, node) {
 		struct ipu_isys_buffer *ib;
 
-		spin_lock_irqsave(&aq->lock, flags);
+		ipu_isys_queue_pull_incoming(aq);
 		if (list_empty(&aq->incoming)) {
-			spin_unlock_irqrestore(&aq->lock, flags);
 			ret = -ENODATA;
 			goto error;
 		}
@@ -326,10 +468,20 @@ static int buffer_list_get(struct ipu_isys_pipeline *ip,
 		ib = list_last_entry(&aq->incoming,
 				     struct ipu_isys_buffer, head);
 		if (ib->req) {
-			spin_unlock_irqrestore(&aq->lock, flags);
 			ret = -ENODATA;
 			goto error;
 		}
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 20, 0)
+		/* Wait for the rest of the request of the first queue */
+		if (bl->nbufs &&
+		    ipu_isys_buffer_req(ib) !=
+		    ipu_isys_buffer_req(list_first_entry(&bl->head,
+							 struct ipu_isys_buffer,
+							 head))) {
+			ret = -ENODATA;
+			goto error;
+		}
+#endif
 
 		dev_dbg(&ip->isys->adev->dev, "buffer: %s: buffer %u\n",
 			ipu_isys_queue_to_video(aq)->vdev.name,
@@ -339,9 +491,7 @@ static int buffer_list_get(struct ipu_isys_pipeline *ip,
 			ipu_isys_buffer_to_vb2_buffer(ib)->index
 #endif
 		    );
-		list_del(&ib->head);
-		list_add(&ib->head, &bl->head);
-		spin_unlock_irqrestore(&aq->lock, flags);
+		list_move(&ib->head, &bl->head);
 
 		bl->nbufs++;
 	}
@@ -390,13 +540,23 @@ ipu_isys_buffer_to_fw_frame_buff_pin(struct vb2_buffer *vb,
 		set->output_pins[aq->fw_output].compress = 1;
 
 	set->output_pins[aq->fw_output].addr =
-	    vb2_dma_contig_plane_dma_addr(vb, 0);
+	    ipu_isys_buffer_dma_addr(vb, 0);
 	set->output_pins[aq->fw_output].out_buf_id =
 #if LINUX_VERSION_CODE < KERNEL_VERSION(4, 4, 0)
 	    vb->v4l2_buf.index + 1;
 #else
 	    vb->index + 1;
 #endif
+	vb2_buffer_to_ipu_isys_buffer(vb)->pins_pending = 1;
+
+	if (!av->embedded_lines)
+		return;
+
+	set->output_pins[aq->fw_output_embedded].addr =
+	    ipu_isys_buffer_dma_addr(vb, 1);
+	set->output_pins[aq->fw_output_embedded].out_buf_id =
+	    set->output_pins[aq->fw_output].out_buf_id;
+	vb2_buffer_to_ipu_isys_buffer(vb)->pins_pending = 2;
 }
 
 /*
@@ -455,6 +615,74 @@ ipu_isys_buffer_to_fw_frame_buff(struct ipu_fw_isys_frame_buff_set_abi *set,
 	}
 }
 
+/*
+ * Send every complete buffer list of ip to the firmware. The frame buffer
+ * sets take consecutive send queue entries and are handed to the firmware
+ * with one write index update. Returns the number of sets sent.
+ */
+static int ipu_isys_send_buffer_lists(struct ipu_isys_pipeline *ip,
+				      struct ipu_isys_buffer_list *bl)
+{
+	struct ipu_isys_video *pipe_av =
+	    container_of(ip, struct ipu_isys_video, ip);
+	struct ipu_isys *isys = pipe_av->isys;
+	struct ipu_fw_com_send_batch batch;
+	int sent = 0;
+	int rval;
+
+	rval = ipu_fw_isys_send_batch_begin(isys, ip->stream_handle, &batch);
+	if (rval)
+		return rval;
+
+	while (!buffer_list_get(ip, bl)) {
+		struct ipu_fw_isys_frame_buff_set_abi *buf;
+		struct isys_fw_msgs *msg;
+
+		msg = ipu_get_fw_msg_buf(ip);
+		if (!msg) {
+			rval = -ENOMEM;
+			goto out_requeue;
+		}
+
+		buf = to_frame_msg_buf(msg);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 20, 0)
+		ipu_isys_buffer_list_req_setup(ip, bl);
+#endif
+		ipu_isys_buffer_to_fw_frame_buff(buf, ip, bl);
+		ipu_fw_isys_dump_frame_buff_set(&isys->adev->dev, buf,
+						ip->nr_output_pins);
+
+		rval = ipu_fw_isys_complex_cmd_batch(isys, &batch, buf,
+						     to_dma_addr(msg),
+						     sizeof(*buf),
+						     IPU_FW_ISYS_SEND_TYPE_STREAM_CAPTURE);
+		if (rval) {
+			ipu_put_fw_mgs_buf(isys, (uintptr_t)buf);
+			goto out_requeue;
+		}
+
+		/*
+		 * The buffers must be on the active queues before the
+		 * firmware sees them at the end of the batch, a buffer
+		 * event could come back before we have queued them.
+		 */
+		ipu_isys_buffer_list_queue(bl, IPU_ISYS_BUFFER_LIST_FL_ACTIVE,
+					   0);
+		sent++;
+	}
+
+	ipu_fw_isys_send_batch_end(isys, &batch);
+
+	return sent;
+
+out_requeue:
+	ipu_fw_isys_send_batch_end(isys, &batch);
+	ipu_isys_buffer_list_queue(bl, IPU_ISYS_BUFFER_LIST_FL_INCOMING, 0);
+	dev_err(&isys->adev->dev, "failed to send buffer list (%d)\n", rval);
+
+	return sent ? sent : rval;
+}
+
 /* Start streaming for real. The buffer list must be available. */
 static int ipu_isys_stream_start(struct ipu_isys_pipeline *ip,
 				 struct ipu_isys_buffer_list *bl, bool error)
@@ -466,6 +694,10 @@ static int ipu_isys_stream_start(struct ipu_isys_pipeline *ip,
 
 	mutex_lock(&pipe_av->isys->stream_mutex);
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 20, 0)
+	if (bl && bl->nbufs)
+		ipu_isys_buffer_list_req_setup(ip, bl);
+#endif
 	rval = ipu_isys_video_set_streaming(pipe_av, 1, bl);
 	if (rval) {
 		mutex_unlock(&pipe_av->isys->stream_mutex);
@@ -473,43 +705,15 @@ static int ipu_isys_stream_start(struct ipu_isys_pipeline *ip,
 	}
 
 	ip->streaming = 1;
+	ip->recoveries = 0;
+	ipu_stats_inc(&pipe_av->stats, IPU_ISYS_STAT_STREAMON);
 
 	mutex_unlock(&pipe_av->isys->stream_mutex);
 
-	bl = &__bl;
-
-	do {
-		struct ipu_fw_isys_frame_buff_set_abi *buf = NULL;
-		struct isys_fw_msgs *msg;
-		enum ipu_fw_isys_send_type send_type =
-		    IPU_FW_ISYS_SEND_TYPE_STREAM_CAPTURE;
-
-		rval = buffer_list_get(ip, bl);
-		if (rval == -EINVAL)
-			goto out_requeue;
-		else if (rval < 0)
-			break;
-
-		msg = ipu_get_fw_msg_buf(ip);
-		if (!msg)
-			return -ENOMEM;
-
-		buf = to_frame_msg_buf(msg);
-
-		ipu_isys_buffer_to_fw_frame_buff(buf, ip, bl);
-
-		ipu_fw_isys_dump_frame_buff_set(&pipe_av->isys->adev->dev, buf,
-						ip->nr_output_pins);
-
-		ipu_isys_buffer_list_queue(bl,
-					   IPU_ISYS_BUFFER_LIST_FL_ACTIVE, 0);
-
-		rval = ipu_fw_isys_complex_cmd(pipe_av->isys,
-					       ip->stream_handle,
-					       buf, to_dma_addr(msg),
-					       sizeof(*buf),
-					       send_type);
-	} while (!WARN_ON(rval));
+	/* Queue the buffers that piled up before stream on in one batch */
+	rval = ipu_isys_send_buffer_lists(ip, &__bl);
+	if (rval < 0)
+		return rval;
 
 	return 0;
 
@@ -535,13 +739,8 @@ static void buf_queue(struct vb2_buffer *vb)
 	struct media_pipeline *mp = media_entity_pipeline(&av->vdev.entity);
 	struct ipu_isys_pipeline *ip = to_ipu_isys_pipeline(mp);
 	struct ipu_isys_buffer_list bl;
-
-	struct ipu_fw_isys_frame_buff_set_abi *buf = NULL;
-	struct isys_fw_msgs *msg;
-
 	struct ipu_isys_video *pipe_av =
 	    container_of(ip, struct ipu_isys_video, ip);
-	unsigned long flags;
 	unsigned int i;
 	int rval;
 
@@ -556,11 +755,13 @@ static void buf_queue(struct vb2_buffer *vb)
 
 	for (i = 0; i < vb->num_planes; i++)
 		dev_dbg(&av->isys->adev->dev, "iova: plane %u iova 0x%x\n", i,
-			(u32)vb2_dma_contig_plane_dma_addr(vb, i));
+			(u32)ipu_isys_buffer_dma_addr(vb, i));
 
-	spin_lock_irqsave(&aq->lock, flags);
-	list_add(&ib->head, &aq->incoming);
-	spin_unlock_irqrestore(&aq->lock, flags);
+	if (WARN_ON(!kfifo_put(&aq->incoming_ring, ib))) {
+		vb2_buffer_done(vb, VB2_BUF_STATE_ERROR);
+		return;
+	}
+	ipu_stats_inc(&av->stats, IPU_ISYS_STAT_QUEUED);
 
 	if (ib->req)
 		return;
@@ -580,6 +781,22 @@ static void buf_queue(struct vb2_buffer *vb)
 		goto out;
 	}
 
+	if (ip->streaming) {
+		/*
+		 * Send this and any other complete buffer lists of the
+		 * pipeline. Only the pipeline mutex is needed here,
+		 * stream_mutex is taken just by the deferred stream start.
+		 */
+		rval = ipu_isys_send_buffer_lists(ip, &bl);
+		if (!rval)
+			dev_dbg(&av->isys->adev->dev,
+				"not enough buffers available\n");
+		else if (rval > 0)
+			dev_dbg(&av->isys->adev->dev, "queued %d buffer lists\n",
+				rval);
+		goto out;
+	}
+
 	/*
 	 * We just put one buffer to the incoming list of this queue
 	 * (above). Let's see whether all queues in the pipeline would
@@ -598,43 +815,10 @@ static void buf_queue(struct vb2_buffer *vb)
 		goto out;
 	}
 
-	msg = ipu_get_fw_msg_buf(ip);
-	if (!msg) {
-		rval = -ENOMEM;
-		goto out;
-	}
-	buf = to_frame_msg_buf(msg);
-
-	ipu_isys_buffer_to_fw_frame_buff(buf, ip, &bl);
-
-	ipu_fw_isys_dump_frame_buff_set(&pipe_av->isys->adev->dev, buf,
-					ip->nr_output_pins);
-
-	if (!ip->streaming) {
-		dev_dbg(&av->isys->adev->dev,
-			"got a buffer to start streaming!\n");
-		rval = ipu_isys_stream_start(ip, &bl, true);
-		if (rval)
-			dev_err(&av->isys->adev->dev,
-				"stream start failed.\n");
-		goto out;
-	}
-
-	/*
-	 * We must queue the buffers in the buffer list to the
-	 * appropriate video buffer queues BEFORE passing them to the
-	 * firmware since we could get a buffer event back before we
-	 * have queued them ourselves to the active queue.
-	 */
-	ipu_isys_buffer_list_queue(&bl, IPU_ISYS_BUFFER_LIST_FL_ACTIVE, 0);
-
-	rval = ipu_fw_isys_complex_cmd(pipe_av->isys,
-				       ip->stream_handle,
-				       buf, to_dma_addr(msg),
-				       sizeof(*buf),
-				       IPU_FW_ISYS_SEND_TYPE_STREAM_CAPTURE);
-	if (!WARN_ON(rval < 0))
-		dev_dbg(&av->isys->adev->dev, "queued buffer\n");
+	dev_dbg(&av->isys->adev->dev, "got a buffer to start streaming!\n");
+	rval = ipu_isys_stream_start(ip, &bl, true);
+	if (rval)
+		dev_err(&av->isys->adev->dev, "stream start failed.\n");
 
 out:
 	mutex_unlock(&pipe_av->mutex);
@@ -694,6 +878,31 @@ int ipu_isys_link_fmt_validate(struct ipu_isys_queue *aq)
 	return 0;
 }
 
+/*
+ * Tell PSYS about a completed imported capture buffer, so the commands
+ * held on it go (IPU_ISYS_FRAME_DONE) or fail (IPU_ISYS_FRAME_ABORTED).
+ */
+static void ipu_isys_queue_notify_frame(struct vb2_buffer *vb,
+					unsigned long action)
+{
+	struct ipu_isys_queue *aq = vb2_queue_to_ipu_isys_queue(vb->vb2_queue);
+	struct ipu_isys_video *av = ipu_isys_queue_to_video(aq);
+
+	if (vb->memory == VB2_MEMORY_DMABUF && vb->planes[0].dbuf)
+		atomic_notifier_call_chain(&av->isys->adev->isp->
+					   isys_frame_notifier, action,
+					   vb->planes[0].dbuf);
+}
+
+/* No PIN_DATA_READY comes for these after a stop or a flush */
+static void ipu_isys_queue_drop_stats_done(struct ipu_isys_queue *aq)
+{
+	struct ipu_isys_buffer *ib, *ib_safe;
+
+	list_for_each_entry_safe(ib, ib_safe, &aq->stats_done, stats_head)
+		list_del_init(&ib->stats_head);
+}
+
 /* Return buffers back to videobuf2. */
 static void return_buffers(struct ipu_isys_queue *aq,
 			   enum vb2_buffer_state state)
@@ -702,7 +911,12 @@ static void return_buffers(struct ipu_isys_queue *aq,
 	int reset_needed = 0;
 	unsigned long flags;
 
+	/* Off ip->queues, so the vb2 queue lock owns the incoming side */
+	ipu_isys_queue_pull_incoming(aq);
 	spin_lock_irqsave(&aq->lock, flags);
+	list_splice_tail_init(&aq->skipped, &aq->incoming);
+	ipu_isys_queue_drop_stats_done(aq);
+	spin_unlock_irqrestore(&aq->lock, flags);
 	while (!list_empty(&aq->incoming)) {
 		struct ipu_isys_buffer *ib = list_first_entry(&aq->incoming,
 							      struct
@@ -711,8 +925,9 @@ static void return_buffers(struct ipu_isys_queue *aq,
 		struct vb2_buffer *vb = ipu_isys_buffer_to_vb2_buffer(ib);
 
 		list_del(&ib->head);
-		spin_unlock_irqrestore(&aq->lock, flags);
 
+		if (state == VB2_BUF_STATE_ERROR)
+			ipu_isys_queue_notify_frame(vb, IPU_ISYS_FRAME_ABORTED);
 		vb2_buffer_done(vb, state);
 
 		dev_dbg(&av->isys->adev->dev,
@@ -724,10 +939,9 @@ static void return_buffers(struct ipu_isys_queue *aq,
 #else
 			vb->index);
 #endif
-
-		spin_lock_irqsave(&aq->lock, flags);
 	}
 
+	spin_lock_irqsave(&aq->lock, flags);
 	/*
 	 * Something went wrong (FW crash / HW hang / not all buffers
 	 * returned from isys) if there are still buffers queued in active
@@ -743,6 +957,8 @@ static void return_buffers(struct ipu_isys_queue *aq,
 		list_del(&ib->head);
 		spin_unlock_irqrestore(&aq->lock, flags);
 
+		if (state == VB2_BUF_STATE_ERROR)
+			ipu_isys_queue_notify_frame(vb, IPU_ISYS_FRAME_ABORTED);
 		vb2_buffer_done(vb, state);
 
 		dev_warn(&av->isys->adev->dev, "%s: cleaning active queue %u\n",
@@ -767,6 +983,22 @@ static void return_buffers(struct ipu_isys_queue *aq,
 	}
 }
 
+/* Frames the pipeline can have in flight, bounded by its deepest queue */
+static unsigned int ipu_isys_queue_depth(struct ipu_isys_pipeline *ip)
+{
+	struct ipu_isys_queue *aq;
+	unsigned int depth = 0;
+
+	list_for_each_entry(aq, &ip->queues, node)
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 8, 0)
+		depth = max(depth, aq->vbq.num_buffers);
+#else
+		depth = max(depth, vb2_get_num_buffers(&aq->vbq));
+#endif
+
+	return depth;
+}
+
 static int start_streaming(struct vb2_queue *q, unsigned int count)
 {
 	struct ipu_isys_queue *aq = vb2_queue_to_ipu_isys_queue(q);
@@ -774,6 +1006,8 @@ static int start_streaming(struct vb2_queue *q, unsigned int count)
 	struct ipu_isys_video *pipe_av;
 	struct ipu_isys_pipeline *ip;
 	struct ipu_isys_buffer_list __bl, *bl = NULL;
+	unsigned long flags;
+	unsigned int gen;
 	bool first;
 	int rval;
 
@@ -782,6 +1016,12 @@ static int start_streaming(struct vb2_queue *q, unsigned int count)
 		av->vdev.name, av->mpix.width, av->mpix.height,
 		av->pfmt->css_pixelformat);
 
+	spin_lock_irqsave(&av->frame_stats.lock, flags);
+	av->frame_stats.has_sequence = false;
+	av->frame_stats.frames = 0;
+	spin_unlock_irqrestore(&av->frame_stats.lock, flags);
+	av->skipped = 0;
+
 	mutex_lock(&av->isys->stream_mutex);
 
 	first = !media_entity_pipeline(&av->vdev.entity);
@@ -794,12 +1034,17 @@ static int start_streaming(struct vb2_queue *q, unsigned int count)
 
 	mutex_unlock(&av->isys->stream_mutex);
 
-	rval = aq->link_fmt_validate(aq);
-	if (rval) {
-		dev_dbg(&av->isys->adev->dev,
-			"%s: link format validation failed (%d)\n",
-			av->vdev.name, rval);
-		goto out_unprepare_streaming;
+	/* Nothing on the link changed since it was last found valid */
+	gen = ipu_isys_topology_gen(av->isys);
+	if (av->fmt_gen != gen) {
+		rval = aq->link_fmt_validate(aq);
+		if (rval) {
+			dev_dbg(&av->isys->adev->dev,
+				"%s: link format validation failed (%d)\n",
+				av->vdev.name, rval);
+			goto out_unprepare_streaming;
+		}
+		av->fmt_gen = gen;
 	}
 
 	ip = to_ipu_isys_pipeline(media_entity_pipeline(&av->vdev.entity));
@@ -814,6 +1059,10 @@ static int start_streaming(struct vb2_queue *q, unsigned int count)
 	if (ip->nr_streaming != ip->nr_queues)
 		goto out;
 
+	rval = ipu_isys_fw_msg_pool_fill(ip, ipu_isys_queue_depth(ip));
+	if (rval)
+		goto out_stream_start;
+
 	if (list_empty(&av->isys->requests)) {
 		bl = &__bl;
 		rval = buffer_list_get(ip, bl);
@@ -878,6 +1127,7 @@ static void stop_streaming(struct vb2_queue *q)
 	ip->nr_streaming--;
 	list_del(&aq->node);
 	ip->streaming = 0;
+	WRITE_ONCE(ip->recovery_pending, false);
 
 	if (pipe_av != av) {
 		mutex_unlock(&pipe_av->mutex);
@@ -994,11 +1244,156 @@ ipu_isys_buf_calc_sequence_time(struct ipu_isys_buffer *ib,
 #endif
 }
 
+static void ipu_isys_frame_lat_record(struct ipu_isys_video *av,
+				      enum ipu_isys_lat_stage stage, u64 ns)
+{
+	struct ipu_isys_frame_stats *stats = &av->frame_stats;
+	struct ipu_isys_lat_hist *hist = &stats->lat[stage];
+	u64 us = div_u64(ns, NSEC_PER_USEC);
+	unsigned long flags;
+
+	spin_lock_irqsave(&stats->lock, flags);
+	hist->buckets[min_t(unsigned int, fls64(us),
+			    IPU_ISYS_LAT_BUCKETS - 1)]++;
+	hist->count++;
+	hist->sum_ns += ns;
+	hist->max_ns = max(hist->max_ns, ns);
+	spin_unlock_irqrestore(&stats->lock, flags);
+}
+
+/* SOF and EOF responses, ts is the firmware TSC timestamp */
+void ipu_isys_frame_sof(struct ipu_isys_pipeline *ip, u32 sequence, u64 ts)
+{
+	struct ipu_isys *isys =
+	    container_of(ip, struct ipu_isys_video, ip)->isys;
+	struct ipu_device *isp = isys->adev->isp;
+	u64 ns = ipu_buttress_tsc_ticks_to_ns(ts, isp);
+	u64 interval;
+
+	if (ip->sof_count && ns > ip->sof_ns) {
+		interval = ns - ip->sof_ns;
+		if (ip->sof_count > 1)
+			ip->jitter_ns = interval > ip->sof_interval_ns ?
+			    interval - ip->sof_interval_ns :
+			    ip->sof_interval_ns - interval;
+		ip->sof_interval_ns = interval;
+	}
+	if (!ip->sof_count)
+		ipu_isys_stream_startup_mark(ip, IPU_ISYS_STARTUP_FIRST_SOF);
+	ip->sof_ns = ns;
+	ip->sof_count++;
+
+	/* The TSC time base is not the CPU's, PSYS gets ktime */
+	WRITE_ONCE(isp->isys_sof_ns, ktime_get_ns());
+	WRITE_ONCE(isp->isys_frame_ns, ip->sof_interval_ns);
+
+	trace_ipu_isys_frame_sof(ip, sequence, ns);
+}
+
+void ipu_isys_frame_eof(struct ipu_isys_pipeline *ip, u64 ts)
+{
+	struct ipu_isys *isys =
+	    container_of(ip, struct ipu_isys_video, ip)->isys;
+	u64 ns = ipu_buttress_tsc_ticks_to_ns(ts, isys->adev->isp);
+
+	ip->eof_ns = ns;
+	ip->sof_eof_ns = ip->sof_count && ns > ip->sof_ns ?
+	    ns - ip->sof_ns : 0;
+
+	trace_ipu_isys_frame_eof(ip, atomic_read(&ip->sequence) - 1, ns);
+}
+
+/*
+ * PIN_DATA_READY for a buffer of @av. The SOF and EOF figures are those of
+ * the latest frame of the pipeline, the one this buffer normally is.
+ */
+static void ipu_isys_frame_ready(struct ipu_isys_video *av,
+				 struct ipu_isys_pipeline *ip,
+				 struct ipu_isys_buffer *ib)
+{
+	struct vb2_buffer *vb = ipu_isys_buffer_to_vb2_buffer(ib);
+	struct ipu_device *isp = av->isys->adev->isp;
+	u64 tsc_now, now_ns, lat = 0;
+	u32 sequence;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 4, 0)
+	sequence = vb->v4l2_buf.sequence;
+#else
+	sequence = to_vb2_v4l2_buffer(vb)->sequence;
+#endif
+
+	ib->ready_ns = ktime_get_ns();
+
+	if (ip->sof_eof_ns)
+		ipu_isys_frame_lat_record(av, IPU_ISYS_LAT_SOF_EOF,
+					  ip->sof_eof_ns);
+	if (ip->sof_count > 2)
+		ipu_isys_frame_lat_record(av, IPU_ISYS_LAT_JITTER,
+					  ip->jitter_ns);
+
+	if (ip->eof_ns && !ipu_buttress_tsc_read(isp, &tsc_now)) {
+		now_ns = ipu_buttress_tsc_ticks_to_ns(tsc_now, isp);
+		if (now_ns > ip->eof_ns) {
+			lat = now_ns - ip->eof_ns;
+			ipu_isys_frame_lat_record(av, IPU_ISYS_LAT_EOF_READY,
+						  lat);
+		}
+	}
+
+	trace_ipu_isys_buf_ready(av, sequence, lat);
+}
+
+static void ipu_isys_frame_done(struct ipu_isys_buffer *ib)
+{
+	struct vb2_buffer *vb = ipu_isys_buffer_to_vb2_buffer(ib);
+	struct ipu_isys_queue *aq = vb2_queue_to_ipu_isys_queue(vb->vb2_queue);
+	struct ipu_isys_video *av = ipu_isys_queue_to_video(aq);
+	struct ipu_isys_frame_stats *stats = &av->frame_stats;
+	u64 now = ktime_get_ns();
+	unsigned long flags;
+	u64 lat = 0;
+	u32 sequence;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 4, 0)
+	sequence = vb->v4l2_buf.sequence;
+#else
+	sequence = to_vb2_v4l2_buffer(vb)->sequence;
+#endif
+
+	spin_lock_irqsave(&stats->lock, flags);
+	if (!stats->frames++)
+		stats->first_done_ns = now;
+	stats->last_done_ns = now;
+	if (stats->has_sequence && sequence > stats->last_sequence + 1) {
+		stats->dropped += sequence - stats->last_sequence - 1;
+		ipu_stats_add(&av->stats, IPU_ISYS_STAT_DROPPED,
+			      sequence - stats->last_sequence - 1);
+	}
+	stats->last_sequence = sequence;
+	stats->has_sequence = true;
+	spin_unlock_irqrestore(&stats->lock, flags);
+
+	if (ib->ready_ns) {
+		lat = now - ib->ready_ns;
+		ipu_isys_frame_lat_record(av, IPU_ISYS_LAT_READY_DONE, lat);
+		ib->ready_ns = 0;
+	}
+
+	trace_ipu_isys_buf_done(av, sequence, lat);
+}
+
 void ipu_isys_queue_buf_done(struct ipu_isys_buffer *ib)
 {
 	struct vb2_buffer *vb = ipu_isys_buffer_to_vb2_buffer(ib);
+	struct ipu_isys_queue *aq = vb2_queue_to_ipu_isys_queue(vb->vb2_queue);
+	struct ipu_isys_video *av = ipu_isys_queue_to_video(aq);
+	u64 start = ktime_get_ns();
+
+	ipu_isys_frame_done(ib);
 
 	if (atomic_read(&ib->str2mmio_flag)) {
+		ipu_stats_inc(&av->stats, IPU_ISYS_STAT_ERRORS);
+		ipu_isys_queue_notify_frame(vb, IPU_ISYS_FRAME_ABORTED);
 		vb2_buffer_done(vb, VB2_BUF_STATE_ERROR);
 		/*
 		 * Operation on buffer is ended with error and will be reported
@@ -1006,8 +1401,113 @@ void ipu_isys_queue_buf_done(struct ipu_isys_buffer *ib)
 		 */
 		atomic_set(&ib->str2mmio_flag, 0);
 	} else {
+		ipu_stats_inc(&av->stats, IPU_ISYS_STAT_DONE);
+		ipu_isys_queue_notify_frame(vb, IPU_ISYS_FRAME_DONE);
 		vb2_buffer_done(vb, VB2_BUF_STATE_DONE);
 	}
+	ipu_stats_add(&av->stats, IPU_ISYS_STAT_CPU_NS,
+		      ktime_get_ns() - start);
+}
+
+/*
+ * Recover from a stream error without stream off: flush the firmware
+ * stream, give the buffers it held back to the incoming queues and start
+ * the stream again on the same handle, the sensor and the PHY staying
+ * untouched. The frames in between are lost, and show as dropped.
+ */
+static void ipu_isys_stream_recovery_work(struct work_struct *work)
+{
+	struct ipu_isys_pipeline *ip =
+	    container_of(work, struct ipu_isys_pipeline, recovery_work);
+	struct ipu_isys_video *pipe_av =
+	    container_of(ip, struct ipu_isys_video, ip);
+	struct ipu_isys *isys = pipe_av->isys;
+	struct ipu_isys_buffer_list bl;
+	struct ipu_isys_queue *aq;
+	unsigned long flags;
+	u64 start, ns;
+	int rval;
+
+	mutex_lock(&pipe_av->mutex);
+	if (!ip->streaming || !READ_ONCE(ip->recovery_pending))
+		goto out;
+
+	start = ktime_get_ns();
+	ip->recoveries++;
+	ipu_stats_inc(&pipe_av->stats, IPU_ISYS_STAT_RECOVERIES);
+
+	mutex_lock(&isys->stream_mutex);
+	rval = ipu_isys_video_flush_streaming(pipe_av);
+	if (rval) {
+		mutex_unlock(&isys->stream_mutex);
+		goto out_failed;
+	}
+
+	ipu_isys_fw_msg_pool_reclaim(ip);
+	list_for_each_entry(aq, &ip->queues, node) {
+		/* The active buffers are the oldest ones, send them first */
+		ipu_isys_queue_pull_incoming(aq);
+		spin_lock_irqsave(&aq->lock, flags);
+		list_splice_tail_init(&aq->skipped, &aq->incoming);
+		list_splice_tail_init(&aq->active, &aq->incoming);
+		ipu_isys_queue_drop_stats_done(aq);
+		spin_unlock_irqrestore(&aq->lock, flags);
+	}
+
+	rval = ipu_isys_video_restart_streaming(pipe_av);
+	mutex_unlock(&isys->stream_mutex);
+	if (rval)
+		goto out_failed;
+
+	rval = ipu_isys_send_buffer_lists(ip, &bl);
+	if (rval < 0)
+		goto out_failed;
+
+	ns = ktime_get_ns() - start;
+	ip->recovery_last_ns = ns;
+	ip->recovery_max_ns = max(ip->recovery_max_ns, ns);
+	dev_info(&isys->adev->dev, "%s: stream recovered in %llu us\n",
+		 pipe_av->vdev.name, div_u64(ns, NSEC_PER_USEC));
+	goto out;
+
+out_failed:
+	ipu_stats_inc(&pipe_av->stats, IPU_ISYS_STAT_RECOVERY_FAILURES);
+	dev_err(&isys->adev->dev,
+		"%s: stream recovery failed (%d), stream off needed\n",
+		pipe_av->vdev.name, rval);
+	/* No further attempts until the next stream on */
+	ip->recoveries = UINT_MAX;
+
+out:
+	WRITE_ONCE(ip->recovery_pending, false);
+	mutex_unlock(&pipe_av->mutex);
+}
+
+/*
+ * A stream error in the response path. The recovery needs the pipeline
+ * mutex, so it is left to recovery_work. Interlaced pipelines keep the
+ * short packet ring in step with the firmware and are not recovered.
+ */
+void ipu_isys_stream_recover(struct ipu_isys_pipeline *ip)
+{
+	if (!ip->streaming || ip->interlaced ||
+	    ip->recoveries >= READ_ONCE(stream_recovery) ||
+	    READ_ONCE(ip->recovery_pending))
+		return;
+
+	WRITE_ONCE(ip->recovery_pending, true);
+	schedule_work(&ip->recovery_work);
+}
+
+/* Hand the buffers completed during a response drain to vb2 */
+void ipu_isys_queue_flush_done(struct ipu_isys_pipeline *ip)
+{
+	struct ipu_isys_buffer *ib, *ib_safe;
+
+	list_for_each_entry_safe(ib, ib_safe, &ip->done_bufs, head) {
+		list_del(&ib->head);
+		ipu_isys_queue_buf_done(ib);
+	}
 }
 
 void ipu_isys_queue_buf_ready(struct ipu_isys_pipeline *ip,
@@ -1016,6 +1516,8 @@ void ipu_isys_queue_buf_ready(struct ipu_isys_pipeline *ip,
 	struct ipu_isys *isys =
 	    container_of(ip, struct ipu_isys_video, ip)->isys;
 	struct ipu_isys_queue *aq = ip->output_pins[info->pin_id].aq;
+	struct ipu_isys_video *av = ipu_isys_queue_to_video(aq);
+	u64 start = ktime_get_ns();
 	struct ipu_isys_buffer *ib;
 	struct vb2_buffer *vb;
 	unsigned long flags;
@@ -1027,20 +1529,34 @@ void ipu_isys_queue_buf_ready(struct ipu_isys_pipeline *ip,
 #endif
 
 	dev_dbg(&isys->adev->dev, "buffer: %s: received buffer %8.8x\n",
-		ipu_isys_queue_to_video(aq)->vdev.name, info->pin.addr);
+		av->vdev.name, info->pin.addr);
 
 	spin_lock_irqsave(&aq->lock, flags);
+	/* The oldest capture of the pin, so the first match is the one */
+	if (info->type == IPU_FW_ISYS_RESP_TYPE_PIN_DATA_READY) {
+		list_for_each_entry(ib, &aq->stats_done, stats_head) {
+			vb = ipu_isys_buffer_to_vb2_buffer(ib);
+			if (info->pin.addr != ipu_isys_buffer_dma_addr(vb, 0))
+				continue;
+			/* Given to the user on STATS_DATA_READY already */
+			list_del_init(&ib->stats_head);
+			goto out_unlock;
+		}
+	}
+
 	if (list_empty(&aq->active)) {
-		spin_unlock_irqrestore(&aq->lock, flags);
 		dev_err(&isys->adev->dev, "active queue empty\n");
-		return;
+		goto out_unlock;
 	}
 
 	list_for_each_entry_reverse(ib, &aq->active, head) {
 		dma_addr_t addr;
 
 		vb = ipu_isys_buffer_to_vb2_buffer(ib);
-		addr = vb2_dma_contig_plane_dma_addr(vb, 0);
+		addr = ipu_isys_buffer_dma_addr(vb, 0);
+		if (info->pin_id == aq->fw_output_embedded &&
+		    info->pin_id != aq->fw_output && vb->num_planes > 1)
+			addr = ipu_isys_buffer_dma_addr(vb, 1);
 
 		if (info->pin.addr != addr) {
 			if (first)
@@ -1061,6 +1577,12 @@ void ipu_isys_queue_buf_ready(struct ipu_isys_pipeline *ip,
 		}
 		dev_dbg(&isys->adev->dev, "buffer: found buffer %pad\n", &addr);
 
+		/* The other pin of the capture still writes the buffer */
+		if (ib->pins_pending > 1) {
+			ib->pins_pending--;
+			goto out_unlock;
+		}
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(4, 4, 0)
 		buf = &vb->v4l2_buf;
 #else
@@ -1069,9 +1591,12 @@ void ipu_isys_queue_buf_ready(struct ipu_isys_pipeline *ip,
 		buf->field = V4L2_FIELD_NONE;
 
 		list_del(&ib->head);
+		if (info->type == IPU_FW_ISYS_RESP_TYPE_STATS_DATA_READY)
+			list_add_tail(&ib->stats_head, &aq->stats_done);
 		spin_unlock_irqrestore(&aq->lock, flags);
 
 		ipu_isys_buf_calc_sequence_time(ib, info);
+		ipu_isys_frame_ready(av, ip, ib);
 
 		/*
 		 * For interlaced buffers, the notification to user space
@@ -1084,16 +1609,162 @@ void ipu_isys_queue_buf_ready(struct ipu_isys_pipeline *ip,
 			spin_unlock_irqrestore(&ip->short_packet_queue_lock,
 					       flags);
 		} else {
-			ipu_isys_queue_buf_done(ib);
+			list_add_tail(&ib->head, &ip->done_bufs);
 		}
 
-		return;
+		goto out;
 	}
 
 	dev_err(&isys->adev->dev,
 		"WARNING: cannot find a matching video buffer!\n");
 
+out_unlock:
 	spin_unlock_irqrestore(&aq->lock, flags);
+out:
+	ipu_stats_add(&av->stats, IPU_ISYS_STAT_CPU_NS, ktime_get_ns() - start);
+}
+
+/* Sequence of the frame being received, for events on it */
+static u32 ipu_isys_queue_cur_sequence(struct ipu_isys_pipeline *ip)
+{
+	if (!ip->has_sof)
+		return atomic_read(&ip->sequence);
+
+	return ip->seq[(ip->seq_index + IPU_ISYS_MAX_PARALLEL_SOF - 1) %
+		       IPU_ISYS_MAX_PARALLEL_SOF].sequence;
+}
+
+/* Send the skipped buffers again ahead of the incoming ones */
+static void ipu_isys_queue_skip_work(struct work_struct *work)
+{
+	struct ipu_isys_pipeline *ip =
+	    container_of(work, struct ipu_isys_pipeline, skip_work);
+	struct ipu_isys_video *pipe_av =
+	    container_of(ip, struct ipu_isys_video, ip);
+	struct ipu_isys_buffer_list bl;
+	struct ipu_isys_queue *aq;
+	unsigned long flags;
+
+	mutex_lock(&pipe_av->mutex);
+	if (!ip->streaming || READ_ONCE(ip->recovery_pending))
+		goto out;
+
+	list_for_each_entry(aq, &ip->queues, node) {
+		ipu_isys_queue_pull_incoming(aq);
+		spin_lock_irqsave(&aq->lock, flags);
+		list_splice_tail_init(&aq->skipped, &aq->incoming);
+		spin_unlock_irqrestore(&aq->lock, flags);
+	}
+
+	ipu_isys_send_buffer_lists(ip, &bl);
+
+out:
+	mutex_unlock(&pipe_av->mutex);
+}
+
+/*
+ * The firmware skipped the frame on a pin, the buffer was not written.
+ * Tell the user which frame it was and reuse the buffer instead of
+ * returning it empty. A buffer of a request can't move to a later frame
+ * and completes as errored.
+ */
+void ipu_isys_queue_buf_skipped(struct ipu_isys_pipeline *ip,
+				struct ipu_fw_isys_resp_info_abi *info)
+{
+	struct ipu_isys_queue *aq = ip->output_pins[info->pin_id].aq;
+	struct ipu_isys_skip_event *skip;
+	struct ipu_isys_video *av;
+	struct ipu_isys_buffer *ib;
+	struct vb2_buffer *vb;
+	unsigned long flags;
+	bool found = false;
+	bool in_req;
+	struct v4l2_event ev = {
+		.type = V4L2_EVENT_IPU_FRAME_SKIPPED,
+	};
+
+	if (!aq)
+		return;
+
+	av = ipu_isys_queue_to_video(aq);
+	skip = (struct ipu_isys_skip_event *)ev.u.data;
+	skip->sequence = ipu_isys_queue_cur_sequence(ip);
+	skip->skipped = ++av->skipped;
+	ipu_stats_inc(&av->stats, IPU_ISYS_STAT_SKIPPED);
+	dev_dbg(&av->isys->adev->dev, "%s: skipped sequence %u, buffer %8.8x\n",
+		av->vdev.name, skip->sequence, info->pin.addr);
+	v4l2_event_queue(&av->vdev, &ev);
+
+	spin_lock_irqsave(&aq->lock, flags);
+	list_for_each_entry(ib, &aq->active, head) {
+		vb = ipu_isys_buffer_to_vb2_buffer(ib);
+		if (ipu_isys_buffer_dma_addr(vb, 0) == info->pin.addr ||
+		    (vb->num_planes > 1 &&
+		     ipu_isys_buffer_dma_addr(vb, 1) == info->pin.addr)) {
+			list_del(&ib->head);
+			found = true;
+			break;
+		}
+	}
+	if (!found) {
+		spin_unlock_irqrestore(&aq->lock, flags);
+		dev_dbg(&av->isys->adev->dev, "skipped buffer not active\n");
+		return;
+	}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 20, 0)
+	in_req = ipu_isys_buffer_req(ib);
+#else
+	in_req = ib->req;
+#endif
+	if (!in_req) {
+		list_add_tail(&ib->head, &aq->skipped);
+		spin_unlock_irqrestore(&aq->lock, flags);
+		schedule_work(&ip->skip_work);
+		return;
+	}
+	spin_unlock_irqrestore(&aq->lock, flags);
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 4, 0)
+	vb->v4l2_buf.sequence = skip->sequence;
+#else
+	to_vb2_v4l2_buffer(vb)->sequence = skip->sequence;
+#endif
+	/* Completes with VB2_BUF_STATE_ERROR, see ipu_isys_queue_buf_done() */
+	atomic_set(&ib->str2mmio_flag, 1);
+	list_add_tail(&ib->head, &ip->done_bufs);
+}
+
+/*
+ * PIN_DATA_WATERMARK: the first watermark_lines lines of the frame in
+ * flight are in memory. The response carries no line count, so report
+ * the programmed level. The frame is the one of the latest SOF, without
+ * SOF it is the one the next PIN_DATA_READY will get.
+ */
+void ipu_isys_queue_watermark_ready(struct ipu_isys_pipeline *ip,
+				    struct ipu_fw_isys_resp_info_abi *info)
+{
+	struct ipu_isys_queue *aq = ip->output_pins[info->pin_id].aq;
+	struct ipu_isys_watermark_event *wm;
+	struct ipu_isys_video *av;
+	struct v4l2_event ev = {
+		.type = V4L2_EVENT_IPU_WATERMARK,
+	};
+
+	if (!aq)
+		return;
+
+	av = ipu_isys_queue_to_video(aq);
+	if (!av->watermark_lines)
+		return;
+
+	wm = (struct ipu_isys_watermark_event *)ev.u.data;
+	wm->lines = av->watermark_lines;
+	wm->sequence = ipu_isys_queue_cur_sequence(ip);
+
+	dev_dbg(&av->isys->adev->dev, "%s: watermark, sequence %u, %u lines\n",
+		av->vdev.name, wm->sequence, wm->lines);
+	v4l2_event_queue(&av->vdev, &ev);
 }
 
 void
@@ -1111,6 +1782,378 @@ ipu_isys_queue_short_packet_ready(struct ipu_isys_pipeline *ip,
 	spin_unlock_irqrestore(&ip->short_packet_queue_lock, flags);
 }
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0)
+/* An imported dma-buf, attached and mapped for as long as it is cached */
+struct ipu_isys_dmabuf {
+	struct list_head head;
+	struct dma_buf *dbuf;
+	struct dma_buf_attachment *attach;
+	struct sg_table *sgt;
+	dma_addr_t dma_addr;
+	unsigned long contig_size;
+	/* vb2 planes attached to the dma-buf, unused when 0 */
+	unsigned int users;
+	unsigned long unused_since;	/* jiffies */
+};
+
+/* vb2 mem_priv of a dma-buf plane */
+struct ipu_isys_dmabuf_priv {
+	struct ipu_isys_dmabuf_cache *cache;
+	struct ipu_isys_dmabuf *buf;
+	unsigned long size;
+	dma_addr_t dma_addr;
+};
+
+static unsigned long ipu_isys_sgt_contig_size(struct sg_table *sgt)
+{
+	dma_addr_t expected = sg_dma_address(sgt->sgl);
+	unsigned long size = 0;
+	struct scatterlist *s;
+	unsigned int i;
+
+	for_each_sg(sgt->sgl, s, sgt->nents, i) {
+		if (sg_dma_address(s) != expected)
+			break;
+		expected += sg_dma_len(s);
+		size += sg_dma_len(s);
+	}
+
+	return size;
+}
+
+static void ipu_isys_dmabuf_release(struct ipu_isys_dmabuf *buf)
+{
+	if (buf->sgt)
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 1, 255)
+		dma_buf_unmap_attachment_unlocked(buf->attach, buf->sgt,
+						  DMA_BIDIRECTIONAL);
+#else
+		dma_buf_unmap_attachment(buf->attach, buf->sgt,
+					 DMA_BIDIRECTIONAL);
+#endif
+	dma_buf_detach(buf->dbuf, buf->attach);
+	dma_buf_put(buf->dbuf);
+	kfree(buf);
+}
+
+/* Drop unused dma-bufs, least recently used first, down to max_bytes */
+static void ipu_isys_dmabuf_cache_trim(struct ipu_isys_dmabuf_cache *cache,
+				       unsigned long max_bytes)
+{
+	struct ipu_isys_dmabuf *buf, *tmp;
+
+	list_for_each_entry_safe(buf, tmp, &cache->bufs, head) {
+		if (cache->unused_bytes <= max_bytes)
+			break;
+		if (buf->users)
+			continue;
+
+		list_del(&buf->head);
+		cache->unused_bytes -= buf->dbuf->size;
+		ipu_isys_dmabuf_release(buf);
+		atomic64_inc(&cache->stats.evictions);
+	}
+}
+
+static void *__ipu_isys_dmabuf_attach(struct device *dev,
+				      struct dma_buf *dbuf,
+				      unsigned long size)
+{
+	struct ipu_isys *isys = ipu_bus_get_drvdata(to_ipu_bus_device(dev));
+	struct ipu_isys_dmabuf_cache *cache = &isys->dmabuf_cache;
+	struct ipu_isys_dmabuf_priv *priv;
+	struct ipu_isys_dmabuf *buf;
+
+	if (dbuf->size < size)
+		return ERR_PTR(-EFAULT);
+
+	priv = kzalloc(sizeof(*priv), GFP_KERNEL);
+	if (!priv)
+		return ERR_PTR(-ENOMEM);
+
+	priv->cache = cache;
+	priv->size = size;
+
+	mutex_lock(&cache->mutex);
+	list_for_each_entry(buf, &cache->bufs, head) {
+		if (buf->dbuf != dbuf)
+			continue;
+
+		if (!buf->users)
+			cache->unused_bytes -= dbuf->size;
+		atomic64_inc(&cache->stats.hits);
+		goto out;
+	}
+
+	buf = kzalloc(sizeof(*buf), GFP_KERNEL);
+	if (!buf) {
+		mutex_unlock(&cache->mutex);
+		kfree(priv);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	buf->attach = dma_buf_attach(dbuf, dev);
+	if (IS_ERR(buf->attach)) {
+		void *err = buf->attach;
+
+		mutex_unlock(&cache->mutex);
+		kfree(buf);
+		kfree(priv);
+		return err;
+	}
+
+	get_dma_buf(dbuf);
+	buf->dbuf = dbuf;
+	list_add_tail(&buf->head, &cache->bufs);
+	atomic64_inc(&cache->stats.misses);
+
+out:
+	buf->users++;
+	priv->buf = buf;
+	mutex_unlock(&cache->mutex);
+
+	return priv;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 16, 0)
+static void *ipu_isys_dmabuf_attach(struct vb2_buffer *vb, struct device *dev,
+				    struct dma_buf *dbuf, unsigned long size)
+#else
+static void *ipu_isys_dmabuf_attach(struct device *dev, struct dma_buf *dbuf,
+				    unsigned long size,
+				    enum dma_data_direction dma_dir)
+#endif
+{
+	return __ipu_isys_dmabuf_attach(dev, dbuf, size);
+}
+
+static void ipu_isys_dmabuf_detach(void *mem_priv)
+{
+	struct ipu_isys_dmabuf_priv *priv = mem_priv;
+	struct ipu_isys_dmabuf_cache *cache = priv->cache;
+	struct ipu_isys_dmabuf *buf = priv->buf;
+	unsigned int idle_ms = READ_ONCE(dmabuf_cache_idle_ms);
+
+	mutex_lock(&cache->mutex);
+	if (!--buf->users) {
+		list_move_tail(&buf->head, &cache->bufs);
+		buf->unused_since = jiffies;
+		cache->unused_bytes += buf->dbuf->size;
+		ipu_isys_dmabuf_cache_trim(cache,
+					   READ_ONCE(dmabuf_cache_max_bytes));
+		if (cache->unused_bytes && idle_ms)
+			schedule_delayed_work(&cache->idle_work,
+					      msecs_to_jiffies(idle_ms));
+	}
+	mutex_unlock(&cache->mutex);
+
+	kfree(priv);
+}
+
+static int ipu_isys_dmabuf_map(void *mem_priv)
+{
+	struct ipu_isys_dmabuf_priv *priv = mem_priv;
+	struct ipu_isys_dmabuf_cache *cache = priv->cache;
+	struct ipu_isys_dmabuf *buf = priv->buf;
+	struct sg_table *sgt;
+	int ret = 0;
+
+	mutex_lock(&cache->mutex);
+	if (!buf->sgt) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 1, 255)
+		sgt = dma_buf_map_attachment_unlocked(buf->attach,
+						      DMA_BIDIRECTIONAL);
+#else
+		sgt = dma_buf_map_attachment(buf->attach, DMA_BIDIRECTIONAL);
+#endif
+		if (IS_ERR_OR_NULL(sgt)) {
+			ret = -EINVAL;
+			goto out;
+		}
+
+		buf->sgt = sgt;
+		buf->dma_addr = sg_dma_address(sgt->sgl);
+		buf->contig_size = ipu_isys_sgt_contig_size(sgt);
+	}
+
+	if (buf->contig_size < priv->size) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	priv->dma_addr = buf->dma_addr;
+out:
+	mutex_unlock(&cache->mutex);
+
+	return ret;
+}
+
+/* The mapping stays with the cached dma-buf until it is evicted */
+static void ipu_isys_dmabuf_unmap(void *mem_priv)
+{
+	struct ipu_isys_dmabuf_priv *priv = mem_priv;
+
+	priv->dma_addr = 0;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 16, 0)
+static void *ipu_isys_dmabuf_vaddr(struct vb2_buffer *vb, void *buf_priv)
+{
+	if (vb->memory == VB2_MEMORY_DMABUF)
+		return NULL;
+
+	return vb2_dma_contig_memops.vaddr(vb, buf_priv);
+}
+
+static void *ipu_isys_dmabuf_cookie(struct vb2_buffer *vb, void *buf_priv)
+{
+	struct ipu_isys_dmabuf_priv *priv = buf_priv;
+
+	if (vb->memory == VB2_MEMORY_DMABUF)
+		return &priv->dma_addr;
+
+	return vb2_dma_contig_memops.cookie(vb, buf_priv);
+}
+#else
+/* Only set for a DMABUF queue, see ipu_isys_queue_set_mem_ops() */
+static void *ipu_isys_dmabuf_vaddr(void *buf_priv)
+{
+	return NULL;
+}
+
+static void *ipu_isys_dmabuf_cookie(void *buf_priv)
+{
+	struct ipu_isys_dmabuf_priv *priv = buf_priv;
+
+	return &priv->dma_addr;
+}
+#endif
+
+/*
+ * The mem_priv of an imported plane is an ipu_isys_dmabuf_priv, which the
+ * vb2_dma_contig ops taking only the mem_priv can't tell apart from their
+ * own. vb2 sets the queue memory before queue_setup() and keeps it while
+ * there are buffers, so pick those ops for it there. The exporter keeps an
+ * imported dma-buf coherent, its planes need no cache sync at all.
+ */
+static void ipu_isys_queue_set_mem_ops(struct ipu_isys_queue *aq)
+{
+	bool dmabuf = aq->vbq.memory == VB2_MEMORY_DMABUF;
+
+	aq->mem_ops.prepare = dmabuf ? NULL : vb2_dma_contig_memops.prepare;
+	aq->mem_ops.finish = dmabuf ? NULL : vb2_dma_contig_memops.finish;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 16, 0)
+	aq->mem_ops.vaddr = dmabuf ? ipu_isys_dmabuf_vaddr :
+		vb2_dma_contig_memops.vaddr;
+	aq->mem_ops.cookie = dmabuf ? ipu_isys_dmabuf_cookie :
+		vb2_dma_contig_memops.cookie;
+#endif
+}
+
+/* Unmap the dma-bufs unused for dmabuf_cache_idle_ms */
+static void ipu_isys_dmabuf_cache_idle_work(struct work_struct *work)
+{
+	struct ipu_isys_dmabuf_cache *cache =
+		container_of(to_delayed_work(work),
+			     struct ipu_isys_dmabuf_cache, idle_work);
+	unsigned long idle = msecs_to_jiffies(READ_ONCE(dmabuf_cache_idle_ms));
+	struct ipu_isys_dmabuf *buf, *tmp;
+
+	if (!idle)
+		return;
+
+	mutex_lock(&cache->mutex);
+	list_for_each_entry_safe(buf, tmp, &cache->bufs, head) {
+		if (buf->users ||
+		    time_before(jiffies, buf->unused_since + idle))
+			continue;
+
+		list_del(&buf->head);
+		cache->unused_bytes -= buf->dbuf->size;
+		ipu_isys_dmabuf_release(buf);
+		atomic64_inc(&cache->stats.evictions);
+	}
+	if (cache->unused_bytes)
+		schedule_delayed_work(&cache->idle_work, idle);
+	mutex_unlock(&cache->mutex);
+}
+#endif
+
+/* DMA address of a plane, whatever memory the buffer is of */
+dma_addr_t ipu_isys_buffer_dma_addr(struct vb2_buffer *vb, unsigned int plane)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0)
+	if (vb->memory == VB2_MEMORY_DMABUF) {
+		struct ipu_isys_dmabuf_priv *priv = vb->planes[plane].mem_priv;
+
+		return priv->dma_addr;
+	}
+#endif
+
+	return vb2_dma_contig_plane_dma_addr(vb, plane);
+}
+
+void ipu_isys_dmabuf_cache_init(struct ipu_isys_dmabuf_cache *cache)
+{
+	mutex_init(&cache->mutex);
+	INIT_LIST_HEAD(&cache->bufs);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0)
+	cache->mem_ops = vb2_dma_contig_memops;
+	cache->mem_ops.attach_dmabuf = ipu_isys_dmabuf_attach;
+	cache->mem_ops.detach_dmabuf = ipu_isys_dmabuf_detach;
+	cache->mem_ops.map_dmabuf = ipu_isys_dmabuf_map;
+	cache->mem_ops.unmap_dmabuf = ipu_isys_dmabuf_unmap;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 16, 0)
+	cache->mem_ops.vaddr = ipu_isys_dmabuf_vaddr;
+	cache->mem_ops.cookie = ipu_isys_dmabuf_cookie;
+#endif
+	INIT_DELAYED_WORK(&cache->idle_work, ipu_isys_dmabuf_cache_idle_work);
+#endif
+}
+
+/* All queues are gone, so are the users of the cached dma-bufs */
+void ipu_isys_dmabuf_cache_cleanup(struct ipu_isys_dmabuf_cache *cache)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0)
+	cancel_delayed_work_sync(&cache->idle_work);
+	mutex_lock(&cache->mutex);
+	ipu_isys_dmabuf_cache_trim(cache, 0);
+	WARN_ON(!list_empty(&cache->bufs));
+	mutex_unlock(&cache->mutex);
+#endif
+	mutex_destroy(&cache->mutex);
+}
+
+int ipu_isys_dmabuf_cache_print(struct ipu_isys_dmabuf_cache *cache,
+				char *buf, size_t size)
+{
+	unsigned int num = 0, used = 0;
+	unsigned long unused_bytes;
+	struct list_head *pos;
+	int n;
+
+	mutex_lock(&cache->mutex);
+	list_for_each(pos, &cache->bufs) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0)
+		if (list_entry(pos, struct ipu_isys_dmabuf, head)->users)
+			used++;
+#endif
+		num++;
+	}
+	unused_bytes = cache->unused_bytes;
+	mutex_unlock(&cache->mutex);
+
+	n = scnprintf(buf, size, "limit %lu\n",
+		      READ_ONCE(dmabuf_cache_max_bytes));
+	n += ipu_buf_cache_stats_print(&cache->stats, buf + n, size - n);
+	n += scnprintf(buf + n, size - n,
+		       "cached %u used %u unused_bytes %lu\n",
+		       num, used, unused_bytes);
+
+	return n;
+}
+
 struct vb2_ops ipu_isys_queue_ops = {
 	.queue_setup = queue_setup,
 	.wait_prepare = ipu_isys_queue_unlock,
@@ -1133,9 +2176,20 @@ int ipu_isys_queue_init(struct ipu_isys_queue *aq)
 		aq->vbq.io_modes = VB2_USERPTR | VB2_MMAP | VB2_DMABUF;
 	aq->vbq.drv_priv = aq;
 	aq->vbq.ops = &ipu_isys_queue_ops;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0)
+	aq->mem_ops = isys->dmabuf_cache.mem_ops;
+	ipu_isys_queue_set_mem_ops(aq);
+	aq->vbq.mem_ops = &aq->mem_ops;
+#else
 	aq->vbq.mem_ops = &vb2_dma_contig_memops;
+#endif
 	aq->vbq.timestamp_flags = (wall_clock_ts_on) ?
 	    V4L2_BUF_FLAG_TIMESTAMP_UNKNOWN : V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 20, 0)
+	/* vb2_request_queue() takes the queue lock itself */
+	aq->vbq.lock = &ipu_isys_queue_to_video(aq)->mutex;
+	aq->vbq.supports_requests = true;
+#endif
 
 	rval = vb2_queue_init(&aq->vbq);
 	if (rval)
@@ -1153,13 +2207,23 @@ int ipu_isys_queue_init(struct ipu_isys_queue *aq)
 #endif
 	spin_lock_init(&aq->lock);
 	INIT_LIST_HEAD(&aq->active);
+	INIT_KFIFO(aq->incoming_ring);
 	INIT_LIST_HEAD(&aq->incoming);
+	INIT_LIST_HEAD(&aq->skipped);
+	INIT_LIST_HEAD(&aq->stats_done);
+	INIT_WORK(&ipu_isys_queue_to_video(aq)->ip.recovery_work,
+		  ipu_isys_stream_recovery_work);
+	INIT_WORK(&ipu_isys_queue_to_video(aq)->ip.skip_work,
+		  ipu_isys_queue_skip_work);
 
 	return 0;
 }
 
 void ipu_isys_queue_cleanup(struct ipu_isys_queue *aq)
 {
+	cancel_work_sync(&ipu_isys_queue_to_video(aq)->ip.recovery_work);
+	cancel_work_sync(&ipu_isys_queue_to_video(aq)->ip.skip_work);
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(4, 8, 0)
 	if (IS_ERR_OR_NULL(aq->ctx))
 		return;
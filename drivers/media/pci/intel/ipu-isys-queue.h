@@ -4,8 +4,12 @@
 #ifndef IPU_ISYS_QUEUE_H
 #define IPU_ISYS_QUEUE_H
 
+#include <linux/kfifo.h>
 #include <linux/list.h>
+#include <linux/mutex.h>
 #include <linux/spinlock.h>
+#include <linux/videodev2.h>
+#include <linux/workqueue.h>
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(4, 4, 0)
 #include <media/videobuf2-core.h>
@@ -14,12 +18,36 @@
 #endif
 
 #include "ipu-isys-media.h"
+#include "ipu-stats.h"
 
 struct ipu_isys_video;
+struct media_request;
 struct ipu_isys_pipeline;
 struct ipu_fw_isys_resp_info_abi;
 struct ipu_fw_isys_frame_buff_set_abi;
 
+/* Room for every buffer vb2 lets a queue have, a power of two */
+#define IPU_ISYS_QUEUE_RING_SIZE	(2 * VIDEO_MAX_FRAME)
+
+/*
+ * dma-bufs imported by the ISYS queues stay attached and mapped after vb2
+ * drops them, so that queueing an fd seen before, in any buffer slot, skips
+ * the attach, the IPU MMU mapping and its TLB invalidation. The unused ones
+ * are dropped least recently used first beyond dmabuf_cache_max_bytes, and
+ * by idle_work once unused for dmabuf_cache_idle_ms.
+ */
+struct ipu_isys_dmabuf_cache {
+	struct mutex mutex;	/* Protects bufs and unused_bytes */
+	struct list_head bufs;	/* struct ipu_isys_dmabuf.head, LRU order */
+	unsigned long unused_bytes;
+	struct ipu_buf_cache_stats stats;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0)
+	/* vb2_dma_contig_memops importing dma-bufs through the cache */
+	struct vb2_mem_ops mem_ops;
+	struct delayed_work idle_work;
+#endif
+};
+
 enum ipu_isys_buffer_type {
 	IPU_ISYS_VIDEO_BUFFER,
 	IPU_ISYS_SHORT_PACKET_BUFFER,
@@ -32,15 +60,33 @@ struct ipu_isys_queue {
 	struct vb2_alloc_ctx *ctx;
 #else
 	struct device *dev;
+	/* The cache mem_ops, set up for vbq.memory by queue_setup() */
+	struct vb2_mem_ops mem_ops;
 #endif
 	/*
-	 * @lock: serialise access to queued and pre_streamon_queued
+	 * @lock: serialise access to active, shared with the ISR
 	 */
 	spinlock_t lock;
 	struct list_head active;
+	/*
+	 * buf_queue() is the single producer of @incoming_ring. Its only
+	 * consumer moves the buffers to @incoming, which needs no lock: it
+	 * belongs to the pipeline mutex holder while the queue is on
+	 * ip->queues and to the vb2 queue lock holder otherwise.
+	 */
+	DECLARE_KFIFO(incoming_ring, struct ipu_isys_buffer *,
+		      IPU_ISYS_QUEUE_RING_SIZE);
 	struct list_head incoming;
+	/* Skipped by the firmware, to be sent again. Under @lock. */
+	struct list_head skipped;
+	/*
+	 * Given to the user on STATS_DATA_READY, their PIN_DATA_READY is
+	 * still to come. Under @lock.
+	 */
+	struct list_head stats_done;
 	u32 css_pin_type;
 	unsigned int fw_output;
+	unsigned int fw_output_embedded;	/* With embedded_lines only */
 	int (*buf_init)(struct vb2_buffer *vb);
 	void (*buf_cleanup)(struct vb2_buffer *vb);
 	int (*buf_prepare)(struct vb2_buffer *vb);
@@ -57,6 +103,9 @@ struct ipu_isys_buffer {
 	struct list_head req_head;
 	struct media_device_request *req;
 	atomic_t str2mmio_flag;
+	u64 ready_ns;	/* PIN_DATA_READY handled, for frame_stats */
+	unsigned int pins_pending;	/* Output pins not yet ready */
+	struct list_head stats_head;	/* ipu_isys_queue.stats_done */
 };
 
 struct ipu_isys_video_buffer {
@@ -145,17 +194,35 @@ ipu_isys_buffer_to_fw_frame_buff(struct ipu_fw_isys_frame_buff_set_abi *set,
 				 struct ipu_isys_pipeline *ip,
 				 struct ipu_isys_buffer_list *bl);
 int ipu_isys_link_fmt_validate(struct ipu_isys_queue *aq);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 20, 0)
+int ipu_isys_req_validate(struct media_request *req);
+#endif
 
 void
 ipu_isys_buf_calc_sequence_time(struct ipu_isys_buffer *ib,
 				struct ipu_fw_isys_resp_info_abi *info);
 void ipu_isys_queue_buf_done(struct ipu_isys_buffer *ib);
+void ipu_isys_queue_flush_done(struct ipu_isys_pipeline *ip);
+void ipu_isys_stream_recover(struct ipu_isys_pipeline *ip);
+void ipu_isys_frame_sof(struct ipu_isys_pipeline *ip, u32 sequence, u64 ts);
+void ipu_isys_frame_eof(struct ipu_isys_pipeline *ip, u64 ts);
+void ipu_isys_queue_buf_skipped(struct ipu_isys_pipeline *ip,
+				struct ipu_fw_isys_resp_info_abi *info);
 void ipu_isys_queue_buf_ready(struct ipu_isys_pipeline *ip,
 			      struct ipu_fw_isys_resp_info_abi *info);
+void ipu_isys_queue_watermark_ready(struct ipu_isys_pipeline *ip,
+				    struct ipu_fw_isys_resp_info_abi *info);
 void
 ipu_isys_queue_short_packet_ready(struct ipu_isys_pipeline *ip,
 				  struct ipu_fw_isys_resp_info_abi *inf);
 
+dma_addr_t ipu_isys_buffer_dma_addr(struct vb2_buffer *vb,
+				    unsigned int plane);
+void ipu_isys_dmabuf_cache_init(struct ipu_isys_dmabuf_cache *cache);
+void ipu_isys_dmabuf_cache_cleanup(struct ipu_isys_dmabuf_cache *cache);
+int ipu_isys_dmabuf_cache_print(struct ipu_isys_dmabuf_cache *cache,
+				char *buf, size_t size);
+
 int ipu_isys_queue_init(struct ipu_isys_queue *aq);
 void ipu_isys_queue_cleanup(struct ipu_isys_queue *aq);
 
@@ -37,6 +37,7 @@ unsigned int ipu_isys_mbus_code_to_bpp(u32 code)
 	case MEDIA_BUS_FMT_SGRBG10_1X10:
 	case MEDIA_BUS_FMT_SRGGB10_1X10:
 		return 10;
+	case MEDIA_BUS_FMT_FIXED:
 	case MEDIA_BUS_FMT_Y8_1X8:
 	case MEDIA_BUS_FMT_SBGGR8_1X8:
 	case MEDIA_BUS_FMT_SGBRG8_1X8:
@@ -90,6 +91,8 @@ unsigned int ipu_isys_mbus_code_to_mipi(u32 code)
 	case MEDIA_BUS_FMT_SGRBG10_DPCM8_1X8:
 	case MEDIA_BUS_FMT_SRGGB10_DPCM8_1X8:
 		return IPU_ISYS_MIPI_CSI2_TYPE_USER_DEF(1);
+	case MEDIA_BUS_FMT_FIXED:
+		return IPU_ISYS_MIPI_CSI2_TYPE_EMBEDDED8;
 	default:
 		WARN_ON(1);
 		return -EINVAL;
@@ -486,6 +489,10 @@ int __ipu_isys_subdev_set_ffmt(struct v4l2_subdev *sd,
 
 	WARN_ON(!mutex_is_locked(&asd->mutex));
 
+	/* Here so that the subdevs calling this directly are covered too */
+	if (fmt->which == V4L2_SUBDEV_FORMAT_ACTIVE)
+		ipu_isys_topology_changed(asd->isys);
+
 	fmt->format.width = clamp(fmt->format.width, IPU_ISYS_MIN_WIDTH,
 				  IPU_ISYS_MAX_WIDTH);
 	fmt->format.height = clamp(fmt->format.height,
@@ -578,6 +585,9 @@ int ipu_isys_subdev_set_sel(struct v4l2_subdev *sd,
 	if (!target_valid(sd, sel->target, sel->pad))
 		return -EINVAL;
 
+	if (sel->which == V4L2_SUBDEV_FORMAT_ACTIVE)
+		ipu_isys_topology_changed(asd->isys);
+
 	switch (sel->target) {
 	case V4L2_SEL_TGT_CROP:
 		if (pad->flags & MEDIA_PAD_FL_SINK) {
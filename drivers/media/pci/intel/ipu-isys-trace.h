@@ -0,0 +1,80 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2024 Intel Corporation */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ipu_isys
+
+#if !defined(IPU_ISYS_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define IPU_ISYS_TRACE_H
+
+#include <linux/tracepoint.h>
+
+#include "ipu-isys-video.h"
+
+/* Firmware SOF and EOF, ts_ns is the firmware timestamp */
+DECLARE_EVENT_CLASS(ipu_isys_frame_class,
+	TP_PROTO(struct ipu_isys_pipeline *ip, u32 sequence, u64 ts_ns),
+	TP_ARGS(ip, sequence, ts_ns),
+	TP_STRUCT__entry(
+		__field(int, stream_handle)
+		__field(u32, sequence)
+		__field(u64, ts_ns)
+	),
+	TP_fast_assign(
+		__entry->stream_handle = ip->stream_handle;
+		__entry->sequence = sequence;
+		__entry->ts_ns = ts_ns;
+	),
+	TP_printk("stream=%d sequence=%u ts_ns=%llu",
+		  __entry->stream_handle, __entry->sequence, __entry->ts_ns)
+);
+
+DEFINE_EVENT(ipu_isys_frame_class, ipu_isys_frame_sof,
+	TP_PROTO(struct ipu_isys_pipeline *ip, u32 sequence, u64 ts_ns),
+	TP_ARGS(ip, sequence, ts_ns)
+);
+
+DEFINE_EVENT(ipu_isys_frame_class, ipu_isys_frame_eof,
+	TP_PROTO(struct ipu_isys_pipeline *ip, u32 sequence, u64 ts_ns),
+	TP_ARGS(ip, sequence, ts_ns)
+);
+
+/*
+ * Buffer stages on a video node: PIN_DATA_READY handled and buffer
+ * handed to vb2. lat_ns is the time since the previous stage, EOF for
+ * ready and ready for done.
+ */
+DECLARE_EVENT_CLASS(ipu_isys_buf_class,
+	TP_PROTO(struct ipu_isys_video *av, u32 sequence, u64 lat_ns),
+	TP_ARGS(av, sequence, lat_ns),
+	TP_STRUCT__entry(
+		__array(char, name, 32)
+		__field(u32, sequence)
+		__field(u64, lat_ns)
+	),
+	TP_fast_assign(
+		strscpy(__entry->name, av->vdev.name, sizeof(__entry->name));
+		__entry->sequence = sequence;
+		__entry->lat_ns = lat_ns;
+	),
+	TP_printk("%s sequence=%u lat_ns=%llu",
+		  __entry->name, __entry->sequence, __entry->lat_ns)
+);
+
+DEFINE_EVENT(ipu_isys_buf_class, ipu_isys_buf_ready,
+	TP_PROTO(struct ipu_isys_video *av, u32 sequence, u64 lat_ns),
+	TP_ARGS(av, sequence, lat_ns)
+);
+
+DEFINE_EVENT(ipu_isys_buf_class, ipu_isys_buf_done,
+	TP_PROTO(struct ipu_isys_video *av, u32 sequence, u64 lat_ns),
+	TP_ARGS(av, sequence, lat_ns)
+);
+
+#endif /* IPU_ISYS_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ipu-isys-trace
+#include <trace/define_trace.h>
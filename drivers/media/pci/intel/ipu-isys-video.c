@@ -18,6 +18,7 @@
 
 #include <media/media-entity.h>
 #include <media/v4l2-device.h>
+#include <media/v4l2-event.h>
 #include <media/v4l2-ioctl.h>
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 6, 0)
 #include <media/v4l2-mc.h>
@@ -50,6 +51,28 @@ module_param_array(video_nr, int, NULL, 0444);
 MODULE_PARM_DESC(video_nr,
 		 "video device numbers (-1=auto, 0=/dev/video0, etc.)");
 
+static unsigned int bw_budget_mbs;
+module_param(bw_budget_mbs, uint, 0664);
+MODULE_PARM_DESC(bw_budget_mbs,
+		 "ISYS bandwidth budget for all streams in MB/s (0=unlimited)");
+
+static unsigned int stream_close_delay_ms;
+module_param(stream_close_delay_ms, uint, 0664);
+MODULE_PARM_DESC(stream_close_delay_ms,
+		 "Firmware stream close delay after stream off in ms (0=at stream off, max 5000)");
+
+/* The node's V4L2_CID_IPU_ISYS_KEEP_OPEN, unless it follows the default */
+static unsigned int stream_close_delay(struct ipu_isys_video *av)
+{
+	int ms = av->keep_open_ctrl ? v4l2_ctrl_g_ctrl(av->keep_open_ctrl) : -1;
+
+	if (ms < 0)
+		ms = min_t(unsigned int, READ_ONCE(stream_close_delay_ms),
+			   IPU_ISYS_KEEP_OPEN_MAX_MS);
+
+	return ms;
+}
+
 const struct ipu_isys_pixelformat ipu_isys_pfmts_be_soc[] = {
 	{V4L2_PIX_FMT_Y10, 16, 10, 0, MEDIA_BUS_FMT_Y10_1X10,
 	 IPU_FW_ISYS_FRAME_FORMAT_RAW16},
@@ -69,6 +92,9 @@ const struct ipu_isys_pixelformat ipu_isys_pfmts_be_soc[] = {
 	 IPU_FW_ISYS_FRAME_FORMAT_RGBA888},
 	{V4L2_PIX_FMT_XBGR32, 32, 32, 0, MEDIA_BUS_FMT_RGB888_1X24,
 	 IPU_FW_ISYS_FRAME_FORMAT_RGBA888},
+	/* Sensor embedded data */
+	{V4L2_META_FMT_GENERIC_8, 8, 8, 0, MEDIA_BUS_FMT_FIXED,
+	 IPU_FW_ISYS_FRAME_FORMAT_RAW8},
 	/* Raw bayer formats. */
 	{V4L2_PIX_FMT_SBGGR12, 16, 12, 0, MEDIA_BUS_FMT_SBGGR12_1X12,
 	 IPU_FW_ISYS_FRAME_FORMAT_RAW16},
@@ -264,6 +290,11 @@ static int video_release(struct file *file)
 
 	vb2_fop_release(file);
 
+	/* Don't leave a stream open across a firmware close */
+	mutex_lock(&av->isys->stream_mutex);
+	ipu_isys_video_close_pending(av->isys);
+	mutex_unlock(&av->isys->stream_mutex);
+
 	mutex_lock(&av->isys->mutex);
 
 	if (!--av->isys->video_opened) {
@@ -284,8 +315,9 @@ static int video_release(struct file *file)
 	v4l2_pipeline_pm_put(&av->vdev.entity);
 #endif
 
+	/* A reset must not wait for autosuspend */
 	if (av->isys->reset_needed)
-		pm_runtime_put_sync(&av->isys->adev->dev);
+		pm_runtime_put_sync_suspend(&av->isys->adev->dev);
 	else
 		pm_runtime_put(&av->isys->adev->dev);
 
@@ -366,6 +398,26 @@ int ipu_isys_vidioc_querycap(struct file *file, void *fh,
 	return 0;
 }
 
+/* ISYS compression is for single planar RAW on the SoC path only */
+static bool ipu_isys_pfmt_compressible(struct ipu_isys_video *av,
+				       const struct ipu_isys_pixelformat *pfmt)
+{
+	if (!av->compression_ctrl || pfmt->bpp_planar ||
+	    pfmt->code == MEDIA_BUS_FMT_FIXED)
+		return false;
+
+	switch (pfmt->css_pixelformat) {
+	case IPU_FW_ISYS_FRAME_FORMAT_RAW8:
+	case IPU_FW_ISYS_FRAME_FORMAT_RAW10:
+	case IPU_FW_ISYS_FRAME_FORMAT_RAW12:
+	case IPU_FW_ISYS_FRAME_FORMAT_RAW14:
+	case IPU_FW_ISYS_FRAME_FORMAT_RAW16:
+		return true;
+	default:
+		return false;
+	}
+}
+
 int ipu_isys_vidioc_enum_fmt(struct file *file, void *fh,
 			     struct v4l2_fmtdesc *f)
 {
@@ -409,6 +461,8 @@ int ipu_isys_vidioc_enum_fmt(struct file *file, void *fh,
 	}
 
 	f->pixelformat = pfmt->pixelformat;
+	if (ipu_isys_pfmt_compressible(av, pfmt))
+		f->flags |= V4L2_FMT_FLAG_IPU_COMPRESSIBLE;
 
 	return 0;
 }
@@ -437,6 +491,7 @@ ipu_isys_video_try_fmt_vid_mplane(struct ipu_isys_video *av,
 {
 	const struct ipu_isys_pixelformat *pfmt =
 	    ipu_isys_get_pixelformat(av, mpix->pixelformat);
+	bool compression;
 
 	if (!pfmt)
 		return NULL;
@@ -486,11 +541,17 @@ ipu_isys_video_try_fmt_vid_mplane(struct ipu_isys_video *av,
 		    max(mpix->plane_fmt[0].bytesperline,
 			av->isys->pdata->ipdata->isys_dma_overshoot)), 1U);
 
-	if (av->compression_ctrl)
-		av->compression = v4l2_ctrl_g_ctrl(av->compression_ctrl);
+	/* Asked for by the format flag or, as before, by the control */
+	compression = ipu_isys_pfmt_compressible(av, pfmt) &&
+	    (mpix->flags & V4L2_PIX_FMT_FLAG_IPU_COMPRESSED ||
+	     v4l2_ctrl_g_ctrl(av->compression_ctrl));
+	if (compression)
+		mpix->flags |= V4L2_PIX_FMT_FLAG_IPU_COMPRESSED;
+	else
+		mpix->flags &= ~V4L2_PIX_FMT_FLAG_IPU_COMPRESSED;
 
 	/* overwrite bpl/height with compression alignment */
-	if (av->compression) {
+	if (compression) {
 		u32 planar_tile_status_size, tile_status_size;
 		u64 planar_bytes;
 
@@ -504,7 +565,6 @@ ipu_isys_video_try_fmt_vid_mplane(struct ipu_isys_video *av,
 		    ALIGN(mpix->plane_fmt[0].bytesperline * mpix->height,
 			  IPU_ISYS_COMPRESSION_PAGE_ALIGN);
 
-		/* ISYS compression only for RAW and single plannar */
 		planar_bytes =
 		    mul_u32_u32(mpix->plane_fmt[0].bytesperline, mpix->height);
 		planar_tile_status_size =
@@ -528,6 +588,20 @@ ipu_isys_video_try_fmt_vid_mplane(struct ipu_isys_video *av,
 	memset(mpix->plane_fmt[0].reserved, 0,
 	       sizeof(mpix->plane_fmt[0].reserved));
 
+	/* Embedded data of the same frame in a plane of its own, RAW8 */
+	if (av->embedded_ctrl && pfmt->code != MEDIA_BUS_FMT_FIXED &&
+	    v4l2_ctrl_g_ctrl(av->embedded_ctrl)) {
+		struct v4l2_plane_pix_format *pf = &mpix->plane_fmt[1];
+
+		mpix->num_planes = 2;
+		pf->bytesperline = ALIGN(mpix->width, av->isys->line_align);
+		pf->sizeimage = pf->bytesperline *
+		    v4l2_ctrl_g_ctrl(av->embedded_ctrl) +
+		    max(pf->bytesperline,
+			av->isys->pdata->ipdata->isys_dma_overshoot);
+		memset(pf->reserved, 0, sizeof(pf->reserved));
+	}
+
 	if (mpix->field == V4L2_FIELD_ANY)
 		mpix->field = V4L2_FIELD_NONE;
 	/* Use defaults */
@@ -549,6 +623,11 @@ static int vidioc_s_fmt_vid_cap_mplane(struct file *file, void *fh,
 
 	av->pfmt = av->try_fmt_vid_mplane(av, &f->fmt.pix_mp);
 	av->mpix = f->fmt.pix_mp;
+	av->compression =
+	    !!(av->mpix.flags & V4L2_PIX_FMT_FLAG_IPU_COMPRESSED);
+	av->embedded_lines = av->mpix.num_planes > 1 ?
+	    v4l2_ctrl_g_ctrl(av->embedded_ctrl) : 0;
+	ipu_isys_topology_changed(av->isys);
 
 	return 0;
 }
@@ -563,6 +642,22 @@ static int vidioc_try_fmt_vid_cap_mplane(struct file *file, void *fh,
 	return 0;
 }
 
+static int queue_frame_ctrls(struct ipu_isys_video *av,
+			     const struct ipu_isys_frame_ctrls *fc)
+{
+	struct media_pipeline *mp = media_entity_pipeline(&av->vdev.entity);
+	struct ipu_isys_pipeline *ip;
+
+	if (!mp)
+		return -ENODEV;
+
+	ip = to_ipu_isys_pipeline(mp);
+	if (!ip->csi2)
+		return -ENODEV;
+
+	return ipu_isys_csi2_queue_frame_ctrls(ip->csi2, fc);
+}
+
 static long ipu_isys_vidioc_private(struct file *file, void *fh,
 				    bool valid_prio, unsigned int cmd,
 				    void *arg)
@@ -575,6 +670,10 @@ static long ipu_isys_vidioc_private(struct file *file, void *fh,
 		*(u32 *)arg = IPU_DRIVER_VERSION;
 		break;
 
+	case VIDIOC_IPU_QUEUE_FRAME_CTRLS:
+		ret = queue_frame_ctrls(av, arg);
+		break;
+
 	default:
 		dev_dbg(&av->isys->adev->dev, "unsupported private ioctl %x\n",
 			cmd);
@@ -583,6 +682,20 @@ static long ipu_isys_vidioc_private(struct file *file, void *fh,
 	return ret;
 }
 
+static int vidioc_subscribe_event(struct v4l2_fh *fh,
+				  const struct v4l2_event_subscription *sub)
+{
+	switch (sub->type) {
+	case V4L2_EVENT_IPU_WATERMARK:
+	case V4L2_EVENT_IPU_FRAME_SKIPPED:
+		return v4l2_event_subscribe(fh, sub, 8, NULL);
+	case V4L2_EVENT_CTRL:
+		return v4l2_ctrl_subscribe_event(fh, sub);
+	default:
+		return -EINVAL;
+	}
+}
+
 static int vidioc_enum_input(struct file *file, void *fh,
 			     struct v4l2_input *input)
 {
@@ -696,7 +809,8 @@ static int get_stream_handle(struct ipu_isys_video *av)
 {
 	struct media_pipeline *mp = media_entity_pipeline(&av->vdev.entity);
 	struct ipu_isys_pipeline *ip = to_ipu_isys_pipeline(mp);
-	unsigned int stream_handle;
+	struct ipu_isys_fw_queue_stats *stats = &av->isys->fw_queues;
+	unsigned int stream_handle, i, streams = 0;
 	unsigned long flags;
 
 	spin_lock_irqsave(&av->isys->lock, flags);
@@ -710,20 +824,31 @@ static int get_stream_handle(struct ipu_isys_video *av)
 	}
 	av->isys->pipes[stream_handle] = ip;
 	ip->stream_handle = stream_handle;
+
+	for (i = 0; i < IPU_ISYS_MAX_STREAMS; i++)
+		if (av->isys->pipes[i])
+			streams++;
+	stats->max_streams = max(stats->max_streams, streams);
 	spin_unlock_irqrestore(&av->isys->lock, flags);
 	return 0;
 }
 
-static void put_stream_handle(struct ipu_isys_video *av)
+static void __put_stream_handle(struct ipu_isys *isys,
+				struct ipu_isys_pipeline *ip)
 {
-	struct media_pipeline *mp = media_entity_pipeline(&av->vdev.entity);
-	struct ipu_isys_pipeline *ip = to_ipu_isys_pipeline(mp);
 	unsigned long flags;
 
-	spin_lock_irqsave(&av->isys->lock, flags);
-	av->isys->pipes[ip->stream_handle] = NULL;
+	spin_lock_irqsave(&isys->lock, flags);
+	isys->pipes[ip->stream_handle] = NULL;
 	ip->stream_handle = -1;
-	spin_unlock_irqrestore(&av->isys->lock, flags);
+	spin_unlock_irqrestore(&isys->lock, flags);
+}
+
+static void put_stream_handle(struct ipu_isys_video *av)
+{
+	struct media_pipeline *mp = media_entity_pipeline(&av->vdev.entity);
+
+	__put_stream_handle(av->isys, to_ipu_isys_pipeline(mp));
 }
 
 static int get_external_facing_format(struct ipu_isys_pipeline *ip,
@@ -839,8 +964,8 @@ static int short_packet_queue_setup(struct ipu_isys_pipeline *ip)
 	    IPU_ISYS_SHORT_PACKET_PKT_LINES(source_fmt.format.height);
 
 	/* Initialize short packet queue. */
-	INIT_LIST_HEAD(&ip->short_packet_incoming);
-	INIT_LIST_HEAD(&ip->short_packet_active);
+	ip->short_packet_head = 0;
+	ip->short_packet_tail = 0;
 #if LINUX_VERSION_CODE < KERNEL_VERSION(5, 4, 0)
 #if LINUX_VERSION_CODE < KERNEL_VERSION(4, 8, 0)
 	init_dma_attrs(&attrs);
@@ -879,7 +1004,6 @@ static int short_packet_queue_setup(struct ipu_isys_pipeline *ip)
 			short_packet_queue_destroy(ip);
 			return -ENOMEM;
 		}
-		list_add(&buf->ib.head, &ip->short_packet_incoming);
 	}
 
 	return 0;
@@ -908,6 +1032,7 @@ csi_short_packet_prepare_fw_cfg(struct ipu_isys_pipeline *ip,
 	ip->output_pins[output_pin].pin_ready =
 	    ipu_isys_queue_short_packet_ready;
 	ip->output_pins[output_pin].aq = NULL;
+	ip->output_pins[output_pin].metadata = false;
 	ip->short_packet_output_pin = output_pin;
 
 	output_info->input_pin_id = input_pin;
@@ -928,6 +1053,91 @@ csi_short_packet_prepare_fw_cfg(struct ipu_isys_pipeline *ip,
 	output_info->error_handling_enable = false;
 }
 
+/*
+ * Output pins of one stream share an input pin per CSI-2 data type.
+ * Input pin 0 carries the external-facing format, a node capturing
+ * another data type of the same virtual channel (e.g. embedded data
+ * or a second exposure) gets an input pin of its own so the whole
+ * pipeline stays a single firmware stream.
+ */
+static unsigned int
+ipu_isys_fw_input_pin_dt(struct ipu_isys_video *av,
+			 struct ipu_fw_isys_stream_cfg_data_abi *cfg,
+			 unsigned int dt, u32 width, u32 height)
+{
+	struct ipu_fw_isys_input_pin_info_abi *input_info;
+	unsigned int i;
+
+	for (i = 0; i < cfg->nof_input_pins; i++)
+		if (cfg->input_pins[i].dt == dt)
+			return i;
+
+	if (!cfg->nof_input_pins || cfg->nof_input_pins >= IPU_MAX_IPINS) {
+		dev_warn(&av->isys->adev->dev,
+			 "%s: no input pin for data type 0x%x\n",
+			 av->vdev.name, dt);
+		return 0;
+	}
+
+	input_info = &cfg->input_pins[cfg->nof_input_pins];
+	*input_info = cfg->input_pins[0];
+	input_info->dt = dt;
+	input_info->input_res.width = width;
+	input_info->input_res.height = height;
+
+	return cfg->nof_input_pins++;
+}
+
+static unsigned int
+ipu_isys_fw_input_pin(struct ipu_isys_video *av,
+		      struct ipu_fw_isys_stream_cfg_data_abi *cfg)
+{
+	return ipu_isys_fw_input_pin_dt(av, cfg,
+					ipu_isys_mbus_code_to_mipi(av->pfmt->code),
+					av->mpix.width, av->mpix.height);
+}
+
+/*
+ * The embedded data of a node with embedded_lines goes through an output
+ * pin of its own into plane 1. Both pins are written by the same capture
+ * and the buffer is ready once both are, see ipu_isys_queue_buf_ready().
+ */
+static void
+ipu_isys_prepare_fw_cfg_embedded(struct ipu_isys_video *av,
+				 struct ipu_fw_isys_stream_cfg_data_abi *cfg)
+{
+	struct media_pipeline *mp = media_entity_pipeline(&av->vdev.entity);
+	struct ipu_isys_pipeline *ip = to_ipu_isys_pipeline(mp);
+	struct ipu_fw_isys_output_pin_info_abi *pin_info;
+	int pin = cfg->nof_output_pins++;
+
+	av->aq.fw_output_embedded = pin;
+	ip->output_pins[pin].pin_ready = ipu_isys_queue_buf_ready;
+	ip->output_pins[pin].aq = &av->aq;
+	/* Not early on STATS_DATA_READY, the image shares the buffer */
+	ip->output_pins[pin].metadata = false;
+
+	pin_info = &cfg->output_pins[pin];
+	memset(pin_info, 0, sizeof(*pin_info));
+	pin_info->input_pin_id =
+	    ipu_isys_fw_input_pin_dt(av, cfg,
+				     IPU_FW_ISYS_MIPI_DATA_TYPE_EMBEDDED,
+				     av->mpix.width, av->embedded_lines);
+	pin_info->output_res.width = av->mpix.width;
+	pin_info->output_res.height = av->embedded_lines;
+	pin_info->stride = av->mpix.plane_fmt[1].bytesperline;
+	pin_info->pt = IPU_FW_ISYS_PIN_TYPE_METADATA_0;
+	pin_info->ft = IPU_FW_ISYS_FRAME_FORMAT_RAW8;
+	pin_info->send_irq = 1;
+	pin_info->s2m_pixel_soc_pixel_remapping =
+	    S2M_PIXEL_SOC_PIXEL_REMAPPING_FLAG_NO_REMAPPING;
+	pin_info->csi_be_soc_pixel_remapping =
+	    CSI_BE_SOC_PIXEL_REMAPPING_FLAG_NO_REMAPPING;
+	pin_info->sensor_type = av->isys->sensor_info.sensor_metadata;
+	pin_info->snoopable = true;
+	pin_info->error_handling_enable = false;
+}
+
 void
 ipu_isys_prepare_fw_cfg_default(struct ipu_isys_video *av,
 				struct ipu_fw_isys_stream_cfg_data_abi *cfg)
@@ -945,7 +1155,7 @@ ipu_isys_prepare_fw_cfg_default(struct ipu_isys_video *av,
 	ip->output_pins[pin].aq = aq;
 
 	pin_info = &cfg->output_pins[pin];
-	pin_info->input_pin_id = 0;
+	pin_info->input_pin_id = ipu_isys_fw_input_pin(av, cfg);
 	pin_info->output_res.width = av->mpix.width;
 	pin_info->output_res.height = av->mpix.height;
 
@@ -957,7 +1167,13 @@ ipu_isys_prepare_fw_cfg_default(struct ipu_isys_video *av,
 						      BITS_PER_BYTE),
 					 av->isys->line_align);
 
-	pin_info->pt = aq->css_pin_type;
+	/* Embedded data goes to the CPU, not to PSYS */
+	if (av->pfmt->code == MEDIA_BUS_FMT_FIXED)
+		pin_info->pt = IPU_FW_ISYS_PIN_TYPE_METADATA_0;
+	else
+		pin_info->pt = aq->css_pin_type;
+	ip->output_pins[pin].metadata =
+	    pin_info->pt == IPU_FW_ISYS_PIN_TYPE_METADATA_0;
 	pin_info->ft = av->pfmt->css_pixelformat;
 	pin_info->send_irq = 1;
 	memset(pin_info->ts_offsets, 0, sizeof(pin_info->ts_offsets));
@@ -967,6 +1183,13 @@ ipu_isys_prepare_fw_cfg_default(struct ipu_isys_video *av,
 	    CSI_BE_SOC_PIXEL_REMAPPING_FLAG_NO_REMAPPING;
 	cfg->vc = 0;
 
+	/* A watermark at or past the last line is PIN_DATA_READY anyway */
+	av->watermark_lines = av->watermark_ctrl ?
+	    v4l2_ctrl_g_ctrl(av->watermark_ctrl) : 0;
+	if (av->watermark_lines >= av->mpix.height)
+		av->watermark_lines = 0;
+	pin_info->watermark_in_lines = av->watermark_lines;
+
 	switch (pin_info->pt) {
 	/* non-snoopable sensor data to PSYS */
 	case IPU_FW_ISYS_PIN_TYPE_RAW_NS:
@@ -1035,6 +1258,9 @@ ipu_isys_prepare_fw_cfg_default(struct ipu_isys_video *av,
 		pin_info->reserve_compression = av->compression;
 		pin_info->ts_offsets[0] = av->ts_offsets[0];
 	}
+
+	if (av->embedded_lines)
+		ipu_isys_prepare_fw_cfg_embedded(av, cfg);
 }
 
 static unsigned int ipu_isys_get_compression_scheme(u32 code)
@@ -1081,9 +1307,47 @@ static unsigned int get_comp_format(u32 code)
 	    ((udt - IPU_ISYS_MIPI_CSI2_TYPE_USER_DEF(1)) * 4);
 }
 
-/* Create stream and start it using the CSS FW ABI. */
-static int start_stream_firmware(struct ipu_isys_video *av,
-				 struct ipu_isys_buffer_list *bl)
+/* Record when a stream start phase completed, relative to startup_ns */
+void ipu_isys_stream_startup_mark(struct ipu_isys_pipeline *ip,
+				   enum ipu_isys_startup_phase phase)
+{
+	ip->startup[phase] = ktime_get_ns() - ip->startup_ns;
+}
+
+/*
+ * A stream left open is taken over if it was opened with the same
+ * configuration. Output pin sensor types rotate on each open and only
+ * need to be distinct, so the ones of the open stream are kept.
+ */
+static bool stream_cfg_reusable(struct ipu_isys_pipeline *ip,
+				struct ipu_fw_isys_stream_cfg_data_abi *cfg)
+{
+	struct ipu_fw_isys_stream_cfg_data_abi *old = ip->open_cfg;
+	u32 types[IPU_MAX_OPINS];
+	unsigned int i;
+	bool same;
+
+	if (!ip->close_pending || !old ||
+	    old->nof_output_pins != cfg->nof_output_pins)
+		return false;
+
+	for (i = 0; i < cfg->nof_output_pins; i++) {
+		types[i] = cfg->output_pins[i].sensor_type;
+		cfg->output_pins[i].sensor_type = old->output_pins[i].sensor_type;
+	}
+	same = !memcmp(old, cfg, sizeof(*cfg));
+	for (i = 0; i < cfg->nof_output_pins; i++)
+		cfg->output_pins[i].sensor_type = types[i];
+
+	return same;
+}
+
+/*
+ * Send the stream configuration without waiting for the firmware, the
+ * CSI-2 receiver and PHY are powered up while the firmware opens the
+ * stream. wait_stream_open_firmware() collects the response.
+ */
+static int open_stream_firmware(struct ipu_isys_video *av)
 {
 	struct media_pipeline *mp = media_entity_pipeline(&av->vdev.entity);
 	struct ipu_isys_pipeline *ip = to_ipu_isys_pipeline(mp);
@@ -1095,7 +1359,6 @@ static int start_stream_firmware(struct ipu_isys_video *av,
 	};
 	struct ipu_fw_isys_stream_cfg_data_abi *stream_cfg;
 	struct isys_fw_msgs *msg = NULL;
-	struct ipu_fw_isys_frame_buff_set_abi *buf = NULL;
 	struct ipu_isys_queue *aq;
 	struct ipu_isys_video *isl_av = NULL;
 	struct v4l2_subdev_format source_fmt = { 0 };
@@ -1106,8 +1369,7 @@ static int start_stream_firmware(struct ipu_isys_video *av,
 	struct media_pad *source_pad = media_pad_remote_pad_first(&av->pad);
 #endif
 	struct ipu_fw_isys_cropping_abi *crop;
-	enum ipu_fw_isys_send_type send_type;
-	int rval, rvalout, tout;
+	int rval;
 
 	rval = get_external_facing_format(ip, &source_fmt);
 	if (rval)
@@ -1197,6 +1459,28 @@ static int start_stream_firmware(struct ipu_isys_video *av,
 
 	ip->nr_output_pins = stream_cfg->nof_output_pins;
 
+	if (stream_cfg_reusable(ip, stream_cfg)) {
+		ip->close_pending = false;
+		cancel_delayed_work(&ip->close_work);
+		ipu_put_fw_mgs_buf(av->isys, (uintptr_t)stream_cfg);
+		ip->stream_cfg = NULL;
+		dev_dbg(dev, "stream %d reused\n", ip->stream_handle);
+		return 0;
+	}
+	ipu_isys_video_close_pending(av->isys);
+
+	if (stream_close_delay(av)) {
+		if (!ip->open_cfg)
+			ip->open_cfg = kmalloc(sizeof(*ip->open_cfg),
+					       GFP_KERNEL);
+		if (ip->open_cfg)
+			*ip->open_cfg = *stream_cfg;
+	} else {
+		/* Not kept open, nothing to compare a later open against */
+		kfree(ip->open_cfg);
+		ip->open_cfg = NULL;
+	}
+
 	rval = get_stream_handle(av);
 	if (rval) {
 		dev_dbg(dev, "Can't get stream_handle\n");
@@ -1218,15 +1502,32 @@ static int start_stream_firmware(struct ipu_isys_video *av,
 	if (rval < 0) {
 		dev_err(dev, "can't open stream (%d)\n", rval);
 		ipu_put_fw_mgs_buf(av->isys, (uintptr_t)stream_cfg);
-		goto out_put_stream_handle;
+		put_stream_handle(av);
+		return rval;
 	}
 
 	get_stream_opened(av);
+	ip->stream_cfg = stream_cfg;
+
+	return 0;
+}
+
+static int wait_stream_open_firmware(struct ipu_isys_video *av)
+{
+	struct media_pipeline *mp = media_entity_pipeline(&av->vdev.entity);
+	struct ipu_isys_pipeline *ip = to_ipu_isys_pipeline(mp);
+	struct device *dev = &av->isys->adev->dev;
+	int rval, tout;
+
+	/* Stream taken over from the last stream off, already open */
+	if (!ip->stream_cfg)
+		return 0;
 
 	tout = wait_for_completion_timeout(&ip->stream_open_completion,
 					   IPU_LIB_CALL_TIMEOUT_JIFFIES);
 
-	ipu_put_fw_mgs_buf(av->isys, (uintptr_t)stream_cfg);
+	ipu_put_fw_mgs_buf(av->isys, (uintptr_t)ip->stream_cfg);
+	ip->stream_cfg = NULL;
 
 	if (!tout) {
 		dev_err(dev, "stream open time out\n");
@@ -1239,6 +1540,27 @@ static int start_stream_firmware(struct ipu_isys_video *av,
 		goto out_put_stream_opened;
 	}
 	dev_dbg(dev, "start stream: open complete\n");
+	ipu_bus_boot_mark(av->isys->adev, IPU_BOOT_STREAM_OPEN);
+
+	return 0;
+
+out_put_stream_opened:
+	put_stream_opened(av);
+	put_stream_handle(av);
+	return rval;
+}
+
+/* Start the stream opened by open_stream_firmware() using the CSS FW ABI. */
+static int start_stream_firmware(struct ipu_isys_video *av,
+				 struct ipu_isys_buffer_list *bl)
+{
+	struct media_pipeline *mp = media_entity_pipeline(&av->vdev.entity);
+	struct ipu_isys_pipeline *ip = to_ipu_isys_pipeline(mp);
+	struct device *dev = &av->isys->adev->dev;
+	struct isys_fw_msgs *msg = NULL;
+	struct ipu_fw_isys_frame_buff_set_abi *buf = NULL;
+	enum ipu_fw_isys_send_type send_type;
+	int rval, rvalout, tout;
 
 	if (bl) {
 		msg = ipu_get_fw_msg_buf(ip);
@@ -1260,7 +1582,7 @@ static int start_stream_firmware(struct ipu_isys_video *av,
 	if (bl) {
 		send_type = IPU_FW_ISYS_SEND_TYPE_STREAM_START_AND_CAPTURE;
 		ipu_fw_isys_dump_frame_buff_set(dev, buf,
-						stream_cfg->nof_output_pins);
+						ip->nr_output_pins);
 		rval = ipu_fw_isys_complex_cmd(av->isys,
 					       ip->stream_handle,
 					       buf, to_dma_addr(msg),
@@ -1316,13 +1638,11 @@ out_stream_close:
 
 out_put_stream_opened:
 	put_stream_opened(av);
-
-out_put_stream_handle:
 	put_stream_handle(av);
 	return rval;
 }
 
-static void stop_streaming_firmware(struct ipu_isys_video *av)
+static int stop_streaming_firmware(struct ipu_isys_video *av)
 {
 	struct media_pipeline *mp = media_entity_pipeline(&av->vdev.entity);
 	struct ipu_isys_pipeline *ip = to_ipu_isys_pipeline(mp);
@@ -1338,29 +1658,82 @@ static void stop_streaming_firmware(struct ipu_isys_video *av)
 
 	if (rval < 0) {
 		dev_err(dev, "can't stop stream (%d)\n", rval);
-		return;
+		return rval;
 	}
 
 	tout = wait_for_completion_timeout(&ip->stream_stop_completion,
 					   IPU_LIB_CALL_TIMEOUT_JIFFIES);
-	if (!tout)
+	if (!tout) {
 		dev_err(dev, "stream stop time out\n");
-	else if (ip->error)
+		return -ETIMEDOUT;
+	}
+	if (ip->error) {
 		dev_err(dev, "stream stop error: %d\n", ip->error);
-	else
-		dev_dbg(dev, "stop stream: complete\n");
+		return -EIO;
+	}
+	dev_dbg(dev, "stop stream: complete\n");
+
+	return 0;
 }
 
-static void close_streaming_firmware(struct ipu_isys_video *av)
+/*
+ * In-place error recovery: flush the stream, leaving it open and the
+ * external sub-device streaming. The firmware then owns none of the
+ * buffers. Called with stream_mutex held.
+ */
+int ipu_isys_video_flush_streaming(struct ipu_isys_video *av)
+{
+	lockdep_assert_held(&av->isys->stream_mutex);
+
+	return stop_streaming_firmware(av);
+}
+
+/*
+ * Start a flushed stream again on the same handle, without buffers. On
+ * failure the stream stays open for stream off to close it as usual.
+ */
+int ipu_isys_video_restart_streaming(struct ipu_isys_video *av)
 {
 	struct media_pipeline *mp = media_entity_pipeline(&av->vdev.entity);
 	struct ipu_isys_pipeline *ip = to_ipu_isys_pipeline(mp);
 	struct device *dev = &av->isys->adev->dev;
 	int rval, tout;
 
-	reinit_completion(&ip->stream_close_completion);
+	lockdep_assert_held(&av->isys->stream_mutex);
+
+	reinit_completion(&ip->stream_start_completion);
 
 	rval = ipu_fw_isys_simple_cmd(av->isys, ip->stream_handle,
+				      IPU_FW_ISYS_SEND_TYPE_STREAM_START);
+	if (rval < 0) {
+		dev_err(dev, "can't restart stream (%d)\n", rval);
+		return rval;
+	}
+
+	tout = wait_for_completion_timeout(&ip->stream_start_completion,
+					   IPU_LIB_CALL_TIMEOUT_JIFFIES);
+	if (!tout) {
+		dev_err(dev, "stream restart time out\n");
+		return -ETIMEDOUT;
+	}
+	if (ip->error) {
+		dev_err(dev, "stream restart error: %d\n", ip->error);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+/* The pipeline may be out of its media pipeline already */
+static void close_stream_firmware_pipe(struct ipu_isys_pipeline *ip)
+{
+	struct ipu_isys *isys = ip->isys;
+	struct device *dev = &isys->adev->dev;
+	int rval, tout;
+
+	reinit_completion(&ip->stream_close_completion);
+
+	rval = ipu_fw_isys_simple_cmd(isys, ip->stream_handle,
 				      IPU_FW_ISYS_SEND_TYPE_STREAM_CLOSE);
 	if (rval < 0) {
 		dev_err(dev, "can't close stream (%d)\n", rval);
@@ -1376,8 +1749,47 @@ static void close_streaming_firmware(struct ipu_isys_video *av)
 	else
 		dev_dbg(dev, "close stream: complete\n");
 
-	put_stream_opened(av);
-	put_stream_handle(av);
+	put_stream_opened(container_of(ip, struct ipu_isys_video, ip));
+	__put_stream_handle(isys, ip);
+}
+
+static void close_streaming_firmware(struct ipu_isys_video *av)
+{
+	struct media_pipeline *mp = media_entity_pipeline(&av->vdev.entity);
+
+	close_stream_firmware_pipe(to_ipu_isys_pipeline(mp));
+}
+
+static void close_stream_work(struct work_struct *work)
+{
+	struct ipu_isys_pipeline *ip =
+	    container_of(to_delayed_work(work), struct ipu_isys_pipeline,
+			 close_work);
+
+	mutex_lock(&ip->isys->stream_mutex);
+	if (ip->close_pending) {
+		ip->close_pending = false;
+		close_stream_firmware_pipe(ip);
+	}
+	mutex_unlock(&ip->isys->stream_mutex);
+}
+
+/* Close the streams left open at stream off now, stream_mutex held */
+void ipu_isys_video_close_pending(struct ipu_isys *isys)
+{
+	unsigned int i;
+
+	lockdep_assert_held(&isys->stream_mutex);
+
+	for (i = 0; i < IPU_ISYS_MAX_STREAMS; i++) {
+		struct ipu_isys_pipeline *ip = isys->pipes[i];
+
+		if (!ip || !ip->close_pending)
+			continue;
+		ip->close_pending = false;
+		cancel_delayed_work(&ip->close_work);
+		close_stream_firmware_pipe(ip);
+	}
 }
 
 void
@@ -1432,12 +1844,15 @@ int ipu_isys_video_prepare_streaming(struct ipu_isys_video *av,
 		if (ip->interlaced && isys->short_packet_source ==
 		    IPU_ISYS_SHORT_PACKET_FROM_RECEIVER)
 			short_packet_queue_destroy(ip);
+		ipu_isys_fw_msg_pool_drain(ip);
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 1, 0)
 		media_pipeline_stop(&av->vdev.entity);
 #else
 		media_pipeline_stop(av->vdev.entity.pads);
 #endif
 		media_entity_enum_cleanup(&ip->entity_enum);
+		/* No cadence for PSYS to pace to any more */
+		WRITE_ONCE(isys->adev->isp->isys_frame_ns, 0);
 		return 0;
 	}
 
@@ -1457,6 +1872,12 @@ int ipu_isys_video_prepare_streaming(struct ipu_isys_video *av,
 	ip->csi2 = NULL;
 	ip->seq_index = 0;
 	memset(ip->seq, 0, sizeof(ip->seq));
+	ip->sof_ns = 0;
+	ip->eof_ns = 0;
+	ip->sof_eof_ns = 0;
+	ip->sof_interval_ns = 0;
+	ip->jitter_ns = 0;
+	ip->sof_count = 0;
 
 	WARN_ON(!list_empty(&ip->queues));
 	ip->interlaced = false;
@@ -1618,14 +2039,109 @@ static void update_stream_watermark(struct ipu_isys_video *av, bool state)
 		mutex_lock(&iwake_watermark->mutex);
 		list_add(&av->watermark->stream_node,
 			 &iwake_watermark->video_list);
+		ipu_isys_iwake_mix_changed(iwake_watermark);
 		mutex_unlock(&iwake_watermark->mutex);
 	} else {
 		av->watermark->stream_data_rate = 0;
 		mutex_lock(&iwake_watermark->mutex);
 		list_del(&av->watermark->stream_node);
+		ipu_isys_iwake_mix_changed(iwake_watermark);
 		mutex_unlock(&iwake_watermark->mutex);
 	}
 	update_watermark_setting(av->isys);
+	ipu_isys_update_pm_qos(av->isys);
+}
+
+/*
+ * Bandwidth of a pipeline in MB/s: the bytes its video nodes write per
+ * line, over the line time of the external sub-device. Without a pixel
+ * rate control the default rate of the iwake watermark is assumed.
+ */
+static u32 ipu_isys_pipeline_bw_mbs(struct ipu_isys_pipeline *ip)
+{
+	struct v4l2_control hb = { .id = V4L2_CID_HBLANK, .value = 0 };
+	struct v4l2_subdev_format source_fmt = { 0 };
+	struct ipu_isys_queue *aq;
+	struct v4l2_subdev *esd;
+	struct v4l2_ctrl *ctrl;
+	u64 pixel_rate, line_ns;
+	u32 hblank = 0;
+	u64 mbs = 0;
+
+	if (get_external_facing_format(ip, &source_fmt))
+		return 0;
+
+	esd = media_entity_to_v4l2_subdev(ip->external->entity);
+	ctrl = v4l2_ctrl_find(esd->ctrl_handler, V4L2_CID_PIXEL_RATE);
+	pixel_rate = ctrl ? v4l2_ctrl_g_ctrl_int64(ctrl) : DEFAULT_PIXEL_RATE;
+	if (!v4l2_g_ctrl(esd->ctrl_handler, &hb) && hb.value > 0)
+		hblank = hb.value;
+	if (!pixel_rate)
+		return 0;
+
+	line_ns = div64_u64((u64)(source_fmt.format.width + hblank) *
+			    NSEC_PER_SEC, pixel_rate);
+	if (!line_ns)
+		return 0;
+
+	list_for_each_entry(aq, &ip->queues, node) {
+		struct ipu_isys_video *av = ipu_isys_queue_to_video(aq);
+
+		mbs += div64_u64((u64)av->mpix.plane_fmt[0].bytesperline *
+				 MSEC_PER_SEC, line_ns);
+	}
+
+	return min_t(u64, mbs, U32_MAX);
+}
+
+/*
+ * Admission control at stream on: refuse a pipeline whose bandwidth
+ * would take the streaming ones over bw_budget_mbs, rather than letting
+ * all of them drop frames. Called with stream_mutex held.
+ */
+static int ipu_isys_bw_admit(struct ipu_isys_video *av,
+			     struct ipu_isys_pipeline *ip)
+{
+	struct ipu_isys *isys = av->isys;
+	unsigned int budget = READ_ONCE(bw_budget_mbs);
+
+	ip->bw_mbs = ipu_isys_pipeline_bw_mbs(ip);
+	if (budget && isys->bw_admitted_mbs + ip->bw_mbs > budget) {
+		dev_warn(&isys->adev->dev,
+			 "%s: %u MB/s over budget, %u of %u MB/s in use\n",
+			 av->vdev.name, ip->bw_mbs, isys->bw_admitted_mbs,
+			 budget);
+		ip->bw_mbs = 0;
+		return -ENOSPC;
+	}
+	isys->bw_admitted_mbs += ip->bw_mbs;
+
+	return 0;
+}
+
+static void ipu_isys_bw_release(struct ipu_isys_video *av,
+				struct ipu_isys_pipeline *ip)
+{
+	av->isys->bw_admitted_mbs -= ip->bw_mbs;
+	ip->bw_mbs = 0;
+}
+
+/*
+ * The external sub-device belongs to this pipeline alone and its stream
+ * changes are serialised by the pipeline mutex, so drop stream_mutex
+ * meanwhile: a slow sensor must not hold up the other pipelines.
+ */
+static int ipu_isys_video_external_s_stream(struct ipu_isys_video *av,
+					    struct v4l2_subdev *esd,
+					    unsigned int state)
+{
+	int rval;
+
+	mutex_unlock(&av->isys->stream_mutex);
+	rval = v4l2_subdev_call(esd, video, s_stream, state);
+	mutex_lock(&av->isys->stream_mutex);
+
+	return rval;
 }
 
 int ipu_isys_video_set_streaming(struct ipu_isys_video *av,
@@ -1645,10 +2161,13 @@ int ipu_isys_video_set_streaming(struct ipu_isys_video *av,
 	struct media_pipeline *mp = media_entity_pipeline(&av->vdev.entity);
 	struct ipu_isys_pipeline *ip = to_ipu_isys_pipeline(mp);
 	struct v4l2_subdev *sd, *esd;
+	unsigned int close_delay;
 	int rval = 0;
 
 	dev_dbg(dev, "set stream: %d\n", state);
 
+	lockdep_assert_held(&av->isys->stream_mutex);
+
 	if (!ip->external->entity) {
 		WARN_ON(1);
 		return -ENODEV;
@@ -1656,12 +2175,24 @@ int ipu_isys_video_set_streaming(struct ipu_isys_video *av,
 	esd = media_entity_to_v4l2_subdev(ip->external->entity);
 
 	if (state) {
-		rval = media_graph_walk_init(&ip->graph, mdev);
+		rval = ipu_isys_bw_admit(av, ip);
 		if (rval)
 			return rval;
+
+		rval = media_graph_walk_init(&ip->graph, mdev);
+		if (rval)
+			goto out_bw_release;
 		rval = media_entity_enum_init(&entities, mdev);
 		if (rval)
 			goto out_media_entity_graph_init;
+
+		memset(ip->startup, 0, sizeof(ip->startup));
+		ip->startup_ns = ktime_get_ns();
+
+		rval = open_stream_firmware(av);
+		if (rval)
+			goto out_media_entity_enum_cleanup;
+		ipu_isys_stream_startup_mark(ip, IPU_ISYS_STARTUP_OPEN_SENT);
 	}
 
 	if (!state) {
@@ -1670,7 +2201,7 @@ int ipu_isys_video_set_streaming(struct ipu_isys_video *av,
 		/* stop external sub-device now. */
 		dev_info(dev, "stream off %s\n", ip->external->entity->name);
 
-		v4l2_subdev_call(esd, video, s_stream, state);
+		ipu_isys_video_external_s_stream(av, esd, state);
 	}
 
 	mutex_lock(&mdev->graph_mutex);
@@ -1706,6 +2237,8 @@ int ipu_isys_video_set_streaming(struct ipu_isys_video *av,
 			continue;
 		if (rval && rval != -ENOIOCTLCMD) {
 			mutex_unlock(&mdev->graph_mutex);
+			if (!wait_stream_open_firmware(av))
+				close_streaming_firmware(av);
 			goto out_media_entity_stop_streaming;
 		}
 
@@ -1722,9 +2255,17 @@ int ipu_isys_video_set_streaming(struct ipu_isys_video *av,
 
 	/* Oh crap */
 	if (state) {
+		ipu_isys_stream_startup_mark(ip, IPU_ISYS_STARTUP_SUBDEVS);
+
+		rval = wait_stream_open_firmware(av);
+		if (rval)
+			goto out_update_stream_watermark;
+		ipu_isys_stream_startup_mark(ip, IPU_ISYS_STARTUP_OPEN);
+
 		rval = start_stream_firmware(av, bl);
 		if (rval)
 			goto out_update_stream_watermark;
+		ipu_isys_stream_startup_mark(ip, IPU_ISYS_STARTUP_START);
 
 		dev_dbg(dev, "set stream: source %d, stream_handle %d\n",
 			ip->source, ip->stream_handle);
@@ -1732,11 +2273,21 @@ int ipu_isys_video_set_streaming(struct ipu_isys_video *av,
 		/* Start external sub-device now. */
 		dev_info(dev, "stream on %s\n", ip->external->entity->name);
 
-		rval = v4l2_subdev_call(esd, video, s_stream, state);
+		rval = ipu_isys_video_external_s_stream(av, esd, state);
 		if (rval)
 			goto out_media_entity_stop_streaming_firmware;
+		ipu_isys_stream_startup_mark(ip, IPU_ISYS_STARTUP_SENSOR);
 	} else {
-		close_streaming_firmware(av);
+		/* Flushed, so the buffers are back. The close may wait. */
+		close_delay = stream_close_delay(av);
+		if (close_delay && ip->open_cfg) {
+			ip->close_pending = true;
+			schedule_delayed_work(&ip->close_work,
+					      msecs_to_jiffies(close_delay));
+		} else {
+			close_streaming_firmware(av);
+		}
+		ipu_isys_bw_release(av, ip);
 	}
 
 	if (state)
@@ -1780,11 +2331,16 @@ out_media_entity_stop_streaming:
 
 	mutex_unlock(&mdev->graph_mutex);
 
+out_media_entity_enum_cleanup:
 	media_entity_enum_cleanup(&entities);
 
 out_media_entity_graph_init:
 	media_graph_walk_cleanup(&ip->graph);
 
+out_bw_release:
+	if (state)
+		ipu_isys_bw_release(av, ip);
+
 	return rval;
 }
 
@@ -1828,6 +2384,8 @@ static const struct v4l2_ioctl_ops ioctl_ops_mplane = {
 	.vidioc_enum_input = vidioc_enum_input,
 	.vidioc_g_input = vidioc_g_input,
 	.vidioc_s_input = vidioc_s_input,
+	.vidioc_subscribe_event = vidioc_subscribe_event,
+	.vidioc_unsubscribe_event = v4l2_event_unsubscribe,
 };
 
 static const struct media_entity_operations entity_ops = {
@@ -1846,6 +2404,70 @@ static const struct v4l2_file_operations isys_fops = {
 	.release = video_release,
 };
 
+static const char * const ipu_isys_stat_names[IPU_ISYS_STAT_NUM] = {
+	[IPU_ISYS_STAT_QUEUED] = "queued",
+	[IPU_ISYS_STAT_DONE] = "done",
+	[IPU_ISYS_STAT_ERRORS] = "errors",
+	[IPU_ISYS_STAT_DROPPED] = "dropped",
+	[IPU_ISYS_STAT_STREAMON] = "streamon",
+	[IPU_ISYS_STAT_RECOVERIES] = "recoveries",
+	[IPU_ISYS_STAT_RECOVERY_FAILURES] = "recovery_failures",
+	[IPU_ISYS_STAT_SKIPPED] = "skipped",
+	[IPU_ISYS_STAT_CPU_NS] = "cpu_ns",
+};
+
+/*
+ * The node counters, then the firmware queue figures of the device, the
+ * message pool and the error recovery timing of the pipeline the node
+ * belongs to.
+ */
+static ssize_t stats_show(struct device *dev, struct device_attribute *attr,
+			  char *buf)
+{
+	struct ipu_isys_video *av = video_get_drvdata(to_video_device(dev));
+	struct ipu_isys_fw_queue_stats *q = &av->isys->fw_queues;
+	struct ipu_isys_frame_stats *fs = &av->frame_stats;
+	u64 frames, span_us, fps_milli = 0;
+	unsigned long flags;
+	int len;
+
+	spin_lock_irqsave(&fs->lock, flags);
+	frames = fs->frames;
+	span_us = div_u64(fs->last_done_ns - fs->first_done_ns, NSEC_PER_USEC);
+	spin_unlock_irqrestore(&fs->lock, flags);
+	/* Rate between the first and the latest buffer since stream on */
+	if (frames > 1 && span_us)
+		fps_milli = div64_u64((frames - 1) * 1000000000ULL, span_us);
+
+	len = ipu_stats_print(&av->stats, buf, PAGE_SIZE);
+	len += scnprintf(buf + len, PAGE_SIZE - len,
+			 "fw_send_full %d\nfw_recv_level %u\n"
+			 "fw_recv_high_water %u\nfw_msgs_in_use %u\n"
+			 "fw_msgs_high_water %u\nrecovery_last_us %llu\n"
+			 "recovery_max_us %llu\nbw_mbs %u\n"
+			 "frames %llu\nfps_milli %llu\n",
+			 atomic_read(&q->send_full), READ_ONCE(q->recv_level),
+			 READ_ONCE(q->recv_high_water),
+			 READ_ONCE(av->ip.fw_msgs.in_use),
+			 READ_ONCE(av->ip.fw_msgs.high_water),
+			 div_u64(READ_ONCE(av->ip.recovery_last_ns),
+				 NSEC_PER_USEC),
+			 div_u64(READ_ONCE(av->ip.recovery_max_ns),
+				 NSEC_PER_USEC),
+			 READ_ONCE(av->ip.bw_mbs), frames, fps_milli);
+
+	return len;
+}
+
+static DEVICE_ATTR_RO(stats);
+
+static struct attribute *ipu_isys_video_attrs[] = {
+	&dev_attr_stats.attr,
+	NULL,
+};
+
+ATTRIBUTE_GROUPS(ipu_isys_video);
+
 /*
  * Do everything that's needed to initialise things related to video
  * buffer queue, video node, and the related media entity. The caller
@@ -1866,10 +2488,21 @@ int ipu_isys_video_init(struct ipu_isys_video *av,
 	init_completion(&av->ip.stream_close_completion);
 	init_completion(&av->ip.stream_start_completion);
 	init_completion(&av->ip.stream_stop_completion);
+	INIT_DELAYED_WORK(&av->ip.close_work, close_stream_work);
 	INIT_LIST_HEAD(&av->ip.queues);
 	spin_lock_init(&av->ip.short_packet_queue_lock);
+	INIT_LIST_HEAD(&av->ip.done_bufs);
+	spin_lock_init(&av->frame_stats.lock);
+	spin_lock_init(&av->ip.fw_msgs.lock);
+	INIT_LIST_HEAD(&av->ip.fw_msgs.free);
+	INIT_LIST_HEAD(&av->ip.fw_msgs.busy);
 	av->ip.isys = av->isys;
 
+	rval = ipu_stats_init(&av->stats, ipu_isys_stat_names,
+			      IPU_ISYS_STAT_NUM);
+	if (rval)
+		goto out_mutex_destroy;
+
 	if (!av->watermark) {
 		av->watermark = kzalloc(sizeof(*av->watermark), GFP_KERNEL);
 		if (!av->watermark) {
@@ -1906,6 +2539,7 @@ int ipu_isys_video_init(struct ipu_isys_video *av,
 		av->vdev.ioctl_ops = ioctl_ops;
 	av->vdev.queue = &av->aq.vbq;
 	av->vdev.lock = &av->mutex;
+	av->vdev.dev.groups = ipu_isys_video_groups;
 	set_bit(V4L2_FL_USES_V4L2_FH, &av->vdev.flags);
 	video_set_drvdata(&av->vdev, av);
 
@@ -1937,6 +2571,8 @@ int ipu_isys_video_init(struct ipu_isys_video *av,
 	}
 
 	av->pfmt = av->try_fmt_vid_mplane(av, &av->mpix);
+	av->compression =
+	    !!(av->mpix.flags & V4L2_PIX_FMT_FLAG_IPU_COMPRESSED);
 
 	av->initialized = true;
 	mutex_unlock(&av->mutex);
@@ -1953,6 +2589,7 @@ out_ipu_isys_queue_cleanup:
 
 out_mutex_destroy:
 	kfree(av->watermark);
+	ipu_stats_free(&av->stats);
 	mutex_destroy(&av->mutex);
 
 	return rval;
@@ -1963,9 +2600,12 @@ void ipu_isys_video_cleanup(struct ipu_isys_video *av)
 	if (!av->initialized)
 		return;
 
+	cancel_delayed_work_sync(&av->ip.close_work);
+	kfree(av->ip.open_cfg);
 	kfree(av->watermark);
 	video_unregister_device(&av->vdev);
 	media_entity_cleanup(&av->vdev.entity);
+	ipu_stats_free(&av->stats);
 	mutex_destroy(&av->mutex);
 	ipu_isys_queue_cleanup(&av->aq);
 	av->initialized = false;
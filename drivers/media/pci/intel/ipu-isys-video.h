@@ -12,10 +12,13 @@
 #include <media/v4l2-subdev.h>
 
 #include "ipu-isys-queue.h"
+#include "ipu-stats.h"
 
 #define IPU_ISYS_OUTPUT_PINS 11
 #define IPU_NUM_CAPTURE_DONE 2
 #define IPU_ISYS_MAX_PARALLEL_SOF 2
+/* Longest a firmware stream is kept open after stream off */
+#define IPU_ISYS_KEEP_OPEN_MAX_MS 5000
 
 struct ipu_isys;
 struct ipu_isys_csi2_be_soc;
@@ -39,6 +42,81 @@ struct output_pin_data {
 	void (*pin_ready)(struct ipu_isys_pipeline *ip,
 			  struct ipu_fw_isys_resp_info_abi *info);
 	struct ipu_isys_queue *aq;
+	/* Completed on STATS_DATA_READY, see ipu_isys_queue.stats_done */
+	bool metadata;
+};
+
+#define IPU_ISYS_LAT_BUCKETS	16
+
+/* Frame timing stages; buckets are log2 of the time in us */
+enum ipu_isys_lat_stage {
+	IPU_ISYS_LAT_SOF_EOF,
+	IPU_ISYS_LAT_EOF_READY,
+	IPU_ISYS_LAT_READY_DONE,
+	/* Change of the SOF to SOF interval between two frames */
+	IPU_ISYS_LAT_JITTER,
+	IPU_ISYS_LAT_NUM
+};
+
+/*
+ * Stream start phases, recorded as the time since stream on. The
+ * firmware opens the stream while the CSI-2 receiver and PHY power up.
+ */
+enum ipu_isys_startup_phase {
+	IPU_ISYS_STARTUP_OPEN_SENT,	/* STREAM_OPEN sent */
+	IPU_ISYS_STARTUP_SUBDEVS,	/* CSI-2 receiver and PHY up */
+	IPU_ISYS_STARTUP_OPEN,		/* STREAM_OPEN acknowledged */
+	IPU_ISYS_STARTUP_START,		/* STREAM_START acknowledged */
+	IPU_ISYS_STARTUP_SENSOR,	/* external sub-device streaming */
+	IPU_ISYS_STARTUP_FIRST_SOF,
+	IPU_ISYS_STARTUP_NUM
+};
+
+struct ipu_isys_lat_hist {
+	u64 buckets[IPU_ISYS_LAT_BUCKETS];
+	u64 count;
+	u64 sum_ns;
+	u64 max_ns;
+};
+
+/* Frame timing of one video node, recorded from the response path */
+struct ipu_isys_frame_stats {
+	spinlock_t lock;	/* Protects the fields below */
+	struct ipu_isys_lat_hist lat[IPU_ISYS_LAT_NUM];
+	bool has_sequence;
+	u32 last_sequence;
+	u64 dropped;
+	/* Buffers done since stream on, for the achieved frame rate */
+	u64 frames;
+	u64 first_done_ns;
+	u64 last_done_ns;
+};
+
+/* Per-CPU event counters of one video node, in sysfs as "stats" */
+enum ipu_isys_stat {
+	IPU_ISYS_STAT_QUEUED,
+	IPU_ISYS_STAT_DONE,
+	IPU_ISYS_STAT_ERRORS,
+	IPU_ISYS_STAT_DROPPED,
+	IPU_ISYS_STAT_STREAMON,
+	IPU_ISYS_STAT_RECOVERIES,
+	IPU_ISYS_STAT_RECOVERY_FAILURES,
+	IPU_ISYS_STAT_SKIPPED,
+	/* CPU time of the buffer ready and done handling */
+	IPU_ISYS_STAT_CPU_NS,
+	IPU_ISYS_STAT_NUM,
+};
+
+/* Firmware message buffers owned by one streaming pipeline */
+struct ipu_isys_fw_msg_pool {
+	spinlock_t lock;	/* Protects the lists and counters */
+	struct list_head free;
+	struct list_head busy;
+	unsigned int size;
+	unsigned int in_use;
+	unsigned int high_water;
+	/* Messages taken from the device wide list while the pool was empty */
+	unsigned long fallbacks;
 };
 
 struct ipu_isys_pipeline {
@@ -68,6 +146,14 @@ struct ipu_isys_pipeline {
 	struct completion stream_start_completion;
 	struct completion stream_stop_completion;
 	struct ipu_isys *isys;
+	/*
+	 * Stream left open at stream off for stream_close_delay_ms, see
+	 * ipu_isys_video_set_streaming(). open_cfg is what it was opened
+	 * with. close_pending is serialised by stream_mutex.
+	 */
+	struct delayed_work close_work;
+	bool close_pending;
+	struct ipu_fw_isys_stream_cfg_data_abi *open_cfg;
 
 	void (*capture_done[IPU_NUM_CAPTURE_DONE])
 	 (struct ipu_isys_pipeline *ip,
@@ -81,11 +167,17 @@ struct ipu_isys_pipeline {
 	unsigned int num_short_packet_lines;
 	unsigned int short_packet_output_pin;
 	unsigned int cur_field;
-	struct list_head short_packet_incoming;
-	struct list_head short_packet_active;
-	/* Serialize access to short packet active and incoming lists */
+	/*
+	 * short_packet_bufs is a ring: buffers from short_packet_tail up to
+	 * short_packet_head are with the firmware, oldest first.
+	 */
+	unsigned int short_packet_head;
+	unsigned int short_packet_tail;
+	/* Serialize access to the short packet ring indexes */
 	spinlock_t short_packet_queue_lock;
 	struct list_head pending_interlaced_bufs;
+	/* Buffers completed in the current response drain */
+	struct list_head done_bufs;
 	unsigned int short_packet_trace_index;
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 5, 0)
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0)
@@ -95,6 +187,28 @@ struct ipu_isys_pipeline {
 #endif
 #endif
 	struct media_entity_enum entity_enum;
+	struct ipu_isys_fw_msg_pool fw_msgs;
+	/* Latest frame timing in ns, response path only */
+	u64 sof_ns;
+	u64 eof_ns;
+	u64 sof_eof_ns;
+	u64 sof_interval_ns;
+	u64 jitter_ns;
+	unsigned int sof_count;
+	/* Stream configuration until the firmware has opened the stream */
+	struct ipu_fw_isys_stream_cfg_data_abi *stream_cfg;
+	u64 startup_ns;
+	u64 startup[IPU_ISYS_STARTUP_NUM];
+	/* Bandwidth admitted at stream on, see ipu_isys_bw_admit() */
+	u32 bw_mbs;
+	/* In-place error recovery, see ipu_isys_stream_recover() */
+	struct work_struct recovery_work;
+	bool recovery_pending;
+	unsigned int recoveries;	/* Since stream on */
+	/* Skipped buffers go back to the firmware from skip_work */
+	struct work_struct skip_work;
+	u64 recovery_last_ns;
+	u64 recovery_max_ns;
 };
 
 #define to_ipu_isys_pipeline(__pipe)				\
@@ -128,11 +242,20 @@ struct ipu_isys_video {
 	bool initialized;
 	struct v4l2_ctrl_handler ctrl_handler;
 	struct v4l2_ctrl *compression_ctrl;
+	struct v4l2_ctrl *watermark_ctrl;
+	unsigned int watermark_lines;	/* Programmed at stream on */
+	struct v4l2_ctrl *embedded_ctrl;
+	unsigned int embedded_lines;	/* In plane 1, latched by S_FMT */
+	struct v4l2_ctrl *keep_open_ctrl;
+	unsigned int skipped;	/* Frames skipped since stream on */
+	unsigned int fmt_gen;	/* Topology the link format was valid in */
 	unsigned int ts_offsets[VIDEO_MAX_PLANES];
 	unsigned int line_header_length;	/* bits */
 	unsigned int line_footer_length;	/* bits */
 
 	struct video_stream_watermark *watermark;
+	struct ipu_isys_frame_stats frame_stats;
+	struct ipu_stats stats;
 
 	const struct ipu_isys_pixelformat *
 		(*try_fmt_vid_mplane)(struct ipu_isys_video *av,
@@ -171,8 +294,13 @@ ipu_isys_prepare_fw_cfg_default(struct ipu_isys_video *av,
 				struct ipu_fw_isys_stream_cfg_data_abi *cfg);
 int ipu_isys_video_prepare_streaming(struct ipu_isys_video *av,
 				     unsigned int state);
+int ipu_isys_video_flush_streaming(struct ipu_isys_video *av);
+void ipu_isys_video_close_pending(struct ipu_isys *isys);
+int ipu_isys_video_restart_streaming(struct ipu_isys_video *av);
 int ipu_isys_video_set_streaming(struct ipu_isys_video *av, unsigned int state,
 				 struct ipu_isys_buffer_list *bl);
+void ipu_isys_stream_startup_mark(struct ipu_isys_pipeline *ip,
+				  enum ipu_isys_startup_phase phase);
 int ipu_isys_video_init(struct ipu_isys_video *av, struct media_entity *source,
 			unsigned int source_pad, unsigned long pad_flags,
 			unsigned int flags);
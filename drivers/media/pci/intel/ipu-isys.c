@@ -34,6 +34,7 @@ LINUX_VERSION_CODE >= KERNEL_VERSION(6, 6, 0)
 #include "ipu-cpd.h"
 #include "ipu-mmu.h"
 #include "ipu-dma.h"
+#include "ipu-gpc-pmu.h"
 #include "ipu-isys.h"
 #include "ipu-isys-csi2.h"
 #include "ipu-isys-video.h"
@@ -42,7 +43,11 @@ LINUX_VERSION_CODE >= KERNEL_VERSION(6, 6, 0)
 #include "ipu-platform.h"
 #include "ipu-platform-buttress-regs.h"
 
+/* CPU latency while powered without tracked streams, in us */
 #define ISYS_PM_QOS_VALUE	300
+/* Bounds of the latency derived from the active streams, in us */
+#define ISYS_PM_QOS_MIN		50
+#define ISYS_PM_QOS_MAX		2000
 
 #define IPU_BUTTRESS_FABIC_CONTROL		0x68
 #define GDA_ENABLE_IWAKE_INDEX			2
@@ -89,6 +94,40 @@ LINUX_VERSION_CODE >= KERNEL_VERSION(6, 6, 0)
  */
 #define CRITICAL_THRESHOLD_IWAKE_DISABLE	(IS_PIXEL_BUFFER_PAGES * 3 / 4)
 
+/* iwake tuning: clean frames before a step up, and the step in percent */
+#define IPU_ISYS_IWAKE_TUNE_FRAMES	1000
+#define IPU_ISYS_IWAKE_TUNE_STEP	5
+#define IPU_ISYS_IWAKE_TUNE_MAX_PCT	200
+
+#define IPU_ISYS_ISR_BUDGET	64
+
+static unsigned int isr_budget = IPU_ISYS_ISR_BUDGET;
+module_param(isr_budget, uint, 0664);
+MODULE_PARM_DESC(isr_budget,
+		 "Firmware responses handled per interrupt before deferring to a worker");
+
+#define IPU_ISYS_IRQ_POLL_ROUNDS	8
+
+static unsigned int irq_poll_us;
+module_param(irq_poll_us, uint, 0664);
+MODULE_PARM_DESC(irq_poll_us,
+		 "Poll for firmware responses every this many us after an interrupt, 0 to disable");
+
+static unsigned int irq_poll_rounds = IPU_ISYS_IRQ_POLL_ROUNDS;
+module_param(irq_poll_rounds, uint, 0664);
+MODULE_PARM_DESC(irq_poll_rounds,
+		 "Polls finding responses before waiting for an interrupt again");
+
+static unsigned int autosuspend_ms;
+module_param(autosuspend_ms, uint, 0444);
+MODULE_PARM_DESC(autosuspend_ms,
+		 "Keep ISYS powered this many ms after the last user, 0 to power off at once");
+
+static unsigned int autosuspend_max_ms;
+module_param(autosuspend_max_ms, uint, 0444);
+MODULE_PARM_DESC(autosuspend_max_ms,
+		 "Adapt the ISYS autosuspend delay to stop-start gaps up to this many ms");
+
 union fabric_ctrl {
 	struct {
 		u16 ltr_val   : 10;
@@ -561,6 +600,85 @@ static int enable_iwake(struct ipu_isys *isys, bool enable)
 	return ret;
 }
 
+/*
+ * Apply pm_qos_value while powered and the default otherwise. The request
+ * may sleep, so it is made outside power_lock; pm_qos_mutex keeps the
+ * last one made matching the latest power state and value.
+ */
+static void isys_pm_qos_apply(struct ipu_isys *isys)
+{
+	unsigned long flags;
+	s32 value;
+
+	mutex_lock(&isys->pm_qos_mutex);
+	spin_lock_irqsave(&isys->power_lock, flags);
+	value = isys->power ? isys->pm_qos_value : PM_QOS_DEFAULT_VALUE;
+	spin_unlock_irqrestore(&isys->power_lock, flags);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+	cpu_latency_qos_update_request(&isys->pm_qos, value);
+#else
+	pm_qos_update_request(&isys->pm_qos, value);
+#endif
+	mutex_unlock(&isys->pm_qos_mutex);
+}
+
+/*
+ * Derive the CPU latency request from the streams on the watermark list.
+ * The pixel buffer fills in max_sram_size / aggregate data rate, and
+ * frame events of the fastest stream should be served within a quarter
+ * of its frame time. Allow half the fill time and at most that quarter.
+ */
+void ipu_isys_update_pm_qos(struct ipu_isys *isys)
+{
+	struct isys_iwake_watermark *iwake_watermark = isys->iwake_watermark;
+	struct video_stream_watermark *p_watermark;
+	u64 datarate_mbs = 0, frame_ns, min_frame_ns = 0;
+	s32 value = ISYS_PM_QOS_VALUE;
+	unsigned long flags;
+	u64 limit_us;
+	int max_sram_size =
+		(ipu_ver == IPU_VER_6 || ipu_ver == IPU_VER_6EP ||
+		 ipu_ver == IPU_VER_6EP_MTL) ?
+		IPU6_MAX_SRAM_SIZE : IPU6SE_MAX_SRAM_SIZE;
+
+	mutex_lock(&iwake_watermark->mutex);
+	list_for_each_entry(p_watermark, &iwake_watermark->video_list,
+			    stream_node) {
+		datarate_mbs += p_watermark->stream_data_rate;
+		if (!p_watermark->pixel_rate)
+			continue;
+		frame_ns = div64_u64((u64)(p_watermark->width +
+					   p_watermark->hblank) *
+				     (p_watermark->height +
+				      p_watermark->vblank) * NSEC_PER_SEC,
+				     p_watermark->pixel_rate);
+		if (!min_frame_ns || frame_ns < min_frame_ns)
+			min_frame_ns = frame_ns;
+	}
+	mutex_unlock(&iwake_watermark->mutex);
+
+	if (datarate_mbs) {
+		limit_us = div64_u64(max_sram_size, datarate_mbs) / 2;
+		if (min_frame_ns)
+			limit_us = min(limit_us,
+				       div_u64(min_frame_ns, 4 * NSEC_PER_USEC));
+		value = clamp_t(u64, limit_us, ISYS_PM_QOS_MIN,
+				ISYS_PM_QOS_MAX);
+	}
+
+	spin_lock_irqsave(&isys->power_lock, flags);
+	if (value == isys->pm_qos_value) {
+		spin_unlock_irqrestore(&isys->power_lock, flags);
+		return;
+	}
+	isys->pm_qos_value = value;
+	spin_unlock_irqrestore(&isys->power_lock, flags);
+
+	dev_dbg(&isys->adev->dev, "cpu latency qos %d us\n", value);
+	isys_pm_qos_apply(isys);
+}
+
 void update_watermark_setting(struct ipu_isys *isys)
 {
 	struct isys_iwake_watermark *iwake_watermark = isys->iwake_watermark;
@@ -640,6 +758,11 @@ void update_watermark_setting(struct ipu_isys *isys)
 		ltr_did_type = LTR_IWAKE_ON;
 	}
 
+	if (READ_ONCE(iwake_watermark->auto_tune))
+		did = min_t(u32, (u32)did *
+			    READ_ONCE(iwake_watermark->tune_pct) / 100,
+			    U16_MAX);
+
 	threshold_bytes = did * isys_pb_datarate_mbs;
 	/* calculate iwake threshold with 2KB granularity pages */
 	iwake_threshold =
@@ -684,6 +807,12 @@ void update_watermark_setting(struct ipu_isys *isys)
 
 	set_iwake_register(isys, GDA_IRQ_CRITICAL_THRESHOLD_INDEX,
 			   iwake_critical_threshold);
+	iwake_watermark->ltr = ltr;
+	iwake_watermark->did = did;
+	iwake_watermark->iwake_threshold =
+		(ipu_ver == IPU_VER_6EP_MTL || ipu_ver == IPU_VER_6EP) ?
+		DEFAULT_IWAKE_THRESHOLD : iwake_threshold;
+	iwake_watermark->critical_threshold = iwake_critical_threshold;
 	mutex_unlock(&iwake_watermark->mutex);
 
 	writel(VAL_PKGC_PMON_CFG_RESET,
@@ -692,6 +821,80 @@ void update_watermark_setting(struct ipu_isys *isys)
 	       isys->adev->isp->base + REG_PKGC_PMON_CFG);
 }
 
+/*
+ * One tuning step: back off by a quarter after an overflow, creep up
+ * after IPU_ISYS_IWAKE_TUNE_FRAMES clean frames, and rewrite the
+ * watermarks if that changed anything.
+ */
+static void isys_iwake_tune_work(struct work_struct *work)
+{
+	struct isys_iwake_watermark *w =
+		container_of(work, struct isys_iwake_watermark, tune_work);
+	struct ipu_isys *isys = w->isys;
+	unsigned int overflows = atomic_xchg(&w->overflows, 0);
+	bool changed;
+	u32 pct;
+
+	mutex_lock(&w->mutex);
+	pct = w->tune_pct;
+	if (overflows) {
+		pct = pct * 3 / 4;
+		w->total_overflows += overflows;
+	} else if (atomic_read(&w->clean_frames) >=
+		   IPU_ISYS_IWAKE_TUNE_FRAMES) {
+		atomic_set(&w->clean_frames, 0);
+		pct += IPU_ISYS_IWAKE_TUNE_STEP;
+	}
+	pct = clamp(pct, w->floor_pct, w->ceil_pct);
+	changed = pct != w->tune_pct;
+	w->tune_pct = pct;
+	mutex_unlock(&w->mutex);
+
+	if (!changed || pm_runtime_get_if_in_use(&isys->adev->dev) <= 0)
+		return;
+
+	dev_dbg(&isys->adev->dev, "iwake tuned to %u%%\n", pct);
+	mutex_lock(&isys->stream_mutex);
+	if (isys->stream_opened)
+		update_watermark_setting(isys);
+	mutex_unlock(&isys->stream_mutex);
+	pm_runtime_put(&isys->adev->dev);
+}
+
+/* The streams changed, start again from the formula. Call with mutex */
+void ipu_isys_iwake_mix_changed(struct isys_iwake_watermark *w)
+{
+	lockdep_assert_held(&w->mutex);
+
+	w->tune_pct = clamp(100U, w->floor_pct, w->ceil_pct);
+	atomic_set(&w->clean_frames, 0);
+}
+
+/* A pixel buffer overflow seen by a CSI-2 receiver, any context */
+void ipu_isys_iwake_overflow(struct ipu_isys *isys)
+{
+	struct isys_iwake_watermark *w = isys->iwake_watermark;
+
+	if (!w || !READ_ONCE(w->auto_tune))
+		return;
+
+	atomic_inc(&w->overflows);
+	atomic_set(&w->clean_frames, 0);
+	schedule_work(&w->tune_work);
+}
+
+/* A start of frame of any stream, from the response path */
+void ipu_isys_iwake_frame(struct ipu_isys *isys)
+{
+	struct isys_iwake_watermark *w = isys->iwake_watermark;
+
+	if (!w || !READ_ONCE(w->auto_tune))
+		return;
+
+	if (atomic_inc_return(&w->clean_frames) == IPU_ISYS_IWAKE_TUNE_FRAMES)
+		schedule_work(&w->tune_work);
+}
+
 static int isys_iwake_watermark_init(struct ipu_isys *isys)
 {
 	struct isys_iwake_watermark *iwake_watermark;
@@ -711,6 +914,10 @@ static int isys_iwake_watermark_init(struct ipu_isys *isys)
 	iwake_watermark->isys = isys;
 	iwake_watermark->iwake_enabled = false;
 	iwake_watermark->force_iwake_disable = false;
+	iwake_watermark->tune_pct = 100;
+	iwake_watermark->floor_pct = 25;
+	iwake_watermark->ceil_pct = 100;
+	INIT_WORK(&iwake_watermark->tune_work, isys_iwake_tune_work);
 	return 0;
 }
 
@@ -720,6 +927,7 @@ static int isys_iwake_watermark_cleanup(struct ipu_isys *isys)
 
 	if (!iwake_watermark)
 		return -EINVAL;
+	cancel_work_sync(&iwake_watermark->tune_work);
 	mutex_lock(&iwake_watermark->mutex);
 	list_del(&iwake_watermark->video_list);
 	mutex_unlock(&iwake_watermark->mutex);
@@ -754,6 +962,7 @@ static void isys_notifier_unbind(struct v4l2_async_notifier *notifier,
 					struct ipu_isys, notifier);
 
 	dev_info(&isys->adev->dev, "unbind %s\n", sd->name);
+	ipu_isys_topology_changed(isys);
 }
 #else
 static int isys_notifier_bound(struct v4l2_async_notifier *notifier,
@@ -791,6 +1000,7 @@ static void isys_notifier_unbind(struct v4l2_async_notifier *notifier,
 					struct ipu_isys, notifier);
 
 	dev_info(&isys->adev->dev, "unbind %s\n", sd->name);
+	ipu_isys_topology_changed(isys);
 }
 #endif
 
@@ -800,6 +1010,7 @@ static int isys_notifier_complete(struct v4l2_async_notifier *notifier)
 					struct ipu_isys, notifier);
 
 	dev_info(&isys->adev->dev, "All sensor registration completed.\n");
+	ipu_isys_topology_changed(isys);
 
 	return v4l2_device_register_subdev_nodes(&isys->v4l2_dev);
 }
@@ -974,11 +1185,31 @@ static void isys_notifier_cleanup(struct ipu_isys *isys)
 }
 #endif
 
-static struct media_device_ops isys_mdev_ops = {
+static int isys_link_notify(struct media_link *link, u32 flags,
+			    unsigned int notification)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 5, 0)
+	struct media_device *mdev = link->source->entity->parent;
+#else
+	struct media_device *mdev = link->graph_obj.mdev;
+#endif
+	struct ipu_isys *isys = container_of(mdev, struct ipu_isys, media_dev);
+
+	if (notification == MEDIA_DEV_NOTIFY_POST_LINK_CH)
+		ipu_isys_topology_changed(isys);
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(4, 6, 0)
-	.link_notify = ipu_pipeline_link_notify,
+	return ipu_pipeline_link_notify(link, flags, notification);
 #else
-	.link_notify = v4l2_pipeline_link_notify,
+	return v4l2_pipeline_link_notify(link, flags, notification);
+#endif
+}
+
+static struct media_device_ops isys_mdev_ops = {
+	.link_notify = isys_link_notify,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 20, 0)
+	.req_validate = ipu_isys_req_validate,
+	.req_queue = vb2_request_queue,
 #endif
 };
 
@@ -989,10 +1220,8 @@ static int isys_register_devices(struct ipu_isys *isys)
 	isys->media_dev.dev = &isys->adev->dev;
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 9, 12)
 	isys->media_dev.ops = &isys_mdev_ops;
-#elif LINUX_VERSION_CODE < KERNEL_VERSION(4, 6, 0)
-	isys->media_dev.link_notify = ipu_pipeline_link_notify;
 #else
-	isys->media_dev.link_notify = v4l2_pipeline_link_notify;
+	isys->media_dev.link_notify = isys_link_notify;
 #endif
 	strscpy(isys->media_dev.model,
 		IPU_MEDIA_DEV_MODEL_NAME, sizeof(isys->media_dev.model));
@@ -1082,12 +1311,6 @@ static int isys_runtime_pm_resume(struct device *dev)
 
 	ipu_trace_restore(dev);
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
-	cpu_latency_qos_update_request(&isys->pm_qos, ISYS_PM_QOS_VALUE);
-#else
-	pm_qos_update_request(&isys->pm_qos, ISYS_PM_QOS_VALUE);
-#endif
-
 	ret = ipu_buttress_start_tsc_sync(isp);
 	if (ret)
 		return ret;
@@ -1095,6 +1318,10 @@ static int isys_runtime_pm_resume(struct device *dev)
 	spin_lock_irqsave(&isys->power_lock, flags);
 	isys->power = 1;
 	spin_unlock_irqrestore(&isys->power_lock, flags);
+	isys_pm_qos_apply(isys);
+#ifdef IPU_ISYS_GPC
+	ipu_gpc_pmu_resume(isys->gpc_pmu);
+#endif
 
 	if (isys->short_packet_source == IPU_ISYS_SHORT_PACKET_FROM_TUNIT) {
 		mutex_lock(&isys->short_packet_tracing_mutex);
@@ -1116,21 +1343,24 @@ static int isys_runtime_pm_suspend(struct device *dev)
 	if (!isys)
 		return 0;
 
+#ifdef IPU_ISYS_GPC
+	ipu_gpc_pmu_suspend(isys->gpc_pmu);
+#endif
 	spin_lock_irqsave(&isys->power_lock, flags);
 	isys->power = 0;
+	isys->resp_deferred = false;
 	spin_unlock_irqrestore(&isys->power_lock, flags);
+	isys_pm_qos_apply(isys);
+	hrtimer_cancel(&isys->resp_timer);
+	cancel_work_sync(&isys->resp_work);
 
+	ipu_isys_csi2_phy_idle_off(isys);
 	ipu_trace_stop(dev);
 	mutex_lock(&isys->mutex);
 	isys->reset_needed = false;
 	mutex_unlock(&isys->mutex);
 
 	isys->phy_termcal_val = 0;
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
-	cpu_latency_qos_update_request(&isys->pm_qos, PM_QOS_DEFAULT_VALUE);
-#else
-	pm_qos_update_request(&isys->pm_qos, PM_QOS_DEFAULT_VALUE);
-#endif
 
 	ipu_mmu_hw_cleanup(adev->mmu);
 
@@ -1142,12 +1372,17 @@ static int isys_suspend(struct device *dev)
 {
 	struct ipu_bus_device *adev = to_ipu_bus_device(dev);
 	struct ipu_isys *isys = ipu_bus_get_drvdata(adev);
+	int rval = 0;
 
+	/* Streams only kept open after stream off don't hold suspend off */
+	mutex_lock(&isys->stream_mutex);
+	ipu_isys_video_close_pending(isys);
 	/* If stream is open, refuse to suspend */
 	if (isys->stream_opened)
-		return -EBUSY;
+		rval = -EBUSY;
+	mutex_unlock(&isys->stream_mutex);
 
-	return 0;
+	return rval;
 }
 
 static int isys_resume(struct device *dev)
@@ -1174,6 +1409,8 @@ static void isys_remove(struct ipu_bus_device *adev)
 	struct isys_fw_msgs *fwmsg, *safe;
 
 	dev_info(&adev->dev, "removed\n");
+	hrtimer_cancel(&isys->resp_timer);
+	cancel_work_sync(&isys->resp_work);
 #ifdef CONFIG_DEBUG_FS
 	if (isp->ipu_dir)
 		debugfs_remove_recursive(isys->debugfsdir);
@@ -1202,9 +1439,13 @@ static void isys_remove(struct ipu_bus_device *adev)
 
 	isys_iwake_watermark_cleanup(isys);
 
+#ifdef IPU_ISYS_GPC
+	ipu_gpc_pmu_unregister(isys->gpc_pmu);
+#endif
 	ipu_trace_uninit(&adev->dev);
 	isys_notifier_cleanup(isys);
 	isys_unregister_devices(isys);
+	ipu_isys_dmabuf_cache_cleanup(&isys->dmabuf_cache);
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
 	cpu_latency_qos_remove_request(&isys->pm_qos);
@@ -1220,6 +1461,7 @@ static void isys_remove(struct ipu_bus_device *adev)
 		release_firmware(isys->fw);
 	}
 
+	mutex_destroy(&isys->pm_qos_mutex);
 	mutex_destroy(&isys->stream_mutex);
 	mutex_destroy(&isys->mutex);
 
@@ -1300,6 +1542,115 @@ static int isys_iwake_control_set(void *data, u64 val)
 	return 0;
 }
 
+static int isys_iwake_auto_tune_get(void *data, u64 *val)
+{
+	struct ipu_isys *isys = data;
+
+	*val = READ_ONCE(isys->iwake_watermark->auto_tune);
+
+	return 0;
+}
+
+static int isys_iwake_auto_tune_set(void *data, u64 val)
+{
+	struct ipu_isys *isys = data;
+	struct isys_iwake_watermark *w = isys->iwake_watermark;
+
+	if (val != !!val)
+		return -EINVAL;
+
+	mutex_lock(&w->mutex);
+	w->auto_tune = val;
+	ipu_isys_iwake_mix_changed(w);
+	mutex_unlock(&w->mutex);
+
+	return 0;
+}
+
+static int isys_iwake_floor_get(void *data, u64 *val)
+{
+	struct ipu_isys *isys = data;
+
+	*val = READ_ONCE(isys->iwake_watermark->floor_pct);
+
+	return 0;
+}
+
+static int isys_iwake_floor_set(void *data, u64 val)
+{
+	struct ipu_isys *isys = data;
+	struct isys_iwake_watermark *w = isys->iwake_watermark;
+	int ret = 0;
+
+	mutex_lock(&w->mutex);
+	if (!val || val > w->ceil_pct)
+		ret = -EINVAL;
+	else
+		w->floor_pct = val;
+	mutex_unlock(&w->mutex);
+
+	return ret;
+}
+
+static int isys_iwake_ceil_get(void *data, u64 *val)
+{
+	struct ipu_isys *isys = data;
+
+	*val = READ_ONCE(isys->iwake_watermark->ceil_pct);
+
+	return 0;
+}
+
+static int isys_iwake_ceil_set(void *data, u64 val)
+{
+	struct ipu_isys *isys = data;
+	struct isys_iwake_watermark *w = isys->iwake_watermark;
+	int ret = 0;
+
+	mutex_lock(&w->mutex);
+	if (val < w->floor_pct || val > IPU_ISYS_IWAKE_TUNE_MAX_PCT)
+		ret = -EINVAL;
+	else
+		w->ceil_pct = val;
+	mutex_unlock(&w->mutex);
+
+	return ret;
+}
+
+DEFINE_SIMPLE_ATTRIBUTE(isys_iwake_auto_tune_fops, isys_iwake_auto_tune_get,
+			isys_iwake_auto_tune_set, "%llu\n");
+DEFINE_SIMPLE_ATTRIBUTE(isys_iwake_floor_fops, isys_iwake_floor_get,
+			isys_iwake_floor_set, "%llu\n");
+DEFINE_SIMPLE_ATTRIBUTE(isys_iwake_ceil_fops, isys_iwake_ceil_get,
+			isys_iwake_ceil_set, "%llu\n");
+
+static ssize_t isys_iwake_state_read(struct file *file, char __user *buf,
+				     size_t len, loff_t *ppos)
+{
+	struct ipu_isys *isys = file->private_data;
+	struct isys_iwake_watermark *w = isys->iwake_watermark;
+	char tmp[192];
+	int n;
+
+	mutex_lock(&w->mutex);
+	n = scnprintf(tmp, sizeof(tmp),
+		      "enabled %u\nauto_tune %u\ntune_pct %u\nltr %u\n"
+		      "did %u\nthreshold %u\ncritical %u\noverflows %llu\n",
+		      w->iwake_enabled, w->auto_tune, w->tune_pct, w->ltr,
+		      w->did, w->iwake_threshold, w->critical_threshold,
+		      w->total_overflows + atomic_read(&w->overflows));
+	mutex_unlock(&w->mutex);
+
+	return simple_read_from_buffer(buf, len, ppos, tmp, n);
+}
+
+static const struct file_operations isys_iwake_state_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = isys_iwake_state_read,
+	.llseek = default_llseek,
+};
+
 DEFINE_SIMPLE_ATTRIBUTE(isys_icache_prefetch_fops,
 			ipu_isys_icache_prefetch_get,
 			ipu_isys_icache_prefetch_set, "%llu\n");
@@ -1308,6 +1659,273 @@ DEFINE_SIMPLE_ATTRIBUTE(isys_iwake_control_fops,
 			isys_iwake_control_get,
 			isys_iwake_control_set, "%llu\n");
 
+#define IPU_ISYS_FW_MSG_POOLS_DUMP_SIZE	1024
+
+static ssize_t isys_fw_msg_pools_read(struct file *file, char __user *buf,
+				      size_t len, loff_t *ppos)
+{
+	struct ipu_isys *isys = file->private_data;
+	struct ipu_isys_fw_msg_pool *pool;
+	unsigned long flags;
+	ssize_t ret;
+	char *tmp;
+	int n = 0;
+	int i;
+
+	tmp = kzalloc(IPU_ISYS_FW_MSG_POOLS_DUMP_SIZE, GFP_KERNEL);
+	if (!tmp)
+		return -ENOMEM;
+
+	spin_lock_irqsave(&isys->lock, flags);
+	for (i = 0; i < IPU_ISYS_MAX_STREAMS; i++) {
+		if (!isys->pipes[i])
+			continue;
+		pool = &isys->pipes[i]->fw_msgs;
+		spin_lock(&pool->lock);
+		n += scnprintf(tmp + n, IPU_ISYS_FW_MSG_POOLS_DUMP_SIZE - n,
+			       "stream %d: size %u in_use %u high_water %u fallbacks %lu\n",
+			       i, pool->size, pool->in_use, pool->high_water,
+			       pool->fallbacks);
+		spin_unlock(&pool->lock);
+	}
+	spin_unlock_irqrestore(&isys->lock, flags);
+
+	ret = simple_read_from_buffer(buf, len, ppos, tmp, n);
+	kfree(tmp);
+
+	return ret;
+}
+
+static const struct file_operations isys_fw_msg_pools_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = isys_fw_msg_pools_read,
+	.llseek = default_llseek,
+};
+
+static ssize_t isys_fw_queues_read(struct file *file, char __user *buf,
+				   size_t len, loff_t *ppos)
+{
+	struct ipu_isys *isys = file->private_data;
+	struct ipu_isys_fw_queue_stats *stats = &isys->fw_queues;
+	char tmp[256];
+	int n;
+
+	n = scnprintf(tmp, sizeof(tmp),
+		      "send_size %u recv_size %u\n"
+		      "max_streams %u max_depth %u\n"
+		      "send_full %d\n"
+		      "recv_high_water %u recv_full %u\n"
+		      "isr_deferrals %lu\n",
+		      stats->send_size, stats->recv_size,
+		      stats->max_streams, stats->max_depth,
+		      atomic_read(&stats->send_full),
+		      stats->recv_high_water, stats->recv_full,
+		      isys->resp_deferrals);
+
+	return simple_read_from_buffer(buf, len, ppos, tmp, n);
+}
+
+static ssize_t isys_irq_stats_read(struct file *file, char __user *buf,
+				   size_t len, loff_t *ppos)
+{
+	struct ipu_isys *isys = file->private_data;
+	unsigned long flags;
+	char tmp[256];
+	int n;
+
+	spin_lock_irqsave(&isys->power_lock, flags);
+	n = scnprintf(tmp, sizeof(tmp),
+		      "poll_us %u poll_rounds %u\n"
+		      "irqs %lu responses %lu\n"
+		      "polls %lu polled_responses %lu\n",
+		      irq_poll_us, irq_poll_rounds,
+		      isys->irq_count, isys->irq_responses,
+		      isys->irq_polls, isys->irq_polled_responses);
+	spin_unlock_irqrestore(&isys->power_lock, flags);
+
+	return simple_read_from_buffer(buf, len, ppos, tmp, n);
+}
+
+static const struct file_operations isys_irq_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = isys_irq_stats_read,
+	.llseek = default_llseek,
+};
+
+static const struct file_operations isys_fw_queues_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = isys_fw_queues_read,
+	.llseek = default_llseek,
+};
+
+#define IPU_ISYS_FRAME_LAT_DUMP_SIZE	8192
+
+static const char * const ipu_isys_lat_names[IPU_ISYS_LAT_NUM] = {
+	[IPU_ISYS_LAT_SOF_EOF] = "sof_eof",
+	[IPU_ISYS_LAT_EOF_READY] = "eof_ready",
+	[IPU_ISYS_LAT_READY_DONE] = "ready_done",
+	[IPU_ISYS_LAT_JITTER] = "jitter",
+};
+
+static ssize_t isys_frame_latency_read(struct file *file, char __user *buf,
+				       size_t len, loff_t *ppos)
+{
+	struct ipu_isys *isys = file->private_data;
+	struct ipu_isys_frame_stats *stats;
+	struct ipu_isys_lat_hist hist[IPU_ISYS_LAT_NUM];
+	struct ipu_isys_video *av;
+	unsigned long flags;
+	u64 dropped;
+	ssize_t ret;
+	char *tmp;
+	int n = 0;
+	int i, j, k;
+
+	tmp = kzalloc(IPU_ISYS_FRAME_LAT_DUMP_SIZE, GFP_KERNEL);
+	if (!tmp)
+		return -ENOMEM;
+
+	n += scnprintf(tmp + n, IPU_ISYS_FRAME_LAT_DUMP_SIZE - n,
+		       "buckets(us):");
+	for (j = 0; j < IPU_ISYS_LAT_BUCKETS - 1; j++)
+		n += scnprintf(tmp + n, IPU_ISYS_FRAME_LAT_DUMP_SIZE - n,
+			       " <%u", 1U << j);
+	n += scnprintf(tmp + n, IPU_ISYS_FRAME_LAT_DUMP_SIZE - n, " >=%u\n",
+		       1U << (IPU_ISYS_LAT_BUCKETS - 2));
+
+	for (k = 0; k < NR_OF_CSI2_BE_SOC_DEV; k++) {
+		av = &isys->csi2_be_soc[k].av;
+		stats = &av->frame_stats;
+
+		spin_lock_irqsave(&stats->lock, flags);
+		memcpy(hist, stats->lat, sizeof(hist));
+		dropped = stats->dropped;
+		spin_unlock_irqrestore(&stats->lock, flags);
+
+		if (!hist[IPU_ISYS_LAT_READY_DONE].count)
+			continue;
+
+		n += scnprintf(tmp + n, IPU_ISYS_FRAME_LAT_DUMP_SIZE - n,
+			       "%s: dropped %llu\n", av->vdev.name, dropped);
+		for (i = 0; i < IPU_ISYS_LAT_NUM; i++) {
+			n += scnprintf(tmp + n,
+				       IPU_ISYS_FRAME_LAT_DUMP_SIZE - n,
+				       "  %s: count %llu avg %llu max %llu us:",
+				       ipu_isys_lat_names[i], hist[i].count,
+				       hist[i].count ?
+				       div64_u64(hist[i].sum_ns,
+						 hist[i].count * NSEC_PER_USEC) :
+				       0,
+				       div_u64(hist[i].max_ns, NSEC_PER_USEC));
+			for (j = 0; j < IPU_ISYS_LAT_BUCKETS; j++)
+				n += scnprintf(tmp + n,
+					       IPU_ISYS_FRAME_LAT_DUMP_SIZE - n,
+					       " %llu", hist[i].buckets[j]);
+			n += scnprintf(tmp + n,
+				       IPU_ISYS_FRAME_LAT_DUMP_SIZE - n, "\n");
+		}
+	}
+
+	ret = simple_read_from_buffer(buf, len, ppos, tmp, n);
+	kfree(tmp);
+
+	return ret;
+}
+
+static const struct file_operations isys_frame_latency_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = isys_frame_latency_read,
+	.llseek = default_llseek,
+};
+
+#define IPU_ISYS_STARTUP_DUMP_SIZE	2048
+
+static const char * const ipu_isys_startup_names[IPU_ISYS_STARTUP_NUM] = {
+	[IPU_ISYS_STARTUP_OPEN_SENT] = "open_sent",
+	[IPU_ISYS_STARTUP_SUBDEVS] = "subdevs",
+	[IPU_ISYS_STARTUP_OPEN] = "open",
+	[IPU_ISYS_STARTUP_START] = "start",
+	[IPU_ISYS_STARTUP_SENSOR] = "sensor",
+	[IPU_ISYS_STARTUP_FIRST_SOF] = "first_sof",
+};
+
+/* Latest stream start of each pipeline, in us since stream on */
+static ssize_t isys_stream_startup_read(struct file *file, char __user *buf,
+					size_t len, loff_t *ppos)
+{
+	struct ipu_isys *isys = file->private_data;
+	struct ipu_isys_pipeline *ip;
+	ssize_t ret;
+	char *tmp;
+	int n = 0;
+	int i, k;
+
+	tmp = kzalloc(IPU_ISYS_STARTUP_DUMP_SIZE, GFP_KERNEL);
+	if (!tmp)
+		return -ENOMEM;
+
+	for (k = 0; k < NR_OF_CSI2_BE_SOC_DEV; k++) {
+		ip = &isys->csi2_be_soc[k].av.ip;
+
+		if (!ip->startup_ns)
+			continue;
+
+		n += scnprintf(tmp + n, IPU_ISYS_STARTUP_DUMP_SIZE - n, "%s:",
+			       isys->csi2_be_soc[k].av.vdev.name);
+		for (i = 0; i < IPU_ISYS_STARTUP_NUM; i++)
+			n += scnprintf(tmp + n, IPU_ISYS_STARTUP_DUMP_SIZE - n,
+				       " %s %llu", ipu_isys_startup_names[i],
+				       div_u64(READ_ONCE(ip->startup[i]),
+					       NSEC_PER_USEC));
+		n += scnprintf(tmp + n, IPU_ISYS_STARTUP_DUMP_SIZE - n, "\n");
+	}
+
+	ret = simple_read_from_buffer(buf, len, ppos, tmp, n);
+	kfree(tmp);
+
+	return ret;
+}
+
+static const struct file_operations isys_stream_startup_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = isys_stream_startup_read,
+	.llseek = default_llseek,
+};
+
+#define IPU_ISYS_DMABUF_CACHE_DUMP_SIZE	256
+
+static ssize_t isys_dmabuf_cache_read(struct file *file, char __user *buf,
+				      size_t len, loff_t *ppos)
+{
+	struct ipu_isys *isys = file->private_data;
+	ssize_t ret;
+	char *tmp;
+	int n;
+
+	tmp = kzalloc(IPU_ISYS_DMABUF_CACHE_DUMP_SIZE, GFP_KERNEL);
+	if (!tmp)
+		return -ENOMEM;
+
+	n = ipu_isys_dmabuf_cache_print(&isys->dmabuf_cache, tmp,
+					IPU_ISYS_DMABUF_CACHE_DUMP_SIZE);
+	ret = simple_read_from_buffer(buf, len, ppos, tmp, n);
+	kfree(tmp);
+
+	return ret;
+}
+
+static const struct file_operations isys_dmabuf_cache_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = isys_dmabuf_cache_read,
+	.llseek = default_llseek,
+};
+
 static int ipu_isys_init_debugfs(struct ipu_isys *isys)
 {
 	struct dentry *file;
@@ -1330,6 +1948,56 @@ static int ipu_isys_init_debugfs(struct ipu_isys *isys)
 	if (IS_ERR(file))
 		goto err;
 
+	file = debugfs_create_file("iwake_auto_tune", 0600,
+				   dir, isys, &isys_iwake_auto_tune_fops);
+	if (IS_ERR(file))
+		goto err;
+
+	file = debugfs_create_file("iwake_floor_pct", 0600,
+				   dir, isys, &isys_iwake_floor_fops);
+	if (IS_ERR(file))
+		goto err;
+
+	file = debugfs_create_file("iwake_ceil_pct", 0600,
+				   dir, isys, &isys_iwake_ceil_fops);
+	if (IS_ERR(file))
+		goto err;
+
+	file = debugfs_create_file("iwake", 0400,
+				   dir, isys, &isys_iwake_state_fops);
+	if (IS_ERR(file))
+		goto err;
+
+	file = debugfs_create_file("fw_msg_pools", 0400,
+				   dir, isys, &isys_fw_msg_pools_fops);
+	if (IS_ERR(file))
+		goto err;
+
+	file = debugfs_create_file("fw_queues", 0400,
+				   dir, isys, &isys_fw_queues_fops);
+	if (IS_ERR(file))
+		goto err;
+
+	file = debugfs_create_file("irq_stats", 0400,
+				   dir, isys, &isys_irq_stats_fops);
+	if (IS_ERR(file))
+		goto err;
+
+	file = debugfs_create_file("frame_latency", 0400,
+				   dir, isys, &isys_frame_latency_fops);
+	if (IS_ERR(file))
+		goto err;
+
+	file = debugfs_create_file("stream_startup", 0400,
+				   dir, isys, &isys_stream_startup_fops);
+	if (IS_ERR(file))
+		goto err;
+
+	file = debugfs_create_file("dmabuf_cache", 0400,
+				   dir, isys, &isys_dmabuf_cache_fops);
+	if (IS_ERR(file))
+		goto err;
+
 	isys->debugfsdir = dir;
 
 #ifdef IPU_ISYS_GPC
@@ -1364,6 +2032,7 @@ static int alloc_fw_msg_bufs(struct ipu_isys *isys, int amount)
 		if (!addr)
 			break;
 		addr->dma_addr = dma_addr;
+		addr->pool = NULL;
 
 		spin_lock_irqsave(&isys->listlock, flags);
 		list_add(&addr->head, &isys->framebuflist);
@@ -1391,16 +2060,151 @@ static int alloc_fw_msg_bufs(struct ipu_isys *isys, int amount)
 	return -ENOMEM;
 }
 
+/*
+ * Give the pipeline its own firmware messages for depth frames in flight
+ * plus the stream configuration, so that capture doesn't touch the device
+ * wide lists or allocate in the frame path. The pool is kept until
+ * ipu_isys_fw_msg_pool_drain(); a short pool only means falling back.
+ */
+#define IPU_ISYS_FW_MSG_POOL_EXTRA	2
+
+int ipu_isys_fw_msg_pool_fill(struct ipu_isys_pipeline *ip,
+			      unsigned int depth)
+{
+	struct ipu_isys_video *pipe_av =
+	    container_of(ip, struct ipu_isys_video, ip);
+	struct ipu_isys_fw_msg_pool *pool = &ip->fw_msgs;
+	struct ipu_isys *isys = pipe_av->isys;
+	struct isys_fw_msgs *msg;
+	unsigned long flags;
+	dma_addr_t dma_addr;
+	unsigned int i;
+
+	/* Sizes the firmware queues at the next open */
+	spin_lock_irqsave(&isys->lock, flags);
+	isys->fw_queues.max_depth = max(isys->fw_queues.max_depth, depth);
+	spin_unlock_irqrestore(&isys->lock, flags);
+
+	if (pool->size)
+		return 0;
+
+	pool->in_use = 0;
+	pool->high_water = 0;
+	pool->fallbacks = 0;
+
+	for (i = 0; i < depth + IPU_ISYS_FW_MSG_POOL_EXTRA; i++) {
+		spin_lock_irqsave(&isys->listlock, flags);
+		msg = list_first_entry_or_null(&isys->framebuflist,
+					       struct isys_fw_msgs, head);
+		if (msg)
+			list_del(&msg->head);
+		spin_unlock_irqrestore(&isys->listlock, flags);
+
+		if (!msg) {
+			msg = dma_alloc_attrs(&isys->adev->dev,
+					      sizeof(struct isys_fw_msgs),
+					      &dma_addr, GFP_KERNEL,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 8, 0)
+					      NULL);
+#else
+					      0);
+#endif
+			if (!msg)
+				break;
+			msg->dma_addr = dma_addr;
+		}
+
+		spin_lock_irqsave(&pool->lock, flags);
+		msg->pool = pool;
+		list_add(&msg->head, &pool->free);
+		pool->size++;
+		spin_unlock_irqrestore(&pool->lock, flags);
+	}
+
+	if (!pool->size)
+		return -ENOMEM;
+
+	dev_dbg(&isys->adev->dev, "%s: %u fw msgs for depth %u\n",
+		pipe_av->vdev.name, pool->size, depth);
+
+	return 0;
+}
+
+/* After a stream flush the firmware holds none of the pool messages */
+void ipu_isys_fw_msg_pool_reclaim(struct ipu_isys_pipeline *ip)
+{
+	struct ipu_isys_fw_msg_pool *pool = &ip->fw_msgs;
+	unsigned long flags;
+
+	spin_lock_irqsave(&pool->lock, flags);
+	list_splice_init(&pool->busy, &pool->free);
+	pool->in_use = 0;
+	spin_unlock_irqrestore(&pool->lock, flags);
+}
+
+/* Hand the pool back to the device wide lists once the stream is closed */
+void ipu_isys_fw_msg_pool_drain(struct ipu_isys_pipeline *ip)
+{
+	struct ipu_isys_video *pipe_av =
+	    container_of(ip, struct ipu_isys_video, ip);
+	struct ipu_isys_fw_msg_pool *pool = &ip->fw_msgs;
+	struct ipu_isys *isys = pipe_av->isys;
+	struct isys_fw_msgs *msg;
+	unsigned long flags;
+
+	spin_lock_irqsave(&pool->lock, flags);
+	if (!pool->size) {
+		spin_unlock_irqrestore(&pool->lock, flags);
+		return;
+	}
+
+	dev_dbg(&isys->adev->dev,
+		"%s: fw msgs %u high water %u fallbacks %lu\n",
+		pipe_av->vdev.name, pool->size, pool->high_water,
+		pool->fallbacks);
+
+	list_for_each_entry(msg, &pool->free, head)
+		msg->pool = NULL;
+	list_for_each_entry(msg, &pool->busy, head)
+		msg->pool = NULL;
+
+	/* Messages the firmware still owns go where a late put expects them */
+	spin_lock(&isys->listlock);
+	list_splice_init(&pool->free, &isys->framebuflist);
+	list_splice_init(&pool->busy, &isys->framebuflist_fw);
+	spin_unlock(&isys->listlock);
+
+	pool->size = 0;
+	pool->in_use = 0;
+	spin_unlock_irqrestore(&pool->lock, flags);
+}
+
 struct isys_fw_msgs *ipu_get_fw_msg_buf(struct ipu_isys_pipeline *ip)
 {
 	struct ipu_isys_video *pipe_av =
 	    container_of(ip, struct ipu_isys_video, ip);
+	struct ipu_isys_fw_msg_pool *pool = &ip->fw_msgs;
 	struct ipu_isys *isys;
-	struct isys_fw_msgs *msg;
+	struct isys_fw_msgs *msg = NULL;
 	unsigned long flags;
 
 	isys = pipe_av->isys;
 
+	spin_lock_irqsave(&pool->lock, flags);
+	if (!list_empty(&pool->free)) {
+		msg = list_last_entry(&pool->free, struct isys_fw_msgs, head);
+		list_move(&msg->head, &pool->busy);
+		pool->in_use++;
+		pool->high_water = max(pool->high_water, pool->in_use);
+	} else if (pool->size) {
+		pool->fallbacks++;
+	}
+	spin_unlock_irqrestore(&pool->lock, flags);
+	if (msg) {
+		memset(&msg->fw_msg, 0, sizeof(msg->fw_msg));
+		return msg;
+	}
+
 	spin_lock_irqsave(&isys->listlock, flags);
 	if (list_empty(&isys->framebuflist)) {
 		spin_unlock_irqrestore(&isys->listlock, flags);
@@ -1436,6 +2240,7 @@ void ipu_cleanup_fw_msg_bufs(struct ipu_isys *isys)
 
 void ipu_put_fw_mgs_buf(struct ipu_isys *isys, u64 data)
 {
+	struct ipu_isys_fw_msg_pool *pool;
 	struct isys_fw_msgs *msg;
 	unsigned long flags;
 	u64 *ptr = (u64 *)(unsigned long)data;
@@ -1443,8 +2248,21 @@ void ipu_put_fw_mgs_buf(struct ipu_isys *isys, u64 data)
 	if (!ptr)
 		return;
 
-	spin_lock_irqsave(&isys->listlock, flags);
 	msg = container_of(ptr, struct isys_fw_msgs, fw_msg.dummy);
+	pool = READ_ONCE(msg->pool);
+	if (pool) {
+		spin_lock_irqsave(&pool->lock, flags);
+		/* Recheck, the pool may have been drained meanwhile */
+		if (msg->pool == pool) {
+			list_move(&msg->head, &pool->free);
+			pool->in_use--;
+			spin_unlock_irqrestore(&pool->lock, flags);
+			return;
+		}
+		spin_unlock_irqrestore(&pool->lock, flags);
+	}
+
+	spin_lock_irqsave(&isys->listlock, flags);
 	list_move(&msg->head, &isys->framebuflist);
 	spin_unlock_irqrestore(&isys->listlock, flags);
 }
@@ -1454,6 +2272,7 @@ static int isys_probe(struct ipu_bus_device *adev)
 	struct ipu_isys *isys;
 	struct ipu_device *isp = adev->isp;
 	const struct firmware *fw;
+	u64 start = ktime_get_ns();
 	int rval = 0;
 
 	isys = devm_kzalloc(&adev->dev, sizeof(*isys), GFP_KERNEL);
@@ -1522,11 +2341,22 @@ static int isys_probe(struct ipu_bus_device *adev)
 	spin_lock_init(&isys->lock);
 	spin_lock_init(&isys->power_lock);
 	isys->power = 0;
+	INIT_WORK(&isys->resp_work, isys_resp_work);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 13, 0)
+	hrtimer_init(&isys->resp_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	isys->resp_timer.function = isys_resp_poll;
+#else
+	hrtimer_setup(&isys->resp_timer, isys_resp_poll, CLOCK_MONOTONIC,
+		      HRTIMER_MODE_REL);
+#endif
 	isys->phy_termcal_val = 0;
 
 	mutex_init(&isys->mutex);
 	mutex_init(&isys->stream_mutex);
+	/* 0 is never current, see start_streaming() */
+	atomic_set(&isys->topology_gen, 1);
 	mutex_init(&isys->lib_mutex);
+	ipu_isys_dmabuf_cache_init(&isys->dmabuf_cache);
 
 	spin_lock_init(&isys->listlock);
 	INIT_LIST_HEAD(&isys->framebuflist);
@@ -1534,6 +2364,7 @@ static int isys_probe(struct ipu_bus_device *adev)
 
 	dev_dbg(&adev->dev, "isys probe %p %p\n", adev, &adev->dev);
 	ipu_bus_set_drvdata(adev, isys);
+	ipu_bus_set_autosuspend(adev, autosuspend_ms, autosuspend_max_ms);
 
 	isys->line_align = IPU_ISYS_2600_MEM_LINE_ALIGN;
 	isys->icache_prefetch = 0;
@@ -1567,6 +2398,8 @@ static int isys_probe(struct ipu_bus_device *adev)
 	ipu_trace_init(adev->isp, isys->pdata->base, &adev->dev,
 		       isys_trace_blocks);
 
+	isys->pm_qos_value = ISYS_PM_QOS_VALUE;
+	mutex_init(&isys->pm_qos_mutex);
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
 	cpu_latency_qos_add_request(&isys->pm_qos, PM_QOS_DEFAULT_VALUE);
 #else
@@ -1582,8 +2415,23 @@ static int isys_probe(struct ipu_bus_device *adev)
 	if (rval)
 		goto out_unregister_devices;
 
+#ifdef IPU_ISYS_GPC
+	/* Not fatal either */
+	isys->gpc_pmu = ipu_gpc_pmu_register(&adev->dev, isys->pdata->base +
+					     IPU_ISYS_GPC_BASE,
+					     &isys_gpc_pmu_regs, "ipu6_isys");
+	if (IS_ERR(isys->gpc_pmu)) {
+		dev_warn(&adev->dev, "gpc pmu register failed: %ld\n",
+			 PTR_ERR(isys->gpc_pmu));
+		isys->gpc_pmu = NULL;
+	}
+#endif
+
 	ipu_mmu_hw_cleanup(adev->mmu);
 
+	dev_dbg(&adev->dev, "probe took %llu us\n",
+		div_u64(ktime_get_ns() - start, NSEC_PER_USEC));
+
 	return 0;
 
 out_unregister_devices:
@@ -1591,6 +2439,7 @@ out_unregister_devices:
 	isys_unregister_devices(isys);
 out_remove_pkg_dir_shared_buffer:
 	cpu_latency_qos_remove_request(&isys->pm_qos);
+	mutex_destroy(&isys->pm_qos_mutex);
 	if (!isp->secure_mode)
 		ipu_cpd_free_pkg_dir(adev, isys->pkg_dir,
 				     isys->pkg_dir_dma_addr,
@@ -1603,6 +2452,7 @@ release_firmware:
 		release_firmware(isys->fw);
 	ipu_trace_uninit(&adev->dev);
 
+	ipu_isys_dmabuf_cache_cleanup(&isys->dmabuf_cache);
 	mutex_destroy(&isys->mutex);
 	mutex_destroy(&isys->stream_mutex);
 
@@ -1629,7 +2479,11 @@ static const struct fwmsg fw_msg[] = {
 	{IPU_FW_ISYS_RESP_TYPE_STREAM_STOP_ACK, "STREAM_STOP_ACK", 0},
 	{IPU_FW_ISYS_RESP_TYPE_STREAM_FLUSH_ACK, "STREAM_FLUSH_ACK", 0},
 	{IPU_FW_ISYS_RESP_TYPE_PIN_DATA_READY, "PIN_DATA_READY", 1},
+	{IPU_FW_ISYS_RESP_TYPE_PIN_DATA_WATERMARK, "PIN_DATA_WATERMARK", 1},
+	{IPU_FW_ISYS_RESP_TYPE_PIN_DATA_SKIPPED, "PIN_DATA_SKIPPED", 1},
 	{IPU_FW_ISYS_RESP_TYPE_STREAM_CAPTURE_ACK, "STREAM_CAPTURE_ACK", 0},
+	{IPU_FW_ISYS_RESP_TYPE_STREAM_CAPTURE_SKIPPED,
+	 "STREAM_CAPTURE_SKIPPED", 1},
 	{IPU_FW_ISYS_RESP_TYPE_STREAM_START_AND_CAPTURE_DONE,
 	 "STREAM_START_AND_CAPTURE_DONE", 1},
 	{IPU_FW_ISYS_RESP_TYPE_STREAM_CAPTURE_DONE, "STREAM_CAPTURE_DONE", 1},
@@ -1650,6 +2504,20 @@ static int resp_type_to_index(int type)
 	return i - 1;
 }
 
+/* Data path errors a flush and restart of the stream may clear */
+static bool isys_fw_error_recoverable(u32 error)
+{
+	switch (error) {
+	case IPU_FW_ISYS_ERROR_HW_CONSISTENCY:
+	case IPU_FW_ISYS_ERROR_HW_REPORTED_STR2MMIO:
+	case IPU_FW_ISYS_ERROR_HW_REPORTED_SIG2CIO:
+	case IPU_FW_ISYS_ERROR_SENSOR_FW_SYNC:
+		return true;
+	default:
+		return false;
+	}
+}
+
 int isys_isr_one(struct ipu_bus_device *adev)
 {
 	struct ipu_isys *isys = ipu_bus_get_drvdata(adev);
@@ -1662,7 +2530,7 @@ int isys_isr_one(struct ipu_bus_device *adev)
 	if (!isys->fwcom)
 		return 0;
 
-	resp = ipu_fw_isys_get_resp(isys->fwcom, IPU_BASE_MSG_RECV_QUEUES,
+	resp = ipu_fw_isys_get_resp(isys, IPU_BASE_MSG_RECV_QUEUES,
 				    &resp_data);
 	if (!resp)
 		return 1;
@@ -1710,6 +2578,8 @@ int isys_isr_one(struct ipu_bus_device *adev)
 		goto leave;
 	}
 	pipe->error = resp->error_info.error;
+	if (isys_fw_error_recoverable(pipe->error))
+		ipu_isys_stream_recover(pipe);
 
 	switch (resp->type) {
 	case IPU_FW_ISYS_RESP_TYPE_STREAM_OPEN_DONE:
@@ -1737,18 +2607,39 @@ int isys_isr_one(struct ipu_bus_device *adev)
 		 */
 		ipu_put_fw_mgs_buf(ipu_bus_get_drvdata(adev), resp->buf_id);
 		if (resp->pin_id < IPU_ISYS_OUTPUT_PINS &&
-		    pipe->output_pins[resp->pin_id].pin_ready)
+		    pipe->output_pins[resp->pin_id].pin_ready) {
 			pipe->output_pins[resp->pin_id].pin_ready(pipe, resp);
-		else
+			isys->resp_done[resp->stream_handle] = pipe;
+		} else
 			dev_err(&adev->dev,
 				"%d:No data pin ready handler for pin id %d\n",
 				resp->stream_handle, resp->pin_id);
-		if (pipe->csi2)
-			ipu_isys_csi2_error(pipe->csi2);
+		if (pipe->csi2 && ipu_isys_csi2_error(pipe->csi2))
+			ipu_isys_stream_recover(pipe);
 
+		break;
+	case IPU_FW_ISYS_RESP_TYPE_PIN_DATA_WATERMARK:
+		if (resp->pin_id < IPU_ISYS_OUTPUT_PINS &&
+		    pipe->output_pins[resp->pin_id].pin_ready ==
+		    ipu_isys_queue_buf_ready)
+			ipu_isys_queue_watermark_ready(pipe, resp);
+		break;
+	case IPU_FW_ISYS_RESP_TYPE_PIN_DATA_SKIPPED:
+		/* The capture message is done with, as on PIN_DATA_READY */
+		ipu_put_fw_mgs_buf(ipu_bus_get_drvdata(adev), resp->buf_id);
+		if (resp->pin_id < IPU_ISYS_OUTPUT_PINS &&
+		    pipe->output_pins[resp->pin_id].pin_ready ==
+		    ipu_isys_queue_buf_ready) {
+			ipu_isys_queue_buf_skipped(pipe, resp);
+			isys->resp_done[resp->stream_handle] = pipe;
+		}
 		break;
 	case IPU_FW_ISYS_RESP_TYPE_STREAM_CAPTURE_ACK:
 		break;
+	case IPU_FW_ISYS_RESP_TYPE_STREAM_CAPTURE_SKIPPED:
+		/* The pins of the capture report their buffers separately */
+		dev_dbg(&adev->dev, "%d:capture skipped\n", resp->stream_handle);
+		break;
 	case IPU_FW_ISYS_RESP_TYPE_STREAM_START_AND_CAPTURE_DONE:
 	case IPU_FW_ISYS_RESP_TYPE_STREAM_CAPTURE_DONE:
 		if (pipe->interlaced) {
@@ -1797,6 +2688,8 @@ int isys_isr_one(struct ipu_bus_device *adev)
 	case IPU_FW_ISYS_RESP_TYPE_FRAME_SOF:
 		if (pipe->csi2)
 			ipu_isys_csi2_sof_event(pipe->csi2);
+		ipu_isys_frame_sof(pipe, atomic_read(&pipe->sequence) - 1, ts);
+		ipu_isys_iwake_frame(isys);
 
 		pipe->seq[pipe->seq_index].sequence =
 		    atomic_read(&pipe->sequence) - 1;
@@ -1811,6 +2704,7 @@ int isys_isr_one(struct ipu_bus_device *adev)
 	case IPU_FW_ISYS_RESP_TYPE_FRAME_EOF:
 		if (pipe->csi2)
 			ipu_isys_csi2_eof_event(pipe->csi2);
+		ipu_isys_frame_eof(pipe, ts);
 
 		dev_dbg(&adev->dev,
 			"eof: handle %d: (index %u), timestamp 0x%16.16llx\n",
@@ -1818,6 +2712,19 @@ int isys_isr_one(struct ipu_bus_device *adev)
 			pipe->seq[pipe->seq_index].sequence, ts);
 		break;
 	case IPU_FW_ISYS_RESP_TYPE_STATS_DATA_READY:
+		/*
+		 * Sensor statistics and embedded data on a metadata pin are
+		 * complete before the frame is. Hand the buffer over now so
+		 * 3A does not wait for the end of the image data. The capture
+		 * message is still released on PIN_DATA_READY, which
+		 * ipu_isys_queue_buf_ready() then drops.
+		 */
+		if (resp->pin_id < IPU_ISYS_OUTPUT_PINS &&
+		    pipe->output_pins[resp->pin_id].metadata &&
+		    pipe->output_pins[resp->pin_id].pin_ready) {
+			pipe->output_pins[resp->pin_id].pin_ready(pipe, resp);
+			isys->resp_done[resp->stream_handle] = pipe;
+		}
 		break;
 	default:
 		dev_err(&adev->dev, "%d:unknown response type %u\n",
@@ -1830,6 +2737,74 @@ leave:
 	return 0;
 }
 
+static bool __isys_isr_drain(struct ipu_isys *isys, unsigned int budget,
+			     unsigned int *handled)
+{
+	unsigned int n, i;
+
+	*handled = 0;
+	if (!isys->fwcom)
+		return false;
+
+	for (n = 0; n < budget; n++)
+		if (isys_isr_one(isys->adev))
+			break;
+
+	/* One read index update for all responses handled in this round */
+	ipu_fw_isys_commit_resp(isys->fwcom, IPU_BASE_MSG_RECV_QUEUES);
+	*handled = n;
+	isys->irq_responses += n;
+
+	/* The pipes[] entry may already be gone, resp_done[] is not */
+	for (i = 0; i < IPU_ISYS_MAX_STREAMS; i++) {
+		if (!isys->resp_done[i])
+			continue;
+		ipu_isys_queue_flush_done(isys->resp_done[i]);
+		isys->resp_done[i] = NULL;
+	}
+
+	return n == budget;
+}
+
+/*
+ * Handle up to isr_budget responses, then give the completed buffers to
+ * vb2 pipeline by pipeline. Called with power_lock held, from isys_isr()
+ * or resp_timer. Returns true if the budget ran out before the queue did.
+ */
+bool isys_isr_drain(struct ipu_isys *isys, unsigned int *handled)
+{
+	return __isys_isr_drain(isys, max(isr_budget, 1U), handled);
+}
+
+/*
+ * Handle one response and give its buffers to vb2. Called with
+ * power_lock held, from resp_work. Returns false once the queue is empty.
+ */
+bool isys_isr_drain_one(struct ipu_isys *isys)
+{
+	unsigned int handled;
+
+	return __isys_isr_drain(isys, 1, &handled);
+}
+
+/*
+ * Interrupt then poll: after a drain that found responses, keep the SW
+ * interrupt masked and poll the queue again in irq_poll_us, for up to
+ * irq_poll_rounds polls in a row. Called with power_lock held, returns
+ * true if a poll was scheduled and the interrupt must stay masked.
+ */
+bool isys_resp_poll_schedule(struct ipu_isys *isys, unsigned int handled)
+{
+	if (!irq_poll_us || !handled ||
+	    isys->resp_poll_round++ >= irq_poll_rounds)
+		return false;
+
+	hrtimer_start(&isys->resp_timer, us_to_ktime(irq_poll_us),
+		      HRTIMER_MODE_REL);
+
+	return true;
+}
+
 static struct ipu_bus_driver isys_driver = {
 	.probe = isys_probe,
 	.remove = isys_remove,
@@ -1839,6 +2814,7 @@ static struct ipu_bus_driver isys_driver = {
 		.name = IPU_ISYS_NAME,
 		.owner = THIS_MODULE,
 		.pm = ISYS_PM_OPS,
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 	},
 };
 
@@ -4,8 +4,10 @@
 #ifndef IPU_ISYS_H
 #define IPU_ISYS_H
 
+#include <linux/hrtimer.h>
 #include <linux/pm_qos.h>
 #include <linux/spinlock.h>
+#include <linux/workqueue.h>
 
 #include <media/v4l2-device.h>
 #include <media/media-device.h>
@@ -28,10 +30,18 @@
 
 /*
  * Current message queue configuration. These must be big enough
- * so that they never gets full. Queues are located in system memory
+ * so that they never gets full. Queues are located in system memory.
+ * The message queue sizes below are the minimum; ipu_fw_isys_init()
+ * grows them from the streams and buffer depths seen so far.
  */
 #define IPU_ISYS_SIZE_RECV_QUEUE 40
 #define IPU_ISYS_SIZE_SEND_QUEUE 40
+#define IPU_ISYS_MAX_SIZE_RECV_QUEUE 512
+#define IPU_ISYS_MAX_SIZE_SEND_QUEUE 128
+/* Responses per frame: SOF, EOF, PIN_DATA_READY and FRAME_BUFF_ACK */
+#define IPU_ISYS_RESP_PER_FRAME 4
+/* Stream commands besides frame buffer sets: open, start, stop, flush, close */
+#define IPU_ISYS_SEND_QUEUE_CMDS 8
 #define IPU_ISYS_SIZE_PROXY_RECV_QUEUE 5
 #define IPU_ISYS_SIZE_PROXY_SEND_QUEUE 5
 #define IPU_ISYS_NUM_RECV_QUEUE 1
@@ -55,6 +65,7 @@
 #define IPU_ISYS_MIN_HEIGHT		1U
 #define IPU_ISYS_MAX_WIDTH		16384U
 #define IPU_ISYS_MAX_HEIGHT		16384U
+#define IPU_ISYS_MAX_EMBEDDED_LINES	16U
 
 #ifdef CONFIG_IPU_SINGLE_BE_SOC_DEVICE
 #define NR_OF_CSI2_BE_SOC_DEV 1
@@ -101,6 +112,23 @@ struct isys_iwake_watermark {
 	struct mutex mutex; /* protect whole struct */
 	struct ipu_isys *isys;
 	struct list_head video_list;
+	/*
+	 * Closed loop tuning, see isys_iwake_tune_work(): the DID of the
+	 * formula is scaled by tune_pct, within floor_pct and ceil_pct.
+	 * Pixel buffer overflows lower it, clean frames raise it again.
+	 */
+	bool auto_tune;
+	u32 tune_pct;
+	u32 floor_pct;
+	u32 ceil_pct;
+	atomic_t overflows;
+	atomic_t clean_frames;
+	u64 total_overflows;
+	struct work_struct tune_work;
+	/* Values last written by update_watermark_setting() */
+	u16 ltr;
+	u16 did;
+	u32 critical_threshold;
 };
 struct ipu_isys_sensor_info {
 	unsigned int vc1_data_start;
@@ -112,6 +140,29 @@ struct ipu_isys_sensor_info {
 	unsigned int sensor_metadata;
 };
 
+/*
+ * struct ipu_isys_fw_queue_stats - firmware message queue sizing and
+ * backpressure
+ *
+ * @send_size, @recv_size: per stream send and shared receive queue sizes
+ *	of the current firmware context
+ * @max_streams, @max_depth: most concurrent streams and deepest stream
+ *	buffer queue seen, used to size the queues at the next open
+ * @send_full: commands refused because the send queue was full
+ * @recv_level, @recv_high_water: pending responses found by the ISR
+ * @recv_full: times the ISR found the receive queue full
+ */
+struct ipu_isys_fw_queue_stats {
+	unsigned int send_size;
+	unsigned int recv_size;
+	unsigned int max_streams;
+	unsigned int max_depth;
+	atomic_t send_full;
+	unsigned int recv_level;
+	unsigned int recv_high_water;
+	unsigned int recv_full;
+};
+
 /*
  * struct ipu_isys
  *
@@ -131,7 +182,9 @@ struct ipu_isys_sensor_info {
  * @reset_needed: Isys requires d0i0->i3 transition
  * @video_opened: total number of opened file handles on video nodes
  * @mutex: serialise access isys video open/release related operations
- * @stream_mutex: serialise stream start and stop, queueing requests
+ * @stream_mutex: serialise stream start and stop, queueing requests. Not
+ *		  taken by steady state buffer queueing, which only needs the
+ *		  pipeline's own mutex
  * @lib_mutex: optional external library mutex
  * @pdata: platform data pointer
  * @csi2: CSI-2 receivers
@@ -142,6 +195,7 @@ struct ipu_isys_sensor_info {
  * @pkg_dir_dma_addr: I/O virtual address for pkg_dir
  * @pkg_dir_size: size of pkg_dir in bytes
  * @short_packet_source: select short packet capture mode
+ * @fw_queues: firmware message queue sizing and statistics
  */
 struct ipu_isys {
 	struct media_device media_dev;
@@ -167,6 +221,10 @@ struct ipu_isys {
 
 #ifdef CONFIG_DEBUG_FS
 	struct dentry *debugfsdir;
+#endif
+#ifdef IPU_ISYS_GPC
+	struct ipu_gpc_pmu *gpc_pmu;
+	struct ipu_gpc_sampler *gpc_sampler;
 #endif
 	struct mutex mutex;	/* Serialise isys video open/release related */
 	struct mutex stream_mutex;	/* Stream start, stop, queueing reqs */
@@ -186,6 +244,9 @@ struct ipu_isys {
 
 	struct list_head requests;
 	struct pm_qos_request pm_qos;
+	/* Latency requested while powered, see ipu_isys_update_pm_qos() */
+	s32 pm_qos_value;
+	struct mutex pm_qos_mutex;	/* Serialise pm_qos updates */
 	unsigned int short_packet_source;
 	struct ipu_isys_csi2_monitor_message *short_packet_trace_buffer;
 	dma_addr_t short_packet_trace_buffer_dma_addr;
@@ -198,10 +259,47 @@ struct ipu_isys {
 	struct list_head framebuflist_fw;
 	struct v4l2_async_notifier notifier;
 	struct isys_iwake_watermark *iwake_watermark;
-
+	struct ipu_isys_fw_queue_stats fw_queues;
+	/* Bandwidth admitted to the streaming pipelines, under stream_mutex */
+	u32 bw_admitted_mbs;
+	/* Response draining moved from the ISR to resp_work, see isys_isr() */
+	bool resp_deferred;
+	struct work_struct resp_work;
+	unsigned long resp_deferrals;
+	/* Interrupt then poll, see isys_resp_poll_schedule() */
+	struct hrtimer resp_timer;
+	unsigned int resp_poll_round;
+	/* Response interrupt counters, under power_lock */
+	unsigned long irq_count;
+	unsigned long irq_responses;
+	unsigned long irq_polls;
+	unsigned long irq_polled_responses;
+	/* Pipelines with buffers on done_bufs, under power_lock */
+	struct ipu_isys_pipeline *resp_done[IPU_ISYS_MAX_STREAMS];
+	/* Bumped on link and format changes, see ipu_isys_topology_changed() */
+	atomic_t topology_gen;
+	struct ipu_isys_dmabuf_cache dmabuf_cache;
 };
 
+/*
+ * Stream on skips the checks of what has not changed since the last
+ * stream on, which is told by the topology generation.
+ */
+static inline void ipu_isys_topology_changed(struct ipu_isys *isys)
+{
+	atomic_inc(&isys->topology_gen);
+}
+
+static inline unsigned int ipu_isys_topology_gen(struct ipu_isys *isys)
+{
+	return atomic_read(&isys->topology_gen);
+}
+
 void update_watermark_setting(struct ipu_isys *isys);
+void ipu_isys_iwake_mix_changed(struct isys_iwake_watermark *w);
+void ipu_isys_iwake_overflow(struct ipu_isys *isys);
+void ipu_isys_iwake_frame(struct ipu_isys *isys);
+void ipu_isys_update_pm_qos(struct ipu_isys *isys);
 
 struct isys_fw_msgs {
 	union {
@@ -211,6 +309,8 @@ struct isys_fw_msgs {
 	} fw_msg;
 	struct list_head head;
 	dma_addr_t dma_addr;
+	/* Owning pipeline pool, NULL when on the device wide lists */
+	struct ipu_isys_fw_msg_pool *pool;
 };
 
 #define to_frame_msg_buf(a) (&(a)->fw_msg.frame)
@@ -223,11 +323,20 @@ int ipu_pipeline_pm_use(struct media_entity *entity, int use);
 struct isys_fw_msgs *ipu_get_fw_msg_buf(struct ipu_isys_pipeline *ip);
 void ipu_put_fw_mgs_buf(struct ipu_isys *isys, u64 data);
 void ipu_cleanup_fw_msg_bufs(struct ipu_isys *isys);
+int ipu_isys_fw_msg_pool_fill(struct ipu_isys_pipeline *ip,
+			      unsigned int depth);
+void ipu_isys_fw_msg_pool_reclaim(struct ipu_isys_pipeline *ip);
+void ipu_isys_fw_msg_pool_drain(struct ipu_isys_pipeline *ip);
 
 extern const struct v4l2_ioctl_ops ipu_isys_ioctl_ops;
 
 void isys_setup_hw(struct ipu_isys *isys);
 int isys_isr_one(struct ipu_bus_device *adev);
+bool isys_isr_drain(struct ipu_isys *isys, unsigned int *handled);
+bool isys_isr_drain_one(struct ipu_isys *isys);
+bool isys_resp_poll_schedule(struct ipu_isys *isys, unsigned int handled);
+void isys_resp_work(struct work_struct *work);
+enum hrtimer_restart isys_resp_poll(struct hrtimer *timer);
 irqreturn_t isys_isr(struct ipu_bus_device *adev);
 #ifdef IPU_ISYS_GPC
 int ipu_isys_gpc_init_debugfs(struct ipu_isys *isys);
@@ -5,7 +5,9 @@
 
 #include <linux/device.h>
 #include <linux/iova.h>
+#include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/sched.h>
 #include <linux/sizes.h>
 
 #include "ipu.h"
@@ -42,7 +44,33 @@
 
 #define TBL_PHYS_ADDR(a)	((phys_addr_t)(a) << ISP_PADDR_SHIFT)
 
-static void tlb_invalidate(struct ipu_mmu *mmu)
+/* Read-only pages shared by the MMU infos of one device, see below */
+struct ipu_mmu_shared {
+	struct list_head node;
+	struct device *dev;
+	unsigned int users;	/* Under ipu_mmu_shared_mutex */
+
+	void *dummy_page;
+	u32 dummy_page_pteval;
+	u32 *dummy_l2_pt;
+	u32 dummy_l2_pteval;
+
+	u32 *trash_page;
+	u32 trash_page_pteval;
+	u32 *trash_l2_pt;
+	u32 trash_l2_pteval;
+};
+
+static LIST_HEAD(ipu_mmu_shared_list);
+static DEFINE_MUTEX(ipu_mmu_shared_mutex);
+
+static unsigned int deferred_unmaps;
+module_param(deferred_unmaps, uint, 0644);
+MODULE_PARM_DESC(deferred_unmaps,
+		 "Unmaps collected before a TLB flush (0 = strict, max "
+		 __stringify(IPU_MMU_MAX_DEFERRED) ")");
+
+static void tlb_invalidate_hw(struct ipu_mmu *mmu)
 {
 	unsigned int i;
 	unsigned long flags;
@@ -78,6 +106,123 @@ static void tlb_invalidate(struct ipu_mmu *mmu)
 	spin_unlock_irqrestore(&mmu->ready_lock, flags);
 }
 
+/*
+ * Invalidate the TLB and release the quarantined IOVAs. Every IOVA in
+ * the quarantine was unmapped before it was added, so none of them can
+ * be reached through the TLB anymore once the invalidation is done.
+ */
+static void tlb_flush_locked(struct ipu_mmu *mmu)
+{
+	unsigned int i;
+
+	lockdep_assert_held(&mmu->deferred_lock);
+
+	tlb_invalidate_hw(mmu);
+
+	for (i = 0; i < mmu->nr_deferred; i++)
+		ipu_dma_free_iova(mmu->dmap, mmu->deferred_iovas[i]);
+	mmu->nr_deferred = 0;
+}
+
+static void tlb_invalidate(struct ipu_mmu *mmu)
+{
+	unsigned long flags;
+
+	/* Invalidations of the batching task are done when the batch ends */
+	if (READ_ONCE(mmu->tlb_batch_owner) == current) {
+		WRITE_ONCE(mmu->tlb_batch_pending, true);
+		return;
+	}
+
+	spin_lock_irqsave(&mmu->deferred_lock, flags);
+	tlb_flush_locked(mmu);
+	spin_unlock_irqrestore(&mmu->deferred_lock, flags);
+}
+
+/*
+ * Batch the TLB invalidations of the calling task until
+ * ipu_mmu_tlb_batch_end(). Other tasks keep invalidating as usual, which
+ * also flushes any entries the batch has left stale. Mappings created in
+ * the batch must not reach the hardware before the batch has ended or
+ * ipu_mmu_tlb_flush_pending() has been called.
+ */
+void ipu_mmu_tlb_batch_begin(struct ipu_mmu *mmu)
+{
+	mutex_lock(&mmu->tlb_batch_mutex);
+	WRITE_ONCE(mmu->tlb_batch_pending, false);
+	WRITE_ONCE(mmu->tlb_batch_owner, current);
+}
+EXPORT_SYMBOL(ipu_mmu_tlb_batch_begin);
+
+void ipu_mmu_tlb_batch_end(struct ipu_mmu *mmu)
+{
+	WRITE_ONCE(mmu->tlb_batch_owner, NULL);
+	if (READ_ONCE(mmu->tlb_batch_pending))
+		mmu->tlb_invalidate(mmu);
+	WRITE_ONCE(mmu->tlb_batch_pending, false);
+	mutex_unlock(&mmu->tlb_batch_mutex);
+}
+EXPORT_SYMBOL(ipu_mmu_tlb_batch_end);
+
+/*
+ * Quarantine an unmapped IOVA until the next TLB invalidation instead of
+ * invalidating right away. The IOVA is freed by whichever flush comes
+ * first: the deferred_unmaps threshold, ipu_mmu_tlb_flush_pending() or a
+ * regular invalidation after a map. Returns false if deferring is
+ * disabled, in which case the caller invalidates and frees the IOVA.
+ */
+bool ipu_mmu_defer_unmap(struct ipu_mmu *mmu, struct iova *iova)
+{
+	unsigned int max = min_t(unsigned int, READ_ONCE(deferred_unmaps),
+				 IPU_MMU_MAX_DEFERRED);
+	unsigned long flags;
+
+	if (!max)
+		return false;
+
+	spin_lock_irqsave(&mmu->deferred_lock, flags);
+	mmu->deferred_iovas[mmu->nr_deferred++] = iova;
+	if (mmu->nr_deferred >= max)
+		tlb_flush_locked(mmu);
+	spin_unlock_irqrestore(&mmu->deferred_lock, flags);
+
+	return true;
+}
+EXPORT_SYMBOL(ipu_mmu_defer_unmap);
+
+/*
+ * Called before buffers are handed to the firmware: issue the TLB
+ * invalidation still owed by a batch or by deferred unmaps, if any.
+ */
+void ipu_mmu_tlb_flush_pending(struct ipu_mmu *mmu)
+{
+	unsigned long flags;
+
+	if (!READ_ONCE(mmu->tlb_batch_pending) && !READ_ONCE(mmu->nr_deferred))
+		return;
+
+	spin_lock_irqsave(&mmu->deferred_lock, flags);
+	/*
+	 * Clear the batch flag before flushing, a map racing with us sets
+	 * it again and gets its own invalidation.
+	 */
+	WRITE_ONCE(mmu->tlb_batch_pending, false);
+	tlb_flush_locked(mmu);
+	spin_unlock_irqrestore(&mmu->deferred_lock, flags);
+}
+EXPORT_SYMBOL(ipu_mmu_tlb_flush_pending);
+
+/*
+ * The invalidation of a strict unmap. The caller releases the pages and
+ * the IOVA right after it, so a batch of the calling task can't hold it
+ * back: flush what the batch owes along with it.
+ */
+void ipu_mmu_tlb_invalidate_unmap(struct ipu_mmu *mmu)
+{
+	mmu->tlb_invalidate(mmu);
+	ipu_mmu_tlb_flush_pending(mmu);
+}
+
 #ifdef DEBUG
 static void page_table_dump(struct ipu_mmu_info *mmu_info)
 {
@@ -114,87 +259,128 @@ static void page_table_dump(struct ipu_mmu_info *mmu_info)
 }
 #endif /* DEBUG */
 
-static dma_addr_t map_single(struct ipu_mmu_info *mmu_info, void *ptr)
+static dma_addr_t map_single(struct device *dev, void *ptr)
 {
 	dma_addr_t dma;
 
-	dma = dma_map_single(mmu_info->dev, ptr, PAGE_SIZE, DMA_BIDIRECTIONAL);
-	if (dma_mapping_error(mmu_info->dev, dma))
+	dma = dma_map_single(dev, ptr, PAGE_SIZE, DMA_BIDIRECTIONAL);
+	if (dma_mapping_error(dev, dma))
 		return 0;
 
 	return dma;
 }
 
-static int get_dummy_page(struct ipu_mmu_info *mmu_info)
+/* A mapped page with each of its PTEs set to pteval, for the shared pages */
+static u32 *alloc_shared_pt(struct device *dev, u32 pteval, u32 *pt_pteval)
 {
 	dma_addr_t dma;
-	void *pt = (void *)get_zeroed_page(GFP_ATOMIC | GFP_DMA32);
+	u32 *pt = (u32 *)get_zeroed_page(GFP_KERNEL | GFP_DMA32);
+	int i;
 
 	if (!pt)
-		return -ENOMEM;
+		return NULL;
 
-	dev_dbg(mmu_info->dev, "%s get_zeroed_page() == %p\n", __func__, pt);
+	dev_dbg(dev, "%s get_zeroed_page() == %p\n", __func__, pt);
 
-	dma = map_single(mmu_info, pt);
+	for (i = 0; i < ISP_L2PT_PTES; i++)
+		pt[i] = pteval;
+
+	dma = map_single(dev, pt);
 	if (!dma) {
-		dev_err(mmu_info->dev, "Failed to map dummy page\n");
-		goto err_free_page;
+		dev_err(dev, "Failed to map shared page\n");
+		free_page((unsigned long)pt);
+		return NULL;
 	}
 
-	mmu_info->dummy_page = pt;
-	mmu_info->dummy_page_pteval = dma >> ISP_PAGE_SHIFT;
-
-	return 0;
+	*pt_pteval = dma >> ISP_PAGE_SHIFT;
 
-err_free_page:
-	free_page((unsigned long)pt);
-	return -ENOMEM;
+	return pt;
 }
 
-static void free_dummy_page(struct ipu_mmu_info *mmu_info)
+static void free_shared_pt(struct device *dev, void *pt, u32 pteval)
 {
-	dma_unmap_single(mmu_info->dev,
-			 TBL_PHYS_ADDR(mmu_info->dummy_page_pteval),
-			 PAGE_SIZE, DMA_BIDIRECTIONAL);
-	free_page((unsigned long)mmu_info->dummy_page);
+	dma_unmap_single(dev, TBL_PHYS_ADDR(pteval), PAGE_SIZE,
+			 DMA_BIDIRECTIONAL);
+	free_page((unsigned long)pt);
 }
 
-static int alloc_dummy_l2_pt(struct ipu_mmu_info *mmu_info)
+/*
+ * The ISYS and PSYS MMU infos of a device sit on the same PCI function,
+ * so the tables nothing writes to after set up can be shared by them: the
+ * dummy page and the dummy L2 table, and the trash page with an L2 table
+ * pointing all its PTEs at it.
+ */
+static struct ipu_mmu_shared *ipu_mmu_shared_get(struct device *dev)
 {
-	dma_addr_t dma;
-	u32 *pt = (u32 *)get_zeroed_page(GFP_ATOMIC | GFP_DMA32);
-	int i;
+	struct ipu_mmu_shared *sh;
 
-	if (!pt)
-		return -ENOMEM;
+	mutex_lock(&ipu_mmu_shared_mutex);
+	list_for_each_entry(sh, &ipu_mmu_shared_list, node) {
+		if (sh->dev == dev) {
+			sh->users++;
+			goto out_unlock;
+		}
+	}
 
-	dev_dbg(mmu_info->dev, "%s get_zeroed_page() == %p\n", __func__, pt);
+	sh = kzalloc(sizeof(*sh), GFP_KERNEL);
+	if (!sh)
+		goto out_unlock;
 
-	dma = map_single(mmu_info, pt);
-	if (!dma) {
-		dev_err(mmu_info->dev, "Failed to map l2pt page\n");
-		goto err_free_page;
-	}
+	sh->dev = dev;
+	sh->dummy_page = alloc_shared_pt(dev, 0, &sh->dummy_page_pteval);
+	if (!sh->dummy_page)
+		goto err_free_sh;
 
-	for (i = 0; i < ISP_L2PT_PTES; i++)
-		pt[i] = mmu_info->dummy_page_pteval;
+	sh->dummy_l2_pt = alloc_shared_pt(dev, sh->dummy_page_pteval,
+					  &sh->dummy_l2_pteval);
+	if (!sh->dummy_l2_pt)
+		goto err_free_dummy_page;
 
-	mmu_info->dummy_l2_pt = pt;
-	mmu_info->dummy_l2_pteval = dma >> ISP_PAGE_SHIFT;
+	sh->trash_page = alloc_shared_pt(dev, 0, &sh->trash_page_pteval);
+	if (!sh->trash_page)
+		goto err_free_dummy_l2_pt;
 
-	return 0;
+	sh->trash_l2_pt = alloc_shared_pt(dev, sh->trash_page_pteval,
+					  &sh->trash_l2_pteval);
+	if (!sh->trash_l2_pt)
+		goto err_free_trash_page;
 
-err_free_page:
-	free_page((unsigned long)pt);
-	return -ENOMEM;
+	sh->users = 1;
+	list_add(&sh->node, &ipu_mmu_shared_list);
+
+out_unlock:
+	mutex_unlock(&ipu_mmu_shared_mutex);
+
+	return sh;
+
+err_free_trash_page:
+	free_shared_pt(dev, sh->trash_page, sh->trash_page_pteval);
+err_free_dummy_l2_pt:
+	free_shared_pt(dev, sh->dummy_l2_pt, sh->dummy_l2_pteval);
+err_free_dummy_page:
+	free_shared_pt(dev, sh->dummy_page, sh->dummy_page_pteval);
+err_free_sh:
+	kfree(sh);
+	mutex_unlock(&ipu_mmu_shared_mutex);
+
+	return NULL;
 }
 
-static void free_dummy_l2_pt(struct ipu_mmu_info *mmu_info)
+static void ipu_mmu_shared_put(struct ipu_mmu_shared *sh)
 {
-	dma_unmap_single(mmu_info->dev,
-			 TBL_PHYS_ADDR(mmu_info->dummy_l2_pteval),
-			 PAGE_SIZE, DMA_BIDIRECTIONAL);
-	free_page((unsigned long)mmu_info->dummy_l2_pt);
+	mutex_lock(&ipu_mmu_shared_mutex);
+	if (--sh->users) {
+		mutex_unlock(&ipu_mmu_shared_mutex);
+		return;
+	}
+	list_del(&sh->node);
+	mutex_unlock(&ipu_mmu_shared_mutex);
+
+	free_shared_pt(sh->dev, sh->trash_l2_pt, sh->trash_l2_pteval);
+	free_shared_pt(sh->dev, sh->trash_page, sh->trash_page_pteval);
+	free_shared_pt(sh->dev, sh->dummy_l2_pt, sh->dummy_l2_pteval);
+	free_shared_pt(sh->dev, sh->dummy_page, sh->dummy_page_pteval);
+	kfree(sh);
 }
 
 static u32 *alloc_l1_pt(struct ipu_mmu_info *mmu_info)
@@ -211,7 +397,7 @@ static u32 *alloc_l1_pt(struct ipu_mmu_info *mmu_info)
 	for (i = 0; i < ISP_L1PT_PTES; i++)
 		pt[i] = mmu_info->dummy_l2_pteval;
 
-	dma = map_single(mmu_info, pt);
+	dma = map_single(mmu_info->dev, pt);
 	if (!dma) {
 		dev_err(mmu_info->dev, "Failed to map l1pt page\n");
 		goto err_free_page;
@@ -227,9 +413,9 @@ err_free_page:
 	return NULL;
 }
 
-static u32 *alloc_l2_pt(struct ipu_mmu_info *mmu_info)
+static u32 *alloc_l2_pt(struct ipu_mmu_info *mmu_info, gfp_t gfp)
 {
-	u32 *pt = (u32 *)get_zeroed_page(GFP_ATOMIC | GFP_DMA32);
+	u32 *pt = (u32 *)get_zeroed_page(gfp | GFP_DMA32);
 	int i;
 
 	if (!pt)
@@ -243,6 +429,88 @@ static u32 *alloc_l2_pt(struct ipu_mmu_info *mmu_info)
 	return pt;
 }
 
+/*
+ * A new L2 table for l2_map(), called with mmu_info->lock held. Taken
+ * from the pool, already mapped; only if it has run dry allocated here,
+ * atomically. The pool is topped up from process context.
+ */
+static u32 *l2_pool_get(struct ipu_mmu_info *mmu_info, dma_addr_t *dma)
+{
+	struct page *page;
+	u32 *pt;
+
+	lockdep_assert_held(&mmu_info->lock);
+
+	page = list_first_entry_or_null(&mmu_info->l2_pool, struct page, lru);
+	if (page) {
+		list_del(&page->lru);
+		if (--mmu_info->l2_pool_count < IPU_MMU_L2_POOL_LOW)
+			schedule_work(&mmu_info->l2_pool_work);
+		*dma = page_private(page);
+		set_page_private(page, 0);
+		return page_address(page);
+	}
+
+	schedule_work(&mmu_info->l2_pool_work);
+	pt = alloc_l2_pt(mmu_info, GFP_ATOMIC);
+	if (!pt)
+		return NULL;
+
+	*dma = map_single(mmu_info->dev, pt);
+	if (!*dma) {
+		dev_err(mmu_info->dev, "Failed to map l2pt page\n");
+		free_page((unsigned long)pt);
+		return NULL;
+	}
+
+	return pt;
+}
+
+static void l2_pool_fill(struct ipu_mmu_info *mmu_info)
+{
+	unsigned long flags;
+	dma_addr_t dma;
+	u32 *pt;
+
+	while (READ_ONCE(mmu_info->l2_pool_count) < IPU_MMU_L2_POOL_SIZE) {
+		pt = alloc_l2_pt(mmu_info, GFP_KERNEL);
+		if (!pt)
+			return;
+
+		dma = map_single(mmu_info->dev, pt);
+		if (!dma) {
+			free_page((unsigned long)pt);
+			return;
+		}
+		set_page_private(virt_to_page(pt), dma);
+
+		spin_lock_irqsave(&mmu_info->lock, flags);
+		list_add(&virt_to_page(pt)->lru, &mmu_info->l2_pool);
+		mmu_info->l2_pool_count++;
+		spin_unlock_irqrestore(&mmu_info->lock, flags);
+	}
+}
+
+static void l2_pool_work(struct work_struct *work)
+{
+	l2_pool_fill(container_of(work, struct ipu_mmu_info, l2_pool_work));
+}
+
+static void l2_pool_free(struct ipu_mmu_info *mmu_info)
+{
+	struct page *page, *tmp;
+
+	cancel_work_sync(&mmu_info->l2_pool_work);
+	list_for_each_entry_safe(page, tmp, &mmu_info->l2_pool, lru) {
+		list_del(&page->lru);
+		dma_unmap_single(mmu_info->dev, page_private(page), PAGE_SIZE,
+				 DMA_BIDIRECTIONAL);
+		set_page_private(page, 0);
+		__free_page(page);
+	}
+	mmu_info->l2_pool_count = 0;
+}
+
 static void l2_unmap(struct ipu_mmu_info *mmu_info, unsigned long iova,
 		     phys_addr_t dummy, size_t size);
 static int l2_map(struct ipu_mmu_info *mmu_info, unsigned long iova,
@@ -252,10 +520,11 @@ static int l2_map(struct ipu_mmu_info *mmu_info, unsigned long iova,
 	u32 l1_idx;
 	u32 l1_entry;
 	u32 *l2_pt, *l2_virt;
-	unsigned int l2_idx;
+	unsigned int l2_idx, i;
 	unsigned long flags;
 	dma_addr_t dma;
 	unsigned int l2_entries;
+	u32 pteval;
 	size_t mapped = 0;
 	int err = 0;
 
@@ -270,20 +539,9 @@ static int l2_map(struct ipu_mmu_info *mmu_info, unsigned long iova,
 
 		l1_entry = mmu_info->l1_pt[l1_idx];
 		if (l1_entry == mmu_info->dummy_l2_pteval) {
-			l2_virt = mmu_info->l2_pts[l1_idx];
-			if (likely(!l2_virt)) {
-				l2_virt = alloc_l2_pt(mmu_info);
-				if (!l2_virt) {
-					err = -ENOMEM;
-					goto error;
-				}
-			}
-
-			dma = map_single(mmu_info, l2_virt);
-			if (!dma) {
-				dev_err(dev, "Failed to map l2pt page\n");
-				free_page((unsigned long)l2_virt);
-				err = -EINVAL;
+			l2_virt = l2_pool_get(mmu_info, &dma);
+			if (!l2_virt) {
+				err = -ENOMEM;
 				goto error;
 			}
 
@@ -299,26 +557,29 @@ static int l2_map(struct ipu_mmu_info *mmu_info, unsigned long iova,
 		}
 
 		l2_pt = mmu_info->l2_pts[l1_idx];
-		l2_entries = 0;
-
-		for (l2_idx = (iova & ISP_L2PT_MASK) >> ISP_L2PT_SHIFT;
-		     size > 0 && l2_idx < ISP_L2PT_PTES; l2_idx++) {
-			l2_pt[l2_idx] = paddr >> ISP_PADDR_SHIFT;
+		l2_idx = (iova & ISP_L2PT_MASK) >> ISP_L2PT_SHIFT;
+		l2_entries = min_t(size_t, ISP_L2PT_PTES - l2_idx,
+				   size >> ISP_PAGE_SHIFT);
 
-			dev_dbg(dev, "l2 index %u mapped as 0x%8.8x\n", l2_idx,
-				l2_pt[l2_idx]);
-
-			iova += ISP_PAGE_SIZE;
-			paddr += ISP_PAGE_SIZE;
-			mapped += ISP_PAGE_SIZE;
-			size -= ISP_PAGE_SIZE;
-
-			l2_entries++;
-		}
+		/*
+		 * The run is physically contiguous, fill the PTEs of this
+		 * L2 table in one go and flush them with a single clflush.
+		 */
+		pteval = paddr >> ISP_PADDR_SHIFT;
+		for (i = 0; i < l2_entries; i++)
+			l2_pt[l2_idx + i] = pteval + i;
 
 		WARN_ON_ONCE(!l2_entries);
-		clflush_cache_range(&l2_pt[l2_idx - l2_entries],
+		clflush_cache_range(&l2_pt[l2_idx],
 				    sizeof(l2_pt[0]) * l2_entries);
+
+		dev_dbg(dev, "l2 index %u--%u mapped from 0x%8.8x\n", l2_idx,
+			l2_idx + l2_entries - 1, pteval);
+
+		iova += (unsigned long)l2_entries << ISP_PAGE_SHIFT;
+		paddr += (phys_addr_t)l2_entries << ISP_PAGE_SHIFT;
+		mapped += (size_t)l2_entries << ISP_PAGE_SHIFT;
+		size -= (size_t)l2_entries << ISP_PAGE_SHIFT;
 	}
 
 	spin_unlock_irqrestore(&mmu_info->lock, flags);
@@ -352,7 +613,7 @@ static void l2_unmap(struct ipu_mmu_info *mmu_info, unsigned long iova,
 {
 	u32 l1_idx;
 	u32 *l2_pt;
-	unsigned int l2_idx;
+	unsigned int l2_idx, i;
 	unsigned int l2_entries;
 	size_t unmapped = 0;
 	unsigned long flags;
@@ -371,25 +632,24 @@ static void l2_unmap(struct ipu_mmu_info *mmu_info, unsigned long iova,
 			continue;
 		}
 		l2_pt = mmu_info->l2_pts[l1_idx];
+		l2_idx = (iova & ISP_L2PT_MASK) >> ISP_L2PT_SHIFT;
+		l2_entries = min_t(size_t, ISP_L2PT_PTES - l2_idx,
+				   size >> ISP_PAGE_SHIFT);
 
-		l2_entries = 0;
-		for (l2_idx = (iova & ISP_L2PT_MASK) >> ISP_L2PT_SHIFT;
-		     size > 0 && l2_idx < ISP_L2PT_PTES; l2_idx++) {
-			dev_dbg(mmu_info->dev,
-				"unmap l2 index %u with pteval 0x%10.10llx\n",
-				l2_idx, TBL_PHYS_ADDR(l2_pt[l2_idx]));
-			l2_pt[l2_idx] = mmu_info->dummy_page_pteval;
-
-			iova += ISP_PAGE_SIZE;
-			unmapped += ISP_PAGE_SIZE;
-			size -= ISP_PAGE_SIZE;
-
-			l2_entries++;
-		}
+		dev_dbg(mmu_info->dev,
+			"unmap l2 index %u--%u from pteval 0x%10.10llx\n",
+			l2_idx, l2_idx + l2_entries - 1,
+			TBL_PHYS_ADDR(l2_pt[l2_idx]));
+		for (i = 0; i < l2_entries; i++)
+			l2_pt[l2_idx + i] = mmu_info->dummy_page_pteval;
 
 		WARN_ON_ONCE(!l2_entries);
-		clflush_cache_range(&l2_pt[l2_idx - l2_entries],
+		clflush_cache_range(&l2_pt[l2_idx],
 				    sizeof(l2_pt[0]) * l2_entries);
+
+		iova += (unsigned long)l2_entries << ISP_PAGE_SHIFT;
+		unmapped += (size_t)l2_entries << ISP_PAGE_SHIFT;
+		size -= (size_t)l2_entries << ISP_PAGE_SHIFT;
 	}
 
 	WARN_ON_ONCE(size);
@@ -404,61 +664,52 @@ static void __ipu_mmu_unmap(struct ipu_mmu_info *mmu_info,
 
 static int allocate_trash_buffer(struct ipu_mmu *mmu)
 {
+	struct ipu_mmu_info *mmu_info = mmu->dmap->mmu_info;
+	struct ipu_mmu_shared *sh = mmu_info->shared;
 	unsigned int n_pages = PAGE_ALIGN(IPU_MMUV2_TRASH_RANGE) >> PAGE_SHIFT;
 	struct iova *iova;
-	u32 iova_addr;
-	unsigned int i;
-	dma_addr_t dma;
-	int ret;
+	unsigned long flags;
+	u32 l1_idx, l1_end;
+
+	BUILD_BUG_ON(IPU_MMUV2_TRASH_RANGE & ~ISP_L1PT_MASK);
 
-	/* Allocate 8MB in iova range */
+	/*
+	 * Allocate 8MB in iova range, size aligned so that it spans whole L1
+	 * entries. Those all point at the shared trash L2 table, whose PTEs
+	 * map the trash page: nothing to map page by page.
+	 */
 	iova = alloc_iova(&mmu->dmap->iovad, n_pages,
-			  mmu->dmap->mmu_info->aperture_end >> PAGE_SHIFT, 0);
+			  mmu_info->aperture_end >> PAGE_SHIFT, true);
 	if (!iova) {
 		dev_err(mmu->dev, "cannot allocate iova range for trash\n");
 		return -ENOMEM;
 	}
 
-	dma = dma_map_page(mmu->dmap->mmu_info->dev, mmu->trash_page, 0,
-			   PAGE_SIZE, DMA_BIDIRECTIONAL);
-	if (dma_mapping_error(mmu->dmap->mmu_info->dev, dma)) {
-		dev_err(mmu->dmap->mmu_info->dev, "Failed to map trash page\n");
-		ret = -ENOMEM;
-		goto out_free_iova;
-	}
-
-	mmu->pci_trash_page = dma;
+	l1_idx = (iova->pfn_lo << PAGE_SHIFT) >> ISP_L1PT_SHIFT;
+	l1_end = l1_idx + (IPU_MMUV2_TRASH_RANGE >> ISP_L1PT_SHIFT);
 
-	/*
-	 * Map the 8MB iova address range to the same physical trash page
-	 * mmu->trash_page which is already reserved at the probe
-	 */
-	iova_addr = iova->pfn_lo;
-	for (i = 0; i < n_pages; i++) {
-		ret = ipu_mmu_map(mmu->dmap->mmu_info, iova_addr << PAGE_SHIFT,
-				  mmu->pci_trash_page, PAGE_SIZE);
-		if (ret) {
-			dev_err(mmu->dev,
-				"mapping trash buffer range failed\n");
-			goto out_unmap;
+	spin_lock_irqsave(&mmu_info->lock, flags);
+	for (; l1_idx < l1_end; l1_idx++) {
+		/* An earlier mapping may have left an empty L2 table here */
+		if (mmu_info->l1_pt[l1_idx] != mmu_info->dummy_l2_pteval) {
+			dma_unmap_single(mmu_info->dev,
+					 TBL_PHYS_ADDR(mmu_info->l1_pt[l1_idx]),
+					 PAGE_SIZE, DMA_BIDIRECTIONAL);
+			free_page((unsigned long)mmu_info->l2_pts[l1_idx]);
 		}
-
-		iova_addr++;
+		mmu_info->l1_pt[l1_idx] = sh->trash_l2_pteval;
+		mmu_info->l2_pts[l1_idx] = sh->trash_l2_pt;
+		clflush_cache_range(&mmu_info->l1_pt[l1_idx],
+				    sizeof(mmu_info->l1_pt[l1_idx]));
 	}
+	spin_unlock_irqrestore(&mmu_info->lock, flags);
 
+	mmu->trash_page = virt_to_page(sh->trash_page);
+	mmu->pci_trash_page = TBL_PHYS_ADDR(sh->trash_page_pteval);
 	mmu->iova_trash_page = iova->pfn_lo << PAGE_SHIFT;
 	dev_dbg(mmu->dev, "iova trash buffer for MMUID: %d is %u\n",
 		mmu->mmid, (unsigned int)mmu->iova_trash_page);
 	return 0;
-
-out_unmap:
-	ipu_mmu_unmap(mmu->dmap->mmu_info, iova->pfn_lo << PAGE_SHIFT,
-		      (iova->pfn_hi - iova->pfn_lo + 1) << PAGE_SHIFT);
-	dma_unmap_page(mmu->dmap->mmu_info->dev, mmu->pci_trash_page,
-		       PAGE_SIZE, DMA_BIDIRECTIONAL);
-out_free_iova:
-	__free_iova(&mmu->dmap->iovad, iova);
-	return ret;
 }
 
 int ipu_mmu_hw_init(struct ipu_mmu *mmu)
@@ -511,19 +762,11 @@ int ipu_mmu_hw_init(struct ipu_mmu *mmu)
 		}
 	}
 
-	if (!mmu->trash_page) {
+	if (!mmu->iova_trash_page) {
 		int ret;
 
-		mmu->trash_page = alloc_page(GFP_KERNEL);
-		if (!mmu->trash_page) {
-			dev_err(mmu->dev, "insufficient memory for trash buffer\n");
-			return -ENOMEM;
-		}
-
 		ret = allocate_trash_buffer(mmu);
 		if (ret) {
-			__free_page(mmu->trash_page);
-			mmu->trash_page = NULL;
 			dev_err(mmu->dev, "trash buffer allocation failed\n");
 			return ret;
 		}
@@ -540,7 +783,6 @@ EXPORT_SYMBOL(ipu_mmu_hw_init);
 static struct ipu_mmu_info *ipu_mmu_alloc(struct ipu_device *isp)
 {
 	struct ipu_mmu_info *mmu_info;
-	int ret;
 
 	mmu_info = kzalloc(sizeof(*mmu_info), GFP_KERNEL);
 	if (!mmu_info)
@@ -553,17 +795,18 @@ static struct ipu_mmu_info *ipu_mmu_alloc(struct ipu_device *isp)
 	mmu_info->pgsize_bitmap = SZ_4K;
 	mmu_info->dev = &isp->pdev->dev;
 
-	ret = get_dummy_page(mmu_info);
-	if (ret)
+	mmu_info->shared = ipu_mmu_shared_get(mmu_info->dev);
+	if (!mmu_info->shared)
 		goto err_free_info;
 
-	ret = alloc_dummy_l2_pt(mmu_info);
-	if (ret)
-		goto err_free_dummy_page;
+	mmu_info->dummy_page = mmu_info->shared->dummy_page;
+	mmu_info->dummy_page_pteval = mmu_info->shared->dummy_page_pteval;
+	mmu_info->dummy_l2_pt = mmu_info->shared->dummy_l2_pt;
+	mmu_info->dummy_l2_pteval = mmu_info->shared->dummy_l2_pteval;
 
 	mmu_info->l2_pts = vzalloc(ISP_L2PT_PTES * sizeof(*mmu_info->l2_pts));
 	if (!mmu_info->l2_pts)
-		goto err_free_dummy_l2_pt;
+		goto err_put_shared;
 
 	/*
 	 * We always map the L1 page table (a single page as well as
@@ -574,6 +817,10 @@ static struct ipu_mmu_info *ipu_mmu_alloc(struct ipu_device *isp)
 		goto err_free_l2_pts;
 
 	spin_lock_init(&mmu_info->lock);
+	INIT_LIST_HEAD(&mmu_info->l2_pool);
+	INIT_WORK(&mmu_info->l2_pool_work, l2_pool_work);
+	/* A short pool is fine, the map path tops it up */
+	l2_pool_fill(mmu_info);
 
 	dev_dbg(mmu_info->dev, "domain initialised\n");
 
@@ -581,10 +828,8 @@ static struct ipu_mmu_info *ipu_mmu_alloc(struct ipu_device *isp)
 
 err_free_l2_pts:
 	vfree(mmu_info->l2_pts);
-err_free_dummy_l2_pt:
-	free_dummy_l2_pt(mmu_info);
-err_free_dummy_page:
-	free_dummy_page(mmu_info);
+err_put_shared:
+	ipu_mmu_shared_put(mmu_info->shared);
 err_free_info:
 	kfree(mmu_info);
 
@@ -599,6 +844,11 @@ int ipu_mmu_hw_cleanup(struct ipu_mmu *mmu)
 	mmu->ready = false;
 	spin_unlock_irqrestore(&mmu->ready_lock, flags);
 
+	/* The TLB is gone with the power, release the quarantined IOVAs */
+	spin_lock_irqsave(&mmu->deferred_lock, flags);
+	tlb_flush_locked(mmu);
+	spin_unlock_irqrestore(&mmu->deferred_lock, flags);
+
 	return 0;
 }
 EXPORT_SYMBOL(ipu_mmu_hw_cleanup);
@@ -627,6 +877,10 @@ static struct ipu_dma_mapping *alloc_dma_mapping(struct ipu_device *isp)
 #endif
 	dmap->mmu_info->dmap = dmap;
 
+	/* The domain falls back to the rbtree when this fails */
+	if (ipu_dma_iova_cache_init(dmap))
+		dev_warn(&isp->pdev->dev, "no per-cpu iova cache\n");
+
 	kref_init(&dmap->ref);
 
 	dev_dbg(&isp->pdev->dev, "alloc mapping\n");
@@ -676,6 +930,7 @@ void ipu_mmu_unmap(struct ipu_mmu_info *mmu_info, unsigned long iova,
 
 	return __ipu_mmu_unmap(mmu_info, iova, size);
 }
+EXPORT_SYMBOL(ipu_mmu_unmap);
 
 /* drivers/iommu/iommu.c:iommu_map() */
 int ipu_mmu_map(struct ipu_mmu_info *mmu_info, unsigned long iova,
@@ -706,6 +961,7 @@ int ipu_mmu_map(struct ipu_mmu_info *mmu_info, unsigned long iova,
 
 	return  __ipu_mmu_map(mmu_info, iova, paddr, size);
 }
+EXPORT_SYMBOL(ipu_mmu_map);
 
 static void ipu_mmu_destroy(struct ipu_mmu *mmu)
 {
@@ -717,25 +973,20 @@ static void ipu_mmu_destroy(struct ipu_mmu *mmu)
 	if (mmu->iova_trash_page) {
 		iova = find_iova(&dmap->iovad,
 				 mmu->iova_trash_page >> PAGE_SHIFT);
-		if (iova) {
-			/* unmap and free the trash buffer iova */
-			ipu_mmu_unmap(mmu_info, iova->pfn_lo << PAGE_SHIFT,
-				      (iova->pfn_hi - iova->pfn_lo + 1) <<
-				      PAGE_SHIFT);
+		/* The trash L1 entries are skipped below, just free the iova */
+		if (iova)
 			__free_iova(&dmap->iovad, iova);
-		} else {
+		else
 			dev_err(mmu->dev, "trash buffer iova not found.\n");
-		}
 
 		mmu->iova_trash_page = 0;
-		dma_unmap_page(mmu_info->dev, mmu->pci_trash_page,
-			       PAGE_SIZE, DMA_BIDIRECTIONAL);
 		mmu->pci_trash_page = 0;
-		__free_page(mmu->trash_page);
+		mmu->trash_page = NULL;
 	}
 
 	for (l1_idx = 0; l1_idx < ISP_L1PT_PTES; l1_idx++) {
-		if (mmu_info->l1_pt[l1_idx] != mmu_info->dummy_l2_pteval) {
+		if (mmu_info->l1_pt[l1_idx] != mmu_info->dummy_l2_pteval &&
+		    mmu_info->l1_pt[l1_idx] != mmu_info->shared->trash_l2_pteval) {
 			dma_unmap_single(mmu_info->dev,
 					 TBL_PHYS_ADDR(mmu_info->l1_pt[l1_idx]),
 					 PAGE_SIZE, DMA_BIDIRECTIONAL);
@@ -743,11 +994,11 @@ static void ipu_mmu_destroy(struct ipu_mmu *mmu)
 		}
 	}
 
-	free_dummy_page(mmu_info);
+	l2_pool_free(mmu_info);
 	dma_unmap_single(mmu_info->dev, mmu_info->l1_pt_dma << ISP_PADDR_SHIFT,
 			 PAGE_SIZE, DMA_BIDIRECTIONAL);
-	free_page((unsigned long)mmu_info->dummy_l2_pt);
 	free_page((unsigned long)mmu_info->l1_pt);
+	ipu_mmu_shared_put(mmu_info->shared);
 	kfree(mmu_info);
 }
 
@@ -788,8 +1039,11 @@ struct ipu_mmu *ipu_mmu_init(struct device *dev,
 	mmu->nr_mmus = hw->nr_mmus;
 	mmu->tlb_invalidate = tlb_invalidate;
 	mmu->ready = false;
-	INIT_LIST_HEAD(&mmu->vma_list);
+	mmu->vma_tree = RB_ROOT;
+	spin_lock_init(&mmu->vma_lock);
 	spin_lock_init(&mmu->ready_lock);
+	mutex_init(&mmu->tlb_batch_mutex);
+	spin_lock_init(&mmu->deferred_lock);
 
 	mmu->dmap = alloc_dma_mapping(isp);
 	if (!mmu->dmap) {
@@ -803,9 +1057,15 @@ struct ipu_mmu *ipu_mmu_init(struct device *dev,
 void ipu_mmu_cleanup(struct ipu_mmu *mmu)
 {
 	struct ipu_dma_mapping *dmap = mmu->dmap;
+	unsigned long flags;
+
+	spin_lock_irqsave(&mmu->deferred_lock, flags);
+	tlb_flush_locked(mmu);
+	spin_unlock_irqrestore(&mmu->deferred_lock, flags);
 
 	ipu_mmu_destroy(mmu);
 	mmu->dmap = NULL;
+	ipu_dma_iova_cache_destroy(dmap);
 	iova_cache_put();
 	put_iova_domain(&dmap->iovad);
 	kfree(dmap);
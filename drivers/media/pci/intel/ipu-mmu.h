@@ -5,6 +5,10 @@
 #define IPU_MMU_H
 
 #include <linux/dma-mapping.h>
+#include <linux/iova.h>
+#include <linux/mutex.h>
+#include <linux/rbtree.h>
+#include <linux/workqueue.h>
 
 #include "ipu.h"
 #include "ipu-pdata.h"
@@ -12,6 +16,15 @@
 #define ISYS_MMID 1
 #define PSYS_MMID 0
 
+/* Upper bound of IOVAs quarantined until the next TLB invalidation */
+#define IPU_MMU_MAX_DEFERRED	64
+
+/* L2 page tables kept ready for the map path, refilled below the low mark */
+#define IPU_MMU_L2_POOL_SIZE	8
+#define IPU_MMU_L2_POOL_LOW	4
+
+struct ipu_mmu_shared;
+
 /*
  * @pgtbl: virtual address of the l1 page table (one page)
  */
@@ -22,6 +35,8 @@ struct ipu_mmu_info {
 	u32 l1_pt_dma;
 	u32 **l2_pts;
 
+	/* Copies of the tables shared with the other MMU infos */
+	struct ipu_mmu_shared *shared;
 	u32 *dummy_l2_pt;
 	u32 dummy_l2_pteval;
 	void *dummy_page;
@@ -33,6 +48,14 @@ struct ipu_mmu_info {
 
 	spinlock_t lock;	/* Serialize access to users */
 	struct ipu_dma_mapping *dmap;
+
+	/*
+	 * Zeroed, dummy filled and DMA mapped L2 tables, the DMA address in
+	 * page_private(). Under lock, refilled by l2_pool_work.
+	 */
+	struct list_head l2_pool;
+	unsigned int l2_pool_count;
+	struct work_struct l2_pool_work;
 };
 
 /*
@@ -49,7 +72,8 @@ struct ipu_mmu {
 	struct device *dev;
 
 	struct ipu_dma_mapping *dmap;
-	struct list_head vma_list;
+	struct rb_root vma_tree;	/* vm_info of coherent buffers */
+	spinlock_t vma_lock;	/* Protects vma_tree */
 
 	struct page *trash_page;
 	dma_addr_t pci_trash_page; /* IOVA from PCI DMA services (parent) */
@@ -58,6 +82,16 @@ struct ipu_mmu {
 	bool ready;
 	spinlock_t ready_lock;	/* Serialize access to bool ready */
 
+	/* Serialize TLB invalidation batches, see ipu_mmu_tlb_batch_begin() */
+	struct mutex tlb_batch_mutex;
+	struct task_struct *tlb_batch_owner;
+	bool tlb_batch_pending;
+
+	/* Unmapped IOVAs waiting for a TLB flush, see ipu_mmu_defer_unmap() */
+	spinlock_t deferred_lock;
+	unsigned int nr_deferred;
+	struct iova *deferred_iovas[IPU_MMU_MAX_DEFERRED];
+
 	void (*tlb_invalidate)(struct ipu_mmu *mmu);
 };
 
@@ -73,4 +107,9 @@ void ipu_mmu_unmap(struct ipu_mmu_info *mmu_info, unsigned long iova,
 		   size_t size);
 phys_addr_t ipu_mmu_iova_to_phys(struct ipu_mmu_info *mmu_info,
 				 dma_addr_t iova);
+void ipu_mmu_tlb_batch_begin(struct ipu_mmu *mmu);
+void ipu_mmu_tlb_batch_end(struct ipu_mmu *mmu);
+bool ipu_mmu_defer_unmap(struct ipu_mmu *mmu, struct iova *iova);
+void ipu_mmu_tlb_flush_pending(struct ipu_mmu *mmu);
+void ipu_mmu_tlb_invalidate_unmap(struct ipu_mmu *mmu);
 #endif
@@ -53,37 +53,17 @@ struct ipu_psys_manifest32 {
 	u32 reserved[5];
 } __packed;
 
-static int
-get_ipu_psys_command32(struct ipu_psys_command *kp,
-		       struct ipu_psys_command32 __user *up)
-{
-	compat_uptr_t pgm, bufs;
-	bool access_ok;
-
-#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 0, 0)
-	access_ok = access_ok(VERIFY_READ, up,
-		sizeof(struct ipu_psys_command32));
-#else
-	access_ok = access_ok(up, sizeof(struct ipu_psys_command32));
-#endif
-	if (!access_ok || get_user(kp->issue_id, &up->issue_id) ||
-	    get_user(kp->user_token, &up->user_token) ||
-	    get_user(kp->priority, &up->priority) ||
-	    get_user(pgm, &up->pg_manifest) ||
-	    get_user(bufs, &up->buffers) ||
-	    get_user(kp->pg, &up->pg) ||
-	    get_user(kp->pg_manifest_size, &up->pg_manifest_size) ||
-	    get_user(kp->bufcount, &up->bufcount) ||
-	    get_user(kp->min_psys_freq, &up->min_psys_freq) ||
-	    get_user(kp->frame_counter, &up->frame_counter)
-	    )
-		return -EFAULT;
-
-	kp->pg_manifest = compat_ptr(pgm);
-	kp->buffers = compat_ptr(bufs);
+struct ipu_psys_mapbuf_batch32 {
+	u32 count;
+	compat_uptr_t entries;
+	u32 reserved[4];
+} __packed;
 
-	return 0;
-}
+struct ipu_psys_events32 {
+	u32 count;
+	compat_uptr_t events;
+	u32 reserved[4];
+} __packed;
 
 static int
 get_ipu_psys_buffer32(struct ipu_psys_buffer *kp,
@@ -174,38 +154,120 @@ put_ipu_psys_manifest32(struct ipu_psys_manifest *kp,
 	return 0;
 }
 
+static int
+get_ipu_psys_mapbuf_batch32(struct ipu_psys_mapbuf_batch *kp,
+			    struct ipu_psys_mapbuf_batch32 __user *up)
+{
+	compat_uptr_t ptr;
+	bool access_ok;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 0, 0)
+	access_ok = access_ok(VERIFY_READ, up,
+		sizeof(struct ipu_psys_mapbuf_batch32));
+#else
+	access_ok = access_ok(up, sizeof(struct ipu_psys_mapbuf_batch32));
+#endif
+	if (!access_ok || get_user(kp->count, &up->count) ||
+	    get_user(ptr, &up->entries))
+		return -EFAULT;
+
+	kp->entries = compat_ptr(ptr);
+
+	return 0;
+}
+
 #define IPU_IOC_GETBUF32 _IOWR('A', 4, struct ipu_psys_buffer32)
 #define IPU_IOC_PUTBUF32 _IOWR('A', 5, struct ipu_psys_buffer32)
 #define IPU_IOC_QCMD32 _IOWR('A', 6, struct ipu_psys_command32)
 #define IPU_IOC_CMD_CANCEL32 _IOWR('A', 8, struct ipu_psys_command32)
 #define IPU_IOC_GET_MANIFEST32 _IOWR('A', 9, struct ipu_psys_manifest32)
+#define IPU_IOC_MAPBUF_BATCH32 _IOWR('A', 10, struct ipu_psys_mapbuf_batch32)
+#define IPU_IOC_UNMAPBUF_BATCH32 _IOWR('A', 11, struct ipu_psys_mapbuf_batch32)
+#define IPU_IOC_DQEVENTS32 _IOWR('A', 14, struct ipu_psys_events32)
+
+/*
+ * QCMD and DQEVENTS are on the hot path: decode them with a single copy
+ * straight into what the native handlers take. The buffer array needs no
+ * conversion, struct ipu_psys_buffer32 has the native layout and the
+ * handlers only use base.fd, so ipu_psys_kcmd_new() copies it into the
+ * kcmd directly from the compat pointer.
+ */
+static long ipu_psys_compat_qcmd(struct ipu_psys_fh *fh,
+				 struct ipu_psys_command32 __user *up)
+{
+	struct ipu_psys_command32 cmd32;
+	struct ipu_psys_command cmd = { 0 };
+
+	if (copy_from_user(&cmd32, up, sizeof(cmd32)))
+		return -EFAULT;
+
+	cmd.issue_id = cmd32.issue_id;
+	cmd.user_token = cmd32.user_token;
+	cmd.priority = cmd32.priority;
+	cmd.pg_manifest = compat_ptr(cmd32.pg_manifest);
+	cmd.buffers = compat_ptr(cmd32.buffers);
+	cmd.pg = cmd32.pg;
+	cmd.pg_manifest_size = cmd32.pg_manifest_size;
+	cmd.bufcount = cmd32.bufcount;
+	cmd.min_psys_freq = cmd32.min_psys_freq;
+	cmd.frame_counter = cmd32.frame_counter;
+
+	return ipu_psys_kcmd_new(&cmd, fh);
+}
+
+static long ipu_psys_compat_dqevents(struct file *file,
+				     struct ipu_psys_events32 __user *up)
+{
+	struct ipu_psys_events32 events32;
+	struct ipu_psys_events events;
+	long err;
+
+	if (copy_from_user(&events32, up, sizeof(events32)))
+		return -EFAULT;
+
+	events.count = events32.count;
+	events.events = compat_ptr(events32.events);
+
+	err = ipu_ioctl_dqevents(&events, file->private_data, file->f_flags);
+	if (err)
+		return err;
+
+	return put_user(events.count, &up->count);
+}
 
 long ipu_psys_compat_ioctl32(struct file *file, unsigned int cmd,
 			     unsigned long arg)
 {
 	union {
 		struct ipu_psys_buffer buf;
-		struct ipu_psys_command cmd;
 		struct ipu_psys_event ev;
 		struct ipu_psys_manifest m;
+		struct ipu_psys_mapbuf_batch batch;
 	} karg;
 	int compatible_arg = 1;
 	int err = 0;
 	void __user *up = compat_ptr(arg);
 
 	switch (cmd) {
+	case IPU_IOC_QCMD32:
+		return ipu_psys_compat_qcmd(file->private_data, up);
+	case IPU_IOC_DQEVENTS32:
+		return ipu_psys_compat_dqevents(file, up);
 	case IPU_IOC_GETBUF32:
 		cmd = IPU_IOC_GETBUF;
 		break;
 	case IPU_IOC_PUTBUF32:
 		cmd = IPU_IOC_PUTBUF;
 		break;
-	case IPU_IOC_QCMD32:
-		cmd = IPU_IOC_QCMD;
-		break;
 	case IPU_IOC_GET_MANIFEST32:
 		cmd = IPU_IOC_GET_MANIFEST;
 		break;
+	case IPU_IOC_MAPBUF_BATCH32:
+		cmd = IPU_IOC_MAPBUF_BATCH;
+		break;
+	case IPU_IOC_UNMAPBUF_BATCH32:
+		cmd = IPU_IOC_UNMAPBUF_BATCH;
+		break;
 	}
 
 	switch (cmd) {
@@ -214,14 +276,15 @@ long ipu_psys_compat_ioctl32(struct file *file, unsigned int cmd,
 		err = get_ipu_psys_buffer32(&karg.buf, up);
 		compatible_arg = 0;
 		break;
-	case IPU_IOC_QCMD:
-		err = get_ipu_psys_command32(&karg.cmd, up);
-		compatible_arg = 0;
-		break;
 	case IPU_IOC_GET_MANIFEST:
 		err = get_ipu_psys_manifest32(&karg.m, up);
 		compatible_arg = 0;
 		break;
+	case IPU_IOC_MAPBUF_BATCH:
+	case IPU_IOC_UNMAPBUF_BATCH:
+		err = get_ipu_psys_mapbuf_batch32(&karg.batch, up);
+		compatible_arg = 0;
+		break;
 	}
 	if (err)
 		return err;
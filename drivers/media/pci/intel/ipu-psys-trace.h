@@ -0,0 +1,68 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2024 Intel Corporation */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ipu_psys
+
+#if !defined(IPU_PSYS_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define IPU_PSYS_TRACE_H
+
+#include <linux/tracepoint.h>
+
+#include "ipu.h"
+#include "ipu-psys.h"
+
+/*
+ * kcmd life cycle stages. id is the kcmd_idr id, only valid while the
+ * kcmd is in the firmware; issue_id identifies the command end to end.
+ */
+DECLARE_EVENT_CLASS(ipu_psys_kcmd_class,
+	TP_PROTO(struct ipu_psys_kcmd *kcmd),
+	TP_ARGS(kcmd),
+	TP_STRUCT__entry(
+		__field(const void *, fh)
+		__field(int, id)
+		__field(int, ppg_id)
+		__field(u64, issue_id)
+		__field(u64, tsc)
+	),
+	TP_fast_assign(
+		__entry->fh = kcmd->fh;
+		__entry->id = kcmd->id;
+		__entry->ppg_id = ipu_fw_psys_pg_get_id(kcmd);
+		__entry->issue_id = kcmd->issue_id;
+		ipu_buttress_tsc_read(kcmd->fh->psys->adev->isp,
+				      &__entry->tsc);
+	),
+	TP_printk("fh=%p kcmd=%d ppg=%d issue_id=0x%llx tsc=%llu",
+		  __entry->fh, __entry->id, __entry->ppg_id,
+		  __entry->issue_id, __entry->tsc)
+);
+
+DEFINE_EVENT(ipu_psys_kcmd_class, ipu_psys_kcmd_queue,
+	TP_PROTO(struct ipu_psys_kcmd *kcmd),
+	TP_ARGS(kcmd)
+);
+
+DEFINE_EVENT(ipu_psys_kcmd_class, ipu_psys_kcmd_start,
+	TP_PROTO(struct ipu_psys_kcmd *kcmd),
+	TP_ARGS(kcmd)
+);
+
+DEFINE_EVENT(ipu_psys_kcmd_class, ipu_psys_kcmd_done,
+	TP_PROTO(struct ipu_psys_kcmd *kcmd),
+	TP_ARGS(kcmd)
+);
+
+DEFINE_EVENT(ipu_psys_kcmd_class, ipu_psys_kcmd_dequeue,
+	TP_PROTO(struct ipu_psys_kcmd *kcmd),
+	TP_ARGS(kcmd)
+);
+
+#endif /* IPU_PSYS_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ipu-psys-trace
+#include <trace/define_trace.h>
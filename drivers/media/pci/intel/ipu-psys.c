@@ -5,6 +5,7 @@
 #include <linux/delay.h>
 #include <linux/device.h>
 #include <linux/dma-buf.h>
+#include <linux/eventfd.h>
 #include <linux/firmware.h>
 #include <linux/fs.h>
 #include <linux/highmem.h>
@@ -13,6 +14,7 @@
 #include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/pm_runtime.h>
+#include <linux/sizes.h>
 #include <linux/version.h>
 #include <linux/poll.h>
 #if LINUX_VERSION_CODE < KERNEL_VERSION(4, 14, 0)
@@ -31,6 +33,7 @@
 #include <uapi/linux/ipu-psys.h>
 
 #include "ipu.h"
+#include "ipu-gpc-pmu.h"
 #include "ipu-mmu.h"
 #include "ipu-bus.h"
 #include "ipu-platform.h"
@@ -42,15 +45,51 @@
 #include "ipu-platform-regs.h"
 #include "ipu-fw-com.h"
 
+#define CREATE_TRACE_POINTS
+#include "ipu-psys-trace.h"
+
 static bool async_fw_init;
 module_param(async_fw_init, bool, 0664);
 MODULE_PARM_DESC(async_fw_init, "Enable asynchronous firmware initialization");
 
+static unsigned long kbuf_lru_max_bytes = SZ_128M;
+module_param(kbuf_lru_max_bytes, ulong, 0664);
+MODULE_PARM_DESC(kbuf_lru_max_bytes,
+		 "Max bytes of unreferenced dma-buf mappings cached per fh");
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
+static unsigned long pin_cache_max_bytes = SZ_256M;
+module_param(pin_cache_max_bytes, ulong, 0664);
+MODULE_PARM_DESC(pin_cache_max_bytes,
+		 "Max bytes of userptr pages kept pinned once unused, 0 to disable");
+#endif
+
+#define IPU_PSYS_IRQ_POLL_ROUNDS	8
+
+static unsigned int irq_poll_us;
+module_param(irq_poll_us, uint, 0664);
+MODULE_PARM_DESC(irq_poll_us,
+		 "Poll for firmware events every this many us after an interrupt, 0 to disable");
+
+static unsigned int irq_poll_rounds = IPU_PSYS_IRQ_POLL_ROUNDS;
+module_param(irq_poll_rounds, uint, 0664);
+MODULE_PARM_DESC(irq_poll_rounds,
+		 "Polls finding events before waiting for an interrupt again");
+
+static unsigned int autosuspend_ms;
+module_param(autosuspend_ms, uint, 0444);
+MODULE_PARM_DESC(autosuspend_ms,
+		 "Keep PSYS powered this many ms after the last user, 0 to power off at once");
+
+static unsigned int autosuspend_max_ms;
+module_param(autosuspend_max_ms, uint, 0444);
+MODULE_PARM_DESC(autosuspend_max_ms,
+		 "Adapt the PSYS autosuspend delay to stop-start gaps up to this many ms");
+
 #define IPU_PSYS_NUM_DEVICES		4
 
 #define IPU_PSYS_MAX_NUM_DESCS		1024
 #define IPU_PSYS_MAX_NUM_BUFS		1024
-#define IPU_PSYS_MAX_NUM_BUFS_LRU	12
 
 static int psys_runtime_pm_resume(struct device *dev);
 static int psys_runtime_pm_suspend(struct device *dev);
@@ -81,12 +120,33 @@ static void ipu_desc_add(struct ipu_psys_fh *fh, struct ipu_psys_desc *desc)
 
 	WARN_ON_ONCE(fh->num_descs >= IPU_PSYS_MAX_NUM_DESCS);
 	list_add(&desc->list, &fh->descs_list);
+	hash_add(fh->descs_hash, &desc->hnode, desc->fd);
 }
 
 static void ipu_desc_del(struct ipu_psys_fh *fh, struct ipu_psys_desc *desc)
 {
 	fh->num_descs--;
 	list_del_init(&desc->list);
+	hash_del(&desc->hnode);
+}
+
+/*
+ * The dma_buf index is keyed by the dma_buf pointer, so a kbuffer is
+ * hashed once its dbuf is known and unhashed when the dbuf is dropped.
+ * It stays hashed while moving between bufs_list and bufs_lru.
+ */
+static void ipu_buffer_hash_add(struct ipu_psys_fh *fh,
+				struct ipu_psys_kbuffer *kbuf)
+{
+	if (hash_hashed(&kbuf->hnode))
+		return;
+
+	hash_add(fh->bufs_hash, &kbuf->hnode, (unsigned long)kbuf->dbuf);
+}
+
+static void ipu_buffer_hash_del(struct ipu_psys_kbuffer *kbuf)
+{
+	hash_del(&kbuf->hnode);
 }
 
 static void ipu_buffer_add(struct ipu_psys_fh *fh,
@@ -109,6 +169,8 @@ static void ipu_buffer_lru_add(struct ipu_psys_fh *fh,
 			       struct ipu_psys_kbuffer *kbuf)
 {
 	fh->num_bufs_lru++;
+	fh->lru_bytes += kbuf->len;
+	kbuf->lru = true;
 	list_add_tail(&kbuf->list, &fh->bufs_lru);
 }
 
@@ -116,6 +178,8 @@ static void ipu_buffer_lru_del(struct ipu_psys_fh *fh,
 			       struct ipu_psys_kbuffer *kbuf)
 {
 	fh->num_bufs_lru--;
+	fh->lru_bytes -= kbuf->len;
+	kbuf->lru = false;
 	list_del_init(&kbuf->list);
 }
 
@@ -129,6 +193,7 @@ static struct ipu_psys_kbuffer *ipu_psys_kbuffer_alloc(void)
 
 	atomic_set(&kbuf->map_count, 0);
 	INIT_LIST_HEAD(&kbuf->list);
+	INIT_HLIST_NODE(&kbuf->hnode);
 	return kbuf;
 }
 
@@ -142,41 +207,135 @@ static struct ipu_psys_desc *ipu_psys_desc_alloc(int fd)
 
 	desc->fd = fd;
 	INIT_LIST_HEAD(&desc->list);
+	INIT_HLIST_NODE(&desc->hnode);
 	return desc;
 }
 
-struct ipu_psys_pg *__get_pg_buf(struct ipu_psys *psys, size_t pg_size)
+static unsigned int ipu_psys_pg_class_idx(size_t size)
+{
+	unsigned int idx = 0;
+
+	while (idx < IPU_PSYS_PG_NUM_CLASSES - 1 && (PAGE_SIZE << idx) < size)
+		idx++;
+
+	return idx;
+}
+
+static struct ipu_psys_pg *ipu_psys_pg_alloc(struct ipu_psys *psys,
+					     size_t size)
 {
+	unsigned int idx = ipu_psys_pg_class_idx(size);
 	struct ipu_psys_pg *kpg;
-	unsigned long flags;
 
-	spin_lock_irqsave(&psys->pgs_lock, flags);
-	list_for_each_entry(kpg, &psys->pgs, list) {
-		if (!kpg->pg_size && kpg->size >= pg_size) {
-			kpg->pg_size = pg_size;
-			spin_unlock_irqrestore(&psys->pgs_lock, flags);
-			return kpg;
-		}
-	}
-	spin_unlock_irqrestore(&psys->pgs_lock, flags);
-	/* no big enough buffer available, allocate new one */
+	/* Round up to the class size so that the buffer can be reused */
+	if (idx < IPU_PSYS_PG_NUM_CLASSES - 1)
+		size = PAGE_SIZE << idx;
+	else
+		size = PAGE_ALIGN(size);
+
 	kpg = kzalloc(sizeof(*kpg), GFP_KERNEL);
 	if (!kpg)
 		return NULL;
 
-	kpg->pg = dma_alloc_attrs(&psys->adev->dev, pg_size,
+	kpg->pg = dma_alloc_attrs(&psys->adev->dev, size,
 				  &kpg->pg_dma_addr, GFP_KERNEL, 0);
 	if (!kpg->pg) {
 		kfree(kpg);
 		return NULL;
 	}
 
-	kpg->pg_size = pg_size;
-	kpg->size = pg_size;
+	kpg->size = size;
+
+	return kpg;
+}
+
+static void ipu_psys_pg_add(struct ipu_psys *psys, struct ipu_psys_pg *kpg)
+{
+	struct ipu_psys_pg_class *class =
+		&psys->pg_classes[ipu_psys_pg_class_idx(kpg->size)];
+	unsigned long flags;
+
+	spin_lock_irqsave(&psys->pgs_lock, flags);
+	list_add(&kpg->list, &class->pgs);
+	class->count++;
+	spin_unlock_irqrestore(&psys->pgs_lock, flags);
+}
+
+static void ipu_psys_pg_pool_free(struct ipu_psys *psys)
+{
+	struct ipu_psys_pg *kpg, *kpg0;
+	unsigned int i;
+
+	for (i = 0; i < IPU_PSYS_PG_NUM_CLASSES; i++) {
+		list_for_each_entry_safe(kpg, kpg0, &psys->pg_classes[i].pgs,
+					 list) {
+			dma_free_attrs(&psys->adev->dev, kpg->size, kpg->pg,
+				       kpg->pg_dma_addr, 0);
+			kfree(kpg);
+		}
+		INIT_LIST_HEAD(&psys->pg_classes[i].pgs);
+		psys->pg_classes[i].count = 0;
+	}
+}
+
+/*
+ * Top up the class of a process group size to IPU_PSYS_PG_CLASS_RESERVE
+ * free buffers, so that the submit path finds one without allocating.
+ */
+static void ipu_psys_pg_pool_reserve(struct ipu_psys *psys, size_t size)
+{
+	unsigned int idx = ipu_psys_pg_class_idx(size);
+	struct ipu_psys_pg_class *class = &psys->pg_classes[idx];
+	struct ipu_psys_pg *kpg;
+	unsigned int nfree = 0;
+	unsigned long flags;
+
+	spin_lock_irqsave(&psys->pgs_lock, flags);
+	list_for_each_entry(kpg, &class->pgs, list)
+		if (!kpg->pg_size && kpg->size >= size)
+			nfree++;
+	spin_unlock_irqrestore(&psys->pgs_lock, flags);
+
+	for (; nfree < IPU_PSYS_PG_CLASS_RESERVE; nfree++) {
+		kpg = ipu_psys_pg_alloc(psys, size);
+		if (!kpg)
+			return;
+		ipu_psys_pg_add(psys, kpg);
+	}
+}
+
+struct ipu_psys_pg *__get_pg_buf(struct ipu_psys *psys, size_t pg_size)
+{
+	unsigned int idx = ipu_psys_pg_class_idx(pg_size);
+	struct ipu_psys_pg_class *class;
+	struct ipu_psys_pg *kpg;
+	unsigned long flags;
+	unsigned int i;
+
 	spin_lock_irqsave(&psys->pgs_lock, flags);
-	list_add(&kpg->list, &psys->pgs);
+	/* Fall back to the bigger classes before allocating */
+	for (i = idx; i < IPU_PSYS_PG_NUM_CLASSES; i++) {
+		list_for_each_entry(kpg, &psys->pg_classes[i].pgs, list) {
+			if (!kpg->pg_size && kpg->size >= pg_size) {
+				kpg->pg_size = pg_size;
+				psys->pg_classes[idx].hits++;
+				spin_unlock_irqrestore(&psys->pgs_lock, flags);
+				return kpg;
+			}
+		}
+	}
+	class = &psys->pg_classes[idx];
+	class->misses++;
 	spin_unlock_irqrestore(&psys->pgs_lock, flags);
 
+	/* no big enough buffer available, allocate new one */
+	kpg = ipu_psys_pg_alloc(psys, pg_size);
+	if (!kpg)
+		return NULL;
+
+	kpg->pg_size = pg_size;
+	ipu_psys_pg_add(psys, kpg);
+
 	return kpg;
 }
 
@@ -184,7 +343,7 @@ static struct ipu_psys_desc *psys_desc_lookup(struct ipu_psys_fh *fh, int fd)
 {
 	struct ipu_psys_desc *desc;
 
-	list_for_each_entry(desc, &fh->descs_list, list) {
+	hash_for_each_possible(fh->descs_hash, desc, hnode, fd) {
 		if (desc->fd == fd)
 			return desc;
 	}
@@ -199,7 +358,7 @@ static bool dmabuf_cmp(struct dma_buf *lb, struct dma_buf *rb)
 
 static struct ipu_psys_kbuffer *psys_buf_lookup(struct ipu_psys_fh *fh, int fd)
 {
-	struct ipu_psys_kbuffer *kbuf;
+	struct ipu_psys_kbuffer *kbuf, *lru_kbuf = NULL;
 	struct dma_buf *dma_buf;
 
 	dma_buf = dma_buf_get(fd);
@@ -207,31 +366,35 @@ static struct ipu_psys_kbuffer *psys_buf_lookup(struct ipu_psys_fh *fh, int fd)
 		return NULL;
 
 	/*
-	 * First lookup so-called `active` list, that is the list of
-	 * referenced buffers
+	 * Prefer a buffer from the so-called `active` list, that is the
+	 * list of referenced buffers, over one from the LRU list.
 	 */
-	list_for_each_entry(kbuf, &fh->bufs_list, list) {
-		if (dmabuf_cmp(kbuf->dbuf, dma_buf)) {
+	hash_for_each_possible(fh->bufs_hash, kbuf, hnode,
+			       (unsigned long)dma_buf) {
+		if (!dmabuf_cmp(kbuf->dbuf, dma_buf))
+			continue;
+
+		if (!kbuf->lru) {
 			dma_buf_put(dma_buf);
 			return kbuf;
 		}
+
+		if (!lru_kbuf)
+			lru_kbuf = kbuf;
 	}
 
+	dma_buf_put(dma_buf);
+
 	/*
-	 * We didn't find anything on the `active` list, try the LRU list
-	 * (list of unreferenced buffers) and possibly resurrect a buffer
+	 * We didn't find anything on the `active` list, possibly resurrect
+	 * a buffer from the LRU list (list of unreferenced buffers)
 	 */
-	list_for_each_entry(kbuf, &fh->bufs_lru, list) {
-		if (dmabuf_cmp(kbuf->dbuf, dma_buf)) {
-			dma_buf_put(dma_buf);
-			ipu_buffer_lru_del(fh, kbuf);
-			ipu_buffer_add(fh, kbuf);
-			return kbuf;
-		}
+	if (lru_kbuf) {
+		ipu_buffer_lru_del(fh, lru_kbuf);
+		ipu_buffer_add(fh, lru_kbuf);
 	}
 
-	dma_buf_put(dma_buf);
-	return NULL;
+	return lru_kbuf;
 }
 
 struct ipu_psys_kbuffer *ipu_psys_lookup_kbuffer(struct ipu_psys_fh *fh, int fd)
@@ -258,6 +421,221 @@ ipu_psys_lookup_kbuffer_by_kaddr(struct ipu_psys_fh *fh, void *kaddr)
 	return NULL;
 }
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
+static void ipu_psys_pin_release(struct kref *ref)
+{
+	struct ipu_psys_pin *pin = container_of(ref, struct ipu_psys_pin, ref);
+
+	mmu_interval_notifier_remove(&pin->notifier);
+	unpin_user_pages_dirty_lock(pin->pages, pin->npages, true);
+	kvfree(pin->pages);
+	kfree(pin);
+}
+
+static void ipu_psys_pin_put(struct ipu_psys_pin *pin)
+{
+	kref_put(&pin->ref, ipu_psys_pin_release);
+}
+
+/* Drop the cache references of the pins taken out of the cache */
+static void ipu_psys_pin_reap(struct ipu_psys *psys)
+{
+	struct ipu_psys_pin *pin, *tmp;
+	LIST_HEAD(stale);
+
+	spin_lock(&psys->pins_lock);
+	list_splice_init(&psys->pins_stale, &stale);
+	spin_unlock(&psys->pins_lock);
+
+	list_for_each_entry_safe(pin, tmp, &stale, list) {
+		list_del(&pin->list);
+		ipu_psys_pin_put(pin);
+	}
+}
+
+/* Under pins_lock. The reference goes at the next ipu_psys_pin_reap() */
+static void ipu_psys_pin_uncache(struct ipu_psys_pin *pin)
+{
+	struct ipu_psys *psys = pin->psys;
+
+	if (!pin->cached)
+		return;
+
+	pin->cached = false;
+	psys->pins_bytes -= pin->npages << PAGE_SHIFT;
+	list_move_tail(&pin->list, &psys->pins_stale);
+}
+
+/*
+ * Called with the mm locked, the pin can't be released from here as that
+ * waits for the invalidation to finish.
+ */
+static bool ipu_psys_pin_invalidate(struct mmu_interval_notifier *mni,
+				    const struct mmu_notifier_range *range,
+				    unsigned long cur_seq)
+{
+	struct ipu_psys_pin *pin =
+	    container_of(mni, struct ipu_psys_pin, notifier);
+	struct ipu_psys *psys = pin->psys;
+
+	spin_lock(&psys->pins_lock);
+	mmu_interval_set_seq(mni, cur_seq);
+	if (!pin->stale)
+		psys->pin_invalidations++;
+	pin->stale = true;
+	ipu_psys_pin_uncache(pin);
+	spin_unlock(&psys->pins_lock);
+
+	return true;
+}
+
+static const struct mmu_interval_notifier_ops ipu_psys_pin_ops = {
+	.invalidate = ipu_psys_pin_invalidate,
+};
+
+static struct ipu_psys_pin *ipu_psys_pin_lookup(struct ipu_psys *psys,
+						unsigned long start,
+						unsigned long npages)
+{
+	struct ipu_psys_pin *pin;
+
+	spin_lock(&psys->pins_lock);
+	list_for_each_entry(pin, &psys->pins, list) {
+		if (pin->mm == current->mm && pin->start == start &&
+		    pin->npages == npages) {
+			kref_get(&pin->ref);
+			list_move_tail(&pin->list, &psys->pins);
+			psys->pin_hits++;
+			spin_unlock(&psys->pins_lock);
+			return pin;
+		}
+	}
+	psys->pin_misses++;
+	spin_unlock(&psys->pins_lock);
+
+	return NULL;
+}
+
+/* Cache pin unless its range changed while it was pinned */
+static void ipu_psys_pin_cache(struct ipu_psys_pin *pin, unsigned long seq)
+{
+	struct ipu_psys *psys = pin->psys;
+	unsigned long max = READ_ONCE(pin_cache_max_bytes);
+	struct ipu_psys_pin *old;
+
+	spin_lock(&psys->pins_lock);
+	if (mmu_interval_read_retry(&pin->notifier, seq))
+		pin->stale = true;
+	if (!pin->stale) {
+		kref_get(&pin->ref);
+		pin->cached = true;
+		psys->pins_bytes += pin->npages << PAGE_SHIFT;
+		list_add_tail(&pin->list, &psys->pins);
+	}
+	while (psys->pins_bytes > max && !list_empty(&psys->pins)) {
+		old = list_first_entry(&psys->pins, struct ipu_psys_pin, list);
+		ipu_psys_pin_uncache(old);
+	}
+	spin_unlock(&psys->pins_lock);
+}
+
+/*
+ * Pages of a regular userptr range from the pin cache, pinning and
+ * caching them on a miss. An error leaves the range to the uncached path.
+ */
+static int ipu_psys_pin_userpages(struct ipu_dma_buf_attach *attach,
+				  unsigned long start, unsigned long npages)
+{
+	struct ipu_psys *psys = attach->psys;
+	struct vm_area_struct *vma;
+	struct ipu_psys_pin *pin;
+	unsigned long seq;
+	bool regular;
+	int nr, ret;
+
+	if (!psys || !READ_ONCE(pin_cache_max_bytes))
+		return -EINVAL;
+
+	ipu_psys_pin_reap(psys);
+
+	pin = ipu_psys_pin_lookup(psys, start, npages);
+	if (pin)
+		goto out;
+
+	mmap_read_lock(current->mm);
+	vma = find_vma(current->mm, start);
+	regular = vma && vma->vm_start <= start &&
+	    vma->vm_end >= start + (npages << PAGE_SHIFT) &&
+	    !(vma->vm_flags & (VM_IO | VM_PFNMAP));
+	mmap_read_unlock(current->mm);
+	if (!regular)
+		return -EINVAL;
+
+	pin = kzalloc(sizeof(*pin), GFP_KERNEL);
+	if (!pin)
+		return -ENOMEM;
+
+	pin->pages = kvcalloc(npages, sizeof(*pin->pages), GFP_KERNEL);
+	if (!pin->pages) {
+		ret = -ENOMEM;
+		goto out_free_pin;
+	}
+
+	kref_init(&pin->ref);
+	INIT_LIST_HEAD(&pin->list);
+	pin->psys = psys;
+	pin->mm = current->mm;
+	pin->start = start;
+
+	ret = mmu_interval_notifier_insert(&pin->notifier, current->mm, start,
+					   npages << PAGE_SHIFT,
+					   &ipu_psys_pin_ops);
+	if (ret)
+		goto out_free_pages;
+
+	seq = mmu_interval_read_begin(&pin->notifier);
+	nr = pin_user_pages_fast(start, npages, FOLL_WRITE | FOLL_LONGTERM,
+				 pin->pages);
+	if (nr != npages) {
+		if (nr > 0)
+			unpin_user_pages(pin->pages, nr);
+		ret = nr < 0 ? nr : -EFAULT;
+		goto out_remove;
+	}
+	pin->npages = npages;
+
+	ipu_psys_pin_cache(pin, seq);
+
+out:
+	attach->pin = pin;
+	attach->pages = pin->pages;
+	attach->npages = npages;
+
+	return 0;
+
+out_remove:
+	mmu_interval_notifier_remove(&pin->notifier);
+out_free_pages:
+	kvfree(pin->pages);
+out_free_pin:
+	kfree(pin);
+
+	return ret;
+}
+
+static void ipu_psys_pin_cache_flush(struct ipu_psys *psys)
+{
+	struct ipu_psys_pin *pin, *tmp;
+
+	spin_lock(&psys->pins_lock);
+	list_for_each_entry_safe(pin, tmp, &psys->pins, list)
+		ipu_psys_pin_uncache(pin);
+	spin_unlock(&psys->pins_lock);
+
+	ipu_psys_pin_reap(psys);
+}
+#endif
+
 static int ipu_psys_get_userpages(struct ipu_dma_buf_attach *attach)
 {
 	struct vm_area_struct *vma;
@@ -284,6 +662,13 @@ static int ipu_psys_get_userpages(struct ipu_dma_buf_attach *attach)
 		goto skip_pages;
 	}
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
+	if (!ipu_psys_pin_userpages(attach, start & PAGE_MASK, npages)) {
+		pages = attach->pages;
+		goto skip_pages;
+	}
+#endif
+
 	pages = kvzalloc(array_size, GFP_KERNEL);
 	if (!pages)
 		goto free_sgt;
@@ -369,6 +754,15 @@ error_up_read:
 	mmap_read_unlock(current->mm);
 #endif
 error:
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
+	if (attach->pin) {
+		ipu_psys_pin_put(attach->pin);
+		attach->pin = NULL;
+		attach->pages = NULL;
+		attach->npages = 0;
+		goto free_sgt;
+	}
+#endif
 	if (!attach->vma_is_io)
 		while (nr > 0)
 			put_page(pages[--nr]);
@@ -390,6 +784,17 @@ static void ipu_psys_put_userpages(struct ipu_dma_buf_attach *attach)
 	if (!attach || !attach->userptr || !attach->sgt)
 		return;
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
+	if (attach->pin) {
+		ipu_psys_pin_put(attach->pin);
+		attach->pin = NULL;
+		attach->pages = NULL;
+		/* An munmap of the range may have left the pin stale */
+		ipu_psys_pin_reap(attach->psys);
+		goto free_sgt;
+	}
+#endif
+
 	if (!attach->vma_is_io) {
 		int i = attach->npages;
 
@@ -401,6 +806,9 @@ static void ipu_psys_put_userpages(struct ipu_dma_buf_attach *attach)
 
 	kvfree(attach->pages);
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
+free_sgt:
+#endif
 	sg_free_table(attach->sgt);
 	kfree(attach->sgt);
 	attach->sgt = NULL;
@@ -427,6 +835,7 @@ static int ipu_dma_buf_attach(struct dma_buf *dbuf, struct device *dev,
 #endif
 	ipu_attach->len = kbuf->len;
 	ipu_attach->userptr = kbuf->userptr;
+	ipu_attach->psys = kbuf->psys;
 
 	ret = ipu_psys_get_userpages(ipu_attach);
 	if (ret) {
@@ -691,6 +1100,17 @@ struct dma_buf_ops ipu_dma_buf_ops = {
 	.vunmap = ipu_dma_buf_vunmap,
 };
 
+static const char * const ipu_psys_stat_names[IPU_PSYS_STAT_NUM] = {
+	[IPU_PSYS_STAT_KBUF_HITS] = "kbuf_hits",
+	[IPU_PSYS_STAT_KBUF_MISSES] = "kbuf_misses",
+	[IPU_PSYS_STAT_KBUF_MAPPED_BYTES] = "kbuf_mapped_bytes",
+	[IPU_PSYS_STAT_KBUF_EVICTIONS] = "kbuf_evictions",
+	[IPU_PSYS_STAT_UNMAPBUF] = "unmapbuf",
+	[IPU_PSYS_STAT_KCMD_QUEUED] = "kcmd_queued",
+	[IPU_PSYS_STAT_KCMD_DONE] = "kcmd_done",
+	[IPU_PSYS_STAT_KCMD_ERRORS] = "kcmd_errors",
+};
+
 static int ipu_psys_open(struct inode *inode, struct file *file)
 {
 	struct ipu_psys *psys = inode_to_ipu_psys(inode);
@@ -713,18 +1133,32 @@ static int ipu_psys_open(struct inode *inode, struct file *file)
 	INIT_LIST_HEAD(&fh->bufs_list);
 	INIT_LIST_HEAD(&fh->descs_list);
 	INIT_LIST_HEAD(&fh->bufs_lru);
+	hash_init(fh->descs_hash);
+	hash_init(fh->bufs_hash);
 	init_waitqueue_head(&fh->wait);
+	INIT_LIST_HEAD(&fh->wake_list);
+	spin_lock_init(&fh->eventfd_lock);
+	spin_lock_init(&fh->lat_lock);
+	fh->pid = task_tgid_nr(current);
+	fh->qos_share = IPU_PSYS_QOS_SHARE_DEFAULT;
+
+	rval = ipu_stats_init(&fh->stats, ipu_psys_stat_names,
+			      IPU_PSYS_STAT_NUM);
+	if (rval)
+		goto open_failed;
 
 	rval = ipu_psys_fh_init(fh);
 	if (rval)
-		goto open_failed;
+		goto fh_init_failed;
 
-	mutex_lock(&psys->mutex);
-	list_add_tail(&fh->list, &psys->fhs);
-	mutex_unlock(&psys->mutex);
+	spin_lock(&psys->fhs_lock);
+	list_add_tail_rcu(&fh->list, &psys->fhs);
+	spin_unlock(&psys->fhs_lock);
 
 	return 0;
 
+fh_init_failed:
+	ipu_stats_free(&fh->stats);
 open_failed:
 	mutex_destroy(&fh->mutex);
 	kfree(fh);
@@ -775,6 +1209,7 @@ static inline void ipu_psys_kbuf_unmap(struct ipu_psys_kbuffer *kbuf)
 		dma_buf_detach(kbuf->dbuf, kbuf->db_attach);
 	dma_buf_put(kbuf->dbuf);
 
+	ipu_buffer_hash_del(kbuf);
 	kbuf->db_attach = NULL;
 	kbuf->dbuf = NULL;
 	kbuf->sgt = NULL;
@@ -812,6 +1247,7 @@ static int ipu_psys_unmapbuf_locked(int fd, struct ipu_psys_fh *fh)
 			"descriptor with no buffer: %d\n", fd);
 		return -EINVAL;
 	}
+	ipu_stats_inc(&fh->stats, IPU_PSYS_STAT_UNMAPBUF);
 
 	/* Wait for final UNMAP */
 	if (!atomic_dec_and_test(&kbuf->map_count))
@@ -821,11 +1257,16 @@ static int ipu_psys_unmapbuf_locked(int fd, struct ipu_psys_fh *fh)
 	return 0;
 }
 
-static int ipu_psys_release(struct inode *inode, struct file *file)
+/*
+ * The heavy part of a close: unmap the buffers, then stop the ppgs and
+ * wait for the firmware.
+ */
+static void ipu_psys_fh_teardown(struct ipu_psys_fh *fh)
 {
-	struct ipu_psys *psys = inode_to_ipu_psys(inode);
-	struct ipu_psys_fh *fh = file->private_data;
+	struct ipu_psys *psys = fh->psys;
+	struct ipu_mmu *mmu = psys->adev->mmu;
 
+	ipu_mmu_tlb_batch_begin(mmu);
 	mutex_lock(&fh->mutex);
 	while (!list_empty(&fh->descs_list)) {
 		struct ipu_psys_desc *desc;
@@ -866,23 +1307,66 @@ static int ipu_psys_release(struct inode *inode, struct file *file)
 		} else {
 			if (db_attach)
 				ipu_psys_put_userpages(db_attach->priv);
+			ipu_buffer_hash_del(kbuf);
 			kfree(kbuf);
 		}
 	}
 	mutex_unlock(&fh->mutex);
+	ipu_mmu_tlb_batch_end(mmu);
 
-	mutex_lock(&psys->mutex);
-	list_del(&fh->list);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
+	/* Pins of an exiting process went stale when its mm was torn down */
+	ipu_psys_pin_reap(psys);
+#endif
 
-	mutex_unlock(&psys->mutex);
 	ipu_psys_fh_deinit(fh);
 
 	mutex_lock(&psys->mutex);
 	if (list_empty(&psys->fhs))
 		psys->power_gating = 0;
 	mutex_unlock(&psys->mutex);
+	if (fh->eventfd)
+		eventfd_ctx_put(fh->eventfd);
+	ipu_stats_free(&fh->stats);
 	mutex_destroy(&fh->mutex);
 	kfree(fh);
+}
+
+static void ipu_psys_fh_release_work(struct work_struct *work)
+{
+	struct ipu_psys *psys = container_of(work, struct ipu_psys,
+					     fh_release_work);
+	struct ipu_psys_fh *fh, *fh0;
+	struct llist_node *list;
+
+	list = llist_del_all(&psys->fh_release_list);
+	if (!list)
+		return;
+
+	/* One grace period for all the fhs closed meanwhile */
+	synchronize_srcu(&psys->fhs_srcu);
+
+	llist_for_each_entry_safe(fh, fh0, list, release_node)
+		ipu_psys_fh_teardown(fh);
+}
+
+/*
+ * Take the fh off the list and leave the rest to fh_release_work, so that
+ * a HAL restarting the camera can open again right away.
+ */
+static int ipu_psys_release(struct inode *inode, struct file *file)
+{
+	struct ipu_psys *psys = inode_to_ipu_psys(inode);
+	struct ipu_psys_fh *fh = file->private_data;
+
+	ipu_psys_chain_release_fh(fh);
+
+	spin_lock(&psys->fhs_lock);
+	list_del_rcu(&fh->list);
+	spin_unlock(&psys->fhs_lock);
+
+	if (llist_add(&fh->release_node, &psys->fh_release_list))
+		queue_work(system_unbound_wq, &psys->fh_release_work);
 
 	return 0;
 }
@@ -908,6 +1392,7 @@ static int ipu_psys_getbuf(struct ipu_psys_buffer *buf, struct ipu_psys_fh *fh)
 	kbuf->len = buf->len;
 	kbuf->userptr = buf->base.userptr;
 	kbuf->flags = buf->flags;
+	kbuf->psys = psys;
 
 	exp_info.ops = &ipu_dma_buf_ops;
 	exp_info.size = kbuf->len;
@@ -942,6 +1427,7 @@ static int ipu_psys_getbuf(struct ipu_psys_buffer *buf, struct ipu_psys_fh *fh)
 	mutex_lock(&fh->mutex);
 	ipu_desc_add(fh, desc);
 	ipu_buffer_add(fh, kbuf);
+	ipu_buffer_hash_add(fh, kbuf);
 	mutex_unlock(&fh->mutex);
 
 	dev_dbg(&psys->adev->dev, "IOC_GETBUF: userptr %p size %llu to fd %d",
@@ -955,19 +1441,28 @@ static int ipu_psys_putbuf(struct ipu_psys_buffer *buf, struct ipu_psys_fh *fh)
 	return 0;
 }
 
+/*
+ * Unreferenced buffers stay mapped on the LRU list so that a later MAPBUF
+ * or QCMD of the same dma-buf doesn't pay for attach, map and TLB
+ * invalidation again. The list is bounded by the IOVA bytes it holds,
+ * the least recently used mappings are dropped first.
+ */
 static void ipu_psys_kbuffer_lru(struct ipu_psys_fh *fh,
 				 struct ipu_psys_kbuffer *kbuf)
 {
 	ipu_buffer_del(fh, kbuf);
 	ipu_buffer_lru_add(fh, kbuf);
 
-	while (fh->num_bufs_lru > IPU_PSYS_MAX_NUM_BUFS_LRU) {
+	while (fh->lru_bytes > READ_ONCE(kbuf_lru_max_bytes) &&
+	       !list_empty(&fh->bufs_lru)) {
 		kbuf = list_first_entry(&fh->bufs_lru,
 					struct ipu_psys_kbuffer,
 					list);
 
 		ipu_buffer_lru_del(fh, kbuf);
 		__ipu_psys_unmapbuf(fh, kbuf);
+		atomic64_inc(&fh->psys->kbuf_cache.evictions);
+		ipu_stats_inc(&fh->stats, IPU_PSYS_STAT_KBUF_EVICTIONS);
 	}
 }
 
@@ -1026,11 +1521,16 @@ struct ipu_psys_kbuffer *ipu_psys_mapbuf_locked(int fd, struct ipu_psys_fh *fh)
 
 	if (kbuf->sgt) {
 		dev_dbg(&psys->adev->dev, "fd %d has been mapped!\n", fd);
+		atomic64_inc(&psys->kbuf_cache.hits);
+		ipu_stats_inc(&fh->stats, IPU_PSYS_STAT_KBUF_HITS);
 		dma_buf_put(dbuf);
 		goto mapbuf_end;
 	}
 
+	atomic64_inc(&psys->kbuf_cache.misses);
+	ipu_stats_inc(&fh->stats, IPU_PSYS_STAT_KBUF_MISSES);
 	kbuf->dbuf = dbuf;
+	ipu_buffer_hash_add(fh, kbuf);
 
 	if (kbuf->len == 0)
 		kbuf->len = kbuf->dbuf->size;
@@ -1078,6 +1578,7 @@ struct ipu_psys_kbuffer *ipu_psys_mapbuf_locked(int fd, struct ipu_psys_fh *fh)
 
 	dev_dbg(&psys->adev->dev, "%s kbuf %p fd %d with len %llu mapped\n",
 		__func__, kbuf, fd, kbuf->len);
+	ipu_stats_add(&fh->stats, IPU_PSYS_STAT_KBUF_MAPPED_BYTES, kbuf->len);
 
 mapbuf_end:
 	kbuf->valid = true;
@@ -1126,6 +1627,53 @@ static long ipu_psys_unmapbuf(int fd, struct ipu_psys_fh *fh)
 	return ret;
 }
 
+static long ipu_psys_mapbuf_batch(struct ipu_psys_mapbuf_batch *batch,
+				  struct ipu_psys_fh *fh, bool map)
+{
+	struct ipu_psys *psys = fh->psys;
+	struct ipu_mmu *mmu = psys->adev->mmu;
+	struct ipu_psys_mapbuf_entry *entries;
+	unsigned int i;
+	long ret = 0;
+
+	if (!batch->count || batch->count > IPU_PSYS_MAPBUF_BATCH_MAX)
+		return -EINVAL;
+
+	entries = memdup_user(batch->entries,
+			      batch->count * sizeof(*entries));
+	if (IS_ERR(entries))
+		return PTR_ERR(entries);
+
+	/*
+	 * One TLB invalidation covers all the mappings of the batch. An
+	 * unmap still flushes before the pages go back to the exporter.
+	 */
+	ipu_mmu_tlb_batch_begin(mmu);
+	mutex_lock(&fh->mutex);
+	for (i = 0; i < batch->count; i++) {
+		if (map)
+			entries[i].status =
+				ipu_psys_mapbuf_locked(entries[i].fd, fh) ?
+				0 : -EINVAL;
+		else
+			entries[i].status =
+				ipu_psys_unmapbuf_locked(entries[i].fd, fh);
+	}
+	mutex_unlock(&fh->mutex);
+	ipu_mmu_tlb_batch_end(mmu);
+
+	if (copy_to_user(batch->entries, entries,
+			 batch->count * sizeof(*entries)))
+		ret = -EFAULT;
+
+	kfree(entries);
+
+	dev_dbg(&psys->adev->dev, "IOC_%sMAPBUF_BATCH: %u fds\n",
+		map ? "" : "UN", batch->count);
+
+	return ret;
+}
+
 static unsigned int ipu_psys_poll(struct file *file,
 				  struct poll_table_struct *wait)
 {
@@ -1145,49 +1693,245 @@ static unsigned int ipu_psys_poll(struct file *file,
 	return res;
 }
 
-static long ipu_get_manifest(struct ipu_psys_manifest *manifest,
-			     struct ipu_psys_fh *fh)
+struct ipu_psys_kmanifest *ipu_psys_kmanifest_alloc(size_t size)
 {
-	struct ipu_psys *psys = fh->psys;
-	struct ipu_device *isp = psys->adev->isp;
-	struct ipu_cpd_client_pkg_hdr *client_pkg;
-	u32 entries;
-	void *host_fw_data;
-	dma_addr_t dma_fw_data;
-	u32 client_pkg_offset;
+	struct ipu_psys_kmanifest *manifest;
 
-	host_fw_data = (void *)isp->cpd_fw->data;
-	dma_fw_data = sg_dma_address(psys->fw_sgt.sgl);
+	manifest = kzalloc(sizeof(*manifest) + size, GFP_KERNEL);
+	if (!manifest)
+		return NULL;
 
-	entries = ipu_cpd_pkg_dir_get_num_entries(psys->pkg_dir);
-	if (!manifest || manifest->index > entries - 1) {
-		dev_err(&psys->adev->dev, "invalid argument\n");
-		return -EINVAL;
-	}
+	kref_init(&manifest->ref);
+	manifest->pg_id = U32_MAX;
+	manifest->size = size;
 
-	if (!ipu_cpd_pkg_dir_get_size(psys->pkg_dir, manifest->index) ||
-	    ipu_cpd_pkg_dir_get_type(psys->pkg_dir, manifest->index) <
-	    IPU_CPD_PKG_DIR_CLIENT_PG_TYPE) {
-		dev_dbg(&psys->adev->dev, "invalid pkg dir entry\n");
-		return -ENOENT;
-	}
+	return manifest;
+}
 
-	client_pkg_offset = ipu_cpd_pkg_dir_get_address(psys->pkg_dir,
-							manifest->index);
-	client_pkg_offset -= dma_fw_data;
+static void ipu_psys_kmanifest_release(struct kref *ref)
+{
+	kfree(container_of(ref, struct ipu_psys_kmanifest, ref));
+}
 
-	client_pkg = host_fw_data + client_pkg_offset;
-	manifest->size = client_pkg->pg_manifest_size;
+void ipu_psys_kmanifest_put(struct ipu_psys_kmanifest *manifest)
+{
+	if (manifest)
+		kref_put(&manifest->ref, ipu_psys_kmanifest_release);
+}
 
-	if (!manifest->manifest)
-		return 0;
+/* Reference to the cached manifest of program group pg_id, or NULL */
+struct ipu_psys_kmanifest *ipu_psys_kmanifest_get(struct ipu_psys *psys,
+						  u32 pg_id)
+{
+	struct ipu_psys_kmanifest *manifest = NULL;
+	unsigned int i;
 
-	if (copy_to_user(manifest->manifest,
-			 (uint8_t *)client_pkg + client_pkg->pg_manifest_offs,
-			 manifest->size)) {
-		return -EFAULT;
+	spin_lock(&psys->manifests_lock);
+	for (i = 0; i < psys->num_manifests; i++) {
+		if (psys->manifests[i] && psys->manifests[i]->pg_id == pg_id) {
+			manifest = psys->manifests[i];
+			kref_get(&manifest->ref);
+			break;
+		}
+	}
+	spin_unlock(&psys->manifests_lock);
+
+	return manifest;
+}
+
+static void ipu_psys_kmanifests_put(struct ipu_psys_kmanifest **manifests,
+				    unsigned int num)
+{
+	unsigned int i;
+
+	if (!manifests)
+		return;
+
+	for (i = 0; i < num; i++)
+		ipu_psys_kmanifest_put(manifests[i]);
+	kfree(manifests);
+}
+
+/*
+ * Copy the program group manifests out of the firmware image loaded for
+ * pkg_dir and replace the previous cache with them.
+ */
+static int ipu_psys_kmanifest_cache_init(struct ipu_psys *psys)
+{
+	struct ipu_device *isp = psys->adev->isp;
+	struct ipu_psys_kmanifest **manifests, **old;
+	dma_addr_t dma_fw_data = sg_dma_address(psys->fw_sgt.sgl);
+	const void *host_fw_data = isp->cpd_fw->data;
+	unsigned int i, entries, old_num;
+
+	entries = ipu_cpd_pkg_dir_get_num_entries(psys->pkg_dir);
+	manifests = kcalloc(entries, sizeof(*manifests), GFP_KERNEL);
+	if (!manifests)
+		return -ENOMEM;
+
+	for (i = 0; i < entries; i++) {
+		const struct ipu_fw_psys_program_group_manifest *pgm;
+		const struct ipu_cpd_client_pkg_hdr *client_pkg;
+		struct ipu_psys_kmanifest *manifest;
+		u32 client_pkg_offset;
+
+		if (!ipu_cpd_pkg_dir_get_size(psys->pkg_dir, i) ||
+		    ipu_cpd_pkg_dir_get_type(psys->pkg_dir, i) <
+		    IPU_CPD_PKG_DIR_CLIENT_PG_TYPE)
+			continue;
+
+		client_pkg_offset = ipu_cpd_pkg_dir_get_address(psys->pkg_dir,
+								i);
+		client_pkg_offset -= dma_fw_data;
+		client_pkg = host_fw_data + client_pkg_offset;
+
+		manifest = ipu_psys_kmanifest_alloc(client_pkg->pg_manifest_size);
+		if (!manifest) {
+			ipu_psys_kmanifests_put(manifests, entries);
+			return -ENOMEM;
+		}
+
+		memcpy(manifest->data,
+		       (const u8 *)client_pkg + client_pkg->pg_manifest_offs,
+		       manifest->size);
+		pgm = (const void *)manifest->data;
+		if (manifest->size >= sizeof(*pgm))
+			manifest->pg_id = pgm->ID;
+		manifests[i] = manifest;
+	}
+
+	spin_lock(&psys->manifests_lock);
+	old = psys->manifests;
+	old_num = psys->num_manifests;
+	psys->manifests = manifests;
+	psys->num_manifests = entries;
+	spin_unlock(&psys->manifests_lock);
+
+	ipu_psys_kmanifests_put(old, old_num);
+
+	return 0;
+}
+
+static void ipu_psys_kmanifest_cache_free(struct ipu_psys *psys)
+{
+	ipu_psys_kmanifests_put(psys->manifests, psys->num_manifests);
+	psys->manifests = NULL;
+	psys->num_manifests = 0;
+}
+
+static long ipu_get_manifest(struct ipu_psys_manifest *manifest,
+			     struct ipu_psys_fh *fh)
+{
+	struct ipu_psys *psys = fh->psys;
+	struct ipu_psys_kmanifest *cached = NULL;
+	long ret = 0;
+
+	spin_lock(&psys->manifests_lock);
+	if (manifest && manifest->index < psys->num_manifests) {
+		cached = psys->manifests[manifest->index];
+		if (cached)
+			kref_get(&cached->ref);
+		else
+			ret = -ENOENT;
+	} else {
+		ret = -EINVAL;
+	}
+	spin_unlock(&psys->manifests_lock);
+
+	if (ret == -EINVAL) {
+		dev_err(&psys->adev->dev, "invalid argument\n");
+		return ret;
+	}
+
+	if (ret == -ENOENT) {
+		dev_dbg(&psys->adev->dev, "invalid pkg dir entry\n");
+		return ret;
+	}
+
+	manifest->size = cached->size;
+
+	if (!manifest->manifest)
+		goto out_put;
+
+	/*
+	 * The process group built from this manifest is about the size of
+	 * the manifest, prepare PG buffers of that class before streaming.
+	 */
+	ipu_psys_pg_pool_reserve(psys, manifest->size);
+
+	if (copy_to_user(manifest->manifest, cached->data, manifest->size))
+		ret = -EFAULT;
+
+out_put:
+	ipu_psys_kmanifest_put(cached);
+
+	return ret;
+}
+
+static int ipu_psys_s_qos(struct ipu_psys_qos *qos, struct ipu_psys_fh *fh)
+{
+	u32 deadline_us = qos->deadline_us ? qos->deadline_us : qos->period_us;
+
+	if (qos->qos_class >= IPU_PSYS_QOS_CLASS_NUM)
+		return -EINVAL;
+
+	if (qos->qos_class == IPU_PSYS_QOS_CLASS_REALTIME && !deadline_us)
+		return -EINVAL;
+
+	if (qos->quota_pct > 100)
+		return -EINVAL;
+
+	mutex_lock(&fh->mutex);
+	WRITE_ONCE(fh->qos_period_us, qos->period_us);
+	WRITE_ONCE(fh->qos_deadline_us, deadline_us);
+	WRITE_ONCE(fh->qos_share, qos->share ? qos->share :
+		   IPU_PSYS_QOS_SHARE_DEFAULT);
+	WRITE_ONCE(fh->qos_quota_pct, qos->quota_pct);
+	WRITE_ONCE(fh->qos_class, qos->qos_class);
+	mutex_unlock(&fh->mutex);
+
+	return 0;
+}
+
+static void ipu_psys_g_qos(struct ipu_psys_qos *qos, struct ipu_psys_fh *fh)
+{
+	memset(qos, 0, sizeof(*qos));
+
+	mutex_lock(&fh->mutex);
+	qos->qos_class = fh->qos_class;
+	qos->period_us = fh->qos_period_us;
+	qos->deadline_us = fh->qos_deadline_us;
+	qos->share = fh->qos_share;
+	qos->quota_pct = fh->qos_quota_pct;
+	qos->throttled = READ_ONCE(fh->throttled_windows);
+	mutex_unlock(&fh->mutex);
+
+	qos->frames = atomic64_read(&fh->qos_frames);
+	qos->missed = atomic64_read(&fh->qos_missed);
+	qos->busy_us = div_u64(atomic64_read(&fh->busy_ns), NSEC_PER_USEC);
+}
+
+static int ipu_psys_set_eventfd(int fd, struct ipu_psys_fh *fh)
+{
+	struct eventfd_ctx *ctx = NULL, *old;
+	unsigned long flags;
+
+	if (fd >= 0) {
+		ctx = eventfd_ctx_fdget(fd);
+		if (IS_ERR(ctx))
+			return PTR_ERR(ctx);
+	} else if (fd != -1) {
+		return -EINVAL;
 	}
 
+	spin_lock_irqsave(&fh->eventfd_lock, flags);
+	old = fh->eventfd;
+	fh->eventfd = ctx;
+	spin_unlock_irqrestore(&fh->eventfd_lock, flags);
+
+	if (old)
+		eventfd_ctx_put(old);
+
 	return 0;
 }
 
@@ -1200,6 +1944,10 @@ static long ipu_psys_ioctl(struct file *file, unsigned int cmd,
 		struct ipu_psys_event ev;
 		struct ipu_psys_capability caps;
 		struct ipu_psys_manifest m;
+		struct ipu_psys_mapbuf_batch batch;
+		struct ipu_psys_qos qos;
+		struct ipu_psys_events events;
+		int fd;
 	} karg;
 	struct ipu_psys_fh *fh = file->private_data;
 	long err = 0;
@@ -1242,6 +1990,24 @@ static long ipu_psys_ioctl(struct file *file, unsigned int cmd,
 	case IPU_IOC_GET_MANIFEST:
 		err = ipu_get_manifest(&karg.m, fh);
 		break;
+	case IPU_IOC_MAPBUF_BATCH:
+		err = ipu_psys_mapbuf_batch(&karg.batch, fh, true);
+		break;
+	case IPU_IOC_UNMAPBUF_BATCH:
+		err = ipu_psys_mapbuf_batch(&karg.batch, fh, false);
+		break;
+	case IPU_IOC_S_QOS:
+		err = ipu_psys_s_qos(&karg.qos, fh);
+		break;
+	case IPU_IOC_G_QOS:
+		ipu_psys_g_qos(&karg.qos, fh);
+		break;
+	case IPU_IOC_DQEVENTS:
+		err = ipu_ioctl_dqevents(&karg.events, fh, file->f_flags);
+		break;
+	case IPU_IOC_SET_EVENTFD:
+		err = ipu_psys_set_eventfd(karg.fd, fh);
+		break;
 	default:
 		err = -ENOTTY;
 		break;
@@ -1272,6 +2038,175 @@ static void ipu_psys_dev_release(struct device *dev)
 {
 }
 
+/*
+ * Power gating transitions of the device, then the counters of each open
+ * fh. Output stops at PAGE_SIZE if there are too many fhs.
+ */
+static ssize_t stats_show(struct device *dev, struct device_attribute *attr,
+			  char *buf)
+{
+	struct ipu_psys *psys = container_of(dev, struct ipu_psys, dev);
+	struct ipu_psys_fh *fh;
+	int len, idx;
+
+	len = scnprintf(buf, PAGE_SIZE,
+			"pg_entered %llu\npg_skipped %llu\n"
+			"pg_early_exits %llu\npg_gated_us %llu\n",
+			READ_ONCE(psys->pg_entered),
+			READ_ONCE(psys->pg_skipped),
+			READ_ONCE(psys->pg_early_exits),
+			div_u64(READ_ONCE(psys->pg_gated_ns), NSEC_PER_USEC));
+
+	idx = srcu_read_lock(&psys->fhs_srcu);
+	ipu_psys_for_each_fh(fh, psys) {
+		len += scnprintf(buf + len, PAGE_SIZE - len, "fh %p pid %d\n",
+				 fh, fh->pid);
+		len += ipu_stats_print(&fh->stats, buf + len, PAGE_SIZE - len);
+	}
+	srcu_read_unlock(&psys->fhs_srcu, idx);
+
+	return len;
+}
+
+static DEVICE_ATTR_RO(stats);
+
+enum ipu_psys_sched_policy {
+	IPU_PSYS_SCHED_NORMAL,
+	IPU_PSYS_SCHED_FIFO_LOW,
+	IPU_PSYS_SCHED_FIFO,
+};
+
+static const char * const ipu_psys_sched_policies[] = {
+	[IPU_PSYS_SCHED_NORMAL] = "normal",
+	[IPU_PSYS_SCHED_FIFO_LOW] = "fifo_low",
+	[IPU_PSYS_SCHED_FIFO] = "fifo",
+};
+
+/* Called by psys_sched_cmd itself, so it can't go away under us */
+static void ipu_psys_sched_attr_apply(struct ipu_psys *psys)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 9, 0)
+	struct sched_param param = { 0 };
+#endif
+
+	mutex_lock(&psys->sched_attr_mutex);
+	psys->sched_attr_changed = false;
+	if (set_cpus_allowed_ptr(current, &psys->sched_cpus))
+		dev_warn(&psys->dev, "can't set sched_cpus %*pbl\n",
+			 cpumask_pr_args(&psys->sched_cpus));
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+	switch (psys->sched_policy) {
+	case IPU_PSYS_SCHED_FIFO_LOW:
+		sched_set_fifo_low(current);
+		break;
+	case IPU_PSYS_SCHED_FIFO:
+		sched_set_fifo(current);
+		break;
+	default:
+		sched_set_normal(current, 0);
+		break;
+	}
+#else
+	if (psys->sched_policy == IPU_PSYS_SCHED_NORMAL) {
+		sched_setscheduler_nocheck(current, SCHED_NORMAL, &param);
+	} else {
+		param.sched_priority =
+			psys->sched_policy == IPU_PSYS_SCHED_FIFO ?
+			MAX_RT_PRIO / 2 : 1;
+		sched_setscheduler_nocheck(current, SCHED_FIFO, &param);
+	}
+#endif
+	mutex_unlock(&psys->sched_attr_mutex);
+}
+
+static void ipu_psys_sched_attr_kick(struct ipu_psys *psys)
+{
+	atomic_set(&psys->wakeup_count, 1);
+	wake_up_interruptible(&psys->sched_cmd_wq);
+}
+
+static ssize_t sched_cpus_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct ipu_psys *psys = container_of(dev, struct ipu_psys, dev);
+	int len;
+
+	mutex_lock(&psys->sched_attr_mutex);
+	len = scnprintf(buf, PAGE_SIZE, "%*pbl\n",
+			cpumask_pr_args(&psys->sched_cpus));
+	mutex_unlock(&psys->sched_attr_mutex);
+
+	return len;
+}
+
+static ssize_t sched_cpus_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct ipu_psys *psys = container_of(dev, struct ipu_psys, dev);
+	cpumask_var_t mask;
+	int rval;
+
+	if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	rval = cpulist_parse(buf, mask);
+	if (!rval && !cpumask_intersects(mask, cpu_online_mask))
+		rval = -EINVAL;
+	if (!rval) {
+		mutex_lock(&psys->sched_attr_mutex);
+		cpumask_copy(&psys->sched_cpus, mask);
+		psys->sched_attr_changed = true;
+		mutex_unlock(&psys->sched_attr_mutex);
+		ipu_psys_sched_attr_kick(psys);
+	}
+	free_cpumask_var(mask);
+
+	return rval ? rval : count;
+}
+
+static DEVICE_ATTR_RW(sched_cpus);
+
+static ssize_t sched_policy_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct ipu_psys *psys = container_of(dev, struct ipu_psys, dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%s\n",
+			 ipu_psys_sched_policies[READ_ONCE(psys->sched_policy)]);
+}
+
+static ssize_t sched_policy_store(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct ipu_psys *psys = container_of(dev, struct ipu_psys, dev);
+	int policy = sysfs_match_string(ipu_psys_sched_policies, buf);
+
+	if (policy < 0)
+		return policy;
+
+	mutex_lock(&psys->sched_attr_mutex);
+	psys->sched_policy = policy;
+	psys->sched_attr_changed = true;
+	mutex_unlock(&psys->sched_attr_mutex);
+	ipu_psys_sched_attr_kick(psys);
+
+	return count;
+}
+
+static DEVICE_ATTR_RW(sched_policy);
+
+static struct attribute *ipu_psys_attrs[] = {
+	&dev_attr_stats.attr,
+	&dev_attr_sched_cpus.attr,
+	&dev_attr_sched_policy.attr,
+	NULL,
+};
+
+ATTRIBUTE_GROUPS(ipu_psys);
+
 #ifdef CONFIG_PM
 static int psys_runtime_pm_resume(struct device *dev)
 {
@@ -1310,6 +2245,9 @@ static int psys_runtime_pm_resume(struct device *dev)
 
 	ipu_psys_subdomains_power(psys, 1);
 	ipu_trace_restore(&psys->adev->dev);
+#ifdef IPU_PSYS_GPC
+	ipu_gpc_pmu_resume(psys->gpc_pmu);
+#endif
 
 	ipu_configure_spc(adev->isp,
 			  &psys->pdata->ipdata->hw_variant,
@@ -1356,6 +2294,9 @@ static int psys_runtime_pm_suspend(struct device *dev)
 	if (rval)
 		dev_err(dev, "Device close failure: %d\n", rval);
 
+#ifdef IPU_PSYS_GPC
+	ipu_gpc_pmu_suspend(psys->gpc_pmu);
+#endif
 	ipu_psys_subdomains_power(psys, 0);
 
 	ipu_mmu_hw_cleanup(adev->mmu);
@@ -1374,6 +2315,13 @@ static int psys_resume(struct device *dev)
 
 static int psys_suspend(struct device *dev)
 {
+	struct ipu_bus_device *adev = to_ipu_bus_device(dev);
+	struct ipu_psys *psys = ipu_bus_get_drvdata(adev);
+
+	/* Let the closed fhs stop their ppgs before the firmware goes */
+	if (psys)
+		flush_work(&psys->fh_release_work);
+
 	return 0;
 }
 
@@ -1445,6 +2393,10 @@ static int cpd_fw_reload(struct ipu_device *isp)
 	isp->pkg_dir_dma_addr = psys->pkg_dir_dma_addr;
 	isp->pkg_dir_size = psys->pkg_dir_size;
 
+	rval = ipu_psys_kmanifest_cache_init(psys);
+	if (rval)
+		goto out_free_pkg_dir;
+
 	if (!isp->secure_mode)
 		return 0;
 
@@ -1515,6 +2467,457 @@ DEFINE_SIMPLE_ATTRIBUTE(psys_icache_prefetch_isp_fops,
 			ipu_psys_icache_prefetch_isp_get,
 			ipu_psys_icache_prefetch_isp_set, "%llu\n");
 
+#define IPU_PSYS_KBUF_CACHE_DUMP_SIZE	1024
+
+static ssize_t ipu_psys_kbuf_cache_read(struct file *file, char __user *buf,
+					size_t len, loff_t *ppos)
+{
+	struct ipu_psys *psys = file->private_data;
+	struct ipu_psys_fh *fh;
+	ssize_t ret;
+	char *tmp;
+	int n, idx;
+
+	tmp = kzalloc(IPU_PSYS_KBUF_CACHE_DUMP_SIZE, GFP_KERNEL);
+	if (!tmp)
+		return -ENOMEM;
+
+	n = scnprintf(tmp, IPU_PSYS_KBUF_CACHE_DUMP_SIZE, "limit %lu\n",
+		      READ_ONCE(kbuf_lru_max_bytes));
+	n += ipu_buf_cache_stats_print(&psys->kbuf_cache, tmp + n,
+				       IPU_PSYS_KBUF_CACHE_DUMP_SIZE - n);
+
+	spin_lock(&psys->pins_lock);
+	n += scnprintf(tmp + n, IPU_PSYS_KBUF_CACHE_DUMP_SIZE - n,
+		       "pinned_bytes %lu\npin_hits %llu\npin_misses %llu\n"
+		       "pin_invalidations %llu\n", psys->pins_bytes,
+		       psys->pin_hits, psys->pin_misses,
+		       psys->pin_invalidations);
+	spin_unlock(&psys->pins_lock);
+
+	idx = srcu_read_lock(&psys->fhs_srcu);
+	ipu_psys_for_each_fh(fh, psys) {
+		mutex_lock(&fh->mutex);
+		n += scnprintf(tmp + n, IPU_PSYS_KBUF_CACHE_DUMP_SIZE - n,
+			       "fh %p: mapped %u cached %u bytes %llu\n",
+			       fh, fh->num_bufs, fh->num_bufs_lru,
+			       fh->lru_bytes);
+		mutex_unlock(&fh->mutex);
+	}
+	srcu_read_unlock(&psys->fhs_srcu, idx);
+
+	ret = simple_read_from_buffer(buf, len, ppos, tmp, n);
+	kfree(tmp);
+
+	return ret;
+}
+
+static const struct file_operations psys_kbuf_cache_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = ipu_psys_kbuf_cache_read,
+	.llseek = default_llseek,
+};
+
+#define IPU_PSYS_PG_POOL_DUMP_SIZE	512
+
+static ssize_t ipu_psys_pg_pool_read(struct file *file, char __user *buf,
+				     size_t len, loff_t *ppos)
+{
+	struct ipu_psys *psys = file->private_data;
+	struct ipu_psys_pg_class *class;
+	struct ipu_psys_pg *kpg;
+	unsigned long flags;
+	unsigned int i, nfree;
+	ssize_t ret;
+	char *tmp;
+	int n = 0;
+
+	tmp = kzalloc(IPU_PSYS_PG_POOL_DUMP_SIZE, GFP_KERNEL);
+	if (!tmp)
+		return -ENOMEM;
+
+	spin_lock_irqsave(&psys->pgs_lock, flags);
+	for (i = 0; i < IPU_PSYS_PG_NUM_CLASSES; i++) {
+		class = &psys->pg_classes[i];
+		nfree = 0;
+		list_for_each_entry(kpg, &class->pgs, list)
+			if (!kpg->pg_size)
+				nfree++;
+
+		n += scnprintf(tmp + n, IPU_PSYS_PG_POOL_DUMP_SIZE - n,
+			       "class %lu%s: buffers %u free %u hits %llu misses %llu\n",
+			       PAGE_SIZE << i,
+			       i == IPU_PSYS_PG_NUM_CLASSES - 1 ? "+" : "",
+			       class->count, nfree, class->hits,
+			       class->misses);
+	}
+	spin_unlock_irqrestore(&psys->pgs_lock, flags);
+
+	ret = simple_read_from_buffer(buf, len, ppos, tmp, n);
+	kfree(tmp);
+
+	return ret;
+}
+
+static const struct file_operations psys_pg_pool_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = ipu_psys_pg_pool_read,
+	.llseek = default_llseek,
+};
+
+#define IPU_PSYS_RESOURCES_DUMP_SIZE	2048
+
+static ssize_t ipu_psys_resources_read(struct file *file, char __user *buf,
+				       size_t len, loff_t *ppos)
+{
+	struct ipu_psys *psys = file->private_data;
+	ssize_t ret;
+	char *tmp;
+	int n;
+
+	tmp = kzalloc(IPU_PSYS_RESOURCES_DUMP_SIZE, GFP_KERNEL);
+	if (!tmp)
+		return -ENOMEM;
+
+	mutex_lock(&psys->mutex);
+	n = scnprintf(tmp, IPU_PSYS_RESOURCES_DUMP_SIZE, "contentions %llu\n",
+		      psys->res_contentions);
+	n += ipu_psys_resource_pool_print(&psys->resource_pool_running,
+					  tmp + n,
+					  IPU_PSYS_RESOURCES_DUMP_SIZE - n);
+	mutex_unlock(&psys->mutex);
+
+	ret = simple_read_from_buffer(buf, len, ppos, tmp, n);
+	kfree(tmp);
+
+	return ret;
+}
+
+static const struct file_operations psys_resources_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = ipu_psys_resources_read,
+	.llseek = default_llseek,
+};
+
+static int ipu_psys_pg_break_even_get(void *data, u64 *val)
+{
+	struct ipu_psys *psys = data;
+
+	*val = READ_ONCE(psys->pg_break_even_us);
+	return 0;
+}
+
+static int ipu_psys_pg_break_even_set(void *data, u64 val)
+{
+	struct ipu_psys *psys = data;
+
+	if (val > U32_MAX)
+		return -EINVAL;
+
+	mutex_lock(&psys->mutex);
+	psys->pg_break_even_us = val;
+	mutex_unlock(&psys->mutex);
+
+	return 0;
+}
+
+DEFINE_SIMPLE_ATTRIBUTE(psys_pg_break_even_fops,
+			ipu_psys_pg_break_even_get,
+			ipu_psys_pg_break_even_set, "%llu\n");
+
+#define IPU_PSYS_POWER_GATING_DUMP_SIZE	512
+
+static ssize_t ipu_psys_power_gating_read(struct file *file, char __user *buf,
+					  size_t len, loff_t *ppos)
+{
+	struct ipu_psys *psys = file->private_data;
+	ssize_t ret;
+	char *tmp;
+	int n;
+
+	tmp = kzalloc(IPU_PSYS_POWER_GATING_DUMP_SIZE, GFP_KERNEL);
+	if (!tmp)
+		return -ENOMEM;
+
+	mutex_lock(&psys->mutex);
+	n = scnprintf(tmp, IPU_PSYS_POWER_GATING_DUMP_SIZE,
+		      "state %d\nbreak_even_us %u\nentered %llu\nskipped %llu\nearly_exits %llu\n"
+		      "paced_exits %llu\n"
+		      "enter_us %llu (max %llu)\nexit_us %llu (max %llu)\n",
+		      psys->power_gating, psys->pg_break_even_us,
+		      psys->pg_entered, psys->pg_skipped,
+		      psys->pg_early_exits, psys->pg_paced_exits,
+		      div_u64(psys->pg_enter_ns, NSEC_PER_USEC),
+		      div_u64(psys->pg_enter_max_ns, NSEC_PER_USEC),
+		      div_u64(psys->pg_exit_ns, NSEC_PER_USEC),
+		      div_u64(psys->pg_exit_max_ns, NSEC_PER_USEC));
+	mutex_unlock(&psys->mutex);
+
+	ret = simple_read_from_buffer(buf, len, ppos, tmp, n);
+	kfree(tmp);
+
+	return ret;
+}
+
+static const struct file_operations psys_power_gating_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = ipu_psys_power_gating_read,
+	.llseek = default_llseek,
+};
+
+#define IPU_PSYS_IRQ_STATS_DUMP_SIZE	256
+
+static ssize_t ipu_psys_irq_stats_read(struct file *file, char __user *buf,
+				       size_t len, loff_t *ppos)
+{
+	struct ipu_psys *psys = file->private_data;
+	ssize_t ret;
+	char *tmp;
+	int n;
+
+	tmp = kzalloc(IPU_PSYS_IRQ_STATS_DUMP_SIZE, GFP_KERNEL);
+	if (!tmp)
+		return -ENOMEM;
+
+	mutex_lock(&psys->mutex);
+	n = scnprintf(tmp, IPU_PSYS_IRQ_STATS_DUMP_SIZE,
+		      "poll_us %u poll_rounds %u\nirqs %llu events %llu\npolls %llu polled_events %llu\n",
+		      irq_poll_us, irq_poll_rounds,
+		      psys->irq_count, psys->irq_events,
+		      psys->irq_polls, psys->irq_polled_events);
+	mutex_unlock(&psys->mutex);
+
+	ret = simple_read_from_buffer(buf, len, ppos, tmp, n);
+	kfree(tmp);
+
+	return ret;
+}
+
+static const struct file_operations psys_irq_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = ipu_psys_irq_stats_read,
+	.llseek = default_llseek,
+};
+
+#define IPU_PSYS_QOS_DUMP_SIZE	1024
+
+static ssize_t ipu_psys_qos_read(struct file *file, char __user *buf,
+				 size_t len, loff_t *ppos)
+{
+	struct ipu_psys *psys = file->private_data;
+	struct ipu_psys_fh *fh;
+	ssize_t ret;
+	char *tmp;
+	int n = 0;
+	int idx;
+
+	tmp = kzalloc(IPU_PSYS_QOS_DUMP_SIZE, GFP_KERNEL);
+	if (!tmp)
+		return -ENOMEM;
+
+	idx = srcu_read_lock(&psys->fhs_srcu);
+	ipu_psys_for_each_fh(fh, psys) {
+		mutex_lock(&fh->mutex);
+		n += scnprintf(tmp + n, IPU_PSYS_QOS_DUMP_SIZE - n,
+			       "fh %p: class %u period %u deadline %u share %u quota %u%% frames %lld missed %lld busy_us %llu load %llu throttled %u\n",
+			       fh, fh->qos_class, fh->qos_period_us,
+			       fh->qos_deadline_us, fh->qos_share,
+			       fh->qos_quota_pct,
+			       atomic64_read(&fh->qos_frames),
+			       atomic64_read(&fh->qos_missed),
+			       div_u64(atomic64_read(&fh->busy_ns),
+				       NSEC_PER_USEC),
+			       READ_ONCE(fh->share_load),
+			       READ_ONCE(fh->throttled_windows));
+		mutex_unlock(&fh->mutex);
+	}
+	srcu_read_unlock(&psys->fhs_srcu, idx);
+
+	ret = simple_read_from_buffer(buf, len, ppos, tmp, n);
+	kfree(tmp);
+
+	return ret;
+}
+
+static const struct file_operations psys_qos_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = ipu_psys_qos_read,
+	.llseek = default_llseek,
+};
+
+#define IPU_PSYS_LAT_DUMP_SIZE	8192
+
+static const char * const ipu_psys_lat_names[IPU_PSYS_LAT_NUM] = {
+	[IPU_PSYS_LAT_QUEUE] = "queue",
+	[IPU_PSYS_LAT_EXEC] = "exec",
+	[IPU_PSYS_LAT_REAP] = "reap",
+};
+
+static ssize_t ipu_psys_latency_read(struct file *file, char __user *buf,
+				     size_t len, loff_t *ppos)
+{
+	struct ipu_psys *psys = file->private_data;
+	struct ipu_psys_lat_hist hist;
+	struct ipu_psys_fh *fh;
+	unsigned long flags;
+	ssize_t ret;
+	char *tmp;
+	int n = 0;
+	int i, j, idx;
+
+	tmp = kzalloc(IPU_PSYS_LAT_DUMP_SIZE, GFP_KERNEL);
+	if (!tmp)
+		return -ENOMEM;
+
+	n += scnprintf(tmp + n, IPU_PSYS_LAT_DUMP_SIZE - n, "buckets(us):");
+	for (j = 0; j < IPU_PSYS_LAT_BUCKETS - 1; j++)
+		n += scnprintf(tmp + n, IPU_PSYS_LAT_DUMP_SIZE - n, " <%u",
+			       1U << j);
+	n += scnprintf(tmp + n, IPU_PSYS_LAT_DUMP_SIZE - n, " >=%u\n",
+		       1U << (IPU_PSYS_LAT_BUCKETS - 2));
+
+	idx = srcu_read_lock(&psys->fhs_srcu);
+	ipu_psys_for_each_fh(fh, psys) {
+		for (i = 0; i < IPU_PSYS_LAT_NUM; i++) {
+			spin_lock_irqsave(&fh->lat_lock, flags);
+			hist = fh->lat[i];
+			spin_unlock_irqrestore(&fh->lat_lock, flags);
+
+			n += scnprintf(tmp + n, IPU_PSYS_LAT_DUMP_SIZE - n,
+				       "fh %p %s: count %llu avg %llu max %llu us:",
+				       fh, ipu_psys_lat_names[i], hist.count,
+				       hist.count ?
+				       div64_u64(hist.sum_ns,
+						 hist.count * NSEC_PER_USEC) : 0,
+				       div_u64(hist.max_ns, NSEC_PER_USEC));
+			for (j = 0; j < IPU_PSYS_LAT_BUCKETS; j++)
+				n += scnprintf(tmp + n,
+					       IPU_PSYS_LAT_DUMP_SIZE - n,
+					       " %llu", hist.buckets[j]);
+			n += scnprintf(tmp + n, IPU_PSYS_LAT_DUMP_SIZE - n,
+				       "\n");
+		}
+	}
+	srcu_read_unlock(&psys->fhs_srcu, idx);
+
+	ret = simple_read_from_buffer(buf, len, ppos, tmp, n);
+	kfree(tmp);
+
+	return ret;
+}
+
+static const struct file_operations psys_latency_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = ipu_psys_latency_read,
+	.llseek = default_llseek,
+};
+
+/* Record one validated QCMD, unless recording is off or the fifo full */
+void ipu_psys_qcmd_record(struct ipu_psys_kcmd *kcmd,
+			  struct ipu_psys_command *cmd, size_t pg_size)
+{
+	static const u8 pad[8];
+	struct ipu_psys *psys = kcmd->fh->psys;
+	unsigned int bufcount = kcmd->buffers ? cmd->bufcount : 0;
+	size_t bufs_size = bufcount * sizeof(*kcmd->buffers);
+	struct ipu_psys_qcmd_record rec = {
+		.ns = ktime_get_ns(),
+		.pid = kcmd->fh->pid,
+		.priority = cmd->priority,
+		.bufcount = bufcount,
+		.pg_size = pg_size,
+		.min_psys_freq = cmd->min_psys_freq,
+		.frame_counter = cmd->frame_counter,
+	};
+	size_t len = sizeof(rec) + bufs_size + pg_size;
+
+	if (!READ_ONCE(psys->qcmd_rec_on))
+		return;
+
+	rec.size = ALIGN(len, 8);
+	memcpy(rec.kernel_enable_bitmap, cmd->kernel_enable_bitmap,
+	       sizeof(rec.kernel_enable_bitmap));
+
+	spin_lock(&psys->qcmd_rec_lock);
+	if (!psys->qcmd_rec_on) {
+		spin_unlock(&psys->qcmd_rec_lock);
+		return;
+	}
+	if (kfifo_avail(&psys->qcmd_rec) < rec.size) {
+		psys->qcmd_rec_lost++;
+		spin_unlock(&psys->qcmd_rec_lock);
+		return;
+	}
+	rec.lost = psys->qcmd_rec_lost;
+	psys->qcmd_rec_lost = 0;
+	kfifo_in(&psys->qcmd_rec, &rec, sizeof(rec));
+	kfifo_in(&psys->qcmd_rec, kcmd->buffers, bufs_size);
+	kfifo_in(&psys->qcmd_rec, kcmd->kpg->pg, pg_size);
+	kfifo_in(&psys->qcmd_rec, pad, rec.size - len);
+	spin_unlock(&psys->qcmd_rec_lock);
+}
+
+static ssize_t ipu_psys_qcmd_record_read(struct file *file, char __user *buf,
+					 size_t len, loff_t *ppos)
+{
+	struct ipu_psys *psys = file->private_data;
+	unsigned int copied = 0;
+	int ret;
+
+	mutex_lock(&psys->qcmd_rec_read_mutex);
+	ret = kfifo_initialized(&psys->qcmd_rec) ?
+	    kfifo_to_user(&psys->qcmd_rec, buf, len, &copied) : 0;
+	mutex_unlock(&psys->qcmd_rec_read_mutex);
+
+	return ret ? ret : copied;
+}
+
+/* "1" starts recording, "0" stops it; records stay until read */
+static ssize_t ipu_psys_qcmd_record_write(struct file *file,
+					  const char __user *buf,
+					  size_t len, loff_t *ppos)
+{
+	struct ipu_psys *psys = file->private_data;
+	bool on;
+	int ret;
+
+	ret = kstrtobool_from_user(buf, len, &on);
+	if (ret)
+		return ret;
+
+	mutex_lock(&psys->qcmd_rec_read_mutex);
+	if (on && !kfifo_initialized(&psys->qcmd_rec)) {
+		ret = kfifo_alloc(&psys->qcmd_rec, IPU_PSYS_QCMD_RECORD_SIZE,
+				  GFP_KERNEL);
+		if (ret) {
+			mutex_unlock(&psys->qcmd_rec_read_mutex);
+			return ret;
+		}
+	}
+	spin_lock(&psys->qcmd_rec_lock);
+	psys->qcmd_rec_on = on && kfifo_initialized(&psys->qcmd_rec);
+	psys->qcmd_rec_lost = 0;
+	spin_unlock(&psys->qcmd_rec_lock);
+	mutex_unlock(&psys->qcmd_rec_read_mutex);
+
+	return len;
+}
+
+static const struct file_operations psys_qcmd_record_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = ipu_psys_qcmd_record_read,
+	.write = ipu_psys_qcmd_record_write,
+	.llseek = noop_llseek,
+};
+
 static int ipu_psys_init_debugfs(struct ipu_psys *psys)
 {
 	struct dentry *file;
@@ -1534,6 +2937,50 @@ static int ipu_psys_init_debugfs(struct ipu_psys *psys)
 	if (IS_ERR(file))
 		goto err;
 
+	file = debugfs_create_file("kbuf_cache", 0400,
+				   dir, psys, &psys_kbuf_cache_fops);
+	if (IS_ERR(file))
+		goto err;
+
+	file = debugfs_create_file("pg_pool", 0400,
+				   dir, psys, &psys_pg_pool_fops);
+	if (IS_ERR(file))
+		goto err;
+
+	file = debugfs_create_file("qos", 0400, dir, psys, &psys_qos_fops);
+	if (IS_ERR(file))
+		goto err;
+
+	file = debugfs_create_file("resources", 0400,
+				   dir, psys, &psys_resources_fops);
+	if (IS_ERR(file))
+		goto err;
+
+	file = debugfs_create_file("power_gating_break_even_us", 0600,
+				   dir, psys, &psys_pg_break_even_fops);
+	if (IS_ERR(file))
+		goto err;
+
+	file = debugfs_create_file("power_gating", 0400,
+				   dir, psys, &psys_power_gating_fops);
+	if (IS_ERR(file))
+		goto err;
+
+	file = debugfs_create_file("latency", 0400,
+				   dir, psys, &psys_latency_fops);
+	if (IS_ERR(file))
+		goto err;
+
+	file = debugfs_create_file("irq_stats", 0400,
+				   dir, psys, &psys_irq_stats_fops);
+	if (IS_ERR(file))
+		goto err;
+
+	file = debugfs_create_file("qcmd_record", 0600,
+				   dir, psys, &psys_qcmd_record_fops);
+	if (IS_ERR(file))
+		goto err;
+
 	psys->debugfsdir = dir;
 
 #ifdef IPU_PSYS_GPC
@@ -1548,10 +2995,20 @@ err:
 }
 #endif
 
+static void ipu_psys_sched_kick_work(struct work_struct *work)
+{
+	struct ipu_psys *psys = container_of(work, struct ipu_psys,
+					     sched_kick_work.work);
+
+	atomic_set(&psys->wakeup_count, 1);
+	wake_up_interruptible(&psys->sched_cmd_wq);
+}
+
 static int ipu_psys_sched_cmd(void *ptr)
 {
 	struct ipu_psys *psys = ptr;
 	size_t pending = 0;
+	int idx;
 
 	while (1) {
 		wait_event_interruptible(psys->sched_cmd_wq,
@@ -1562,12 +3019,17 @@ static int ipu_psys_sched_cmd(void *ptr)
 		if (kthread_should_stop())
 			break;
 
+		if (READ_ONCE(psys->sched_attr_changed))
+			ipu_psys_sched_attr_apply(psys);
+
 		if (pending == 0)
 			continue;
 
 		mutex_lock(&psys->mutex);
+		idx = srcu_read_lock(&psys->fhs_srcu);
 		atomic_set(&psys->wakeup_count, 0);
 		ipu_psys_run_next(psys);
+		srcu_read_unlock(&psys->fhs_srcu, idx);
 		mutex_unlock(&psys->mutex);
 	}
 
@@ -1676,7 +3138,7 @@ static void run_fw_init_work(struct work_struct *work)
 static int ipu_psys_probe(struct ipu_bus_device *adev)
 {
 	struct ipu_device *isp = adev->isp;
-	struct ipu_psys_pg *kpg, *kpg0;
+	struct ipu_psys_pg *kpg;
 	struct ipu_psys *psys;
 	unsigned int minor;
 	int i, rval = -E2BIG;
@@ -1708,6 +3170,10 @@ static int ipu_psys_probe(struct ipu_bus_device *adev)
 	psys->icache_prefetch_sp = 0;
 
 	psys->power_gating = 0;
+	psys->pg_break_even_us = IPU_PSYS_PG_BREAK_EVEN_US;
+	INIT_DELAYED_WORK(&psys->sched_kick_work, ipu_psys_sched_kick_work);
+	init_llist_head(&psys->fh_release_list);
+	INIT_WORK(&psys->fh_release_work, ipu_psys_fh_release_work);
 
 	ipu_trace_init(adev->isp, psys->pdata->base, &adev->dev,
 		       psys_trace_blocks);
@@ -1725,16 +3191,36 @@ static int ipu_psys_probe(struct ipu_bus_device *adev)
 
 	spin_lock_init(&psys->ready_lock);
 	spin_lock_init(&psys->pgs_lock);
+	spin_lock_init(&psys->manifests_lock);
+	spin_lock_init(&psys->kcmd_lock);
+	idr_init(&psys->kcmd_idr);
+	hash_init(psys->buf_sets_hash);
 	psys->ready = 0;
 	psys->timeout = IPU_PSYS_CMD_TIMEOUT_MS;
 
 	mutex_init(&psys->mutex);
+	spin_lock_init(&psys->fhs_lock);
+	spin_lock_init(&psys->qcmd_rec_lock);
+	mutex_init(&psys->qcmd_rec_read_mutex);
 	INIT_LIST_HEAD(&psys->fhs);
-	INIT_LIST_HEAD(&psys->pgs);
+	spin_lock_init(&psys->pins_lock);
+	INIT_LIST_HEAD(&psys->pins);
+	INIT_LIST_HEAD(&psys->pins_stale);
+	ipu_psys_chain_init(psys);
+	rval = init_srcu_struct(&psys->fhs_srcu);
+	if (rval) {
+		mutex_destroy(&psys->mutex);
+		goto out_unlock;
+	}
+	for (i = 0; i < IPU_PSYS_PG_NUM_CLASSES; i++)
+		INIT_LIST_HEAD(&psys->pg_classes[i].pgs);
 	INIT_LIST_HEAD(&psys->started_kcmds_list);
 
 	init_waitqueue_head(&psys->sched_cmd_wq);
 	atomic_set(&psys->wakeup_count, 0);
+	mutex_init(&psys->sched_attr_mutex);
+	cpumask_copy(&psys->sched_cpus, cpu_possible_mask);
+	psys->sched_policy = IPU_PSYS_SCHED_NORMAL;
 	/*
 	 * Create a thread to schedule commands sent to IPU firmware.
 	 * The thread reduces the coupling between the command scheduler
@@ -1745,12 +3231,16 @@ static int ipu_psys_probe(struct ipu_bus_device *adev)
 
 	if (IS_ERR(psys->sched_cmd_thread)) {
 		psys->sched_cmd_thread = NULL;
+		cleanup_srcu_struct(&psys->fhs_srcu);
+		mutex_destroy(&psys->sched_attr_mutex);
 		mutex_destroy(&psys->mutex);
 		goto out_unlock;
 	}
 
 	ipu_bus_set_drvdata(adev, psys);
+	ipu_bus_set_autosuspend(adev, autosuspend_ms, autosuspend_max_ms);
 
+	ipu6_psys_hw_res_variant_init();
 	rval = ipu_psys_resource_pool_init(&psys->resource_pool_running);
 	if (rval < 0) {
 		dev_err(&psys->dev,
@@ -1758,27 +3248,23 @@ static int ipu_psys_probe(struct ipu_bus_device *adev)
 		goto out_mutex_destroy;
 	}
 
-	ipu6_psys_hw_res_variant_init();
 	psys->pkg_dir = isp->pkg_dir;
 	psys->pkg_dir_dma_addr = isp->pkg_dir_dma_addr;
 	psys->pkg_dir_size = isp->pkg_dir_size;
 	psys->fw_sgt = isp->fw_sgt;
 
+	rval = ipu_psys_kmanifest_cache_init(psys);
+	if (rval) {
+		dev_err(&psys->dev, "unable to cache pg manifests\n");
+		goto out_free_pgs;
+	}
+
 	/* allocate and map memory for process groups */
 	for (i = 0; i < IPU_PSYS_PG_POOL_SIZE; i++) {
-		kpg = kzalloc(sizeof(*kpg), GFP_KERNEL);
+		kpg = ipu_psys_pg_alloc(psys, IPU_PSYS_PG_MAX_SIZE);
 		if (!kpg)
 			goto out_free_pgs;
-		kpg->pg = dma_alloc_attrs(&adev->dev,
-					  IPU_PSYS_PG_MAX_SIZE,
-					  &kpg->pg_dma_addr,
-					  GFP_KERNEL, 0);
-		if (!kpg->pg) {
-			kfree(kpg);
-			goto out_free_pgs;
-		}
-		kpg->size = IPU_PSYS_PG_MAX_SIZE;
-		list_add(&kpg->list, &psys->pgs);
+		ipu_psys_pg_add(psys, kpg);
 	}
 
 	psys->caps.pg_count = ipu_cpd_pkg_dir_get_num_entries(psys->pkg_dir);
@@ -1802,6 +3288,7 @@ static int ipu_psys_probe(struct ipu_bus_device *adev)
 	psys->dev.bus = &ipu_psys_bus;
 	psys->dev.devt = MKDEV(MAJOR(ipu_psys_dev_t), minor);
 	psys->dev.release = ipu_psys_dev_release;
+	psys->dev.groups = ipu_psys_groups;
 	dev_set_name(&psys->dev, "ipu-psys%d", minor);
 	rval = device_register(&psys->dev);
 	if (rval < 0) {
@@ -1822,6 +3309,21 @@ static int ipu_psys_probe(struct ipu_bus_device *adev)
 
 	adev->isp->cpd_fw_reload = &cpd_fw_reload;
 
+#ifdef IPU_PSYS_GPC
+	/* Not fatal either */
+	psys->gpc_pmu = ipu_gpc_pmu_register(&adev->dev, psys->pdata->base +
+					     IPU_GPC_BASE,
+					     &psys_gpc_pmu_regs, "ipu6_psys");
+	if (IS_ERR(psys->gpc_pmu)) {
+		dev_warn(&adev->dev, "gpc pmu register failed: %ld\n",
+			 PTR_ERR(psys->gpc_pmu));
+		psys->gpc_pmu = NULL;
+	}
+#endif
+
+	atomic_notifier_chain_register(&adev->isp->isys_frame_notifier,
+				       &psys->chain_nb);
+
 	dev_info(&adev->dev, "psys probe minor: %d\n", minor);
 
 	ipu_mmu_hw_cleanup(adev->mmu);
@@ -1831,20 +3333,21 @@ static int ipu_psys_probe(struct ipu_bus_device *adev)
 out_release_fw_com:
 	ipu_fw_com_release(psys->fwcom, 1);
 out_free_pgs:
-	list_for_each_entry_safe(kpg, kpg0, &psys->pgs, list) {
-		dma_free_attrs(&adev->dev, kpg->size, kpg->pg,
-			       kpg->pg_dma_addr, 0);
-		kfree(kpg);
-	}
+	ipu_psys_pg_pool_free(psys);
+	ipu_psys_kmanifest_cache_free(psys);
 
 	ipu_psys_resource_pool_cleanup(&psys->resource_pool_running);
 out_mutex_destroy:
-	mutex_destroy(&psys->mutex);
-	cdev_del(&psys->cdev);
+	/* The kick work and the command thread both take psys->mutex */
+	cancel_delayed_work_sync(&psys->sched_kick_work);
 	if (psys->sched_cmd_thread) {
 		kthread_stop(psys->sched_cmd_thread);
 		psys->sched_cmd_thread = NULL;
 	}
+	mutex_destroy(&psys->sched_attr_mutex);
+	mutex_destroy(&psys->mutex);
+	cdev_del(&psys->cdev);
+	cleanup_srcu_struct(&psys->fhs_srcu);
 out_unlock:
 	/* Safe to call even if the init is not called */
 	ipu_trace_uninit(&adev->dev);
@@ -1859,25 +3362,27 @@ static void ipu_psys_remove(struct ipu_bus_device *adev)
 {
 	struct ipu_device *isp = adev->isp;
 	struct ipu_psys *psys = ipu_bus_get_drvdata(adev);
-	struct ipu_psys_pg *kpg, *kpg0;
 
 #ifdef CONFIG_DEBUG_FS
 	if (isp->ipu_dir)
 		debugfs_remove_recursive(psys->debugfsdir);
 #endif
 
+	flush_work(&psys->fh_release_work);
+	ipu_psys_chain_cleanup(psys);
+	cancel_delayed_work_sync(&psys->sched_kick_work);
 	if (psys->sched_cmd_thread) {
 		kthread_stop(psys->sched_cmd_thread);
 		psys->sched_cmd_thread = NULL;
 	}
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
+	ipu_psys_pin_cache_flush(psys);
+#endif
+
 	mutex_lock(&ipu_psys_mutex);
 
-	list_for_each_entry_safe(kpg, kpg0, &psys->pgs, list) {
-		dma_free_attrs(&adev->dev, kpg->size, kpg->pg,
-			       kpg->pg_dma_addr, 0);
-		kfree(kpg);
-	}
+	ipu_psys_pg_pool_free(psys);
 
 	if (psys->fwcom && ipu_fw_com_release(psys->fwcom, 1))
 		dev_err(&adev->dev, "fw com release failed.\n");
@@ -1885,9 +3390,13 @@ static void ipu_psys_remove(struct ipu_bus_device *adev)
 	kfree(psys->server_init);
 	kfree(psys->syscom_config);
 
+#ifdef IPU_PSYS_GPC
+	ipu_gpc_pmu_unregister(psys->gpc_pmu);
+#endif
 	ipu_trace_uninit(&adev->dev);
 
 	ipu_psys_resource_pool_cleanup(&psys->resource_pool_running);
+	ipu_psys_kmanifest_cache_free(psys);
 
 	device_unregister(&psys->dev);
 
@@ -1896,17 +3405,51 @@ static void ipu_psys_remove(struct ipu_bus_device *adev)
 
 	mutex_unlock(&ipu_psys_mutex);
 
+	idr_destroy(&psys->kcmd_idr);
+	cleanup_srcu_struct(&psys->fhs_srcu);
+	if (kfifo_initialized(&psys->qcmd_rec))
+		kfifo_free(&psys->qcmd_rec);
+	mutex_destroy(&psys->qcmd_rec_read_mutex);
+	mutex_destroy(&psys->sched_attr_mutex);
 	mutex_destroy(&psys->mutex);
 
 	dev_info(&adev->dev, "removed\n");
 }
 
+/* One irq_poll_us poll for firmware events, with the interrupt disabled */
+static unsigned int psys_isr_poll(struct ipu_psys *psys)
+{
+	unsigned int events;
+	int r, idx;
+
+	mutex_lock(&psys->mutex);
+#ifdef CONFIG_PM
+	r = pm_runtime_get_if_in_use(&psys->adev->dev);
+	if (!r || WARN_ON_ONCE(r < 0)) {
+		mutex_unlock(&psys->mutex);
+		return 0;
+	}
+#endif
+
+	idx = srcu_read_lock(&psys->fhs_srcu);
+	events = ipu_psys_handle_events(psys);
+	srcu_read_unlock(&psys->fhs_srcu, idx);
+	psys->irq_polls++;
+	psys->irq_polled_events += events;
+
+	pm_runtime_put(&psys->adev->dev);
+	mutex_unlock(&psys->mutex);
+
+	return events;
+}
+
 static irqreturn_t psys_isr_threaded(struct ipu_bus_device *adev)
 {
 	struct ipu_psys *psys = ipu_bus_get_drvdata(adev);
 	void __iomem *base = psys->pdata->base;
+	unsigned int events = 0, rounds = 0;
 	u32 status;
-	int r;
+	int r, idx;
 
 	mutex_lock(&psys->mutex);
 #ifdef CONFIG_PM
@@ -1919,15 +3462,30 @@ static irqreturn_t psys_isr_threaded(struct ipu_bus_device *adev)
 
 	status = readl(base + IPU_REG_PSYS_GPDEV_IRQ_STATUS);
 	writel(status, base + IPU_REG_PSYS_GPDEV_IRQ_CLEAR);
+	psys->irq_count++;
 
 	if (status & IPU_PSYS_GPDEV_IRQ_FWIRQ(IPU_PSYS_GPDEV_FWIRQ0)) {
 		writel(0, base + IPU_REG_PSYS_GPDEV_FWIRQ(0));
-		ipu_psys_handle_events(psys);
+		idx = srcu_read_lock(&psys->fhs_srcu);
+		events = ipu_psys_handle_events(psys);
+		srcu_read_unlock(&psys->fhs_srcu, idx);
+		psys->irq_events += events;
 	}
 
 	pm_runtime_put(&psys->adev->dev);
 	mutex_unlock(&psys->mutex);
 
+	/*
+	 * Interrupt then poll: the buttress keeps the PSYS interrupt
+	 * disabled until this returns, so events following a busy one are
+	 * picked up by polling instead of raising interrupts of their own.
+	 * Events arriving meanwhile still latch the interrupt status.
+	 */
+	while (events && irq_poll_us && rounds++ < irq_poll_rounds) {
+		usleep_range(irq_poll_us, irq_poll_us + irq_poll_us / 4 + 1);
+		events = psys_isr_poll(psys);
+	}
+
 	return status ? IRQ_HANDLED : IRQ_NONE;
 }
 
@@ -5,21 +5,44 @@
 #define IPU_PSYS_H
 
 #include <linux/cdev.h>
+#include <linux/hashtable.h>
+#include <linux/idr.h>
+#include <linux/kfifo.h>
+#include <linux/kref.h>
+#include <linux/llist.h>
+#include <linux/mmu_notifier.h>
+#include <linux/srcu.h>
+#include <linux/version.h>
 #include <linux/workqueue.h>
 
 #include "ipu.h"
 #include "ipu-pdata.h"
 #include "ipu-fw-psys.h"
 #include "ipu-platform-psys.h"
+#include "ipu-stats.h"
 
 #define IPU_PSYS_PG_POOL_SIZE 16
 #define IPU_PSYS_PG_MAX_SIZE 8192
+/* PG pool size classes are PAGE_SIZE << n, the last one takes any size */
+#define IPU_PSYS_PG_NUM_CLASSES 6
+/* Free PG buffers kept in a class once a manifest of that size is seen */
+#define IPU_PSYS_PG_CLASS_RESERVE 4
 #define IPU_MAX_PSYS_CMD_BUFFERS 32
 #define IPU_PSYS_EVENT_CMD_COMPLETE IPU_FW_PSYS_EVENT_TYPE_SUCCESS
 #define IPU_PSYS_EVENT_FRAGMENT_COMPLETE IPU_FW_PSYS_EVENT_TYPE_SUCCESS
 #define IPU_PSYS_CLOSE_TIMEOUT_US   50
 #define IPU_PSYS_CLOSE_TIMEOUT (100000 / IPU_PSYS_CLOSE_TIMEOUT_US)
 #define IPU_MAX_RESOURCES 128
+/* Buckets for the per-fh fd and dma_buf lookup tables */
+#define IPU_PSYS_FH_HASH_BITS 8
+/* Default idle time the power gating round trip needs to pay off */
+#define IPU_PSYS_PG_BREAK_EVEN_US	8000
+/* Buckets for the buffer set by address table of the event path */
+#define IPU_PSYS_BUF_SET_HASH_BITS 6
+/* Latency histogram buckets, bucket n counts [2^(n-1), 2^n) us */
+#define IPU_PSYS_LAT_BUCKETS 16
+/* Bytes of QCMD records kept until read from debugfs */
+#define IPU_PSYS_QCMD_RECORD_SIZE	SZ_1M
 
 /* Opaque structure. Do not access fields. */
 struct ipu_resource {
@@ -61,6 +84,8 @@ struct ipu_psys_resource_pool {
 	DECLARE_BITMAP(cmd_queues, 32);
 	/* Protects cmd_queues bitmap */
 	spinlock_t queues_lock;
+	/* Bumped whenever cells or resource bitmaps change, never 0 */
+	unsigned long gen;
 };
 
 /*
@@ -75,6 +100,39 @@ struct ipu_psys_resource_alloc {
 	int resources;
 };
 
+struct ipu_psys_pg_class {
+	struct list_head pgs;
+	unsigned int count;
+	u64 hits;
+	u64 misses;
+};
+
+enum ipu_psys_lat_stage {
+	IPU_PSYS_LAT_QUEUE,	/* QCMD to handed to the firmware */
+	IPU_PSYS_LAT_EXEC,	/* handed to the firmware to completion event */
+	IPU_PSYS_LAT_REAP,	/* completion event to DQEVENT */
+	IPU_PSYS_LAT_NUM
+};
+
+struct ipu_psys_lat_hist {
+	u64 buckets[IPU_PSYS_LAT_BUCKETS];
+	u64 count;
+	u64 sum_ns;
+	u64 max_ns;
+};
+
+/*
+ * Program group manifest of a pkg_dir entry, copied out of the firmware
+ * image when it is loaded. Started ppgs hold a reference, so a manifest
+ * stays valid across a firmware reload until the last user is gone.
+ */
+struct ipu_psys_kmanifest {
+	struct kref ref;
+	u32 pg_id;
+	u32 size;
+	u8 data[];
+};
+
 struct task_struct;
 struct ipu_psys {
 	struct ipu_psys_capability caps;
@@ -86,9 +144,18 @@ struct ipu_psys {
 	bool icache_prefetch_sp;
 	bool icache_prefetch_isp;
 	spinlock_t ready_lock;	/* protect psys firmware state */
-	spinlock_t pgs_lock;	/* Protect pgs list access */
+	spinlock_t pgs_lock;	/* Protect pg_classes access */
+	/*
+	 * fhs is changed under fhs_lock and walked under fhs_srcu, so that
+	 * open and release don't wait for a whole scheduler run.
+	 */
+	spinlock_t fhs_lock;
+	struct srcu_struct fhs_srcu;
 	struct list_head fhs;
-	struct list_head pgs;
+	/* Closed fhs whose buffers and ppgs fh_release_work tears down */
+	struct llist_head fh_release_list;
+	struct work_struct fh_release_work;
+	struct ipu_psys_pg_class pg_classes[IPU_PSYS_PG_NUM_CLASSES];
 	struct list_head started_kcmds_list;
 	struct ipu_psys_pdata *pdata;
 	struct ipu_bus_device *adev;
@@ -98,41 +165,189 @@ struct ipu_psys {
 	struct task_struct *sched_cmd_thread;
 	wait_queue_head_t sched_cmd_wq;
 	atomic_t wakeup_count;  /* Psys schedule thread wakeup count */
+	/* Placement of sched_cmd_thread set in sysfs, applied by the thread */
+	struct mutex sched_attr_mutex;
+	struct cpumask sched_cpus;
+	unsigned int sched_policy;
+	bool sched_attr_changed;
 #ifdef CONFIG_DEBUG_FS
 	struct dentry *debugfsdir;
 #endif
+#ifdef IPU_PSYS_GPC
+	struct ipu_gpc_pmu *gpc_pmu;
+#endif
 
 	/* Resources needed to be managed for process groups */
 	struct ipu_psys_resource_pool resource_pool_running;
+	/* Undo log of the admission checks, under psys->mutex */
+	struct ipu_psys_resource_alloc resource_alloc_try;
 
 	const struct firmware *fw;
 	struct sg_table fw_sgt;
 	u64 *pkg_dir;
 	dma_addr_t pkg_dir_dma_addr;
 	unsigned int pkg_dir_size;
+	/* Manifests by pkg_dir index, NULL for other entries */
+	spinlock_t manifests_lock;
+	struct ipu_psys_kmanifest **manifests;
+	unsigned int num_manifests;
 	unsigned long timeout;
 
 	int active_kcmds, started_kcmds;
 	void *fwcom;
 
 	int power_gating;
+	/*
+	 * Power gating is only entered when the idle time predicted from the
+	 * running ppgs' frame intervals exceeds pg_break_even_us. Scheduler
+	 * state, protected by mutex.
+	 */
+	u32 pg_break_even_us;
+	u64 pg_gated_ns;
+	u64 pg_entered;
+	u64 pg_skipped;
+	u64 pg_early_exits;
+	/* Power gating exits ahead of an ISYS frame, see frame_pacing_lead_us */
+	u64 pg_paced_exits;
+	/* Last and worst power gating entry (first suspend to gated) and exit */
+	u64 pg_enter_start_ns;
+	u64 pg_enter_ns;
+	u64 pg_enter_max_ns;
+	u64 pg_exit_ns;
+	u64 pg_exit_max_ns;
+	/* Starts and resumes that found no room in the running pool */
+	u64 res_contentions;
+	/* Re-runs the scheduler to retry a skipped power gating */
+	struct delayed_work sched_kick_work;
+
+	/*
+	 * Firmware event lookup: kcmds running in the firmware by id and
+	 * buffer sets by address, both protected by kcmd_lock.
+	 */
+	spinlock_t kcmd_lock;
+	struct idr kcmd_idr;
+	DECLARE_HASHTABLE(buf_sets_hash, IPU_PSYS_BUF_SET_HASH_BITS);
+	/*
+	 * Firmware busy time for the buttress DVFS governor: accumulated
+	 * under kcmd_lock while any kcmd is tracked, sampled by the scheduler.
+	 */
+	unsigned int busy_inflight;
+	u64 busy_since_ns;
+	u64 busy_ns;
+	/* Governor window start and missed deadlines seen, under mutex */
+	u64 dvfs_window_ns;
+	u64 dvfs_missed;
+
+	/* Interrupts, events they found and interrupt-then-poll rounds */
+	u64 irq_count;
+	u64 irq_events;
+	u64 irq_polls;
+	u64 irq_polled_events;
+
+	/* dma-buf mapping cache statistics, summed over all fhs */
+	struct ipu_buf_cache_stats kbuf_cache;
+
+	/* QCMD recording, see struct ipu_psys_qcmd_record */
+	spinlock_t qcmd_rec_lock;	/* Protects the fields below */
+	struct kfifo qcmd_rec;
+	bool qcmd_rec_on;
+	u32 qcmd_rec_lost;
+	struct mutex qcmd_rec_read_mutex;	/* Single reader of qcmd_rec */
+
+	/* Pinned userptr ranges, see struct ipu_psys_pin */
+	spinlock_t pins_lock;	/* Protects the fields below */
+	struct list_head pins;
+	struct list_head pins_stale;
+	unsigned long pins_bytes;
+	u64 pin_hits;
+	u64 pin_misses;
+	u64 pin_invalidations;
+
+	/*
+	 * Commands waiting for an ISYS frame, see IPU_BUFFER_FLAG_WAIT_ISYS.
+	 * The ISYS notifier moves them from chain_held to chain_ready, and
+	 * chain_work sends them to their ppgs. Aborted frames and
+	 * chain_timeout_work fail them with an event instead.
+	 */
+	spinlock_t chain_lock;	/* Protects chain_held and chain_ready */
+	struct list_head chain_held;
+	struct list_head chain_ready;
+	struct work_struct chain_work;
+	struct delayed_work chain_timeout_work;
+	struct notifier_block chain_nb;
+};
+
+/* Per-CPU event counters of one fh, in the psys "stats" sysfs file */
+enum ipu_psys_stat {
+	IPU_PSYS_STAT_KBUF_HITS,
+	/* Misses are the buffers mapped to the IPU, of mapped_bytes */
+	IPU_PSYS_STAT_KBUF_MISSES,
+	IPU_PSYS_STAT_KBUF_MAPPED_BYTES,
+	IPU_PSYS_STAT_KBUF_EVICTIONS,
+	IPU_PSYS_STAT_UNMAPBUF,
+	IPU_PSYS_STAT_KCMD_QUEUED,
+	IPU_PSYS_STAT_KCMD_DONE,
+	IPU_PSYS_STAT_KCMD_ERRORS,
+	IPU_PSYS_STAT_NUM,
 };
 
 struct ipu_psys_fh {
 	struct ipu_psys *psys;
 	struct mutex mutex;	/* Protects bufs_list & kcmds fields */
 	struct list_head list;
+	/* On psys->fh_release_list once closed */
+	struct llist_node release_node;
 	/* Holds all buffers that this fh owns */
 	struct list_head bufs_list;
 	/* Holds all descriptors (fd:kbuffer associations) */
 	struct list_head descs_list;
 	struct list_head bufs_lru;
+	/* fd -> descriptor index over descs_list */
+	DECLARE_HASHTABLE(descs_hash, IPU_PSYS_FH_HASH_BITS);
+	/* dma_buf -> kbuffer index over bufs_list and bufs_lru */
+	DECLARE_HASHTABLE(bufs_hash, IPU_PSYS_FH_HASH_BITS);
 	wait_queue_head_t wait;
+	/* On the wake list of a firmware event batch */
+	struct list_head wake_list;
+	/* IPU_IOC_SET_EVENTFD context, signalled along with wait */
+	struct eventfd_ctx *eventfd;
+	spinlock_t eventfd_lock;
 	struct ipu_psys_scheduler sched;
 
 	u32 num_bufs;
 	u32 num_descs;
 	u32 num_bufs_lru;
+	/* Bytes of mapped IOVA held by bufs_lru */
+	u64 lru_bytes;
+
+	/* IPU_IOC_S_QOS settings, written under mutex */
+	u32 qos_class;
+	u32 qos_period_us;
+	u32 qos_deadline_us;
+	u32 qos_share;
+	u32 qos_quota_pct;
+	atomic64_t qos_frames;
+	atomic64_t qos_missed;
+	/* Firmware time of the fh's kcmds, added as they are untracked */
+	atomic64_t busy_ns;
+	/*
+	 * Recent busy time over qos_share, halved every scheduler window.
+	 * Among ppgs of a QoS class the fh with the lower load goes first.
+	 * Written by the scheduler under psys->mutex.
+	 */
+	u64 share_load;
+	u64 share_busy_ns;
+	/* Over qos_quota_pct in the last window, set by the scheduler */
+	bool throttled;
+	u32 throttled_windows;
+
+	/* kcmd stage latencies, protected by lat_lock */
+	spinlock_t lat_lock;
+	struct ipu_psys_lat_hist lat[IPU_PSYS_LAT_NUM];
+
+	struct ipu_stats stats;
+	/* Process that opened the fh */
+	pid_t pid;
 };
 
 struct ipu_psys_pg {
@@ -151,11 +366,22 @@ struct ipu_psys_kcmd {
 	enum ipu_psys_cmd_state state;
 	void *pg_manifest;
 	size_t pg_manifest_size;
+	struct ipu_psys_kmanifest *manifest_ref;
 	struct ipu_psys_kbuffer **kbufs;
 	struct ipu_psys_buffer *buffers;
 	size_t nbuffers;
 	struct ipu_fw_psys_process_group *pg_user;
 	struct ipu_psys_pg *kpg;
+	/* kpg is the kppg's own PG, not a pool copy of pg_user */
+	bool pg_reused;
+	/* kcmd_idr id while the kcmd is running in the firmware, or 0 */
+	int id;
+	/* ktime_get_ns() deadline of a REALTIME fh frame, else U64_MAX */
+	u64 deadline;
+	/* ktime_get_ns() of QCMD, firmware hand over and completion */
+	u64 qcmd_ns;
+	u64 start_ns;
+	u64 done_ns;
 	u64 user_token;
 	u64 issue_id;
 	u32 priority;
@@ -166,6 +392,31 @@ struct ipu_psys_kcmd {
 	struct ipu_buttress_constraint constraint;
 	struct ipu_psys_event ev;
 	struct timer_list watchdog;
+	/* Held on psys->chain_held until ISYS completes a frame into it */
+	struct dma_buf *wait_dbuf;
+	/* Set when the frame is aborted or never comes, fails the kcmd */
+	int wait_error;
+};
+
+/*
+ * User pages pinned long term for userptr buffers, keyed by mm and page
+ * range. Attachments of the same range share the pin, and the cache keeps
+ * it after the last one goes, so a HAL handing in the same malloc'd
+ * buffers again skips pinning. Any invalidation of the range, munmap
+ * included, takes the pin out of the cache; attachments already holding
+ * it keep the pages, as they did with get_user_pages().
+ */
+struct ipu_psys_pin {
+	struct list_head list;	/* psys->pins, most recently used last */
+	struct kref ref;
+	struct ipu_psys *psys;
+	struct mm_struct *mm;
+	unsigned long start;
+	unsigned long npages;
+	struct page **pages;
+	struct mmu_interval_notifier notifier;
+	bool cached;	/* On psys->pins, holding a reference */
+	bool stale;	/* Range invalidated, never handed out again */
 };
 
 struct ipu_dma_buf_attach {
@@ -176,13 +427,17 @@ struct ipu_dma_buf_attach {
 	bool vma_is_io;
 	struct page **pages;
 	size_t npages;
+	struct ipu_psys *psys;
+	struct ipu_psys_pin *pin;	/* Owner of pages, if cached */
 };
 
 struct ipu_psys_kbuffer {
 	u64 len;
 	void *userptr;
+	struct ipu_psys *psys;	/* Exporter of a userptr buffer */
 	void *kaddr;
 	struct list_head list;
+	struct hlist_node hnode;
 	dma_addr_t dma_addr;
 	struct sg_table *sgt;
 	struct dma_buf_attachment *db_attach;
@@ -191,14 +446,26 @@ struct ipu_psys_kbuffer {
 	/* The number of times this buffer is mapped */
 	atomic_t map_count;
 	bool valid;	/* True when buffer is usable */
+	bool lru;	/* True when buffer is on the LRU list */
 };
 
 struct ipu_psys_desc {
 	struct ipu_psys_kbuffer	*kbuf;
 	struct list_head	list;
+	struct hlist_node	hnode;
 	u32			fd;
 };
 
+/* Walk psys->fhs, the caller holds psys->fhs_srcu */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 12, 0)
+#define ipu_psys_for_each_fh(fh, psys) \
+	list_for_each_entry_rcu(fh, &(psys)->fhs, list)
+#else
+#define ipu_psys_for_each_fh(fh, psys) \
+	list_for_each_entry_srcu(fh, &(psys)->fhs, list, \
+				 srcu_read_lock_held(&(psys)->fhs_srcu))
+#endif
+
 #define inode_to_ipu_psys(inode) \
 	container_of((inode)->i_cdev, struct ipu_psys, cdev)
 
@@ -209,10 +476,19 @@ long ipu_psys_compat_ioctl32(struct file *file, unsigned int cmd,
 
 void ipu_psys_setup_hw(struct ipu_psys *psys);
 void ipu_psys_subdomains_power(struct ipu_psys *psys, bool on);
-void ipu_psys_handle_events(struct ipu_psys *psys);
+unsigned int ipu_psys_handle_events(struct ipu_psys *psys);
 int ipu_psys_kcmd_new(struct ipu_psys_command *cmd, struct ipu_psys_fh *fh);
+void ipu_psys_chain_init(struct ipu_psys *psys);
+void ipu_psys_chain_cleanup(struct ipu_psys *psys);
+void ipu_psys_chain_release_fh(struct ipu_psys_fh *fh);
+void ipu_psys_qcmd_record(struct ipu_psys_kcmd *kcmd,
+			  struct ipu_psys_command *cmd, size_t pg_size);
 void ipu_psys_run_next(struct ipu_psys *psys);
 struct ipu_psys_pg *__get_pg_buf(struct ipu_psys *psys, size_t pg_size);
+struct ipu_psys_kmanifest *ipu_psys_kmanifest_alloc(size_t size);
+struct ipu_psys_kmanifest *ipu_psys_kmanifest_get(struct ipu_psys *psys,
+						 u32 pg_id);
+void ipu_psys_kmanifest_put(struct ipu_psys_kmanifest *manifest);
 struct ipu_psys_kbuffer *
 ipu_psys_lookup_kbuffer(struct ipu_psys_fh *fh, int fd);
 struct ipu_psys_kbuffer *
@@ -224,8 +500,12 @@ int ipu_psys_gpc_init_debugfs(struct ipu_psys *psys);
 #endif
 int ipu_psys_resource_pool_init(struct ipu_psys_resource_pool *pool);
 void ipu_psys_resource_pool_cleanup(struct ipu_psys_resource_pool *pool);
+int ipu_psys_resource_pool_print(struct ipu_psys_resource_pool *pool,
+				 char *buf, size_t size);
 struct ipu_psys_kcmd *ipu_get_completed_kcmd(struct ipu_psys_fh *fh);
 long ipu_ioctl_dqevent(struct ipu_psys_event *event,
 		       struct ipu_psys_fh *fh, unsigned int f_flags);
+long ipu_ioctl_dqevents(struct ipu_psys_events *events,
+			struct ipu_psys_fh *fh, unsigned int f_flags);
 
 #endif /* IPU_PSYS_H */
@@ -0,0 +1,92 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2024 Intel Corporation */
+
+#ifndef IPU_STATS_H
+#define IPU_STATS_H
+
+#include <linux/atomic.h>
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/types.h>
+
+/*
+ * Event counters cheap enough to leave on: each CPU bumps its own copy and
+ * a read sums them, so the figures are exact but not a snapshot. A set
+ * whose allocation failed counts nothing and reads as zeros.
+ */
+struct ipu_stats {
+	u64 __percpu *cnt;
+	const char * const *names;
+	unsigned int num;
+};
+
+static inline int ipu_stats_init(struct ipu_stats *s,
+				 const char * const *names, unsigned int num)
+{
+	s->names = names;
+	s->num = num;
+	s->cnt = __alloc_percpu(num * sizeof(u64), sizeof(u64));
+
+	return s->cnt ? 0 : -ENOMEM;
+}
+
+static inline void ipu_stats_free(struct ipu_stats *s)
+{
+	free_percpu(s->cnt);
+	s->cnt = NULL;
+}
+
+static inline void ipu_stats_add(struct ipu_stats *s, unsigned int i, u64 val)
+{
+	if (s->cnt)
+		this_cpu_add(s->cnt[i], val);
+}
+
+static inline void ipu_stats_inc(struct ipu_stats *s, unsigned int i)
+{
+	ipu_stats_add(s, i, 1);
+}
+
+static inline u64 ipu_stats_read(struct ipu_stats *s, unsigned int i)
+{
+	u64 sum = 0;
+	int cpu;
+
+	if (!s->cnt)
+		return 0;
+
+	for_each_possible_cpu(cpu)
+		sum += per_cpu_ptr(s->cnt, cpu)[i];
+
+	return sum;
+}
+
+/* One "name value" line per counter, as much as fits in size bytes */
+static inline int ipu_stats_print(struct ipu_stats *s, char *buf, size_t size)
+{
+	unsigned int i;
+	int len = 0;
+
+	for (i = 0; i < s->num; i++)
+		len += scnprintf(buf + len, size - len, "%s %llu\n",
+				 s->names[i], ipu_stats_read(s, i));
+
+	return len;
+}
+
+/* Counters of a dma-buf import cache, kept alike by ISYS and PSYS */
+struct ipu_buf_cache_stats {
+	atomic64_t hits;
+	atomic64_t misses;
+	atomic64_t evictions;
+};
+
+static inline int ipu_buf_cache_stats_print(struct ipu_buf_cache_stats *s,
+					    char *buf, size_t size)
+{
+	return scnprintf(buf, size, "hits %lld\nmisses %lld\nevictions %lld\n",
+			 atomic64_read(&s->hits), atomic64_read(&s->misses),
+			 atomic64_read(&s->evictions));
+}
+
+#endif /* IPU_STATS_H */
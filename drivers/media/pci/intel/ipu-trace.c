@@ -5,11 +5,15 @@
 #include <linux/delay.h>
 #include <linux/device.h>
 #include <linux/dma-mapping.h>
+#include <linux/kref.h>
+#include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/pm_runtime.h>
 #include <linux/sizes.h>
+#include <linux/slab.h>
 #include <linux/uaccess.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 
 #include "ipu.h"
 #include "ipu-platform-regs.h"
@@ -22,6 +26,11 @@ static bool ipu_trace_enable;
 module_param(ipu_trace_enable, bool, 0660);
 MODULE_PARM_DESC(ipu_trace_enable, "IPU trace enable");
 
+static unsigned int ipu_trace_ring_poll_ms = 10;
+module_param(ipu_trace_ring_poll_ms, uint, 0660);
+MODULE_PARM_DESC(ipu_trace_ring_poll_ms,
+		 "Trace ring write pointer update interval in ms");
+
 struct trace_register_range {
 	u32 start;
 	u32 end;
@@ -59,10 +68,28 @@ struct ipu_subsystem_wptrace_config {
 	struct config_value config[MAX_TRACE_REGISTERS];
 };
 
+/* The ring buffer memory, kept until its last user mapping goes */
+struct ipu_trace_ring_mem {
+	struct kref ref;
+	struct device *dev;
+	void *vaddr;
+	dma_addr_t dma_handle;
+};
+
+struct ipu_trace_ring {
+	struct ipu_trace_ring_ctrl *ctrl;	/* control page */
+	struct ipu_trace_ring_mem *mem;	/* NULL once uninit starts */
+	struct delayed_work work;
+	struct mutex lock; /* Protect the control page and users */
+	unsigned int users;
+	u32 last;	/* ring offset at the last update */
+};
+
 struct ipu_subsystem_trace_config {
 	u32 offset;
 	void __iomem *base;
 	struct ipu_trace_buffer memory;	/* ring buffer */
+	struct ipu_trace_ring ring;	/* streaming access to the ring */
 	struct device *dev;
 	struct ipu_trace_block *blocks;
 	unsigned int fill_level;	/* Nbr of regs in config table below */
@@ -83,6 +110,8 @@ struct ipu_trace {
 	struct ipu_subsystem_trace_config psys;
 };
 
+static void __ipu_trace_ring_reset(struct ipu_subsystem_trace_config *sys);
+
 static void __ipu_trace_restore(struct device *dev)
 {
 	struct ipu_bus_device *adev = to_ipu_bus_device(dev);
@@ -144,6 +173,7 @@ static void __ipu_trace_restore(struct device *dev)
 
 	/* ring buffer base */
 	writel(mapped_trace_buffer, addr + TRACE_REG_TUN_DRAM_BASE_ADDR);
+	__ipu_trace_ring_reset(sys);
 
 	/* ring buffer end */
 	writel(mapped_trace_buffer + MEMORY_RING_BUFFER_SIZE -
@@ -743,6 +773,275 @@ static const struct file_operations ipu_gettrace_fops = {
 	.llseek = no_llseek,
 };
 
+/*
+ * Streaming access to the ring. The trace unit wraps from the end address
+ * back to the base, so the ring holds MEMORY_RING_BUFFER_SIZE bytes and
+ * TRACE_REG_TUN_WR_PTR is the DMA address of the next message. The write
+ * pointer is sampled while the files are open and the subsystem is
+ * powered. A producer lapping the ring between two samples is not seen.
+ *
+ * Mappings hold a reference to the ring memory, which is freed with the
+ * last of them rather than at uninit. The control page is inserted as a
+ * page, so its own refcount keeps it. mmap() is refused once uninit has
+ * started, and the files go through the debugfs proxy for the rest; where
+ * the proxy doesn't forward mmap(), read() gives the control page.
+ */
+static void __ipu_trace_ring_reset(struct ipu_subsystem_trace_config *sys)
+{
+	struct ipu_trace_ring *ring = &sys->ring;
+	struct ipu_trace_ring_ctrl *ctrl = ring->ctrl;
+
+	if (!ctrl)
+		return;
+
+	/* The trace unit starts again from the base */
+	mutex_lock(&ring->lock);
+	WRITE_ONCE(ctrl->seq, ctrl->seq + 1);
+	smp_wmb();
+	if (ring->last)
+		ctrl->head += MEMORY_RING_BUFFER_SIZE - ring->last;
+	ctrl->tail = ctrl->head;
+	ring->last = 0;
+	smp_wmb();
+	WRITE_ONCE(ctrl->seq, ctrl->seq + 1);
+	mutex_unlock(&ring->lock);
+}
+
+static void ipu_trace_ring_update(struct ipu_subsystem_trace_config *sys)
+{
+	struct ipu_trace_ring *ring = &sys->ring;
+	struct ipu_trace_ring_ctrl *ctrl = ring->ctrl;
+	struct ipu_trace_block *blocks;
+	void __iomem *addr = NULL;
+	u32 pos;
+
+	for (blocks = sys->blocks; blocks->type != IPU_TRACE_BLOCK_END;
+	     blocks++) {
+		if (blocks->type == IPU_TRACE_BLOCK_TUN) {
+			addr = sys->base + blocks->offset;
+			break;
+		}
+	}
+	if (!addr || !sys->dev || !sys->memory.memory_buffer)
+		return;
+
+	/* Registers are only accessible while the subsystem is powered */
+	if (pm_runtime_get_if_in_use(sys->dev) <= 0)
+		return;
+	pos = readl(addr + TRACE_REG_TUN_WR_PTR) -
+		lower_32_bits(sys->memory.dma_handle);
+	pm_runtime_put(sys->dev);
+
+	if (pos >= MEMORY_RING_BUFFER_SIZE)
+		return;
+
+	WRITE_ONCE(ctrl->seq, ctrl->seq + 1);
+	smp_wmb();
+	ctrl->head += (pos + MEMORY_RING_BUFFER_SIZE - ring->last) %
+		MEMORY_RING_BUFFER_SIZE;
+	ring->last = pos;
+	if (ctrl->head - ctrl->tail > MEMORY_RING_BUFFER_SIZE) {
+		ctrl->overruns++;
+		ctrl->tail = ctrl->head - MEMORY_RING_BUFFER_SIZE;
+	}
+	smp_wmb();
+	WRITE_ONCE(ctrl->seq, ctrl->seq + 1);
+}
+
+static void ipu_trace_ring_work(struct work_struct *work)
+{
+	struct ipu_subsystem_trace_config *sys =
+		container_of(to_delayed_work(work),
+			     struct ipu_subsystem_trace_config, ring.work);
+	struct ipu_trace_ring *ring = &sys->ring;
+
+	mutex_lock(&ring->lock);
+	if (ring->users) {
+		ipu_trace_ring_update(sys);
+		schedule_delayed_work(&ring->work,
+				      msecs_to_jiffies(ipu_trace_ring_poll_ms));
+	}
+	mutex_unlock(&ring->lock);
+}
+
+static int tracering_open(struct inode *inode, struct file *file)
+{
+	struct ipu_subsystem_trace_config *sys = inode->i_private;
+	struct ipu_trace_ring *ring;
+
+	if (!sys || !sys->memory.memory_buffer || !sys->ring.ctrl)
+		return -EACCES;
+
+	ring = &sys->ring;
+	mutex_lock(&ring->lock);
+	if (!ring->users++)
+		mod_delayed_work(system_wq, &ring->work, 0);
+	mutex_unlock(&ring->lock);
+
+	file->private_data = sys;
+	return nonseekable_open(inode, file);
+}
+
+static int tracering_release(struct inode *inode, struct file *file)
+{
+	struct ipu_subsystem_trace_config *sys = file->private_data;
+
+	/* The work stops by itself once there are no users */
+	mutex_lock(&sys->ring.lock);
+	sys->ring.users--;
+	mutex_unlock(&sys->ring.lock);
+
+	return 0;
+}
+
+/* The control page, for users not mapping it */
+static ssize_t tracering_read(struct file *file, char __user *buf,
+			      size_t len, loff_t *ppos)
+{
+	struct ipu_subsystem_trace_config *sys = file->private_data;
+	struct ipu_trace_ring_ctrl ctrl;
+	loff_t pos = 0;
+
+	mutex_lock(&sys->ring.lock);
+	ipu_trace_ring_update(sys);
+	ctrl = *sys->ring.ctrl;
+	mutex_unlock(&sys->ring.lock);
+
+	return simple_read_from_buffer(buf, len, &pos, &ctrl, sizeof(ctrl));
+}
+
+/* The consumer writes its position, a u64, after reading from the ring */
+static ssize_t tracering_write(struct file *file, const char __user *buf,
+			       size_t len, loff_t *ppos)
+{
+	struct ipu_subsystem_trace_config *sys = file->private_data;
+	struct ipu_trace_ring_ctrl *ctrl = sys->ring.ctrl;
+	ssize_t ret = len;
+	u64 tail;
+
+	if (len != sizeof(tail))
+		return -EINVAL;
+
+	if (copy_from_user(&tail, buf, sizeof(tail)))
+		return -EFAULT;
+
+	mutex_lock(&sys->ring.lock);
+	if (tail <= ctrl->head) {
+		WRITE_ONCE(ctrl->seq, ctrl->seq + 1);
+		smp_wmb();
+		ctrl->tail = max(ctrl->tail, tail);
+		smp_wmb();
+		WRITE_ONCE(ctrl->seq, ctrl->seq + 1);
+	} else {
+		ret = -EINVAL;
+	}
+	mutex_unlock(&sys->ring.lock);
+
+	return ret;
+}
+
+static void ipu_trace_ring_mem_release(struct kref *ref)
+{
+	struct ipu_trace_ring_mem *mem =
+		container_of(ref, struct ipu_trace_ring_mem, ref);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 4, 0)
+	dma_free_coherent(mem->dev,
+			  MEMORY_RING_BUFFER_SIZE + MEMORY_RING_BUFFER_GUARD,
+			  mem->vaddr, mem->dma_handle);
+#else
+	dma_free_attrs(mem->dev,
+		       MEMORY_RING_BUFFER_SIZE + MEMORY_RING_BUFFER_GUARD,
+		       mem->vaddr, mem->dma_handle, DMA_ATTR_NON_CONSISTENT);
+#endif
+	put_device(mem->dev);
+	kfree(mem);
+}
+
+static void ipu_trace_ring_vm_open(struct vm_area_struct *vma)
+{
+	struct ipu_trace_ring_mem *mem = vma->vm_private_data;
+
+	kref_get(&mem->ref);
+}
+
+static void ipu_trace_ring_vm_close(struct vm_area_struct *vma)
+{
+	struct ipu_trace_ring_mem *mem = vma->vm_private_data;
+
+	kref_put(&mem->ref, ipu_trace_ring_mem_release);
+}
+
+static const struct vm_operations_struct ipu_trace_ring_vm_ops = {
+	.open = ipu_trace_ring_vm_open,
+	.close = ipu_trace_ring_vm_close,
+};
+
+static int tracering_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct ipu_subsystem_trace_config *sys = file->private_data;
+	unsigned long size = vma->vm_end - vma->vm_start;
+	struct ipu_trace_ring_mem *mem;
+	int ret;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	/* No mprotect() to writable later on */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+	vm_flags_clear(vma, VM_MAYWRITE);
+#else
+	vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+
+	if (!vma->vm_pgoff) {
+		if (size != PAGE_SIZE)
+			return -EINVAL;
+		return vm_insert_page(vma, vma->vm_start,
+				      virt_to_page(sys->ring.ctrl));
+	}
+
+	mutex_lock(&sys->ring.lock);
+	mem = sys->ring.mem;
+	if (!mem) {
+		mutex_unlock(&sys->ring.lock);
+		return -ENODEV;
+	}
+	kref_get(&mem->ref);
+	mutex_unlock(&sys->ring.lock);
+
+	/* The ring, the guard included as it may hold valid data */
+	vma->vm_pgoff--;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 4, 0)
+	ret = dma_mmap_coherent(mem->dev, vma, mem->vaddr, mem->dma_handle,
+				MEMORY_RING_BUFFER_SIZE +
+				MEMORY_RING_BUFFER_GUARD);
+#else
+	ret = dma_mmap_attrs(mem->dev, vma, mem->vaddr, mem->dma_handle,
+			     MEMORY_RING_BUFFER_SIZE +
+			     MEMORY_RING_BUFFER_GUARD,
+			     DMA_ATTR_NON_CONSISTENT);
+#endif
+	if (ret) {
+		kref_put(&mem->ref, ipu_trace_ring_mem_release);
+		return ret;
+	}
+
+	vma->vm_private_data = mem;
+	vma->vm_ops = &ipu_trace_ring_vm_ops;
+
+	return 0;
+}
+
+static const struct file_operations ipu_tracering_fops = {
+	.owner = THIS_MODULE,
+	.open = tracering_open,
+	.release = tracering_release,
+	.read = tracering_read,
+	.write = tracering_write,
+	.mmap = tracering_mmap,
+	.llseek = no_llseek,
+};
+
 int ipu_trace_init(struct ipu_device *isp, void __iomem *base,
 		   struct device *dev, struct ipu_trace_block *blocks)
 {
@@ -771,6 +1070,12 @@ int ipu_trace_init(struct ipu_device *isp, void __iomem *base,
 	sys->base = base;
 	sys->blocks = blocks;
 
+	if (!sys->ring.ctrl) {
+		sys->ring.ctrl = (void *)get_zeroed_page(GFP_KERNEL);
+		if (sys->ring.ctrl)
+			sys->ring.ctrl->size = MEMORY_RING_BUFFER_SIZE;
+	}
+
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 4, 0)
 	sys->memory.memory_buffer =
 	    dma_alloc_coherent(dev, MEMORY_RING_BUFFER_SIZE +
@@ -785,8 +1090,19 @@ int ipu_trace_init(struct ipu_device *isp, void __iomem *base,
 			    GFP_KERNEL, DMA_ATTR_NON_CONSISTENT);
 #endif
 
-	if (!sys->memory.memory_buffer)
+	if (!sys->memory.memory_buffer) {
 		dev_err(dev, "failed alloc memory for tracing.\n");
+		goto leave;
+	}
+
+	/* The ring mappings share the buffer, see tracering_mmap() */
+	sys->ring.mem = kzalloc(sizeof(*sys->ring.mem), GFP_KERNEL);
+	if (sys->ring.mem) {
+		kref_init(&sys->ring.mem->ref);
+		sys->ring.mem->dev = get_device(dev);
+		sys->ring.mem->vaddr = sys->memory.memory_buffer;
+		sys->ring.mem->dma_handle = sys->memory.dma_handle;
+	}
 
 leave:
 	mutex_unlock(&isp->trace->lock);
@@ -801,13 +1117,25 @@ void ipu_trace_uninit(struct device *dev)
 	struct ipu_device *isp = adev->isp;
 	struct ipu_trace *trace = isp->trace;
 	struct ipu_subsystem_trace_config *sys = adev->trace_cfg;
+	struct ipu_trace_ring_mem *mem;
 
 	if (!trace || !sys)
 		return;
 
+	cancel_delayed_work_sync(&sys->ring.work);
+
 	mutex_lock(&trace->lock);
 
-	if (sys->memory.memory_buffer)
+	/* No new ring mappings from here on */
+	mutex_lock(&sys->ring.lock);
+	mem = sys->ring.mem;
+	sys->ring.mem = NULL;
+	mutex_unlock(&sys->ring.lock);
+
+	/* The ring mappings left keep the buffer until they go */
+	if (mem)
+		kref_put(&mem->ref, ipu_trace_ring_mem_release);
+	else if (sys->memory.memory_buffer)
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 4, 0)
 		dma_free_coherent(sys->dev,
 				  MEMORY_RING_BUFFER_SIZE +
@@ -822,8 +1150,10 @@ void ipu_trace_uninit(struct device *dev)
 			       sys->memory.dma_handle, DMA_ATTR_NON_CONSISTENT);
 #endif
 
+	mutex_lock(&sys->ring.lock);
 	sys->dev = NULL;
 	sys->memory.memory_buffer = NULL;
+	mutex_unlock(&sys->ring.lock);
 
 	mutex_unlock(&trace->lock);
 }
@@ -831,7 +1161,7 @@ EXPORT_SYMBOL_GPL(ipu_trace_uninit);
 
 int ipu_trace_debugfs_add(struct ipu_device *isp, struct dentry *dir)
 {
-	struct dentry *files[4];
+	struct dentry *files[6];
 	int i = 0;
 
 	if (!ipu_trace_enable)
@@ -862,6 +1192,18 @@ int ipu_trace_debugfs_add(struct ipu_device *isp, struct dentry *dir)
 				       &isp->trace->psys, &ipu_gettrace_fops);
 	if (!files[i])
 		goto error;
+	i++;
+
+	files[i] = debugfs_create_file("getisystracering", 0644, dir,
+				       &isp->trace->isys, &ipu_tracering_fops);
+	if (!files[i])
+		goto error;
+	i++;
+
+	files[i] = debugfs_create_file("getpsystracering", 0644, dir,
+				       &isp->trace->psys, &ipu_tracering_fops);
+	if (!files[i])
+		goto error;
 
 	return 0;
 
@@ -882,6 +1224,10 @@ int ipu_trace_add(struct ipu_device *isp)
 		return -ENOMEM;
 
 	mutex_init(&isp->trace->lock);
+	mutex_init(&isp->trace->isys.ring.lock);
+	mutex_init(&isp->trace->psys.ring.lock);
+	INIT_DELAYED_WORK(&isp->trace->isys.ring.work, ipu_trace_ring_work);
+	INIT_DELAYED_WORK(&isp->trace->psys.ring.work, ipu_trace_ring_work);
 
 	dev_dbg(&isp->pdev->dev, "ipu trace enabled!");
 
@@ -892,6 +1238,12 @@ void ipu_trace_release(struct ipu_device *isp)
 {
 	if (!isp->trace)
 		return;
+	cancel_delayed_work_sync(&isp->trace->isys.ring.work);
+	cancel_delayed_work_sync(&isp->trace->psys.ring.work);
+	free_page((unsigned long)isp->trace->isys.ring.ctrl);
+	free_page((unsigned long)isp->trace->psys.ring.ctrl);
+	mutex_destroy(&isp->trace->isys.ring.lock);
+	mutex_destroy(&isp->trace->psys.ring.lock);
 	mutex_destroy(&isp->trace->lock);
 }
 
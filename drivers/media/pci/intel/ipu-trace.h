@@ -119,6 +119,21 @@
 struct ipu_trace;
 struct ipu_subsystem_trace_config;
 
+/*
+ * Control page of the streaming trace files (get{isys,psys}tracering),
+ * mmap()ed read-only at offset 0. The ring itself is mmap()ed from offset
+ * PAGE_SIZE on. Positions are byte counts since the trace files were
+ * created; position % size is the offset into the ring. seq is odd while
+ * the page is being updated.
+ */
+struct ipu_trace_ring_ctrl {
+	__u32 seq;
+	__u32 size;	/* ring size in bytes */
+	__u64 head;	/* written by the trace unit */
+	__u64 tail;	/* consumed, as last written to the file */
+	__u64 overruns;	/* updates that found head more than size ahead */
+};
+
 enum ipu_trace_block_type {
 	IPU_TRACE_BLOCK_TUN = 0,	/* Trace unit */
 	IPU_TRACE_BLOCK_TM,	/* Trace monitor */
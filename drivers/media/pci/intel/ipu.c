@@ -6,6 +6,7 @@
 #include <linux/device.h>
 #include <linux/interrupt.h>
 #include <linux/firmware.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
 #include <linux/pci.h>
@@ -23,6 +24,7 @@
 #include "ipu-cpd.h"
 #include "ipu-pdata.h"
 #include "ipu-bus.h"
+#include "ipu-dma.h"
 #include "ipu-mmu.h"
 #include "ipu-platform-regs.h"
 #include "ipu-platform-isys-csi2-reg.h"
@@ -316,6 +318,122 @@ static int cpd_fw_reload(void *data, u64 val)
 
 DEFINE_SIMPLE_ATTRIBUTE(cpd_fw_fops, NULL, cpd_fw_reload, "%llu\n");
 
+static ssize_t ipu_resume_stats_read(struct file *file, char __user *buf,
+				     size_t len, loff_t *ppos)
+{
+	struct ipu_device *isp = file->private_data;
+	struct ipu_resume_stats *rs = &isp->resume;
+	char tmp[256];
+	int n;
+
+	n = scnprintf(tmp, sizeof(tmp),
+		      "fast %llu full %llu\n"
+		      "restore_us %llu ipc_reset_us %llu auth_us %llu\n",
+		      rs->fast, rs->full,
+		      div_u64(rs->ns[IPU_RESUME_RESTORE], NSEC_PER_USEC),
+		      div_u64(rs->ns[IPU_RESUME_IPC_RESET], NSEC_PER_USEC),
+		      div_u64(rs->ns[IPU_RESUME_AUTH], NSEC_PER_USEC));
+
+	return simple_read_from_buffer(buf, len, ppos, tmp, n);
+}
+
+static const struct file_operations ipu_resume_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = ipu_resume_stats_read,
+	.llseek = default_llseek,
+};
+
+static ssize_t ipu_power_stats_read(struct file *file, char __user *buf,
+				    size_t len, loff_t *ppos)
+{
+	struct ipu_device *isp = file->private_data;
+	struct ipu_bus_device *adevs[] = { isp->isys, isp->psys };
+	char tmp[256];
+	int i, n = 0;
+
+	for (i = 0; i < ARRAY_SIZE(adevs); i++) {
+		struct ipu_bus_pm *pm;
+
+		if (IS_ERR_OR_NULL(adevs[i]))
+			continue;
+
+		pm = &adevs[i]->pm;
+		n += scnprintf(tmp + n, sizeof(tmp) - n,
+			       "%s: suspends %llu resumes %llu early %llu delay_ms %u gap_avg_ms %llu\n",
+			       dev_name(&adevs[i]->dev), pm->suspends,
+			       pm->resumes, pm->early_resumes, pm->cur_ms,
+			       div_u64(pm->gap_avg_ns, NSEC_PER_MSEC));
+	}
+
+	return simple_read_from_buffer(buf, len, ppos, tmp, n);
+}
+
+static const struct file_operations ipu_power_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = ipu_power_stats_read,
+	.llseek = default_llseek,
+};
+
+static const char *const ipu_boot_phase_names[IPU_BOOT_NUM] = {
+	[IPU_BOOT_POWER_UP] = "power_up",
+	[IPU_BOOT_AUTH] = "auth",
+	[IPU_BOOT_SP_START] = "sp_start",
+	[IPU_BOOT_SYSCOM_READY] = "syscom_ready",
+	[IPU_BOOT_STREAM_OPEN] = "stream_open",
+};
+
+static ssize_t ipu_boot_timeline_read(struct file *file, char __user *buf,
+				      size_t len, loff_t *ppos)
+{
+	struct ipu_device *isp = file->private_data;
+	struct ipu_bus_device *adevs[] = { isp->isys, isp->psys };
+	const size_t size = 1024;
+	char *tmp;
+	ssize_t ret;
+	int i, j, n = 0;
+
+	tmp = kzalloc(size, GFP_KERNEL);
+	if (!tmp)
+		return -ENOMEM;
+
+	for (i = 0; i < ARRAY_SIZE(adevs); i++) {
+		u64 *tsc;
+
+		if (IS_ERR_OR_NULL(adevs[i]))
+			continue;
+
+		tsc = adevs[i]->boot_tsc;
+		for (j = 0; j < IPU_BOOT_NUM; j++) {
+			u64 us = 0;
+
+			if (!tsc[j])
+				continue;
+			if (tsc[j] > tsc[IPU_BOOT_POWER_UP])
+				us = div_u64(ipu_buttress_tsc_ticks_to_ns(tsc[j] -
+						tsc[IPU_BOOT_POWER_UP], isp),
+					     NSEC_PER_USEC);
+			n += scnprintf(tmp + n, size - n,
+				       "%s: %-12s tsc %llu +%llu us\n",
+				       dev_name(&adevs[i]->dev),
+				       ipu_boot_phase_names[j], tsc[j], us);
+		}
+	}
+
+	ret = simple_read_from_buffer(buf, len, ppos, tmp, n);
+	kfree(tmp);
+
+	return ret;
+}
+
+static const struct file_operations ipu_boot_timeline_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = ipu_boot_timeline_read,
+	.llseek = default_llseek,
+};
+
 static int ipu_init_debugfs(struct ipu_device *isp)
 {
 	struct dentry *file;
@@ -339,6 +457,21 @@ static int ipu_init_debugfs(struct ipu_device *isp)
 	if (!file)
 		goto err;
 
+	file = debugfs_create_file("resume", 0400, dir, isp,
+				   &ipu_resume_stats_fops);
+	if (!file)
+		goto err;
+
+	file = debugfs_create_file("power", 0400, dir, isp,
+				   &ipu_power_stats_fops);
+	if (!file)
+		goto err;
+
+	file = debugfs_create_file("boot_timeline", 0400, dir, isp,
+				   &ipu_boot_timeline_fops);
+	if (!file)
+		goto err;
+
 	if (ipu_trace_debugfs_add(isp, dir))
 		goto err;
 
@@ -409,6 +542,20 @@ static void ipu_configure_vc_mechanism(struct ipu_device *isp)
 	writel(val, isp->base + BUTTRESS_REG_BTRS_CTRL);
 }
 
+/*
+ * The image is mapped page by page for ISYS and PSYS, see
+ * ipu_buttress_map_fw_image(). Use the loader's buffer as is when it
+ * is vmalloc'ed or page aligned in the linear map, copy it otherwise.
+ */
+static bool ipu_cpd_fw_mappable(const struct firmware *fw)
+{
+	if (is_vmalloc_addr(fw->data))
+		return true;
+
+	return PAGE_ALIGNED(fw->data) && virt_addr_valid(fw->data) &&
+		virt_addr_valid(fw->data + fw->size - 1);
+}
+
 int request_cpd_fw(const struct firmware **firmware_p, const char *name,
 		   struct device *device)
 {
@@ -420,9 +567,10 @@ int request_cpd_fw(const struct firmware **firmware_p, const char *name,
 	if (ret)
 		return ret;
 
-	if (is_vmalloc_addr(fw->data)) {
+	if (ipu_cpd_fw_mappable(fw)) {
 		*firmware_p = fw;
 	} else {
+		dev_dbg(device, "copying %zu byte firmware image\n", fw->size);
 		tmp = kzalloc(sizeof(*tmp), GFP_KERNEL);
 		if (!tmp) {
 			release_firmware(fw);
@@ -444,6 +592,17 @@ int request_cpd_fw(const struct firmware **firmware_p, const char *name,
 }
 EXPORT_SYMBOL(request_cpd_fw);
 
+/* Log the time spent in a probe stage and start the next one */
+static void ipu_probe_stage(struct pci_dev *pdev, const char *stage,
+			    u64 *start)
+{
+	u64 now = ktime_get_ns();
+
+	dev_dbg(&pdev->dev, "probe: %s took %llu us\n", stage,
+		div_u64(now - *start, NSEC_PER_USEC));
+	*start = now;
+}
+
 static int ipu_pci_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 {
 	struct ipu_device *isp;
@@ -454,6 +613,8 @@ static int ipu_pci_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 	struct ipu_buttress_ctrl *isys_ctrl = NULL, *psys_ctrl = NULL;
 	unsigned int dma_mask = IPU_DMA_MASK;
 	struct fwnode_handle *fwnode = dev_fwnode(&pdev->dev);
+	u64 probe_start = ktime_get_ns();
+	u64 stage_start = probe_start;
 	u32 is_es;
 	int rval;
 	u32 val;
@@ -467,6 +628,7 @@ static int ipu_pci_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 
 	isp->pdev = pdev;
 	INIT_LIST_HEAD(&isp->devices);
+	ATOMIC_INIT_NOTIFIER_HEAD(&isp->isys_frame_notifier);
 
 	rval = pcim_enable_device(pdev);
 	if (rval) {
@@ -566,10 +728,14 @@ static int ipu_pci_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 		return rval;
 	}
 
+	ipu_probe_stage(pdev, "pci setup", &stage_start);
+
 	rval = ipu_buttress_init(isp);
 	if (rval)
 		return rval;
 
+	ipu_probe_stage(pdev, "buttress init", &stage_start);
+
 	dev_dbg(&pdev->dev, "cpd file name: %s\n", isp->cpd_fw_name);
 	rval = request_cpd_fw(&isp->cpd_fw, isp->cpd_fw_name, &pdev->dev);
 	if (rval == -ENOENT) {
@@ -592,6 +758,8 @@ static int ipu_pci_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 		goto out_ipu_bus_del_devices;
 	}
 
+	ipu_probe_stage(pdev, "firmware load", &stage_start);
+
 	rval = ipu_trace_add(isp);
 	if (rval)
 		dev_err(&pdev->dev, "Trace support not available\n");
@@ -639,6 +807,8 @@ static int ipu_pci_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 		goto out_ipu_bus_del_devices;
 	}
 
+	ipu_probe_stage(pdev, "bus devices", &stage_start);
+
 	rval = pm_runtime_get_sync(&isp->psys->dev);
 	if (rval < 0) {
 		dev_err(&isp->psys->dev, "Failed to get runtime PM\n");
@@ -679,6 +849,19 @@ static int ipu_pci_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 	ipu_mmu_hw_cleanup(isp->psys->mmu);
 	pm_runtime_put(&isp->psys->dev);
 
+	ipu_probe_stage(pdev, "authentication", &stage_start);
+
+#if defined(CONFIG_IPU_ISYS_BRIDGE)
+	rval = cio2_bridge_wait(pdev);
+	if (rval) {
+		dev_err_probe(&pdev->dev, rval,
+			      "ipu_isys_bridge_init() failed\n");
+		goto out_ipu_bus_del_devices;
+	}
+
+	ipu_probe_stage(pdev, "sensor discovery wait", &stage_start);
+#endif
+
 #ifdef CONFIG_DEBUG_FS
 	rval = ipu_init_debugfs(isp);
 	if (rval) {
@@ -701,9 +884,15 @@ static int ipu_pci_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 
 	isp->ipu_bus_ready_to_probe = true;
 
+	dev_info(&pdev->dev, "probe done in %llu us\n",
+		 div_u64(ktime_get_ns() - probe_start, NSEC_PER_USEC));
+
 	return 0;
 
 out_ipu_bus_del_devices:
+#if defined(CONFIG_IPU_ISYS_BRIDGE)
+	cio2_bridge_wait(pdev);
+#endif
 	if (isp->pkg_dir) {
 		if (isp->psys) {
 			ipu_cpd_free_pkg_dir(isp->psys, isp->pkg_dir,
@@ -827,8 +1016,12 @@ static int ipu_resume(struct device *dev)
 	struct pci_dev *pdev = to_pci_dev(dev);
 	struct ipu_device *isp = pci_get_drvdata(pdev);
 	struct ipu_buttress *b = &isp->buttress;
+	struct ipu_resume_stats *rs = &isp->resume;
+	u64 t0, t1;
 	int rval;
 
+	t0 = ktime_get_ns();
+
 	/* Configure the arbitration mechanisms for VC requests */
 	ipu_configure_vc_mechanism(isp);
 
@@ -839,9 +1032,31 @@ static int ipu_resume(struct device *dev)
 
 	ipu_buttress_restore(isp);
 
+	t1 = ktime_get_ns();
+	rs->ns[IPU_RESUME_RESTORE] = t1 - t0;
+
+	/*
+	 * The buttress keeps the authenticated firmware unless it lost
+	 * power, in which case the security state reads back as reset.
+	 * Firmware mapping and package directory are kept by the drivers
+	 * all along, so only a real reset needs the CSE again.
+	 */
+	if (ipu_buttress_auth_done(isp) && !isp->ipc_reinit) {
+		rs->ns[IPU_RESUME_IPC_RESET] = 0;
+		rs->ns[IPU_RESUME_AUTH] = 0;
+		rs->fast++;
+		dev_dbg(dev, "firmware authentication retained\n");
+		return 0;
+	}
+	rs->full++;
+
 	rval = ipu_buttress_ipc_reset(isp, &b->cse);
 	if (rval)
 		dev_err(&isp->pdev->dev, "IPC reset protocol failed!\n");
+	isp->ipc_reinit = false;
+
+	t0 = ktime_get_ns();
+	rs->ns[IPU_RESUME_IPC_RESET] = t0 - t1;
 
 	rval = pm_runtime_get_sync(&isp->psys->dev);
 	if (rval < 0) {
@@ -855,6 +1070,7 @@ static int ipu_resume(struct device *dev)
 			rval);
 
 	pm_runtime_put(&isp->psys->dev);
+	rs->ns[IPU_RESUME_AUTH] = ktime_get_ns() - t0;
 
 	return 0;
 }
@@ -863,10 +1079,17 @@ static int ipu_runtime_resume(struct device *dev)
 {
 	struct pci_dev *pdev = to_pci_dev(dev);
 	struct ipu_device *isp = pci_get_drvdata(pdev);
+	struct ipu_resume_stats *rs = &isp->resume;
+	u64 t0, t1;
 	int rval;
 
+	t0 = ktime_get_ns();
 	ipu_configure_vc_mechanism(isp);
 	ipu_buttress_restore(isp);
+	t1 = ktime_get_ns();
+	rs->ns[IPU_RESUME_RESTORE] = t1 - t0;
+	rs->ns[IPU_RESUME_IPC_RESET] = 0;
+	rs->ns[IPU_RESUME_AUTH] = 0;
 
 	if (isp->ipc_reinit) {
 		struct ipu_buttress *b = &isp->buttress;
@@ -876,6 +1099,10 @@ static int ipu_runtime_resume(struct device *dev)
 		if (rval)
 			dev_err(&isp->pdev->dev,
 				"IPC reset protocol failed!\n");
+		rs->ns[IPU_RESUME_IPC_RESET] = ktime_get_ns() - t1;
+		rs->full++;
+	} else {
+		rs->fast++;
 	}
 
 	return 0;
@@ -920,17 +1147,22 @@ static struct pci_driver ipu_pci_driver = {
 	.remove = ipu_pci_remove,
 	.driver = {
 		   .pm = IPU_PM,
+		   .probe_type = PROBE_PREFER_ASYNCHRONOUS,
 		   },
 	.err_handler = &pci_err_handlers,
 };
 
 static int __init ipu_init(void)
 {
-	int rval = ipu_bus_register();
+	int rval = ipu_dma_pool_init();
 
+	if (rval)
+		return rval;
+
+	rval = ipu_bus_register();
 	if (rval) {
 		pr_warn("can't register ipu bus (%d)\n", rval);
-		return rval;
+		goto out_pool_exit;
 	}
 
 	rval = pci_register_driver(&ipu_pci_driver);
@@ -943,6 +1175,8 @@ static int __init ipu_init(void)
 
 out_pci_register_driver:
 	ipu_bus_unregister();
+out_pool_exit:
+	ipu_dma_pool_exit();
 
 	return rval;
 }
@@ -951,6 +1185,7 @@ static void __exit ipu_exit(void)
 {
 	pci_unregister_driver(&ipu_pci_driver);
 	ipu_bus_unregister();
+	ipu_dma_pool_exit();
 }
 
 module_init(ipu_init);
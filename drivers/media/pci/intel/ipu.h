@@ -6,12 +6,14 @@
 
 #include <linux/ioport.h>
 #include <linux/list.h>
+#include <linux/notifier.h>
 #include <uapi/linux/media.h>
 #include <linux/version.h>
 
 #include "ipu-pdata.h"
 #include "ipu-bus.h"
 #include "ipu-buttress.h"
+#include "ipu-cpd.h"
 #include "ipu-trace.h"
 
 #define IPU6_PCI_ID	0x9a19
@@ -67,6 +69,28 @@ struct firmware;
 
 #define NR_OF_MMU_RESOURCES			2
 
+/* Actions of ipu_device isys_frame_notifier */
+#define IPU_ISYS_FRAME_DONE		0
+#define IPU_ISYS_FRAME_ABORTED		1
+
+/* Resume phases of the PCI device, see ipu_resume_stats */
+enum ipu_resume_phase {
+	IPU_RESUME_RESTORE,
+	IPU_RESUME_IPC_RESET,
+	IPU_RESUME_AUTH,
+	IPU_RESUME_NUM
+};
+
+/*
+ * Latest resume time per phase in ns. A fast resume finds the CSE
+ * authentication still in place and skips IPC reset and authentication.
+ */
+struct ipu_resume_stats {
+	u64 ns[IPU_RESUME_NUM];
+	u64 fast;
+	u64 full;
+};
+
 struct ipu_device {
 	struct pci_dev *pdev;
 	struct list_head devices;
@@ -77,6 +101,7 @@ struct ipu_device {
 	const struct firmware *cpd_fw;
 	const char *cpd_fw_name;
 	const char *cpd_fw_name_new;
+	struct ipu_cpd_index cpd_index;
 	u64 *pkg_dir;
 	dma_addr_t pkg_dir_dma_addr;
 	unsigned int pkg_dir_size;
@@ -91,6 +116,21 @@ struct ipu_device {
 	bool ipc_reinit;
 	bool secure_mode;
 	bool ipu_bus_ready_to_probe;
+	struct ipu_resume_stats resume;
+	/*
+	 * Called with the struct dma_buf of each imported ISYS capture
+	 * buffer that completes, from ISYS response handling or stream
+	 * stop. The action is IPU_ISYS_FRAME_DONE or IPU_ISYS_FRAME_ABORTED;
+	 * PSYS releases or fails the commands held on that buffer.
+	 */
+	struct atomic_notifier_head isys_frame_notifier;
+	/*
+	 * Frame cadence of the ISYS stream that last reported a SOF, for
+	 * the PSYS frame pacing: CPU time of that SOF and the SOF to SOF
+	 * period, 0 while unknown. Written by ISYS response handling.
+	 */
+	u64 isys_sof_ns;
+	u64 isys_frame_ns;
 
 	int (*cpd_fw_reload)(struct ipu_device *isp);
 };
@@ -112,6 +152,7 @@ extern enum ipu_version ipu_ver;
 void ipu_internal_pdata_init(void);
 #if defined(CONFIG_IPU_ISYS_BRIDGE)
 int cio2_bridge_init(struct pci_dev *cio2);
+int cio2_bridge_wait(struct pci_dev *cio2);
 #endif
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 1, 0)
@@ -306,6 +306,7 @@ enum {
 
 #define BUTTRESS_IRQS		(BUTTRESS_ISR_IPC_FROM_CSE_IS_WAITING |	\
 				 BUTTRESS_ISR_IPC_EXEC_DONE_BY_CSE |	\
+				 BUTTRESS_ISR_CSE_CSR_SET |		\
 				 BUTTRESS_ISR_IS_IRQ |			\
 				 BUTTRESS_ISR_PS_IRQ)
 
@@ -52,6 +52,8 @@
 #define IPU6_CSI_RX_ERROR_IRQ_MASK		0xfffff
 
 #define CSI_RX_NUM_ERRORS_IN_IRQ		20
+/* Transfer FIFO and FIFO overflow, the pixel buffer not drained in time */
+#define CSI_RX_OVERFLOW_ERRORS			(BIT(3) | BIT(16))
 #define CSI_RX_NUM_IRQ				32
 
 #define IPU_CSI_RX_IRQ_FS_VC		1
@@ -9,8 +9,11 @@
 
 #define IPU_PSYS_BUF_SET_POOL_SIZE 8
 #define IPU_PSYS_BUF_SET_MAX_SIZE 1024
+/* Buffer sets reserved per PPG for the frames in flight */
+#define IPU_PSYS_PPG_BUF_SET_RING 4
 
 struct ipu_fw_psys_buffer_set;
+struct ipu_psys_kmanifest;
 
 enum ipu_psys_cmd_state {
 	KCMD_STATE_PPG_NEW,
@@ -49,6 +52,7 @@ struct ipu_psys_ppg {
 	struct list_head sched_list;
 	u64 token;
 	void *manifest;
+	struct ipu_psys_kmanifest *manifest_ref;
 	struct mutex mutex;     /* Protects kcmd and ppg state field */
 	struct list_head kcmds_new_list;
 	struct list_head kcmds_processing_list;
@@ -56,6 +60,18 @@ struct ipu_psys_ppg {
 	enum ipu_psys_ppg_state state;
 	u32 pri_base;
 	int pri_dynamic;
+	/* Last enqueue and inter-frame interval EWMA, for power gating */
+	u64 last_arrival_ns;
+	u64 interval_ns;
+	/* Earliest deadline of the kcmds queued or running, U64_MAX if none */
+	u64 deadline;
+	/* Last admission result and resource_pool_running gen it was for */
+	int admit_ret;
+	unsigned long admit_gen;
+	/* Buffer set ring preallocated at start, claimed under mutex */
+	struct ipu_psys_buffer_set *buf_sets[IPU_PSYS_PPG_BUF_SET_RING];
+	unsigned int buf_set_next;
+	size_t buf_set_size;
 };
 
 struct ipu_psys_buffer_set {
@@ -66,12 +82,24 @@ struct ipu_psys_buffer_set {
 	dma_addr_t dma_addr;
 	void *kaddr;
 	struct ipu_psys_kcmd *kcmd;
+	/* Owner PPG when reserved in its ring, NULL in the fh pool */
+	struct ipu_psys_ppg *kppg;
+	/* In psys->buf_sets_hash by dma_addr, kcmd_id is kcmd's id */
+	struct hlist_node hnode;
+	int kcmd_id;
 };
 
 int ipu_psys_kcmd_start(struct ipu_psys *psys, struct ipu_psys_kcmd *kcmd);
 void ipu_psys_kcmd_complete(struct ipu_psys_ppg *kppg,
 			    struct ipu_psys_kcmd *kcmd,
 			    int error);
+void ipu_psys_kcmd_mark_start(struct ipu_psys_kcmd *kcmd);
+void ipu_psys_kcmd_track(struct ipu_psys_kcmd *kcmd);
+void ipu_psys_kcmd_untrack(struct ipu_psys_kcmd *kcmd);
+void ipu_psys_buf_set_hash_add(struct ipu_psys *psys,
+			       struct ipu_psys_buffer_set *kbuf_set);
+void ipu_psys_buf_set_hash_del(struct ipu_psys *psys,
+			       struct ipu_psys_buffer_set *kbuf_set);
 int ipu_psys_fh_init(struct ipu_psys_fh *fh);
 int ipu_psys_fh_deinit(struct ipu_psys_fh *fh);
 
@@ -73,13 +73,16 @@ int ipu_psys_move_resources(const struct device *dev,
 			    struct ipu_psys_resource_pool *source_pool,
 			    struct ipu_psys_resource_pool *target_pool);
 
-void ipu_psys_resource_copy(struct ipu_psys_resource_pool *src,
-			    struct ipu_psys_resource_pool *dest);
-
 int ipu_psys_try_allocate_resources(struct device *dev,
 				    struct ipu_fw_psys_process_group *pg,
 				    void *pg_manifest,
+				    struct ipu_psys_resource_alloc *alloc,
 				    struct ipu_psys_resource_pool *pool);
+int ipu_psys_check_resources(struct device *dev,
+			     struct ipu_fw_psys_process_group *pg,
+			     void *pg_manifest,
+			     struct ipu_psys_resource_alloc *alloc,
+			     struct ipu_psys_resource_pool *pool);
 
 void ipu_psys_reset_process_cell(const struct device *dev,
 				 struct ipu_fw_psys_process_group *pg,
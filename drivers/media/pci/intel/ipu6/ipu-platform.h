@@ -40,7 +40,9 @@ extern const struct ipu_buttress_ctrl psys_buttress_ctrl;
 
 /* definitions in ipu6-isys.c */
 extern struct ipu_trace_block isys_trace_blocks[];
+extern const struct ipu_gpc_pmu_regs isys_gpc_pmu_regs;
 /* definitions in ipu6-psys.c */
 extern struct ipu_trace_block psys_trace_blocks[];
+extern const struct ipu_gpc_pmu_regs psys_gpc_pmu_regs;
 
 #endif
@@ -6,6 +6,7 @@
 #include <linux/gfp.h>
 #include <linux/slab.h>
 #include <linux/device.h>
+#include <linux/kernel.h>
 
 #include <uapi/linux/ipu-psys.h>
 
@@ -13,19 +14,35 @@
 #include "ipu-psys.h"
 
 struct ipu6_psys_hw_res_variant hw_var;
+/*
+ * The hardware variant cannot change after probe, so resolve everything
+ * that depends on it here once. The per command allocation paths below
+ * only dereference hw_var and never look at ipu_ver again.
+ */
 void ipu6_psys_hw_res_variant_init(void)
 {
 	if (ipu_ver == IPU_VER_6SE) {
 		hw_var.queue_num = IPU6SE_FW_PSYS_N_PSYS_CMD_QUEUE_ID;
 		hw_var.cell_num = IPU6SE_FW_PSYS_N_CELL_ID;
+		hw_var.cmd_queue_start =
+			IPU6SE_FW_PSYS_CMD_QUEUE_PPG0_COMMAND_ID;
+		hw_var.res_defs = ipu6se_res_defs;
 	} else if (ipu_ver == IPU_VER_6) {
 		hw_var.queue_num = IPU6_FW_PSYS_N_PSYS_CMD_QUEUE_ID;
 		hw_var.cell_num = IPU6_FW_PSYS_N_CELL_ID;
+		hw_var.cmd_queue_start = IPU6_FW_PSYS_CMD_QUEUE_PPG0_COMMAND_ID;
+		hw_var.res_defs = ipu6_res_defs;
 	} else if (ipu_ver == IPU_VER_6EP || ipu_ver == IPU_VER_6EP_MTL) {
 		hw_var.queue_num = IPU6_FW_PSYS_N_PSYS_CMD_QUEUE_ID;
 		hw_var.cell_num = IPU6EP_FW_PSYS_N_CELL_ID;
+		hw_var.cmd_queue_start = IPU6_FW_PSYS_CMD_QUEUE_PPG0_COMMAND_ID;
+		hw_var.res_defs = ipu6ep_res_defs;
 	} else {
 		WARN(1, "ipu6 psys res var is not initialised correctly.");
+		hw_var.queue_num = IPU6_FW_PSYS_N_PSYS_CMD_QUEUE_ID;
+		hw_var.cell_num = IPU6_FW_PSYS_N_CELL_ID;
+		hw_var.cmd_queue_start = IPU6_FW_PSYS_CMD_QUEUE_PPG0_COMMAND_ID;
+		hw_var.res_defs = ipu6_res_defs;
 	}
 
 	hw_var.set_proc_dev_chn = ipu6_fw_psys_set_proc_dev_chn;
@@ -35,15 +52,9 @@ void ipu6_psys_hw_res_variant_init(void)
 		ipu6_fw_psys_get_program_manifest_by_process;
 }
 
-static const struct ipu_fw_resource_definitions *get_res(void)
+static inline const struct ipu_fw_resource_definitions *get_res(void)
 {
-	if (ipu_ver == IPU_VER_6SE)
-		return ipu6se_res_defs;
-
-	if (ipu_ver == IPU_VER_6EP || ipu_ver == IPU_VER_6EP_MTL)
-		return ipu6ep_res_defs;
-
-	return ipu6_res_defs;
+	return hw_var.res_defs;
 }
 
 static int ipu_resource_init(struct ipu_resource *res, u32 id, int elements)
@@ -91,12 +102,49 @@ ipu_resource_alloc_with_pos(struct ipu_resource *res, int n,
 	return pos;
 }
 
+/*
+ * Smallest free run of at least n elements, or largest free run and run
+ * count when n is 0. Returns res->elements if nothing fits.
+ */
+static unsigned long ipu_resource_free_runs(struct ipu_resource *res,
+					    unsigned long n,
+					    unsigned long *largest,
+					    unsigned int *runs)
+{
+	unsigned long start, end, len, best = res->elements;
+	unsigned long best_len = ULONG_MAX;
+
+	*largest = 0;
+	*runs = 0;
+	for (start = find_first_zero_bit(res->bitmap, res->elements);
+	     start < res->elements;
+	     start = find_next_zero_bit(res->bitmap, res->elements, end)) {
+		end = find_next_bit(res->bitmap, res->elements, start);
+		len = end - start;
+		(*runs)++;
+		*largest = max(*largest, len);
+		if (n && len >= n && len < best_len) {
+			best = start;
+			best_len = len;
+			if (len == n)
+				break;
+		}
+	}
+
+	return best;
+}
+
+/*
+ * Best fit, so that small requests don't split the runs a later large
+ * one needs: with mixed ppg sizes first fit leaves the pool fragmented.
+ */
 static unsigned long
 ipu_resource_alloc(struct ipu_resource *res, int n,
 		   struct ipu_resource_alloc *alloc,
 		   enum ipu_resource_type type)
 {
-	unsigned long p;
+	unsigned long p, largest;
+	unsigned int runs;
 
 	if (n <= 0) {
 		alloc->elements = 0;
@@ -106,7 +154,7 @@ ipu_resource_alloc(struct ipu_resource *res, int n,
 	if (!res->bitmap)
 		return (unsigned long)(-ENOSPC);
 
-	p = bitmap_find_next_zero_area(res->bitmap, res->elements, 0, n, 0);
+	p = ipu_resource_free_runs(res, n, &largest, &runs);
 	alloc->resource = NULL;
 
 	if (p >= res->elements)
@@ -140,6 +188,13 @@ static void ipu_resource_cleanup(struct ipu_resource *res)
 }
 
 /********** IPU PSYS-specific resource handling **********/
+static void ipu_psys_resource_pool_changed(struct ipu_psys_resource_pool *pool)
+{
+	unsigned long gen = pool->gen + 1;
+
+	WRITE_ONCE(pool->gen, gen ? gen : 1);
+}
+
 int ipu_psys_resource_pool_init(struct ipu_psys_resource_pool *pool)
 {
 	int i, j, k, ret;
@@ -149,6 +204,7 @@ int ipu_psys_resource_pool_init(struct ipu_psys_resource_pool *pool)
 
 	spin_lock_init(&pool->queues_lock);
 	pool->cells = 0;
+	pool->gen = 1;
 
 	for (i = 0; i < res_defs->num_dev_channels; i++) {
 		ret = ipu_resource_init(&pool->dev_channels[i], i,
@@ -171,12 +227,7 @@ int ipu_psys_resource_pool_init(struct ipu_psys_resource_pool *pool)
 	}
 
 	spin_lock(&pool->queues_lock);
-	if (ipu_ver == IPU_VER_6SE)
-		bitmap_zero(pool->cmd_queues,
-			    IPU6SE_FW_PSYS_N_PSYS_CMD_QUEUE_ID);
-	else
-		bitmap_zero(pool->cmd_queues,
-			    IPU6_FW_PSYS_N_PSYS_CMD_QUEUE_ID);
+	bitmap_zero(pool->cmd_queues, hw_var.queue_num);
 	spin_unlock(&pool->queues_lock);
 
 	return 0;
@@ -195,23 +246,38 @@ error:
 	return ret;
 }
 
-void ipu_psys_resource_copy(struct ipu_psys_resource_pool *src,
-			    struct ipu_psys_resource_pool *dest)
+/*
+ * Free space of each external memory: free elements, largest free run,
+ * free runs and fragmentation, the share of free space that is not in
+ * the largest run, in percent.
+ */
+int ipu_psys_resource_pool_print(struct ipu_psys_resource_pool *pool,
+				 char *buf, size_t size)
 {
-	int i;
-	const struct ipu_fw_resource_definitions *res_defs;
-
-	res_defs = get_res();
-
-	dest->cells = src->cells;
-	for (i = 0; i < res_defs->num_dev_channels; i++)
-		*dest->dev_channels[i].bitmap = *src->dev_channels[i].bitmap;
+	const struct ipu_fw_resource_definitions *res_defs = get_res();
+	unsigned long free, largest;
+	struct ipu_resource *res;
+	unsigned int runs;
+	int i, len;
+
+	len = scnprintf(buf, size, "cells 0x%x\n"
+			"mem\tsize\tfree\tlargest\truns\tfrag_pct\n",
+			pool->cells);
+	for (i = 0; i < res_defs->num_ext_mem_ids; i++) {
+		res = &pool->ext_memory[i];
+		if (!res->bitmap)
+			continue;
 
-	for (i = 0; i < res_defs->num_ext_mem_ids; i++)
-		*dest->ext_memory[i].bitmap = *src->ext_memory[i].bitmap;
+		free = res->elements -
+		    bitmap_weight(res->bitmap, res->elements);
+		ipu_resource_free_runs(res, 0, &largest, &runs);
+		len += scnprintf(buf + len, size - len,
+				 "%d\t%d\t%lu\t%lu\t%u\t%lu\n", i,
+				 res->elements, free, largest, runs,
+				 free ? (free - largest) * 100 / free : 0);
+	}
 
-	for (i = 0; i < res_defs->num_dfm_ids; i++)
-		*dest->dfms[i].bitmap = *src->dfms[i].bitmap;
+	return len;
 }
 
 void ipu_psys_resource_pool_cleanup(struct ipu_psys_resource_pool
@@ -375,21 +441,13 @@ static int __alloc_mem_resrc(const struct device *dev,
 int ipu_psys_allocate_cmd_queue_resource(struct ipu_psys_resource_pool *pool)
 {
 	unsigned long p;
-	int size, start;
-
-	size = IPU6_FW_PSYS_N_PSYS_CMD_QUEUE_ID;
-	start = IPU6_FW_PSYS_CMD_QUEUE_PPG0_COMMAND_ID;
-
-	if (ipu_ver == IPU_VER_6SE) {
-		size = IPU6SE_FW_PSYS_N_PSYS_CMD_QUEUE_ID;
-		start = IPU6SE_FW_PSYS_CMD_QUEUE_PPG0_COMMAND_ID;
-	}
 
 	spin_lock(&pool->queues_lock);
 	/* find available cmd queue from ppg0_cmd_id */
-	p = bitmap_find_next_zero_area(pool->cmd_queues, size, start, 1, 0);
+	p = bitmap_find_next_zero_area(pool->cmd_queues, hw_var.queue_num,
+				       hw_var.cmd_queue_start, 1, 0);
 
-	if (p >= size) {
+	if (p >= hw_var.queue_num) {
 		spin_unlock(&pool->queues_lock);
 		return -ENOSPC;
 	}
@@ -408,9 +466,14 @@ void ipu_psys_free_cmd_queue_resource(struct ipu_psys_resource_pool *pool,
 	spin_unlock(&pool->queues_lock);
 }
 
+/*
+ * Check if pg fits into `pool'. The resources are booked into the pool
+ * and into the caller's scratch `alloc', which is reset first.
+ */
 int ipu_psys_try_allocate_resources(struct device *dev,
 				    struct ipu_fw_psys_process_group *pg,
 				    void *pg_manifest,
+				    struct ipu_psys_resource_alloc *alloc,
 				    struct ipu_psys_resource_pool *pool)
 {
 	u32 id, idx;
@@ -419,7 +482,6 @@ int ipu_psys_try_allocate_resources(struct device *dev,
 	u16 *process_offset_table;
 	u8 processes;
 	u32 cells = 0;
-	struct ipu_psys_resource_alloc *alloc;
 	const struct ipu_fw_resource_definitions *res_defs;
 
 	if (!pg)
@@ -427,9 +489,7 @@ int ipu_psys_try_allocate_resources(struct device *dev,
 	process_offset_table = (u16 *)((u8 *)pg + pg->processes_offset);
 	processes = pg->process_count;
 
-	alloc = kzalloc(sizeof(*alloc), GFP_KERNEL);
-	if (!alloc)
-		return -ENOMEM;
+	memset(alloc, 0, sizeof(*alloc));
 
 	res_defs = get_res();
 	for (i = 0; i < processes; i++) {
@@ -537,13 +597,35 @@ int ipu_psys_try_allocate_resources(struct device *dev,
 	}
 
 	pool->cells |= cells;
+	alloc->cells = cells;
 
-	kfree(alloc);
 	return 0;
 
 free_out:
 	dev_dbg(dev, "failed to try_allocate resource\n");
-	kfree(alloc);
+	return ret;
+}
+
+/*
+ * Check if pg fits into `pool' in place, without a copy of the pool: the
+ * resources are booked with `alloc' as the undo log and given back before
+ * returning, so the cost is that of the resources pg needs. The pool is
+ * left as it was, gen included. Caller serializes against pool changes.
+ */
+int ipu_psys_check_resources(struct device *dev,
+			     struct ipu_fw_psys_process_group *pg,
+			     void *pg_manifest,
+			     struct ipu_psys_resource_alloc *alloc,
+			     struct ipu_psys_resource_pool *pool)
+{
+	unsigned long gen = pool->gen;
+	int ret;
+
+	ret = ipu_psys_try_allocate_resources(dev, pg, pg_manifest, alloc,
+					      pool);
+	ipu_psys_free_resources(alloc, pool);
+	WRITE_ONCE(pool->gen, gen);
+
 	return ret;
 }
 
@@ -714,6 +796,7 @@ int ipu_psys_allocate_resources(const struct device *dev,
 	}
 	alloc->cells |= cells;
 	pool->cells |= cells;
+	ipu_psys_resource_pool_changed(pool);
 	return 0;
 
 free_out:
@@ -808,6 +891,8 @@ int ipu_psys_move_resources(const struct device *dev,
 
 	target_pool->cells |= alloc->cells;
 	source_pool->cells &= ~alloc->cells;
+	ipu_psys_resource_pool_changed(source_pool);
+	ipu_psys_resource_pool_changed(target_pool);
 
 	return 0;
 }
@@ -865,4 +950,5 @@ void ipu_psys_free_resources(struct ipu_psys_resource_alloc
 	for (i = 0; i < alloc->resources; i++)
 		ipu_resource_free(&alloc->resource_alloc[i]);
 	alloc->resources = 0;
+	ipu_psys_resource_pool_changed(pool);
 }
@@ -600,10 +600,5 @@ void ipu6_fw_psys_pg_dump(struct ipu_psys *psys,
 void ipu6_fw_psys_pg_dump(struct ipu_psys *psys,
 			  struct ipu_psys_kcmd *kcmd, const char *note)
 {
-	if (ipu_ver == IPU_VER_6SE || ipu_ver == IPU_VER_6 ||
-	    ipu_ver == IPU_VER_6EP || ipu_ver == IPU_VER_6EP_MTL)
-		return;
-
-	WARN(1, "%s ipu_ver:[%u] is unsupported!\n", __func__, ipu_ver);
 }
 #endif
@@ -2,7 +2,10 @@
 // Copyright (C) 2020 - 2024 Intel Corporation
 
 #include <linux/delay.h>
+#include <linux/dma-mapping.h>
+#include <linux/module.h>
 #include <linux/spinlock.h>
+#include <linux/version.h>
 #include <media/ipu-isys.h>
 #include "ipu.h"
 #include "ipu-buttress.h"
@@ -57,6 +60,14 @@ static struct ipu6_csi2_error dphy_rx_errors[] = {
 
 static refcount_t phy_power_ref_count[IPU_ISYS_CSI_PHY_NUM];
 
+static bool phy_keep_on;
+module_param(phy_keep_on, bool, 0664);
+MODULE_PARM_DESC(phy_keep_on,
+		 "Keep the D-PHY up and configured from stream off until ISYS suspends");
+
+/* Powered and configured PHYs without a stream, see phy_keep_on */
+static bool phy_idle_on[IPU_ISYS_CSI_PHY_NUM];
+
 static int ipu6_csi2_phy_power_set(struct ipu_isys *isys,
 				   struct ipu_isys_csi2_config *cfg, bool on)
 {
@@ -90,6 +101,13 @@ static int ipu6_csi2_phy_power_set(struct ipu_isys *isys,
 			return 0;
 		}
 
+		/* Still set up from the last stream, skip the polled power up */
+		if (phy_idle_on[phy_id]) {
+			phy_idle_on[phy_id] = false;
+			refcount_set(ref, 1);
+			return 0;
+		}
+
 		ret = ipu6_isys_phy_powerup_ack(isys, phy_id);
 		if (ret)
 			return ret;
@@ -111,8 +129,13 @@ static int ipu6_csi2_phy_power_set(struct ipu_isys *isys,
 	}
 
 	/* power off process */
-	if (refcount_dec_and_test(ref))
+	if (refcount_dec_and_test(ref)) {
+		if (phy_keep_on) {
+			phy_idle_on[phy_id] = true;
+			return 0;
+		}
 		ret = ipu6_isys_phy_powerdown_ack(isys, phy_id);
+	}
 	if (ret)
 		dev_err(&isys->adev->dev, "phy poweroff failed!");
 
@@ -241,9 +264,11 @@ static void ipu6_isys_register_errors(struct ipu_isys_csi2 *csi2)
 	csi2->receiver_errors |= irq & mask;
 }
 
-void ipu_isys_csi2_error(struct ipu_isys_csi2 *csi2)
+/* Report the receiver errors, true if any of them lost data */
+bool ipu_isys_csi2_error(struct ipu_isys_csi2 *csi2)
 {
 	struct ipu6_csi2_error *errors;
+	bool fatal = false;
 	u32 status;
 	unsigned int i;
 
@@ -253,13 +278,20 @@ void ipu_isys_csi2_error(struct ipu_isys_csi2 *csi2)
 	csi2->receiver_errors = 0;
 	errors = dphy_rx_errors;
 
+	if (status & CSI_RX_OVERFLOW_ERRORS)
+		ipu_isys_iwake_overflow(csi2->isys);
+
 	for (i = 0; i < CSI_RX_NUM_ERRORS_IN_IRQ; i++) {
-		if (status & BIT(i))
-			dev_err_ratelimited(&csi2->isys->adev->dev,
-					    "csi2-%i error: %s\n",
-					    csi2->index,
-					    errors[i].error_string);
+		if (!(status & BIT(i)))
+			continue;
+		dev_err_ratelimited(&csi2->isys->adev->dev,
+				    "csi2-%i error: %s\n",
+				    csi2->index,
+				    errors[i].error_string);
+		fatal |= !errors[i].is_info_only;
 	}
+
+	return fatal;
 }
 
 const unsigned int csi2_port_cfg[][3] = {
@@ -441,6 +473,20 @@ static void ipu_isys_csi2_set_timing(struct v4l2_subdev *sd,
 	}
 }
 
+/* Power down the PHYs phy_keep_on left up, before ISYS powers off */
+void ipu_isys_csi2_phy_idle_off(struct ipu_isys *isys)
+{
+	unsigned int i;
+
+	for (i = 0; i < IPU_ISYS_CSI_PHY_NUM; i++) {
+		if (!phy_idle_on[i])
+			continue;
+		phy_idle_on[i] = false;
+		if (ipu6_isys_phy_powerdown_ack(isys, i))
+			dev_err(&isys->adev->dev, "phy poweroff failed!");
+	}
+}
+
 int ipu_isys_csi2_set_stream(struct v4l2_subdev *sd,
 			     struct ipu_isys_csi2_timing timing,
 			     unsigned int nlanes, int enable)
@@ -625,15 +671,19 @@ unsigned int ipu_isys_csi2_get_current_field(struct ipu_isys_pipeline *ip,
 	struct ipu_isys *isys = av->isys;
 	unsigned int field = V4L2_FIELD_TOP;
 
-	struct ipu_isys_buffer *short_packet_ib =
-		list_last_entry(&ip->short_packet_active,
-				struct ipu_isys_buffer, head);
+	/* The oldest buffer in the firmware, short_packet_queue_lock held */
 	struct ipu_isys_private_buffer *pb =
-		ipu_isys_buffer_to_private_buffer(short_packet_ib);
+		&ip->short_packet_bufs[ip->short_packet_tail %
+				       IPU_ISYS_SHORT_PACKET_BUFFER_NUM];
 	struct ipu_isys_mipi_packet_header *ph =
 		(struct ipu_isys_mipi_packet_header *)
 		pb->buffer;
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 4, 0)
+	dma_sync_single_for_cpu(&isys->adev->dev, pb->dma_addr,
+				sizeof(*ph), DMA_BIDIRECTIONAL);
+#endif
+
 	/* Check if the first SOF packet is received. */
 	if ((ph->dtype & IPU_ISYS_SHORT_PACKET_DTYPE_MASK) != 0)
 		dev_warn(&isys->adev->dev, "First short packet is not SOF.\n");
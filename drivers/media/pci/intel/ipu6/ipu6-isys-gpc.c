@@ -5,6 +5,7 @@
 #include <linux/debugfs.h>
 #include <linux/pm_runtime.h>
 
+#include "ipu-gpc-sample.h"
 #include "ipu-isys.h"
 #include "ipu-platform-regs.h"
 
@@ -200,6 +201,13 @@ int ipu_isys_gpc_init_debugfs(struct ipu_isys *isys)
 			goto err;
 	}
 
+	isys->gpc_sampler =
+		ipu_gpc_sampler_create(&isys->adev->dev, isys->adev->isp,
+				       isys->pdata->base + IPU_ISYS_GPC_BASE +
+				       IPU_ISF_CDC_MMU_GPC_VALUE0, gpcdir);
+	if (IS_ERR(isys->gpc_sampler))
+		isys->gpc_sampler = NULL;
+
 	return 0;
 
 err:
@@ -5,6 +5,7 @@
 #include <media/v4l2-event.h>
 
 #include "ipu.h"
+#include "ipu-gpc-pmu.h"
 #include "ipu-platform-regs.h"
 #include "ipu-trace.h"
 #include "ipu-isys.h"
@@ -78,6 +79,15 @@ struct ipu_trace_block isys_trace_blocks[] = {
 	}
 };
 
+/* Offsets from IPU_ISYS_GPC_BASE */
+const struct ipu_gpc_pmu_regs isys_gpc_pmu_regs = {
+	.soft_reset = IPU_ISF_CDC_MMU_GPC_SOFT_RESET,
+	.overall_enable = IPU_ISF_CDC_MMU_GPC_OVERALL_ENABLE,
+	.enable0 = IPU_ISF_CDC_MMU_GPC_ENABLE0,
+	.value0 = IPU_ISF_CDC_MMU_GPC_VALUE0,
+	.cnt_sel0 = IPU_ISF_CDC_MMU_GPC_CNT_SEL0,
+};
+
 void isys_setup_hw(struct ipu_isys *isys)
 {
 	void __iomem *base = isys->pdata->base;
@@ -128,12 +138,14 @@ irqreturn_t isys_isr(struct ipu_bus_device *adev)
 	void __iomem *base = isys->pdata->base;
 	u32 status_sw, status_csi;
 	u32 ctrl0_status, ctrl0_clear;
+	unsigned int handled;
 
 	spin_lock(&isys->power_lock);
 	if (!isys->power) {
 		spin_unlock(&isys->power_lock);
 		return IRQ_NONE;
 	}
+	isys->irq_count++;
 
 	if (ipu_ver == IPU_VER_6EP_MTL) {
 		ctrl0_status = IPU6V6_REG_ISYS_CSI_TOP_CTRL0_IRQ_STATUS;
@@ -150,6 +162,10 @@ irqreturn_t isys_isr(struct ipu_bus_device *adev)
 	       base + IPU_REG_ISYS_UNISPART_IRQ_MASK);
 
 	do {
+		/* resp_work owns the response queue and its status bit */
+		if (isys->resp_deferred)
+			status_sw &= ~IPU_ISYS_UNISPART_IRQ_SW;
+
 		writel(status_csi, isys->pdata->base + ctrl0_clear);
 
 		writel(status_sw, isys->pdata->base +
@@ -167,23 +183,113 @@ irqreturn_t isys_isr(struct ipu_bus_device *adev)
 			}
 		}
 
-		writel(0, base + IPU_REG_ISYS_UNISPART_SW_IRQ_REG);
+		if (!isys->resp_deferred) {
+			writel(0, base + IPU_REG_ISYS_UNISPART_SW_IRQ_REG);
 
-		if (!isys_isr_one(adev))
-			status_sw = IPU_ISYS_UNISPART_IRQ_SW;
-		else
-			status_sw = 0;
+			/*
+			 * Out of budget: leave the SW interrupt masked and
+			 * let resp_work drain the rest, NAPI style. With
+			 * irq_poll_us set, responses following this one are
+			 * polled for by resp_timer instead.
+			 */
+			if (isys_isr_drain(isys, &handled)) {
+				isys->resp_deferred = true;
+				isys->resp_deferrals++;
+				queue_work(system_highpri_wq, &isys->resp_work);
+			} else {
+				isys->resp_poll_round = 0;
+				if (isys_resp_poll_schedule(isys, handled))
+					isys->resp_deferred = true;
+			}
+		}
 
 		status_csi = readl(isys->pdata->base + ctrl0_status);
-		status_sw |= readl(isys->pdata->base +
-				   IPU_REG_ISYS_UNISPART_IRQ_STATUS);
+		status_sw = readl(isys->pdata->base +
+				  IPU_REG_ISYS_UNISPART_IRQ_STATUS);
+		if (isys->resp_deferred)
+			status_sw &= ~IPU_ISYS_UNISPART_IRQ_SW;
 	} while (((status_csi & isys->isr_csi2_bits) ||
 		  (status_sw & IPU_ISYS_UNISPART_IRQ_SW)) &&
 		 !isys->adev->isp->flr_done);
 
-	writel(ISYS_UNISPART_IRQS, base + IPU_REG_ISYS_UNISPART_IRQ_MASK);
+	if (isys->resp_deferred)
+		writel(ISYS_UNISPART_IRQS & ~IPU_ISYS_UNISPART_IRQ_SW,
+		       base + IPU_REG_ISYS_UNISPART_IRQ_MASK);
+	else
+		writel(ISYS_UNISPART_IRQS,
+		       base + IPU_REG_ISYS_UNISPART_IRQ_MASK);
 
 	spin_unlock(&isys->power_lock);
 
 	return IRQ_HANDLED;
 }
+
+/*
+ * Drains the responses isys_isr() left over. power_lock is taken per
+ * response so that interrupts are only off while one is handled.
+ */
+void isys_resp_work(struct work_struct *work)
+{
+	struct ipu_isys *isys = container_of(work, struct ipu_isys,
+					     resp_work);
+	void __iomem *base = isys->pdata->base;
+	unsigned long flags;
+	bool first = true;
+
+	for (;;) {
+		spin_lock_irqsave(&isys->power_lock, flags);
+		if (!isys->power || !isys->resp_deferred)
+			break;
+
+		if (first) {
+			writel(IPU_ISYS_UNISPART_IRQ_SW,
+			       base + IPU_REG_ISYS_UNISPART_IRQ_CLEAR);
+			writel(0, base + IPU_REG_ISYS_UNISPART_SW_IRQ_REG);
+			first = false;
+		}
+
+		if (!isys_isr_drain_one(isys)) {
+			/* A response arriving from now on raises the irq */
+			isys->resp_deferred = false;
+			writel(ISYS_UNISPART_IRQS,
+			       base + IPU_REG_ISYS_UNISPART_IRQ_MASK);
+			break;
+		}
+		spin_unlock_irqrestore(&isys->power_lock, flags);
+
+		cond_resched();
+	}
+	spin_unlock_irqrestore(&isys->power_lock, flags);
+}
+
+/* resp_timer: one irq_poll_us poll of the response queue */
+enum hrtimer_restart isys_resp_poll(struct hrtimer *timer)
+{
+	struct ipu_isys *isys = container_of(timer, struct ipu_isys,
+					     resp_timer);
+	void __iomem *base = isys->pdata->base;
+	unsigned int handled;
+	unsigned long flags;
+
+	spin_lock_irqsave(&isys->power_lock, flags);
+	if (!isys->power || !isys->resp_deferred) {
+		spin_unlock_irqrestore(&isys->power_lock, flags);
+		return HRTIMER_NORESTART;
+	}
+
+	writel(IPU_ISYS_UNISPART_IRQ_SW, base + IPU_REG_ISYS_UNISPART_IRQ_CLEAR);
+	writel(0, base + IPU_REG_ISYS_UNISPART_SW_IRQ_REG);
+
+	isys->irq_polls++;
+	if (isys_isr_drain(isys, &handled)) {
+		isys->resp_deferrals++;
+		queue_work(system_highpri_wq, &isys->resp_work);
+	} else if (!isys_resp_poll_schedule(isys, handled)) {
+		isys->resp_deferred = false;
+		writel(ISYS_UNISPART_IRQS, base + IPU_REG_ISYS_UNISPART_IRQ_MASK);
+	}
+	isys->irq_polled_responses += handled;
+	spin_unlock_irqrestore(&isys->power_lock, flags);
+
+	return HRTIMER_NORESTART;
+}
@@ -5,6 +5,10 @@
 #include "ipu6-ppg.h"
 
 extern bool enable_power_gating;
+extern unsigned int frame_pacing_lead_us;
+
+/* Busy time sampling period of the PSYS DVFS governor */
+#define IPU_PSYS_DVFS_WINDOW_NS		(50 * NSEC_PER_MSEC)
 
 struct sched_list {
 	struct list_head list;
@@ -32,16 +36,50 @@ static struct sched_list *get_sc_list(enum SCHED_LIST type)
 	return &stop_list;
 }
 
-static bool is_kppg_in_list(struct ipu_psys_ppg *kppg, struct list_head *head)
+/* Lower ranks are started first and suspended last */
+static int ipu_psys_scheduler_qos_rank(struct ipu_psys_ppg *kppg)
 {
-	struct ipu_psys_ppg *tmp;
+	switch (READ_ONCE(kppg->fh->qos_class)) {
+	case IPU_PSYS_QOS_CLASS_REALTIME:
+		return 0;
+	case IPU_PSYS_QOS_CLASS_BACKGROUND:
+		return 2;
+	default:
+		return 1;
+	}
+}
 
-	list_for_each_entry(tmp, head, sched_list) {
-		if (kppg == tmp)
-			return true;
+/*
+ * Whether a should be started before b, or b suspended before a: by QoS
+ * class, then earliest deadline among REALTIME ppgs, then by the fair share
+ * load of their fhs, then by priority.
+ */
+static bool ipu_psys_scheduler_ppg_before(struct ipu_psys_ppg *a,
+					  struct ipu_psys_ppg *b)
+{
+	int rank_a = ipu_psys_scheduler_qos_rank(a);
+	int rank_b = ipu_psys_scheduler_qos_rank(b);
+
+	if (rank_a != rank_b)
+		return rank_a < rank_b;
+
+	if (rank_a == 0) {
+		u64 deadline_a = READ_ONCE(a->deadline);
+		u64 deadline_b = READ_ONCE(b->deadline);
+
+		if (deadline_a != deadline_b)
+			return deadline_a < deadline_b;
 	}
 
-	return false;
+	if (a->fh != b->fh) {
+		u64 load_a = READ_ONCE(a->fh->share_load);
+		u64 load_b = READ_ONCE(b->fh->share_load);
+
+		if (load_a != load_b)
+			return load_a < load_b;
+	}
+
+	return a->pri_base + a->pri_dynamic < b->pri_base + b->pri_dynamic;
 }
 
 void ipu_psys_scheduler_remove_kppg(struct ipu_psys_ppg *kppg,
@@ -67,7 +105,6 @@ void ipu_psys_scheduler_remove_kppg(struct ipu_psys_ppg *kppg,
 void ipu_psys_scheduler_add_kppg(struct ipu_psys_ppg *kppg,
 				 enum SCHED_LIST type)
 {
-	int cur_pri = kppg->pri_base + kppg->pri_dynamic;
 	struct sched_list *sc_list = get_sc_list(type);
 	struct ipu_psys *psys = kppg->fh->psys;
 	struct ipu_psys_ppg *tmp0, *tmp1;
@@ -79,28 +116,29 @@ void ipu_psys_scheduler_add_kppg(struct ipu_psys_ppg *kppg,
 		kppg->pri_base, kppg->pri_dynamic, kppg->fh);
 
 	mutex_lock(&sc_list->lock);
-	if (list_empty(&sc_list->list)) {
-		list_add(&kppg->sched_list, &sc_list->list);
+	/* sched_list is only linked while kppg is on one of the lists */
+	if (!list_empty(&kppg->sched_list)) {
+		dev_dbg(&psys->adev->dev, "kppg already in list\n");
 		goto out;
 	}
 
-	if (is_kppg_in_list(kppg, &sc_list->list)) {
-		dev_dbg(&psys->adev->dev, "kppg already in list\n");
+	if (list_empty(&sc_list->list)) {
+		list_add(&kppg->sched_list, &sc_list->list);
 		goto out;
 	}
 
 	list_for_each_entry_safe(tmp0, tmp1, &sc_list->list, sched_list) {
-		int tmp_pri = tmp0->pri_base + tmp0->pri_dynamic;
-
 		dev_dbg(&psys->adev->dev,
 			"found kppg(%d 0x%p), state %d pri(%d %d) fh 0x%p\n",
 			tmp0->kpg->pg->ID, tmp0, tmp0->state,
 			tmp0->pri_base, tmp0->pri_dynamic, tmp0->fh);
 
-		if (type == SCHED_START_LIST && tmp_pri > cur_pri) {
+		if (type == SCHED_START_LIST &&
+		    ipu_psys_scheduler_ppg_before(kppg, tmp0)) {
 			list_add(&kppg->sched_list, tmp0->sched_list.prev);
 			goto out;
-		} else if (type == SCHED_STOP_LIST && tmp_pri < cur_pri) {
+		} else if (type == SCHED_STOP_LIST &&
+			   ipu_psys_scheduler_ppg_before(tmp0, kppg)) {
 			list_add(&kppg->sched_list, tmp0->sched_list.prev);
 			goto out;
 		}
@@ -111,80 +149,71 @@ out:
 	mutex_unlock(&sc_list->lock);
 }
 
+/*
+ * Check if kppg's manifest fits into the resources left by the running
+ * ppgs. The result is cached in kppg until resource_pool_running changes,
+ * so retries under contention neither allocate nor redo the check.
+ */
 static int ipu_psys_detect_resource_contention(struct ipu_psys_ppg *kppg)
 {
-	struct ipu_psys_resource_pool *try_res_pool;
 	struct ipu_psys *psys = kppg->fh->psys;
+	struct ipu_psys_resource_pool *rpr = &psys->resource_pool_running;
+	unsigned long gen;
 	int ret = 0;
 	int state;
 
-	try_res_pool = kzalloc(sizeof(*try_res_pool), GFP_KERNEL);
-	if (IS_ERR_OR_NULL(try_res_pool))
-		return -ENOMEM;
-
 	mutex_lock(&kppg->mutex);
 	state = kppg->state;
 	mutex_unlock(&kppg->mutex);
 	if (state == PPG_STATE_STARTED || state == PPG_STATE_RUNNING ||
 	    state == PPG_STATE_RESUMED)
-		goto exit;
-
-	ret = ipu_psys_resource_pool_init(try_res_pool);
-	if (ret < 0) {
-		dev_err(&psys->adev->dev, "unable to alloc pg resources\n");
-		WARN_ON(1);
-		goto exit;
-	}
+		return 0;
 
-	ipu_psys_resource_copy(&psys->resource_pool_running, try_res_pool);
-	ret = ipu_psys_try_allocate_resources(&psys->adev->dev,
-					      kppg->kpg->pg,
-					      kppg->manifest,
-					      try_res_pool);
+	gen = READ_ONCE(rpr->gen);
+	if (kppg->admit_gen == gen)
+		return kppg->admit_ret;
 
-	ipu_psys_resource_pool_cleanup(try_res_pool);
-exit:
-	kfree(try_res_pool);
+	ret = ipu_psys_check_resources(&psys->adev->dev, kppg->kpg->pg,
+				       kppg->manifest,
+				       &psys->resource_alloc_try, rpr);
+	kppg->admit_ret = ret;
+	kppg->admit_gen = gen;
+	if (ret == -ENOSPC)
+		psys->res_contentions++;
 
 	return ret;
 }
 
-static void ipu_psys_scheduler_ppg_sort(struct ipu_psys *psys, bool *stopping)
+/*
+ * kppgs are put on the start list when they enter START/RESUME and on the
+ * stop list when they enter RUNNING, so the scheduler only has to look for
+ * suspending/stopping kppgs when a start hits resource contention.
+ */
+static bool ipu_psys_scheduler_ppg_stopping(struct ipu_psys *psys)
 {
-	struct ipu_psys_ppg *kppg, *tmp;
 	struct ipu_psys_scheduler *sched;
+	struct ipu_psys_ppg *kppg;
 	struct ipu_psys_fh *fh;
+	bool stopping = false;
 
-	list_for_each_entry(fh, &psys->fhs, list) {
+	ipu_psys_for_each_fh(fh, psys) {
 		mutex_lock(&fh->mutex);
 		sched = &fh->sched;
-
-		if (list_empty(&sched->ppgs)) {
-			mutex_unlock(&fh->mutex);
-			continue;
-		}
-
-		list_for_each_entry_safe(kppg, tmp, &sched->ppgs, list) {
+		list_for_each_entry(kppg, &sched->ppgs, list) {
 			mutex_lock(&kppg->mutex);
-			if (kppg->state == PPG_STATE_START ||
-			    kppg->state == PPG_STATE_RESUME) {
-				ipu_psys_scheduler_add_kppg(kppg,
-							    SCHED_START_LIST);
-			} else if (kppg->state == PPG_STATE_RUNNING) {
-				ipu_psys_scheduler_add_kppg(kppg,
-							    SCHED_STOP_LIST);
-			} else if (kppg->state == PPG_STATE_SUSPENDING ||
-				   kppg->state == PPG_STATE_STOPPING) {
-				/* there are some suspending/stopping ppgs */
-				*stopping = true;
-			} else if (kppg->state == PPG_STATE_RESUMING ||
-				   kppg->state == PPG_STATE_STARTING) {
-				   /* how about kppg are resuming/starting? */
-			}
+			if (kppg->state == PPG_STATE_SUSPENDING ||
+			    kppg->state == PPG_STATE_STOPPING)
+				stopping = true;
 			mutex_unlock(&kppg->mutex);
+			if (stopping)
+				break;
 		}
 		mutex_unlock(&fh->mutex);
+		if (stopping)
+			break;
 	}
+
+	return stopping;
 }
 
 static void ipu_psys_scheduler_update_start_ppg_priority(void)
@@ -199,11 +228,17 @@ static void ipu_psys_scheduler_update_start_ppg_priority(void)
 	mutex_unlock(&sc_list->lock);
 }
 
-static bool ipu_psys_scheduler_switch_ppg(struct ipu_psys *psys)
+/*
+ * Suspend the running ppg that is the best to preempt for new_kppg. Running
+ * deadlines move on, so the stop list order is rechecked here.
+ */
+static bool ipu_psys_scheduler_switch_ppg(struct ipu_psys *psys,
+					  struct ipu_psys_ppg *new_kppg)
 {
 	struct sched_list *sc_list = get_sc_list(SCHED_STOP_LIST);
-	struct ipu_psys_ppg *kppg;
+	struct ipu_psys_ppg *kppg, *tmp;
 	bool resched = false;
+	int rank, new_rank;
 
 	mutex_lock(&sc_list->lock);
 	if (list_empty(&sc_list->list)) {
@@ -214,8 +249,25 @@ static bool ipu_psys_scheduler_switch_ppg(struct ipu_psys *psys)
 	}
 	kppg = list_first_entry(&sc_list->list, struct ipu_psys_ppg,
 				sched_list);
+	list_for_each_entry(tmp, &sc_list->list, sched_list)
+		if (ipu_psys_scheduler_ppg_before(kppg, tmp))
+			kppg = tmp;
 	mutex_unlock(&sc_list->lock);
 
+	/*
+	 * Within a class only REALTIME deadlines and the fair share of other
+	 * fhs are enforced, an fh may still reorder its own ppgs by priority.
+	 */
+	rank = ipu_psys_scheduler_qos_rank(kppg);
+	new_rank = ipu_psys_scheduler_qos_rank(new_kppg);
+	if (new_rank > rank ||
+	    (new_rank == rank && (rank == 0 || kppg->fh != new_kppg->fh) &&
+	     !ipu_psys_scheduler_ppg_before(new_kppg, kppg))) {
+		dev_dbg(&psys->adev->dev, "kppg 0x%p not preempted for 0x%p\n",
+			kppg, new_kppg);
+		return false;
+	}
+
 	mutex_lock(&kppg->mutex);
 	if (!(kppg->state & PPG_STATE_STOP)) {
 		dev_dbg(&psys->adev->dev, "s_change:%s: %p %d -> %d\n",
@@ -229,8 +281,27 @@ static bool ipu_psys_scheduler_switch_ppg(struct ipu_psys *psys)
 }
 
 /*
- * search all kppgs and sort them into start_list and stop_list, alway start
- * first kppg(high priority) in start_list;
+ * A handle over its quota in the last window gets no ppg started or
+ * resumed and no buffer set enqueued until the window ends, when the
+ * kick runs the scheduler again.
+ */
+static bool ipu_psys_scheduler_throttled(struct ipu_psys *psys,
+					 struct ipu_psys_fh *fh)
+{
+	u64 end = psys->dvfs_window_ns + IPU_PSYS_DVFS_WINDOW_NS;
+	u64 now = ktime_get_ns();
+
+	if (!READ_ONCE(fh->throttled))
+		return false;
+
+	/* An earlier pending kick reevaluates and arms this again */
+	queue_delayed_work(system_wq, &psys->sched_kick_work,
+			   end > now ? nsecs_to_jiffies(end - now) : 0);
+	return true;
+}
+
+/*
+ * alway start first kppg(high priority) in start_list;
  * if there is resource contention, it would switch kppgs in stop_list
  * to suspend state one by one
  */
@@ -238,11 +309,8 @@ static bool ipu_psys_scheduler_ppg_start(struct ipu_psys *psys)
 {
 	struct sched_list *sc_list = get_sc_list(SCHED_START_LIST);
 	struct ipu_psys_ppg *kppg, *kppg0;
-	bool stopping_existed = false;
 	int ret;
 
-	ipu_psys_scheduler_ppg_sort(psys, &stopping_existed);
-
 	mutex_lock(&sc_list->lock);
 	if (list_empty(&sc_list->list)) {
 		dev_dbg(&psys->adev->dev, "no ppg to start\n");
@@ -254,6 +322,11 @@ static bool ipu_psys_scheduler_ppg_start(struct ipu_psys *psys)
 				 &sc_list->list, sched_list) {
 		mutex_unlock(&sc_list->lock);
 
+		if (ipu_psys_scheduler_throttled(psys, kppg->fh)) {
+			mutex_lock(&sc_list->lock);
+			continue;
+		}
+
 		ret = ipu_psys_detect_resource_contention(kppg);
 		if (ret < 0) {
 			dev_dbg(&psys->adev->dev,
@@ -265,8 +338,8 @@ static bool ipu_psys_scheduler_ppg_start(struct ipu_psys *psys)
 			 * 2. no suspending/stopping ppg
 			 */
 			if (ret == -ENOSPC) {
-				if (!stopping_existed &&
-				    ipu_psys_scheduler_switch_ppg(psys)) {
+				if (!ipu_psys_scheduler_ppg_stopping(psys) &&
+				    ipu_psys_scheduler_switch_ppg(psys, kppg)) {
 					return true;
 				}
 				dev_dbg(&psys->adev->dev,
@@ -276,18 +349,25 @@ static bool ipu_psys_scheduler_ppg_start(struct ipu_psys *psys)
 					"detect resource error %d\n", ret);
 			}
 		} else {
+			bool retry;
+
 			kppg->pri_dynamic = 0;
 
 			mutex_lock(&kppg->mutex);
 			if (kppg->state == PPG_STATE_START)
-				ipu_psys_ppg_start(kppg);
+				ret = ipu_psys_ppg_start(kppg);
 			else
-				ipu_psys_ppg_resume(kppg);
+				ret = ipu_psys_ppg_resume(kppg);
+			/* A failed start/resume that can be retried stays */
+			retry = ret && (kppg->state == PPG_STATE_START ||
+					kppg->state == PPG_STATE_RESUME);
 			mutex_unlock(&kppg->mutex);
 
-			ipu_psys_scheduler_remove_kppg(kppg,
-						       SCHED_START_LIST);
-			ipu_psys_scheduler_update_start_ppg_priority();
+			if (!retry) {
+				ipu_psys_scheduler_remove_kppg(kppg,
+							       SCHED_START_LIST);
+				ipu_psys_scheduler_update_start_ppg_priority();
+			}
 		}
 		mutex_lock(&sc_list->lock);
 	}
@@ -303,7 +383,10 @@ static bool ipu_psys_scheduler_ppg_enqueue_bufset(struct ipu_psys *psys)
 	struct ipu_psys_fh *fh;
 	bool resched = false;
 
-	list_for_each_entry(fh, &psys->fhs, list) {
+	ipu_psys_for_each_fh(fh, psys) {
+		if (ipu_psys_scheduler_throttled(psys, fh))
+			continue;
+
 		mutex_lock(&fh->mutex);
 		sched = &fh->sched;
 		if (list_empty(&sched->ppgs)) {
@@ -334,7 +417,7 @@ static bool ipu_psys_scheduler_ppg_halt(struct ipu_psys *psys)
 	struct ipu_psys_fh *fh;
 	bool stopping_exit = false;
 
-	list_for_each_entry(fh, &psys->fhs, list) {
+	ipu_psys_for_each_fh(fh, psys) {
 		mutex_lock(&fh->mutex);
 		sched = &fh->sched;
 		if (list_empty(&sched->ppgs)) {
@@ -389,12 +472,15 @@ static void ipu_psys_update_ppg_state_by_kcmd(struct ipu_psys *psys,
 			 * because here need resume at first
 			 */
 			kppg->state |= PPG_STATE_STOP;
-		else if (kcmd->state == KCMD_STATE_PPG_ENQUEUE)
+		else if (kcmd->state == KCMD_STATE_PPG_ENQUEUE) {
 			kppg->state = PPG_STATE_RESUME;
+			ipu_psys_scheduler_add_kppg(kppg, SCHED_START_LIST);
+		}
 	} else if (kppg->state == PPG_STATE_STOPPED) {
-		if (kcmd->state == KCMD_STATE_PPG_START)
+		if (kcmd->state == KCMD_STATE_PPG_START) {
 			kppg->state = PPG_STATE_START;
-		else if (kcmd->state == KCMD_STATE_PPG_STOP)
+			ipu_psys_scheduler_add_kppg(kppg, SCHED_START_LIST);
+		} else if (kcmd->state == KCMD_STATE_PPG_STOP)
 			ipu_psys_kcmd_complete(kppg, kcmd, 0);
 		else if (kcmd->state == KCMD_STATE_PPG_ENQUEUE) {
 			dev_err(&psys->adev->dev, "ppg %p stopped!\n", kppg);
@@ -414,7 +500,7 @@ static void ipu_psys_scheduler_kcmd_set(struct ipu_psys *psys)
 	struct ipu_psys_ppg *kppg, *tmp;
 	struct ipu_psys_fh *fh;
 
-	list_for_each_entry(fh, &psys->fhs, list) {
+	ipu_psys_for_each_fh(fh, psys) {
 		mutex_lock(&fh->mutex);
 		sched = &fh->sched;
 		if (list_empty(&sched->ppgs)) {
@@ -444,7 +530,7 @@ static bool is_ready_to_enter_power_gating(struct ipu_psys *psys)
 	struct ipu_psys_ppg *kppg, *tmp;
 	struct ipu_psys_fh *fh;
 
-	list_for_each_entry(fh, &psys->fhs, list) {
+	ipu_psys_for_each_fh(fh, psys) {
 		mutex_lock(&fh->mutex);
 		sched = &fh->sched;
 		if (list_empty(&sched->ppgs)) {
@@ -481,7 +567,7 @@ static bool has_pending_kcmd(struct ipu_psys *psys)
 	struct ipu_psys_ppg *kppg, *tmp;
 	struct ipu_psys_fh *fh;
 
-	list_for_each_entry(fh, &psys->fhs, list) {
+	ipu_psys_for_each_fh(fh, psys) {
 		mutex_lock(&fh->mutex);
 		sched = &fh->sched;
 		if (list_empty(&sched->ppgs)) {
@@ -505,74 +591,271 @@ static bool has_pending_kcmd(struct ipu_psys *psys)
 	return false;
 }
 
+/*
+ * Expected CPU time of the next ISYS SOF for frame pacing, 0 if pacing is
+ * off or there is no steady stream: no period yet, or two frames missed.
+ */
+static u64 ipu_psys_scheduler_next_frame(struct ipu_psys *psys, u64 now)
+{
+	struct ipu_device *isp = psys->adev->isp;
+	u64 period = READ_ONCE(isp->isys_frame_ns);
+	u64 sof = READ_ONCE(isp->isys_sof_ns);
+
+	if (!READ_ONCE(frame_pacing_lead_us) || !period)
+		return 0;
+
+	if (now <= sof)
+		return sof + period;
+
+	if (now - sof > 2 * period)
+		return 0;
+
+	return sof + period * (div64_u64(now - sof, period) + 1);
+}
+
+/*
+ * Predict the idle time until the next frame of the running ppgs. Returns 0
+ * if entering power gating pays off now, else the delay in ns after which
+ * it should be reconsidered.
+ */
+static u64 ipu_psys_scheduler_gating_delay(struct ipu_psys *psys)
+{
+	u64 break_even = (u64)psys->pg_break_even_us * NSEC_PER_USEC;
+	u64 now = ktime_get_ns();
+	u64 next = U64_MAX;
+	struct ipu_psys_ppg *kppg;
+	struct ipu_psys_fh *fh;
+	u64 frame;
+
+	if (!break_even)
+		return 0;
+
+	/* With frame pacing PSYS is powered up again lead us before it */
+	frame = ipu_psys_scheduler_next_frame(psys, now);
+	if (frame)
+		next = max(frame - (u64)frame_pacing_lead_us * NSEC_PER_USEC,
+			   now);
+
+	ipu_psys_for_each_fh(fh, psys) {
+		mutex_lock(&fh->mutex);
+		list_for_each_entry(kppg, &fh->sched.ppgs, list) {
+			u64 expected;
+
+			mutex_lock(&kppg->mutex);
+			expected = kppg->last_arrival_ns + kppg->interval_ns;
+			/* more than a frame late means the stream paused */
+			if (kppg->state == PPG_STATE_RUNNING &&
+			    kppg->interval_ns &&
+			    now < expected + kppg->interval_ns)
+				next = min(next, expected);
+			mutex_unlock(&kppg->mutex);
+		}
+		mutex_unlock(&fh->mutex);
+	}
+
+	if (next == U64_MAX || (next > now && next - now >= break_even))
+		return 0;
+
+	/* Retry once the next frame should have arrived */
+	return max(next, now) - now + break_even;
+}
+
 static bool ipu_psys_scheduler_exit_power_gating(struct ipu_psys *psys)
 {
 	/* Assume power gating process can be aborted directly during START */
 	if (psys->power_gating == PSYS_POWER_GATED) {
+		u64 now = ktime_get_ns();
+		u64 gated_ns = now - psys->pg_gated_ns;
+
+		if (gated_ns < (u64)psys->pg_break_even_us * NSEC_PER_USEC)
+			psys->pg_early_exits++;
 		dev_dbg(&psys->adev->dev, "powergating: exit ---\n");
 		ipu_psys_exit_power_gating(psys);
+		psys->pg_exit_ns = ktime_get_ns() - now;
+		psys->pg_exit_max_ns = max(psys->pg_exit_max_ns,
+					   psys->pg_exit_ns);
 	}
 	psys->power_gating = PSYS_POWER_NORMAL;
 	return false;
 }
 
+/*
+ * Frame pacing: leave power gating frame_pacing_lead_us ahead of the next
+ * ISYS frame and resume the streaming ppgs, so that the commands for that
+ * frame find PSYS powered and their resources reserved. While gated and
+ * the frame is not due yet, arm the kick for then.
+ */
+static bool ipu_psys_scheduler_pace(struct ipu_psys *psys)
+{
+	u64 lead = (u64)READ_ONCE(frame_pacing_lead_us) * NSEC_PER_USEC;
+	u64 now = ktime_get_ns();
+	u64 frame = ipu_psys_scheduler_next_frame(psys, now);
+	struct ipu_psys_ppg *kppg;
+	struct ipu_psys_fh *fh;
+	bool resume = false;
+
+	if (psys->power_gating != PSYS_POWER_GATED || !frame)
+		return false;
+
+	if (frame - now > lead) {
+		mod_delayed_work(system_wq, &psys->sched_kick_work,
+				 nsecs_to_jiffies(frame - lead - now));
+		return false;
+	}
+
+	dev_dbg(&psys->adev->dev, "powergating: paced exit, frame in %llu us\n",
+		div_u64(frame - now, NSEC_PER_USEC));
+	psys->pg_paced_exits++;
+	ipu_psys_scheduler_exit_power_gating(psys);
+
+	ipu_psys_for_each_fh(fh, psys) {
+		mutex_lock(&fh->mutex);
+		list_for_each_entry(kppg, &fh->sched.ppgs, list) {
+			mutex_lock(&kppg->mutex);
+			if (kppg->state == PPG_STATE_SUSPENDED &&
+			    kppg->interval_ns) {
+				kppg->state = PPG_STATE_RESUME;
+				ipu_psys_scheduler_add_kppg(kppg,
+							    SCHED_START_LIST);
+				resume = true;
+			}
+			mutex_unlock(&kppg->mutex);
+		}
+		mutex_unlock(&fh->mutex);
+	}
+
+	return resume;
+}
+
 static bool ipu_psys_scheduler_enter_power_gating(struct ipu_psys *psys)
 {
-	struct ipu_psys_scheduler *sched;
-	struct ipu_psys_ppg *kppg, *tmp;
+	struct ipu_psys_ppg *kppg;
 	struct ipu_psys_fh *fh;
+	bool resched = false;
+	bool busy = false;
 
 	if (!enable_power_gating)
 		return false;
 
 	if (psys->power_gating == PSYS_POWER_NORMAL &&
 	    is_ready_to_enter_power_gating(psys)) {
+		u64 delay = ipu_psys_scheduler_gating_delay(psys);
+
+		if (delay) {
+			dev_dbg(&psys->adev->dev,
+				"powergating: next frame due, retry in %llu us\n",
+				div_u64(delay, NSEC_PER_USEC));
+			psys->pg_skipped++;
+			mod_delayed_work(system_wq, &psys->sched_kick_work,
+					 nsecs_to_jiffies(delay) + 1);
+			return false;
+		}
+
 		/* Enter power gating */
 		dev_dbg(&psys->adev->dev, "powergating: enter +++\n");
 		psys->power_gating = PSYS_POWER_GATING;
+		psys->pg_enter_start_ns = ktime_get_ns();
 	}
 
 	if (psys->power_gating != PSYS_POWER_GATING)
 		return false;
 
-	/* Suspend ppgs one by one */
-	list_for_each_entry(fh, &psys->fhs, list) {
+	/*
+	 * Suspend all running ppgs at once: the halt that follows sends the
+	 * suspend commands back to back and the ACKs come in together, rather
+	 * than one firmware round trip per scheduler run.
+	 */
+	ipu_psys_for_each_fh(fh, psys) {
 		mutex_lock(&fh->mutex);
-		sched = &fh->sched;
-		if (list_empty(&sched->ppgs)) {
-			mutex_unlock(&fh->mutex);
-			continue;
-		}
-
-		list_for_each_entry_safe(kppg, tmp, &sched->ppgs, list) {
+		list_for_each_entry(kppg, &fh->sched.ppgs, list) {
 			mutex_lock(&kppg->mutex);
-			if (kppg->state == PPG_STATE_RUNNING) {
+			if (kppg->state == PPG_STATE_RUNNING)
 				kppg->state = PPG_STATE_SUSPEND;
-				mutex_unlock(&kppg->mutex);
-				mutex_unlock(&fh->mutex);
-				return true;
-			}
 
 			if (kppg->state != PPG_STATE_SUSPENDED &&
 			    kppg->state != PPG_STATE_STOPPED) {
-				/* Can't enter power gating */
-				mutex_unlock(&kppg->mutex);
-				mutex_unlock(&fh->mutex);
+				/* Can't enter power gating yet */
+				busy = true;
 				/* Need re-run l-scheduler to suspend ppg? */
-				return (kppg->state & PPG_STATE_STOP ||
-					kppg->state == PPG_STATE_SUSPEND);
+				if (kppg->state & PPG_STATE_STOP ||
+				    kppg->state == PPG_STATE_SUSPEND)
+					resched = true;
 			}
 			mutex_unlock(&kppg->mutex);
 		}
 		mutex_unlock(&fh->mutex);
 	}
 
+	if (busy)
+		return resched;
+
 	psys->power_gating = PSYS_POWER_GATED;
+	psys->pg_gated_ns = ktime_get_ns();
+	psys->pg_entered++;
+	psys->pg_enter_ns = psys->pg_gated_ns - psys->pg_enter_start_ns;
+	psys->pg_enter_max_ns = max(psys->pg_enter_max_ns, psys->pg_enter_ns);
 	ipu_psys_enter_power_gating(psys);
 
 	return false;
 }
 
+/*
+ * Feed the firmware busy time of the last window to the buttress governor,
+ * age the fair share loads of the fhs with it and throttle the fhs that
+ * went over their quota.
+ */
+static void ipu_psys_scheduler_dvfs(struct ipu_psys *psys)
+{
+	struct ipu_psys_fh *fh;
+	unsigned long flags;
+	u64 now = ktime_get_ns();
+	u64 busy_ns, window_ns, missed = 0;
+	u64 fh_busy_ns, fh_window_ns;
+	u32 quota;
+	bool throttled;
+
+	if (!psys->dvfs_window_ns) {
+		psys->dvfs_window_ns = now;
+		return;
+	}
+
+	window_ns = now - psys->dvfs_window_ns;
+	if (window_ns < IPU_PSYS_DVFS_WINDOW_NS)
+		return;
+
+	spin_lock_irqsave(&psys->kcmd_lock, flags);
+	if (psys->busy_inflight) {
+		psys->busy_ns += now - psys->busy_since_ns;
+		psys->busy_since_ns = now;
+	}
+	busy_ns = psys->busy_ns;
+	psys->busy_ns = 0;
+	spin_unlock_irqrestore(&psys->kcmd_lock, flags);
+
+	ipu_psys_for_each_fh(fh, psys) {
+		missed += atomic64_read(&fh->qos_missed);
+
+		fh_busy_ns = atomic64_read(&fh->busy_ns);
+		fh_window_ns = fh_busy_ns - fh->share_busy_ns;
+		WRITE_ONCE(fh->share_load, fh->share_load / 2 +
+			   div_u64(fh_window_ns * IPU_PSYS_QOS_SHARE_DEFAULT,
+				   READ_ONCE(fh->qos_share)));
+		fh->share_busy_ns = fh_busy_ns;
+
+		quota = READ_ONCE(fh->qos_quota_pct);
+		throttled = quota && fh_window_ns * 100 > window_ns * quota;
+		WRITE_ONCE(fh->throttled, throttled);
+		if (throttled)
+			WRITE_ONCE(fh->throttled_windows,
+				   fh->throttled_windows + 1);
+	}
+
+	ipu_buttress_psys_dvfs_update(psys->adev->isp, busy_ns, window_ns,
+				      missed > psys->dvfs_missed);
+	psys->dvfs_window_ns = now;
+	psys->dvfs_missed = missed;
+}
+
 void ipu_psys_run_next(struct ipu_psys *psys)
 {
 	/* Wake up scheduler due to unfinished work */
@@ -588,10 +871,14 @@ void ipu_psys_run_next(struct ipu_psys *psys)
 		return;
 	}
 
+	ipu_psys_scheduler_dvfs(psys);
+
+	need_trigger = ipu_psys_scheduler_pace(psys);
+
 	/* Abort power gating process */
 	if (psys->power_gating != PSYS_POWER_NORMAL &&
 	    has_pending_kcmd(psys))
-		need_trigger = ipu_psys_scheduler_exit_power_gating(psys);
+		need_trigger |= ipu_psys_scheduler_exit_power_gating(psys);
 
 	/* Handle kcmd and related ppg switch */
 	if (psys->power_gating == PSYS_POWER_NORMAL) {
@@ -605,6 +892,8 @@ void ipu_psys_run_next(struct ipu_psys *psys)
 		need_trigger = ipu_psys_scheduler_enter_power_gating(psys);
 		if (psys->power_gating == PSYS_POWER_GATING)
 			wait_fw_finish = ipu_psys_scheduler_ppg_halt(psys);
+		else if (psys->power_gating == PSYS_POWER_GATED)
+			need_trigger |= ipu_psys_scheduler_pace(psys);
 	}
 
 	if (need_trigger && !wait_fw_finish) {
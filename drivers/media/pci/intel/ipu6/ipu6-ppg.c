@@ -6,6 +6,7 @@
 
 #include <asm/cacheflush.h>
 
+#include "ipu-mmu.h"
 #include "ipu6-ppg.h"
 
 static bool enable_suspend_resume;
@@ -53,7 +54,7 @@ __get_buf_set(struct ipu_psys_fh *fh, size_t buf_set_size)
 
 	mutex_lock(&sched->bs_mutex);
 	list_for_each_entry(kbuf_set, &sched->buf_sets, list) {
-		if (!kbuf_set->buf_set_size &&
+		if (!kbuf_set->kppg && !kbuf_set->buf_set_size &&
 		    kbuf_set->size >= buf_set_size) {
 			kbuf_set->buf_set_size = buf_set_size;
 			mutex_unlock(&sched->bs_mutex);
@@ -80,10 +81,86 @@ __get_buf_set(struct ipu_psys_fh *fh, size_t buf_set_size)
 	mutex_lock(&sched->bs_mutex);
 	list_add(&kbuf_set->list, &sched->buf_sets);
 	mutex_unlock(&sched->bs_mutex);
+	ipu_psys_buf_set_hash_add(fh->psys, kbuf_set);
 
 	return kbuf_set;
 }
 
+/*
+ * The buffer set size only depends on the terminal count of the PG, so it
+ * is fixed for the lifetime of a PPG. Reserve a ring of buffer sets from
+ * the fh pool when the PPG starts to keep the per-frame path free of
+ * allocations and of the fh wide bs_mutex. A short ring is fine, frames
+ * fall back to __get_buf_set() when all its sets are in flight.
+ */
+void ipu_psys_ppg_alloc_bufsets(struct ipu_psys_kcmd *kcmd,
+				struct ipu_psys_ppg *kppg)
+{
+	struct ipu_psys_scheduler *sched = &kppg->fh->sched;
+	struct ipu_psys_buffer_set *kbuf_set;
+	unsigned int i;
+
+	kppg->buf_set_size = ipu_fw_psys_ppg_get_buffer_set_size(kcmd);
+	kppg->buf_set_next = 0;
+
+	for (i = 0; i < IPU_PSYS_PPG_BUF_SET_RING; i++) {
+		kbuf_set = __get_buf_set(kppg->fh, kppg->buf_set_size);
+		if (!kbuf_set)
+			break;
+
+		mutex_lock(&sched->bs_mutex);
+		kbuf_set->kppg = kppg;
+		kbuf_set->buf_set_size = 0;
+		mutex_unlock(&sched->bs_mutex);
+		kppg->buf_sets[i] = kbuf_set;
+	}
+}
+
+/* Return the ring of the PPG to the fh pool */
+void ipu_psys_ppg_free_bufsets(struct ipu_psys_ppg *kppg)
+{
+	struct ipu_psys_scheduler *sched = &kppg->fh->sched;
+	unsigned int i;
+
+	mutex_lock(&sched->bs_mutex);
+	for (i = 0; i < IPU_PSYS_PPG_BUF_SET_RING; i++) {
+		if (!kppg->buf_sets[i])
+			continue;
+		kppg->buf_sets[i]->kppg = NULL;
+		kppg->buf_sets[i] = NULL;
+	}
+	mutex_unlock(&sched->bs_mutex);
+}
+
+static struct ipu_psys_buffer_set *
+ipu_psys_ppg_ring_get(struct ipu_psys_ppg *kppg, size_t buf_set_size)
+{
+	struct ipu_psys_buffer_set *kbuf_set;
+	unsigned int i, idx;
+
+	if (buf_set_size > kppg->buf_set_size)
+		return NULL;
+
+	/*
+	 * Ring sets are only claimed here, under kppg->mutex. The release in
+	 * ipu_psys_kcmd_free() just clears buf_set_size.
+	 */
+	mutex_lock(&kppg->mutex);
+	for (i = 0; i < IPU_PSYS_PPG_BUF_SET_RING; i++) {
+		idx = (kppg->buf_set_next + i) % IPU_PSYS_PPG_BUF_SET_RING;
+		kbuf_set = kppg->buf_sets[idx];
+		if (kbuf_set && !READ_ONCE(kbuf_set->buf_set_size)) {
+			WRITE_ONCE(kbuf_set->buf_set_size, buf_set_size);
+			kppg->buf_set_next = idx + 1;
+			mutex_unlock(&kppg->mutex);
+			return kbuf_set;
+		}
+	}
+	mutex_unlock(&kppg->mutex);
+
+	return NULL;
+}
+
 static struct ipu_psys_buffer_set *
 ipu_psys_create_buffer_set(struct ipu_psys_kcmd *kcmd,
 			   struct ipu_psys_ppg *kppg)
@@ -96,7 +173,9 @@ ipu_psys_create_buffer_set(struct ipu_psys_kcmd *kcmd,
 
 	buf_set_size = ipu_fw_psys_ppg_get_buffer_set_size(kcmd);
 
-	kbuf_set = __get_buf_set(fh, buf_set_size);
+	kbuf_set = ipu_psys_ppg_ring_get(kppg, buf_set_size);
+	if (!kbuf_set)
+		kbuf_set = __get_buf_set(fh, buf_set_size);
 	if (!kbuf_set) {
 		dev_err(&psys->adev->dev, "failed to create buffer set\n");
 		return NULL;
@@ -130,6 +209,7 @@ int ipu_psys_ppg_get_bufset(struct ipu_psys_kcmd *kcmd,
 	}
 	kcmd->kbuf_set = kbuf_set;
 	kbuf_set->kcmd = kcmd;
+	kbuf_set->kcmd_id = 0;
 
 	for (i = 0; i < kcmd->nbuffers; i++) {
 		struct ipu_fw_psys_terminal *terminal;
@@ -156,13 +236,14 @@ error:
 	return ret;
 }
 
-void ipu_psys_ppg_complete(struct ipu_psys *psys, struct ipu_psys_ppg *kppg)
+bool ipu_psys_ppg_complete(struct ipu_psys *psys, struct ipu_psys_ppg *kppg)
 {
 	u8 queue_id;
 	int old_ppg_state;
+	bool kick = false;
 
 	if (!psys || !kppg)
-		return;
+		return false;
 
 	mutex_lock(&kppg->mutex);
 	old_ppg_state = kppg->state;
@@ -177,6 +258,7 @@ void ipu_psys_ppg_complete(struct ipu_psys *psys, struct ipu_psys_ppg *kppg)
 		queue_id = ipu_fw_psys_ppg_get_base_queue_id(&tmp_kcmd);
 		ipu_psys_free_cmd_queue_resource(&psys->resource_pool_running,
 						 queue_id);
+		ipu_psys_ppg_free_bufsets(kppg);
 		pm_runtime_put(&psys->adev->dev);
 	} else {
 		if (kppg->state == PPG_STATE_SUSPENDING) {
@@ -186,19 +268,19 @@ void ipu_psys_ppg_complete(struct ipu_psys *psys, struct ipu_psys_ppg *kppg)
 		} else if (kppg->state == PPG_STATE_STARTED ||
 			   kppg->state == PPG_STATE_RESUMED) {
 			kppg->state = PPG_STATE_RUNNING;
+			ipu_psys_scheduler_add_kppg(kppg, SCHED_STOP_LIST);
 		}
 
-		/* Kick l-scheduler thread for FW callback,
-		 * also for checking if need to enter power gating
-		 */
-		atomic_set(&psys->wakeup_count, 1);
-		wake_up_interruptible(&psys->sched_cmd_wq);
+		/* The caller kicks the l-scheduler for the FW callback */
+		kick = true;
 	}
 	if (old_ppg_state != kppg->state)
 		dev_dbg(&psys->adev->dev, "s_change:%s: %p %d -> %d\n",
 			__func__, kppg, old_ppg_state, kppg->state);
 
 	mutex_unlock(&kppg->mutex);
+
+	return kick;
 }
 
 int ipu_psys_ppg_start(struct ipu_psys_ppg *kppg)
@@ -206,6 +288,7 @@ int ipu_psys_ppg_start(struct ipu_psys_ppg *kppg)
 	struct ipu_psys *psys = kppg->fh->psys;
 	struct ipu_psys_kcmd *kcmd = ipu_psys_ppg_get_kcmd(kppg,
 						KCMD_STATE_PPG_START);
+	bool kcmd_failed = false;
 	unsigned int i;
 	int ret;
 
@@ -229,14 +312,14 @@ int ipu_psys_ppg_start(struct ipu_psys_ppg *kppg)
 					       kcmd->buffers[i].len);
 		if (ret) {
 			dev_err(&psys->adev->dev, "Unable to set terminal\n");
-			return ret;
+			goto retry;
 		}
 	}
 
 	ret = ipu_fw_psys_pg_submit(kcmd);
 	if (ret) {
 		dev_err(&psys->adev->dev, "failed to submit kcmd!\n");
-		return ret;
+		goto retry;
 	}
 
 	ret = ipu_psys_allocate_resources(&psys->adev->dev,
@@ -246,7 +329,7 @@ int ipu_psys_ppg_start(struct ipu_psys_ppg *kppg)
 					  &psys->resource_pool_running);
 	if (ret) {
 		dev_err(&psys->adev->dev, "alloc resources failed!\n");
-		return ret;
+		goto retry;
 	}
 
 	ret = pm_runtime_get_sync(&psys->adev->dev);
@@ -257,9 +340,10 @@ int ipu_psys_ppg_start(struct ipu_psys_ppg *kppg)
 
 	ret = ipu_psys_kcmd_start(psys, kcmd);
 	if (ret) {
-		ipu_psys_kcmd_complete(kppg, kcmd, -EIO);
+		kcmd_failed = true;
 		goto error;
 	}
+	ipu_psys_kcmd_mark_start(kcmd);
 
 	dev_dbg(&psys->adev->dev, "s_change:%s: %p %d -> %d\n",
 		__func__, kppg, kppg->state, PPG_STATE_STARTED);
@@ -276,6 +360,15 @@ error:
 				    kcmd->kpg->pg->process_count);
 	ipu_psys_free_resources(&kppg->kpg->resource_alloc,
 				&psys->resource_pool_running);
+	if (kcmd_failed) {
+		/* The start kcmd is gone, nothing is left to retry */
+		ipu_psys_kcmd_complete(kppg, kcmd, -EIO);
+		dev_err(&psys->adev->dev, "failed to start ppg\n");
+		return ret;
+	}
+retry:
+	/* Still START, the l-scheduler tries again on its next pass */
+	kppg->state = PPG_STATE_START;
 
 	dev_err(&psys->adev->dev, "failed to start ppg\n");
 	return ret;
@@ -302,7 +395,8 @@ int ipu_psys_ppg_resume(struct ipu_psys_ppg *kppg)
 						  &psys->resource_pool_running);
 		if (ret) {
 			dev_err(&psys->adev->dev, "failed to allocate res\n");
-			return -EIO;
+			ret = -EIO;
+			goto retry;
 		}
 
 		ret = ipu_fw_psys_ppg_resume(&tmp_kcmd);
@@ -315,7 +409,7 @@ int ipu_psys_ppg_resume(struct ipu_psys_ppg *kppg)
 		ret = ipu_fw_psys_pg_submit(&tmp_kcmd);
 		if (ret) {
 			dev_err(&psys->adev->dev, "failed to submit kcmd!\n");
-			return ret;
+			goto retry;
 		}
 
 		ret = ipu_psys_allocate_resources(&psys->adev->dev,
@@ -325,7 +419,7 @@ int ipu_psys_ppg_resume(struct ipu_psys_ppg *kppg)
 						  &psys->resource_pool_running);
 		if (ret) {
 			dev_err(&psys->adev->dev, "failed to allocate res\n");
-			return ret;
+			goto retry;
 		}
 
 		ret = ipu_psys_kcmd_start(psys, &tmp_kcmd);
@@ -347,6 +441,9 @@ error:
 				    kppg->kpg->pg->process_count);
 	ipu_psys_free_resources(&kppg->kpg->resource_alloc,
 				&psys->resource_pool_running);
+retry:
+	/* Still RESUME, the l-scheduler tries again on its next pass */
+	kppg->state = PPG_STATE_RESUME;
 
 	return ret;
 }
@@ -361,6 +458,7 @@ int ipu_psys_ppg_stop(struct ipu_psys_ppg *kppg)
 
 	if (kcmd) {
 		list_move_tail(&kcmd->list, &kppg->kcmds_processing_list);
+		ipu_psys_kcmd_track(kcmd);
 	} else {
 		dev_dbg(&psys->adev->dev, "Exceptional stop happened!\n");
 		kcmd_temp.kpg = kppg->kpg;
@@ -464,8 +562,12 @@ bool ipu_psys_ppg_enqueue_bufsets(struct ipu_psys_ppg *kppg)
 					break;
 				}
 
+				/* Tracked before the firmware can complete it */
+				ipu_psys_kcmd_track(kcmd);
+				ipu_mmu_tlb_flush_pending(psys->adev->mmu);
 				ret = ipu_fw_psys_ppg_enqueue_bufs(kcmd);
 				if (ret) {
+					ipu_psys_kcmd_untrack(kcmd);
 					dev_err(&psys->adev->dev,
 						"kppg 0x%p fail to qbufset %d",
 						kppg, ret);
@@ -485,76 +587,62 @@ bool ipu_psys_ppg_enqueue_bufsets(struct ipu_psys_ppg *kppg)
 	return need_resume;
 }
 
-void ipu_psys_enter_power_gating(struct ipu_psys *psys)
+/* Each SUSPENDED ppg holds a runtime PM reference while PSYS is gated */
+static unsigned int ipu_psys_suspended_ppgs(struct ipu_psys *psys)
 {
-	struct ipu_psys_scheduler *sched;
-	struct ipu_psys_ppg *kppg, *tmp;
+	struct ipu_psys_ppg *kppg;
 	struct ipu_psys_fh *fh;
-	int ret = 0;
+	unsigned int n = 0;
 
-	list_for_each_entry(fh, &psys->fhs, list) {
+	ipu_psys_for_each_fh(fh, psys) {
 		mutex_lock(&fh->mutex);
-		sched = &fh->sched;
-		if (list_empty(&sched->ppgs)) {
-			mutex_unlock(&fh->mutex);
-			continue;
-		}
-
-		list_for_each_entry_safe(kppg, tmp, &sched->ppgs, list) {
+		list_for_each_entry(kppg, &fh->sched.ppgs, list) {
 			mutex_lock(&kppg->mutex);
-			/*
-			 * Only for SUSPENDED kppgs, STOPPED kppgs has already
-			 * power down and new kppgs might come now.
-			 */
-			if (kppg->state != PPG_STATE_SUSPENDED) {
-				mutex_unlock(&kppg->mutex);
-				continue;
-			}
-
-			ret = pm_runtime_put(&psys->adev->dev);
-			if (ret < 0) {
-				dev_err(&psys->adev->dev,
-					"failed to power gating off\n");
-				pm_runtime_get_sync(&psys->adev->dev);
-
-			}
+			if (kppg->state == PPG_STATE_SUSPENDED)
+				n++;
 			mutex_unlock(&kppg->mutex);
 		}
 		mutex_unlock(&fh->mutex);
 	}
+
+	return n;
 }
 
-void ipu_psys_exit_power_gating(struct ipu_psys *psys)
+void ipu_psys_enter_power_gating(struct ipu_psys *psys)
 {
-	struct ipu_psys_scheduler *sched;
-	struct ipu_psys_ppg *kppg, *tmp;
-	struct ipu_psys_fh *fh;
-	int ret = 0;
+	unsigned int n = ipu_psys_suspended_ppgs(psys);
+	int ret;
 
-	list_for_each_entry(fh, &psys->fhs, list) {
-		mutex_lock(&fh->mutex);
-		sched = &fh->sched;
-		if (list_empty(&sched->ppgs)) {
-			mutex_unlock(&fh->mutex);
-			continue;
-		}
+	if (!n)
+		return;
 
-		list_for_each_entry_safe(kppg, tmp, &sched->ppgs, list) {
-			mutex_lock(&kppg->mutex);
-			/* Only for SUSPENDED kppgs */
-			if (kppg->state != PPG_STATE_SUSPENDED) {
-				mutex_unlock(&kppg->mutex);
-				continue;
-			}
+	/* Only the last reference dropped can let the device idle */
+	while (--n)
+		pm_runtime_put_noidle(&psys->adev->dev);
 
-			ret = pm_runtime_get_sync(&psys->adev->dev);
-			if (ret < 0) {
-				dev_err(&psys->adev->dev,
-					"failed to power gating\n");
-				pm_runtime_put_noidle(&psys->adev->dev);
-			}
-			mutex_unlock(&kppg->mutex);
-		}
-		mutex_unlock(&fh->mutex);
+	ret = pm_runtime_put(&psys->adev->dev);
+	if (ret < 0) {
+		dev_err(&psys->adev->dev, "failed to power gating off\n");
+		pm_runtime_get_sync(&psys->adev->dev);
 	}
 }
+
+void ipu_psys_exit_power_gating(struct ipu_psys *psys)
+{
+	unsigned int n = ipu_psys_suspended_ppgs(psys);
+	int ret;
+
+	if (!n)
+		return;
+
+	/* Power up once, the other references don't need a resume */
+	ret = pm_runtime_get_sync(&psys->adev->dev);
+	if (ret < 0) {
+		dev_err(&psys->adev->dev, "failed to power gating\n");
+		pm_runtime_put_noidle(&psys->adev->dev);
+		return;
+	}
+
+	while (--n)
+		pm_runtime_get_noresume(&psys->adev->dev);
+}
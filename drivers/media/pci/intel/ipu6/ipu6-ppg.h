@@ -21,6 +21,9 @@ enum ipu_psys_power_gating_state {
 
 int ipu_psys_ppg_get_bufset(struct ipu_psys_kcmd *kcmd,
 			    struct ipu_psys_ppg *kppg);
+void ipu_psys_ppg_alloc_bufsets(struct ipu_psys_kcmd *kcmd,
+				struct ipu_psys_ppg *kppg);
+void ipu_psys_ppg_free_bufsets(struct ipu_psys_ppg *kppg);
 struct ipu_psys_kcmd *ipu_psys_ppg_get_stop_kcmd(struct ipu_psys_ppg *kppg);
 void ipu_psys_scheduler_remove_kppg(struct ipu_psys_ppg *kppg,
 				    enum SCHED_LIST type);
@@ -30,7 +33,7 @@ int ipu_psys_ppg_start(struct ipu_psys_ppg *kppg);
 int ipu_psys_ppg_resume(struct ipu_psys_ppg *kppg);
 int ipu_psys_ppg_stop(struct ipu_psys_ppg *kppg);
 int ipu_psys_ppg_suspend(struct ipu_psys_ppg *kppg);
-void ipu_psys_ppg_complete(struct ipu_psys *psys, struct ipu_psys_ppg *kppg);
+bool ipu_psys_ppg_complete(struct ipu_psys *psys, struct ipu_psys_ppg *kppg);
 bool ipu_psys_ppg_enqueue_bufsets(struct ipu_psys_ppg *kppg);
 void ipu_psys_enter_power_gating(struct ipu_psys *psys);
 void ipu_psys_exit_power_gating(struct ipu_psys *psys);
@@ -5,6 +5,7 @@
 #include <linux/debugfs.h>
 #include <linux/pm_runtime.h>
 
+#include "ipu-gpc-sample.h"
 #include "ipu-psys.h"
 #include "ipu-platform-regs.h"
 
@@ -207,6 +208,12 @@ int ipu_psys_gpc_init_debugfs(struct ipu_psys *psys)
 			goto err;
 	}
 
+	/* PSYS has no frame events, timer samples only */
+	if (IS_ERR(ipu_gpc_sampler_create(&psys->adev->dev, psys->adev->isp,
+					  psys->pdata->base + IPU_GPC_BASE +
+					  IPU_CDC_MMU_GPC_VALUE0, gpcdir)))
+		dev_warn(&psys->adev->dev, "gpc sampler not available\n");
+
 	return 0;
 
 err:
@@ -4,6 +4,7 @@
 #include <linux/uaccess.h>
 #include <linux/device.h>
 #include <linux/delay.h>
+#include <linux/eventfd.h>
 #include <linux/highmem.h>
 #include <linux/mm.h>
 #include <linux/pm_runtime.h>
@@ -19,10 +20,13 @@
 #include <linux/fs.h>
 
 #include "ipu.h"
+#include "ipu-gpc-pmu.h"
+#include "ipu-mmu.h"
 #include "ipu-psys.h"
 #include "ipu6-ppg.h"
 #include "ipu-platform-regs.h"
 #include "ipu-trace.h"
+#include "ipu-psys-trace.h"
 
 MODULE_IMPORT_NS(DMA_BUF);
 
@@ -31,10 +35,25 @@ module_param(early_pg_transfer, bool, 0664);
 MODULE_PARM_DESC(early_pg_transfer,
 		 "Copy PGs back to user after resource allocation");
 
+static bool ppg_zero_copy_qcmd;
+module_param(ppg_zero_copy_qcmd, bool, 0664);
+MODULE_PARM_DESC(ppg_zero_copy_qcmd,
+		 "Reuse the PPG's PG for enqueue and stop commands");
+
 bool enable_power_gating = true;
 module_param(enable_power_gating, bool, 0664);
 MODULE_PARM_DESC(enable_power_gating, "enable power gating");
 
+unsigned int frame_pacing_lead_us;
+module_param(frame_pacing_lead_us, uint, 0664);
+MODULE_PARM_DESC(frame_pacing_lead_us,
+		 "Leave power gating this many us before the next ISYS frame (0 = off)");
+
+static unsigned int chain_timeout_ms = 1000;
+module_param(chain_timeout_ms, uint, 0664);
+MODULE_PARM_DESC(chain_timeout_ms,
+		 "Fail commands held for an ISYS frame after this many ms (0 = never)");
+
 struct ipu_trace_block psys_trace_blocks[] = {
 	{
 		.offset = IPU_TRACE_REG_PS_TRACE_UNIT_BASE,
@@ -69,6 +88,15 @@ struct ipu_trace_block psys_trace_blocks[] = {
 	}
 };
 
+/* Offsets from IPU_GPC_BASE */
+const struct ipu_gpc_pmu_regs psys_gpc_pmu_regs = {
+	.soft_reset = IPU_CDC_MMU_GPC_SOFT_RESET,
+	.overall_enable = IPU_CDC_MMU_GPC_OVERALL_ENABLE,
+	.enable0 = IPU_CDC_MMU_GPC_ENABLE0,
+	.value0 = IPU_CDC_MMU_GPC_VALUE0,
+	.cnt_sel0 = IPU_CDC_MMU_GPC_CNT_SEL0,
+};
+
 static void ipu6_set_sp_info_bits(void *base)
 {
 	int i;
@@ -197,6 +225,8 @@ static void ipu_psys_kcmd_free(struct ipu_psys_kcmd *kcmd)
 	kppg = ipu_psys_identify_kppg(kcmd);
 	sched = &kcmd->fh->sched;
 
+	ipu_psys_kcmd_untrack(kcmd);
+
 	if (kcmd->kbuf_set) {
 		mutex_lock(&sched->bs_mutex);
 		kcmd->kbuf_set->buf_set_size = 0;
@@ -211,16 +241,53 @@ static void ipu_psys_kcmd_free(struct ipu_psys_kcmd *kcmd)
 		mutex_unlock(&kppg->mutex);
 	}
 
-	kfree(kcmd->pg_manifest);
+	ipu_psys_kmanifest_put(kcmd->manifest_ref);
+	/* buffers share the allocation of kbufs */
 	kfree(kcmd->kbufs);
-	kfree(kcmd->buffers);
 	kfree(kcmd);
 }
 
+/*
+ * Steady-state PPG frames, i.e. enqueue and stop commands, can use the
+ * PG their PPG started with instead of a pool copy of the user PG: the
+ * terminal layout and the token of a PPG don't change. Only the buffer
+ * set then differs from frame to frame.
+ */
+static struct ipu_psys_pg *ipu_psys_kcmd_reuse_pg(struct ipu_psys_kcmd *kcmd,
+						  struct ipu_psys_command *cmd)
+{
+	struct ipu_psys_scheduler *sched = &kcmd->fh->sched;
+	struct ipu_psys_pg *kpg = NULL;
+	struct ipu_psys_ppg *kppg;
+	unsigned int i;
+
+	if (!ppg_zero_copy_qcmd || !kcmd->pg_user)
+		return NULL;
+
+	/* Start commands come with buffers without DMA handles */
+	for (i = 0; cmd->buffers && i < cmd->bufcount; i++)
+		if (!(kcmd->buffers[i].flags & IPU_BUFFER_FLAG_DMA_HANDLE))
+			return NULL;
+
+	mutex_lock(&kcmd->fh->mutex);
+	list_for_each_entry(kppg, &sched->ppgs, list) {
+		if (kppg->token == kcmd->pg_user->token) {
+			kpg = kppg->kpg;
+			break;
+		}
+	}
+	mutex_unlock(&kcmd->fh->mutex);
+
+	kcmd->pg_reused = !!kpg;
+
+	return kpg;
+}
+
 static struct ipu_psys_kcmd *ipu_psys_copy_cmd(struct ipu_psys_command *cmd,
 					       struct ipu_psys_fh *fh)
 {
 	struct ipu_psys *psys = fh->psys;
+	struct ipu_mmu *mmu = psys->adev->mmu;
 	struct ipu_psys_kcmd *kcmd;
 	struct ipu_psys_kbuffer *kpgbuf;
 	unsigned int i;
@@ -240,8 +307,35 @@ static struct ipu_psys_kcmd *ipu_psys_copy_cmd(struct ipu_psys_command *cmd,
 
 	kcmd->state = KCMD_STATE_PPG_NEW;
 	kcmd->fh = fh;
+	kcmd->deadline = U64_MAX;
 	INIT_LIST_HEAD(&kcmd->list);
 
+	/*
+	 * Copy the whole user buffer array at once, kbufs and buffers share
+	 * a single allocation sized by bufcount.
+	 */
+	if (cmd->buffers) {
+		if (!cmd->bufcount)
+			goto error;
+
+		kcmd->kbufs = kcalloc(cmd->bufcount, sizeof(kcmd->kbufs[0]) +
+				      sizeof(*kcmd->buffers), GFP_KERNEL);
+		if (!kcmd->kbufs)
+			goto error;
+		kcmd->buffers = (struct ipu_psys_buffer *)
+			(kcmd->kbufs + cmd->bufcount);
+
+		ret = copy_from_user(kcmd->buffers, cmd->buffers,
+				     cmd->bufcount * sizeof(*kcmd->buffers));
+		if (ret)
+			goto error;
+	}
+
+	/*
+	 * One TLB invalidation covers the maps of the command buffers. The
+	 * batch ends before the manifest copy, no user access happens in it.
+	 */
+	ipu_mmu_tlb_batch_begin(mmu);
 	mutex_lock(&fh->mutex);
 	fd = cmd->pg;
 	kpgbuf = ipu_psys_lookup_kbuffer(fh, fd);
@@ -249,7 +343,7 @@ static struct ipu_psys_kcmd *ipu_psys_copy_cmd(struct ipu_psys_command *cmd,
 		dev_err(&psys->adev->dev, "%s kbuf %p with fd %d not found.\n",
 			__func__, kpgbuf, fd);
 		mutex_unlock(&fh->mutex);
-		goto error;
+		goto error_batch;
 	}
 
 	/* check and remap if possibe */
@@ -257,33 +351,26 @@ static struct ipu_psys_kcmd *ipu_psys_copy_cmd(struct ipu_psys_command *cmd,
 	if (!kpgbuf || !kpgbuf->sgt) {
 		dev_err(&psys->adev->dev, "%s remap failed\n", __func__);
 		mutex_unlock(&fh->mutex);
-		goto error;
+		goto error_batch;
 	}
 	mutex_unlock(&fh->mutex);
 
 	kcmd->pg_user = kpgbuf->kaddr;
-	kcmd->kpg = __get_pg_buf(psys, kpgbuf->len);
-	if (!kcmd->kpg)
-		goto error;
-
-	memcpy(kcmd->kpg->pg, kcmd->pg_user, kcmd->kpg->pg_size);
-
-	kcmd->pg_manifest = kzalloc(cmd->pg_manifest_size, GFP_KERNEL);
-	if (!kcmd->pg_manifest)
-		goto error;
 
-	ret = copy_from_user(kcmd->pg_manifest, cmd->pg_manifest,
-			     cmd->pg_manifest_size);
-	if (ret)
-		goto error;
+	kcmd->kpg = ipu_psys_kcmd_reuse_pg(kcmd, cmd);
+	if (!kcmd->kpg) {
+		kcmd->kpg = __get_pg_buf(psys, kpgbuf->len);
+		if (!kcmd->kpg)
+			goto error_batch;
 
-	kcmd->pg_manifest_size = cmd->pg_manifest_size;
+		memcpy(kcmd->kpg->pg, kcmd->pg_user, kcmd->kpg->pg_size);
+	}
 
 	kcmd->user_token = cmd->user_token;
 	kcmd->issue_id = cmd->issue_id;
 	kcmd->priority = cmd->priority;
 	if (kcmd->priority >= IPU_PSYS_CMD_PRIORITY_NUM)
-		goto error;
+		goto error_batch;
 
 	/*
 	 * Kenel enable bitmap be used only.
@@ -292,29 +379,16 @@ static struct ipu_psys_kcmd *ipu_psys_copy_cmd(struct ipu_psys_command *cmd,
 	       sizeof(cmd->kernel_enable_bitmap));
 
 	kcmd->nbuffers = ipu_fw_psys_pg_get_terminal_count(kcmd);
-	kcmd->buffers = kcalloc(kcmd->nbuffers, sizeof(*kcmd->buffers),
-				GFP_KERNEL);
-	if (!kcmd->buffers)
-		goto error;
-
-	kcmd->kbufs = kcalloc(kcmd->nbuffers, sizeof(kcmd->kbufs[0]),
-			      GFP_KERNEL);
-	if (!kcmd->kbufs)
-		goto error;
 
-	/* should be stop cmd for ppg */
+	/* should be stop cmd for ppg, it uses the manifest of the kppg */
 	if (!cmd->buffers) {
+		ipu_mmu_tlb_batch_end(mmu);
 		kcmd->state = KCMD_STATE_PPG_STOP;
 		return kcmd;
 	}
 
-	if (!cmd->bufcount || kcmd->nbuffers > cmd->bufcount)
-		goto error;
-
-	ret = copy_from_user(kcmd->buffers, cmd->buffers,
-			     kcmd->nbuffers * sizeof(*kcmd->buffers));
-	if (ret)
-		goto error;
+	if (kcmd->nbuffers > cmd->bufcount)
+		goto error_batch;
 
 	for (i = 0; i < kcmd->nbuffers; i++) {
 		struct ipu_fw_psys_terminal *terminal;
@@ -330,7 +404,7 @@ static struct ipu_psys_kcmd *ipu_psys_copy_cmd(struct ipu_psys_command *cmd,
 		if (kcmd->state == KCMD_STATE_PPG_START) {
 			dev_err(&psys->adev->dev,
 				"err: all buffer.flags&DMA_HANDLE must 0\n");
-			goto error;
+			goto error_batch;
 		}
 
 		mutex_lock(&fh->mutex);
@@ -341,7 +415,7 @@ static struct ipu_psys_kcmd *ipu_psys_copy_cmd(struct ipu_psys_command *cmd,
 				"%s kcmd->buffers[%d] %p fd %d not found.\n",
 				__func__, i, kpgbuf, fd);
 			mutex_unlock(&fh->mutex);
-			goto error;
+			goto error_batch;
 		}
 
 		kpgbuf = ipu_psys_mapbuf_locked(fd, fh);
@@ -349,13 +423,22 @@ static struct ipu_psys_kcmd *ipu_psys_copy_cmd(struct ipu_psys_command *cmd,
 			dev_err(&psys->adev->dev, "%s remap failed\n",
 				__func__);
 			mutex_unlock(&fh->mutex);
-			goto error;
+			goto error_batch;
 		}
 		mutex_unlock(&fh->mutex);
 		kcmd->kbufs[i] = kpgbuf;
 		if (!kcmd->kbufs[i] || !kcmd->kbufs[i]->sgt ||
 		    kcmd->kbufs[i]->len < kcmd->buffers[i].bytes_used)
-			goto error;
+			goto error_batch;
+		if (kcmd->buffers[i].flags & IPU_BUFFER_FLAG_WAIT_ISYS) {
+			/* A command waits for one ISYS frame only */
+			if (kcmd->wait_dbuf && kcmd->wait_dbuf != kpgbuf->dbuf) {
+				dev_err(&psys->adev->dev,
+					"more than one buffer waits for ISYS\n");
+				goto error_batch;
+			}
+			kcmd->wait_dbuf = kpgbuf->dbuf;
+		}
 		if ((kcmd->kbufs[i]->flags &
 		     IPU_BUFFER_FLAG_NO_FLUSH) ||
 		    (kcmd->buffers[i].flags &
@@ -369,11 +452,49 @@ static struct ipu_psys_kcmd *ipu_psys_copy_cmd(struct ipu_psys_command *cmd,
 				       kcmd->kbufs[i]->sgt->orig_nents,
 				       DMA_BIDIRECTIONAL);
 	}
+	ipu_mmu_tlb_batch_end(mmu);
 
-	if (kcmd->state != KCMD_STATE_PPG_START)
+	if (kcmd->state != KCMD_STATE_PPG_START) {
 		kcmd->state = KCMD_STATE_PPG_ENQUEUE;
+		if (READ_ONCE(fh->qos_class) == IPU_PSYS_QOS_CLASS_REALTIME) {
+			u32 deadline_us = READ_ONCE(fh->qos_deadline_us);
+
+			kcmd->deadline = ktime_get_ns() +
+				(u64)deadline_us * NSEC_PER_USEC;
+		}
+		return kcmd;
+	}
+
+	/*
+	 * Only the start command needs the manifest, it becomes the kppg's.
+	 * Share the one cached at firmware load for the program group, a
+	 * manifest not found there is copied from the user.
+	 */
+	kcmd->manifest_ref = ipu_psys_kmanifest_get(psys, kcmd->kpg->pg->ID);
+	if (kcmd->manifest_ref &&
+	    kcmd->manifest_ref->size != cmd->pg_manifest_size) {
+		ipu_psys_kmanifest_put(kcmd->manifest_ref);
+		kcmd->manifest_ref = NULL;
+	}
+
+	if (!kcmd->manifest_ref) {
+		kcmd->manifest_ref =
+			ipu_psys_kmanifest_alloc(cmd->pg_manifest_size);
+		if (!kcmd->manifest_ref)
+			goto error;
+
+		ret = copy_from_user(kcmd->manifest_ref->data,
+				     cmd->pg_manifest, cmd->pg_manifest_size);
+		if (ret)
+			goto error;
+	}
+
+	kcmd->pg_manifest = kcmd->manifest_ref->data;
+	kcmd->pg_manifest_size = kcmd->manifest_ref->size;
 
 	return kcmd;
+error_batch:
+	ipu_mmu_tlb_batch_end(mmu);
 error:
 	ipu_psys_kcmd_free(kcmd);
 
@@ -382,27 +503,135 @@ error:
 	return NULL;
 }
 
-static struct ipu_psys_buffer_set *
-ipu_psys_lookup_kbuffer_set(struct ipu_psys *psys, u32 addr)
+static void ipu_psys_fh_lat_record(struct ipu_psys_fh *fh,
+				   enum ipu_psys_lat_stage stage,
+				   u64 from, u64 to)
+{
+	struct ipu_psys_lat_hist *hist = &fh->lat[stage];
+	u64 ns, us;
+	unsigned long flags;
+
+	if (!from || to < from)
+		return;
+
+	ns = to - from;
+	us = div_u64(ns, NSEC_PER_USEC);
+
+	spin_lock_irqsave(&fh->lat_lock, flags);
+	hist->buckets[min_t(unsigned int, fls64(us),
+			    IPU_PSYS_LAT_BUCKETS - 1)]++;
+	hist->count++;
+	hist->sum_ns += ns;
+	hist->max_ns = max(hist->max_ns, ns);
+	spin_unlock_irqrestore(&fh->lat_lock, flags);
+}
+
+/* kcmd is handed to the firmware, end of its queue wait */
+void ipu_psys_kcmd_mark_start(struct ipu_psys_kcmd *kcmd)
+{
+	kcmd->start_ns = ktime_get_ns();
+	ipu_psys_fh_lat_record(kcmd->fh, IPU_PSYS_LAT_QUEUE, kcmd->qcmd_ns,
+			       kcmd->start_ns);
+	trace_ipu_psys_kcmd_start(kcmd);
+}
+
+/*
+ * A kcmd is tracked in kcmd_idr while it is on the processing list of its
+ * kppg, i.e. while the firmware may report it done. ids are handed out
+ * cyclically so that a stale id of a freed kcmd is not reused for a long
+ * time, an event is only accepted if its id still maps to its kcmd.
+ */
+void ipu_psys_kcmd_track(struct ipu_psys_kcmd *kcmd)
+{
+	struct ipu_psys *psys = kcmd->fh->psys;
+	unsigned long flags;
+	int id;
+
+	if (kcmd->id)
+		return;
+
+	idr_preload(GFP_KERNEL);
+	spin_lock_irqsave(&psys->kcmd_lock, flags);
+	id = idr_alloc_cyclic(&psys->kcmd_idr, kcmd, 1, 0, GFP_NOWAIT);
+	if (id > 0) {
+		kcmd->id = id;
+		if (kcmd->kbuf_set)
+			kcmd->kbuf_set->kcmd_id = id;
+		if (!psys->busy_inflight++)
+			psys->busy_since_ns = ktime_get_ns();
+	}
+	spin_unlock_irqrestore(&psys->kcmd_lock, flags);
+	idr_preload_end();
+
+	if (id > 0)
+		ipu_psys_kcmd_mark_start(kcmd);
+
+	if (id < 0)
+		dev_err(&psys->adev->dev, "failed to track kcmd %p\n", kcmd);
+}
+
+void ipu_psys_kcmd_untrack(struct ipu_psys_kcmd *kcmd)
+{
+	struct ipu_psys *psys = kcmd->fh->psys;
+	unsigned long flags;
+
+	if (!kcmd->id)
+		return;
+
+	spin_lock_irqsave(&psys->kcmd_lock, flags);
+	idr_remove(&psys->kcmd_idr, kcmd->id);
+	kcmd->id = 0;
+	if (!--psys->busy_inflight)
+		psys->busy_ns += ktime_get_ns() - psys->busy_since_ns;
+	spin_unlock_irqrestore(&psys->kcmd_lock, flags);
+
+	atomic64_add(ktime_get_ns() - kcmd->start_ns, &kcmd->fh->busy_ns);
+}
+
+void ipu_psys_buf_set_hash_add(struct ipu_psys *psys,
+			       struct ipu_psys_buffer_set *kbuf_set)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&psys->kcmd_lock, flags);
+	/*
+	 * Keyed on the 32-bit IPU address the firmware returns as the event
+	 * handle: the buffer set's ipu_virtual_address is set from dma_addr.
+	 */
+	hash_add(psys->buf_sets_hash, &kbuf_set->hnode, (u32)kbuf_set->dma_addr);
+	spin_unlock_irqrestore(&psys->kcmd_lock, flags);
+}
+
+void ipu_psys_buf_set_hash_del(struct ipu_psys *psys,
+			       struct ipu_psys_buffer_set *kbuf_set)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&psys->kcmd_lock, flags);
+	hash_del(&kbuf_set->hnode);
+	spin_unlock_irqrestore(&psys->kcmd_lock, flags);
+}
+
+/* Resolve a CMD_RUN event handle to its kcmd and the kcmd's id */
+static struct ipu_psys_kcmd *
+ipu_psys_lookup_kbuffer_set_kcmd(struct ipu_psys *psys, u32 addr, int *id)
 {
-	struct ipu_psys_fh *fh;
 	struct ipu_psys_buffer_set *kbuf_set;
-	struct ipu_psys_scheduler *sched;
+	struct ipu_psys_kcmd *kcmd = NULL;
+	unsigned long flags;
 
-	list_for_each_entry(fh, &psys->fhs, list) {
-		sched = &fh->sched;
-		mutex_lock(&sched->bs_mutex);
-		list_for_each_entry(kbuf_set, &sched->buf_sets, list) {
-			if (kbuf_set->buf_set &&
-			    kbuf_set->buf_set->ipu_virtual_address == addr) {
-				mutex_unlock(&sched->bs_mutex);
-				return kbuf_set;
-			}
+	spin_lock_irqsave(&psys->kcmd_lock, flags);
+	hash_for_each_possible(psys->buf_sets_hash, kbuf_set, hnode, addr) {
+		if (kbuf_set->buf_set &&
+		    kbuf_set->buf_set->ipu_virtual_address == addr) {
+			kcmd = kbuf_set->kcmd;
+			*id = kbuf_set->kcmd_id;
+			break;
 		}
-		mutex_unlock(&sched->bs_mutex);
 	}
+	spin_unlock_irqrestore(&psys->kcmd_lock, flags);
 
-	return NULL;
+	return kcmd;
 }
 
 static struct ipu_psys_ppg *ipu_psys_lookup_ppg(struct ipu_psys *psys,
@@ -412,7 +641,7 @@ static struct ipu_psys_ppg *ipu_psys_lookup_ppg(struct ipu_psys *psys,
 	struct ipu_psys_ppg *kppg, *tmp;
 	struct ipu_psys_fh *fh;
 
-	list_for_each_entry(fh, &psys->fhs, list) {
+	ipu_psys_for_each_fh(fh, psys) {
 		sched = &fh->sched;
 		mutex_lock(&fh->mutex);
 		if (list_empty(&sched->ppgs)) {
@@ -432,12 +661,43 @@ static struct ipu_psys_ppg *ipu_psys_lookup_ppg(struct ipu_psys *psys,
 	return NULL;
 }
 
+/* Track the frame interval of kppg as a 1/8 EWMA, under kppg->mutex */
+static void ipu_psys_ppg_note_arrival(struct ipu_psys_ppg *kppg)
+{
+	u64 now = ktime_get_ns();
+	u64 interval = now - kppg->last_arrival_ns;
+
+	/* Relearn after a pause of the stream */
+	if (!kppg->last_arrival_ns || interval >= NSEC_PER_SEC)
+		kppg->interval_ns = 0;
+	else if (!kppg->interval_ns)
+		kppg->interval_ns = interval;
+	else
+		kppg->interval_ns += (s64)(interval - kppg->interval_ns) / 8;
+
+	kppg->last_arrival_ns = now;
+}
+
+/* Update the earliest deadline of kppg's kcmds, called under kppg->mutex */
+static void ipu_psys_ppg_update_deadline(struct ipu_psys_ppg *kppg)
+{
+	struct ipu_psys_kcmd *kcmd;
+	u64 deadline = U64_MAX;
+
+	list_for_each_entry(kcmd, &kppg->kcmds_new_list, list)
+		deadline = min(deadline, kcmd->deadline);
+	list_for_each_entry(kcmd, &kppg->kcmds_processing_list, list)
+		deadline = min(deadline, kcmd->deadline);
+
+	WRITE_ONCE(kppg->deadline, deadline);
+}
+
 /*
  * Move kcmd into completed state (due to running finished or failure).
- * Fill up the event struct and notify waiters.
+ * Fill up the event struct, the caller notifies waiters.
  */
-void ipu_psys_kcmd_complete(struct ipu_psys_ppg *kppg,
-			    struct ipu_psys_kcmd *kcmd, int error)
+static void __ipu_psys_kcmd_complete(struct ipu_psys_ppg *kppg,
+				     struct ipu_psys_kcmd *kcmd, int error)
 {
 	struct ipu_psys_fh *fh = kcmd->fh;
 	struct ipu_psys *psys = fh->psys;
@@ -448,6 +708,23 @@ void ipu_psys_kcmd_complete(struct ipu_psys_ppg *kppg,
 	kcmd->ev.error = error;
 	list_move_tail(&kcmd->list, &kppg->kcmds_finished_list);
 
+	kcmd->done_ns = ktime_get_ns();
+	if (!kcmd->start_ns)
+		kcmd->start_ns = kcmd->done_ns;
+	ipu_psys_fh_lat_record(fh, IPU_PSYS_LAT_EXEC, kcmd->start_ns,
+			       kcmd->done_ns);
+	trace_ipu_psys_kcmd_done(kcmd);
+	ipu_psys_kcmd_untrack(kcmd);
+	ipu_stats_inc(&fh->stats, error ? IPU_PSYS_STAT_KCMD_ERRORS :
+		      IPU_PSYS_STAT_KCMD_DONE);
+
+	if (kcmd->deadline != U64_MAX) {
+		atomic64_inc(&fh->qos_frames);
+		if (ktime_get_ns() > kcmd->deadline)
+			atomic64_inc(&fh->qos_missed);
+		ipu_psys_ppg_update_deadline(kppg);
+	}
+
 	if (kcmd->constraint.min_freq)
 		ipu_buttress_remove_psys_constraint(psys->adev->isp,
 						    &kcmd->constraint);
@@ -465,7 +742,30 @@ void ipu_psys_kcmd_complete(struct ipu_psys_ppg *kppg,
 	}
 
 	kcmd->state = KCMD_STATE_PPG_COMPLETE;
+}
+
+/* Notify waiters and the eventfd of fh about completed kcmds */
+static void ipu_psys_fh_notify(struct ipu_psys_fh *fh)
+{
+	unsigned long flags;
+
 	wake_up_interruptible(&fh->wait);
+
+	spin_lock_irqsave(&fh->eventfd_lock, flags);
+	if (fh->eventfd)
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 8, 0)
+		eventfd_signal(fh->eventfd, 1);
+#else
+		eventfd_signal(fh->eventfd);
+#endif
+	spin_unlock_irqrestore(&fh->eventfd_lock, flags);
+}
+
+void ipu_psys_kcmd_complete(struct ipu_psys_ppg *kppg,
+			    struct ipu_psys_kcmd *kcmd, int error)
+{
+	__ipu_psys_kcmd_complete(kppg, kcmd, error);
+	ipu_psys_fh_notify(kcmd->fh);
 }
 
 /*
@@ -486,6 +786,9 @@ int ipu_psys_kcmd_start(struct ipu_psys *psys, struct ipu_psys_kcmd *kcmd)
 	if (early_pg_transfer && kcmd->pg_user && kcmd->kpg->pg)
 		memcpy(kcmd->pg_user, kcmd->kpg->pg, kcmd->kpg->pg_size);
 
+	/* The buffers go to the firmware, settle the pending TLB flushes */
+	ipu_mmu_tlb_flush_pending(psys->adev->mmu);
+
 	ret = ipu_fw_psys_pg_start(kcmd);
 	if (ret) {
 		dev_err(&psys->adev->dev, "failed to start kcmd!\n");
@@ -524,6 +827,7 @@ static int ipu_psys_kcmd_send_to_ppg_start(struct ipu_psys_kcmd *kcmd)
 	kppg->state = PPG_STATE_START;
 	kppg->pri_base = kcmd->priority;
 	kppg->pri_dynamic = 0;
+	kppg->deadline = U64_MAX;
 	INIT_LIST_HEAD(&kppg->list);
 
 	mutex_init(&kppg->mutex);
@@ -532,20 +836,15 @@ static int ipu_psys_kcmd_send_to_ppg_start(struct ipu_psys_kcmd *kcmd)
 	INIT_LIST_HEAD(&kppg->kcmds_finished_list);
 	INIT_LIST_HEAD(&kppg->sched_list);
 
-	kppg->manifest = kzalloc(kcmd->pg_manifest_size, GFP_KERNEL);
-	if (!kppg->manifest) {
-		kfree(kppg);
-		return -ENOMEM;
-	}
-	memcpy(kppg->manifest, kcmd->pg_manifest,
-	       kcmd->pg_manifest_size);
+	kref_get(&kcmd->manifest_ref->ref);
+	kppg->manifest_ref = kcmd->manifest_ref;
+	kppg->manifest = kcmd->pg_manifest;
 
 	queue_id = ipu_psys_allocate_cmd_queue_resource(rpr);
 	if (queue_id == -ENOSPC) {
 		dev_err(&psys->adev->dev, "no available queue\n");
-		kfree(kppg->manifest);
+		ipu_psys_kmanifest_put(kppg->manifest_ref);
 		kfree(kppg);
-		mutex_unlock(&psys->mutex);
 		return -ENOMEM;
 	}
 
@@ -560,18 +859,21 @@ static int ipu_psys_kcmd_send_to_ppg_start(struct ipu_psys_kcmd *kcmd)
 					      kcmd->kpg->pg_dma_addr);
 	if (ret) {
 		ipu_psys_free_cmd_queue_resource(rpr, queue_id);
-		kfree(kppg->manifest);
+		ipu_psys_kmanifest_put(kppg->manifest_ref);
 		kfree(kppg);
 		return -EIO;
 	}
 	memcpy(kcmd->pg_user, kcmd->kpg->pg, kcmd->kpg->pg_size);
 
+	ipu_psys_ppg_alloc_bufsets(kcmd, kppg);
+
 	mutex_lock(&fh->mutex);
 	list_add_tail(&kppg->list, &sched->ppgs);
 	mutex_unlock(&fh->mutex);
 
 	mutex_lock(&kppg->mutex);
 	list_add(&kcmd->list, &kppg->kcmds_new_list);
+	ipu_psys_scheduler_add_kppg(kppg, SCHED_START_LIST);
 	mutex_unlock(&kppg->mutex);
 
 	dev_dbg(&psys->adev->dev,
@@ -600,9 +902,11 @@ static int ipu_psys_kcmd_send_to_ppg(struct ipu_psys_kcmd *kcmd)
 		return ipu_psys_kcmd_send_to_ppg_start(kcmd);
 
 	kppg = ipu_psys_identify_kppg(kcmd);
-	spin_lock_irqsave(&psys->pgs_lock, flags);
-	kcmd->kpg->pg_size = 0;
-	spin_unlock_irqrestore(&psys->pgs_lock, flags);
+	if (!kcmd->pg_reused) {
+		spin_lock_irqsave(&psys->pgs_lock, flags);
+		kcmd->kpg->pg_size = 0;
+		spin_unlock_irqrestore(&psys->pgs_lock, flags);
+	}
 	if (!kppg) {
 		dev_err(&psys->adev->dev, "token not match\n");
 		return -EINVAL;
@@ -638,6 +942,9 @@ static int ipu_psys_kcmd_send_to_ppg(struct ipu_psys_kcmd *kcmd)
 
 		mutex_lock(&kppg->mutex);
 		list_add_tail(&kcmd->list, &kppg->kcmds_new_list);
+		ipu_psys_ppg_note_arrival(kppg);
+		if (kcmd->deadline < kppg->deadline)
+			WRITE_ONCE(kppg->deadline, kcmd->deadline);
 		mutex_unlock(&kppg->mutex);
 	}
 
@@ -678,15 +985,41 @@ int ipu_psys_kcmd_new(struct ipu_psys_command *cmd, struct ipu_psys_fh *fh)
 		goto error;
 	}
 
+	/* Held commands complete on their ppg, which must be running */
+	if (kcmd->wait_dbuf && kcmd->state == KCMD_STATE_PPG_START) {
+		dev_dbg(&psys->adev->dev, "ppg start can't wait for ISYS\n");
+		ret = -EINVAL;
+		goto error;
+	}
+
 	if (cmd->min_psys_freq) {
 		kcmd->constraint.min_freq = cmd->min_psys_freq;
 		ipu_buttress_add_psys_constraint(psys->adev->isp,
 						 &kcmd->constraint);
 	}
 
+	ipu_psys_qcmd_record(kcmd, cmd, pg_size);
+
+	kcmd->qcmd_ns = ktime_get_ns();
+	trace_ipu_psys_kcmd_queue(kcmd);
+
+	if (kcmd->wait_dbuf) {
+		unsigned long flags;
+
+		spin_lock_irqsave(&psys->chain_lock, flags);
+		list_add_tail(&kcmd->list, &psys->chain_held);
+		spin_unlock_irqrestore(&psys->chain_lock, flags);
+		if (chain_timeout_ms)
+			schedule_delayed_work(&psys->chain_timeout_work,
+					      msecs_to_jiffies(chain_timeout_ms));
+		ipu_stats_inc(&fh->stats, IPU_PSYS_STAT_KCMD_QUEUED);
+		return 0;
+	}
+
 	ret = ipu_psys_kcmd_send_to_ppg(kcmd);
 	if (ret)
 		goto error;
+	ipu_stats_inc(&fh->stats, IPU_PSYS_STAT_KCMD_QUEUED);
 
 	dev_dbg(&psys->adev->dev,
 		"IOC_QCMD: user_token:%llx issue_id:0x%llx pri:%d\n",
@@ -700,55 +1033,222 @@ error:
 	return ret;
 }
 
-static bool ipu_psys_kcmd_is_valid(struct ipu_psys *psys,
-				   struct ipu_psys_kcmd *kcmd)
+/*
+ * ISYS frame done or aborted on @data, a struct dma_buf. Runs in ISYS
+ * response handling, so the held commands only move to chain_ready here.
+ */
+static int ipu_psys_chain_notify(struct notifier_block *nb,
+				 unsigned long action, void *data)
 {
-	struct ipu_psys_fh *fh;
-	struct ipu_psys_kcmd *kcmd0;
-	struct ipu_psys_ppg *kppg, *tmp;
-	struct ipu_psys_scheduler *sched;
+	struct ipu_psys *psys = container_of(nb, struct ipu_psys, chain_nb);
+	struct ipu_psys_kcmd *kcmd, *kcmd0;
+	unsigned long flags;
+	bool ready = false;
 
-	list_for_each_entry(fh, &psys->fhs, list) {
-		sched = &fh->sched;
-		mutex_lock(&fh->mutex);
-		if (list_empty(&sched->ppgs)) {
-			mutex_unlock(&fh->mutex);
+	spin_lock_irqsave(&psys->chain_lock, flags);
+	list_for_each_entry_safe(kcmd, kcmd0, &psys->chain_held, list) {
+		if (kcmd->wait_dbuf != data)
 			continue;
+		if (action == IPU_ISYS_FRAME_ABORTED)
+			kcmd->wait_error = -EPIPE;
+		list_move_tail(&kcmd->list, &psys->chain_ready);
+		ready = true;
+	}
+	spin_unlock_irqrestore(&psys->chain_lock, flags);
+
+	if (ready)
+		schedule_work(&psys->chain_work);
+
+	return NOTIFY_OK;
+}
+
+/* Give the pool PG of a held kcmd back, it never reached the ppg */
+static void ipu_psys_chain_put_pg(struct ipu_psys *psys,
+				  struct ipu_psys_pg *kpg)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&psys->pgs_lock, flags);
+	kpg->pg_size = 0;
+	spin_unlock_irqrestore(&psys->pgs_lock, flags);
+}
+
+/*
+ * Complete a held kcmd with @error through its ppg, like the firmware
+ * would: the constraint goes and the event reaches the user.
+ */
+static void ipu_psys_chain_fail(struct ipu_psys_kcmd *kcmd, int error)
+{
+	struct ipu_psys *psys = kcmd->fh->psys;
+	struct ipu_psys_pg *kpg = kcmd->pg_reused ? NULL : kcmd->kpg;
+	struct ipu_psys_ppg *kppg;
+
+	kppg = ipu_psys_identify_kppg(kcmd);
+	if (!kppg) {
+		/* The ppg went away, nobody is left to get the event */
+		if (kcmd->constraint.min_freq)
+			ipu_buttress_remove_psys_constraint(psys->adev->isp,
+							    &kcmd->constraint);
+		ipu_psys_kcmd_free(kcmd);
+		if (kpg)
+			ipu_psys_chain_put_pg(psys, kpg);
+		return;
+	}
+
+	/* Completing copies the PG back to the user, then it can go */
+	mutex_lock(&kppg->mutex);
+	ipu_psys_kcmd_complete(kppg, kcmd, error);
+	kcmd->kpg = kppg->kpg;
+	mutex_unlock(&kppg->mutex);
+	if (kpg)
+		ipu_psys_chain_put_pg(psys, kpg);
+}
+
+static void ipu_psys_chain_work(struct work_struct *work)
+{
+	struct ipu_psys *psys = container_of(work, struct ipu_psys,
+					     chain_work);
+	struct ipu_psys_kcmd *kcmd;
+	unsigned long flags;
+	int ret;
+
+	for (;;) {
+		spin_lock_irqsave(&psys->chain_lock, flags);
+		kcmd = list_first_entry_or_null(&psys->chain_ready,
+						struct ipu_psys_kcmd, list);
+		if (kcmd)
+			list_del_init(&kcmd->list);
+		spin_unlock_irqrestore(&psys->chain_lock, flags);
+		if (!kcmd)
+			break;
+
+		ret = kcmd->wait_error;
+		if (!ret)
+			ret = ipu_psys_kcmd_send_to_ppg(kcmd);
+		if (ret) {
+			dev_dbg(&psys->adev->dev,
+				"chained kcmd %llx not sent (%d)\n",
+				kcmd->user_token, ret);
+			ipu_psys_chain_fail(kcmd, ret);
 		}
-		list_for_each_entry_safe(kppg, tmp, &sched->ppgs, list) {
-			mutex_lock(&kppg->mutex);
-			list_for_each_entry(kcmd0,
-					    &kppg->kcmds_processing_list,
-					    list) {
-				if (kcmd0 == kcmd) {
-					mutex_unlock(&kppg->mutex);
-					mutex_unlock(&fh->mutex);
-					return true;
-				}
-			}
-			mutex_unlock(&kppg->mutex);
-		}
-		mutex_unlock(&fh->mutex);
 	}
+}
+
+/* Fail the held kcmds whose ISYS frame did not come in time */
+static void ipu_psys_chain_timeout_work(struct work_struct *work)
+{
+	struct ipu_psys *psys = container_of(work, struct ipu_psys,
+					     chain_timeout_work.work);
+	u64 timeout_ns = (u64)chain_timeout_ms * NSEC_PER_MSEC;
+	u64 now = ktime_get_ns();
+	struct ipu_psys_kcmd *kcmd, *kcmd0;
+	unsigned long flags;
+	bool ready = false;
+	bool held;
+
+	spin_lock_irqsave(&psys->chain_lock, flags);
+	list_for_each_entry_safe(kcmd, kcmd0, &psys->chain_held, list) {
+		if (timeout_ns && now - kcmd->qcmd_ns < timeout_ns)
+			continue;
+		kcmd->wait_error = -ETIMEDOUT;
+		list_move_tail(&kcmd->list, &psys->chain_ready);
+		ready = true;
+	}
+	held = !list_empty(&psys->chain_held);
+	spin_unlock_irqrestore(&psys->chain_lock, flags);
+
+	if (ready)
+		schedule_work(&psys->chain_work);
+	if (held && timeout_ns)
+		schedule_delayed_work(&psys->chain_timeout_work,
+				      msecs_to_jiffies(chain_timeout_ms));
+}
+
+void ipu_psys_chain_init(struct ipu_psys *psys)
+{
+	spin_lock_init(&psys->chain_lock);
+	INIT_LIST_HEAD(&psys->chain_held);
+	INIT_LIST_HEAD(&psys->chain_ready);
+	INIT_WORK(&psys->chain_work, ipu_psys_chain_work);
+	INIT_DELAYED_WORK(&psys->chain_timeout_work,
+			  ipu_psys_chain_timeout_work);
+	psys->chain_nb.notifier_call = ipu_psys_chain_notify;
+}
+
+void ipu_psys_chain_cleanup(struct ipu_psys *psys)
+{
+	atomic_notifier_chain_unregister(&psys->adev->isp->isys_frame_notifier,
+					 &psys->chain_nb);
+	cancel_delayed_work_sync(&psys->chain_timeout_work);
+	cancel_work_sync(&psys->chain_work);
+}
+
+/* Fail the commands of @fh still waiting for ISYS, before its buffers go */
+void ipu_psys_chain_release_fh(struct ipu_psys_fh *fh)
+{
+	struct ipu_psys *psys = fh->psys;
+	struct ipu_psys_kcmd *kcmd, *kcmd0;
+	unsigned long flags;
+	LIST_HEAD(drop);
+
+	spin_lock_irqsave(&psys->chain_lock, flags);
+	list_for_each_entry_safe(kcmd, kcmd0, &psys->chain_held, list)
+		if (kcmd->fh == fh)
+			list_move_tail(&kcmd->list, &drop);
+	list_for_each_entry_safe(kcmd, kcmd0, &psys->chain_ready, list)
+		if (kcmd->fh == fh)
+			list_move_tail(&kcmd->list, &drop);
+	spin_unlock_irqrestore(&psys->chain_lock, flags);
+
+	/* One of them may be on its way to the ppg */
+	flush_work(&psys->chain_work);
+
+	list_for_each_entry_safe(kcmd, kcmd0, &drop, list) {
+		list_del_init(&kcmd->list);
+		ipu_psys_chain_fail(kcmd, -ECANCELED);
+	}
+}
+
+static bool ipu_psys_kcmd_is_valid(struct ipu_psys *psys,
+				   struct ipu_psys_kcmd *kcmd, int id)
+{
+	unsigned long flags;
+	bool valid;
+
+	if (!id)
+		return false;
 
-	return false;
+	spin_lock_irqsave(&psys->kcmd_lock, flags);
+	valid = idr_find(&psys->kcmd_idr, id) == kcmd;
+	spin_unlock_irqrestore(&psys->kcmd_lock, flags);
+
+	return valid;
 }
 
-void ipu_psys_handle_events(struct ipu_psys *psys)
+/*
+ * Drain the firmware event queue. Waiters of each fh and the l-scheduler
+ * are woken once per batch instead of once per event.
+ */
+unsigned int ipu_psys_handle_events(struct ipu_psys *psys)
 {
+	unsigned int events = 0;
 	struct ipu_psys_kcmd *kcmd;
 	struct ipu_fw_psys_event event;
 	struct ipu_psys_ppg *kppg;
+	struct ipu_psys_fh *fh, *fh0;
+	LIST_HEAD(wake_fhs);
+	bool kick = false;
 	bool error;
 	u32 hdl;
 	u16 cmd, status;
-	int res;
+	int res, id;
 
 	do {
 		memset(&event, 0, sizeof(event));
 		if (!ipu_fw_psys_rcv_event(psys, &event))
 			break;
 
+		events++;
 		if (!event.context_handle)
 			break;
 
@@ -768,16 +1268,14 @@ void ipu_psys_handle_events(struct ipu_psys *psys)
 
 		kppg = NULL;
 		kcmd = NULL;
+		id = 0;
 		if (cmd == IPU_FW_PSYS_PROCESS_GROUP_CMD_RUN) {
-			struct ipu_psys_buffer_set *kbuf_set;
 			/*
 			 * Need change ppg state when the 1st running is done
 			 * (after PPG started/resumed)
 			 */
-			kbuf_set = ipu_psys_lookup_kbuffer_set(psys, hdl);
-			if (kbuf_set)
-				kcmd = kbuf_set->kcmd;
-			if (!kbuf_set || !kcmd)
+			kcmd = ipu_psys_lookup_kbuffer_set_kcmd(psys, hdl, &id);
+			if (!kcmd || !ipu_psys_kcmd_is_valid(psys, kcmd, id))
 				error = true;
 			else
 				kppg = ipu_psys_identify_kppg(kcmd);
@@ -796,6 +1294,8 @@ void ipu_psys_handle_events(struct ipu_psys *psys)
 					kcmd = ipu_psys_ppg_get_stop_kcmd(kppg);
 					if (!kcmd)
 						error = true;
+					else
+						id = kcmd->id;
 				}
 				mutex_unlock(&kppg->mutex);
 			}
@@ -805,25 +1305,45 @@ void ipu_psys_handle_events(struct ipu_psys *psys)
 		}
 
 		if (error || !kppg) {
+			/* Stale or unknown handle, the other events still count */
 			dev_err(&psys->adev->dev, "event error, command %d\n",
 				cmd);
-			break;
+			continue;
 		}
 
 		dev_dbg(&psys->adev->dev, "event to kppg 0x%p, kcmd 0x%p\n",
 			kppg, kcmd);
 
-		ipu_psys_ppg_complete(psys, kppg);
+		kick |= ipu_psys_ppg_complete(psys, kppg);
 
-		if (kcmd && ipu_psys_kcmd_is_valid(psys, kcmd)) {
+		if (kcmd && ipu_psys_kcmd_is_valid(psys, kcmd, id)) {
 			res = (status == IPU_PSYS_EVENT_CMD_COMPLETE ||
 			       status == IPU_PSYS_EVENT_FRAGMENT_COMPLETE) ?
 				0 : -EIO;
 			mutex_lock(&kppg->mutex);
-			ipu_psys_kcmd_complete(kppg, kcmd, res);
+			__ipu_psys_kcmd_complete(kppg, kcmd, res);
 			mutex_unlock(&kppg->mutex);
+			/* wake_list is only used here, under psys->mutex */
+			if (list_empty(&kcmd->fh->wake_list))
+				list_add_tail(&kcmd->fh->wake_list, &wake_fhs);
 		}
 	} while (1);
+
+	list_for_each_entry_safe(fh, fh0, &wake_fhs, wake_list) {
+		list_del_init(&fh->wake_list);
+		ipu_psys_fh_notify(fh);
+	}
+
+	if (kick) {
+		/*
+		 * Kick l-scheduler thread for FW callback,
+		 * also for checking if need to enter power gating
+		 */
+		atomic_set(&psys->wakeup_count, 1);
+		wake_up_interruptible(&psys->sched_cmd_wq);
+	}
+
+	return events;
 }
 
 int ipu_psys_fh_init(struct ipu_psys_fh *fh)
@@ -853,6 +1373,7 @@ int ipu_psys_fh_init(struct ipu_psys_fh *fh)
 		}
 		kbuf_set->size = IPU_PSYS_BUF_SET_MAX_SIZE;
 		list_add(&kbuf_set->list, &sched->buf_sets);
+		ipu_psys_buf_set_hash_add(psys, kbuf_set);
 	}
 
 	return 0;
@@ -860,6 +1381,7 @@ int ipu_psys_fh_init(struct ipu_psys_fh *fh)
 out_free_buf_sets:
 	list_for_each_entry_safe(kbuf_set, kbuf_set_tmp,
 				 &sched->buf_sets, list) {
+		ipu_psys_buf_set_hash_del(psys, kbuf_set);
 		dma_free_attrs(&psys->adev->dev,
 			       kbuf_set->size, kbuf_set->kaddr,
 			       kbuf_set->dma_addr, 0);
@@ -908,6 +1430,8 @@ int ipu_psys_fh_deinit(struct ipu_psys_fh *fh)
 				if (psys->power_gating != PSYS_POWER_GATED)
 					pm_runtime_put(&psys->adev->dev);
 			}
+			ipu_psys_scheduler_remove_kppg(kppg, SCHED_START_LIST);
+			ipu_psys_scheduler_remove_kppg(kppg, SCHED_STOP_LIST);
 			list_del(&kppg->list);
 			mutex_unlock(&kppg->mutex);
 
@@ -941,8 +1465,9 @@ int ipu_psys_fh_deinit(struct ipu_psys_fh *fh)
 			kppg->kpg->pg_size = 0;
 			spin_unlock_irqrestore(&psys->pgs_lock, flags);
 
+			ipu_psys_ppg_free_bufsets(kppg);
 			mutex_destroy(&kppg->mutex);
-			kfree(kppg->manifest);
+			ipu_psys_kmanifest_put(kppg->manifest_ref);
 			kfree(kppg);
 		}
 	}
@@ -950,6 +1475,7 @@ int ipu_psys_fh_deinit(struct ipu_psys_fh *fh)
 
 	mutex_lock(&sched->bs_mutex);
 	list_for_each_entry_safe(kbuf_set, kbuf_set0, &sched->buf_sets, list) {
+		ipu_psys_buf_set_hash_del(psys, kbuf_set);
 		dma_free_attrs(&psys->adev->dev,
 			       kbuf_set->size, kbuf_set->kaddr,
 			       kbuf_set->dma_addr, 0);
@@ -994,6 +1520,14 @@ struct ipu_psys_kcmd *ipu_get_completed_kcmd(struct ipu_psys_fh *fh)
 	return NULL;
 }
 
+/* The completion event of kcmd is handed to the user */
+static void ipu_psys_kcmd_reap(struct ipu_psys_kcmd *kcmd)
+{
+	ipu_psys_fh_lat_record(kcmd->fh, IPU_PSYS_LAT_REAP, kcmd->done_ns,
+			       ktime_get_ns());
+	trace_ipu_psys_kcmd_dequeue(kcmd);
+}
+
 long ipu_ioctl_dqevent(struct ipu_psys_event *event,
 		       struct ipu_psys_fh *fh, unsigned int f_flags)
 {
@@ -1018,7 +1552,55 @@ long ipu_ioctl_dqevent(struct ipu_psys_event *event,
 	}
 
 	*event = kcmd->ev;
+	ipu_psys_kcmd_reap(kcmd);
 	ipu_psys_kcmd_free(kcmd);
 
 	return 0;
 }
+
+long ipu_ioctl_dqevents(struct ipu_psys_events *events,
+			struct ipu_psys_fh *fh, unsigned int f_flags)
+{
+	struct ipu_psys *psys = fh->psys;
+	struct ipu_psys_kcmd *kcmd = NULL;
+	int rval;
+	u32 i;
+
+	dev_dbg(&psys->adev->dev, "IOC_DQEVENTS %u\n", events->count);
+
+	if (!events->count || events->count > IPU_PSYS_DQEVENTS_MAX)
+		return -EINVAL;
+
+	if (!(f_flags & O_NONBLOCK)) {
+		rval = wait_event_interruptible(fh->wait,
+						(kcmd =
+						 ipu_get_completed_kcmd(fh)));
+		if (rval == -ERESTARTSYS)
+			return rval;
+	}
+
+	for (i = 0; i < events->count; i++) {
+		if (!kcmd)
+			kcmd = ipu_get_completed_kcmd(fh);
+		if (!kcmd)
+			break;
+
+		/* Keep the event queued if it can't be handed out */
+		if (copy_to_user(&events->events[i], &kcmd->ev,
+				 sizeof(kcmd->ev))) {
+			if (!i)
+				return -EFAULT;
+			break;
+		}
+		ipu_psys_kcmd_reap(kcmd);
+		ipu_psys_kcmd_free(kcmd);
+		kcmd = NULL;
+	}
+
+	if (!i)
+		return -ENODATA;
+
+	events->count = i;
+
+	return 0;
+}
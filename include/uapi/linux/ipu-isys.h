@@ -4,12 +4,97 @@
 #ifndef UAPI_LINUX_IPU_ISYS_H
 #define UAPI_LINUX_IPU_ISYS_H
 
+#include <linux/types.h>
+
 #define V4L2_CID_IPU_BASE	(V4L2_CID_USER_BASE + 0x1080)
 
 #define V4L2_CID_IPU_STORE_CSI2_HEADER	(V4L2_CID_IPU_BASE + 2)
 #define V4L2_CID_IPU_ISYS_COMPRESSION	(V4L2_CID_IPU_BASE + 3)
+/* Lines of a frame after which V4L2_EVENT_IPU_WATERMARK is sent, 0 is off */
+#define V4L2_CID_IPU_ISYS_WATERMARK	(V4L2_CID_IPU_BASE + 4)
+/*
+ * Sensor embedded data lines captured with each frame into a second
+ * plane of the same buffer, 0 is off. Taken into account by S_FMT.
+ */
+#define V4L2_CID_IPU_ISYS_EMBEDDED_LINES	(V4L2_CID_IPU_BASE + 5)
+/*
+ * Time in ms the firmware stream stays open after STREAMOFF. A STREAMON
+ * with an unchanged configuration meanwhile restarts it without opening
+ * it again. -1 follows the stream_close_delay_ms module parameter. At
+ * most 5000, system suspend closes the stream regardless.
+ */
+#define V4L2_CID_IPU_ISYS_KEEP_OPEN	(V4L2_CID_IPU_BASE + 6)
+
+/*
+ * Sensor embedded data lines (CSI-2 data type 0x12) as sent by the
+ * sensor, one byte per sample, are captured as the generic 8-bit
+ * metadata format of the kernel. Buffers carry the sequence and
+ * timestamp of the frame the lines were sent with. The sensor tells the
+ * size in its frame descriptor.
+ */
+#ifndef V4L2_META_FMT_GENERIC_8
+#define V4L2_META_FMT_GENERIC_8	v4l2_fourcc('M', 'E', 'T', '8')
+#endif
+
+/*
+ * ISYS RAW compression. VIDIOC_ENUM_FMT sets V4L2_FMT_FLAG_IPU_COMPRESSIBLE
+ * on the formats a node can write compressed. Setting
+ * V4L2_PIX_FMT_FLAG_IPU_COMPRESSED in the flags of struct
+ * v4l2_pix_format_mplane selects the compressed layout, the driver clears
+ * it when the format can't be compressed. The compressed image is followed
+ * by its tile status in the same plane, at the page aligned end of the
+ * image.
+ */
+#define V4L2_FMT_FLAG_IPU_COMPRESSIBLE		0x00100000
+#define V4L2_PIX_FMT_FLAG_IPU_COMPRESSED	0x80
+
+/*
+ * Sent on a capture video node once the first @lines lines of frame
+ * @sequence have been written to the buffer in flight. Carried in the
+ * data field of struct v4l2_event.
+ */
+#define V4L2_EVENT_IPU_WATERMARK	(V4L2_EVENT_PRIVATE_START + 1)
+
+struct ipu_isys_watermark_event {
+	__u32 sequence;
+	__u32 lines;
+};
+
+/*
+ * Sent on a capture video node when the firmware skipped frame @sequence
+ * on it. The buffer is reused for a later frame, or dequeued with
+ * V4L2_BUF_FLAG_ERROR if it belongs to a request. @skipped counts the
+ * skips of the node since stream on. Carried in the data field of struct
+ * v4l2_event.
+ */
+#define V4L2_EVENT_IPU_FRAME_SKIPPED	(V4L2_EVENT_PRIVATE_START + 2)
+
+struct ipu_isys_skip_event {
+	__u32 sequence;
+	__u32 skipped;
+};
 
 #define VIDIOC_IPU_GET_DRIVER_VERSION \
 	_IOWR('v', BASE_VIDIOC_PRIVATE + 3, uint32_t)
 
+#define IPU_ISYS_FRAME_CTRLS_MAX	8
+
+/*
+ * Sensor controls to set right after the start of frame @sequence, as
+ * reported by V4L2_EVENT_FRAME_SYNC on the CSI-2 receiver. A sequence
+ * already passed is set on the next frame start.
+ */
+struct ipu_isys_frame_ctrls {
+	__u32 sequence;
+	__u32 count;
+	struct {
+		__u32 id;
+		__s32 value;
+	} ctrls[IPU_ISYS_FRAME_CTRLS_MAX];
+	__u32 reserved[4];
+};
+
+#define VIDIOC_IPU_QUEUE_FRAME_CTRLS \
+	_IOW('v', BASE_VIDIOC_PRIVATE + 4, struct ipu_isys_frame_ctrls)
+
 #endif /* UAPI_LINUX_IPU_ISYS_H */
@@ -58,6 +58,14 @@ struct ipu_psys_buffer {
 #define IPU_BUFFER_FLAG_NO_FLUSH	(1 << 3)
 #define IPU_BUFFER_FLAG_DMA_HANDLE	(1 << 4)
 #define IPU_BUFFER_FLAG_USERPTR	(1 << 5)
+/*
+ * Input dma-buf also imported into an ISYS capture queue: QCMD returns at
+ * once and the command is held in the kernel until ISYS completes its next
+ * frame into the buffer. Queue the command before the buffer to ISYS.
+ * One buffer per command at most, and not on a ppg start command. The
+ * command completes with an error if the frame fails or doesn't come.
+ */
+#define IPU_BUFFER_FLAG_WAIT_ISYS	(1 << 6)
 
 #define	IPU_PSYS_CMD_PRIORITY_HIGH	0
 #define	IPU_PSYS_CMD_PRIORITY_MED	1
@@ -108,6 +116,130 @@ struct ipu_psys_manifest {
 	uint32_t reserved[5];
 } __attribute__ ((packed));
 
+/**
+ * struct ipu_psys_mapbuf_entry - one buffer of a batched map/unmap
+ * @fd:		DMA-BUF handle
+ * @status:	result for this fd set by the driver, 0 or negative errno
+ */
+struct ipu_psys_mapbuf_entry {
+	int fd;
+	int32_t status;
+	uint32_t reserved[2];
+} __attribute__ ((packed));
+
+#define IPU_PSYS_MAPBUF_BATCH_MAX	128
+
+/**
+ * struct ipu_psys_mapbuf_batch - batched IPU_IOC_MAPBUF / IPU_IOC_UNMAPBUF
+ * @count:	number of entries, at most IPU_PSYS_MAPBUF_BATCH_MAX
+ * @entries:	userspace pointer to array of map/unmap entries
+ *
+ * All entries are processed and the IPU MMU TLB is invalidated once for the
+ * whole batch. The ioctl itself fails only if the batch can't be processed,
+ * results for the individual fds are returned in the entries.
+ */
+struct ipu_psys_mapbuf_batch {
+	uint32_t count;
+	struct ipu_psys_mapbuf_entry __user *entries;
+	uint32_t reserved[4];
+} __attribute__ ((packed));
+
+#define IPU_PSYS_DQEVENTS_MAX	32
+
+/**
+ * struct ipu_psys_events - dequeue several events with IPU_IOC_DQEVENTS
+ * @count:	capacity of @events, at most IPU_PSYS_DQEVENTS_MAX; set by the
+ *		driver to the number of events dequeued
+ * @events:	userspace pointer to array of events
+ *
+ * Waits like IPU_IOC_DQEVENT for the first event unless the file is
+ * non-blocking, then returns all events that are ready up to @count.
+ */
+struct ipu_psys_events {
+	uint32_t count;
+	struct ipu_psys_event __user *events;
+	uint32_t reserved[4];
+} __attribute__ ((packed));
+
+#define IPU_PSYS_QOS_CLASS_DEFAULT	0
+#define IPU_PSYS_QOS_CLASS_REALTIME	1
+#define IPU_PSYS_QOS_CLASS_BACKGROUND	2
+#define IPU_PSYS_QOS_CLASS_NUM		3
+
+#define IPU_PSYS_QOS_SHARE_DEFAULT	1024
+
+/**
+ * struct ipu_psys_qos - scheduling class of a PSYS file handle
+ * @qos_class:		IPU_PSYS_QOS_CLASS_*
+ * @period_us:		frame period of a REALTIME handle
+ * @deadline_us:	deadline of each frame relative to its IPU_IOC_QCMD,
+ *			0 to use @period_us
+ * @share:		weight of the handle against others of its class,
+ *			0 for IPU_PSYS_QOS_SHARE_DEFAULT
+ * @frames:		frames completed with a deadline, set by the driver
+ * @missed:		frames completed late, set by the driver
+ * @busy_us:		time the commands of the handle spent in the
+ *			firmware, set by the driver
+ * @quota_pct:		cap on that time, in percent of each scheduler
+ *			window, 0 for no cap
+ * @throttled:		windows the handle was held back for going over
+ *			@quota_pct, set by the driver
+ *
+ * PPGs of REALTIME handles are started and resumed earliest deadline first
+ * and ahead of DEFAULT ones, PPGs of BACKGROUND handles are suspended first
+ * when resources are short. A PPG is never suspended for one of a lower
+ * class, or for a REALTIME one with a later deadline.
+ *
+ * Between handles of a class, the PPGs of the handle that recently used
+ * the least PSYS time relative to its @share are started first and
+ * suspended last. A handle that went over @quota_pct in the last window
+ * gets no PPG started or resumed and no buffer set queued in this one.
+ */
+struct ipu_psys_qos {
+	uint32_t qos_class;
+	uint32_t period_us;
+	uint32_t deadline_us;
+	uint32_t share;
+	uint64_t frames;
+	uint64_t missed;
+	uint64_t busy_us;
+	uint32_t quota_pct;
+	uint32_t throttled;
+} __attribute__ ((packed));
+
+/**
+ * struct ipu_psys_qcmd_record - IPU_IOC_QCMD recorded through debugfs
+ * @ns:			CLOCK_MONOTONIC time of the command
+ * @size:		size of the whole record, a multiple of 8 bytes
+ * @pid:		process that queued the command
+ * @lost:		commands dropped before this one for lack of room
+ * @priority:		as in struct ipu_psys_command
+ * @bufcount:		number of struct ipu_psys_buffer following
+ * @pg_size:		bytes of process group following the buffers
+ * @min_psys_freq:	as in struct ipu_psys_command
+ * @frame_counter:	as in struct ipu_psys_command
+ * @kernel_enable_bitmap: as in struct ipu_psys_command
+ *
+ * Reading the debugfs "qcmd_record" file of the PSYS gives one of these
+ * per command, followed by the @bufcount buffers of the command and the
+ * process group as sent to the firmware, then padding up to @size. The
+ * fds are those of the recording process; a replay substitutes buffers
+ * of the same len.
+ */
+struct ipu_psys_qcmd_record {
+	uint64_t ns;
+	uint32_t size;
+	uint32_t pid;
+	uint32_t lost;
+	uint32_t priority;
+	uint32_t bufcount;
+	uint32_t pg_size;
+	uint32_t min_psys_freq;
+	uint32_t frame_counter;
+	uint32_t kernel_enable_bitmap[4];
+	uint32_t reserved;
+} __attribute__ ((packed));
+
 #define IPU_IOC_QUERYCAP _IOR('A', 1, struct ipu_psys_capability)
 #define IPU_IOC_MAPBUF _IOWR('A', 2, int)
 #define IPU_IOC_UNMAPBUF _IOWR('A', 3, int)
@@ -117,5 +249,12 @@ struct ipu_psys_manifest {
 #define IPU_IOC_DQEVENT _IOWR('A', 7, struct ipu_psys_event)
 #define IPU_IOC_CMD_CANCEL _IOWR('A', 8, struct ipu_psys_command)
 #define IPU_IOC_GET_MANIFEST _IOWR('A', 9, struct ipu_psys_manifest)
+#define IPU_IOC_MAPBUF_BATCH _IOWR('A', 10, struct ipu_psys_mapbuf_batch)
+#define IPU_IOC_UNMAPBUF_BATCH _IOWR('A', 11, struct ipu_psys_mapbuf_batch)
+#define IPU_IOC_S_QOS _IOW('A', 12, struct ipu_psys_qos)
+#define IPU_IOC_G_QOS _IOR('A', 13, struct ipu_psys_qos)
+#define IPU_IOC_DQEVENTS _IOWR('A', 14, struct ipu_psys_events)
+/* eventfd signalled on each command completion, -1 to detach */
+#define IPU_IOC_SET_EVENTFD _IOW('A', 15, int)
 
 #endif /* _UAPI_IPU_PSYS_H */